@@ -0,0 +1,244 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+#include <qtest.h>
+
+#include "kimap2test/allocationcounter.h"
+#include "kimap2test/fakeserver.h"
+#include "kimap2/session.h"
+#include "kimap2/fetchjob.h"
+#include "imapstreamparser.h"
+#include <message_p.h>
+
+#include <QtTest>
+
+using namespace KIMAP2;
+
+/*
+ * The limits are per response and leave some headroom over what the code needs today, a
+ * change that allocates for every token of a response goes over them.
+ */
+
+static QByteArray flagsResponses(int count)
+{
+    QByteArray data;
+    for (int i = 1; i <= count; i++) {
+        data += "* " + QByteArray::number(i) + " FETCH (FLAGS (\\Seen $Forwarded) UID " + QByteArray::number(i + 1000) + ")\r\n";
+    }
+    return data;
+}
+
+static QByteArray headerResponses(int count)
+{
+    const QByteArray header("From: Joe Smith <smith@example.com>\r\nDate: Wed, 2 Mar 2011 11:33:24 +0700\r\nMessage-ID: <1234@example.com>\r\nSubject: hello\r\nTo: Jane <jane@example.com>\r\n\r\n");
+    QByteArray data;
+    for (int i = 1; i <= count; i++) {
+        data += "* " + QByteArray::number(i) + " FETCH (UID " + QByteArray::number(i + 1000) + " FLAGS (\\Seen) RFC822.SIZE 2048 BODY[HEADER.FIELDS (FROM DATE MESSAGE-ID SUBJECT TO)] {"
+                + QByteArray::number(header.size()) + "}\r\n" + header + ")\r\n";
+    }
+    return data;
+}
+
+static QByteArray bodyResponses(int count, int bodySize)
+{
+    const QByteArray body(bodySize, 'x');
+    QByteArray data;
+    for (int i = 1; i <= count; i++) {
+        data += "* " + QByteArray::number(i) + " FETCH (UID " + QByteArray::number(i + 1000) + " BODY[] {"
+                + QByteArray::number(body.size()) + "}\r\n" + body + ")\r\n";
+    }
+    return data;
+}
+
+static QList<QByteArray> toScenario(const QByteArray &responses)
+{
+    QList<QByteArray> scenario;
+    int start = 0;
+    while (start < responses.size()) {
+        // Each response ends with ")\r\n", literals never do in this data
+        const int end = responses.indexOf(")\r\n", start) + 1;
+        scenario << "S: " + responses.mid(start, end - start);
+        start = end + 2;
+    }
+    return scenario;
+}
+
+struct ParseCount {
+    qint64 allocations;
+    qint64 bytes;
+    int responses;
+};
+
+static ParseCount parse(const QByteArray &input, bool zeroCopy)
+{
+    QByteArray data = input;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+    ImapStreamParser parser(&buffer);
+    parser.setZeroCopyEnabled(zeroCopy);
+    int responses = 0;
+    parser.onResponseReceived([&responses](const Message &) {
+        responses++;
+    });
+
+    AllocationCounter counter;
+    while (parser.availableDataSize()) {
+        parser.parseStream();
+    }
+    counter.stop();
+    return {counter.allocations(), counter.bytes(), responses};
+}
+
+class AllocationTest: public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+
+    void initTestCase()
+    {
+        if (!AllocationCounter::isSupported()) {
+            QSKIP("Allocations can't be counted on this platform");
+        }
+    }
+
+    void testCounter()
+    {
+        qint64 innerAllocations = 0;
+        qint64 innerBytes = 0;
+        AllocationCounter counter;
+        QByteArray data(1000, 'x');
+        {
+            AllocationCounter inner;
+            QByteArray more(500, 'y');
+            inner.stop();
+            innerAllocations = inner.allocations();
+            innerBytes = inner.bytes();
+        }
+        counter.stop();
+        QByteArray after(100, 'z');
+
+        QCOMPARE(innerAllocations, qint64(1));
+        QVERIFY(innerBytes >= 500);
+        QCOMPARE(counter.allocations(), qint64(2));
+        QVERIFY(counter.bytes() >= 1500);
+    }
+
+    void testParseStream_data()
+    {
+        QTest::addColumn<QByteArray>("input");
+        QTest::addColumn<int>("literalBytes");
+        QTest::addColumn<double>("maxAllocations");
+        QTest::addColumn<double>("maxBytes");
+
+        QTest::newRow("flags") << flagsResponses(2000) << 0 << 16.0 << 1024.0;
+        QTest::newRow("headers") << headerResponses(2000) << 154 << 24.0 << 1536.0;
+        QTest::newRow("body literals") << bodyResponses(200, 64 * 1024) << 64 * 1024 << 16.0 << 4096.0;
+    }
+
+    void testParseStream()
+    {
+        QFETCH(QByteArray, input);
+        QFETCH(int, literalBytes);
+        QFETCH(double, maxAllocations);
+        QFETCH(double, maxBytes);
+
+        const ParseCount zeroCopy = parse(input, true);
+        QVERIFY(zeroCopy.responses > 0);
+        const double allocations = double(zeroCopy.allocations) / zeroCopy.responses;
+        const double bytes = double(zeroCopy.bytes) / zeroCopy.responses;
+        QVERIFY2(allocations <= maxAllocations, qPrintable(QString::number(allocations)));
+        QVERIFY2(bytes <= maxBytes, qPrintable(QString::number(bytes)));
+
+        // Copying the tokens costs at least the size of the literals
+        const ParseCount copied = parse(input, false);
+        QCOMPARE(copied.responses, zeroCopy.responses);
+        QVERIFY((copied.bytes - zeroCopy.bytes) / zeroCopy.responses >= literalBytes);
+    }
+
+    void testFetchJob_data()
+    {
+        QTest::addColumn<QByteArray>("responses");
+        QTest::addColumn<int>("mode");
+        QTest::addColumn<QByteArray>("items");
+        QTest::addColumn<bool>("compact");
+        QTest::addColumn<double>("maxAllocations");
+
+        QTest::newRow("flags") << flagsResponses(2000) << int(FetchJob::FetchScope::Flags) << QByteArray("(FLAGS UID)") << false << 48.0;
+        QTest::newRow("compact flags") << flagsResponses(2000) << int(FetchJob::FetchScope::Flags) << QByteArray("(FLAGS UID)") << true << 24.0;
+        QTest::newRow("compact headers") << headerResponses(2000) << int(FetchJob::FetchScope::Headers)
+                                            << QByteArray("(RFC822.SIZE INTERNALDATE BODY.PEEK[HEADER.FIELDS (FROM DATE MESSAGE-ID SUBJECT TO)] FLAGS UID)") << true << 40.0;
+    }
+
+    /*
+     * Counts everything the session thread does while the job runs, reading from the
+     * socket, parsing and handleResponse().
+     */
+    void testFetchJob()
+    {
+        QFETCH(QByteArray, responses);
+        QFETCH(int, mode);
+        QFETCH(QByteArray, items);
+        QFETCH(bool, compact);
+        QFETCH(double, maxAllocations);
+
+        FetchJob::FetchScope scope;
+        scope.mode = static_cast<FetchJob::FetchScope::Mode>(mode);
+        if (scope.mode == FetchJob::FetchScope::Headers) {
+            scope.headerFields = QList<QByteArray>() << "FROM" << "DATE" << "MESSAGE-ID" << "SUBJECT" << "TO";
+        }
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 UID FETCH 1:* " + items
+                               << toScenario(responses)
+                               << "S: A000001 OK fetch done");
+        fakeServer.startAndWait();
+
+        Session session(QStringLiteral("127.0.0.1"), 5989);
+        FetchJob *job = new FetchJob(&session);
+        job->setUidBased(true);
+        job->setSequenceSet(ImapSet(1, 0));
+        job->setScope(scope);
+
+        int results = 0;
+        if (compact) {
+            job->setCompactResultHandler([&results](QVector<FetchJob::CompactResult> &&batch) {
+                results += batch.size();
+            });
+        } else {
+            connect(job, &FetchJob::resultReceived, [&results](const FetchJob::Result &) {
+                results++;
+            });
+        }
+
+        AllocationCounter counter;
+        QVERIFY(job->exec());
+        counter.stop();
+
+        QVERIFY(results > 0);
+        const double allocations = double(counter.allocations()) / results;
+        QVERIFY2(allocations <= maxAllocations, qPrintable(QString::number(allocations)));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+};
+
+QTEST_GUILESS_MAIN(AllocationTest)
+
+#include "allocationtest.moc"
@@ -21,8 +21,10 @@
 #include "kimap2test/fakeserver.h"
 #include "kimap2/session.h"
 #include "kimap2/appendjob.h"
+#include "kimap2/statusjob.h"
 
 #include <QtTest>
+#include <QBuffer>
 #include <QDateTime>
 
 class AppendJobTest: public QObject
@@ -73,6 +75,28 @@ private Q_SLOTS:
                      << "X" ;
             QTest::newRow("Don't crash on empty response") << "INBOX" << scenario << flags << QDateTime() << QByteArray("content") << qint64(0);
         }
+        {
+            QList<QByteArray> scenario;
+            scenario << "S: * PREAUTH [CAPABILITY IMAP4rev1 LITERAL+] localhost Test Library server ready"
+                     << "C: A000001 APPEND \"INBOX\" (\\Seen) {7+}\r\ncontent"
+                     << "S: A000001 OK APPEND completed. [ APPENDUID 492 2671 ]";
+            QTest::newRow("LITERAL+") << "INBOX" << scenario << flags << QDateTime() << QByteArray("content") << qint64(2671);
+        }
+        {
+            QList<QByteArray> scenario;
+            scenario << "S: * PREAUTH [CAPABILITY IMAP4rev1 LITERAL-] localhost Test Library server ready"
+                     << "C: A000001 APPEND \"INBOX\" (\\Seen) {7+}\r\ncontent"
+                     << "S: A000001 OK APPEND completed. [ APPENDUID 492 2671 ]";
+            QTest::newRow("LITERAL-") << "INBOX" << scenario << flags << QDateTime() << QByteArray("content") << qint64(2671);
+        }
+        {
+            const QByteArray content(5000, 'x');
+            QList<QByteArray> scenario;
+            scenario << "S: * PREAUTH [CAPABILITY IMAP4rev1 LITERAL-] localhost Test Library server ready"
+                     << "C: A000001 APPEND \"INBOX\" (\\Seen) {5000}\r\n" + content
+                     << "S: A000001 OK APPEND completed. [ APPENDUID 492 2671 ]";
+            QTest::newRow("LITERAL- beyond 4096 bytes") << "INBOX" << scenario << flags << QDateTime() << content << qint64(2671);
+        }
     }
 
     void testAppend()
@@ -88,6 +112,8 @@ private Q_SLOTS:
         fakeServer.setScenario(scenario);
         fakeServer.startAndWait();
         KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        //The literal depends on the capabilities in the greeting
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
 
         KIMAP2::AppendJob *job = new KIMAP2::AppendJob(&session);
         job->setContent(content);
@@ -103,6 +129,240 @@ private Q_SLOTS:
         fakeServer.quit();
     }
 
+    void testAppendFromDevice()
+    {
+        //Spans several chunks
+        QByteArray content(150000, 'x');
+        content.replace(0, 4, "From");
+        QBuffer buffer(&content);
+        QVERIFY(buffer.open(QIODevice::ReadOnly));
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 LITERAL+] localhost Test Library server ready"
+                               << "C: A000001 APPEND \"INBOX\" {150000+}\r\n" + content
+                               << "S: A000001 OK APPEND completed. [ APPENDUID 492 2671 ]");
+        fakeServer.startAndWait();
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        KIMAP2::AppendJob *job = new KIMAP2::AppendJob(&session);
+        job->setMailBox(QStringLiteral("INBOX"));
+        job->setContent(&buffer, content.size());
+        QVERIFY(job->exec());
+        QCOMPARE(job->uid(), qint64(2671));
+        QCOMPARE(job->processedAmount(KJob::Bytes), qulonglong(content.size()));
+        QCOMPARE(job->totalAmount(KJob::Bytes), qulonglong(content.size()));
+
+        fakeServer.quit();
+    }
+
+    void testMultiAppend_data()
+    {
+        QTest::addColumn<QList<QByteArray> >("scenario");
+
+        {
+            QList<QByteArray> scenario;
+            scenario << "S: * PREAUTH [CAPABILITY IMAP4rev1 MULTIAPPEND UIDPLUS LITERAL+] localhost Test Library server ready"
+                     << "C: A000001 APPEND \"INBOX\" {5+}\r\nfirst (\\Seen) {6+}\r\nsecond \"26-Feb-2014 12:38:00 +0000\" {5+}\r\nthird"
+                     << "S: A000001 OK [APPENDUID 38505 3955:3957] APPEND completed";
+            QTest::newRow("LITERAL+") << scenario;
+        }
+        {
+            QList<QByteArray> scenario;
+            scenario << "S: * PREAUTH [CAPABILITY IMAP4rev1 MULTIAPPEND UIDPLUS] localhost Test Library server ready"
+                     << "C: A000001 APPEND \"INBOX\" {5}\r\nfirst (\\Seen) {6}\r\nsecond \"26-Feb-2014 12:38:00 +0000\" {5}\r\nthird"
+                     << "S: A000001 OK [APPENDUID 38505 3955:3957] APPEND completed";
+            QTest::newRow("continuation for each literal") << scenario;
+        }
+    }
+
+    void testMultiAppend()
+    {
+        QFETCH(QList<QByteArray>, scenario);
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        QByteArray third("third");
+        QBuffer buffer(&third);
+        QVERIFY(buffer.open(QIODevice::ReadOnly));
+
+        KIMAP2::AppendJob *job = new KIMAP2::AppendJob(&session);
+        job->setMailBox(QStringLiteral("INBOX"));
+        job->addMessage("first");
+        job->addMessage("second", QList<QByteArray>() << "\\Seen");
+        job->addMessage(&buffer, third.size(), QList<QByteArray>(), QDateTime::fromString(QStringLiteral("2014-02-26T12:38:00Z"), Qt::ISODate));
+        QVERIFY(job->exec());
+        QCOMPARE(job->uids(), KIMAP2::ImapSet(3955, 3957));
+        QCOMPARE(job->uid(), qint64(3955));
+        QCOMPARE(job->processedAmount(KJob::Bytes), qulonglong(16));
+        QCOMPARE(job->uidValidity(), qint64(38505));
+
+        //The streamed message has no content in its result
+        const QList<KIMAP2::FetchJob::Result> results = job->results();
+        QCOMPARE(results.size(), 3);
+        QCOMPARE(results.at(0).uid, qint64(3955));
+        QCOMPARE(results.at(0).rawContent, QByteArray("first"));
+        QCOMPARE(results.at(1).uid, qint64(3956));
+        QCOMPARE(results.at(1).flags, KIMAP2::MessageFlags() << "\\Seen");
+        QCOMPARE(results.at(2).uid, qint64(3957));
+        QCOMPARE(results.at(2).size, qint64(5));
+        QVERIFY(results.at(2).rawContent.isNull());
+        QCOMPARE(results.at(2).internalDate, qint64(1393418280));
+
+        fakeServer.quit();
+    }
+
+    void testResults()
+    {
+        const QByteArray content("Subject: Draft\r\nFrom: me@example.com\r\n\r\nHello\r\n");
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 UIDPLUS LITERAL+] localhost Test Library server ready"
+                               << "C: A000001 APPEND \"Drafts\" (\\Draft \\Seen) {47+}\r\n" + content
+                               << "S: A000001 OK [APPENDUID 786 45] APPEND completed"
+                              );
+        fakeServer.startAndWait();
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        KIMAP2::AppendJob *job = new KIMAP2::AppendJob(&session);
+        job->setMailBox(QStringLiteral("Drafts"));
+        job->setFlags(QList<QByteArray>() << "\\Draft" << "\\Seen");
+        job->setContent(content);
+        QVERIFY(job->results().isEmpty());
+        QVERIFY(job->exec());
+        QCOMPARE(job->uidValidity(), qint64(786));
+
+        const QList<KIMAP2::FetchJob::Result> results = job->results();
+        QCOMPARE(results.size(), 1);
+        const KIMAP2::FetchJob::Result &result = results.first();
+        QCOMPARE(result.uid, qint64(45));
+        QCOMPARE(result.size, qint64(content.size()));
+        QCOMPARE(result.internalDate, qint64(0));
+        QCOMPARE(result.flags, KIMAP2::MessageFlags() << "\\Draft" << "\\Seen");
+        QVERIFY(result.flagSet.contains("\\Seen"));
+        QCOMPARE(result.rawContent, content);
+        QCOMPARE(result.rawHeader, QByteArray("Subject: Draft\r\nFrom: me@example.com\r\n\r\n"));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testCatenate_data()
+    {
+        QTest::addColumn<QList<QByteArray> >("scenario");
+
+        {
+            QList<QByteArray> scenario;
+            scenario << "S: * PREAUTH [CAPABILITY IMAP4rev1 CATENATE UIDPLUS LITERAL+] localhost Test Library server ready"
+                     << "C: A000001 APPEND \"Drafts\" (\\Seen) CATENATE (TEXT {13+}\r\nSubject: Hi\r\n URL \"/INBOX;UIDVALIDITY=385759045/;UID=20/;SECTION=2\" TEXT {4+}\r\n--\r\n)"
+                     << "S: A000001 OK [APPENDUID 786 45] CATENATE completed";
+            QTest::newRow("LITERAL+") << scenario;
+        }
+        {
+            QList<QByteArray> scenario;
+            scenario << "S: * PREAUTH [CAPABILITY IMAP4rev1 CATENATE UIDPLUS] localhost Test Library server ready"
+                     << "C: A000001 APPEND \"Drafts\" (\\Seen) CATENATE (TEXT {13}\r\nSubject: Hi\r\n URL \"/INBOX;UIDVALIDITY=385759045/;UID=20/;SECTION=2\" TEXT {4}\r\n--\r\n)"
+                     << "S: A000001 OK [APPENDUID 786 45] CATENATE completed";
+            QTest::newRow("continuation for each literal") << scenario;
+        }
+    }
+
+    void testCatenate()
+    {
+        QFETCH(QList<QByteArray>, scenario);
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        KIMAP2::AppendJob *job = new KIMAP2::AppendJob(&session);
+        job->setMailBox(QStringLiteral("Drafts"));
+        job->setFlags(QList<QByteArray>() << "\\Seen");
+        job->addTextPart("Subject: Hi\r\n");
+        job->addUrlPart("/INBOX;UIDVALIDITY=385759045/;UID=20/;SECTION=2");
+        job->addTextPart("--\r\n");
+        QVERIFY(job->exec());
+        QCOMPARE(job->uid(), qint64(45));
+
+        fakeServer.quit();
+    }
+
+    void testCatenateUnsupported()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth());
+        fakeServer.startAndWait();
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::AppendJob *job = new KIMAP2::AppendJob(&session);
+        job->setMailBox(QStringLiteral("Drafts"));
+        job->addUrlPart("/INBOX;UIDVALIDITY=385759045/;UID=20");
+        QVERIFY(!job->exec());
+
+        fakeServer.quit();
+    }
+
+    void testMultiAppendUnsupported()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth());
+        fakeServer.startAndWait();
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::AppendJob *job = new KIMAP2::AppendJob(&session);
+        job->setMailBox(QStringLiteral("INBOX"));
+        job->setContent("first");
+        job->addMessage("second");
+        QVERIFY(!job->exec());
+
+        fakeServer.quit();
+    }
+
+    void testAppendLimit()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 LITERAL+ APPENDLIMIT=10] localhost Test Library server ready"
+                               << "C: A000001 STATUS \"Archive\" (APPENDLIMIT)"
+                               << "S: * STATUS \"Archive\" (APPENDLIMIT NIL)"
+                               << "S: A000001 OK STATUS completed"
+                               << "C: A000002 APPEND \"Archive\" {11+}\r\nlong enough"
+                               << "S: A000002 OK APPEND completed");
+        fakeServer.startAndWait();
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        //Fails without sending anything
+        KIMAP2::AppendJob *job = new KIMAP2::AppendJob(&session);
+        job->setMailBox(QStringLiteral("INBOX"));
+        job->setContent("long enough");
+        QVERIFY(!job->exec());
+
+        KIMAP2::StatusJob *statusJob = new KIMAP2::StatusJob(&session);
+        statusJob->setMailBox(QStringLiteral("Archive"));
+        statusJob->setDataItems({ "APPENDLIMIT" });
+        QVERIFY(statusJob->exec());
+        QCOMPARE(statusJob->appendLimit(), qint64(-1));
+
+        job = new KIMAP2::AppendJob(&session);
+        job->setMailBox(QStringLiteral("Archive"));
+        job->setContent("long enough");
+        QVERIFY(job->exec());
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
 };
 
 QTEST_GUILESS_MAIN(AppendJobTest)
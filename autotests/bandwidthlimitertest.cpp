@@ -0,0 +1,114 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+#include <qtest.h>
+
+#include "kimap2test/loadserver.h"
+#include "kimap2/bandwidthlimiter.h"
+#include "kimap2/fetchjob.h"
+#include "kimap2/selectjob.h"
+#include "kimap2/session.h"
+
+#include <QtTest>
+
+using namespace KIMAP2;
+
+class BandwidthLimiterTest: public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testUnlimited()
+    {
+        BandwidthLimiter limiter;
+        QCOMPARE(limiter.acquire(BandwidthLimiter::Download, BandwidthLimiter::Background, 1000000), qint64(1000000));
+        QCOMPARE(limiter.delay(BandwidthLimiter::Download, BandwidthLimiter::Background), 0);
+    }
+
+    void testBurst()
+    {
+        BandwidthLimiter limiter;
+        limiter.setRate(BandwidthLimiter::Download, BandwidthLimiter::Background, 1000, 500);
+        QCOMPARE(limiter.acquire(BandwidthLimiter::Download, BandwidthLimiter::Background, 2000), qint64(500));
+        QCOMPARE(limiter.acquire(BandwidthLimiter::Download, BandwidthLimiter::Background, 2000), qint64(0));
+        QVERIFY(limiter.delay(BandwidthLimiter::Download, BandwidthLimiter::Background) > 0);
+        //The other direction is independent
+        QCOMPARE(limiter.acquire(BandwidthLimiter::Upload, BandwidthLimiter::Background, 2000), qint64(2000));
+
+        //Unused bytes go back
+        limiter.consume(BandwidthLimiter::Download, BandwidthLimiter::Background, -100);
+        QCOMPARE(limiter.delay(BandwidthLimiter::Download, BandwidthLimiter::Background), 0);
+        QCOMPARE(limiter.acquire(BandwidthLimiter::Download, BandwidthLimiter::Background, 2000), qint64(100));
+
+        QTRY_VERIFY(limiter.acquire(BandwidthLimiter::Download, BandwidthLimiter::Background, 2000) > 0);
+    }
+
+    void testInteractiveGoesFirst()
+    {
+        BandwidthLimiter limiter;
+        limiter.setRate(BandwidthLimiter::Upload, BandwidthLimiter::Background, 1000);
+        //Interactive traffic isn't limited, but uses up the background budget
+        QCOMPARE(limiter.acquire(BandwidthLimiter::Upload, BandwidthLimiter::Interactive, 5000), qint64(5000));
+        QCOMPARE(limiter.acquire(BandwidthLimiter::Upload, BandwidthLimiter::Background, 100), qint64(0));
+        QVERIFY(limiter.delay(BandwidthLimiter::Upload, BandwidthLimiter::Background) > 0);
+
+        limiter.consume(BandwidthLimiter::Upload, BandwidthLimiter::Background, 5000);
+        QCOMPARE(limiter.delay(BandwidthLimiter::Upload, BandwidthLimiter::Interactive), 0);
+    }
+
+    void testShapedSession()
+    {
+        LoadServer::Options options;
+        options.port = 0;
+        options.messages = 20;
+        LoadServer server(options);
+        QVERIFY(server.startAndWait());
+
+        BandwidthLimiter limiter;
+        limiter.setRate(BandwidthLimiter::Download, BandwidthLimiter::Background, 2000, 200);
+        limiter.setRate(BandwidthLimiter::Upload, BandwidthLimiter::Background, 2000, 200);
+
+        Session session(QStringLiteral("127.0.0.1"), server.port());
+        session.setBandwidthLimiter(&limiter);
+        QCOMPARE(session.bandwidthLimiter(), &limiter);
+        SelectJob *select = new SelectJob(&session);
+        select->setMailBox(QStringLiteral("INBOX"));
+        QVERIFY(select->exec());
+
+        FetchJob::FetchScope scope;
+        scope.mode = FetchJob::FetchScope::Flags;
+        FetchJob *fetch = new FetchJob(&session);
+        fetch->setPriority(Job::BackgroundPriority);
+        fetch->setUidBased(true);
+        fetch->setSequenceSet(ImapSet(1, 0));
+        fetch->setScope(scope);
+        int results = 0;
+        connect(fetch, &FetchJob::resultReceived, [&results](const FetchJob::Result &) {
+            results++;
+        });
+        QElapsedTimer timer;
+        timer.start();
+        QVERIFY(fetch->exec());
+        QCOMPARE(results, 20);
+        //The responses are well beyond the burst
+        QVERIFY(session.metrics().bytesReceived > 400);
+        QVERIFY(timer.elapsed() >= 50);
+    }
+};
+
+QTEST_GUILESS_MAIN(BandwidthLimiterTest)
+
+#include "bandwidthlimitertest.moc"
@@ -0,0 +1,185 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+#include <qtest.h>
+
+#include "kimap2test/fakeserver.h"
+#include "kimap2/bodycache.h"
+#include "kimap2/copyjob.h"
+#include "kimap2/fetchjob.h"
+#include "kimap2/selectjob.h"
+#include "kimap2/session.h"
+
+#include <QtTest>
+
+using namespace KIMAP2;
+
+class BodyCacheTest: public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+
+    void testKeys()
+    {
+        FetchJob::Result result;
+        QVERIFY(BodyCache::keyOf(result).isEmpty());
+
+        result.rawHeader = "Subject: test\r\nMessage-ID:\r\n <a@example.com>\r\n\r\n";
+        result.size = 1234;
+        QCOMPARE(BodyCache::keyOf(result), BodyCache::messageIdKey(1234, "<a@example.com>"));
+
+        result.gmailMessageId = 1278455344230334865;
+        QCOMPARE(BodyCache::keyOf(result), BodyCache::gmailMessageIdKey(1278455344230334865));
+
+        result.emailId = "M6d99ac3275bb4e";
+        QCOMPARE(BodyCache::keyOf(result), BodyCache::emailIdKey("M6d99ac3275bb4e"));
+    }
+
+    void testLocations()
+    {
+        BodyCache cache;
+        cache.insert("a", "first");
+        cache.insert("b", "second");
+        cache.setLocation(QStringLiteral("INBOX"), 3, 1, "a");
+        cache.setLocation(QStringLiteral("INBOX"), 3, 3, "b");
+        QCOMPARE(cache.keyAt(QStringLiteral("INBOX"), 3, 3), QByteArray("b"));
+        //Not for another or an unknown UIDVALIDITY
+        QVERIFY(cache.keyAt(QStringLiteral("INBOX"), 4, 3).isEmpty());
+        QVERIFY(cache.keyAt(QStringLiteral("INBOX"), -1, 3).isEmpty());
+
+        ImapSet sources;
+        sources.add(QVector<ImapSet::Id>() << 1 << 2 << 3);
+        cache.addCopies(QStringLiteral("INBOX"), 3, sources, QStringLiteral("Archive"), 7, ImapSet(20, 22));
+        QCOMPARE(cache.keyAt(QStringLiteral("Archive"), 7, 20), QByteArray("a"));
+        QVERIFY(cache.keyAt(QStringLiteral("Archive"), 7, 21).isEmpty());
+        QCOMPARE(cache.keyAt(QStringLiteral("Archive"), 7, 22), QByteArray("b"));
+
+        const QHash<qint64, QByteArray> contents = cache.contents(QStringLiteral("Archive"), 7, ImapSet(1, 100));
+        QCOMPARE(contents.size(), 2);
+        QCOMPARE(contents.value(22), QByteArray("second"));
+        QCOMPARE(cache.hits(), qint64(2));
+        QVERIFY(cache.contents(QStringLiteral("Archive"), 8, ImapSet(1, 100)).isEmpty());
+
+        //A new UIDVALIDITY invalidates the UIDs
+        cache.setLocation(QStringLiteral("Archive"), 8, 30, "a");
+        QCOMPARE(cache.keyAt(QStringLiteral("Archive"), 8, 30), QByteArray("a"));
+        QVERIFY(cache.keyAt(QStringLiteral("Archive"), 7, 20).isEmpty());
+        QVERIFY(cache.keyAt(QStringLiteral("Archive"), 8, 20).isEmpty());
+        QVERIFY(cache.contains("a"));
+    }
+
+    void testFetchFromCopies()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 SELECT \"INBOX\""
+                               << "S: * OK [UIDVALIDITY 3] UIDs valid"
+                               << "S: A000001 OK [READ-WRITE] SELECT completed"
+                               << "C: A000002 UID FETCH 1:2 (BODY.PEEK[] UID)"
+                               << "S: * 1 FETCH (UID 1 BODY[] {24}\r\nMessage-ID: <a@x>\r\n\r\nA\r\n)\r\n"
+                                  "* 2 FETCH (UID 2 BODY[] {24}\r\nMessage-ID: <b@x>\r\n\r\nB\r\n)\r\n"
+                                  "A000002 OK fetch done"
+                               << "C: A000003 UID COPY 1:2 \"Archive\""
+                               << "S: A000003 OK [COPYUID 7 1:2 10:11] COPY completed"
+                               << "C: A000004 SELECT \"Archive\""
+                               << "S: * OK [UIDVALIDITY 7] UIDs valid"
+                               << "S: A000004 OK [READ-WRITE] SELECT completed"
+                               << "C: A000005 UID FETCH 12 (BODY.PEEK[] UID)"
+                               << "S: * 3 FETCH (UID 12 BODY[] {24}\r\nMessage-ID: <c@x>\r\n\r\nC\r\n)\r\n"
+                                  "A000005 OK fetch done"
+                               << "C: A000006 UID FETCH 10:11 (UID)"
+                               << "S: * 1 FETCH (UID 10)\r\n"
+                                  "* 2 FETCH (UID 11)\r\n"
+                                  "A000006 OK fetch done"
+                               << "C: A000007 SELECT \"INBOX\""
+                               << "S: * OK [UIDVALIDITY 4] UIDs valid"
+                               << "S: A000007 OK [READ-WRITE] SELECT completed"
+                               << "C: A000008 UID FETCH 2 (BODY.PEEK[] UID)"
+                               << "S: * 1 FETCH (UID 2 BODY[] {24}\r\nMessage-ID: <d@x>\r\n\r\nD\r\n)\r\n"
+                                  "A000008 OK fetch done"
+                              );
+        fakeServer.startAndWait();
+
+        Session session(QStringLiteral("127.0.0.1"), 5989);
+        BodyCache cache;
+
+        SelectJob *select = new SelectJob(&session);
+        select->setMailBox(QStringLiteral("INBOX"));
+        QVERIFY(select->exec());
+
+        FetchJob *fetch = new FetchJob(&session);
+        fetch->setUidBased(true);
+        fetch->setSequenceSet(ImapSet(1, 2));
+        fetch->setRawResults(true);
+        fetch->setBodyCache(&cache);
+        QVERIFY(fetch->exec());
+        QCOMPARE(cache.keyAt(QStringLiteral("INBOX"), 3, 2), BodyCache::messageIdKey(24, "<b@x>"));
+
+        CopyJob *copy = new CopyJob(&session);
+        copy->setUidBased(true);
+        copy->setSequenceSet(ImapSet(1, 2));
+        copy->setMailBox(QStringLiteral("Archive"));
+        copy->setBodyCache(&cache);
+        QVERIFY(copy->exec());
+
+        select = new SelectJob(&session);
+        select->setMailBox(QStringLiteral("Archive"));
+        QVERIFY(select->exec());
+
+        fetch = new FetchJob(&session);
+        fetch->setUidBased(true);
+        fetch->setSequenceSet(ImapSet(10, 12));
+        fetch->setRawResults(true);
+        fetch->setBodyCache(&cache);
+        QMap<qint64, QByteArray> contents;
+        connect(fetch, &FetchJob::resultReceived, [&contents](const FetchJob::Result &result) {
+            contents.insert(result.uid, result.rawContent);
+        });
+        QVERIFY(fetch->exec());
+        QCOMPARE(contents.size(), 3);
+        QCOMPARE(contents.value(10), QByteArray("Message-ID: <a@x>\r\n\r\nA\r\n"));
+        QCOMPARE(contents.value(11), QByteArray("Message-ID: <b@x>\r\n\r\nB\r\n"));
+        QCOMPARE(contents.value(12), QByteArray("Message-ID: <c@x>\r\n\r\nC\r\n"));
+        QCOMPARE(cache.hits(), qint64(2));
+
+        //UID 2 is another message once INBOX has another UIDVALIDITY
+        select = new SelectJob(&session);
+        select->setMailBox(QStringLiteral("INBOX"));
+        QVERIFY(select->exec());
+
+        fetch = new FetchJob(&session);
+        fetch->setUidBased(true);
+        fetch->setSequenceSet(ImapSet(2));
+        fetch->setRawResults(true);
+        fetch->setBodyCache(&cache);
+        QByteArray content;
+        connect(fetch, &FetchJob::resultReceived, [&content](const FetchJob::Result &result) {
+            content = result.rawContent;
+        });
+        QVERIFY(fetch->exec());
+        QCOMPARE(content, QByteArray("Message-ID: <d@x>\r\n\r\nD\r\n"));
+        QCOMPARE(cache.hits(), qint64(2));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+};
+
+QTEST_GUILESS_MAIN(BodyCacheTest)
+
+#include "bodycachetest.moc"
@@ -0,0 +1,140 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+#include <qtest.h>
+
+#include "kimap2/bodystructure.h"
+
+#include <kmime/kmime_content.h>
+
+#include <QtTest>
+
+using namespace KIMAP2;
+
+class BodyStructureTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testSinglePart()
+    {
+        const BodyStructure structure = BodyStructure::fromImapList(
+            "(\"TEXT\" \"PLAIN\" (\"CHARSET\" \"ISO-8859-1\" \"NAME\" \"a \\\"b\\\".txt\") NIL \"Some text\" \"7BIT\" 5 1 NIL (\"INLINE\" NIL) NIL)");
+        QVERIFY(structure.isValid());
+        QVERIFY(!structure.isMultipart());
+        QCOMPARE(structure.partId(), QByteArray("1"));
+        QCOMPARE(structure.type(), QByteArray("TEXT"));
+        QCOMPARE(structure.subType(), QByteArray("PLAIN"));
+        QCOMPARE(structure.parameter("charset"), QByteArray("ISO-8859-1"));
+        QCOMPARE(structure.parameter("NAME"), QByteArray("a \"b\".txt"));
+        QVERIFY(structure.parameter("BOUNDARY").isNull());
+        QVERIFY(structure.id().isNull());
+        QCOMPARE(structure.description(), QByteArray("Some text"));
+        QCOMPARE(structure.encoding(), QByteArray("7BIT"));
+        QCOMPARE(structure.size(), qint64(5));
+        QCOMPARE(structure.lines(), qint64(1));
+        QCOMPARE(structure.disposition(), QByteArray("INLINE"));
+        QCOMPARE(structure.childCount(), 0);
+    }
+
+    void testMultipart()
+    {
+        const BodyStructure structure = BodyStructure::fromImapList(
+            "(((\"TEXT\" \"PLAIN\" (\"CHARSET\" \"UTF-8\") NIL NIL \"7BIT\" 72 4 NIL NIL NIL)(\"TEXT\" \"HTML\" (\"CHARSET\" \"UTF-8\") NIL NIL \"QUOTED-PRINTABLE\" 281 5 NIL NIL NIL) \"ALTERNATIVE\" (\"BOUNDARY\" \"0001\") NIL NIL)"
+            "(\"IMAGE\" \"JPEG\" (\"NAME\" \"photo.jpg\") \"<id@host>\" NIL \"BASE64\" 53338 NIL (\"ATTACHMENT\" (\"FILENAME\" \"photo.jpg\")) NIL) \"MIXED\" (\"BOUNDARY\" \"0002\") NIL NIL)");
+        QVERIFY(structure.isValid());
+        QVERIFY(structure.isMultipart());
+        QCOMPARE(structure.partId(), QByteArray());
+        QCOMPARE(structure.type(), QByteArray("MULTIPART"));
+        QCOMPARE(structure.subType(), QByteArray("MIXED"));
+        QCOMPARE(structure.parameter("BOUNDARY"), QByteArray("0002"));
+        QCOMPARE(structure.size(), qint64(-1));
+        QCOMPARE(structure.childCount(), 2);
+
+        const BodyStructure alternative = structure.child(0);
+        QCOMPARE(alternative.partId(), QByteArray("1"));
+        QCOMPARE(alternative.subType(), QByteArray("ALTERNATIVE"));
+        QCOMPARE(alternative.childCount(), 2);
+        QCOMPARE(alternative.child(0).partId(), QByteArray("1.1"));
+        QCOMPARE(alternative.child(1).partId(), QByteArray("1.2"));
+        QCOMPARE(alternative.child(1).encoding(), QByteArray("QUOTED-PRINTABLE"));
+        QCOMPARE(alternative.child(1).lines(), qint64(5));
+
+        const BodyStructure image = structure.child(1);
+        QCOMPARE(image.partId(), QByteArray("2"));
+        QCOMPARE(image.id(), QByteArray("<id@host>"));
+        QCOMPARE(image.size(), qint64(53338));
+        QCOMPARE(image.lines(), qint64(-1));
+        QCOMPARE(image.disposition(), QByteArray("ATTACHMENT"));
+        QCOMPARE(image.dispositionParameter("filename"), QByteArray("photo.jpg"));
+
+        QVERIFY(!structure.child(2).isValid());
+    }
+
+    void testEncapsulatedMessage()
+    {
+        const BodyStructure structure = BodyStructure::fromImapList(
+            "((\"TEXT\" \"PLAIN\" NIL NIL NIL \"7BIT\" 10 1)"
+            "(\"MESSAGE\" \"RFC822\" NIL NIL NIL \"7BIT\" 300 (\"date\" \"subject\" NIL NIL NIL NIL NIL NIL NIL \"<id>\")"
+            " ((\"TEXT\" \"PLAIN\" NIL NIL NIL \"7BIT\" 10 1)(\"TEXT\" \"HTML\" NIL NIL NIL \"7BIT\" 20 1) \"ALTERNATIVE\") 12)"
+            " \"MIXED\")");
+        QVERIFY(structure.isValid());
+        const BodyStructure message = structure.child(1);
+        QCOMPARE(message.partId(), QByteArray("2"));
+        QCOMPARE(message.lines(), qint64(12));
+        QCOMPARE(message.childCount(), 1);
+        const BodyStructure body = message.child(0);
+        QVERIFY(body.isMultipart());
+        QCOMPARE(body.partId(), QByteArray("2"));
+        QCOMPARE(body.child(0).partId(), QByteArray("2.1"));
+        QCOMPARE(body.child(1).partId(), QByteArray("2.2"));
+    }
+
+    void testLiteral()
+    {
+        const BodyStructure structure = BodyStructure::fromImapList(
+            "(\"APPLICATION\" \"OCTET-STREAM\" (\"NAME\" {9}\r\nfoo (1).x) NIL NIL \"BASE64\" 42 NIL NIL NIL)");
+        QVERIFY(structure.isValid());
+        QCOMPARE(structure.parameter("NAME"), QByteArray("foo (1).x"));
+        QCOMPARE(structure.size(), qint64(42));
+    }
+
+    void testMalformed()
+    {
+        QVERIFY(!BodyStructure::fromImapList("").isValid());
+        QVERIFY(!BodyStructure::fromImapList("NIL").isValid());
+        QVERIFY(!BodyStructure::fromImapList("(\"TEXT\" \"PLAIN\" NIL NIL NIL \"7BIT\"").isValid());
+        QVERIFY(!BodyStructure::fromImapList("(\"TEXT\" \"PLAIN\" NIL NIL NIL \"7BIT\" many 1)").isValid());
+    }
+
+    void testToContent()
+    {
+        const BodyStructure structure = BodyStructure::fromImapList(
+            "((\"TEXT\" \"PLAIN\" (\"CHARSET\" \"UTF-8\") NIL NIL \"7BIT\" 72 4 NIL NIL NIL)"
+            "(\"IMAGE\" \"JPEG\" NIL NIL NIL \"BASE64\" 53338 NIL (\"ATTACHMENT\" (\"FILENAME\" \"photo.jpg\")) NIL) \"MIXED\" (\"BOUNDARY\" \"0002\") NIL NIL)");
+        QScopedPointer<KMime::Content> content(structure.toContent());
+        QCOMPARE(content->contentType()->mimeType().toLower(), QByteArray("multipart/mixed"));
+        QCOMPARE(content->contentType()->boundary(), QByteArray("0002"));
+        QCOMPARE(content->contents().size(), 2);
+        QCOMPARE(content->contents().at(0)->contentType()->mimeType().toLower(), QByteArray("text/plain"));
+        QCOMPARE(content->contents().at(1)->contentDisposition()->disposition(), KMime::Headers::CDattachment);
+        QCOMPARE(content->contents().at(1)->contentDisposition()->filename(), QStringLiteral("photo.jpg"));
+    }
+};
+
+QTEST_GUILESS_MAIN(BodyStructureTest)
+
+#include "bodystructuretest.moc"
@@ -24,6 +24,7 @@
 #include "kimap2test/fakeserver.h"
 #include "kimap2/session.h"
 #include "kimap2/capabilitiesjob.h"
+#include "kimap2/loginjob.h"
 
 #include <QtTest>
 
@@ -86,6 +87,61 @@ private Q_SLOTS:
         fakeServer.quit();
     }
 
+    void testKnownCapabilities()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 IDLE] localhost Test Library server ready"
+                               << "C: A000001 NOOP"
+                               << "S: A000001 OK noop done");
+        fakeServer.startAndWait();
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        //Taken from the greeting without sending CAPABILITY
+        KIMAP2::CapabilitiesJob *job = new KIMAP2::CapabilitiesJob(&session);
+        QSignalSpy spy(job, &KIMAP2::CapabilitiesJob::capabilitiesReceived);
+        QVERIFY(job->exec());
+        QCOMPARE(job->capabilities(), QStringList() << QStringLiteral("IMAP4REV1") << QStringLiteral("IDLE"));
+        QCOMPARE(spy.count(), 1);
+
+        bool done = false;
+        session.sendCommand("NOOP", QByteArray(), [&done](const KIMAP2::CommandResult &) {
+            done = true;
+        });
+        QTRY_VERIFY(done);
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testCapabilitiesAfterLogin()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * OK [CAPABILITY IMAP4rev1 AUTH=PLAIN] localhost Test Library server ready"
+                               << "C: A000001 LOGIN \"user\" \"password\""
+                               << "S: A000001 OK User logged in"
+                               << "C: A000002 CAPABILITY"
+                               << "S: * CAPABILITY IMAP4rev1 IDLE"
+                               << "S: A000002 OK capability done");
+        fakeServer.startAndWait();
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::LoginJob *login = new KIMAP2::LoginJob(&session);
+        login->setUserName(QStringLiteral("user"));
+        login->setPassword(QStringLiteral("password"));
+        QVERIFY(login->exec());
+
+        //The capabilities from the greeting don't hold once logged in
+        KIMAP2::CapabilitiesJob *job = new KIMAP2::CapabilitiesJob(&session);
+        QVERIFY(job->exec());
+        QCOMPARE(job->capabilities(), QStringList() << QStringLiteral("IMAP4REV1") << QStringLiteral("IDLE"));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
 };
 
 QTEST_GUILESS_MAIN(CapabilitiesJobTest)
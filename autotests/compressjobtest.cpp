@@ -0,0 +1,160 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+#include <qtest.h>
+
+#include "kimap2test/fakeserver.h"
+#include "kimap2/session.h"
+#include "kimap2/capabilitiesjob.h"
+#include "kimap2/compressjob.h"
+
+#include <QtTest>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+#include <zlib.h>
+
+/**
+ * Answers COMPRESS DEFLATE and a compressed CAPABILITY, which FakeServer can't.
+ */
+class DeflateServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    DeflateServer()
+        : client(Q_NULLPTR), compressed(false)
+    {
+        memset(&inflater, 0, sizeof(inflater));
+        memset(&deflater, 0, sizeof(deflater));
+        inflateInit2(&inflater, -15);
+        deflateInit2(&deflater, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+        connect(&server, &QTcpServer::newConnection, this, [this]() {
+            client = server.nextPendingConnection();
+            connect(client, &QIODevice::readyRead, this, &DeflateServer::readClient);
+            client->write("* PREAUTH localhost Test Library server ready\r\n");
+        });
+        server.listen(QHostAddress(QHostAddress::LocalHost), 5989);
+    }
+
+    ~DeflateServer()
+    {
+        inflateEnd(&inflater);
+        deflateEnd(&deflater);
+    }
+
+    QList<QByteArray> received;
+
+private:
+    void readClient()
+    {
+        QByteArray data = client->readAll();
+        if (compressed) {
+            data = transform(&inflater, data, false);
+        }
+        buffer += data;
+        int end;
+        while ((end = buffer.indexOf("\r\n")) >= 0) {
+            const QByteArray line = buffer.left(end);
+            buffer.remove(0, end + 2);
+            received << line;
+            if (line == "A000001 COMPRESS DEFLATE") {
+                client->write("A000001 OK DEFLATE active\r\n");
+                compressed = true;
+            } else if (line == "A000002 CAPABILITY") {
+                client->write(transform(&deflater, "* CAPABILITY IMAP4rev1 COMPRESS=DEFLATE\r\n"
+                                        "A000002 OK CAPABILITY completed\r\n", true));
+            }
+        }
+    }
+
+    static QByteArray transform(z_stream *stream, const QByteArray &input, bool compress)
+    {
+        QByteArray output;
+        char chunk[4096];
+        stream->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(input.constData()));
+        stream->avail_in = input.size();
+        do {
+            stream->next_out = reinterpret_cast<Bytef *>(chunk);
+            stream->avail_out = sizeof(chunk);
+            if (compress) {
+                deflate(stream, Z_SYNC_FLUSH);
+            } else {
+                inflate(stream, Z_SYNC_FLUSH);
+            }
+            output.append(chunk, sizeof(chunk) - stream->avail_out);
+        } while (stream->avail_out == 0);
+        return output;
+    }
+
+    QTcpServer server;
+    QTcpSocket *client;
+    QByteArray buffer;
+    bool compressed;
+    z_stream inflater;
+    z_stream deflater;
+};
+
+class CompressJobTest: public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+
+    void testCompress()
+    {
+        DeflateServer server;
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::CompressJob *compress = new KIMAP2::CompressJob(&session);
+        QVERIFY(compress->exec());
+
+        KIMAP2::CapabilitiesJob *capabilities = new KIMAP2::CapabilitiesJob(&session);
+        QVERIFY(capabilities->exec());
+        QCOMPARE(capabilities->capabilities(), QStringList() << QStringLiteral("IMAP4REV1") << QStringLiteral("COMPRESS=DEFLATE"));
+        QCOMPARE(server.received, QList<QByteArray>() << "A000001 COMPRESS DEFLATE" << "A000002 CAPABILITY");
+    }
+
+    void testCompressRejected()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 COMPRESS DEFLATE"
+                               << "S: A000001 NO [COMPRESSIONACTIVE] DEFLATE active via TLS"
+                               << "C: A000002 CAPABILITY"
+                               << "S: * CAPABILITY IMAP4rev1"
+                               << "S: A000002 OK CAPABILITY completed"
+                              );
+        fakeServer.startAndWait();
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::CompressJob *compress = new KIMAP2::CompressJob(&session);
+        QVERIFY(!compress->exec());
+
+        //Without compression we keep talking in plain text
+        KIMAP2::CapabilitiesJob *capabilities = new KIMAP2::CapabilitiesJob(&session);
+        QVERIFY(capabilities->exec());
+        QCOMPARE(capabilities->capabilities(), QStringList() << QStringLiteral("IMAP4REV1"));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+};
+
+QTEST_GUILESS_MAIN(CompressJobTest)
+
+#include "compressjobtest.moc"
@@ -0,0 +1,148 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+#include <qtest.h>
+
+#include "kimap2test/fakeserver.h"
+#include "kimap2/session.h"
+#include "kimap2/downloadjob.h"
+
+#include <QtTest>
+
+class DownloadJobTest: public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+
+    void testDownload()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 UID FETCH 7 (BODY.PEEK[]<0.5> RFC822.SIZE)"
+                               << "S: * 1 FETCH (UID 7 RFC822.SIZE 12 BODY[]<0> {5}\r\nHello)"
+                               << "S: A000001 OK fetch done"
+                               << "C: A000002 UID FETCH 7 (BODY.PEEK[]<5.5>)"
+                               << "S: * 1 FETCH (UID 7 BODY[]<5> {5}\r\n Worl)"
+                               << "S: A000002 OK fetch done"
+                               << "C: A000003 UID FETCH 7 (BODY.PEEK[]<10.5>)"
+                               << "S: * 1 FETCH (UID 7 BODY[]<10> \"d!\")"
+                               << "S: A000003 OK fetch done"
+                               << "C: A000004 UID FETCH 7 (BODY.PEEK[]<15.5>)"
+                               << "S: * 1 FETCH (UID 7 BODY[]<15> \"\")"
+                               << "S: A000004 OK fetch done"
+                              );
+        fakeServer.startAndWait();
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::DownloadJob *job = new KIMAP2::DownloadJob(&session);
+        job->setUid(7);
+        job->setRangeSize(5);
+        QVERIFY(job->exec());
+        QCOMPARE(job->data(), QByteArray("Hello World!"));
+        QCOMPARE(job->offset(), qint64(12));
+        QCOMPARE(job->totalAmount(KJob::Bytes), qulonglong(12));
+        QCOMPARE(job->processedAmount(KJob::Bytes), qulonglong(12));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testResume()
+    {
+        qint64 offset = 0;
+        QByteArray data;
+        {
+            FakeServer fakeServer;
+            fakeServer.setScenario(QList<QByteArray>()
+                                   << FakeServer::preauth()
+                                   << "C: A000001 UID FETCH 7 (BODY.PEEK[1]<0.100>)"
+                                   << "S: * 1 FETCH (UID 7 BODY[1]<0> {13}\r\nHello"
+                                   << "X"
+                                  );
+            fakeServer.startAndWait();
+            KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+            KIMAP2::DownloadJob *job = new KIMAP2::DownloadJob(&session);
+            job->setUid(7);
+            job->setPart("1");
+            job->setRangeSize(100);
+            job->setMaximumPendingRanges(1);
+            job->setSink([&data](const char *chunk, int size) {
+                data.append(chunk, size);
+            });
+            QVERIFY(!job->exec());
+            offset = job->offset();
+            fakeServer.quit();
+        }
+        //What arrived before the connection was lost
+        QCOMPARE(data, QByteArray("Hello\r\n"));
+        QCOMPARE(offset, qint64(7));
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 UID FETCH 7 (BODY.PEEK[1]<7.100>)"
+                               << "S: * 1 FETCH (UID 7 BODY[1]<7> {6}\r\nWorld!)"
+                               << "S: A000001 OK fetch done"
+                              );
+        fakeServer.startAndWait();
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::DownloadJob *job = new KIMAP2::DownloadJob(&session);
+        job->setUid(7);
+        job->setPart("1");
+        job->setRangeSize(100);
+        job->setMaximumPendingRanges(1);
+        job->setOffset(offset);
+        job->setSink([&data](const char *chunk, int size) {
+            data.append(chunk, size);
+        });
+        QVERIFY(job->exec());
+        QCOMPARE(data, QByteArray("Hello\r\nWorld!"));
+        QCOMPARE(job->offset(), qint64(13));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testMessageNotFound()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 UID FETCH 7 (BODY.PEEK[]<0.100> RFC822.SIZE)"
+                               << "S: A000001 OK fetch done"
+                              );
+        fakeServer.startAndWait();
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::DownloadJob *job = new KIMAP2::DownloadJob(&session);
+        job->setUid(7);
+        job->setRangeSize(100);
+        job->setMaximumPendingRanges(1);
+        QVERIFY(!job->exec());
+        QCOMPARE(job->error(), int(KIMAP2::CommandFailed));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+};
+
+QTEST_GUILESS_MAIN(DownloadJobTest)
+
+#include "downloadjobtest.moc"
@@ -0,0 +1,179 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+#include <qtest.h>
+
+#include "kimap2test/fakeserver.h"
+#include "kimap2/session.h"
+#include "kimap2/enablejob.h"
+#include "kimap2/listjob.h"
+#include "kimap2/searchjob.h"
+#include "kimap2/selectjob.h"
+
+#include <QtTest>
+
+class EnableJobTest: public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testEnable()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 ENABLE] localhost Test Library server ready"
+                               << "C: A000001 ENABLE CONDSTORE X-UNKNOWN"
+                               << "S: * ENABLED CONDSTORE"
+                               << "S: A000001 OK enabled");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        KIMAP2::EnableJob *job = new KIMAP2::EnableJob(&session);
+        job->setExtensions(QList<QByteArray>() << "CONDSTORE" << "X-UNKNOWN");
+        QVERIFY(job->exec());
+        QCOMPARE(job->enabledExtensions(), QList<QByteArray>() << "CONDSTORE");
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testEnableUnsupported()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1] localhost Test Library server ready");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        KIMAP2::EnableJob *job = new KIMAP2::EnableJob(&session);
+        job->setExtensions(QList<QByteArray>() << "UTF8=ACCEPT");
+        QVERIFY(!job->exec());
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testUtf8Accept()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 ENABLE UTF8=ACCEPT] localhost Test Library server ready"
+                               << "C: A000001 ENABLE UTF8=ACCEPT"
+                               << "S: * ENABLED UTF8=ACCEPT"
+                               << "S: A000001 OK enabled"
+                               << "C: A000002 LIST \"\" *"
+                               << "S: * LIST ( \\HasNoChildren ) / \"Entwürfe\""
+                               << "S: * LIST ( \\HasNoChildren ) / \"Tom & Jerry\""
+                               << "S: A000002 OK list done"
+                               << "C: A000003 SELECT \"Entwürfe\""
+                               << "S: A000003 OK [READ-WRITE] select done");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        KIMAP2::EnableJob *job = new KIMAP2::EnableJob(&session);
+        job->setExtensions(QList<QByteArray>() << "UTF8=ACCEPT");
+        QVERIFY(job->exec());
+
+        KIMAP2::ListJob *list = new KIMAP2::ListJob(&session);
+        list->setOption(KIMAP2::ListJob::IncludeUnsubscribed);
+        QStringList names;
+        connect(list, &KIMAP2::ListJob::resultReceived, [&](const KIMAP2::MailBoxDescriptor &descriptor, const QList<QByteArray> &) {
+            names << descriptor.name;
+        });
+        QVERIFY(list->exec());
+        QCOMPARE(names, QStringList() << QString::fromUtf8("Entwürfe") << QStringLiteral("Tom & Jerry"));
+
+        KIMAP2::SelectJob *select = new KIMAP2::SelectJob(&session);
+        select->setMailBox(QString::fromUtf8("Entwürfe"));
+        QVERIFY(select->exec());
+        QCOMPARE(session.selectedMailBox(), QString::fromUtf8("Entwürfe"));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testImap4Rev2()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 IMAP4rev2 ENABLE] localhost Test Library server ready"
+                               //Still IMAP4rev1
+                               << "C: A000001 LSUB \"\" *"
+                               << "S: * LSUB () / \"Entw&APw-rfe\""
+                               << "S: A000001 OK lsub done"
+                               << "C: A000002 ENABLE IMAP4rev2"
+                               << "S: * ENABLED IMAP4rev2"
+                               << "S: A000002 OK enabled"
+                               << "C: A000003 LIST (SUBSCRIBED) \"\" *"
+                               << "S: * LIST (\\Subscribed) \"/\" \"Entwürfe\""
+                               << "S: * LIST (\\Subscribed) \"/\" \"Tom & Jerry\""
+                               << "S: A000003 OK list done"
+                               << "C: A000004 SELECT \"Entwürfe\""
+                               << "S: A000004 OK [READ-WRITE] select done"
+                               << "C: A000005 UID SEARCH NOT SEEN"
+                               << "S: * ESEARCH (TAG \"A000005\") UID ALL 2,10:11"
+                               << "S: A000005 OK search done");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        QStringList names;
+        auto collect = [&](const KIMAP2::MailBoxDescriptor &descriptor, const QList<QByteArray> &) {
+            names << descriptor.name;
+        };
+        KIMAP2::ListJob *list = new KIMAP2::ListJob(&session);
+        connect(list, &KIMAP2::ListJob::resultReceived, collect);
+        QVERIFY(list->exec());
+        QCOMPARE(names, QStringList() << QString::fromUtf8("Entwürfe"));
+
+        KIMAP2::EnableJob *job = new KIMAP2::EnableJob(&session);
+        job->setExtensions(QList<QByteArray>() << "IMAP4rev2");
+        QVERIFY(job->exec());
+
+        names.clear();
+        list = new KIMAP2::ListJob(&session);
+        connect(list, &KIMAP2::ListJob::resultReceived, collect);
+        QVERIFY(list->exec());
+        QCOMPARE(names, QStringList() << QString::fromUtf8("Entwürfe") << QStringLiteral("Tom & Jerry"));
+
+        KIMAP2::SelectJob *select = new KIMAP2::SelectJob(&session);
+        select->setMailBox(QString::fromUtf8("Entwürfe"));
+        QVERIFY(select->exec());
+        QCOMPARE(select->firstUnseenIndex(), -1);
+
+        //Every SEARCH is answered with ESEARCH
+        KIMAP2::SearchJob *search = new KIMAP2::SearchJob(&session);
+        search->setUidBased(true);
+        search->setTerm(KIMAP2::Term(KIMAP2::Term::Seen).setNegated(true));
+        QVERIFY(search->exec());
+        QCOMPARE(search->results(), QVector<qint64>() << 2 << 10 << 11);
+        QCOMPARE(search->resultCount(), qint64(3));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+};
+
+QTEST_GUILESS_MAIN(EnableJobTest)
+
+#include "enablejobtest.moc"
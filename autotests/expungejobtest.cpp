@@ -82,6 +82,71 @@ private Q_SLOTS:
         fakeServer.quit();
     }
 
+    void testExpungedSequenceNumbers()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 EXPUNGE"
+                               << "S: * 3 EXPUNGE"
+                               << "S: * 3 EXPUNGE"
+                               << "S: * 5 EXPUNGE"
+                               << "S: * 1 EXPUNGE"
+                               << "S: A000001 OK EXPUNGE completed");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::ExpungeJob *job = new KIMAP2::ExpungeJob(&session);
+        QSignalSpy spy(job, &KIMAP2::ExpungeJob::expunged);
+        QVERIFY(job->exec());
+        QCOMPARE(spy.count(), 4);
+        // 3 and 4 went first, so the 5 was a 7 before
+        QCOMPARE(job->expungedSequenceNumbers().toImapSequenceSet(), QByteArray("1,3:4,7"));
+
+        fakeServer.quit();
+    }
+
+    void testUidExpunge()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 UIDPLUS QRESYNC] localhost Test Library server ready"
+                               << "C: A000001 UID EXPUNGE 3000:3002,3010"
+                               << "S: * VANISHED 3000:3001"
+                               << "S: * VANISHED 3010"
+                               << "S: A000001 OK EXPUNGE completed");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::ExpungeJob *job = new KIMAP2::ExpungeJob(&session);
+        job->setUidSet(KIMAP2::ImapSet::fromImapSequenceSet("3010,3000:3002"));
+        QSignalSpy spy(job, &KIMAP2::ExpungeJob::vanished);
+        QVERIFY(job->exec());
+        QCOMPARE(spy.count(), 2);
+        QCOMPARE(job->vanishedUids().toImapSequenceSet(), QByteArray("3000:3001,3010"));
+        QVERIFY(job->expungedSequenceNumbers().isEmpty());
+
+        fakeServer.quit();
+    }
+
+    void testUidExpungeUnsupported()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth());
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::ExpungeJob *job = new KIMAP2::ExpungeJob(&session);
+        job->setUidSet(KIMAP2::ImapSet(3000));
+        QVERIFY(!job->exec());
+
+        fakeServer.quit();
+    }
+
 };
 
 QTEST_GUILESS_MAIN(ExpungeJobTest)
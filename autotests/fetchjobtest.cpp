@@ -21,7 +21,11 @@
 
 #include "kimap2test/fakeserver.h"
 #include "kimap2/session.h"
+#include "kimap2/enablejob.h"
 #include "kimap2/fetchjob.h"
+#include "kimap2/selectjob.h"
+#include "kimap2/resultarena.h"
+#include "kimap2/storejob.h"
 
 #include <QtTest>
 
@@ -155,6 +159,18 @@ private Q_SLOTS:
         scope.changedSince = 123456789;
         QTest::newRow("fetch large payload") << false << KIMAP2::ImapSet(11, 11) << 1
                                             << scenario << scope;
+
+        scenario.clear();
+        scenario << FakeServer::preauth()
+                 << "C: A000001 FETCH 11 (RFC822.SIZE INTERNALDATE BODY.PEEK[HEADER.FIELDS (FROM CC LIST-ID X-PRIORITY)] FLAGS UID)"
+                 << "S: * 11 FETCH (UID 123 RFC822.SIZE 770 INTERNALDATE \"11-Oct-2010 03:33:50 +0100\" BODY[HEADER.FIELDS (FROM CC LIST-ID X-PRIORITY)] {89}"
+                 << "S: From: John Smith <john@example.com>\r\nCc: jane@example.com\r\nList-Id: <kde.example.com>\r\n\r\n FLAGS ())"
+                 << "S: A000001 OK fetch done";
+        scope.mode = KIMAP2::FetchJob::FetchScope::Headers;
+        scope.changedSince = 0;
+        scope.headerFields << "FROM" << "CC" << "LIST-ID" << "X-PRIORITY";
+        QTest::newRow("custom header fields") << false << KIMAP2::ImapSet(11, 11) << 1
+                                              << scenario << scope;
     }
 
     void testFetch()
@@ -312,6 +328,1297 @@ private Q_SLOTS:
         m_attrs.clear();
     }
 
+    void testFetchRawResults()
+    {
+        QList<QByteArray> scenario;
+        scenario << FakeServer::preauth()
+                 << "C: A000001 FETCH 2 (BODY.PEEK[HEADER.FIELDS (TO FROM MESSAGE-ID REFERENCES IN-REPLY-TO SUBJECT DATE)] BODY.PEEK[1.1.1.MIME] BODY.PEEK[1.1.1] FLAGS UID)"
+                 << "S: * 2 FETCH (UID 20 FLAGS (\\Seen) BODY[HEADER.FIELDS (TO FROM MESSAGE-ID REFERENCES IN-REPLY-TO SUBJECT DATE)] {154}\r\nFrom: Joe Smith <smith@example.com>\r\nDate: Wed, 2 Mar 2011 11:33:24 +0700\r\nMessage-ID: <1234@example.com>\r\nSubject: hello\r\nTo: Jane <jane@example.com>\r\n\r\n BODY[1.1.1] {28}\r\nHi Jane, nice to meet you!\r\n BODY[1.1.1.MIME] {48}\r\nContent-Type: text/plain; charset=ISO-8859-1\r\n\r\n)\r\n"
+                 << "S: A000001 OK fetch done";
+
+        KIMAP2::FetchJob::FetchScope scope;
+        scope.mode = KIMAP2::FetchJob::FetchScope::HeaderAndContent;
+        scope.parts.clear();
+        scope.parts.append("1.1.1");
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::FetchJob *job = new KIMAP2::FetchJob(&session);
+        job->setUidBased(false);
+        job->setSequenceSet(KIMAP2::ImapSet(2, 2));
+        job->setScope(scope);
+        job->setRawResults(true);
+        QList<FetchJob::Result> results;
+        connect(job, &FetchJob::resultReceived, [&results](const FetchJob::Result &result) {
+            results << result;
+        });
+        QVERIFY(job->exec());
+        QCOMPARE(results.size(), 1);
+
+        //Nothing is parsed until asked for
+        const FetchJob::Result &result = results.first();
+        QVERIFY(!result.message);
+        QVERIFY(result.parts.isEmpty());
+        QVERIFY(result.rawHeader.startsWith("From: Joe Smith <smith@example.com>\r\n"));
+        QCOMPARE(result.rawParts.value("1.1.1"), QByteArray("Hi Jane, nice to meet you!\r\n"));
+        QCOMPARE(result.rawPartHeaders.value("1.1.1"), QByteArray("Content-Type: text/plain; charset=ISO-8859-1\r\n\r\n"));
+        QCOMPARE(result.flags, KIMAP2::MessageFlags() << "\\Seen");
+
+        QCOMPARE(result.parsedMessage()->messageID()->identifier(), QByteArray("1234@example.com"));
+        QCOMPARE(result.parsedMessage(), result.message);
+        QCOMPARE(result.parsedPart("1.1.1")->decodedText(true, true), QStringLiteral("Hi Jane, nice to meet you!"));
+        QVERIFY(!result.parsedPart("2"));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testResultArena()
+    {
+        QList<QByteArray> scenario;
+        scenario << FakeServer::preauth()
+                 << "C: A000001 UID FETCH 20:21 (BODY.PEEK[] UID)"
+                 << "S: * 1 FETCH (UID 20 BODY[] {20}\r\nSubject: one\r\n\r\nHi\r\n)"
+                 << "S: * 2 FETCH (UID 21 BODY[] {23}\r\nSubject: two\r\n\r\nHey\r\n\r\n)"
+                 << "S: A000001 OK fetch done";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::FetchJob::FetchScope scope;
+        scope.mode = KIMAP2::FetchJob::FetchScope::Content;
+
+        KIMAP2::ResultArena arena;
+        KIMAP2::FetchJob *job = new KIMAP2::FetchJob(&session);
+        job->setUidBased(true);
+        job->setSequenceSet(KIMAP2::ImapSet(20, 21));
+        job->setScope(scope);
+        job->setRawResults(true);
+        job->setResultArena(&arena);
+        QList<FetchJob::Result> results;
+        connect(job, &FetchJob::resultReceived, [&results](const FetchJob::Result &result) {
+            results << result;
+        });
+        QVERIFY(job->exec());
+
+        QCOMPARE(results.size(), 2);
+        QCOMPARE(results.at(0).rawContent, QByteArray("Subject: one\r\n\r\nHi\r\n"));
+        QCOMPARE(results.at(1).rawContent, QByteArray("Subject: two\r\n\r\nHey\r\n\r\n"));
+        QVERIFY(arena.contains(results.at(0).rawContent.constData()));
+        QVERIFY(arena.contains(results.at(1).rawContent.constData()));
+        QCOMPARE(arena.size(), qint64(43));
+
+        results.clear();
+        arena.reset();
+        QCOMPARE(arena.size(), qint64(0));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testFetchVanished()
+    {
+        QList<QByteArray> scenario;
+        scenario << FakeServer::preauth()
+                 << "C: A000001 UID FETCH 300:500 (FLAGS UID) (CHANGEDSINCE 12345 VANISHED)"
+                 << "S: * VANISHED (EARLIER) 300:310,405,411"
+                 << "S: * 1 FETCH (UID 404 MODSEQ (65402) FLAGS (\\Seen))"
+                 << "S: A000001 OK Conditional UID FETCH completed";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::FetchJob::FetchScope scope;
+        scope.mode = KIMAP2::FetchJob::FetchScope::Flags;
+        scope.changedSince = 12345;
+        scope.vanishedEnabled = true;
+
+        KIMAP2::FetchJob *job = new KIMAP2::FetchJob(&session);
+        job->setUidBased(true);
+        job->setSequenceSet(KIMAP2::ImapSet(300, 500));
+        job->setScope(scope);
+        QList<QByteArray> vanished;
+        connect(job, &FetchJob::vanished, [&vanished](const KIMAP2::ImapSet &uids) {
+            vanished << uids.toImapSequenceSet();
+        });
+        connect(job, &FetchJob::resultReceived, this, &FetchJobTest::onResultReceived);
+        QVERIFY(job->exec());
+
+        QCOMPARE(vanished, QList<QByteArray>() << "300:310,405,411");
+        QCOMPARE(m_uids.value(1), qint64(404));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+
+        m_signals.clear();
+        m_uids.clear();
+        m_sizes.clear();
+        m_flags.clear();
+        m_messages.clear();
+        m_parts.clear();
+        m_attrs.clear();
+    }
+
+    void testFetchModSeq()
+    {
+        QList<QByteArray> scenario;
+        scenario << FakeServer::preauth()
+                 << "C: A000001 UID FETCH 1:* (FLAGS UID MODSEQ)"
+                 << "S: * 1 FETCH (UID 10 FLAGS (\\Seen) MODSEQ (624140003))"
+                 << "S: * 2 FETCH (UID 20 FLAGS () MODSEQ (624140007))"
+                 << "S: * 3 FETCH (UID 30 FLAGS () MODSEQ (624140005))"
+                 << "S: A000001 OK fetch done";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::FetchJob::FetchScope scope;
+        scope.mode = KIMAP2::FetchJob::FetchScope::Flags;
+        scope.modSeqEnabled = true;
+
+        KIMAP2::FetchJob *job = new KIMAP2::FetchJob(&session);
+        job->setUidBased(true);
+        job->setSequenceSet(KIMAP2::ImapSet(1, 0));
+        job->setScope(scope);
+        QList<quint64> modSeqs;
+        connect(job, &FetchJob::resultReceived, [&modSeqs](const FetchJob::Result &result) {
+            modSeqs << result.modSeq;
+        });
+        job->setAutoDelete(false);
+        QVERIFY(job->exec());
+
+        QCOMPARE(modSeqs, QList<quint64>() << 624140003ULL << 624140007ULL << 624140005ULL);
+        QCOMPARE(job->highestModSequence(), quint64(624140007ULL));
+        delete job;
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testFetchFlagSet()
+    {
+        QList<QByteArray> scenario;
+        scenario << FakeServer::preauth()
+                 << "C: A000001 UID FETCH 1:* (FLAGS UID)"
+                 << "S: * 1 FETCH (UID 10 FLAGS (\\Seen $Work))"
+                 << "S: * 2 FETCH (UID 20 FLAGS ($Work \\Flagged))"
+                 << "S: * 3 FETCH (UID 30 FLAGS ($work \\Seen))"
+                 << "S: A000001 OK fetch done";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::FetchJob::FetchScope scope;
+        scope.mode = KIMAP2::FetchJob::FetchScope::Flags;
+
+        KIMAP2::FetchJob *job = new KIMAP2::FetchJob(&session);
+        job->setUidBased(true);
+        job->setSequenceSet(KIMAP2::ImapSet(1, 0));
+        job->setScope(scope);
+        QList<FetchJob::Result> results;
+        connect(job, &FetchJob::resultReceived, [&results](const FetchJob::Result &result) {
+            results << result;
+        });
+        QVERIFY(job->exec());
+
+        QCOMPARE(results.size(), 3);
+        QCOMPARE(results[0].flags, KIMAP2::MessageFlags() << "\\Seen" << "$Work");
+        // One copy of each flag for the session
+        QVERIFY(results[0].flags[1].constData() == results[1].flags[0].constData());
+        QVERIFY(results[1].flagSet.contains("\\flagged"));
+        QVERIFY(results[1].flagSet.contains("$WORK"));
+        QVERIFY(!results[1].flagSet.contains("\\Seen"));
+        QCOMPARE(results[1].flagSet.toMessageFlags(), KIMAP2::MessageFlags() << "\\Flagged" << "$Work");
+        QVERIFY(results[0].flagSet != results[1].flagSet);
+        QCOMPARE(results[0].flagSet, KIMAP2::FlagSet::fromMessageFlags(KIMAP2::MessageFlags() << "$work" << "\\SEEN"));
+        // Flags are case-insensitive within a session as well, the lists keep the spelling the server used
+        QCOMPARE(results[0].flagSet, results[2].flagSet);
+        QCOMPARE(results[2].flags, KIMAP2::MessageFlags() << "$work" << "\\Seen");
+
+        KIMAP2::StoreJob *store = new KIMAP2::StoreJob(&session);
+        store->setFlags(results[1].flagSet);
+        QCOMPARE(store->flags(), KIMAP2::MessageFlags() << "\\Flagged" << "$Work");
+        delete store;
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testFetchPartialWindow()
+    {
+        QList<QByteArray> scenario;
+        scenario << "S: * PREAUTH [CAPABILITY IMAP4rev1 CONDSTORE PARTIAL] localhost Test Library server ready"
+                 << "C: A000001 UID FETCH 1:* (FLAGS UID) (CHANGEDSINCE 12345 PARTIAL -1:-2)"
+                 << "S: * 299 FETCH (UID 4999 FLAGS (\\Seen) MODSEQ (624140003))"
+                 << "S: * 300 FETCH (UID 5000 FLAGS () MODSEQ (624140007))"
+                 << "S: A000001 OK fetch done";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        KIMAP2::FetchJob::FetchScope scope;
+        scope.mode = KIMAP2::FetchJob::FetchScope::Flags;
+        scope.changedSince = 12345;
+
+        KIMAP2::FetchJob *job = new KIMAP2::FetchJob(&session);
+        job->setUidBased(true);
+        job->setSequenceSet(KIMAP2::ImapSet(1, 0));
+        job->setScope(scope);
+        //Not split, the window is of the whole set
+        job->setChunkSize(1);
+        job->setPartial(-1, -2);
+        QList<qint64> uids;
+        connect(job, &FetchJob::resultReceived, [&uids](const FetchJob::Result &result) {
+            uids << result.uid;
+        });
+        QVERIFY(job->exec());
+        QCOMPARE(uids, QList<qint64>() << 4999 << 5000);
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testFetchPreview()
+    {
+        QList<QByteArray> scenario;
+        scenario << "S: * PREAUTH [CAPABILITY IMAP4rev1 PREVIEW] localhost Test Library server ready"
+                 << "C: A000001 UID FETCH 1:* (FLAGS UID PREVIEW (LAZY))"
+                 << "S: * 1 FETCH (UID 10 FLAGS () PREVIEW \"Hi \\\"Bob\\\", see you\")"
+                 << "S: * 2 FETCH (UID 20 FLAGS () PREVIEW NIL)"
+                 << "S: * 3 FETCH (UID 30 FLAGS () PREVIEW {7}\r\nGr\xc3\xbc\xc3\x9f\x65)"
+                 << "S: A000001 OK fetch done";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::FetchJob::FetchScope scope;
+        scope.mode = KIMAP2::FetchJob::FetchScope::Flags;
+        scope.previewEnabled = true;
+        scope.previewLazy = true;
+
+        KIMAP2::FetchJob *job = new KIMAP2::FetchJob(&session);
+        job->setUidBased(true);
+        job->setSequenceSet(KIMAP2::ImapSet(1, 0));
+        job->setScope(scope);
+        QList<QString> previews;
+        connect(job, &FetchJob::resultReceived, [&previews](const FetchJob::Result &result) {
+            previews << result.preview;
+        });
+        job->setAutoDelete(false);
+        QVERIFY(job->exec());
+
+        QCOMPARE(previews.size(), 3);
+        QCOMPARE(previews.at(0), QStringLiteral("Hi \"Bob\", see you"));
+        QVERIFY(previews.at(1).isNull());
+        QCOMPARE(previews.at(2), QString::fromUtf8("Gr\xc3\xbc\xc3\x9f\x65"));
+        delete job;
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testFetchObjectIds()
+    {
+        QList<QByteArray> scenario;
+        scenario << "S: * PREAUTH [CAPABILITY IMAP4rev1 OBJECTID] localhost Test Library server ready"
+                 << "C: A000001 UID FETCH 1:* (FLAGS UID EMAILID THREADID)"
+                 << "S: * 1 FETCH (UID 10 FLAGS () EMAILID (M6d99ac3275bb4e) THREADID (T64b478a75b7ea9))"
+                 << "S: * 2 FETCH (UID 20 FLAGS () EMAILID (M5fdc09b49ea703) THREADID NIL)"
+                 << "S: A000001 OK fetch done";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::FetchJob::FetchScope scope;
+        scope.mode = KIMAP2::FetchJob::FetchScope::Flags;
+        scope.objectIdEnabled = true;
+
+        KIMAP2::FetchJob *job = new KIMAP2::FetchJob(&session);
+        job->setUidBased(true);
+        job->setSequenceSet(KIMAP2::ImapSet(1, 0));
+        job->setScope(scope);
+        QList<QByteArray> emailIds;
+        QList<QByteArray> threadIds;
+        connect(job, &FetchJob::resultReceived, [&](const FetchJob::Result &result) {
+            emailIds << result.emailId;
+            threadIds << result.threadId;
+        });
+        job->setAutoDelete(false);
+        QVERIFY(job->exec());
+
+        QCOMPARE(emailIds, QList<QByteArray>() << "M6d99ac3275bb4e" << "M5fdc09b49ea703");
+        QCOMPARE(threadIds.size(), 2);
+        QCOMPARE(threadIds.at(0), QByteArray("T64b478a75b7ea9"));
+        QVERIFY(threadIds.at(1).isNull());
+        delete job;
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testFetchGmailExtensions()
+    {
+        QList<QByteArray> scenario;
+        scenario << FakeServer::preauth()
+                 << "C: A000001 UID FETCH 1:* (FLAGS UID X-GM-LABELS X-GM-MSGID X-GM-THRID)"
+                 << "S: * 1 FETCH (UID 10 FLAGS () X-GM-LABELS (\\Inbox \"Work Items\" Travel) X-GM-MSGID 1278455344230334865 X-GM-THRID 1266894439832287888)"
+                 << "S: * 2 FETCH (UID 20 FLAGS () X-GM-LABELS (Travel) X-GM-MSGID 1278455344230334866 X-GM-THRID 1266894439832287888)"
+                 << "S: A000001 OK fetch done";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::FetchJob::FetchScope scope;
+        scope.mode = KIMAP2::FetchJob::FetchScope::Flags;
+        scope.gmailExtensionsEnabled = true;
+
+        KIMAP2::FetchJob *job = new KIMAP2::FetchJob(&session);
+        job->setUidBased(true);
+        job->setSequenceSet(KIMAP2::ImapSet(1, 0));
+        job->setScope(scope);
+        QList<FetchJob::Result> results;
+        connect(job, &FetchJob::resultReceived, [&](const FetchJob::Result &result) {
+            results << result;
+        });
+        QVERIFY(job->exec());
+
+        QCOMPARE(results.size(), 2);
+        QCOMPARE(results.at(0).gmailLabels, KIMAP2::MessageFlags() << "\\Inbox" << "Work Items" << "Travel");
+        QCOMPARE(results.at(0).gmailMessageId, Q_INT64_C(1278455344230334865));
+        QCOMPARE(results.at(0).gmailThreadId, Q_INT64_C(1266894439832287888));
+        QCOMPARE(results.at(1).gmailThreadId, results.at(0).gmailThreadId);
+        //Interned, both results share the label's data
+        QCOMPARE(results.at(1).gmailLabels.first().constData(), results.at(0).gmailLabels.last().constData());
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testFetchUidOnly()
+    {
+        QList<QByteArray> scenario;
+        scenario << "S: * PREAUTH [CAPABILITY IMAP4rev1 ENABLE UIDONLY] localhost Test Library server ready"
+                 << "C: A000001 ENABLE UIDONLY"
+                 << "S: * ENABLED UIDONLY"
+                 << "S: A000001 OK enabled"
+                 << "C: A000002 UID FETCH 1:* (FLAGS UID)"
+                 << "S: * 10 UIDFETCH (FLAGS (\\Seen))"
+                 << "S: * 4294967295 UIDFETCH (FLAGS ())"
+                 << "S: A000002 OK fetch done";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        KIMAP2::EnableJob *enable = new KIMAP2::EnableJob(&session);
+        enable->setExtensions(QList<QByteArray>() << "UIDONLY");
+        QVERIFY(enable->exec());
+
+        KIMAP2::FetchJob::FetchScope scope;
+        scope.mode = KIMAP2::FetchJob::FetchScope::Flags;
+
+        KIMAP2::FetchJob *job = new KIMAP2::FetchJob(&session);
+        job->setUidBased(true);
+        job->setSequenceSet(KIMAP2::ImapSet(1, 0));
+        job->setScope(scope);
+        QList<FetchJob::Result> results;
+        connect(job, &FetchJob::resultReceived, [&](const FetchJob::Result &result) {
+            results << result;
+        });
+        QVERIFY(job->exec());
+
+        QCOMPARE(results.size(), 2);
+        QCOMPARE(results.at(0).uid, qint64(10));
+        QCOMPARE(results.at(0).sequenceNumber, qint64(0));
+        QCOMPARE(results.at(0).flags, KIMAP2::MessageFlags() << "\\Seen");
+        QCOMPARE(results.at(1).uid, qint64(4294967295));
+
+        //Sequence numbers aren't available, so this fails without asking the server
+        job = new KIMAP2::FetchJob(&session);
+        job->setSequenceSet(KIMAP2::ImapSet(1, 0));
+        job->setScope(scope);
+        QVERIFY(!job->exec());
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testFetchEnvelope()
+    {
+        QList<QByteArray> scenario;
+        scenario << FakeServer::preauth()
+                 << "C: A000001 UID FETCH 1:* (RFC822.SIZE INTERNALDATE ENVELOPE FLAGS UID)"
+                 << "S: * 1 FETCH (UID 10 FLAGS () RFC822.SIZE 4286 INTERNALDATE \"17-Jul-1996 02:44:25 -0700\" "
+                    "ENVELOPE (\"Wed, 17 Jul 1996 02:23:25 -0700 (PDT)\" \"IMAP4rev1 WG mtg summary and minutes\" "
+                    "((\"Terry Gray\" NIL \"gray\" \"cac.washington.edu\")) ((\"Terry Gray\" NIL \"gray\" \"cac.washington.edu\")) "
+                    "((\"Terry Gray\" NIL \"gray\" \"cac.washington.edu\")) ((NIL NIL \"imap\" \"cac.washington.edu\")) "
+                    "((NIL NIL \"minutes\" \"CNRI.Reston.VA.US\")(\"John Klensin\" NIL \"KLENSIN\" \"MIT.EDU\")) NIL NIL "
+                    "\"<B27397-0100000@cac.washington.edu>\"))"
+                 << "S: * 2 FETCH (UID 20 FLAGS () RFC822.SIZE 12 INTERNALDATE \"17-Jul-1996 02:44:25 -0700\" "
+                    "ENVELOPE (NIL \"=?UTF-8?Q?caf=C3=A9?=\" ((\"=?ISO-8859-1?Q?Andr=E9?=\" NIL \"andre\" \"example.org\")) NIL NIL NIL NIL NIL "
+                    "\"<B27397-0100000@cac.washington.edu>\" NIL))"
+                 << "S: A000001 OK fetch done";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::FetchJob::FetchScope scope;
+        scope.mode = KIMAP2::FetchJob::FetchScope::Envelope;
+
+        KIMAP2::FetchJob *job = new KIMAP2::FetchJob(&session);
+        job->setUidBased(true);
+        job->setSequenceSet(KIMAP2::ImapSet(1, 0));
+        job->setScope(scope);
+        QList<FetchJob::Result> results;
+        connect(job, &FetchJob::resultReceived, [&](const FetchJob::Result &result) {
+            results << result;
+        });
+        QVERIFY(job->exec());
+
+        QCOMPARE(results.size(), 2);
+        const KIMAP2::Envelope first = results.at(0).envelope;
+        QVERIFY(!results.at(0).message);
+        QCOMPARE(results.at(0).size, qint64(4286));
+        QCOMPARE(first.dateTime(), qint64(837595405));
+        QCOMPARE(first.decodedSubject(), QStringLiteral("IMAP4rev1 WG mtg summary and minutes"));
+        QCOMPARE(first.from.size(), 1);
+        QCOMPARE(first.from.first().displayName(), QStringLiteral("Terry Gray"));
+        QCOMPARE(first.from.first().address(), QByteArray("gray@cac.washington.edu"));
+        QCOMPARE(first.cc.size(), 2);
+        QCOMPARE(first.cc.at(1).address(), QByteArray("KLENSIN@MIT.EDU"));
+        QVERIFY(first.bcc.isEmpty());
+        QVERIFY(first.inReplyTo.isNull());
+        QCOMPARE(first.messageId, QByteArray("<B27397-0100000@cac.washington.edu>"));
+
+        const KIMAP2::Envelope second = results.at(1).envelope;
+        QCOMPARE(second.dateTime(), qint64(0));
+        QCOMPARE(second.decodedSubject(), QString::fromUtf8("caf\xc3\xa9"));
+        QCOMPARE(second.from.first().displayName(), QString::fromUtf8("Andr\xc3\xa9"));
+        QCOMPARE(second.inReplyTo, QByteArray("<B27397-0100000@cac.washington.edu>"));
+        QVERIFY(second.messageId.isNull());
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testFetchPreparedScope()
+    {
+        QList<QByteArray> scenario;
+        scenario << "S: * PREAUTH [CAPABILITY IMAP4rev1 OBJECTID CONDSTORE] localhost Test Library server ready"
+                 << "C: A000001 UID FETCH 1:* (FLAGS UID EMAILID THREADID)"
+                 << "S: * 1 FETCH (UID 10 FLAGS () EMAILID (M6d99ac3275bb4e) THREADID NIL)"
+                 << "S: A000001 OK fetch done"
+                 << "C: A000002 UID FETCH 11:* (FLAGS UID EMAILID THREADID) (CHANGEDSINCE 5)"
+                 << "S: * 2 FETCH (UID 20 FLAGS (\\Seen) EMAILID (M5fdc09b49ea703) THREADID NIL MODSEQ (7))"
+                 << "S: A000002 OK fetch done";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::FetchJob::FetchScope scope;
+        scope.mode = KIMAP2::FetchJob::FetchScope::Flags;
+        scope.objectIdEnabled = true;
+
+        KIMAP2::FetchJob *job = new KIMAP2::FetchJob(&session);
+        job->setUidBased(true);
+        job->setSequenceSet(KIMAP2::ImapSet(1, 0));
+        job->setScope(scope);
+        QVERIFY(job->exec());
+
+        //The capabilities are known now
+        const KIMAP2::FetchJob::PreparedScope prepared(scope, &session);
+        QVERIFY(prepared.isValid());
+        QCOMPARE(prepared.scope().mode, KIMAP2::FetchJob::FetchScope::Flags);
+        QVERIFY(!KIMAP2::FetchJob::PreparedScope().isValid());
+
+        KIMAP2::FetchJob::FetchScope changed = prepared.scope();
+        changed.changedSince = 5;
+        job = new KIMAP2::FetchJob(&session);
+        job->setUidBased(true);
+        job->setSequenceSet(KIMAP2::ImapSet(11, 0));
+        job->setScope(KIMAP2::FetchJob::PreparedScope(changed, &session));
+        QList<QByteArray> emailIds;
+        connect(job, &FetchJob::resultReceived, [&emailIds](const FetchJob::Result &result) {
+            emailIds << result.emailId;
+        });
+        QVERIFY(job->exec());
+        QCOMPARE(emailIds, QList<QByteArray>() << "M5fdc09b49ea703");
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testFetchCompactResults()
+    {
+        QList<QByteArray> scenario;
+        scenario << FakeServer::preauth()
+                 << "C: A000001 FETCH 1:2 (FLAGS UID) (CHANGEDSINCE 5)"
+                 << "S: * 1 FETCH (UID 10 MODSEQ (7) FLAGS (\\Seen $Junk))"
+                 << "S: * 2 FETCH (UID 20 MODSEQ (9) FLAGS (\\Seen))"
+                 << "S: A000001 OK fetch done"
+                 << "C: A000002 FETCH 2 (BODY.PEEK[1.MIME] UID)"
+                 << "S: * 2 FETCH (UID 20 BODY[1.MIME] {48}\r\nContent-Type: text/plain; charset=ISO-8859-1\r\n\r\n)"
+                 << "S: A000002 OK fetch done";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::FetchJob::FetchScope scope;
+        scope.mode = KIMAP2::FetchJob::FetchScope::Flags;
+        scope.changedSince = 5;
+
+        KIMAP2::FetchJob *job = new KIMAP2::FetchJob(&session);
+        job->setUidBased(false);
+        job->setSequenceSet(KIMAP2::ImapSet(1, 2));
+        job->setScope(scope);
+        QVector<FetchJob::CompactResult> results;
+        job->setCompactResultHandler([&results](QVector<FetchJob::CompactResult> &&batch) {
+            results += batch;
+        });
+        bool fullResults = false;
+        connect(job, &FetchJob::resultReceived, [&fullResults]() {
+            fullResults = true;
+        });
+        QVERIFY(job->exec());
+
+        QVERIFY(!fullResults);
+        QCOMPARE(results.size(), 2);
+        QCOMPARE(results[0].sequenceNumber, qint64(1));
+        QCOMPARE(results[0].uid, qint64(10));
+        QCOMPARE(results[0].modSeq, quint64(7));
+        QCOMPARE(results[0].flags, QVector<QByteArray>() << "\\Seen" << "$Junk");
+        QCOMPARE(results[1].uid, qint64(20));
+        QCOMPARE(results[1].modSeq, quint64(9));
+        QCOMPARE(results[1].flags, QVector<QByteArray>() << "\\Seen");
+        // Interned
+        QVERIFY(static_cast<const void *>(results[1].flags[0].constData()) == results[0].flags[0].constData());
+
+        scope.mode = KIMAP2::FetchJob::FetchScope::Headers;
+        scope.changedSince = 0;
+        scope.parts.clear();
+        scope.parts.append("1");
+
+        job = new KIMAP2::FetchJob(&session);
+        job->setUidBased(false);
+        job->setSequenceSet(KIMAP2::ImapSet(2, 2));
+        job->setScope(scope);
+        results.clear();
+        job->setCompactResultHandler([&results](QVector<FetchJob::CompactResult> &&batch) {
+            results += batch;
+        });
+        QVERIFY(job->exec());
+
+        QCOMPARE(results.size(), 1);
+        QCOMPARE(results[0].uid, qint64(20));
+        QVERIFY(results[0].header.isEmpty());
+        QCOMPARE(results[0].partHeaders.size(), 1);
+        QCOMPARE(results[0].partHeaders[0].partId, QByteArray("1"));
+        QCOMPARE(results[0].partHeaders[0].header, QByteArray("Content-Type: text/plain; charset=ISO-8859-1\r\n\r\n"));
+        QCOMPARE(results[0].partHeaders[0].binarySize, qint64(-1));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testFetchBinary()
+    {
+        QList<QByteArray> scenario;
+        scenario << "S: * PREAUTH [CAPABILITY IMAP4rev1 BINARY] localhost Test Library server ready"
+                 << "C: A000001 FETCH 2 (BODY.PEEK[HEADER.FIELDS (TO FROM MESSAGE-ID REFERENCES IN-REPLY-TO SUBJECT DATE)] BODY.PEEK[2.MIME] BINARY.PEEK[2] FLAGS UID)"
+                 << "S: * 2 FETCH (UID 20 FLAGS () BODY[HEADER.FIELDS (TO FROM MESSAGE-ID REFERENCES IN-REPLY-TO SUBJECT DATE)] {18}\r\nSubject: hello\r\n\r\n BINARY[2] ~{6}\r\nHello! BODY[2.MIME] {63}\r\nContent-Type: text/plain\r\nContent-Transfer-Encoding: base64\r\n\r\n)\r\n"
+                 << "S: A000001 OK fetch done"
+                 << "C: A000002 FETCH 2 (BODY.PEEK[2.MIME] BINARY.SIZE[2] UID)"
+                 << "S: * 2 FETCH (UID 20 BODY[2.MIME] {63}\r\nContent-Type: text/plain\r\nContent-Transfer-Encoding: base64\r\n\r\n BINARY.SIZE[2] 6)"
+                 << "S: A000002 OK fetch done";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::FetchJob::FetchScope scope;
+        scope.mode = KIMAP2::FetchJob::FetchScope::HeaderAndContent;
+        scope.parts.clear();
+        scope.parts.append("2");
+        scope.binaryEnabled = true;
+
+        KIMAP2::FetchJob *job = new KIMAP2::FetchJob(&session);
+        job->setSequenceSet(KIMAP2::ImapSet(2, 2));
+        job->setScope(scope);
+        connect(job, &FetchJob::resultReceived, this, &FetchJobTest::onResultReceived);
+        QVERIFY(job->exec());
+
+        //The server already decoded the part, so it isn't decoded again
+        QCOMPARE(m_parts[2].keys(), QList<QByteArray>() << "2");
+        QCOMPARE(m_parts[2].value("2")->decodedContent(), QByteArray("Hello!"));
+
+        scope.mode = KIMAP2::FetchJob::FetchScope::Headers;
+        job = new KIMAP2::FetchJob(&session);
+        job->setSequenceSet(KIMAP2::ImapSet(2, 2));
+        job->setScope(scope);
+        connect(job, &FetchJob::resultReceived, this, &FetchJobTest::onResultReceived);
+        QVERIFY(job->exec());
+        QCOMPARE(m_attrs[2], KIMAP2::MessageAttributes() << qMakePair<QByteArray, QVariant>("BINARY.SIZE[2]", 6));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+
+        m_signals.clear();
+        m_uids.clear();
+        m_sizes.clear();
+        m_flags.clear();
+        m_messages.clear();
+        m_parts.clear();
+        m_attrs.clear();
+    }
+
+    void testFetchBinaryUnsupported()
+    {
+        QList<QByteArray> scenario;
+        scenario << FakeServer::preauth()
+                 << "C: A000001 FETCH 2 (BODY.PEEK[2] UID)"
+                 << "S: * 2 FETCH (UID 20 BODY[2] {8}\r\nSGVsbG8h)"
+                 << "S: A000001 OK fetch done";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::FetchJob::FetchScope scope;
+        scope.mode = KIMAP2::FetchJob::FetchScope::Content;
+        scope.parts.clear();
+        scope.parts.append("2");
+        scope.binaryEnabled = true;
+
+        KIMAP2::FetchJob *job = new KIMAP2::FetchJob(&session);
+        job->setSequenceSet(KIMAP2::ImapSet(2, 2));
+        job->setScope(scope);
+        QList<FetchJob::Result> results;
+        connect(job, &FetchJob::resultReceived, [&results](const FetchJob::Result &result) {
+            results << result;
+        });
+        QVERIFY(job->exec());
+        QCOMPARE(results.size(), 1);
+        QVERIFY(results.first().decodedParts.isEmpty());
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testFetchPartial()
+    {
+        QList<QByteArray> scenario;
+        scenario << FakeServer::preauth()
+                 << "C: A000001 UID FETCH 7 (BODY.PEEK[1]<4.4> UID)"
+                 << "S: * 1 FETCH (UID 7 BODY[1]<4> {4}\r\no Ja)"
+                 << "S: A000001 OK fetch done";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::FetchJob::FetchScope scope;
+        scope.mode = KIMAP2::FetchJob::FetchScope::Content;
+        scope.parts.clear();
+        scope.parts.append("1");
+        scope.partialOffset = 4;
+        scope.partialLength = 4;
+
+        KIMAP2::FetchJob *job = new KIMAP2::FetchJob(&session);
+        job->setUidBased(true);
+        job->setSequenceSet(KIMAP2::ImapSet(7, 7));
+        job->setScope(scope);
+        QList<FetchJob::Result> results;
+        connect(job, &FetchJob::resultReceived, [&results](const FetchJob::Result &result) {
+            results << result;
+        });
+        QVERIFY(job->exec());
+        QCOMPARE(results.size(), 1);
+        QCOMPARE(results.first().uid, qint64(7));
+        //Fragments are not parsed
+        QVERIFY(results.first().parts.isEmpty());
+        QCOMPARE(results.first().rawParts.value("1"), QByteArray("o Ja"));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testFetchPartSink()
+    {
+        // Larger than the parser buffer so the literal is also read straight from the socket
+        const QByteArray body = "Subject: big\r\n\r\n" + QByteArray(100000, 'a') + "\r\n";
+        const QByteArray smallBody = "Subject: small\r\n\r\nHi\r\n";
+
+        QList<QByteArray> scenario;
+        scenario << FakeServer::preauth()
+                 << "C: A000001 FETCH 1:2 (BODY.PEEK[] UID)"
+                 << "S: * 1 FETCH (UID 10 BODY[] {" + QByteArray::number(body.size()) + "}\r\n" + body + ")"
+                 << "S: * 2 FETCH (BODY[] {" + QByteArray::number(smallBody.size()) + "}\r\n" + smallBody + " UID 20)"
+                 << "S: A000001 OK fetch done";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::FetchJob *job = new KIMAP2::FetchJob(&session);
+        job->setSequenceSet(KIMAP2::ImapSet(1, 2));
+
+        QMap<qint64, QByteArray> streamed;
+        job->setPartSink(QByteArray(), [&](qint64 sequenceNumber, const char *data, int size) {
+            QVERIFY(size <= 16000);
+            streamed[sequenceNumber].append(data, size);
+        });
+        connect(job, &FetchJob::resultReceived, this, &FetchJobTest::onResultReceived);
+
+        QVERIFY(job->exec());
+
+        QCOMPARE(streamed.value(1), body);
+        QCOMPARE(streamed.value(2), smallBody);
+
+        // The streamed content doesn't end up in the result
+        QCOMPARE(m_uids.value(1), qint64(10));
+        QCOMPARE(m_uids.value(2), qint64(20));
+        QVERIFY(!m_messages.value(1));
+        QVERIFY(!m_messages.value(2));
+
+        fakeServer.quit();
+
+        m_signals.clear();
+        m_uids.clear();
+        m_sizes.clear();
+        m_flags.clear();
+        m_messages.clear();
+        m_parts.clear();
+        m_attrs.clear();
+    }
+
+    void testFetchPartSinkInlineValue()
+    {
+        QList<QByteArray> scenario;
+        scenario << FakeServer::preauth()
+                 << "C: A000001 FETCH 1:2 (BODY.PEEK[1] UID)"
+                 << "S: * 1 FETCH (UID 10 BODY[1] \"Hi\")"
+                 << "S: * 2 FETCH (UID 20 BODY[1] {3}\r\nYo!)"
+                 << "S: A000001 OK fetch done";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::FetchJob *job = new KIMAP2::FetchJob(&session);
+        job->setSequenceSet(KIMAP2::ImapSet(1, 2));
+        KIMAP2::FetchJob::FetchScope scope;
+        scope.mode = KIMAP2::FetchJob::FetchScope::Content;
+        scope.parts << "1";
+        job->setScope(scope);
+
+        QMap<qint64, QByteArray> streamed;
+        job->setPartSink("1", [&](qint64 sequenceNumber, const char *data, int size) {
+            streamed[sequenceNumber].append(data, size);
+        });
+        connect(job, &FetchJob::resultReceived, this, &FetchJobTest::onResultReceived);
+
+        QVERIFY(job->exec());
+
+        // Only literals go to the sink, a quoted value is kept in the result
+        QVERIFY(!streamed.contains(1));
+        QCOMPARE(streamed.value(2), QByteArray("Yo!"));
+        QVERIFY(m_parts.value(1).contains("1"));
+        QCOMPARE(m_parts.value(1).value("1")->body(), QByteArray("Hi"));
+        QVERIFY(!m_parts.value(2).contains("1"));
+
+        fakeServer.quit();
+
+        m_signals.clear();
+        m_uids.clear();
+        m_sizes.clear();
+        m_flags.clear();
+        m_messages.clear();
+        m_parts.clear();
+        m_attrs.clear();
+    }
+
+    void testFetchIncremental()
+    {
+        const QByteArray body = "Subject: big\r\n\r\n" + QByteArray(50000, 'a') + "\r\n";
+
+        QList<QByteArray> scenario;
+        scenario << FakeServer::preauth()
+                 << "C: A000001 FETCH 1:2 (BODY.PEEK[] UID)"
+                 << "S: * 1 FETCH (UID 10 BODY[] {" + QByteArray::number(body.size()) + "}\r\n" + body + ")"
+                 << "S: * 2 FETCH (UID 20 FLAGS (\\Seen))"
+                 << "S: A000001 OK fetch done";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::FetchJob *job = new KIMAP2::FetchJob(&session);
+        job->setSequenceSet(KIMAP2::ImapSet(1, 2));
+        job->setIncrementalDelivery(true);
+
+        QStringList events;
+        QByteArray streamedBody;
+        connect(job, &FetchJob::itemStarted, [&](qint64 sequenceNumber) {
+            events << QStringLiteral("start %1").arg(sequenceNumber);
+        });
+        connect(job, &FetchJob::attributeStarted, [&](qint64 sequenceNumber, const QByteArray &name) {
+            events << QStringLiteral("%1 %2").arg(sequenceNumber).arg(QString::fromLatin1(name));
+        });
+        connect(job, &FetchJob::attributeData, [&](qint64 sequenceNumber, const QByteArray &data) {
+            if (events.last() == QLatin1String("1 BODY[]")) {
+                streamedBody += data;
+            } else {
+                events << QStringLiteral("%1 = %2").arg(sequenceNumber).arg(QString::fromLatin1(data));
+            }
+        });
+        connect(job, &FetchJob::itemFinished, [&](qint64 sequenceNumber) {
+            events << QStringLiteral("end %1").arg(sequenceNumber);
+        });
+        connect(job, &FetchJob::resultReceived, this, &FetchJobTest::onResultReceived);
+
+        QVERIFY(job->exec());
+
+        QCOMPARE(events, QStringList() << QStringLiteral("start 1") << QStringLiteral("1 UID") << QStringLiteral("1 = 10")
+                                       << QStringLiteral("1 BODY[]") << QStringLiteral("end 1")
+                                       << QStringLiteral("start 2") << QStringLiteral("2 UID") << QStringLiteral("2 = 20")
+                                       << QStringLiteral("2 FLAGS") << QStringLiteral("2 = (\\Seen)") << QStringLiteral("end 2"));
+        QCOMPARE(streamedBody, body);
+        // No results are assembled in incremental mode
+        QVERIFY(m_signals.isEmpty());
+
+        fakeServer.quit();
+    }
+
+    void testFetchChunksStepAside()
+    {
+        QList<QByteArray> scenario;
+        scenario << FakeServer::preauth()
+                 << "C: A000001 UID FETCH 1:2 (FLAGS UID)"
+                 << "S: * 1 FETCH (FLAGS () UID 1)"
+                 << "S: * 2 FETCH (FLAGS () UID 2)"
+                 << "S: A000001 OK fetch done"
+                 << "C: A000002 UID FETCH 10 (FLAGS UID)"
+                 << "S: * 10 FETCH (FLAGS (\\Seen) UID 10)"
+                 << "S: A000002 OK fetch done"
+                 << "C: A000003 UID FETCH 3:4 (FLAGS UID)"
+                 << "S: * 3 FETCH (FLAGS () UID 3)"
+                 << "S: * 4 FETCH (FLAGS () UID 4)"
+                 << "S: A000003 OK fetch done"
+                 << "C: A000004 UID FETCH 5 (FLAGS UID)"
+                 << "S: * 5 FETCH (FLAGS () UID 5)"
+                 << "S: A000004 OK fetch done";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::FetchJob::FetchScope scope;
+        scope.mode = KIMAP2::FetchJob::FetchScope::Flags;
+
+        KIMAP2::FetchJob *job = new KIMAP2::FetchJob(&session);
+        job->setUidBased(true);
+        job->setSequenceSet(KIMAP2::ImapSet(1, 5));
+        job->setScope(scope);
+        job->setChunkSize(2);
+        job->setPriority(KIMAP2::Job::BackgroundPriority);
+
+        QList<qint64> uids;
+        bool interactiveDone = false;
+        connect(job, &FetchJob::resultReceived, [&](const FetchJob::Result &result) {
+            uids << result.uid;
+            if (uids.size() != 1) {
+                return;
+            }
+            //Arrives while the first chunk is fetched, and runs before the second one
+            KIMAP2::FetchJob *interactive = new KIMAP2::FetchJob(&session);
+            interactive->setUidBased(true);
+            interactive->setSequenceSet(KIMAP2::ImapSet(10));
+            interactive->setScope(scope);
+            interactive->setPriority(KIMAP2::Job::InteractivePriority);
+            connect(interactive, &FetchJob::resultReceived, [&](const FetchJob::Result &interactiveResult) {
+                uids << interactiveResult.uid;
+            });
+            connect(interactive, &KJob::result, [&](KJob *finished) {
+                interactiveDone = !finished->error();
+            });
+            interactive->start();
+        });
+
+        QVERIFY(job->exec());
+        QVERIFY(interactiveDone);
+        QCOMPARE(uids, QList<qint64>() << 1 << 2 << 10 << 3 << 4 << 5);
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testFetchChunksFailWithoutTheirMailBox()
+    {
+        QList<QByteArray> scenario;
+        scenario << FakeServer::preauth()
+                 << "C: A000001 SELECT \"INBOX\""
+                 << "S: A000001 OK [READ-WRITE] SELECT completed"
+                 << "C: A000002 UID FETCH 1:2 (FLAGS UID)"
+                 << "S: * 1 FETCH (FLAGS () UID 1)"
+                 << "S: * 2 FETCH (FLAGS () UID 2)"
+                 << "S: A000002 OK fetch done"
+                 << "C: A000003 SELECT \"Drafts\""
+                 << "S: A000003 OK [READ-WRITE] SELECT completed"
+                 << "C: A000004 SELECT \"INBOX\""
+                 << "S: A000004 NO [NONEXISTENT] Mailbox doesn't exist";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::SelectJob *inbox = new KIMAP2::SelectJob(&session);
+        inbox->setMailBox(QStringLiteral("INBOX"));
+        QVERIFY(inbox->exec());
+
+        KIMAP2::FetchJob::FetchScope scope;
+        scope.mode = KIMAP2::FetchJob::FetchScope::Flags;
+
+        KIMAP2::FetchJob *job = new KIMAP2::FetchJob(&session);
+        job->setUidBased(true);
+        job->setSequenceSet(KIMAP2::ImapSet(1, 5));
+        job->setScope(scope);
+        job->setChunkSize(2);
+        job->setPriority(KIMAP2::Job::BackgroundPriority);
+
+        bool drafts = false;
+        connect(job, &FetchJob::resultReceived, [&](const FetchJob::Result &) {
+            if (drafts) {
+                return;
+            }
+            drafts = true;
+            //Selects another mailbox before the second chunk
+            KIMAP2::SelectJob *select = new KIMAP2::SelectJob(&session);
+            select->setMailBox(QStringLiteral("Drafts"));
+            select->setPriority(KIMAP2::Job::InteractivePriority);
+            select->start();
+        });
+
+        //Fails once selecting INBOX again fails, instead of trying forever
+        QVERIFY(!job->exec());
+        QVERIFY(job->errorText().contains(QStringLiteral("Mailbox doesn't exist")));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testFetchPipelinedChunks()
+    {
+        QList<QByteArray> scenario;
+        scenario << FakeServer::preauth()
+                 << "C: A000001 UID FETCH 1,3 (FLAGS UID)"
+                 << "C: A000002 UID FETCH 5,7 (FLAGS UID)"
+                 << "S: * 1 FETCH (FLAGS () UID 1)\r\n"
+                    "* 2 FETCH (FLAGS () UID 3)\r\n"
+                    "A000001 OK fetch done\r\n"
+                    "* 3 FETCH (FLAGS () UID 5)\r\n"
+                    "* 4 FETCH (FLAGS () UID 7)\r\n"
+                    "A000002 OK fetch done";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::FetchJob::FetchScope scope;
+        scope.mode = KIMAP2::FetchJob::FetchScope::Flags;
+
+        KIMAP2::ImapSet set;
+        set.add(QVector<KIMAP2::ImapSet::Id>() << 1 << 3 << 5 << 7);
+
+        KIMAP2::FetchJob *job = new KIMAP2::FetchJob(&session);
+        job->setUidBased(true);
+        job->setSequenceSet(set);
+        job->setScope(scope);
+        //Two UIDs with their commas
+        job->setMaximumSetLength(4);
+        job->setPipelinedChunks(2);
+        QList<qint64> uids;
+        QList<QByteArray> checkpoints;
+        connect(job, &FetchJob::resultReceived, [&uids](const FetchJob::Result &result) {
+            uids << result.uid;
+        });
+        connect(job, &FetchJob::chunkCompleted, [&uids, &checkpoints](const KIMAP2::ImapSet &chunk) {
+            checkpoints << chunk.toImapSequenceSet() + ':' + QByteArray::number(uids.size());
+        });
+        QVERIFY(job->exec());
+
+        QCOMPARE(uids, QList<qint64>() << 1 << 3 << 5 << 7);
+        //Each checkpoint follows the results of its chunk
+        QCOMPARE(checkpoints, QList<QByteArray>() << "1,3:2" << "5,7:4");
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testFetchParallelParsing()
+    {
+        QList<QByteArray> scenario;
+        scenario << FakeServer::preauth()
+                 << "C: A000001 UID FETCH 1:3 (BODY.PEEK[] UID)"
+                 << "S: * 1 FETCH (UID 1 BODY[] {18}\r\nSubject: first\r\n\r\n)\r\n"
+                    "* 2 FETCH (UID 2 BODY[] {19}\r\nSubject: second\r\n\r\n)\r\n"
+                    "* 3 FETCH (UID 3 BODY[] {18}\r\nSubject: third\r\n\r\n)\r\n"
+                    "A000001 OK fetch done";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::FetchJob *job = new KIMAP2::FetchJob(&session);
+        job->setUidBased(true);
+        job->setSequenceSet(KIMAP2::ImapSet(1, 3));
+        //Parses the last message first, once all of them arrived
+        QList<std::function<void()> > tasks;
+        job->setParseExecutor([&tasks](const std::function<void()> &task) {
+            if (tasks.isEmpty()) {
+                QTimer::singleShot(100, [&tasks]() {
+                    while (!tasks.isEmpty()) {
+                        tasks.takeLast()();
+                    }
+                });
+            }
+            tasks << task;
+        });
+        QStringList subjects;
+        connect(job, &FetchJob::resultReceived, [&subjects](const FetchJob::Result &result) {
+            subjects << result.message->subject()->asUnicodeString();
+        });
+        QVERIFY(job->exec());
+        QCOMPARE(subjects, QStringList() << QStringLiteral("first") << QStringLiteral("second") << QStringLiteral("third"));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testFetchResultWindow()
+    {
+        QList<QByteArray> scenario;
+        scenario << FakeServer::preauth()
+                 << "C: A000001 UID FETCH 1:4 (FLAGS UID)"
+                 << "S: * 1 FETCH (FLAGS () UID 1)\r\n"
+                    "* 2 FETCH (FLAGS () UID 2)\r\n"
+                    "* 3 FETCH (FLAGS () UID 3)\r\n"
+                    "* 4 FETCH (FLAGS () UID 4)\r\n"
+                    "A000001 OK fetch done";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        session.setReadBufferSize(4096);
+        QCOMPARE(session.readBufferSize(), qint64(4096));
+
+        KIMAP2::FetchJob::FetchScope scope;
+        scope.mode = KIMAP2::FetchJob::FetchScope::Flags;
+
+        KIMAP2::FetchJob *job = new KIMAP2::FetchJob(&session);
+        job->setUidBased(true);
+        job->setSequenceSet(KIMAP2::ImapSet(1, 4));
+        job->setScope(scope);
+        job->setResultWindow(2);
+
+        QList<qint64> uids;
+        connect(job, &FetchJob::resultReceived, [&](const FetchJob::Result &result) {
+            uids << result.uid;
+        });
+        QSignalSpy resultSpy(job, SIGNAL(result(KJob*)));
+        job->start();
+
+        //Everything arrives at once, but only two results are delivered without being acknowledged
+        QTRY_COMPARE(uids.size(), 2);
+        QTest::qWait(100);
+        QCOMPARE(uids.size(), 2);
+        QCOMPARE(resultSpy.count(), 0);
+
+        job->acknowledgeResults();
+        QTRY_COMPARE(uids.size(), 3);
+        QTest::qWait(100);
+        QCOMPARE(uids.size(), 3);
+
+        job->acknowledgeResults(3);
+        QTRY_COMPARE(resultSpy.count(), 1);
+        QCOMPARE(uids, QList<qint64>() << 1 << 2 << 3 << 4);
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testFetchBatches()
+    {
+        QList<QByteArray> scenario;
+        scenario << FakeServer::preauth()
+                 << "C: A000001 UID FETCH 1:3 (FLAGS UID)"
+                 << "S: * 1 FETCH (FLAGS () UID 1)\r\n"
+                    "* 2 FETCH (FLAGS () UID 2)\r\n"
+                    "* 3 FETCH (FLAGS () UID 3)\r\n"
+                    "A000001 OK fetch done";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::FetchJob::FetchScope scope;
+        scope.mode = KIMAP2::FetchJob::FetchScope::Flags;
+
+        KIMAP2::FetchJob *job = new KIMAP2::FetchJob(&session);
+        job->setUidBased(true);
+        job->setSequenceSet(KIMAP2::ImapSet(1, 3));
+        job->setScope(scope);
+        QList<int> batchSizes;
+        QList<qint64> uids;
+        job->setResultBatchHandler([&](QVector<FetchJob::Result> &&results) {
+            batchSizes << results.size();
+            foreach (const FetchJob::Result &result, results) {
+                uids << result.uid;
+            }
+        }, 2);
+        int signalled = 0;
+        connect(job, &FetchJob::resultReceived, [&signalled](const FetchJob::Result &) {
+            signalled++;
+        });
+        QVERIFY(job->exec());
+
+        //The last one goes out before the job finishes
+        QCOMPARE(batchSizes, QList<int>() << 2 << 1);
+        QCOMPARE(uids, QList<qint64>() << 1 << 2 << 3);
+        QCOMPARE(signalled, 0);
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testFetchAbort()
+    {
+        QList<QByteArray> scenario;
+        scenario << FakeServer::preauth()
+                 << "C: A000001 UID FETCH 1:3 (FLAGS UID)"
+                 << "S: * 1 FETCH (FLAGS () UID 1)\r\n"
+                    "* 2 FETCH (FLAGS () UID 2)\r\n"
+                    "* 3 FETCH (FLAGS () UID 3)\r\n"
+                    "A000001 OK fetch done"
+                 << "C: A000002 UID FETCH 4 (FLAGS UID)"
+                 << "S: A000002 OK fetch done";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::FetchJob::FetchScope scope;
+        scope.mode = KIMAP2::FetchJob::FetchScope::Flags;
+
+        KIMAP2::FetchJob *job = new KIMAP2::FetchJob(&session);
+        job->setUidBased(true);
+        job->setSequenceSet(KIMAP2::ImapSet(1, 3));
+        job->setScope(scope);
+        QList<qint64> uids;
+        connect(job, &FetchJob::resultReceived, [&](const FetchJob::Result &result) {
+            uids << result.uid;
+            job->abort();
+        });
+        QList<int> errors;
+        connect(job, &KJob::result, [&](KJob *finished) {
+            errors << finished->error();
+        });
+        job->start();
+
+        //Never started, so it only leaves the queue
+        KIMAP2::FetchJob *queued = new KIMAP2::FetchJob(&session);
+        queued->setUidBased(true);
+        queued->setSequenceSet(KIMAP2::ImapSet(5));
+        queued->setScope(scope);
+        connect(queued, &KJob::result, [&](KJob *finished) {
+            errors << finished->error();
+        });
+        queued->start();
+        queued->abort();
+        QTRY_COMPARE(errors.size(), 1);
+        QCOMPARE(errors[0], int(KJob::KilledJobError));
+
+        KIMAP2::FetchJob *next = new KIMAP2::FetchJob(&session);
+        next->setUidBased(true);
+        next->setSequenceSet(KIMAP2::ImapSet(4));
+        next->setScope(scope);
+        connect(next, &KJob::result, [&](KJob *finished) {
+            errors << finished->error();
+        });
+        next->start();
+
+        QTRY_COMPARE(errors.size(), 3);
+        QCOMPARE(errors, QList<int>() << KJob::KilledJobError << KJob::KilledJobError << KJob::NoError);
+        QCOMPARE(uids, QList<qint64>() << 1);
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
 };
 
 QTEST_GUILESS_MAIN(FetchJobTest)
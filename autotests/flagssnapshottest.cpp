@@ -0,0 +1,199 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#include <qtest.h>
+
+#include "kimap2/flagssnapshot.h"
+#include "kimap2/searchjob.h"
+
+#include <QtTest>
+
+using KIMAP2::FlagsSnapshot;
+
+Q_DECLARE_METATYPE(KIMAP2::Term)
+
+class FlagsSnapshotTest : public QObject
+{
+    Q_OBJECT
+
+private:
+    static FlagsSnapshot::MessageState message(qint64 uid, const KIMAP2::MessageFlags &flags, quint64 modSeq = 0)
+    {
+        FlagsSnapshot::MessageState state;
+        state.uid = uid;
+        state.flags = flags;
+        state.modSeq = modSeq;
+        return state;
+    }
+
+private Q_SLOTS:
+    void testFlags()
+    {
+        FlagsSnapshot snapshot;
+        QVERIFY(snapshot.isEmpty());
+        snapshot.set(5, KIMAP2::MessageFlags() << "$Junk" << "\\seen", 20);
+        snapshot.set(2, KIMAP2::MessageFlags() << "\\Flagged" << "$junk" << "$Work");
+        snapshot.set(9, KIMAP2::MessageFlags());
+
+        QCOMPARE(snapshot.count(), 3);
+        QCOMPARE(snapshot.uids().toImapSequenceSet(), QByteArray("2,5,9"));
+        QCOMPARE(snapshot.flags(5), KIMAP2::MessageFlags() << "\\Seen" << "$Junk");
+        QCOMPARE(snapshot.flags(2), KIMAP2::MessageFlags() << "\\Flagged" << "$Junk" << "$Work");
+        QVERIFY(snapshot.flags(9).isEmpty());
+        QVERIFY(snapshot.flags(3).isEmpty());
+        QCOMPARE(snapshot.systemFlags(5), FlagsSnapshot::SystemFlags(FlagsSnapshot::Seen));
+        QCOMPARE(snapshot.modSeq(5), quint64(20));
+        QCOMPARE(snapshot.uids(FlagsSnapshot::Flagged).toImapSequenceSet(), QByteArray("2"));
+
+        FlagsSnapshot copy = snapshot;
+        copy.remove(KIMAP2::ImapSet::fromImapSequenceSet("1:5"));
+        QCOMPARE(copy.uids().toImapSequenceSet(), QByteArray("9"));
+        QCOMPARE(snapshot.count(), 3);
+    }
+
+    void testSearch_data()
+    {
+        QTest::addColumn<KIMAP2::Term>("term");
+        QTest::addColumn<QByteArray>("uids");
+
+        using KIMAP2::Term;
+        QTest::newRow("all") << Term(Term::All, QString()) << QByteArray("1:6");
+        QTest::newRow("unseen") << Term(Term::Seen).setNegated(true) << QByteArray("2:4,6");
+        QTest::newRow("flagged not deleted") << Term(Term::And, QVector<Term>() << Term(Term::Flagged) << Term(Term::Deleted).setNegated(true))
+                                             << QByteArray("2");
+        QTest::newRow("or") << Term(Term::Or, QVector<Term>() << Term(Term::Draft) << Term(Term::Answered) << Term(Term::Deleted))
+                            << QByteArray("1,3:5");
+        QTest::newRow("keyword") << Term(Term::Keyword, QStringLiteral("$junk")) << QByteArray("1,4");
+        QTest::newRow("unknown keyword") << Term(Term::Keyword, QStringLiteral("$Other")) << QByteArray();
+        QTest::newRow("not keyword") << Term(Term::Keyword, QStringLiteral("$Junk")).setNegated(true) << QByteArray("2:3,5:6");
+        QTest::newRow("uid") << Term(Term::And, QVector<Term>() << Term(Term::Uid, KIMAP2::ImapSet(3, 0)) << Term(Term::Seen).setNegated(true))
+                             << QByteArray("3:4,6");
+        QTest::newRow("uid beyond the highest") << Term(Term::Uid, KIMAP2::ImapSet(100, 0)) << QByteArray("6");
+    }
+
+    void testSearch()
+    {
+        QFETCH(KIMAP2::Term, term);
+        QFETCH(QByteArray, uids);
+
+        FlagsSnapshot snapshot;
+        snapshot.set(1, KIMAP2::MessageFlags() << "\\Seen" << "\\Answered" << "$Junk");
+        snapshot.set(2, KIMAP2::MessageFlags() << "\\Flagged");
+        snapshot.set(3, KIMAP2::MessageFlags() << "\\Draft" << "$Work");
+        snapshot.set(4, KIMAP2::MessageFlags() << "\\Flagged" << "\\Deleted" << "$Junk" << "$Work");
+        snapshot.set(5, KIMAP2::MessageFlags() << "\\Seen" << "\\Deleted");
+        snapshot.set(6, KIMAP2::MessageFlags());
+
+        bool ok = false;
+        QCOMPARE(snapshot.search(term, &ok).toImapSequenceSet(), uids);
+        QVERIFY(ok);
+    }
+
+    void testSearchNeedsServer()
+    {
+        using KIMAP2::Term;
+        FlagsSnapshot snapshot;
+        snapshot.set(1, KIMAP2::MessageFlags() << "\\Seen");
+
+        bool ok = true;
+        QVERIFY(snapshot.search(Term(Term::Subject, QStringLiteral("Hello")), &ok).isEmpty());
+        QVERIFY(!ok);
+        //One key the snapshot doesn't know is enough
+        QVERIFY(snapshot.search(Term(Term::And, QVector<Term>() << Term(Term::Seen) << Term(Term::Recent)), &ok).isEmpty());
+        QVERIFY(!ok);
+        QVERIFY(snapshot.search(Term(Term::SequenceNumber, KIMAP2::ImapSet(1)), &ok).isEmpty());
+        QVERIFY(!ok);
+        QVERIFY(snapshot.search(Term(Term::Uid, KIMAP2::ImapSet::savedSearchResult()), &ok).isEmpty());
+        QVERIFY(!ok);
+        QVERIFY(snapshot.search(Term(), &ok).isEmpty());
+        QVERIFY(!ok);
+    }
+
+    void testApplyAndDiff()
+    {
+        FlagsSnapshot snapshot;
+        snapshot.apply(QVector<FlagsSnapshot::MessageState>()
+                       << message(10, KIMAP2::MessageFlags() << "\\Seen", 1)
+                       << message(4, KIMAP2::MessageFlags(), 2)
+                       << message(7, KIMAP2::MessageFlags() << "$Label1", 3));
+        QCOMPARE(snapshot.uids().toImapSequenceSet(), QByteArray("4,7,10"));
+
+        // Merged in between, and the later of two updates wins
+        snapshot.apply(QVector<FlagsSnapshot::MessageState>()
+                       << message(5, KIMAP2::MessageFlags() << "\\Answered", 4)
+                       << message(7, KIMAP2::MessageFlags() << "\\Seen", 5)
+                       << message(7, KIMAP2::MessageFlags() << "\\Deleted", 6)
+                       << message(1, KIMAP2::MessageFlags(), 7));
+        QCOMPARE(snapshot.uids().toImapSequenceSet(), QByteArray("1,4:5,7,10"));
+        QCOMPARE(snapshot.flags(7), KIMAP2::MessageFlags() << "\\Deleted");
+        QCOMPARE(snapshot.flags(10), KIMAP2::MessageFlags() << "\\Seen");
+        QCOMPARE(snapshot.highestModSequence(), quint64(7));
+
+        const FlagsSnapshot::Diff diff = snapshot.diff(QVector<FlagsSnapshot::MessageState>()
+                                         << message(10, KIMAP2::MessageFlags() << "\\SEEN", 1)
+                                         << message(4, KIMAP2::MessageFlags() << "$Label1", 2)
+                                         << message(5, KIMAP2::MessageFlags() << "\\Answered", 8)
+                                         << message(12, KIMAP2::MessageFlags()));
+        QCOMPARE(diff.added.size(), 1);
+        QCOMPARE(diff.added.first().uid, qint64(12));
+        QCOMPARE(diff.changed.size(), 2);
+        QCOMPARE(diff.changed.at(0).uid, qint64(4));
+        QCOMPARE(diff.changed.at(1).uid, qint64(5));
+    }
+
+    void testLargeModSeq()
+    {
+        FlagsSnapshot snapshot;
+        snapshot.set(1, KIMAP2::MessageFlags(), 3);
+        snapshot.set(2, KIMAP2::MessageFlags(), Q_UINT64_C(90060115205545359));
+        QCOMPARE(snapshot.modSeq(1), quint64(3));
+        QCOMPARE(snapshot.modSeq(2), Q_UINT64_C(90060115205545359));
+        snapshot.remove(KIMAP2::ImapSet(1));
+        QCOMPARE(snapshot.highestModSequence(), Q_UINT64_C(90060115205545359));
+    }
+
+    void testMillionMessages()
+    {
+        QVector<FlagsSnapshot::MessageState> batch;
+        batch.reserve(1000);
+        FlagsSnapshot snapshot;
+        for (qint64 uid = 1; uid <= 1000000; ++uid) {
+            KIMAP2::MessageFlags flags;
+            if (uid % 2) {
+                flags << "\\Seen";
+            }
+            if (uid % 7 == 0) {
+                flags << "$Label" + QByteArray::number(uid % 5);
+            }
+            batch << message(uid, flags, uid + 1000);
+            if (batch.size() == 1000) {
+                snapshot.apply(batch);
+                batch.clear();
+            }
+        }
+        QCOMPARE(snapshot.count(), 1000000);
+        snapshot.squeeze();
+        QVERIFY(snapshot.memoryUsage() < 12 * 1024 * 1024);
+        QCOMPARE(snapshot.flags(14), KIMAP2::MessageFlags() << "$Label4");
+        QCOMPARE(snapshot.modSeq(999999), quint64(1000999));
+        QCOMPARE(snapshot.uids(FlagsSnapshot::Seen).intervals().size(), 500000);
+    }
+};
+
+QTEST_GUILESS_MAIN(FlagsSnapshotTest)
+
+#include "flagssnapshottest.moc"
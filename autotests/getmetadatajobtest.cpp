@@ -332,6 +332,109 @@ private Q_SLOTS:
         fakeServer.quit();
     }
 
+    void testMultipleMailBoxes()
+    {
+        FakeServer fakeServer;
+        //The server only answers once it received all commands
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 GETMETADATA \"Calendar\" (/shared/vendor/kolab/folder-type)"
+                               << "C: A000002 GETMETADATA \"Contacts\" (/shared/vendor/kolab/folder-type)"
+                               << "C: A000003 GETMETADATA \"Notes\" (/shared/vendor/kolab/folder-type)"
+                               << "S: * METADATA \"Calendar\" (/shared/vendor/kolab/folder-type \"event\")"
+                               << "S: A000001 OK GETMETADATA complete"
+                               << "S: * METADATA \"Contacts\" (/shared/vendor/kolab/folder-type \"contact\")"
+                               << "S: A000002 OK GETMETADATA complete"
+                               << "S: * METADATA \"Notes\" (/shared/vendor/kolab/folder-type NIL)"
+                               << "S: A000003 OK GETMETADATA complete");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::GetMetaDataJob *job = new KIMAP2::GetMetaDataJob(&session);
+        job->setServerCapability(KIMAP2::MetaDataJobBase::Metadata);
+        job->setMailBoxes(QStringList() << QStringLiteral("Calendar") << QStringLiteral("Contacts") << QStringLiteral("Notes"));
+        job->addRequestedEntry("/shared/vendor/kolab/folder-type");
+        QStringList received;
+        connect(job, &KIMAP2::GetMetaDataJob::metaDataReceived, [&](const QString &mailBox, const QMap<QByteArray, QByteArray> &metaData) {
+            received << mailBox + QLatin1Char('=') + QString::fromLatin1(metaData.value("/shared/vendor/kolab/folder-type"));
+        });
+        QVERIFY(job->exec());
+
+        QCOMPARE(received, QStringList() << QStringLiteral("Calendar=event") << QStringLiteral("Contacts=contact") << QStringLiteral("Notes="));
+        const QHash<QString, QMap<QByteArray, QByteArray> > metadata = job->allMetaDataForMailboxes();
+        QCOMPARE(metadata.size(), 3);
+        QCOMPARE(metadata.value(QStringLiteral("Contacts")).value("/shared/vendor/kolab/folder-type"), QByteArray("contact"));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testAnnotateWildcard()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 GETANNOTATION \"*\" \"/vendor/kolab/folder-type\" \"value.shared\""
+                               << "S: * ANNOTATION \"Calendar\" \"/vendor/kolab/folder-type\" (\"value.shared\" \"event\")"
+                               << "S: * ANNOTATION \"Tasks\" \"/vendor/kolab/folder-type\" (\"value.shared\" \"task\")"
+                               << "S: A000001 OK annotations retrieved");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::GetMetaDataJob *job = new KIMAP2::GetMetaDataJob(&session);
+        job->setServerCapability(KIMAP2::MetaDataJobBase::Annotatemore);
+        job->setMailBoxes(QStringList() << QStringLiteral("*"));
+        job->addRequestedEntry("/shared/vendor/kolab/folder-type");
+        QVERIFY(job->exec());
+
+        QCOMPARE(job->allMetaDataForMailbox(QStringLiteral("Calendar")).value("/shared/vendor/kolab/folder-type"), QByteArray("event"));
+        QCOMPARE(job->allMetaDataForMailbox(QStringLiteral("Tasks")).value("/shared/vendor/kolab/folder-type"), QByteArray("task"));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testFlatStorage()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 GETANNOTATION \"*\" \"/vendor/kolab/folder-type\" \"value.shared\""
+                               << "S: * ANNOTATION \"Calendar\" \"/vendor/kolab/folder-type\" (\"value.shared\" \"event\")"
+                               << "S: * ANNOTATION \"Tasks\" \"/vendor/kolab/folder-type\" (\"value.shared\" \"task\")"
+                               << "S: * ANNOTATION \"Calendar\" \"/comment\" (\"value.shared\" \"Dates\")"
+                               << "S: A000001 OK annotations retrieved");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::GetMetaDataJob *job = new KIMAP2::GetMetaDataJob(&session);
+        job->setServerCapability(KIMAP2::MetaDataJobBase::Annotatemore);
+        job->setMailBoxes(QStringList() << QStringLiteral("*"));
+        job->addRequestedEntry("/shared/vendor/kolab/folder-type");
+        job->setStorage(KIMAP2::GetMetaDataJob::FlatStorage);
+        QStringList streamed;
+        connect(job, &KIMAP2::GetMetaDataJob::resultReceived, [&streamed](const KIMAP2::GetMetaDataJob::Entry &entry) {
+            streamed << entry.mailBox + QLatin1Char(' ') + QString::fromLatin1(entry.entry);
+        });
+        QVERIFY(job->exec());
+
+        QCOMPARE(streamed, QStringList() << QStringLiteral("Calendar /shared/vendor/kolab/folder-type")
+                 << QStringLiteral("Tasks /shared/vendor/kolab/folder-type") << QStringLiteral("Calendar /shared/comment"));
+        const QVector<KIMAP2::GetMetaDataJob::Entry> entries = job->entries();
+        QCOMPARE(entries.size(), 3);
+        QCOMPARE(entries.at(1).value, QByteArray("task"));
+        QCOMPARE(entries.at(2).attribute, QByteArray("value.shared"));
+        //The names of a mailbox share their data
+        QCOMPARE(entries.at(0).mailBox.constData(), entries.at(2).mailBox.constData());
+        QVERIFY(job->allMetaDataForMailboxes().isEmpty());
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
     void testAnnotateMutiple()
     {
         //Do not double same parts of the request
@@ -286,6 +286,204 @@ private Q_SLOTS:
         fakeServer.quit();
     }
 
+    void shouldReportVanished()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 SELECT \"INBOX\""
+                               << "S: A000001 OK SELECT done"
+                               << "C: A000002 IDLE"
+                               << "S: + OK"
+                               << "S: * VANISHED 405,407:410"
+                               << "S: A000002 OK done idling"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::SelectJob *select = new KIMAP2::SelectJob(&session);
+        select->setMailBox(QStringLiteral("INBOX"));
+        QVERIFY(select->exec());
+
+        KIMAP2::IdleJob *idle = new KIMAP2::IdleJob(&session);
+        QList<QByteArray> vanished;
+        connect(idle, &KIMAP2::IdleJob::mailBoxMessagesVanished, [&](KIMAP2::IdleJob *job, const KIMAP2::ImapSet &uids) {
+            QCOMPARE(job, idle);
+            vanished << uids.toImapSequenceSet();
+        });
+        QVERIFY(idle->exec());
+        QCOMPARE(vanished, QList<QByteArray>() << "405,407:410");
+
+        fakeServer.quit();
+    }
+
+    void shouldReportMessageUpdates()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 SELECT \"INBOX\""
+                               << "S: A000001 OK SELECT done"
+                               << "C: A000002 IDLE"
+                               << "S: + OK"
+                               << "S: * 12 FETCH (UID 4827 FLAGS (\\Seen $Junk) MODSEQ (98305))"
+                               << "S: * 3 FETCH (FLAGS ())"
+                               << "S: * 7 EXPUNGE"
+                               << "S: A000002 OK done idling"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::SelectJob *select = new KIMAP2::SelectJob(&session);
+        select->setMailBox(QStringLiteral("INBOX"));
+        QVERIFY(select->exec());
+
+        KIMAP2::IdleJob *idle = new KIMAP2::IdleJob(&session);
+        QSignalSpy flagsSpy(idle, &KIMAP2::IdleJob::messageFlagsChanged);
+        QSignalSpy expungeSpy(idle, &KIMAP2::IdleJob::messageExpunged);
+        QVERIFY(idle->exec());
+
+        QCOMPARE(flagsSpy.count(), 2);
+        QCOMPARE(flagsSpy.at(0).at(1).toLongLong(), qint64(12));
+        QCOMPARE(flagsSpy.at(0).at(2).toLongLong(), qint64(4827));
+        QCOMPARE(flagsSpy.at(0).at(3).value<QList<QByteArray> >(), QList<QByteArray>() << "\\Seen" << "$Junk");
+        QCOMPARE(flagsSpy.at(0).at(4).toULongLong(), quint64(98305));
+        QCOMPARE(flagsSpy.at(1).at(1).toLongLong(), qint64(3));
+        QCOMPARE(flagsSpy.at(1).at(2).toLongLong(), qint64(0));
+        QVERIFY(flagsSpy.at(1).at(3).value<QList<QByteArray> >().isEmpty());
+        QCOMPARE(flagsSpy.at(1).at(4).toULongLong(), quint64(0));
+        QCOMPARE(expungeSpy.count(), 1);
+        QCOMPARE(expungeSpy.at(0).at(1).toLongLong(), qint64(7));
+
+        fakeServer.quit();
+    }
+
+    void shouldRenewIdle()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 IDLE] localhost Test Library server ready"
+                               << "C: A000001 IDLE"
+                               << "S: + OK"
+                               << "C: DONE"
+                               << "S: A000001 OK done idling"
+                               << "C: A000002 IDLE"
+                               << "S: + OK"
+                               << "S: * 3 EXISTS"
+                               << "S: A000002 OK done idling"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        const int originalTimeout = session.timeout();
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        KIMAP2::IdleJob *idle = new KIMAP2::IdleJob(&session);
+        idle->setRenewInterval(1);
+        QSignalSpy statsSpy(idle, SIGNAL(mailBoxStats(KIMAP2::IdleJob*,QString,int,int)));
+        QVERIFY(idle->exec());
+        QCOMPARE(statsSpy.count(), 1);
+        QCOMPARE(statsSpy.at(0).at(2).toInt(), 3);
+        QCOMPARE(session.timeout(), originalTimeout);
+
+        fakeServer.quit();
+    }
+
+    void shouldPollWithoutIdle()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1] localhost Test Library server ready"
+                               << "C: A000001 NOOP"
+                               << "S: * 4 EXISTS"
+                               << "S: A000001 OK NOOP completed"
+                               << "C: A000002 NOOP"
+                               << "S: * 5 EXISTS"
+                               << "S: A000002 OK NOOP completed"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        KIMAP2::IdleJob *idle = new KIMAP2::IdleJob(&session);
+        idle->setRenewInterval(1);
+        QList<int> counts;
+        connect(idle, &KIMAP2::IdleJob::mailBoxStats, [&](KIMAP2::IdleJob *job, const QString &, int messageCount, int) {
+            counts << messageCount;
+            if (counts.size() == 2) {
+                job->stop();
+            }
+        });
+        QVERIFY(idle->exec());
+        QCOMPARE(counts, QList<int>() << 4 << 5);
+
+        fakeServer.quit();
+    }
+
+    void shouldNotWaitForRecentWithImap4rev2()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev2 IDLE] localhost Test Library server ready"
+                               << "C: A000001 IDLE"
+                               << "S: + OK"
+                               << "S: * 3 EXISTS"
+                               << "W: 500"
+                               << "S: A000001 OK done idling"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        KIMAP2::IdleJob *idle = new KIMAP2::IdleJob(&session);
+        idle->setStatsDelay(1000);
+        QElapsedTimer timer;
+        qint64 statsAfter = -1;
+        connect(idle, &KIMAP2::IdleJob::mailBoxStats, [&](KIMAP2::IdleJob *, const QString &, int messageCount, int recentCount) {
+            QCOMPARE(messageCount, 3);
+            QCOMPARE(recentCount, -1);
+            statsAfter = timer.elapsed();
+        });
+        timer.start();
+        QVERIFY(idle->exec());
+        QVERIFY(statsAfter >= 0);
+        QVERIFY(statsAfter < 400);
+
+        fakeServer.quit();
+    }
+
+    void shouldBatchMessageCounts()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 IDLE"
+                               << "S: + OK"
+                               << "S: * 3 EXISTS"
+                               << "S: * 4 EXISTS"
+                               << "S: * 1 RECENT"
+                               << "S: * 5 EXISTS"
+                               << "S: A000001 OK done idling"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::IdleJob *idle = new KIMAP2::IdleJob(&session);
+        QList<QList<int> > batches;
+        connect(idle, &KIMAP2::IdleJob::messageCountsChanged, [&](KIMAP2::IdleJob *, const QString &, const QList<int> &counts) {
+            batches << counts;
+        });
+        QVERIFY(idle->exec());
+        QCOMPARE(batches, QList<QList<int> >() << (QList<int>() << 3 << 4 << 5));
+
+        fakeServer.quit();
+    }
+
 };
 
 QTEST_GUILESS_MAIN(IdleJobTest)
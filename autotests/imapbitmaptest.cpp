@@ -0,0 +1,134 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+#include <qtest.h>
+
+#include "kimap2/imapbitmap.h"
+
+#include <QtTest>
+
+using namespace KIMAP2;
+
+class ImapBitmapTest : public QObject
+{
+    Q_OBJECT
+
+private:
+    // Every other value from begin to end, so that ImapSet can't merge anything
+    static ImapBitmap alternating(ImapBitmap::Id begin, ImapBitmap::Id end)
+    {
+        ImapBitmap set;
+        for (ImapBitmap::Id id = begin; id <= end; id += 2) {
+            set.add(id);
+        }
+        return set;
+    }
+
+private Q_SLOTS:
+    void testSparse()
+    {
+        ImapBitmap set;
+        QVERIFY(set.isEmpty());
+        set.add(5);
+        set.add(3);
+        set.add(4);
+        set.add(70000);
+        set.add(10, 12);
+        set.add(4);
+        QCOMPARE(set.count(), ImapBitmap::Id(7));
+        QVERIFY(set.contains(3));
+        QVERIFY(set.contains(70000));
+        QVERIFY(!set.contains(6));
+        QVERIFY(!set.contains(0));
+        QCOMPARE(set.toImapSequenceSet(), QByteArray("3:5,10:12,70000"));
+
+        set.remove(4);
+        set.remove(70000);
+        set.remove(8);
+        QCOMPARE(set.count(), ImapBitmap::Id(5));
+        QCOMPARE(set.toImapSequenceSet(), QByteArray("3,5,10:12"));
+
+        //Not a UID
+        set.add(0);
+        set.add(0, 1);
+        set.add(Q_INT64_C(0xFFFFFFFF), Q_INT64_C(0x100000001));
+        QVERIFY(!set.contains(0));
+        QCOMPARE(set.count(), ImapBitmap::Id(7));
+        QCOMPARE(set.toImapSequenceSet(), QByteArray("1,3,5,10:12,4294967295"));
+    }
+
+    void testDense()
+    {
+        const ImapBitmap set = alternating(1, 20001);
+        QCOMPARE(set.count(), ImapBitmap::Id(10001));
+        QVERIFY(set.contains(20001));
+        QVERIFY(!set.contains(20000));
+
+        ImapBitmap copy = set;
+        copy.add(1, 100000);
+        QCOMPARE(copy.count(), ImapBitmap::Id(100000));
+        QCOMPARE(copy.toImapSequenceSet(), QByteArray("1:100000"));
+        QCOMPARE(set.count(), ImapBitmap::Id(10001));
+
+        // Going back below the limit gives the same set as building it sparse
+        ImapBitmap shrinking = alternating(1, 8193);
+        for (ImapBitmap::Id id = 1; id <= 8193; id += 4) {
+            shrinking.remove(id);
+        }
+        ImapBitmap sparse;
+        for (ImapBitmap::Id id = 3; id <= 8193; id += 4) {
+            sparse.add(id);
+        }
+        QCOMPARE(shrinking.count(), ImapBitmap::Id(2048));
+        QCOMPARE(shrinking, sparse);
+    }
+
+    void testSetAlgebra()
+    {
+        const ImapBitmap odd = alternating(1, 20001);
+        const ImapBitmap even = alternating(2, 20000);
+        ImapBitmap low;
+        low.add(1, 10);
+
+        QCOMPARE(odd.united(even).toImapSequenceSet(), QByteArray("1:20001"));
+        QVERIFY(odd.intersected(even).isEmpty());
+        QCOMPARE(odd.subtracted(even), odd);
+
+        QCOMPARE(odd.intersected(low).toImapSequenceSet(), QByteArray("1,3,5,7,9"));
+        QCOMPARE(low.intersected(odd), odd.intersected(low));
+        QCOMPARE(low.subtracted(odd).toImapSequenceSet(), QByteArray("2,4,6,8,10"));
+        QCOMPARE(odd.subtracted(low).count(), odd.count() - 5);
+        QCOMPARE(low.united(odd).count(), odd.count() + 5);
+
+        ImapBitmap far;
+        far.add(4294967295LL);
+        QCOMPARE(far.united(low).toImapSequenceSet(), QByteArray("1:10,4294967295"));
+        QVERIFY(far.intersected(low).isEmpty());
+    }
+
+    void testFromImapSet()
+    {
+        const ImapSet set = ImapSet::fromImapSequenceSet("3:5,1,9:*");
+        QCOMPARE(ImapBitmap::fromImapSet(set, 12).toImapSequenceSet(), QByteArray("1,3:5,9:12"));
+        QCOMPARE(ImapBitmap::fromImapSet(set).toImapSequenceSet(), QByteArray("1,3:5,9"));
+        QVERIFY(ImapBitmap::fromImapSet(ImapSet::savedSearchResult()).isEmpty());
+        QCOMPARE(ImapBitmap::fromImapSet(set, 12).toImapSet(), ImapSet::fromImapSequenceSet("1,3:5,9:12"));
+    }
+};
+
+QTEST_GUILESS_MAIN(ImapBitmapTest)
+
+#include "imapbitmaptest.moc"
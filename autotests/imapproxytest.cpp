@@ -0,0 +1,205 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+#include <qtest.h>
+
+#include "kimap2test/loadserver.h"
+#include "kimap2/imapproxy.h"
+#include "kimap2/fetchjob.h"
+#include "kimap2/loginjob.h"
+#include "kimap2/selectjob.h"
+#include "kimap2/session.h"
+#include "kimap2/sessionpool.h"
+#include "kimap2/storejob.h"
+
+#include <QtTest>
+
+using namespace KIMAP2;
+
+class ImapProxyTest: public QObject
+{
+    Q_OBJECT
+
+private:
+    static bool select(Session *session, const QString &mailBox = QStringLiteral("INBOX"))
+    {
+        SelectJob *job = new SelectJob(session);
+        job->setMailBox(mailBox);
+        return job->exec();
+    }
+
+    static int fetchFlags(Session *session)
+    {
+        FetchJob::FetchScope scope;
+        scope.mode = FetchJob::FetchScope::Flags;
+        FetchJob *job = new FetchJob(session);
+        job->setUidBased(true);
+        job->setSequenceSet(ImapSet(1, 0));
+        job->setScope(scope);
+        int results = 0;
+        connect(job, &FetchJob::resultReceived, [&results](const FetchJob::Result &) {
+            results++;
+        });
+        if (!job->exec()) {
+            return -1;
+        }
+        return results;
+    }
+
+private Q_SLOTS:
+    void testSharedBackend()
+    {
+        LoadServer::Options options;
+        options.port = 0;
+        options.messages = 20;
+        LoadServer server(options);
+        QVERIFY(server.startAndWait());
+
+        SessionPool pool(QStringLiteral("127.0.0.1"), server.port(), SessionPool::SessionSetup());
+        pool.setMaximumSessions(1);
+        ImapProxy proxy(&pool);
+        QVERIFY(proxy.listen());
+
+        Session first(QStringLiteral("127.0.0.1"), proxy.serverPort());
+        Session second(QStringLiteral("127.0.0.1"), proxy.serverPort());
+        QVERIFY(select(&first));
+        QVERIFY(select(&second));
+        QCOMPARE(first.selectedMailBox(), QStringLiteral("INBOX"));
+        QCOMPARE(fetchFlags(&first), 20);
+        QCOMPARE(fetchFlags(&second), 20);
+
+        QCOMPARE(proxy.clientCount(), 2);
+        QCOMPARE(server.connectionCount(), 1);
+    }
+
+    void testUpdatesReachOtherClients()
+    {
+        LoadServer::Options options;
+        options.port = 0;
+        options.messages = 10;
+        LoadServer server(options);
+        QVERIFY(server.startAndWait());
+
+        SessionPool pool(QStringLiteral("127.0.0.1"), server.port(), SessionPool::SessionSetup());
+        pool.setMaximumSessions(1);
+        ImapProxy proxy(&pool);
+        QVERIFY(proxy.listen());
+
+        Session first(QStringLiteral("127.0.0.1"), proxy.serverPort());
+        Session second(QStringLiteral("127.0.0.1"), proxy.serverPort());
+        QVERIFY(select(&first));
+        QVERIFY(select(&second));
+
+        StoreJob *store = new StoreJob(&first);
+        store->setUidBased(true);
+        store->setSequenceSet(ImapSet(3));
+        store->setFlags(MessageFlags() << "\\Flagged");
+        store->setMode(StoreJob::AppendFlags);
+        QVERIFY(store->exec());
+
+        QList<QList<QByteArray> > untagged;
+        bool done = false;
+        second.sendCommand("NOOP", QByteArray(), [&](const CommandResult &result) {
+            QVERIFY(result.isOk());
+            untagged = result.untaggedResponses;
+            done = true;
+        });
+        QTRY_VERIFY(done);
+        QCOMPARE(untagged.size(), 1);
+        QCOMPARE(untagged.first().value(2), QByteArray("FETCH"));
+    }
+
+    void testRefusesSessionCommands()
+    {
+        LoadServer::Options options;
+        options.port = 0;
+        options.messages = 1;
+        LoadServer server(options);
+        QVERIFY(server.startAndWait());
+
+        SessionPool pool(QStringLiteral("127.0.0.1"), server.port(), SessionPool::SessionSetup());
+        ImapProxy proxy(&pool);
+        QVERIFY(proxy.listen());
+
+        Session session(QStringLiteral("127.0.0.1"), proxy.serverPort());
+        QByteArray status;
+        session.sendCommand("COMPRESS", "DEFLATE", [&](const CommandResult &result) {
+            status = result.status;
+        });
+        QTRY_COMPARE(status, QByteArray("BAD"));
+        QVERIFY(select(&session));
+    }
+
+    void testExamineIsReadOnly()
+    {
+        LoadServer::Options options;
+        options.port = 0;
+        options.messages = 10;
+        LoadServer server(options);
+        QVERIFY(server.startAndWait());
+
+        SessionPool pool(QStringLiteral("127.0.0.1"), server.port(), SessionPool::SessionSetup());
+        ImapProxy proxy(&pool);
+        QVERIFY(proxy.listen());
+
+        Session session(QStringLiteral("127.0.0.1"), proxy.serverPort());
+        SelectJob *examine = new SelectJob(&session);
+        examine->setMailBox(QStringLiteral("INBOX"));
+        examine->setOpenReadOnly(true);
+        QVERIFY(examine->exec());
+
+        StoreJob *store = new StoreJob(&session);
+        store->setUidBased(true);
+        store->setSequenceSet(ImapSet(3));
+        store->setFlags(MessageFlags() << "\\Flagged");
+        store->setMode(StoreJob::AppendFlags);
+        QVERIFY(!store->exec());
+        QCOMPARE(fetchFlags(&session), 10);
+    }
+
+    void testLogin()
+    {
+        LoadServer::Options options;
+        options.port = 0;
+        options.messages = 1;
+        LoadServer server(options);
+        QVERIFY(server.startAndWait());
+
+        SessionPool pool(QStringLiteral("127.0.0.1"), server.port(), SessionPool::SessionSetup());
+        ImapProxy proxy(&pool);
+        proxy.setAuthenticator([](const QString &user, const QString &password) {
+            return user == QLatin1String("user") && password == QLatin1String("secret");
+        });
+        QVERIFY(proxy.listen());
+
+        Session rejected(QStringLiteral("127.0.0.1"), proxy.serverPort());
+        LoginJob *login = new LoginJob(&rejected);
+        login->setUserName(QStringLiteral("user"));
+        login->setPassword(QStringLiteral("wrong"));
+        QVERIFY(!login->exec());
+
+        Session session(QStringLiteral("127.0.0.1"), proxy.serverPort());
+        login = new LoginJob(&session);
+        login->setUserName(QStringLiteral("user"));
+        login->setPassword(QStringLiteral("secret"));
+        QVERIFY(login->exec());
+        QVERIFY(select(&session));
+    }
+};
+
+QTEST_GUILESS_MAIN(ImapProxyTest)
+
+#include "imapproxytest.moc"
@@ -62,6 +62,12 @@ private Q_SLOTS:
         set = ImapSet(7, 10);
         set.add(QVector<ImapSet::Id>() << 5 << 3);
         QTest::newRow("one interval and two values") << set << QByteArray("7:10,3,5");
+
+        set = ImapSet(4294967295LL, 9223372036854775807LL);
+        set.add(10);
+        QTest::newRow("large values") << set << QByteArray("4294967295:9223372036854775807,10");
+
+        QTest::newRow("saved search result") << ImapSet::savedSearchResult() << QByteArray("$");
     }
 
     void shouldConvertToAndFromByteArray()
@@ -75,6 +81,54 @@ private Q_SLOTS:
         QCOMPARE(ImapSet::fromImapSequenceSet(byteArray), imapSet);
     }
 
+    void testFromInvalidSequence_data()
+    {
+        QTest::addColumn<QByteArray>("sequence");
+
+        QTest::newRow("empty") << QByteArray();
+        QTest::newRow("no number") << QByteArray("foo");
+        QTest::newRow("no begin") << QByteArray(":5");
+        QTest::newRow("no end") << QByteArray("5:");
+        QTest::newRow("trailing garbage") << QByteArray("5:*x");
+        QTest::newRow("three values") << QByteArray("3:4:5");
+        QTest::newRow("overflow") << QByteArray("9223372036854775808");
+    }
+
+    void testFromInvalidSequence()
+    {
+        QFETCH(QByteArray, sequence);
+
+        QCOMPARE(ImapInterval::fromImapSequence(sequence), ImapInterval());
+        // The set keeps the invalid interval empty and goes on with the next one
+        const QVector<ImapSet::Range> ranges = ImapSet::fromImapSequenceSet("7," + sequence + ",9").ranges();
+        QCOMPARE(ranges.size(), sequence.isEmpty() ? 2 : 3);
+        QCOMPARE(ranges.last().begin, ImapSet::Id(9));
+    }
+
+    void testRanges()
+    {
+        ImapSet set = ImapSet::fromImapSequenceSet("7:10,12,3:*,foo");
+        const QVector<ImapSet::Range> ranges = set.ranges();
+        QCOMPARE(ranges.size(), 4);
+        QCOMPARE(ranges.at(0).begin, ImapSet::Id(7));
+        QCOMPARE(ranges.at(0).end, ImapSet::Id(10));
+        QCOMPARE(ranges.at(1).begin, ImapSet::Id(12));
+        QCOMPARE(ranges.at(1).end, ImapSet::Id(12));
+        QCOMPARE(ranges.at(2).begin, ImapSet::Id(3));
+        QCOMPARE(ranges.at(2).end, ImapSet::Id(0));
+        // Invalid intervals are kept empty, as with ImapInterval::fromImapSequence()
+        QCOMPARE(ranges.at(3).begin, ImapSet::Id(0));
+        QCOMPARE(set.intervals().at(2), ImapInterval(3));
+
+        ImapSet other(12);
+        other.add(ImapInterval(3));
+        other.add(ImapInterval());
+        other.add(ImapInterval(7, 10));
+        QCOMPARE(other, set);
+        other.add(5);
+        QVERIFY(!(other == set));
+    }
+
     void testOptimize_data()
     {
         QTest::addColumn<ImapSet>("imapSet");
@@ -168,6 +222,116 @@ private Q_SLOTS:
         QCOMPARE(imapSet.intervals().size(), expectedString.count(",") + 1);
         QCOMPARE(imapSet.toImapSequenceSet(), expectedString);
     }
+
+    void testSetAlgebra_data()
+    {
+        QTest::addColumn<QByteArray>("first");
+        QTest::addColumn<QByteArray>("second");
+        QTest::addColumn<QByteArray>("united");
+        QTest::addColumn<QByteArray>("intersected");
+        QTest::addColumn<QByteArray>("subtracted");
+
+        QTest::newRow("Disjoint") << "1:3"_ba << "5:7"_ba << "1:3,5:7"_ba << ""_ba << "1:3"_ba;
+        QTest::newRow("Neighbours") << "1:3"_ba << "4:7"_ba << "1:7"_ba << ""_ba << "1:3"_ba;
+        QTest::newRow("Overlapping") << "1:5"_ba << "3:8"_ba << "1:8"_ba << "3:5"_ba << "1:2"_ba;
+        QTest::newRow("Hole") << "1:10"_ba << "4:6"_ba << "1:10"_ba << "4:6"_ba << "1:3,7:10"_ba;
+        QTest::newRow("Unsorted") << "9,1:3,5"_ba << "2,5:8"_ba << "1:3,5:9"_ba << "2,5"_ba << "1,3,9"_ba;
+        QTest::newRow("Spanning") << "1:3,5:7,9:11"_ba << "2:10"_ba << "1:11"_ba << "2:3,5:7,9:10"_ba << "1,11"_ba;
+        QTest::newRow("Open end") << "5:*"_ba << "1:3,7:9"_ba << "1:3,5:*"_ba << "7:9"_ba << "5:6,10:*"_ba;
+        QTest::newRow("Both open") << "5:*"_ba << "3,8:*"_ba << "3,5:*"_ba << "8:*"_ba << "5:7"_ba;
+        QTest::newRow("Covered") << "4:6"_ba << "1:*"_ba << "1:*"_ba << "4:6"_ba << ""_ba;
+        QTest::newRow("Empty") << "1:3"_ba << ""_ba << "1:3"_ba << ""_ba << "1:3"_ba;
+    }
+
+    void testSetAlgebra()
+    {
+        QFETCH(QByteArray, first);
+        QFETCH(QByteArray, second);
+        QFETCH(QByteArray, united);
+        QFETCH(QByteArray, intersected);
+        QFETCH(QByteArray, subtracted);
+
+        const ImapSet a = ImapSet::fromImapSequenceSet(first);
+        const ImapSet b = ImapSet::fromImapSequenceSet(second);
+        QCOMPARE(a.united(b).toImapSequenceSet(), united);
+        QCOMPARE(b.united(a).toImapSequenceSet(), united);
+        QCOMPARE(a.intersected(b).toImapSequenceSet(), intersected);
+        QCOMPARE(b.intersected(a).toImapSequenceSet(), intersected);
+        QCOMPARE(a.subtracted(b).toImapSequenceSet(), subtracted);
+    }
+
+    void testSplit()
+    {
+        const ImapSet set = ImapSet::fromImapSequenceSet("1,3,5:7,100:200,300:*");
+        QList<ImapSet> chunks = set.split(7);
+        QCOMPARE(chunks.size(), 3);
+        QCOMPARE(chunks.at(0).toImapSequenceSet(), "1,3,5:7"_ba);
+        QCOMPARE(chunks.at(1).toImapSequenceSet(), "100:200"_ba);
+        QCOMPARE(chunks.at(2).toImapSequenceSet(), "300:*"_ba);
+
+        // An interval doesn't get split, even when it is too long
+        chunks = set.split(3);
+        QCOMPARE(chunks.size(), 4);
+        QCOMPARE(chunks.at(0).toImapSequenceSet(), "1,3"_ba);
+        QCOMPARE(chunks.at(2).toImapSequenceSet(), "100:200"_ba);
+
+        QCOMPARE(set.split(0), QList<ImapSet>() << set);
+        QCOMPARE(ImapSet().split(10), QList<ImapSet>() << ImapSet());
+        QVERIFY(ImapSet::savedSearchResult().split(10).first().isSavedSearchResult());
+    }
+
+    void testContains()
+    {
+        const ImapSet set = ImapSet::fromImapSequenceSet("3:5,9,20:*");
+        QVERIFY(!set.contains(1));
+        QVERIFY(set.contains(3));
+        QVERIFY(set.contains(5));
+        QVERIFY(!set.contains(6));
+        QVERIFY(set.contains(9));
+        QVERIFY(!set.contains(19));
+        QVERIFY(set.contains(20));
+        QVERIFY(set.contains(100000));
+        QVERIFY(!ImapSet().contains(1));
+
+        // Tokens that don't parse give invalid intervals, which are empty
+        const ImapSet garbled = ImapSet::fromImapSequenceSet("x");
+        QVERIFY(!garbled.contains(5));
+        QVERIFY(!garbled.contains(0));
+        QCOMPARE(garbled.contains(5), !garbled.intersected(ImapSet(5)).isEmpty());
+        const ImapSet mixed = ImapSet::fromImapSequenceSet("3,x");
+        QVERIFY(mixed.contains(3));
+        QVERIFY(!mixed.contains(4));
+    }
+
+    void testBuilder()
+    {
+        ImapSetBuilder builder;
+        QVERIFY(builder.isEmpty());
+        for (ImapSet::Id id : {1, 2, 3, 5, 5, 6, 9}) {
+            builder.add(id);
+        }
+        QVERIFY(!builder.isEmpty());
+        ImapSet set = builder.toSet();
+        QCOMPARE(set.toImapSequenceSet(), "1:3,5:6,9"_ba);
+
+        // Adding more doesn't touch the set handed out before
+        builder.add(10);
+        builder.add(7);
+        builder.add(2);
+        QCOMPARE(set.toImapSequenceSet(), "1:3,5:6,9"_ba);
+        QCOMPARE(builder.toSet().toImapSequenceSet(), "1:3,5:7,9:10"_ba);
+
+        builder.add(12, 0);
+        builder.add(15);
+        builder.add(11);
+        QCOMPARE(builder.toSet().toImapSequenceSet(), "1:3,5:7,9:*"_ba);
+
+        builder.clear();
+        QVERIFY(builder.isEmpty());
+        builder.add(8);
+        builder.add(4, 7);
+        QCOMPARE(builder.toSet().toImapSequenceSet(), "4:8"_ba);
+    }
 };
 
 QTEST_GUILESS_MAIN(ImapSetTest)
@@ -0,0 +1,103 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+#include <qtest.h>
+
+#include "kimap2test/fakeserver.h"
+#include "kimap2/session.h"
+#include "kimap2/capabilitiesjob.h"
+#include "kimap2/jobcoroutine.h"
+#include "kimap2/selectjob.h"
+
+#include <QtTest>
+
+using namespace KIMAP2;
+
+#ifdef KIMAP2_HAVE_COROUTINES
+struct SyncState {
+    QStringList capabilities;
+    int messageCount = -1;
+    int selectError = -1;
+    int failingError = -1;
+    bool done = false;
+};
+
+static Task synchronize(Session *session, SyncState *state)
+{
+    CapabilitiesJob *capabilities = new CapabilitiesJob(session);
+    if (co_await *capabilities) {
+        co_return;
+    }
+    state->capabilities = capabilities->capabilities();
+
+    SelectJob *select = new SelectJob(session);
+    select->setMailBox(QStringLiteral("INBOX"));
+    state->selectError = co_await *select;
+    state->messageCount = select->messageCount();
+
+    SelectJob *failing = new SelectJob(session);
+    failing->setMailBox(QStringLiteral("Missing"));
+    //Awaiting a future doesn't start the job
+    failing->start();
+    state->failingError = co_await failing->future();
+    state->done = true;
+}
+#endif
+
+class JobCoroutineTest: public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+
+    void testAwaitJobs()
+    {
+#ifndef KIMAP2_HAVE_COROUTINES
+        QSKIP("Built without coroutine support");
+#else
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 CAPABILITY"
+                               << "S: * CAPABILITY IMAP4rev1"
+                               << "S: A000001 OK CAPABILITY completed"
+                               << "C: A000002 SELECT \"INBOX\""
+                               << "S: * 3 EXISTS"
+                               << "S: A000002 OK [READ-WRITE] SELECT completed"
+                               << "C: A000003 SELECT \"Missing\""
+                               << "S: A000003 NO No such mailbox"
+                              );
+        fakeServer.startAndWait();
+
+        Session session(QStringLiteral("127.0.0.1"), 5989);
+        SyncState state;
+        synchronize(&session, &state);
+
+        QTRY_VERIFY(state.done);
+        QCOMPARE(state.capabilities, QStringList() << QStringLiteral("IMAP4REV1"));
+        QCOMPARE(state.selectError, 0);
+        QCOMPARE(state.messageCount, 3);
+        QCOMPARE(state.failingError, int(CommandFailed));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+#endif
+    }
+};
+
+QTEST_GUILESS_MAIN(JobCoroutineTest)
+
+#include "jobcoroutinetest.moc"
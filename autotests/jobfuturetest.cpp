@@ -0,0 +1,116 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+#include <qtest.h>
+
+#include "kimap2test/fakeserver.h"
+#include "kimap2/session.h"
+#include "kimap2/capabilitiesjob.h"
+#include "kimap2/selectjob.h"
+
+#include <QtTest>
+
+using namespace KIMAP2;
+
+class JobFutureTest: public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+
+    void testChain()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 CAPABILITY"
+                               << "S: * CAPABILITY IMAP4rev1"
+                               << "S: A000001 OK CAPABILITY completed"
+                               << "C: A000002 SELECT \"INBOX\""
+                               << "S: * 3 EXISTS"
+                               << "S: A000002 OK [READ-WRITE] SELECT completed"
+                              );
+        fakeServer.startAndWait();
+
+        Session session(QStringLiteral("127.0.0.1"), 5989);
+        CapabilitiesJob *capabilities = new CapabilitiesJob(&session);
+        QStringList received;
+        int messageCount = -1;
+        bool finished = false;
+        int error = -1;
+        capabilities->future().then([&received](Job *job) -> Job * {
+            received = static_cast<CapabilitiesJob *>(job)->capabilities();
+            SelectJob *select = new SelectJob(job->session());
+            select->setMailBox(QStringLiteral("INBOX"));
+            return select;
+        }).then([&messageCount](Job *job) -> Job * {
+            messageCount = static_cast<SelectJob *>(job)->messageCount();
+            return Q_NULLPTR;
+        }).onFinished([&](int finishedError, const QString &) {
+            error = finishedError;
+            finished = true;
+        });
+        capabilities->start();
+
+        QTRY_VERIFY(finished);
+        QCOMPARE(error, 0);
+        QCOMPARE(received, QStringList() << QStringLiteral("IMAP4REV1"));
+        QCOMPARE(messageCount, 3);
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testFailureSkipsContinuations()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 CAPABILITY"
+                               << "S: A000001 BAD command unknown or arguments invalid"
+                              );
+        fakeServer.startAndWait();
+
+        Session session(QStringLiteral("127.0.0.1"), 5989);
+        CapabilitiesJob *capabilities = new CapabilitiesJob(&session);
+        bool called = false;
+        const JobFuture future = capabilities->future().then([&called](Job *) -> Job * {
+            called = true;
+            return Q_NULLPTR;
+        });
+        QVERIFY(!future.isFinished());
+        capabilities->start();
+
+        QTRY_VERIFY(future.isFinished());
+        QVERIFY(!called);
+        QCOMPARE(future.error(), int(CommandFailed));
+        QVERIFY(!future.errorText().isEmpty());
+
+        //Continuations added later are called right away
+        bool finishedLate = false;
+        future.onFinished([&finishedLate](int, const QString &) {
+            finishedLate = true;
+        });
+        QVERIFY(finishedLate);
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+};
+
+QTEST_GUILESS_MAIN(JobFutureTest)
+
+#include "jobfuturetest.moc"
@@ -0,0 +1,104 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+#include "allocationcounter.h"
+
+#include <cstddef>
+
+// Totals of the thread since it started, the counters keep the values they started at
+static thread_local int s_active = 0;
+static thread_local qint64 s_allocations = 0;
+static thread_local qint64 s_bytes = 0;
+
+#ifdef __GLIBC__
+#include <malloc.h>
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+}
+
+static inline void countAllocation(size_t size)
+{
+    if (s_active) {
+        ++s_allocations;
+        s_bytes += size;
+    }
+}
+
+// The executable's definitions take precedence over the ones in libc, also for the libraries
+extern "C" void *malloc(size_t size) __THROW
+{
+    countAllocation(size);
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size) __THROW
+{
+    countAllocation(count * size);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) __THROW
+{
+    countAllocation(size);
+    return __libc_realloc(ptr, size);
+}
+#endif
+
+AllocationCounter::AllocationCounter()
+    : m_allocations(s_allocations),
+    m_bytes(s_bytes),
+    m_running(true)
+{
+    ++s_active;
+}
+
+AllocationCounter::~AllocationCounter()
+{
+    stop();
+}
+
+void AllocationCounter::stop()
+{
+    if (!m_running) {
+        return;
+    }
+    m_running = false;
+    --s_active;
+    m_allocations = s_allocations - m_allocations;
+    m_bytes = s_bytes - m_bytes;
+}
+
+qint64 AllocationCounter::allocations() const
+{
+    return m_running ? s_allocations - m_allocations : m_allocations;
+}
+
+qint64 AllocationCounter::bytes() const
+{
+    return m_running ? s_bytes - m_bytes : m_bytes;
+}
+
+bool AllocationCounter::isSupported()
+{
+#ifdef __GLIBC__
+    return true;
+#else
+    return false;
+#endif
+}
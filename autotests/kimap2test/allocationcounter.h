@@ -0,0 +1,69 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+#include <QtGlobal>
+
+/**
+ * Counts the heap allocations made by the current thread while it exists.
+ *
+ * malloc, calloc and realloc are interposed by linking this in, which covers QByteArray,
+ * the Qt containers and operator new. Other threads, like the one of a FakeServer, aren't
+ * counted. Counters can be nested.
+ *
+ * @code
+ * AllocationCounter counter;
+ * parser.parseStream();
+ * counter.stop();
+ * QVERIFY(counter.allocations() <= 2);
+ * @endcode
+ *
+ * Counting needs glibc, see isSupported(). Elsewhere all counts stay 0.
+ */
+class AllocationCounter
+{
+public:
+    AllocationCounter();
+    ~AllocationCounter();
+
+    /**
+     * Stops counting, the counts keep their values.
+     */
+    void stop();
+
+    /**
+     * The number of allocations, a realloc counts as one.
+     */
+    qint64 allocations() const;
+
+    /**
+     * The number of bytes requested by the allocations.
+     */
+    qint64 bytes() const;
+
+    static bool isSupported();
+
+private:
+    Q_DISABLE_COPY(AllocationCounter)
+
+    qint64 m_allocations;
+    qint64 m_bytes;
+    bool m_running;
+};
+
+#endif
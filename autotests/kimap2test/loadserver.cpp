@@ -0,0 +1,1321 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+#include "loadserver.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QLocale>
+#include <QMutex>
+#include <QSet>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QThread>
+#include <QTimer>
+#include <QVector>
+
+#include <algorithm>
+#include <cctype>
+#include <functional>
+
+#include "kimap2/imapset.h"
+
+enum Flag {
+    Seen = 1,
+    Answered = 2,
+    Flagged = 4,
+    Deleted = 8,
+    Draft = 16
+};
+
+static const struct {
+    Flag flag;
+    const char *name;
+} flagNames[] = {
+    { Seen, "\\Seen" },
+    { Answered, "\\Answered" },
+    { Flagged, "\\Flagged" },
+    { Deleted, "\\Deleted" },
+    { Draft, "\\Draft" }
+};
+
+// What is generated and written ahead of the socket
+static const int chunkSize = 64 * 1024;
+
+static QByteArray flagList(quint8 flags)
+{
+    QByteArray result("(");
+    for (const auto &entry : flagNames) {
+        if (flags & entry.flag) {
+            if (result.size() > 1) {
+                result += ' ';
+            }
+            result += entry.name;
+        }
+    }
+    return result + ')';
+}
+
+static quint8 parseFlags(const QList<QByteArray> &names)
+{
+    quint8 flags = 0;
+    for (const QByteArray &name : names) {
+        for (const auto &entry : flagNames) {
+            if (qstricmp(name.constData(), entry.name) == 0) {
+                flags |= entry.flag;
+            }
+        }
+    }
+    return flags;
+}
+
+static QByteArray quoted(const QByteArray &string)
+{
+    QByteArray result("\"");
+    for (const char c : string) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+        }
+        result += c;
+    }
+    return result + '"';
+}
+
+static QByteArray literal(const QByteArray &data)
+{
+    return '{' + QByteArray::number(data.size()) + "}\r\n" + data;
+}
+
+/*
+ * Splits a command line into its arguments.
+ *
+ * Parenthesized lists and bracketed sections stay in one piece, quotes are removed.
+ */
+static QList<QByteArray> tokenize(const QByteArray &line)
+{
+    QList<QByteArray> tokens;
+    int i = 0;
+    while (i < line.size()) {
+        if (line[i] == ' ') {
+            ++i;
+            continue;
+        }
+        QByteArray token;
+        if (line[i] == '"') {
+            for (++i; i < line.size() && line[i] != '"'; ++i) {
+                if (line[i] == '\\' && i + 1 < line.size()) {
+                    ++i;
+                }
+                token += line[i];
+            }
+            ++i;
+        } else {
+            int depth = 0;
+            bool inQuotes = false;
+            const int start = i;
+            for (; i < line.size(); ++i) {
+                const char c = line[i];
+                if (inQuotes) {
+                    if (c == '\\') {
+                        ++i;
+                    } else if (c == '"') {
+                        inQuotes = false;
+                    }
+                } else if (c == '"') {
+                    inQuotes = true;
+                } else if (c == '(' || c == '[') {
+                    ++depth;
+                } else if (c == ')' || c == ']') {
+                    --depth;
+                } else if (c == ' ' && depth <= 0) {
+                    break;
+                }
+            }
+            token = line.mid(start, i - start);
+        }
+        tokens << token;
+    }
+    return tokens;
+}
+
+static QList<QByteArray> listItems(const QByteArray &token)
+{
+    if (token.startsWith('(') && token.endsWith(')')) {
+        return tokenize(token.mid(1, token.size() - 2));
+    }
+    return QList<QByteArray>() << token;
+}
+
+static QByteArray dateTime(qint64 uid, const char *format)
+{
+    // A message a minute, starting at the start of 2016
+    const QDateTime time = QDateTime::fromMSecsSinceEpoch((1451606400 + uid * 60) * 1000LL, Qt::UTC);
+    return QLocale::c().toString(time, QLatin1String(format)).toLatin1();
+}
+
+static int lineCount(const QByteArray &data)
+{
+    return data.count("\r\n");
+}
+
+/*
+ * The mailboxes, shared by the threads.
+ *
+ * Message content is the same for all messages apart from the headers.
+ */
+class LoadServerStore : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Mailbox {
+        QByteArray name;
+        QVector<qint64> uids;
+        QVector<quint8> flags;
+        qint64 uidNext;
+    };
+
+    explicit LoadServerStore(const LoadServer::Options &options)
+        : options(options),
+          newMessageTimer(this)
+    {
+        QByteArray line("The quick brown fox jumps over the lazy dog, again and again and again.\r\n");
+        if (options.shape == LoadServer::Options::Plain) {
+            text = repeat(line, options.bodySize);
+            body = text;
+            contentType = "Content-Type: text/plain; charset=us-ascii\r\n";
+            bodyStructure = "(\"TEXT\" \"PLAIN\" (\"CHARSET\" \"us-ascii\") NIL NIL \"7BIT\" "
+                            + QByteArray::number(body.size()) + ' ' + QByteArray::number(lineCount(body)) + " NIL NIL NIL NIL)";
+        } else {
+            text = repeat(line, qMin(options.bodySize / 4, 4096));
+            attachment = repeat("QUJDREVGR0hJSktMTU5PUFFSU1RVVldYWVphYmNkZWZnaGlqa2xtbm9wcXJzdHV2d3h5ejAxMjM0NTY3\r\n",
+                                qMax(0, options.bodySize - text.size()));
+            textHeader = "Content-Type: text/plain; charset=us-ascii\r\n\r\n";
+            attachmentHeader = "Content-Type: application/octet-stream; name=\"data.bin\"\r\n"
+                               "Content-Transfer-Encoding: base64\r\n"
+                               "Content-Disposition: attachment; filename=\"data.bin\"\r\n\r\n";
+            body = "--loadserver\r\n" + textHeader + text + "\r\n--loadserver\r\n" + attachmentHeader + attachment + "\r\n--loadserver--\r\n";
+            contentType = "Content-Type: multipart/mixed; boundary=\"loadserver\"\r\n";
+            bodyStructure = "((\"TEXT\" \"PLAIN\" (\"CHARSET\" \"us-ascii\") NIL NIL \"7BIT\" "
+                            + QByteArray::number(text.size()) + ' ' + QByteArray::number(lineCount(text)) + " NIL NIL NIL NIL)"
+                            "(\"APPLICATION\" \"OCTET-STREAM\" (\"NAME\" \"data.bin\") NIL NIL \"BASE64\" "
+                            + QByteArray::number(attachment.size()) + " NIL (\"ATTACHMENT\" (\"FILENAME\" \"data.bin\")) NIL NIL)"
+                            " \"MIXED\" (\"BOUNDARY\" \"loadserver\") NIL NIL NIL)";
+        }
+
+        for (int i = 0; i < qMax(1, options.mailboxes); ++i) {
+            Mailbox mailbox;
+            mailbox.name = i ? "Folder" + QByteArray::number(i) : QByteArray("INBOX");
+            mailbox.uids.reserve(options.messages);
+            mailbox.flags.reserve(options.messages);
+            for (int m = 1; m <= options.messages; ++m) {
+                mailbox.uids << m;
+                mailbox.flags << initialFlags(m);
+            }
+            mailbox.uidNext = options.messages + 1;
+            mailboxes << mailbox;
+        }
+
+        if (options.newMessageInterval > 0) {
+            newMessageTimer.setInterval(options.newMessageInterval);
+            connect(&newMessageTimer, &QTimer::timeout, this, &LoadServerStore::addMessage);
+        }
+    }
+
+    int indexOf(const QByteArray &name) const
+    {
+        for (int i = 0; i < mailboxes.size(); ++i) {
+            if (mailboxes[i].name == name || (i == 0 && qstricmp(name.constData(), "INBOX") == 0)) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    QByteArray name(int mailbox) const
+    {
+        return mailboxes[mailbox].name;
+    }
+
+    int mailboxCount() const
+    {
+        return mailboxes.size();
+    }
+
+    int messageCount(int mailbox) const
+    {
+        QMutexLocker locker(&mutex);
+        return mailboxes[mailbox].uids.size();
+    }
+
+    qint64 uidNext(int mailbox) const
+    {
+        QMutexLocker locker(&mutex);
+        return mailboxes[mailbox].uidNext;
+    }
+
+    qint64 uid(int mailbox, int index) const
+    {
+        QMutexLocker locker(&mutex);
+        return mailboxes[mailbox].uids[index];
+    }
+
+    QVector<qint64> uids(int mailbox) const
+    {
+        QMutexLocker locker(&mutex);
+        return mailboxes[mailbox].uids;
+    }
+
+    quint8 flags(int mailbox, int index) const
+    {
+        QMutexLocker locker(&mutex);
+        return mailboxes[mailbox].flags[index];
+    }
+
+    QVector<quint8> flags(int mailbox) const
+    {
+        QMutexLocker locker(&mutex);
+        return mailboxes[mailbox].flags;
+    }
+
+    /**
+     * The indexes of the messages in @p set, among the first @p count (the ones a client knows of).
+     */
+    QVector<int> resolve(int mailbox, const KIMAP2::ImapSet &set, bool uidBased, int count) const
+    {
+        QMutexLocker locker(&mutex);
+        const QVector<qint64> &uids = mailboxes[mailbox].uids;
+        count = qMin(count, uids.size());
+        QVector<int> indexes;
+        if (!count) {
+            return indexes;
+        }
+        for (const KIMAP2::ImapSet::Range &range : set.ranges()) {
+            if (uidBased) {
+                const qint64 last = uids[count - 1];
+                // A lone "*" is parsed as 0
+                qint64 begin = range.begin ? range.begin : last;
+                qint64 end = range.end ? range.end : last;
+                if (begin > end) {
+                    std::swap(begin, end);
+                }
+                auto it = std::lower_bound(uids.constBegin(), uids.constBegin() + count, begin);
+                for (; it != uids.constBegin() + count && *it <= end; ++it) {
+                    indexes << int(it - uids.constBegin());
+                }
+            } else {
+                qint64 begin = range.begin ? range.begin : count;
+                qint64 end = range.end ? range.end : count;
+                if (begin > end) {
+                    std::swap(begin, end);
+                }
+                for (qint64 seq = qMax<qint64>(begin, 1); seq <= qMin<qint64>(end, count); ++seq) {
+                    indexes << int(seq - 1);
+                }
+            }
+        }
+        std::sort(indexes.begin(), indexes.end());
+        indexes.erase(std::unique(indexes.begin(), indexes.end()), indexes.end());
+        return indexes;
+    }
+
+    enum StoreMode { Replace, Add, Remove };
+
+    /**
+     * Changes the flags of the messages at @p indexes and tells the others about it.
+     */
+    void store(int mailbox, const QVector<int> &indexes, StoreMode mode, quint8 flags, int connectionId)
+    {
+        QVector<int> changed;
+        {
+            QMutexLocker locker(&mutex);
+            QVector<quint8> &messageFlags = mailboxes[mailbox].flags;
+            for (const int index : indexes) {
+                const quint8 old = messageFlags[index];
+                quint8 updated = flags;
+                if (mode == Add) {
+                    updated = old | flags;
+                } else if (mode == Remove) {
+                    updated = old & ~flags;
+                }
+                if (updated != old) {
+                    messageFlags[index] = updated;
+                    changed << index;
+                }
+            }
+        }
+        if (!changed.isEmpty()) {
+            emit flagsChanged(mailbox, changed, connectionId);
+        }
+    }
+
+    QByteArray header(int mailbox, qint64 uid) const
+    {
+        return "From: Sender " + QByteArray::number(uid % 100) + " <sender" + QByteArray::number(uid % 100) + "@example.com>\r\n"
+               "To: User <user@example.com>\r\n"
+               "Subject: Message " + QByteArray::number(uid) + " in " + mailboxes[mailbox].name + "\r\n"
+               "Date: " + dateTime(uid, "ddd, dd MMM yyyy hh:mm:ss +0000") + "\r\n"
+               "Message-ID: <" + QByteArray::number(uid) + '.' + mailboxes[mailbox].name + "@loadserver>\r\n"
+               "MIME-Version: 1.0\r\n"
+               + contentType + "\r\n";
+    }
+
+    QByteArray envelope(int mailbox, qint64 uid) const
+    {
+        const QByteArray from = "((\"Sender " + QByteArray::number(uid % 100) + "\" NIL \"sender" + QByteArray::number(uid % 100) + "\" \"example.com\"))";
+        return "(" + quoted(dateTime(uid, "ddd, dd MMM yyyy hh:mm:ss +0000"))
+               + ' ' + quoted("Message " + QByteArray::number(uid) + " in " + mailboxes[mailbox].name)
+               + ' ' + from + ' ' + from + ' ' + from
+               + " ((\"User\" NIL \"user\" \"example.com\")) NIL NIL NIL "
+               + quoted('<' + QByteArray::number(uid) + '.' + mailboxes[mailbox].name + "@loadserver>") + ')';
+    }
+
+    /**
+     * The content of a BODY[] section, or a null array for sections that don't exist.
+     */
+    QByteArray section(int mailbox, qint64 uid, const QByteArray &section, const QList<QByteArray> &fields) const
+    {
+        if (section.isEmpty()) {
+            return header(mailbox, uid) + body;
+        }
+        if (section == "HEADER") {
+            return header(mailbox, uid);
+        }
+        if (section == "TEXT") {
+            return body;
+        }
+        if (section.startsWith("HEADER.FIELDS")) {
+            const bool exclude = section.startsWith("HEADER.FIELDS.NOT");
+            QByteArray result;
+            for (const QByteArray &headerLine : header(mailbox, uid).split('\n')) {
+                const QByteArray name = headerLine.left(headerLine.indexOf(':')).toUpper();
+                if (name.isEmpty() || headerLine == "\r") {
+                    continue;
+                }
+                bool listed = false;
+                for (const QByteArray &field : fields) {
+                    listed |= field.toUpper() == name;
+                }
+                if (listed != exclude) {
+                    result += headerLine + '\n';
+                }
+            }
+            return result + "\r\n";
+        }
+        if (options.shape == LoadServer::Options::Plain) {
+            return section == "1" ? text : QByteArray();
+        }
+        if (section == "1") {
+            return text;
+        }
+        if (section == "1.MIME") {
+            return textHeader;
+        }
+        if (section == "2") {
+            return attachment;
+        }
+        if (section == "2.MIME") {
+            return attachmentHeader;
+        }
+        return QByteArray();
+    }
+
+    qint64 size(int mailbox, qint64 uid) const
+    {
+        return header(mailbox, uid).size() + body.size();
+    }
+
+    const LoadServer::Options options;
+    QByteArray bodyStructure;
+    QTimer newMessageTimer;
+
+Q_SIGNALS:
+    void flagsChanged(int mailbox, const QVector<int> &indexes, int connectionId);
+    void messagesAdded(int mailbox, int count);
+
+private:
+    static QByteArray repeat(const QByteArray &line, int size)
+    {
+        QByteArray result;
+        result.reserve(size);
+        while (result.size() + line.size() <= size) {
+            result += line;
+        }
+        return result;
+    }
+
+    quint8 initialFlags(int message) const
+    {
+        quint8 flags = Seen;
+        if (options.unseenInterval > 0 && message % options.unseenInterval == 0) {
+            flags &= ~Seen;
+        }
+        if (options.flaggedInterval > 0 && message % options.flaggedInterval == 0) {
+            flags |= Flagged;
+        }
+        return flags;
+    }
+
+    void addMessage()
+    {
+        int count;
+        {
+            QMutexLocker locker(&mutex);
+            Mailbox &inbox = mailboxes[0];
+            inbox.uids << inbox.uidNext++;
+            inbox.flags << 0;
+            count = inbox.uids.size();
+        }
+        emit messagesAdded(0, count);
+    }
+
+    mutable QMutex mutex;
+    QList<Mailbox> mailboxes;
+    QByteArray text;
+    QByteArray attachment;
+    QByteArray textHeader;
+    QByteArray attachmentHeader;
+    QByteArray body;
+    QByteArray contentType;
+};
+
+/*
+ * One client, on the thread of its worker.
+ */
+class LoadServerConnection : public QObject
+{
+    Q_OBJECT
+
+public:
+    LoadServerConnection(LoadServer *server, LoadServerStore *store, qintptr descriptor, int id)
+        : server(server),
+          store(store),
+          id(id),
+          mailbox(-1),
+          knownMessages(0),
+          readOnly(false),
+          literalRemaining(0),
+          pendingExists(false),
+          sendBudget(0),
+          closeWhenSent(false)
+    {
+        clock.start();
+        lastRefill = 0;
+        socket.setSocketDescriptor(descriptor);
+        socket.setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        connect(&socket, &QTcpSocket::readyRead, this, &LoadServerConnection::readCommands);
+        connect(&socket, &QTcpSocket::bytesWritten, this, &LoadServerConnection::send);
+        connect(&socket, &QTcpSocket::disconnected, this, &LoadServerConnection::deleteLater);
+        sendTimer.setSingleShot(true);
+        connect(&sendTimer, &QTimer::timeout, this, &LoadServerConnection::send);
+        queue("* PREAUTH [CAPABILITY IMAP4rev1 IDLE UIDPLUS LITERAL+] LoadServer ready\r\n");
+    }
+
+    ~LoadServerConnection()
+    {
+        // Nothing may reach the half destroyed connection
+        socket.disconnect(this);
+        socket.abort();
+    }
+
+    void flagsChanged(int changedMailbox, const QVector<int> &indexes, int connectionId)
+    {
+        if (changedMailbox != mailbox || connectionId == id) {
+            return;
+        }
+        for (const int index : indexes) {
+            if (index < knownMessages) {
+                pendingFlags.insert(index);
+            }
+        }
+        if (!idleTag.isEmpty()) {
+            queue(takeNotifications());
+        }
+    }
+
+    void messagesAdded(int changedMailbox, int count)
+    {
+        if (changedMailbox != mailbox || count <= knownMessages) {
+            return;
+        }
+        pendingExists = true;
+        if (!idleTag.isEmpty()) {
+            queue(takeNotifications());
+        }
+    }
+
+private:
+    struct Reply {
+        qint64 due;
+        QByteArray data;
+        int sent;
+        // Appends the next part of the reply, returns false once there's nothing left
+        std::function<bool(QByteArray &)> generate;
+    };
+
+    void queue(const QByteArray &data, const std::function<bool(QByteArray &)> &generate = std::function<bool(QByteArray &)>())
+    {
+        if (data.isEmpty() && !generate) {
+            return;
+        }
+        replies.append({commandTime + store->options.latency, data, 0, generate});
+        send();
+    }
+
+    void send()
+    {
+        if (replies.isEmpty() && closeWhenSent) {
+            socket.disconnectFromHost();
+            return;
+        }
+        while (!replies.isEmpty()) {
+            Reply &reply = replies.first();
+            const qint64 now = clock.elapsed();
+            if (reply.due > now) {
+                sendTimer.start(int(reply.due - now));
+                return;
+            }
+            if (socket.bytesToWrite() >= chunkSize) {
+                // Goes on with bytesWritten()
+                return;
+            }
+            if (reply.sent == reply.data.size()) {
+                reply.data.clear();
+                reply.sent = 0;
+                if (!reply.generate || !reply.generate(reply.data)) {
+                    reply.generate = nullptr;
+                }
+                if (reply.data.isEmpty()) {
+                    if (!reply.generate) {
+                        replies.removeFirst();
+                        if (replies.isEmpty() && closeWhenSent) {
+                            socket.disconnectFromHost();
+                            return;
+                        }
+                    }
+                    continue;
+                }
+            }
+            qint64 size = reply.data.size() - reply.sent;
+            const qint64 bandwidth = store->options.bandwidth;
+            if (bandwidth > 0) {
+                sendBudget = qMin<qint64>(qMax<qint64>(bandwidth / 10, 1), sendBudget + (now - lastRefill) * bandwidth / 1000);
+                lastRefill = now;
+                if (sendBudget <= 0) {
+                    sendTimer.start(qMax<int>(1, int(1000 * (1 - sendBudget) / bandwidth)));
+                    return;
+                }
+                size = qMin(size, sendBudget);
+                sendBudget -= size;
+            }
+            socket.write(reply.data.constData() + reply.sent, size);
+            reply.sent += size;
+            server->m_bytesSent.fetchAndAddRelaxed(size);
+        }
+    }
+
+    void readCommands()
+    {
+        while (true) {
+            if (literalRemaining > 0) {
+                const QByteArray data = socket.read(literalRemaining);
+                if (data.isEmpty()) {
+                    return;
+                }
+                // Handled like a quoted string from here on
+                literalData += data;
+                literalRemaining -= data.size();
+                if (literalRemaining > 0) {
+                    return;
+                }
+                pendingLine += quoted(literalData);
+                literalData.clear();
+            }
+            if (!socket.canReadLine()) {
+                return;
+            }
+            QByteArray line = socket.readLine();
+            line.chop(line.endsWith("\r\n") ? 2 : 1);
+            if (line.endsWith('}') && line.lastIndexOf('{') >= 0) {
+                const int start = line.lastIndexOf('{');
+                QByteArray size = line.mid(start + 1, line.size() - start - 2);
+                const bool synchronizing = !size.endsWith('+');
+                if (!synchronizing) {
+                    size.chop(1);
+                }
+                bool ok = false;
+                literalRemaining = size.toLongLong(&ok);
+                if (ok) {
+                    pendingLine += line.left(start);
+                    if (synchronizing) {
+                        socket.write("+ Ready for literal data\r\n");
+                    }
+                    continue;
+                }
+                literalRemaining = 0;
+            }
+            line = pendingLine + line;
+            pendingLine.clear();
+            handleLine(line);
+        }
+    }
+
+    void handleLine(const QByteArray &line)
+    {
+        commandTime = clock.elapsed();
+        if (!idleTag.isEmpty()) {
+            if (qstricmp(line.trimmed().constData(), "DONE") == 0) {
+                queue(takeNotifications() + idleTag + " OK IDLE terminated\r\n");
+                idleTag.clear();
+            }
+            return;
+        }
+
+        QList<QByteArray> args = tokenize(line);
+        if (args.size() < 2) {
+            queue("* BAD Invalid command\r\n");
+            return;
+        }
+        server->m_commands.fetchAndAddRelaxed(1);
+        const QByteArray tag = args.takeFirst();
+        QByteArray command = args.takeFirst().toUpper();
+        bool uidBased = false;
+        if (command == "UID" && !args.isEmpty()) {
+            uidBased = true;
+            command = args.takeFirst().toUpper();
+        }
+
+        if (command == "CAPABILITY") {
+            queue("* CAPABILITY IMAP4rev1 IDLE UIDPLUS LITERAL+\r\n" + tag + " OK CAPABILITY completed\r\n");
+        } else if (command == "LOGIN" || command == "AUTHENTICATE" || command == "ENABLE") {
+            queue(tag + " OK " + command + " completed\r\n");
+        } else if (command == "NOOP" || command == "CHECK") {
+            queue(takeNotifications() + tag + " OK " + command + " completed\r\n");
+        } else if (command == "LOGOUT") {
+            closeWhenSent = true;
+            queue("* BYE LoadServer logging out\r\n" + tag + " OK LOGOUT completed\r\n");
+        } else if (command == "LIST" || command == "LSUB") {
+            list(tag, command, args);
+        } else if (command == "SELECT" || command == "EXAMINE") {
+            select(tag, command, args);
+        } else if (command == "CLOSE" || command == "UNSELECT") {
+            mailbox = -1;
+            pendingFlags.clear();
+            pendingExists = false;
+            queue(tag + " OK " + command + " completed\r\n");
+        } else if (mailbox < 0 && (command == "FETCH" || command == "SEARCH" || command == "STORE" || command == "IDLE")) {
+            queue(tag + " BAD No mailbox selected\r\n");
+        } else if (command == "FETCH") {
+            fetch(tag, args, uidBased);
+        } else if (command == "SEARCH") {
+            search(tag, args, uidBased);
+        } else if (command == "STORE") {
+            storeFlags(tag, args, uidBased);
+        } else if (command == "IDLE") {
+            idleTag = tag;
+            queue("+ idling\r\n" + takeNotifications());
+        } else {
+            queue(tag + " BAD Unsupported command\r\n");
+        }
+    }
+
+    QByteArray takeNotifications()
+    {
+        if (mailbox < 0) {
+            return QByteArray();
+        }
+        QByteArray result;
+        if (pendingExists) {
+            knownMessages = store->messageCount(mailbox);
+            result += "* " + QByteArray::number(knownMessages) + " EXISTS\r\n";
+            pendingExists = false;
+        }
+        QList<int> indexes = pendingFlags.toList();
+        std::sort(indexes.begin(), indexes.end());
+        for (const int index : indexes) {
+            result += "* " + QByteArray::number(index + 1) + " FETCH (UID " + QByteArray::number(store->uid(mailbox, index))
+                      + " FLAGS " + flagList(store->flags(mailbox, index)) + ")\r\n";
+        }
+        pendingFlags.clear();
+        return result;
+    }
+
+    void list(const QByteArray &tag, const QByteArray &command, const QList<QByteArray> &args)
+    {
+        const QByteArray pattern = args.value(1);
+        QByteArray result;
+        for (int i = 0; i < store->mailboxCount(); ++i) {
+            const QByteArray name = store->name(i);
+            if (pattern == "*" || pattern == "%" || pattern == name) {
+                result += "* " + command + " (\\HasNoChildren) \"/\" " + quoted(name) + "\r\n";
+            }
+        }
+        queue(result + tag + " OK " + command + " completed\r\n");
+    }
+
+    void select(const QByteArray &tag, const QByteArray &command, const QList<QByteArray> &args)
+    {
+        const int index = store->indexOf(args.value(0));
+        pendingFlags.clear();
+        pendingExists = false;
+        if (index < 0) {
+            mailbox = -1;
+            queue(tag + " NO Mailbox doesn't exist\r\n");
+            return;
+        }
+        mailbox = index;
+        readOnly = command == "EXAMINE";
+        knownMessages = store->messageCount(mailbox);
+        int unseen = 0;
+        const QVector<quint8> flags = store->flags(mailbox);
+        for (int i = 0; i < flags.size(); ++i) {
+            if (!(flags[i] & Seen)) {
+                unseen = i + 1;
+                break;
+            }
+        }
+        QByteArray result = "* FLAGS (\\Answered \\Flagged \\Deleted \\Seen \\Draft)\r\n"
+                            "* OK [PERMANENTFLAGS (\\Answered \\Flagged \\Deleted \\Seen \\Draft)] Flags permitted\r\n"
+                            "* " + QByteArray::number(knownMessages) + " EXISTS\r\n"
+                            "* 0 RECENT\r\n";
+        if (unseen) {
+            result += "* OK [UNSEEN " + QByteArray::number(unseen) + "] First unseen\r\n";
+        }
+        result += "* OK [UIDVALIDITY 1] UIDs valid\r\n"
+                  "* OK [UIDNEXT " + QByteArray::number(store->uidNext(mailbox)) + "] Predicted next UID\r\n"
+                  + tag + (readOnly ? " OK [READ-ONLY] " : " OK [READ-WRITE] ") + command + " completed\r\n";
+        queue(result);
+    }
+
+    struct FetchItem {
+        enum Type { Flags, Uid, Size, InternalDate, BodyStructure, Envelope, Section } type;
+        QByteArray name;
+        QByteArray section;
+        QList<QByteArray> fields;
+        qint64 offset;
+        qint64 length;
+    };
+
+    static bool parseFetchItems(const QList<QByteArray> &args, QVector<FetchItem> *items, bool *setsSeen)
+    {
+        QList<QByteArray> names;
+        for (const QByteArray &arg : args) {
+            names << listItems(arg);
+        }
+        for (const QByteArray &original : names) {
+            const QByteArray name = original.toUpper();
+            if (name == "ALL" || name == "FAST" || name == "FULL") {
+                items->append({FetchItem::Flags, "FLAGS", {}, {}, 0, -1});
+                items->append({FetchItem::InternalDate, "INTERNALDATE", {}, {}, 0, -1});
+                items->append({FetchItem::Size, "RFC822.SIZE", {}, {}, 0, -1});
+                if (name != "FAST") {
+                    items->append({FetchItem::Envelope, "ENVELOPE", {}, {}, 0, -1});
+                }
+                if (name == "FULL") {
+                    items->append({FetchItem::BodyStructure, "BODY", {}, {}, 0, -1});
+                }
+            } else if (name == "FLAGS") {
+                items->append({FetchItem::Flags, name, {}, {}, 0, -1});
+            } else if (name == "UID") {
+                items->append({FetchItem::Uid, name, {}, {}, 0, -1});
+            } else if (name == "RFC822.SIZE") {
+                items->append({FetchItem::Size, name, {}, {}, 0, -1});
+            } else if (name == "INTERNALDATE") {
+                items->append({FetchItem::InternalDate, name, {}, {}, 0, -1});
+            } else if (name == "BODYSTRUCTURE" || name == "BODY") {
+                items->append({FetchItem::BodyStructure, name, {}, {}, 0, -1});
+            } else if (name == "ENVELOPE") {
+                items->append({FetchItem::Envelope, name, {}, {}, 0, -1});
+            } else if (name == "RFC822" || name == "RFC822.HEADER" || name == "RFC822.TEXT") {
+                const QByteArray section = name == "RFC822" ? QByteArray() : name.mid(7);
+                items->append({FetchItem::Section, name, section, {}, 0, -1});
+                *setsSeen |= name != "RFC822.HEADER";
+            } else if (name.startsWith("BODY[") || name.startsWith("BODY.PEEK[")) {
+                const int open = name.indexOf('[');
+                const int close = name.lastIndexOf(']');
+                if (close < open) {
+                    return false;
+                }
+                FetchItem item{FetchItem::Section, "BODY", name.mid(open + 1, close - open - 1), {}, 0, -1};
+                const int fieldsStart = item.section.indexOf('(');
+                if (fieldsStart >= 0) {
+                    item.fields = listItems(item.section.mid(fieldsStart));
+                    item.section = item.section.left(fieldsStart).trimmed();
+                }
+                const QByteArray partial = name.mid(close + 1);
+                if (partial.startsWith('<') && partial.endsWith('>')) {
+                    const QList<QByteArray> range = partial.mid(1, partial.size() - 2).split('.');
+                    item.offset = range.value(0).toLongLong();
+                    item.length = range.size() > 1 ? range[1].toLongLong() : -1;
+                }
+                // The response names the section as it was asked for
+                item.name = "BODY[" + original.mid(open + 1, close - open - 1) + ']';
+                if (item.length >= 0) {
+                    item.name += '<' + QByteArray::number(item.offset) + '>';
+                }
+                *setsSeen |= !name.startsWith("BODY.PEEK[");
+                items->append(item);
+            } else if (name.startsWith('(')) {
+                // Modifiers like CHANGEDSINCE, not supported
+                continue;
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    QByteArray fetchResponse(int index, const QVector<FetchItem> &items, bool uidBased) const
+    {
+        const qint64 uid = store->uid(mailbox, index);
+        QByteArray response = "* " + QByteArray::number(index + 1) + " FETCH (";
+        bool first = true;
+        auto append = [&](const QByteArray &name, const QByteArray &value) {
+            if (!first) {
+                response += ' ';
+            }
+            first = false;
+            response += name + ' ' + value;
+        };
+        bool hasUid = false;
+        for (const FetchItem &item : items) {
+            hasUid |= item.type == FetchItem::Uid;
+        }
+        if (uidBased && !hasUid) {
+            append("UID", QByteArray::number(uid));
+        }
+        for (const FetchItem &item : items) {
+            switch (item.type) {
+            case FetchItem::Flags:
+                append(item.name, flagList(store->flags(mailbox, index)));
+                break;
+            case FetchItem::Uid:
+                append(item.name, QByteArray::number(uid));
+                break;
+            case FetchItem::Size:
+                append(item.name, QByteArray::number(store->size(mailbox, uid)));
+                break;
+            case FetchItem::InternalDate:
+                append(item.name, quoted(dateTime(uid, "dd-MMM-yyyy hh:mm:ss +0000")));
+                break;
+            case FetchItem::BodyStructure:
+                append(item.name, store->bodyStructure);
+                break;
+            case FetchItem::Envelope:
+                append(item.name, store->envelope(mailbox, uid));
+                break;
+            case FetchItem::Section: {
+                QByteArray data = store->section(mailbox, uid, item.section, item.fields);
+                if (item.length >= 0) {
+                    data = data.mid(item.offset, item.length);
+                }
+                append(item.name, data.isNull() ? QByteArray("NIL") : literal(data));
+                break;
+            }
+            }
+        }
+        return response + ")\r\n";
+    }
+
+    void fetch(const QByteArray &tag, const QList<QByteArray> &args, bool uidBased)
+    {
+        QVector<FetchItem> items;
+        bool setsSeen = false;
+        if (args.size() < 2 || !parseFetchItems(args.mid(1), &items, &setsSeen)) {
+            queue(tag + " BAD Invalid FETCH\r\n");
+            return;
+        }
+        const QVector<int> indexes = store->resolve(mailbox, KIMAP2::ImapSet::fromImapSequenceSet(args[0]), uidBased, knownMessages);
+        if (setsSeen && !readOnly) {
+            store->store(mailbox, indexes, LoadServerStore::Add, Seen, id);
+            bool hasFlags = false;
+            for (const FetchItem &item : items) {
+                hasFlags |= item.type == FetchItem::Flags;
+            }
+            if (!hasFlags) {
+                items.append({FetchItem::Flags, "FLAGS", {}, {}, 0, -1});
+            }
+        }
+
+        // Generated while the socket drains, the completion is a reply of its own
+        int next = 0;
+        queue(QByteArray(), [this, indexes, items, uidBased, next](QByteArray &data) mutable {
+            while (next < indexes.size() && data.size() < chunkSize) {
+                data += fetchResponse(indexes[next++], items, uidBased);
+            }
+            return next < indexes.size();
+        });
+        queue(takeNotifications() + tag + " OK FETCH completed\r\n");
+    }
+
+    typedef std::function<bool(int index, qint64 uid, quint8 flags)> Predicate;
+
+    /*
+     * Parses the search key at @p position of @p keys, and the ones that belong to it.
+     */
+    bool parseSearchKey(const QList<QByteArray> &keys, int &position, Predicate *predicate) const
+    {
+        if (position >= keys.size()) {
+            return false;
+        }
+        const QByteArray key = keys[position++].toUpper();
+        auto flag = [predicate](quint8 flag, bool set) {
+            *predicate = [flag, set](int, qint64, quint8 flags) {
+                return bool(flags & flag) == set;
+            };
+            return true;
+        };
+        auto set = [this, predicate](const QByteArray &sequence, bool uidBased) {
+            const QVector<int> indexes = store->resolve(mailbox, KIMAP2::ImapSet::fromImapSequenceSet(sequence), uidBased, knownMessages);
+            const QSet<int> matches = indexes.toList().toSet();
+            *predicate = [matches](int index, qint64, quint8) {
+                return matches.contains(index);
+            };
+            return true;
+        };
+
+        if (key.startsWith('(')) {
+            const QList<QByteArray> group = listItems(keys[position - 1]);
+            return parseSearchKeys(group, predicate);
+        } else if (key == "ALL" || key == "OLD") {
+            *predicate = [](int, qint64, quint8) {
+                return true;
+            };
+            return true;
+        } else if (key == "SEEN" || key == "UNSEEN" || key == "NEW") {
+            return flag(Seen, key == "SEEN");
+        } else if (key == "FLAGGED" || key == "UNFLAGGED") {
+            return flag(Flagged, key == "FLAGGED");
+        } else if (key == "ANSWERED" || key == "UNANSWERED") {
+            return flag(Answered, key == "ANSWERED");
+        } else if (key == "DELETED" || key == "UNDELETED") {
+            return flag(Deleted, key == "DELETED");
+        } else if (key == "DRAFT" || key == "UNDRAFT") {
+            return flag(Draft, key == "DRAFT");
+        } else if (key == "UID") {
+            return position < keys.size() && set(keys[position++], true);
+        } else if (key == "NOT") {
+            Predicate negated;
+            if (!parseSearchKey(keys, position, &negated)) {
+                return false;
+            }
+            *predicate = [negated](int index, qint64 uid, quint8 flags) {
+                return !negated(index, uid, flags);
+            };
+            return true;
+        } else if (key == "OR") {
+            Predicate left;
+            Predicate right;
+            if (!parseSearchKey(keys, position, &left) || !parseSearchKey(keys, position, &right)) {
+                return false;
+            }
+            *predicate = [left, right](int index, qint64 uid, quint8 flags) {
+                return left(index, uid, flags) || right(index, uid, flags);
+            };
+            return true;
+        } else if (!key.isEmpty() && (std::isdigit(key[0]) || key[0] == '*')) {
+            return set(key, false);
+        }
+        return false;
+    }
+
+    bool parseSearchKeys(const QList<QByteArray> &keys, Predicate *predicate) const
+    {
+        QVector<Predicate> all;
+        int position = 0;
+        while (position < keys.size()) {
+            Predicate next;
+            if (!parseSearchKey(keys, position, &next)) {
+                return false;
+            }
+            all << next;
+        }
+        *predicate = [all](int index, qint64 uid, quint8 flags) {
+            for (const Predicate &p : all) {
+                if (!p(index, uid, flags)) {
+                    return false;
+                }
+            }
+            return true;
+        };
+        return true;
+    }
+
+    void search(const QByteArray &tag, QList<QByteArray> args, bool uidBased)
+    {
+        if (args.size() >= 2 && args[0].toUpper() == "CHARSET") {
+            args = args.mid(2);
+        }
+        Predicate predicate;
+        if (args.isEmpty() || !parseSearchKeys(args, &predicate)) {
+            queue(tag + " NO [CANNOT] Unsupported search\r\n");
+            return;
+        }
+        const QVector<qint64> uids = store->uids(mailbox);
+        const QVector<quint8> flags = store->flags(mailbox);
+        QByteArray result("* SEARCH");
+        for (int i = 0; i < knownMessages; ++i) {
+            if (predicate(i, uids[i], flags[i])) {
+                result += ' ' + QByteArray::number(uidBased ? uids[i] : i + 1);
+            }
+        }
+        queue(result + "\r\n" + takeNotifications() + tag + " OK SEARCH completed\r\n");
+    }
+
+    void storeFlags(const QByteArray &tag, const QList<QByteArray> &args, bool uidBased)
+    {
+        if (args.size() < 3) {
+            queue(tag + " BAD Invalid STORE\r\n");
+            return;
+        }
+        if (readOnly) {
+            queue(tag + " NO Mailbox is read-only\r\n");
+            return;
+        }
+        QByteArray item = args[1].toUpper();
+        const bool silent = item.endsWith(".SILENT");
+        if (silent) {
+            item.chop(7);
+        }
+        LoadServerStore::StoreMode mode;
+        if (item == "FLAGS") {
+            mode = LoadServerStore::Replace;
+        } else if (item == "+FLAGS") {
+            mode = LoadServerStore::Add;
+        } else if (item == "-FLAGS") {
+            mode = LoadServerStore::Remove;
+        } else {
+            queue(tag + " BAD Invalid STORE\r\n");
+            return;
+        }
+        QList<QByteArray> names;
+        for (const QByteArray &arg : args.mid(2)) {
+            names << listItems(arg);
+        }
+        const QVector<int> indexes = store->resolve(mailbox, KIMAP2::ImapSet::fromImapSequenceSet(args[0]), uidBased, knownMessages);
+        store->store(mailbox, indexes, mode, parseFlags(names), id);
+
+        QByteArray result;
+        if (!silent) {
+            for (const int index : indexes) {
+                result += "* " + QByteArray::number(index + 1) + " FETCH (";
+                if (uidBased) {
+                    result += "UID " + QByteArray::number(store->uid(mailbox, index)) + ' ';
+                }
+                result += "FLAGS " + flagList(store->flags(mailbox, index)) + ")\r\n";
+            }
+        }
+        queue(result + takeNotifications() + tag + " OK STORE completed\r\n");
+    }
+
+    LoadServer *server;
+    LoadServerStore *store;
+    const int id;
+    QTcpSocket socket;
+    QElapsedTimer clock;
+    QTimer sendTimer;
+    qint64 commandTime = 0;
+    qint64 lastRefill;
+
+    int mailbox;
+    int knownMessages;
+    bool readOnly;
+    QByteArray idleTag;
+
+    QByteArray pendingLine;
+    QByteArray literalData;
+    qint64 literalRemaining;
+
+    QSet<int> pendingFlags;
+    bool pendingExists;
+
+    QList<Reply> replies;
+    qint64 sendBudget;
+    bool closeWhenSent;
+};
+
+class LoadServerWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    LoadServerWorker(LoadServer *server, LoadServerStore *store)
+        : server(server), store(store)
+    {
+        connect(store, &LoadServerStore::flagsChanged, this, [this](int mailbox, const QVector<int> &indexes, int connectionId) {
+            for (LoadServerConnection *connection : connections) {
+                connection->flagsChanged(mailbox, indexes, connectionId);
+            }
+        });
+        connect(store, &LoadServerStore::messagesAdded, this, [this](int mailbox, int count) {
+            for (LoadServerConnection *connection : connections) {
+                connection->messagesAdded(mailbox, count);
+            }
+        });
+    }
+
+public Q_SLOTS:
+    void addConnection(qintptr descriptor, int id)
+    {
+        LoadServerConnection *connection = new LoadServerConnection(server, store, descriptor, id);
+        connections.insert(connection);
+        server->m_connections.fetchAndAddRelaxed(1);
+        connect(connection, &QObject::destroyed, this, [this, connection]() {
+            connections.remove(connection);
+            server->m_connections.fetchAndAddRelaxed(-1);
+        });
+    }
+
+    void closeAll()
+    {
+        for (LoadServerConnection *connection : connections.values()) {
+            delete connection;
+        }
+    }
+
+private:
+    LoadServer *server;
+    LoadServerStore *store;
+    QSet<LoadServerConnection *> connections;
+};
+
+class LoadServerListener : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    explicit LoadServerListener(LoadServer *server)
+        : server(server)
+    {
+        setMaxPendingConnections(1024);
+    }
+
+public Q_SLOTS:
+    bool listenOn(quint16 port)
+    {
+        return listen(QHostAddress(QHostAddress::LocalHost), port);
+    }
+
+protected:
+    void incomingConnection(qintptr descriptor) Q_DECL_OVERRIDE
+    {
+        server->addConnection(descriptor);
+    }
+
+private:
+    LoadServer *server;
+};
+
+LoadServer::LoadServer(const Options &options, QObject *parent)
+    : QObject(parent),
+      m_options(options),
+      m_port(0),
+      m_store(Q_NULLPTR),
+      m_listener(Q_NULLPTR)
+{
+    qRegisterMetaType<qintptr>("qintptr");
+}
+
+LoadServer::~LoadServer()
+{
+    stop();
+}
+
+bool LoadServer::startAndWait()
+{
+    m_store = new LoadServerStore(m_options);
+    for (int i = 0; i < qMax(1, m_options.threads); ++i) {
+        QThread *thread = new QThread;
+        LoadServerWorker *worker = new LoadServerWorker(this, m_store);
+        worker->moveToThread(thread);
+        connect(thread, &QThread::finished, worker, &QObject::deleteLater);
+        m_threads << thread;
+        m_workers << worker;
+        thread->start();
+    }
+
+    // The listener and the store's timer live on the first thread
+    m_listener = new LoadServerListener(this);
+    m_listener->moveToThread(m_threads.first());
+    m_store->moveToThread(m_threads.first());
+    connect(m_threads.first(), &QThread::finished, m_listener, &QObject::deleteLater);
+
+    bool listening = false;
+    QMetaObject::invokeMethod(m_listener, "listenOn", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(bool, listening), Q_ARG(quint16, m_options.port));
+    if (!listening) {
+        qWarning() << "LoadServer can't listen on port" << m_options.port;
+        stop();
+        return false;
+    }
+    m_port = m_listener->serverPort();
+    if (m_options.newMessageInterval > 0) {
+        QMetaObject::invokeMethod(&m_store->newMessageTimer, "start", Qt::QueuedConnection);
+    }
+    return true;
+}
+
+void LoadServer::stop()
+{
+    for (LoadServerWorker *worker : m_workers) {
+        QMetaObject::invokeMethod(worker, "closeAll", Qt::BlockingQueuedConnection);
+    }
+    if (m_store && !m_threads.isEmpty()) {
+        // Deleted after the timer stopped on its thread
+        connect(m_threads.first(), &QThread::finished, m_store, &QObject::deleteLater);
+    }
+    for (QThread *thread : m_threads) {
+        thread->quit();
+        thread->wait();
+        delete thread;
+    }
+    m_threads.clear();
+    m_workers.clear();
+    m_listener = Q_NULLPTR;
+    m_store = Q_NULLPTR;
+    m_port = 0;
+}
+
+void LoadServer::addConnection(qintptr descriptor)
+{
+    const int id = m_nextId.fetchAndAddRelaxed(1);
+    LoadServerWorker *worker = m_workers.at(id % m_workers.size());
+    QMetaObject::invokeMethod(worker, "addConnection", Qt::QueuedConnection, Q_ARG(qintptr, descriptor), Q_ARG(int, id));
+}
+
+quint16 LoadServer::port() const
+{
+    return m_port;
+}
+
+int LoadServer::connectionCount() const
+{
+    return m_connections.load();
+}
+
+qint64 LoadServer::commandCount() const
+{
+    return m_commands.load();
+}
+
+qint64 LoadServer::bytesSent() const
+{
+    return m_bytesSent.load();
+}
+
+#include "loadserver.moc"
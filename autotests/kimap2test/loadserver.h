@@ -0,0 +1,143 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+#ifndef LOADSERVER_H
+#define LOADSERVER_H
+
+#include <QAtomicInteger>
+#include <QList>
+#include <QObject>
+
+class QThread;
+class LoadServerConnection;
+class LoadServerListener;
+class LoadServerStore;
+class LoadServerWorker;
+
+/**
+ * An IMAP server for load tests, serving generated mailboxes to many clients at once.
+ *
+ * Unlike FakeServer it doesn't follow a scenario, it answers CAPABILITY, LOGIN, LIST, SELECT,
+ * EXAMINE, FETCH, SEARCH, STORE, IDLE, NOOP, CLOSE and LOGOUT from the state of its mailboxes,
+ * with sequence numbers or UIDs. Clients start authenticated, a LOGIN is accepted anyway.
+ * Messages are generated from their UID when they are fetched, only UIDs and flags are kept
+ * in memory. Nothing is ever expunged.
+ *
+ * A STORE is seen by the other clients that selected the mailbox: clients in IDLE get the
+ * FETCH FLAGS right away, the others before the completion of their next command.
+ *
+ * The connections are spread over Options::threads threads, each running an event loop, so
+ * one thread serves thousands of idle clients. Large FETCH responses are generated while
+ * the socket drains instead of in one piece.
+ *
+ * @code
+ * LoadServer::Options options;
+ * options.messages = 100000;
+ * options.latency = 20;
+ * LoadServer server(options);
+ * server.startAndWait();
+ * KIMAP2::Session session(QStringLiteral("127.0.0.1"), server.port());
+ * @endcode
+ */
+class LoadServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Options {
+        enum Shape {
+            // A single text/plain part
+            Plain,
+            // A multipart/mixed message with a text part and a base64 attachment
+            Multipart
+        };
+
+        // 0 picks a free port, see port()
+        quint16 port = 5989;
+        int threads = 1;
+        // INBOX and mailboxes - 1 more mailboxes named Folder1, Folder2 etc.
+        int mailboxes = 1;
+        int messages = 1000;
+        // The size of a message body, the headers come on top
+        int bodySize = 2048;
+        Shape shape = Plain;
+        // Every unseenInterval-th message is unseen, every flaggedInterval-th flagged, 0 for none
+        int unseenInterval = 10;
+        int flaggedInterval = 50;
+        // A new message in INBOX every newMessageInterval milliseconds, 0 for none
+        int newMessageInterval = 0;
+        // Milliseconds every response is held back, measured from the command
+        int latency = 0;
+        // The bytes per second sent to each client, 0 for no limit
+        qint64 bandwidth = 0;
+    };
+
+    explicit LoadServer(const Options &options, QObject *parent = Q_NULLPTR);
+    ~LoadServer();
+
+    /**
+     * Starts the threads and waits until the server listens.
+     *
+     * Returns false if the port can't be used.
+     */
+    bool startAndWait();
+
+    /**
+     * Closes all connections and stops the threads.
+     */
+    void stop();
+
+    quint16 port() const;
+
+    /**
+     * Serves a connected socket, e.g. the peer of a KIMAP2::SocketPairTransport.
+     * Can be called from any thread once the server started.
+     */
+    void addConnection(qintptr descriptor);
+
+    /**
+     * The number of clients connected now.
+     */
+    int connectionCount() const;
+
+    /**
+     * The number of commands handled since the server started.
+     */
+    qint64 commandCount() const;
+
+    /**
+     * The number of bytes sent since the server started.
+     */
+    qint64 bytesSent() const;
+
+private:
+    Q_DISABLE_COPY(LoadServer)
+    friend class LoadServerConnection;
+    friend class LoadServerWorker;
+
+    Options m_options;
+    quint16 m_port;
+    LoadServerStore *m_store;
+    LoadServerListener *m_listener;
+    QList<QThread *> m_threads;
+    QList<LoadServerWorker *> m_workers;
+    QAtomicInteger<int> m_connections;
+    QAtomicInteger<int> m_nextId;
+    QAtomicInteger<qint64> m_commands;
+    QAtomicInteger<qint64> m_bytesSent;
+};
+
+#endif
@@ -0,0 +1,342 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+#include "simulatedserver.h"
+
+#include <QDebug>
+#include <QPointer>
+#include <QTcpSocket>
+#include <QTimer>
+#include <qtest.h>
+
+#include "kimap2/transport.h"
+
+SimulatedServer::SimulatedServer(const Options &options, QObject *parent)
+    : QObject(parent),
+      m_options(options),
+      m_commandCount(0),
+      m_maximumInFlight(0)
+{
+    qRegisterMetaType<qintptr>("qintptr");
+    m_clock.start();
+}
+
+SimulatedServer::~SimulatedServer()
+{
+    qDeleteAll(m_connections);
+}
+
+SimulatedServer::Options SimulatedServer::options() const
+{
+    return m_options;
+}
+
+QSharedPointer<KIMAP2::Transport> SimulatedServer::transport()
+{
+    if (!m_transport) {
+        // The transport may outlive the server in a session that is still around
+        QPointer<SimulatedServer> server(this);
+        m_transport.reset(new KIMAP2::SocketPairTransport([server](qintptr descriptor) {
+            if (server) {
+                QMetaObject::invokeMethod(server.data(), "addConnection", Qt::QueuedConnection, Q_ARG(qintptr, descriptor));
+            }
+        }));
+    }
+    return m_transport;
+}
+
+void SimulatedServer::setScenario(const QList<QByteArray> &scenario)
+{
+    QMutexLocker locker(&m_mutex);
+
+    m_scenarios.clear();
+    m_scenarios << scenario;
+}
+
+void SimulatedServer::addScenario(const QList<QByteArray> &scenario)
+{
+    QMutexLocker locker(&m_mutex);
+
+    m_scenarios << scenario;
+}
+
+bool SimulatedServer::isScenarioDone(int scenarioNumber) const
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (scenarioNumber < m_scenarios.size()) {
+        return m_scenarios[scenarioNumber].isEmpty();
+    } else {
+        return true; // Non existent hence empty, right?
+    }
+}
+
+bool SimulatedServer::isAllScenarioDone() const
+{
+    QMutexLocker locker(&m_mutex);
+
+    foreach (const QList<QByteArray> &scenario, m_scenarios) {
+        if (!scenario.isEmpty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SimulatedServer::isIdle() const
+{
+    QMutexLocker locker(&m_mutex);
+
+    for (const Connection *connection : m_connections) {
+        if (!connection->output.isEmpty() || (connection->socket && connection->socket->bytesToWrite() > 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int SimulatedServer::commandCount() const
+{
+    QMutexLocker locker(&m_mutex);
+
+    return m_commandCount;
+}
+
+int SimulatedServer::maximumCommandsInFlight() const
+{
+    QMutexLocker locker(&m_mutex);
+
+    return m_maximumInFlight;
+}
+
+void SimulatedServer::compareReceived(const QByteArray &received, const QByteArray &expected) const
+{
+    QCOMPARE(QString::fromUtf8(received), QString::fromUtf8(expected));
+    QCOMPARE(received, expected);
+}
+
+qint64 SimulatedServer::now() const
+{
+    return m_clock.nsecsElapsed() / 1000;
+}
+
+void SimulatedServer::addConnection(qintptr descriptor)
+{
+    QMutexLocker locker(&m_mutex);
+
+    Connection *connection = new Connection;
+    connection->scenario = m_connections.size();
+    connection->socket = new QTcpSocket(this);
+    connection->timer = new QTimer(this);
+    connection->continued = 0;
+    connection->lastDue = 0;
+    connection->nextSend = 0;
+    connection->inFlight = 0;
+    connection->unqueued = 0;
+    m_connections << connection;
+
+    if (!connection->socket->setSocketDescriptor(descriptor)) {
+        qWarning() << "SimulatedServer can't adopt the connection:" << connection->socket->errorString();
+        return;
+    }
+    if (connection->scenario >= m_scenarios.size()) {
+        qWarning() << "SimulatedServer has no scenario for connection" << connection->scenario;
+        m_scenarios << QList<QByteArray>();
+    }
+
+    connection->timer->setSingleShot(true);
+    connection->timer->setTimerType(Qt::PreciseTimer);
+    connect(connection->timer, &QTimer::timeout, this, [this, connection]() {
+        QMutexLocker locker(&m_mutex);
+        send(connection);
+    });
+    connect(connection->socket, &QTcpSocket::readyRead, this, [this, connection]() {
+        QMutexLocker locker(&m_mutex);
+        readCommands(connection);
+    });
+    // Queued, since send() disconnects with the mutex held and the signal may come right away
+    connect(connection->socket, &QTcpSocket::disconnected, this, [this, connection]() {
+        QMutexLocker locker(&m_mutex);
+        connection->timer->stop();
+        connection->output.clear();
+        if (connection->socket) {
+            connection->socket->deleteLater();
+            connection->socket = Q_NULLPTR;
+        }
+    }, Qt::QueuedConnection);
+
+    // The greeting
+    queueServerPart(connection, now() + m_options.roundTripTime * 1000);
+}
+
+void SimulatedServer::readCommands(Connection *connection)
+{
+    const qint64 received = now();
+    connection->received += connection->socket->readAll();
+
+    QByteArray command;
+    while (takeCommand(connection, &command)) {
+        m_commandCount++;
+        connection->inFlight++;
+        connection->unqueued++;
+        m_maximumInFlight = qMax(m_maximumInFlight, connection->inFlight);
+
+        QList<QByteArray> &scenario = m_scenarios[connection->scenario];
+        const QByteArray expected = scenario.isEmpty() ? QByteArray() : scenario.first();
+        if (!expected.startsWith("C: ")) {
+            // Not a command the scenario waits for, fails the test
+            compareReceived("C: " + command, expected);
+            continue;
+        }
+        scenario.removeFirst();
+        if (!expected.startsWith("C: SKIP")) {
+            compareReceived("C: " + command, expected);
+        }
+
+        if (scenario.isEmpty() || !scenario.first().startsWith("C: ")) {
+            queueServerPart(connection, received + m_options.roundTripTime * 1000);
+        }
+    }
+}
+
+bool SimulatedServer::takeCommand(Connection *connection, QByteArray *command)
+{
+    QByteArray &received = connection->received;
+    int position = 0;
+    forever {
+        const int end = received.indexOf("\r\n", position);
+        if (end < 0) {
+            return false;
+        }
+
+        // A line ending in {<size>} or {<size>+} continues after a literal
+        const int open = received.lastIndexOf('{', end);
+        if (open >= position && received.at(end - 1) == '}') {
+            QByteArray size = received.mid(open + 1, end - open - 2);
+            const bool synchronizing = !size.endsWith('+');
+            if (!synchronizing) {
+                size.chop(1);
+            }
+            bool ok = false;
+            const int literalSize = size.toInt(&ok);
+            if (ok) {
+                const int literalStart = end + 2;
+                if (synchronizing && connection->continued < literalStart) {
+                    connection->continued = literalStart;
+                    connection->output << Piece{qMax(now() + m_options.roundTripTime * 1000, connection->lastDue),
+                                                "+ Ready for literal data (expecting " + QByteArray::number(literalSize) + " bytes)\r\n",
+                                                false, 0};
+                    scheduleSend(connection);
+                }
+                if (received.size() < literalStart + literalSize) {
+                    return false;
+                }
+                position = literalStart + literalSize;
+                continue;
+            }
+        }
+
+        *command = received.left(end).trimmed();
+        received.remove(0, end + 2);
+        connection->continued = 0;
+        return true;
+    }
+}
+
+void SimulatedServer::queueServerPart(Connection *connection, qint64 due)
+{
+    QList<QByteArray> &scenario = m_scenarios[connection->scenario];
+    const int queued = connection->output.size();
+    due = qMax(due, connection->lastDue);
+
+    while (!scenario.isEmpty() && (scenario.first().startsWith("S: ") || scenario.first().startsWith("W: "))) {
+        const QByteArray rule = scenario.takeFirst();
+        if (rule.startsWith("S: ")) {
+            connection->output << Piece{due, rule.mid(3) + "\r\n", false, 0};
+        } else {
+            due += rule.mid(3).toInt() * 1000;
+        }
+    }
+    if (!scenario.isEmpty() && scenario.first().startsWith("X")) {
+        scenario.removeFirst();
+        connection->output << Piece{due, QByteArray(), true, 0};
+    }
+    connection->lastDue = due;
+
+    // The commands count as answered once the last piece of their responses is written
+    if (connection->output.size() > queued) {
+        connection->output.last().answers += connection->unqueued;
+    } else {
+        connection->inFlight -= connection->unqueued;
+    }
+    connection->unqueued = 0;
+
+    if (!scenario.isEmpty()) {
+        QVERIFY(scenario.first().startsWith("C: "));
+    }
+    scheduleSend(connection);
+}
+
+void SimulatedServer::send(Connection *connection)
+{
+    if (!connection->socket) {
+        return;
+    }
+
+    const qint64 time = now();
+    while (!connection->output.isEmpty()) {
+        Piece &piece = connection->output.first();
+        if (piece.due > time || (m_options.bandwidth > 0 && connection->nextSend > time)) {
+            break;
+        }
+        if (piece.close) {
+            connection->output.clear();
+            connection->socket->disconnectFromHost();
+            return;
+        }
+
+        const int size = m_options.chunkSize > 0 ? qMin(m_options.chunkSize, piece.data.size()) : piece.data.size();
+        connection->socket->write(piece.data.constData(), size);
+        if (m_options.bandwidth > 0) {
+            // Paced from the simulated schedule, so a late timer doesn't slow down the link
+            connection->nextSend = qMax(connection->nextSend, piece.due) + size * Q_INT64_C(1000000) / m_options.bandwidth;
+        }
+        piece.data.remove(0, size);
+        if (piece.data.isEmpty()) {
+            connection->inFlight -= piece.answers;
+            connection->output.removeFirst();
+        }
+        if (m_options.chunkSize > 0) {
+            // Every chunk in its own write, which the client reads on its own
+            connection->socket->flush();
+            break;
+        }
+    }
+    scheduleSend(connection);
+}
+
+void SimulatedServer::scheduleSend(Connection *connection)
+{
+    if (connection->output.isEmpty() || !connection->socket) {
+        connection->timer->stop();
+        return;
+    }
+    qint64 next = connection->output.first().due;
+    if (m_options.bandwidth > 0) {
+        next = qMax(next, connection->nextSend);
+    }
+    connection->timer->start(int(qMax(Q_INT64_C(0), (next - now() + 999) / 1000)));
+}
@@ -0,0 +1,172 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+#ifndef SIMULATEDSERVER_H
+#define SIMULATEDSERVER_H
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QSharedPointer>
+
+class QTcpSocket;
+class QTimer;
+
+namespace KIMAP2
+{
+class Transport;
+}
+
+/**
+ * Plays FakeServer scenarios in the same process and thread, over a simulated network.
+ *
+ * The sessions connect through transport(), a KIMAP2::SocketPairTransport, so there is no TCP
+ * port, no loopback and no server thread. Instead the server holds back its responses as
+ * a network with the given round trip time and bandwidth would, which makes the timings of
+ * pipelining, batching and backpressure tests depend on the Options rather than on the machine:
+ *
+ * @li every server part of a scenario is sent roundTripTime milliseconds after the client part
+ *     before it arrived, or the connection was opened for the greeting,
+ * @li the responses of a connection leave at bandwidth bytes per second, one after another, and
+ * @li they are written in pieces of at most chunkSize bytes, each in its own write, to
+ *     exercise the parser with responses split at arbitrary points.
+ *
+ * Scenarios are written as for FakeServer, with "C:", "S:" and "X" lines. A "W: <ms>" line
+ * delays the following server parts by that many milliseconds of simulated time, without
+ * blocking the event loop. STARTTLS and TLS are not supported.
+ *
+ * @code
+ * SimulatedServer::Options options;
+ * options.roundTripTime = 100;
+ * SimulatedServer server(options);
+ * server.setScenario(scenario);
+ * KIMAP2::Session session(server.transport());
+ * @endcode
+ *
+ * The transports need a Unix system, elsewhere the sessions fail to connect.
+ */
+class SimulatedServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Options {
+        // Milliseconds from a command to the first byte of its response
+        int roundTripTime = 0;
+        // The bytes per second sent to each client, 0 for no limit
+        qint64 bandwidth = 0;
+        // The largest piece a response is written in, 0 for whole responses
+        int chunkSize = 0;
+    };
+
+    explicit SimulatedServer(const Options &options = Options(), QObject *parent = Q_NULLPTR);
+    ~SimulatedServer();
+
+    Options options() const;
+
+    /**
+     * Opens a connection to this server for each session that is created with it.
+     * The connections are served by the thread of the server.
+     */
+    QSharedPointer<KIMAP2::Transport> transport();
+
+    /**
+     * Replaces the scenarios with @p scenario, see FakeServer::setScenario().
+     */
+    void setScenario(const QList<QByteArray> &scenario);
+
+    /**
+     * Adds a scenario for the next connection, see FakeServer::addScenario().
+     */
+    void addScenario(const QList<QByteArray> &scenario);
+
+    bool isScenarioDone(int scenarioNumber) const;
+    bool isAllScenarioDone() const;
+
+    /**
+     * Returns true once everything the scenarios sent so far was written to the clients.
+     */
+    bool isIdle() const;
+
+    /**
+     * The number of commands received on all connections.
+     */
+    int commandCount() const;
+
+    /**
+     * The largest number of commands that were received, but not answered yet, on one connection.
+     * 1 unless the client pipelined.
+     */
+    int maximumCommandsInFlight() const;
+
+protected:
+    /**
+     * Whether the received content is the same as the expected, see FakeServer::compareReceived().
+     */
+    virtual void compareReceived(const QByteArray &received, const QByteArray &expected) const;
+
+private Q_SLOTS:
+    void addConnection(qintptr descriptor);
+
+private:
+    Q_DISABLE_COPY(SimulatedServer)
+
+    struct Piece {
+        // Microseconds on the clock of the server when it may be sent
+        qint64 due;
+        QByteArray data;
+        // Closes the connection instead of sending data
+        bool close;
+        // The commands this piece answers
+        int answers;
+    };
+
+    struct Connection {
+        int scenario;
+        QTcpSocket *socket;
+        QTimer *timer;
+        QByteArray received;
+        // How much of received was checked for literals that need a continuation
+        int continued;
+        QList<Piece> output;
+        // When the last queued piece is due
+        qint64 lastDue;
+        // When the bandwidth allows the next byte
+        qint64 nextSend;
+        // Commands received and not answered yet, and those of them no server part was queued for
+        int inFlight;
+        int unqueued;
+    };
+
+    void readCommands(Connection *connection);
+    bool takeCommand(Connection *connection, QByteArray *command);
+    void queueServerPart(Connection *connection, qint64 due);
+    void send(Connection *connection);
+    void scheduleSend(Connection *connection);
+    qint64 now() const;
+
+    const Options m_options;
+    QSharedPointer<KIMAP2::Transport> m_transport;
+    QElapsedTimer m_clock;
+    mutable QMutex m_mutex;
+    QList<QList<QByteArray> > m_scenarios;
+    QList<Connection *> m_connections;
+    int m_commandCount;
+    int m_maximumInFlight;
+};
+
+#endif
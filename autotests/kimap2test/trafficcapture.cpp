@@ -0,0 +1,196 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+#include "trafficcapture.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QTimer>
+#include <QtEndian>
+
+static const char CaptureHeader[] = "KIMAP2 capture 1\n";
+static const int RecordHeaderSize = 1 + 8 + 4;
+
+bool TrafficCapture::load(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Can't open capture" << fileName;
+        return false;
+    }
+    return load(&file);
+}
+
+bool TrafficCapture::load(QIODevice *device)
+{
+    m_records.clear();
+    const QByteArray data = device->readAll();
+    if (!data.startsWith(CaptureHeader)) {
+        qWarning() << "Not a capture";
+        return false;
+    }
+    int pos = sizeof(CaptureHeader) - 1;
+    //A truncated last record is left out
+    while (pos + RecordHeaderSize <= data.size()) {
+        const uchar *header = reinterpret_cast<const uchar *>(data.constData() + pos);
+        const quint32 size = qFromBigEndian<quint32>(header + 9);
+        if (pos + RecordHeaderSize + qint64(size) > data.size()) {
+            break;
+        }
+        Record record;
+        record.type = static_cast<Record::Type>(header[0]);
+        record.timestamp = qFromBigEndian<quint64>(header + 1);
+        record.data = data.mid(pos + RecordHeaderSize, size);
+        if (record.type == Record::Dropped && record.data.size() == 8) {
+            const quint64 dropped = qFromBigEndian<quint64>(reinterpret_cast<const uchar *>(record.data.constData()));
+            record.data = QByteArray::number(dropped);
+        }
+        m_records << record;
+        pos += RecordHeaderSize + size;
+    }
+    return true;
+}
+
+QList<TrafficCapture::Record> TrafficCapture::records() const
+{
+    return m_records;
+}
+
+QByteArray TrafficCapture::receivedData() const
+{
+    QByteArray result;
+    foreach (const Record &record, m_records) {
+        if (record.type == Record::Received) {
+            result += record.data;
+        }
+    }
+    return result;
+}
+
+bool TrafficCapture::isIncomplete() const
+{
+    foreach (const Record &record, m_records) {
+        if (record.type == Record::Dropped) {
+            return true;
+        }
+    }
+    return false;
+}
+
+CaptureServer::CaptureServer(const TrafficCapture &capture, Pacing pacing, QObject *parent)
+    : QObject(parent),
+      m_records(capture.records()),
+      m_pacing(pacing),
+      m_client(Q_NULLPTR),
+      m_position(0),
+      m_clientLines(0),
+      m_expectedLines(0),
+      m_bytesSent(0),
+      m_replayScheduled(false),
+      m_lastTimestamp(0),
+      m_lastEventAt(0)
+{
+    connect(&m_server, &QTcpServer::newConnection, this, &CaptureServer::newConnection);
+}
+
+CaptureServer::~CaptureServer()
+{
+}
+
+bool CaptureServer::listen()
+{
+    return m_server.listen(QHostAddress(QHostAddress::LocalHost), 5989);
+}
+
+bool CaptureServer::isReplayDone() const
+{
+    return m_position == m_records.size();
+}
+
+qint64 CaptureServer::bytesSent() const
+{
+    return m_bytesSent;
+}
+
+void CaptureServer::newConnection()
+{
+    QTcpSocket *socket = m_server.nextPendingConnection();
+    if (m_client) {
+        //Only one client gets the capture
+        socket->disconnectFromHost();
+        return;
+    }
+    m_client = socket;
+    connect(m_client, &QIODevice::readyRead, this, &CaptureServer::clientDataAvailable);
+    m_clock.start();
+    if (!m_records.isEmpty()) {
+        markEvent(m_records.first().timestamp);
+    }
+    replay();
+}
+
+void CaptureServer::clientDataAvailable()
+{
+    m_clientLines += m_client->readAll().count('\n');
+    if (!m_replayScheduled) {
+        replay();
+    }
+}
+
+void CaptureServer::markEvent(qint64 timestamp)
+{
+    m_lastTimestamp = timestamp;
+    m_lastEventAt = m_clock.elapsed();
+}
+
+void CaptureServer::replay()
+{
+    m_replayScheduled = false;
+    while (m_client && m_position < m_records.size()) {
+        const TrafficCapture::Record &record = m_records.at(m_position);
+        switch (record.type) {
+        case TrafficCapture::Record::Sent: {
+            const qint64 expected = m_expectedLines + record.data.count('\n');
+            if (m_clientLines < expected) {
+                return;
+            }
+            m_expectedLines = expected;
+            markEvent(record.timestamp);
+            break;
+        }
+        case TrafficCapture::Record::Received:
+            if (m_pacing == RecordedPacing) {
+                const qint64 delay = (record.timestamp - m_lastTimestamp) / 1000 - (m_clock.elapsed() - m_lastEventAt);
+                if (delay > 0) {
+                    m_replayScheduled = true;
+                    QTimer::singleShot(int(delay), this, SLOT(replay()));
+                    return;
+                }
+            }
+            m_client->write(record.data);
+            m_bytesSent += record.data.size();
+            markEvent(record.timestamp);
+            break;
+        case TrafficCapture::Record::Disconnected:
+            m_client->disconnectFromHost();
+            break;
+        case TrafficCapture::Record::Dropped:
+            qWarning() << "The capture misses" << record.data << "bytes, the replay may stall";
+            break;
+        }
+        ++m_position;
+    }
+}
@@ -0,0 +1,129 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+#ifndef TRAFFICCAPTURE_H
+#define TRAFFICCAPTURE_H
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QObject>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+class QIODevice;
+
+/**
+ * The traffic of a session, as captured with KIMAP2_LOGFILE and KIMAP2_LOGFILE_CAPTURE.
+ *
+ * @code
+ * TrafficCapture capture;
+ * QVERIFY(capture.load(fileName));
+ * QBuffer buffer;
+ * buffer.setData(capture.receivedData());
+ * buffer.open(QIODevice::ReadOnly);
+ * KIMAP2::ImapStreamParser parser(&buffer);
+ * @endcode
+ */
+class TrafficCapture
+{
+public:
+    struct Record {
+        enum Type { Sent = 'C', Received = 'S', Disconnected = 'X', Dropped = 'D' };
+
+        Type type;
+        // Microseconds since the capture started
+        qint64 timestamp;
+        // The exact bytes, or for Dropped the number of bytes that are missing from the capture
+        QByteArray data;
+    };
+
+    bool load(const QString &fileName);
+    bool load(QIODevice *device);
+
+    QList<Record> records() const;
+
+    /**
+     * Returns everything the server sent, in one piece.
+     */
+    QByteArray receivedData() const;
+
+    /**
+     * Returns true if the writer couldn't keep up and parts of the traffic are missing.
+     */
+    bool isIncomplete() const;
+
+private:
+    QList<Record> m_records;
+};
+
+/**
+ * Plays the server part of a capture to the first client that connects, on port 5989 of the local machine.
+ *
+ * What the server sent after a command is held back until the client sent as many lines as
+ * the captured client did up to that point, so the replay works for a client that sends the
+ * same commands. Nothing checks what the client sends.
+ *
+ * The server runs on the thread it is created on.
+ */
+class CaptureServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Pacing {
+        LineRate,      ///< Send everything as soon as the client is there for it
+        RecordedPacing ///< Also wait as long as the server took in the capture
+    };
+
+    explicit CaptureServer(const TrafficCapture &capture, Pacing pacing = LineRate, QObject *parent = Q_NULLPTR);
+    ~CaptureServer();
+
+    bool listen();
+
+    /**
+     * Returns true once all of the capture was played.
+     */
+    bool isReplayDone() const;
+
+    /**
+     * Returns how many bytes were sent to the client so far.
+     */
+    qint64 bytesSent() const;
+
+private Q_SLOTS:
+    void replay();
+
+private:
+    void newConnection();
+    void clientDataAvailable();
+    void markEvent(qint64 timestamp);
+
+    QList<TrafficCapture::Record> m_records;
+    Pacing m_pacing;
+    QTcpServer m_server;
+    QTcpSocket *m_client;
+    QElapsedTimer m_clock;
+    int m_position;
+    qint64 m_clientLines;
+    qint64 m_expectedLines;
+    qint64 m_bytesSent;
+    bool m_replayScheduled;
+    // When the last record was played, in the capture and in the replay, for RecordedPacing
+    qint64 m_lastTimestamp;
+    qint64 m_lastEventAt;
+};
+
+#endif
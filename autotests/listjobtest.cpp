@@ -24,6 +24,8 @@
 #include "kimap2test/fakeserver.h"
 #include "kimap2/session.h"
 #include "kimap2/listjob.h"
+#include "kimap2/namespacejob.h"
+#include "kimap2/statusjob.h"
 
 #include <QtTest>
 #include <QDebug>
@@ -230,6 +232,270 @@ private Q_SLOTS:
         fakeServer.quit();
     }
 
+    void testListMailBoxIds()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 LIST-STATUS OBJECTID] localhost Test Library server ready"
+                               << "C: A000001 LIST \"\" * RETURN (STATUS (MAILBOXID))"
+                               << "S: * LIST ( \\HasChildren ) / INBOX"
+                               << "S: * STATUS INBOX (MAILBOXID (F2212ea87-6097-4256-9d51-71338625))"
+                               << "S: * LIST ( \\HasNoChildren ) / INBOX/Archive"
+                               << "S: * STATUS INBOX/Archive (MAILBOXID (F6352ae03-b7f5-463c-896f-d8b48ee3))"
+                               << "S: A000001 OK list done");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::ListJob *job = new KIMAP2::ListJob(&session);
+        job->setOption(KIMAP2::ListJob::IncludeUnsubscribed);
+        job->setMailBoxIdsEnabled(true);
+        QSignalSpy spy(job, &KIMAP2::ListJob::mailBoxIdReceived);
+        QVERIFY(job->exec());
+
+        QCOMPARE(spy.count(), 2);
+        const KIMAP2::MailBoxDescriptor archive = spy.at(1).at(0).value<KIMAP2::MailBoxDescriptor>();
+        QCOMPARE(archive.name, QStringLiteral("INBOX/Archive"));
+        QCOMPARE(archive.separator, QLatin1Char('/'));
+        QCOMPARE(spy.at(1).at(1).toByteArray(), QByteArray("F6352ae03-b7f5-463c-896f-d8b48ee3"));
+        QCOMPARE(spy.at(0).at(1).toByteArray(), QByteArray("F2212ea87-6097-4256-9d51-71338625"));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testListExtended()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 LIST-EXTENDED SPECIAL-USE] localhost Test Library server ready"
+                               << "C: A000001 LIST (SUBSCRIBED RECURSIVEMATCH) \"\" (\"INBOX\" \"INBOX/*\" \"Shared\" \"Shared/*\") RETURN (CHILDREN SPECIAL-USE)"
+                               << "S: * LIST (\\Subscribed \\HasChildren) \"/\" \"INBOX\""
+                               << "S: * LIST (\\HasChildren) \"/\" \"Shared\" (\"CHILDINFO\" (\"SUBSCRIBED\"))"
+                               << "S: * LIST (\\Subscribed \\Sent \\HasNoChildren) \"/\" \"INBOX/Sent\""
+                               << "S: A000001 OK list done");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        KIMAP2::MailBoxDescriptor personal;
+        personal.name = QStringLiteral("INBOX/");
+        personal.separator = QLatin1Char('/');
+        KIMAP2::MailBoxDescriptor shared;
+        shared.name = QStringLiteral("Shared/");
+        shared.separator = QLatin1Char('/');
+
+        KIMAP2::ListJob *job = new KIMAP2::ListJob(&session);
+        job->setOption(KIMAP2::ListJob::IncludeUnsubscribed);
+        job->setQueriedNamespaces(QList<KIMAP2::MailBoxDescriptor>() << personal << shared);
+        job->setExtendedOptions(KIMAP2::ListJob::SelectSubscribed | KIMAP2::ListJob::SelectRecursiveMatch
+                                | KIMAP2::ListJob::ReturnChildren | KIMAP2::ListJob::ReturnSpecialUse);
+        QSignalSpy spy(job, &KIMAP2::ListJob::resultReceived);
+        QVERIFY(job->exec());
+
+        QCOMPARE(spy.count(), 3);
+        QCOMPARE(spy.at(1).at(0).value<KIMAP2::MailBoxDescriptor>().name, QStringLiteral("Shared"));
+        const KIMAP2::MailBoxDescriptor sent = spy.at(2).at(0).value<KIMAP2::MailBoxDescriptor>();
+        QCOMPARE(sent.name, QStringLiteral("INBOX/Sent"));
+        QCOMPARE(spy.at(2).at(1).value<QList<QByteArray> >(), QList<QByteArray>() << "\\subscribed" << "\\sent" << "\\hasnochildren");
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testSessionNamespaces()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 NAMESPACE LIST-EXTENDED] localhost Test Library server ready"
+                               << "C: A000001 NAMESPACE"
+                               << "S: * NAMESPACE ((\"\" \"/\")) ((\"Other Users/\" \"/\")) ((\"Shared/\" \"/\"))"
+                               << "S: A000001 OK namespace done"
+                               << "C: A000002 LIST \"\" (\"*\" \"Other Users\" \"Other Users/*\" \"Shared\" \"Shared/*\")"
+                               << "S: * LIST (\\HasNoChildren) \"/\" \"INBOX\""
+                               << "S: * LIST (\\HasNoChildren) \"/\" \"Shared/Team\""
+                               << "S: A000002 OK list done");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QVERIFY(!session.hasNamespaces());
+
+        KIMAP2::NamespaceJob *namespaces = new KIMAP2::NamespaceJob(&session);
+        QVERIFY(namespaces->exec());
+        QVERIFY(session.hasNamespaces());
+        QCOMPARE(session.sharedNamespaces().size(), 1);
+        QCOMPARE(session.sharedNamespaces().first().name, QStringLiteral("Shared/"));
+
+        //Answered by the session
+        namespaces = new KIMAP2::NamespaceJob(&session);
+        QVERIFY(namespaces->exec());
+        QCOMPARE(namespaces->userNamespaces().first().name, QStringLiteral("Other Users/"));
+        QVERIFY(namespaces->containsEmptyNamespace());
+
+        KIMAP2::ListJob *job = new KIMAP2::ListJob(&session);
+        job->setOption(KIMAP2::ListJob::IncludeUnsubscribed);
+        job->setQueriesSessionNamespaces(true);
+        QSignalSpy spy(job, &KIMAP2::ListJob::resultReceived);
+        QVERIFY(job->exec());
+        QCOMPARE(spy.count(), 2);
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testListStatus()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 LIST-STATUS] localhost Test Library server ready"
+                               << "C: A000001 LIST \"\" * RETURN (STATUS (MESSAGES UNSEEN UIDNEXT))"
+                               << "S: * LIST ( \\HasChildren ) / INBOX"
+                               << "S: * STATUS INBOX (MESSAGES 17 UNSEEN 2 UIDNEXT 4392)"
+                               << "S: * LIST ( \\Noselect ) / Lists"
+                               << "S: * LIST ( \\HasNoChildren ) / Lists/KDE"
+                               << "S: * STATUS Lists/KDE (MESSAGES 0 UNSEEN 0 UIDNEXT 1)"
+                               << "S: A000001 OK list done");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        KIMAP2::ListJob *job = new KIMAP2::ListJob(&session);
+        job->setOption(KIMAP2::ListJob::IncludeUnsubscribed);
+        job->setStatusItems(QList<QByteArray>() << "MESSAGES" << "UNSEEN" << "UIDNEXT");
+        QList<QPair<QString, QList<QPair<QByteArray, qint64> > > > statuses;
+        connect(job, &KIMAP2::ListJob::statusReceived, [&](const KIMAP2::MailBoxDescriptor &descriptor, const QList<QPair<QByteArray, qint64> > &status) {
+            statuses << qMakePair(descriptor.name, status);
+        });
+        QVERIFY(job->exec());
+
+        QCOMPARE(statuses.size(), 2);
+        QCOMPARE(statuses.at(0).first, QStringLiteral("INBOX"));
+        QCOMPARE(statuses.at(0).second, QList<QPair<QByteArray, qint64> >()
+                 << qMakePair(QByteArray("MESSAGES"), qint64(17))
+                 << qMakePair(QByteArray("UNSEEN"), qint64(2))
+                 << qMakePair(QByteArray("UIDNEXT"), qint64(4392)));
+        QCOMPARE(statuses.at(1).first, QStringLiteral("Lists/KDE"));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testMailBoxNameCache()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 LIST \"\" *"
+                               << "S: * LIST ( \\HasChildren ) . inbox"
+                               << "S: * LIST ( \\HasNoChildren ) . inbox.Sent"
+                               << "S: * LIST ( \\HasNoChildren ) . Inboxes"
+                               << "S: * LIST ( \\HasNoChildren ) . &AOQ-&AOQ-"
+                               << "S: * LIST ( \\HasNoChildren ) . \"&AOQ-\\\"Q\""
+                               << "S: A000001 OK list done"
+                               // Sent the way the server spelled it, not as &AOQA5A-
+                               << "C: A000002 STATUS \"&AOQ-&AOQ-\" (MESSAGES)"
+                               << "S: * STATUS &AOQ-&AOQ- (MESSAGES 3)"
+                               << "S: A000002 OK status done"
+                               // Quoted again
+                               << "C: A000003 STATUS \"&AOQ-\\\"Q\" (MESSAGES)"
+                               << "S: * STATUS \"&AOQ-\\\"Q\" (MESSAGES 1)"
+                               << "S: A000003 OK status done");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        session.setMailBoxNameCacheEnabled(true);
+
+        KIMAP2::ListJob *job = new KIMAP2::ListJob(&session);
+        job->setOption(KIMAP2::ListJob::IncludeUnsubscribed);
+        QStringList names;
+        connect(job, &KIMAP2::ListJob::resultReceived, [&](const KIMAP2::MailBoxDescriptor &descriptor, const QList<QByteArray> &) {
+            names << descriptor.name;
+        });
+        QVERIFY(job->exec());
+        QCOMPARE(names, QStringList() << QStringLiteral("INBOX") << QStringLiteral("INBOX.Sent")
+                 << QStringLiteral("Inboxes") << QString::fromUtf8("ää") << QString::fromUtf8("ä\"Q"));
+
+        KIMAP2::StatusJob *status = new KIMAP2::StatusJob(&session);
+        status->setMailBox(QString::fromUtf8("ää"));
+        status->setDataItems(QList<QByteArray>() << "MESSAGES");
+        QVERIFY(status->exec());
+        QCOMPARE(status->status(), QList<QPair<QByteArray, qint64> >() << qMakePair(QByteArray("MESSAGES"), qint64(3)));
+
+        status = new KIMAP2::StatusJob(&session);
+        status->setMailBox(QString::fromUtf8("ä\"Q"));
+        status->setDataItems(QList<QByteArray>() << "MESSAGES");
+        QVERIFY(status->exec());
+        QCOMPARE(status->status(), QList<QPair<QByteArray, qint64> >() << qMakePair(QByteArray("MESSAGES"), qint64(1)));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testImap4Rev2()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev2] localhost Test Library server ready"
+                               << "C: A000001 LIST \"\" * RETURN (STATUS (MESSAGES UNSEEN))"
+                               << "S: * LIST (\\HasNoChildren) \"/\" \"INBOX\""
+                               << "S: * STATUS \"INBOX\" (MESSAGES 17 UNSEEN 2)"
+                               << "S: A000001 OK list done");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        //LIST-STATUS is part of IMAP4rev2
+        KIMAP2::ListJob *job = new KIMAP2::ListJob(&session);
+        job->setOption(KIMAP2::ListJob::IncludeUnsubscribed);
+        job->setStatusItems(QList<QByteArray>() << "MESSAGES" << "UNSEEN");
+        QSignalSpy spy(job, &KIMAP2::ListJob::statusReceived);
+        QVERIFY(job->exec());
+        QCOMPARE(spy.count(), 1);
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testChildrenOf()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 LIST-EXTENDED] localhost Test Library server ready"
+                               << "C: A000001 LIST \"\" % RETURN (CHILDREN)"
+                               << "S: * LIST (\\HasChildren) \".\" \"INBOX\""
+                               << "S: * LIST (\\Noselect \\HasChildren) \".\" \"&AOQ-\""
+                               << "S: A000001 OK list done"
+                               << "C: A000002 LSUB \"\" \"&AOQ-.%\""
+                               << "S: * LSUB () \".\" \"&AOQ-.Team\""
+                               << "S: A000002 OK lsub done");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::ListJob *job = new KIMAP2::ListJob(&session);
+        job->setOption(KIMAP2::ListJob::IncludeUnsubscribed);
+        job->setChildrenOf(KIMAP2::MailBoxDescriptor());
+        QVERIFY(job->listsChildrenOnly());
+        QSignalSpy spy(job, &KIMAP2::ListJob::resultReceived);
+        QVERIFY(job->exec());
+        QCOMPARE(spy.count(), 2);
+        const KIMAP2::MailBoxDescriptor shared = spy.at(1).at(0).value<KIMAP2::MailBoxDescriptor>();
+        QCOMPARE(shared.name, QString::fromUtf8("ä"));
+
+        //CHILDREN is a LIST-EXTENDED option, LSUB has none
+        job = new KIMAP2::ListJob(&session);
+        job->setChildrenOf(shared);
+        QSignalSpy lsubSpy(job, &KIMAP2::ListJob::resultReceived);
+        QVERIFY(job->exec());
+        QCOMPARE(lsubSpy.count(), 1);
+        QCOMPARE(lsubSpy.at(0).at(0).value<KIMAP2::MailBoxDescriptor>().name, QString::fromUtf8("ä.Team"));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
 };
 
 QTEST_GUILESS_MAIN(ListJobTest)
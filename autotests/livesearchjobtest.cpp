@@ -0,0 +1,115 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#include <qtest.h>
+
+#include "kimap2test/fakeserver.h"
+#include "kimap2/session.h"
+#include "kimap2/livesearchjob.h"
+
+#include <QtTest>
+
+class LiveSearchJobTest: public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testUpdates()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 ESEARCH CONTEXT=SEARCH IDLE] localhost Test Library server ready"
+                               << "C: A000001 UID SEARCH RETURN (ALL UPDATE) NOT SEEN"
+                               << "S: * ESEARCH (TAG \"A000001\") UID ALL 3:5,9"
+                               << "S: A000001 OK search done"
+                               << "C: A000002 IDLE"
+                               << "S: + idling"
+                               << "S: * ESEARCH (TAG \"A000001\") UID ADDTO (0 12:13)"
+                               << "S: * ESEARCH (TAG \"A000001\") UID REMOVEFROM (0 4 0 9)"
+                               << "C: DONE"
+                               << "S: A000002 OK done idling"
+                               << "C: A000003 CANCELUPDATE \"A000001\""
+                               << "S: A000003 OK updates cancelled");
+        fakeServer.startAndWait();
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        KIMAP2::LiveSearchJob *job = new KIMAP2::LiveSearchJob(&session);
+        job->setUidBased(true);
+        job->setTerm(KIMAP2::Term(KIMAP2::Term::Seen).setNegated(true));
+
+        QList<QByteArray> added;
+        QList<QByteArray> removed;
+        connect(job, &KIMAP2::LiveSearchJob::resultsAdded, [&added](KIMAP2::LiveSearchJob *, const KIMAP2::ImapSet &set) {
+            added << set.toImapSequenceSet();
+        });
+        connect(job, &KIMAP2::LiveSearchJob::resultsRemoved, [&removed](KIMAP2::LiveSearchJob *job, const KIMAP2::ImapSet &set) {
+            removed << set.toImapSequenceSet();
+            job->stop();
+        });
+        QVERIFY(job->exec());
+
+        QCOMPARE(added, QList<QByteArray>() << "3:5,9" << "12:13");
+        QCOMPARE(removed, QList<QByteArray>() << "4,9");
+        QCOMPARE(job->results().toImapSequenceSet(), QByteArray("3,5,12:13"));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testStopBeforeIdle()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 ESEARCH CONTEXT=SEARCH IDLE] localhost Test Library server ready"
+                               << "C: A000001 SEARCH RETURN (ALL UPDATE) ALL"
+                               << "S: * ESEARCH (TAG \"A000001\") ALL 1:3"
+                               << "S: A000001 OK search done"
+                               << "C: A000002 CANCELUPDATE \"A000001\""
+                               << "S: A000002 OK updates cancelled");
+        fakeServer.startAndWait();
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        KIMAP2::LiveSearchJob *job = new KIMAP2::LiveSearchJob(&session);
+        job->stop();
+        QVERIFY(job->exec());
+        QCOMPARE(job->results().toImapSequenceSet(), QByteArray("1:3"));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testUnsupported()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 ESEARCH IDLE] localhost Test Library server ready");
+        fakeServer.startAndWait();
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        KIMAP2::LiveSearchJob *job = new KIMAP2::LiveSearchJob(&session);
+        QVERIFY(!job->exec());
+
+        fakeServer.quit();
+    }
+};
+
+QTEST_GUILESS_MAIN(LiveSearchJobTest)
+
+#include "livesearchjobtest.moc"
@@ -0,0 +1,228 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+#include <qtest.h>
+
+#include "kimap2test/loadserver.h"
+#include "kimap2/session.h"
+#include "kimap2/fetchjob.h"
+#include "kimap2/idlejob.h"
+#include "kimap2/searchjob.h"
+#include "kimap2/selectjob.h"
+#include "kimap2/storejob.h"
+
+#include <QtTest>
+
+Q_DECLARE_METATYPE(KIMAP2::IdleJob *)
+
+using namespace KIMAP2;
+
+class LoadServerTest: public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit LoadServerTest(QObject *parent = nullptr)
+        : QObject(parent)
+    {
+        qRegisterMetaType<KIMAP2::IdleJob *>();
+    }
+
+private:
+    static bool select(Session *session, const QString &mailBox = QStringLiteral("INBOX"), int *messageCount = nullptr)
+    {
+        SelectJob *job = new SelectJob(session);
+        job->setMailBox(mailBox);
+        const bool result = job->exec();
+        if (messageCount) {
+            *messageCount = job->messageCount();
+        }
+        return result;
+    }
+
+    static QVector<qint64> search(Session *session, const Term &term)
+    {
+        SearchJob *job = new SearchJob(session);
+        job->setUidBased(true);
+        job->setTerm(term);
+        if (!job->exec()) {
+            return QVector<qint64>();
+        }
+        return job->results();
+    }
+
+private Q_SLOTS:
+    void testSelectAndFetch()
+    {
+        LoadServer::Options options;
+        options.port = 0;
+        options.messages = 500;
+        options.mailboxes = 2;
+        options.shape = LoadServer::Options::Multipart;
+        LoadServer server(options);
+        QVERIFY(server.startAndWait());
+
+        Session session(QStringLiteral("127.0.0.1"), server.port());
+        int messageCount = 0;
+        QVERIFY(select(&session, QStringLiteral("Folder1"), &messageCount));
+        QCOMPARE(messageCount, 500);
+
+        FetchJob::FetchScope scope;
+        scope.mode = FetchJob::FetchScope::Full;
+        FetchJob *job = new FetchJob(&session);
+        job->setUidBased(true);
+        job->setSequenceSet(ImapSet(1, 0));
+        job->setScope(scope);
+        QList<FetchJob::Result> results;
+        connect(job, &FetchJob::resultReceived, [&results](const FetchJob::Result &result) {
+            results << result;
+        });
+        QVERIFY(job->exec());
+
+        QCOMPARE(results.count(), 500);
+        QCOMPARE(results.first().uid, qint64(1));
+        QCOMPARE(results.last().uid, qint64(500));
+        QVERIFY(results.first().message);
+        QCOMPARE(results.first().message->subject()->asUnicodeString(), QStringLiteral("Message 1 in Folder1"));
+        QCOMPARE(results.first().message->contents().count(), 2);
+        QVERIFY(server.commandCount() >= 2);
+    }
+
+    void testSearchAndStore()
+    {
+        LoadServer::Options options;
+        options.port = 0;
+        options.messages = 100;
+        options.unseenInterval = 10;
+        LoadServer server(options);
+        QVERIFY(server.startAndWait());
+
+        Session session(QStringLiteral("127.0.0.1"), server.port());
+        QVERIFY(select(&session));
+
+        QCOMPARE(search(&session, Term(Term::All)).count(), 100);
+        QCOMPARE(search(&session, Term(Term::New)), QVector<qint64>() << 10 << 20 << 30 << 40 << 50 << 60 << 70 << 80 << 90 << 100);
+
+        StoreJob *store = new StoreJob(&session);
+        store->setUidBased(true);
+        store->setSequenceSet(ImapSet(10, 30));
+        store->setFlags(MessageFlags() << "\\Seen");
+        store->setMode(StoreJob::AppendFlags);
+        QVERIFY(store->exec());
+
+        QCOMPARE(search(&session, Term(Term::New)), QVector<qint64>() << 40 << 50 << 60 << 70 << 80 << 90 << 100);
+    }
+
+    void testIdleSeesStore()
+    {
+        LoadServer::Options options;
+        options.port = 0;
+        options.messages = 10;
+        LoadServer server(options);
+        QVERIFY(server.startAndWait());
+
+        Session idleSession(QStringLiteral("127.0.0.1"), server.port());
+        QVERIFY(select(&idleSession));
+        IdleJob *idle = new IdleJob(&idleSession);
+        QSignalSpy flagsSpy(idle, &IdleJob::mailBoxMessageFlagsChanged);
+        idle->start();
+
+        Session session(QStringLiteral("127.0.0.1"), server.port());
+        QVERIFY(select(&session));
+        StoreJob *store = new StoreJob(&session);
+        store->setUidBased(true);
+        store->setSequenceSet(ImapSet(3));
+        store->setFlags(MessageFlags() << "\\Flagged");
+        store->setMode(StoreJob::AppendFlags);
+        QVERIFY(store->exec());
+
+        QTRY_COMPARE(flagsSpy.count(), 1);
+        QCOMPARE(flagsSpy.first().at(1).toLongLong(), qint64(3));
+
+        QSignalSpy resultSpy(idle, &KJob::result);
+        idle->stop();
+        QTRY_COMPARE(resultSpy.count(), 1);
+    }
+
+    void testManySessions()
+    {
+        LoadServer::Options options;
+        options.port = 0;
+        options.messages = 50;
+        options.threads = 2;
+        options.latency = 10;
+        LoadServer server(options);
+        QVERIFY(server.startAndWait());
+
+        const int count = 200;
+        QList<Session *> sessions;
+        int done = 0;
+        for (int i = 0; i < count; ++i) {
+            Session *session = new Session(QStringLiteral("127.0.0.1"), server.port(), this);
+            sessions << session;
+            SelectJob *select = new SelectJob(session);
+            select->setMailBox(QStringLiteral("INBOX"));
+            select->start();
+            FetchJob::FetchScope scope;
+            scope.mode = FetchJob::FetchScope::Flags;
+            FetchJob *fetch = new FetchJob(session);
+            fetch->setUidBased(true);
+            fetch->setSequenceSet(ImapSet(1, 0));
+            fetch->setScope(scope);
+            connect(fetch, &KJob::result, [&done](KJob *job) {
+                if (!job->error()) {
+                    done++;
+                }
+            });
+            fetch->start();
+        }
+
+        QTRY_COMPARE_WITH_TIMEOUT(done, count, 30000);
+        QCOMPARE(server.connectionCount(), count);
+        qDeleteAll(sessions);
+    }
+
+    void testBandwidthLimit()
+    {
+        LoadServer::Options options;
+        options.port = 0;
+        options.messages = 20;
+        options.bodySize = 10 * 1024;
+        options.bandwidth = 400 * 1024;
+        LoadServer server(options);
+        QVERIFY(server.startAndWait());
+
+        Session session(QStringLiteral("127.0.0.1"), server.port());
+        QVERIFY(select(&session));
+
+        FetchJob::FetchScope scope;
+        scope.mode = FetchJob::FetchScope::Content;
+        FetchJob *job = new FetchJob(&session);
+        job->setUidBased(true);
+        job->setSequenceSet(ImapSet(1, 0));
+        job->setScope(scope);
+
+        QElapsedTimer timer;
+        timer.start();
+        QVERIFY(job->exec());
+        // About 200 KiB at 400 KiB/s
+        QVERIFY(timer.elapsed() >= 350);
+    }
+};
+
+QTEST_GUILESS_MAIN(LoadServerTest)
+
+#include "loadservertest.moc"
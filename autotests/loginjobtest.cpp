@@ -24,9 +24,27 @@
 #include "kimap2test/fakeserver.h"
 #include "kimap2/session.h"
 #include "kimap2/loginjob.h"
+#include "kimap2/oauthtokenprovider.h"
+#include "kimap2/selectjob.h"
 
 #include <QtTest>
 
+class MemoryCapabilityCache : public KIMAP2::CapabilityCache
+{
+public:
+    QStringList capabilities(const QString &hostName, quint16 port) Q_DECL_OVERRIDE
+    {
+        return stored.value(hostName + QString::number(port));
+    }
+
+    void setCapabilities(const QString &hostName, quint16 port, const QStringList &capabilities) Q_DECL_OVERRIDE
+    {
+        stored.insert(hostName + QString::number(port), capabilities);
+    }
+
+    QHash<QString, QStringList> stored;
+};
+
 class LoginJobTest: public QObject
 {
     Q_OBJECT
@@ -323,6 +341,214 @@ private Q_SLOTS:
         delete session;
     }
 
+    void shouldUseGreetingCapabilities()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * OK [CAPABILITY IMAP4rev1 AUTH=PLAIN] localhost Test Library server ready"
+                               << "C: A000001 LOGIN \"user\" \"password\""
+                               << "S: A000001 OK [CAPABILITY IMAP4rev1 IDLE] User logged in"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QSignalSpy capabilitiesSpy(&session, SIGNAL(capabilitiesChanged(QStringList)));
+
+        KIMAP2::LoginJob *login = new KIMAP2::LoginJob(&session);
+        login->setUserName(QStringLiteral("user"));
+        login->setPassword(QStringLiteral("password"));
+        QVERIFY(login->exec());
+
+        QCOMPARE(session.capabilities(), QStringList() << QStringLiteral("IMAP4REV1") << QStringLiteral("IDLE"));
+        QCOMPARE(capabilitiesSpy.count(), 2);
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void shouldUseCapabilityCache()
+    {
+        MemoryCapabilityCache cache;
+        for (int i = 0; i < 2; i++) {
+            QList<QByteArray> scenario;
+            scenario << FakeServer::greeting();
+            if (i == 0) {
+                scenario << "C: A000001 CAPABILITY"
+                         << "S: * CAPABILITY IMAP4rev1 AUTH=PLAIN"
+                         << "S: A000001 OK"
+                         << "C: A000002 LOGIN \"user\" \"password\""
+                         << "S: A000002 OK User logged in";
+            } else {
+                //Reconnecting saves the round trip
+                scenario << "C: A000001 LOGIN \"user\" \"password\""
+                         << "S: A000001 OK User logged in";
+            }
+            FakeServer fakeServer;
+            fakeServer.setScenario(scenario);
+            fakeServer.startAndWait();
+
+            KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+            session.setCapabilityCache(&cache);
+
+            KIMAP2::LoginJob *login = new KIMAP2::LoginJob(&session);
+            login->setUserName(QStringLiteral("user"));
+            login->setPassword(QStringLiteral("password"));
+            QVERIFY(login->exec());
+
+            QCOMPARE(cache.stored.value(QStringLiteral("127.0.0.15989")), QStringList() << QStringLiteral("IMAP4rev1") << QStringLiteral("AUTH=PLAIN"));
+            QVERIFY(fakeServer.isAllScenarioDone());
+            fakeServer.quit();
+        }
+    }
+
+    void shouldPipelineFollowUp()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * OK [CAPABILITY IMAP4rev1] localhost Test Library server ready"
+                               << "C: A000001 LOGIN \"user\" \"password\""
+                               << "C: A000002 SELECT \"INBOX\""
+                               << "S: A000001 OK User logged in"
+                               << "S: * 3 EXISTS"
+                               << "S: A000002 OK [READ-WRITE] SELECT completed"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::LoginJob *login = new KIMAP2::LoginJob(&session);
+        login->setUserName(QStringLiteral("user"));
+        login->setPassword(QStringLiteral("password"));
+        login->setFollowUpPipelined(true);
+        login->start();
+
+        KIMAP2::SelectJob *select = new KIMAP2::SelectJob(&session);
+        select->setMailBox(QStringLiteral("INBOX"));
+        QVERIFY(select->exec());
+        QCOMPARE(select->messageCount(), 3);
+        QCOMPARE(session.state(), KIMAP2::Session::Selected);
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void shouldLoginWithXOAuth2InOneRoundTrip()
+    {
+        const QByteArray initialResponse = QByteArray("user=user\x01" "auth=Bearer token\x01\x01").toBase64();
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::greeting()
+                               << "C: A000001 CAPABILITY"
+                               << "S: * CAPABILITY IMAP4rev1 AUTH=XOAUTH2 SASL-IR"
+                               << "S: A000001 OK"
+                               << "C: A000002 AUTHENTICATE XOAUTH2 " + initialResponse
+                               << "S: A000002 OK Success"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::LoginJob *login = new KIMAP2::LoginJob(&session);
+        login->setAuthenticationMode(KIMAP2::LoginJob::XOAuth2);
+        login->setUserName(QStringLiteral("user"));
+        login->setPassword(QStringLiteral("token"));
+        QVERIFY(login->exec());
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void shouldRetryWithFreshToken()
+    {
+        const QByteArray expiredResponse = QByteArray("n,a=user,\x01" "host=127.0.0.1\x01" "port=5989\x01" "auth=Bearer expired\x01\x01").toBase64();
+        const QByteArray freshResponse = QByteArray("n,a=user,\x01" "host=127.0.0.1\x01" "port=5989\x01" "auth=Bearer fresh\x01\x01").toBase64();
+        const QByteArray error = QByteArray("{\"status\":\"invalid_token\"}").toBase64();
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::greeting()
+                               << "C: A000001 CAPABILITY"
+                               << "S: * CAPABILITY IMAP4rev1 AUTH=OAUTHBEARER"
+                               << "S: A000001 OK"
+                               << "C: A000002 AUTHENTICATE OAUTHBEARER"
+                               << "S: +"
+                               << "C: " + expiredResponse
+                               << "S: + " + error
+                               << "C: AQ=="
+                               << "S: A000002 NO Authentication failed"
+                               << "C: A000003 AUTHENTICATE OAUTHBEARER"
+                               << "S: +"
+                               << "C: " + freshResponse
+                               << "S: A000003 OK Success"
+                              );
+        fakeServer.startAndWait();
+
+        int fetches = 0;
+        QSharedPointer<KIMAP2::OAuthTokenProvider> provider(new KIMAP2::OAuthTokenProvider([&fetches](const KIMAP2::OAuthTokenProvider::TokenCallback &done) {
+            fetches++;
+            done(fetches == 1 ? QStringLiteral("expired") : QStringLiteral("fresh"));
+        }));
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::LoginJob *login = new KIMAP2::LoginJob(&session);
+        login->setAuthenticationMode(KIMAP2::LoginJob::OAuthBearer);
+        login->setUserName(QStringLiteral("user"));
+        login->setTokenProvider(provider);
+        QVERIFY(login->exec());
+        QCOMPARE(fetches, 2);
+        QCOMPARE(provider->token(), QStringLiteral("fresh"));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void shouldInvalidateRejectedToken()
+    {
+        const QByteArray initialResponse = QByteArray("n,a=user,\x01" "host=127.0.0.1\x01" "port=5989\x01" "auth=Bearer expired\x01\x01").toBase64();
+        const QByteArray error = QByteArray("{\"status\":\"invalid_token\"}").toBase64();
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::greeting()
+                               << "C: A000001 CAPABILITY"
+                               << "S: * CAPABILITY IMAP4rev1 AUTH=OAUTHBEARER"
+                               << "S: A000001 OK"
+                               << "C: A000002 AUTHENTICATE OAUTHBEARER"
+                               << "S: +"
+                               << "C: " + initialResponse
+                               << "S: + " + error
+                               << "C: AQ=="
+                               << "S: A000002 NO Authentication failed"
+                               << "C: A000003 AUTHENTICATE OAUTHBEARER"
+                               << "S: +"
+                               << "C: " + initialResponse
+                               << "S: + " + error
+                               << "C: AQ=="
+                               << "S: A000003 NO Authentication failed"
+                              );
+        fakeServer.startAndWait();
+
+        int fetches = 0;
+        QSharedPointer<KIMAP2::OAuthTokenProvider> provider(new KIMAP2::OAuthTokenProvider([&fetches](const KIMAP2::OAuthTokenProvider::TokenCallback &done) {
+            fetches++;
+            done(QStringLiteral("expired"));
+        }));
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::LoginJob *login = new KIMAP2::LoginJob(&session);
+        login->setAuthenticationMode(KIMAP2::LoginJob::OAuthBearer);
+        login->setUserName(QStringLiteral("user"));
+        login->setTokenProvider(provider);
+        QVERIFY(!login->exec());
+        QVERIFY(login->errorString().contains(QStringLiteral("invalid_token")));
+        //Retried once with a fresh token
+        QCOMPARE(fetches, 2);
+        QVERIFY(provider->token().isEmpty());
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
 };
 
 QTEST_GUILESS_MAIN(LoginJobTest)
@@ -0,0 +1,156 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+#include <qtest.h>
+
+#include "kimap2test/fakeserver.h"
+#include "kimap2/mailboxscanjob.h"
+#include "kimap2/session.h"
+
+#include <QtTest>
+
+#include <limits>
+
+using namespace KIMAP2;
+
+class MailboxScanJobTest: public QObject
+{
+    Q_OBJECT
+
+private:
+    static MailboxFingerprint fingerprint(qint64 messages, qint64 uidNext, qint64 unseen, quint64 modSeq = 0)
+    {
+        MailboxFingerprint fingerprint;
+        fingerprint.messages = messages;
+        fingerprint.uidNext = uidNext;
+        fingerprint.uidValidity = 1;
+        fingerprint.unseen = unseen;
+        fingerprint.highestModSequence = modSeq;
+        return fingerprint;
+    }
+
+private Q_SLOTS:
+
+    void testDistance()
+    {
+        const MailboxFingerprint older = fingerprint(10, 11, 2);
+        QCOMPARE(older.distance(older), qint64(0));
+        //Two new messages, one of them expunged again
+        QCOMPARE(fingerprint(11, 13, 2).distance(older), qint64(3));
+        QCOMPARE(fingerprint(10, 11, 0).distance(older), qint64(2));
+
+        MailboxFingerprint replaced = older;
+        replaced.uidValidity = 2;
+        QCOMPARE(replaced.distance(older), std::numeric_limits<qint64>::max());
+        QCOMPARE(older.distance(MailboxFingerprint()), std::numeric_limits<qint64>::max());
+    }
+
+    void testStatus()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 CONDSTORE] localhost Test Library server ready"
+                               << "C: A000001 STATUS \"Archive\" (MESSAGES UIDNEXT UIDVALIDITY UNSEEN HIGHESTMODSEQ)"
+                               << "C: A000002 STATUS \"Gone\" (MESSAGES UIDNEXT UIDVALIDITY UNSEEN HIGHESTMODSEQ)"
+                               << "C: A000003 STATUS \"INBOX\" (MESSAGES UIDNEXT UIDVALIDITY UNSEEN HIGHESTMODSEQ)"
+                               << "C: A000004 STATUS \"Locked\" (MESSAGES UIDNEXT UIDVALIDITY UNSEEN HIGHESTMODSEQ)"
+                               << "C: A000005 STATUS \"Trash\" (MESSAGES UIDNEXT UIDVALIDITY UNSEEN HIGHESTMODSEQ)"
+                               << "S: * STATUS Archive (MESSAGES 5 UIDNEXT 6 UIDVALIDITY 1 UNSEEN 0 HIGHESTMODSEQ 20)"
+                               << "S: A000001 OK STATUS completed"
+                               << "S: A000002 NO [NONEXISTENT] No such mailbox"
+                               << "S: * STATUS INBOX (MESSAGES 12 UIDNEXT 13 UIDVALIDITY 1 UNSEEN 4 HIGHESTMODSEQ 104)"
+                               << "S: A000003 OK STATUS completed"
+                               << "S: A000004 NO [INUSE] Try again later"
+                               << "S: * STATUS Trash (MESSAGES 3 UIDNEXT 4 UIDVALIDITY 1 UNSEEN 0 HIGHESTMODSEQ 51)"
+                               << "S: A000005 OK STATUS completed"
+                              );
+        fakeServer.startAndWait();
+
+        Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), Session::Authenticated);
+
+        QHash<QString, MailboxFingerprint> fingerprints;
+        fingerprints.insert(QStringLiteral("INBOX"), fingerprint(10, 11, 2, 100));
+        fingerprints.insert(QStringLiteral("Archive"), fingerprint(5, 6, 0, 20));
+        fingerprints.insert(QStringLiteral("Trash"), fingerprint(3, 4, 0, 50));
+        fingerprints.insert(QStringLiteral("Gone"), fingerprint(1, 2, 0, 10));
+        fingerprints.insert(QStringLiteral("Locked"), fingerprint(7, 8, 1, 30));
+
+        MailboxScanJob *job = new MailboxScanJob(&session);
+        job->setFingerprints(fingerprints);
+        QStringList reported;
+        connect(job, &MailboxScanJob::mailBoxChanged, [&](const QString &mailBox, const MailboxFingerprint &current, const MailboxFingerprint &previous) {
+            reported << mailBox;
+            QCOMPARE(previous, fingerprints.value(mailBox));
+            QVERIFY(current != previous);
+        });
+        QVERIFY(job->exec());
+
+        QVERIFY(!job->usesListStatus());
+        QCOMPARE(reported, QStringList() << QStringLiteral("INBOX") << QStringLiteral("Trash"));
+        QCOMPARE(job->changedMailBoxes(), reported);
+        QCOMPARE(job->removedMailBoxes(), QStringList() << QStringLiteral("Gone"));
+        QCOMPARE(job->fingerprints().size(), 4);
+        QCOMPARE(job->fingerprints().value(QStringLiteral("INBOX")), fingerprint(12, 13, 4, 104));
+        //Still there, only without a status this time
+        QCOMPARE(job->fingerprints().value(QStringLiteral("Locked")), fingerprint(7, 8, 1, 30));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testListStatus()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 LIST-STATUS] localhost Test Library server ready"
+                               << "C: A000001 LIST \"\" * RETURN (STATUS (MESSAGES UIDNEXT UIDVALIDITY UNSEEN))"
+                               << "S: * LIST ( \\HasChildren ) / INBOX"
+                               << "S: * STATUS INBOX (MESSAGES 17 UIDNEXT 4392 UIDVALIDITY 1 UNSEEN 2)"
+                               << "S: * LIST ( \\Noselect ) / Lists"
+                               << "S: * LIST ( \\HasNoChildren ) / Lists/KDE"
+                               << "S: * STATUS Lists/KDE (MESSAGES 0 UIDNEXT 1 UIDVALIDITY 7 UNSEEN 0)"
+                               << "S: A000001 OK list done"
+                              );
+        fakeServer.startAndWait();
+
+        Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), Session::Authenticated);
+
+        QHash<QString, MailboxFingerprint> fingerprints;
+        fingerprints.insert(QStringLiteral("INBOX"), fingerprint(17, 4392, 2));
+        fingerprints.insert(QStringLiteral("Old"), fingerprint(1, 2, 0));
+        fingerprints.insert(QStringLiteral("Lists"), fingerprint(0, 1, 0));
+
+        MailboxScanJob *job = new MailboxScanJob(&session);
+        job->setFingerprints(fingerprints);
+        QVERIFY(job->exec());
+
+        QVERIFY(job->usesListStatus());
+        QCOMPARE(job->changedMailBoxes(), QStringList() << QStringLiteral("Lists/KDE"));
+        QCOMPARE(job->removedMailBoxes(), QStringList() << QStringLiteral("Old"));
+        QCOMPARE(job->fingerprints().value(QStringLiteral("Lists/KDE")).uidValidity, qint64(7));
+        //Listed without a status
+        QCOMPARE(job->fingerprints().value(QStringLiteral("Lists")), fingerprint(0, 1, 0));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+};
+
+QTEST_GUILESS_MAIN(MailboxScanJobTest)
+
+#include "mailboxscanjobtest.moc"
@@ -0,0 +1,236 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#include <qtest.h>
+
+#include "kimap2test/fakeserver.h"
+#include "kimap2/session.h"
+#include "kimap2/mailboxsyncjob.h"
+
+#include <QtTest>
+
+using KIMAP2::MailboxSyncJob;
+
+class MailboxSyncJobTest: public QObject
+{
+    Q_OBJECT
+
+private:
+    struct Recorder {
+        QList<qint64> newUids;
+        QList<qint64> changedUids;
+        QList<QByteArray> vanished;
+        int batches = 0;
+    };
+
+    static void record(MailboxSyncJob *job, Recorder *recorder)
+    {
+        connect(job, &MailboxSyncJob::newMessages, [recorder](MailboxSyncJob *, const QVector<MailboxSyncJob::MessageState> &messages) {
+            recorder->batches++;
+            for (const MailboxSyncJob::MessageState &message : messages) {
+                recorder->newUids << message.uid;
+            }
+        });
+        connect(job, &MailboxSyncJob::changedMessages, [recorder](MailboxSyncJob *, const QVector<MailboxSyncJob::MessageState> &messages) {
+            recorder->batches++;
+            for (const MailboxSyncJob::MessageState &message : messages) {
+                recorder->changedUids << message.uid;
+            }
+        });
+        connect(job, &MailboxSyncJob::vanishedMessages, [recorder](MailboxSyncJob *, const KIMAP2::ImapSet &uids) {
+            recorder->vanished << uids.toImapSequenceSet();
+        });
+    }
+
+    static KIMAP2::MailboxSyncState previousState()
+    {
+        KIMAP2::MailboxSyncState state;
+        state.uidValidity = 3857529045;
+        state.nextUid = 21;
+        state.highestModSequence = 700;
+        state.uids = KIMAP2::ImapSet::fromImapSequenceSet("1:10,15:20");
+        return state;
+    }
+
+private Q_SLOTS:
+    void testQResync()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 CONDSTORE QRESYNC ENABLE] localhost Test Library server ready"
+                               << "C: A000001 ENABLE QRESYNC"
+                               << "C: A000002 SELECT \"INBOX\" (QRESYNC (3857529045 700))"
+                               << "S: * ENABLED QRESYNC"
+                               << "S: A000001 OK ENABLE completed"
+                               << "S: * 17 EXISTS"
+                               << "S: * OK [UIDVALIDITY 3857529045] UIDs valid"
+                               << "S: * OK [UIDNEXT 23] Predicted next UID"
+                               << "S: * OK [HIGHESTMODSEQ 715] Highest"
+                               << "S: * VANISHED (EARLIER) 3:4,11:14,16"
+                               << "S: * 3 FETCH (UID 5 FLAGS (\\Seen) MODSEQ (710))"
+                               << "S: * 17 FETCH (UID 22 FLAGS () MODSEQ (715))"
+                               << "S: A000002 OK [READ-WRITE] mailbox selected");
+        fakeServer.startAndWait();
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        MailboxSyncJob *job = new MailboxSyncJob(&session);
+        job->setMailBox(QStringLiteral("INBOX"));
+        job->setPreviousState(previousState());
+        Recorder recorder;
+        record(job, &recorder);
+        QVERIFY(job->exec());
+
+        QCOMPARE(job->strategy(), MailboxSyncJob::QResync);
+        QVERIFY(!job->uidValidityChanged());
+        QCOMPARE(recorder.newUids, QList<qint64>() << 22);
+        QCOMPARE(recorder.changedUids, QList<qint64>() << 5);
+        QCOMPARE(recorder.vanished, QList<QByteArray>() << "3:4,16");
+        QCOMPARE(job->state().uidValidity, qint64(3857529045));
+        QCOMPARE(job->state().nextUid, qint64(23));
+        QCOMPARE(job->state().highestModSequence, quint64(715));
+        QCOMPARE(job->state().uids.toImapSequenceSet(), QByteArray("1:2,5:10,15,17:20,22"));
+        QCOMPARE(session.selectedMailBox(), QStringLiteral("INBOX"));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testCondStore()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 CONDSTORE ESEARCH] localhost Test Library server ready"
+                               << "C: A000001 SELECT \"INBOX\" (CONDSTORE)"
+                               << "C: A000002 UID SEARCH RETURN (ALL) UID 1:20"
+                               << "C: A000003 UID FETCH 1:* (UID FLAGS) (CHANGEDSINCE 700)"
+                               << "S: * OK [UIDVALIDITY 3857529045] UIDs valid"
+                               << "S: * OK [UIDNEXT 23] Predicted next UID"
+                               << "S: * OK [HIGHESTMODSEQ 715] Highest"
+                               << "S: A000001 OK [READ-WRITE] mailbox selected"
+                               << "S: * ESEARCH (TAG \"A000002\") UID ALL 1:9,15:20"
+                               << "S: A000002 OK search done"
+                               << "S: * 3 FETCH (UID 5 FLAGS (\\Seen) MODSEQ (710))"
+                               << "S: * 16 FETCH (UID 21 FLAGS () MODSEQ (712))"
+                               << "S: * 17 FETCH (UID 22 FLAGS () MODSEQ (715))"
+                               << "S: A000003 OK fetch done");
+        fakeServer.startAndWait();
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        MailboxSyncJob *job = new MailboxSyncJob(&session);
+        job->setMailBox(QStringLiteral("INBOX"));
+        job->setPreviousState(previousState());
+        job->setBatchSize(2);
+        Recorder recorder;
+        record(job, &recorder);
+        QVERIFY(job->exec());
+
+        QCOMPARE(job->strategy(), MailboxSyncJob::CondStore);
+        QCOMPARE(recorder.newUids, QList<qint64>() << 21 << 22);
+        QCOMPARE(recorder.changedUids, QList<qint64>() << 5);
+        QCOMPARE(recorder.batches, 2);
+        QCOMPARE(recorder.vanished, QList<QByteArray>() << "10");
+        QCOMPARE(job->state().highestModSequence, quint64(715));
+        QCOMPARE(job->state().uids.toImapSequenceSet(), QByteArray("1:9,15:22"));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testFull()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 SELECT \"INBOX\""
+                               << "C: A000002 UID FETCH 1:* (UID FLAGS)"
+                               << "S: * 3 EXISTS"
+                               << "S: * OK [UIDVALIDITY 3857529045] UIDs valid"
+                               << "S: * OK [UIDNEXT 23] Predicted next UID"
+                               << "S: A000001 OK [READ-WRITE] mailbox selected"
+                               << "S: * 1 FETCH (UID 2 FLAGS (\\Seen))"
+                               << "S: * 2 FETCH (UID 15 FLAGS ())"
+                               << "S: * 3 FETCH (UID 22 FLAGS ())"
+                               << "S: A000002 OK fetch done");
+        fakeServer.startAndWait();
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        MailboxSyncJob *job = new MailboxSyncJob(&session);
+        job->setMailBox(QStringLiteral("INBOX"));
+        job->setPreviousState(previousState());
+        Recorder recorder;
+        record(job, &recorder);
+        QVERIFY(job->exec());
+
+        QCOMPARE(job->strategy(), MailboxSyncJob::Full);
+        QCOMPARE(recorder.newUids, QList<qint64>() << 22);
+        QCOMPARE(recorder.changedUids, QList<qint64>() << 2 << 15);
+        QCOMPARE(recorder.vanished, QList<QByteArray>() << "1,3:10,16:20");
+        QCOMPARE(job->state().highestModSequence, quint64(0));
+        QCOMPARE(job->state().uids.toImapSequenceSet(), QByteArray("2,15,22"));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testUidValidityChanged()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 CONDSTORE] localhost Test Library server ready"
+                               << "C: A000001 SELECT \"INBOX\" (CONDSTORE)"
+                               << "C: A000002 UID SEARCH UID 1:20"
+                               << "C: A000003 UID FETCH 1:* (UID FLAGS) (CHANGEDSINCE 700)"
+                               << "S: * OK [UIDVALIDITY 1] UIDs valid"
+                               << "S: * OK [UIDNEXT 3] Predicted next UID"
+                               << "S: * OK [HIGHESTMODSEQ 5] Highest"
+                               << "S: A000001 OK [READ-WRITE] mailbox selected"
+                               << "S: * SEARCH 1 2"
+                               << "S: A000002 OK search done"
+                               << "S: A000003 OK fetch done"
+                               << "C: A000004 UID FETCH 1:* (UID FLAGS MODSEQ)"
+                               << "S: * 1 FETCH (UID 1 FLAGS () MODSEQ (4))"
+                               << "S: * 2 FETCH (UID 2 FLAGS () MODSEQ (5))"
+                               << "S: A000004 OK fetch done");
+        fakeServer.startAndWait();
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        MailboxSyncJob *job = new MailboxSyncJob(&session);
+        job->setMailBox(QStringLiteral("INBOX"));
+        job->setPreviousState(previousState());
+        Recorder recorder;
+        record(job, &recorder);
+        QVERIFY(job->exec());
+
+        QVERIFY(job->uidValidityChanged());
+        QCOMPARE(recorder.vanished, QList<QByteArray>() << "1:10,15:20");
+        QCOMPARE(recorder.newUids, QList<qint64>() << 1 << 2);
+        QVERIFY(recorder.changedUids.isEmpty());
+        QCOMPARE(job->state().uidValidity, qint64(1));
+        QCOMPARE(job->state().uids.toImapSequenceSet(), QByteArray("1:2"));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+};
+
+QTEST_GUILESS_MAIN(MailboxSyncJobTest)
+
+#include "mailboxsyncjobtest.moc"
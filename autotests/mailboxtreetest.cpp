@@ -0,0 +1,170 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+#include <qtest.h>
+
+#include "kimap2test/fakeserver.h"
+#include "kimap2/mailboxtree.h"
+#include "kimap2/session.h"
+
+#include <QtTest>
+
+using namespace KIMAP2;
+
+class MailBoxTreeTest: public QObject
+{
+    Q_OBJECT
+
+private:
+    static QStringList names(const QList<MailBoxTree::Node> &nodes)
+    {
+        QStringList names;
+        for (const MailBoxTree::Node &node : nodes) {
+            names << node.descriptor.name;
+        }
+        return names;
+    }
+
+private Q_SLOTS:
+
+    void testLoadsLevelsOnDemand()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 LIST-EXTENDED] localhost Test Library server ready"
+                               << "C: A000001 LIST \"\" % RETURN (CHILDREN)"
+                               << "S: * LIST (\\HasChildren) \"/\" \"INBOX\""
+                               << "S: * LIST (\\HasNoChildren) \"/\" \"Trash\""
+                               << "S: * LIST (\\Noselect \\HasChildren) \"/\" \"Shared\""
+                               << "S: A000001 OK list done"
+                               << "C: A000002 LIST \"\" \"Shared/%\" RETURN (CHILDREN)"
+                               << "S: * LIST (\\HasNoChildren) \"/\" \"Shared/Team\""
+                               << "S: * LIST (\\HasChildren) \"/\" \"Shared/Projects\""
+                               << "S: A000002 OK list done"
+                               //After the invalidation
+                               << "C: A000003 LIST \"\" \"Shared/%\" RETURN (CHILDREN)"
+                               << "S: * LIST (\\HasNoChildren) \"/\" \"Shared/Team\""
+                               << "S: A000003 OK list done");
+        fakeServer.startAndWait();
+
+        Session session(QStringLiteral("127.0.0.1"), 5989);
+        MailBoxTree tree(&session);
+        QSignalSpy spy(&tree, &MailBoxTree::childrenReceived);
+
+        tree.requestChildren();
+        QTRY_COMPARE(spy.count(), 1);
+        QCOMPARE(spy.at(0).at(0).toString(), QString());
+        QCOMPARE(names(spy.at(0).at(1).value<QList<MailBoxTree::Node> >()),
+                 QStringList() << QStringLiteral("INBOX") << QStringLiteral("Trash") << QStringLiteral("Shared"));
+        QVERIFY(tree.isLoaded());
+        QVERIFY(!tree.isLoaded(QStringLiteral("Shared")));
+        QVERIFY(!tree.node(QStringLiteral("Shared")).isSelectable());
+        QVERIFY(tree.node(QStringLiteral("INBOX")).isSelectable());
+
+        //Known to have no children, answered without a LIST
+        tree.requestChildren(QStringLiteral("Trash"));
+        QCOMPARE(spy.count(), 2);
+        QVERIFY(tree.children(QStringLiteral("Trash")).isEmpty());
+
+        //The second request waits for the LIST of the first
+        tree.requestChildren(QStringLiteral("Shared"));
+        tree.requestChildren(QStringLiteral("Shared"));
+        QTRY_COMPARE(spy.count(), 3);
+        QCOMPARE(spy.at(2).at(0).toString(), QStringLiteral("Shared"));
+        QCOMPARE(names(tree.children(QStringLiteral("Shared"))),
+                 QStringList() << QStringLiteral("Shared/Team") << QStringLiteral("Shared/Projects"));
+        QVERIFY(tree.node(QStringLiteral("Shared/Projects")).hasChildren());
+
+        //Cached
+        tree.requestChildren(QStringLiteral("Shared"));
+        QCOMPARE(spy.count(), 4);
+
+        tree.invalidate(QStringLiteral("Shared"));
+        QVERIFY(tree.isLoaded());
+        QVERIFY(!tree.isLoaded(QStringLiteral("Shared")));
+        QVERIFY(tree.node(QStringLiteral("Shared/Team")).descriptor.name.isEmpty());
+        tree.requestChildren(QStringLiteral("Shared"));
+        QTRY_COMPARE(spy.count(), 5);
+        QCOMPARE(names(tree.children(QStringLiteral("Shared"))), QStringList() << QStringLiteral("Shared/Team"));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testRelistsInvalidatedLevel()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 LIST \"\" %"
+                               << "S: * LIST () \"/\" \"Old\""
+                               << "S: A000001 OK list done"
+                               << "C: A000002 LIST \"\" %"
+                               << "S: * LIST () \"/\" \"New\""
+                               << "S: A000002 OK list done");
+        fakeServer.startAndWait();
+
+        Session session(QStringLiteral("127.0.0.1"), 5989);
+        MailBoxTree tree(&session);
+        QSignalSpy spy(&tree, &MailBoxTree::childrenReceived);
+
+        tree.requestChildren();
+        tree.invalidate();
+        tree.requestChildren();
+        QTRY_COMPARE(spy.count(), 1);
+        QCOMPARE(names(spy.at(0).at(1).value<QList<MailBoxTree::Node> >()), QStringList() << QStringLiteral("New"));
+        QCOMPARE(names(tree.children()), QStringList() << QStringLiteral("New"));
+        QVERIFY(tree.node(QStringLiteral("Old")).descriptor.name.isEmpty());
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testRequestFailed()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 LIST \"\" %"
+                               << "S: A000001 NO list failed"
+                               << "C: A000002 LIST \"\" %"
+                               << "S: * LIST () \".\" \"INBOX\""
+                               << "S: A000002 OK list done");
+        fakeServer.startAndWait();
+
+        Session session(QStringLiteral("127.0.0.1"), 5989);
+        MailBoxTree tree(&session);
+        QSignalSpy failedSpy(&tree, &MailBoxTree::requestFailed);
+        QSignalSpy spy(&tree, &MailBoxTree::childrenReceived);
+
+        tree.requestChildren();
+        QTRY_COMPARE(failedSpy.count(), 1);
+        QVERIFY(!tree.isLoaded());
+
+        tree.requestChildren();
+        QTRY_COMPARE(spy.count(), 1);
+        //Without CHILDREN the server may have some
+        QVERIFY(tree.node(QStringLiteral("INBOX")).hasChildren());
+        QCOMPARE(tree.node(QStringLiteral("INBOX")).descriptor.separator, QLatin1Char('.'));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+};
+
+QTEST_GUILESS_MAIN(MailBoxTreeTest)
+
+#include "mailboxtreetest.moc"
@@ -0,0 +1,168 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#include <qtest.h>
+
+#include "kimap2/messagecache.h"
+
+#include <QtTest>
+#include <QTemporaryDir>
+
+using KIMAP2::MessageCache;
+
+class MessageCacheTest: public QObject
+{
+    Q_OBJECT
+
+private:
+    static MessageCache::Entry message(qint64 uid)
+    {
+        MessageCache::Entry entry;
+        entry.uid = uid;
+        entry.size = 1000 + uid;
+        entry.internalDate = 1476000000 + uid;
+        entry.modSeq = 100 + uid;
+        entry.flags << "\\Seen";
+        entry.header = "Subject: Message " + QByteArray::number(uid) + "\r\n";
+        return entry;
+    }
+
+private Q_SLOTS:
+    void testPersistence()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString fileName = dir.path() + QStringLiteral("/INBOX");
+
+        {
+            MessageCache cache(fileName);
+            QVERIFY(cache.open(42));
+            for (qint64 uid = 1; uid <= 5; ++uid) {
+                QVERIFY(cache.insert(message(uid)));
+            }
+            QVERIFY(cache.updateFlags(2, KIMAP2::MessageFlags() << "\\Seen" << "\\Flagged", 200));
+            QVERIFY(cache.updateFlags(9, KIMAP2::MessageFlags(), 201));
+            QVERIFY(cache.remove(KIMAP2::ImapSet::fromImapSequenceSet("3:4")));
+            QCOMPARE(cache.entry(2).flags, KIMAP2::MessageFlags() << "\\Seen" << "\\Flagged");
+        }
+
+        MessageCache cache(fileName);
+        QVERIFY(cache.open(42));
+        QCOMPARE(cache.count(), 3);
+        QCOMPARE(cache.uids().toImapSequenceSet(), QByteArray("1:2,5"));
+        QVERIFY(!cache.contains(3));
+        QVERIFY(!cache.contains(9));
+        QCOMPARE(cache.entry(4).uid, qint64(0));
+
+        const MessageCache::Entry first = cache.entry(1);
+        QCOMPARE(first.uid, qint64(1));
+        QCOMPARE(first.size, qint64(1001));
+        QCOMPARE(first.internalDate, qint64(1476000001));
+        QCOMPARE(first.modSeq, quint64(101));
+        QCOMPARE(first.flags, KIMAP2::MessageFlags() << "\\Seen");
+        QCOMPARE(first.header, QByteArray("Subject: Message 1\r\n"));
+
+        const MessageCache::Entry second = cache.entry(2);
+        QCOMPARE(second.modSeq, quint64(200));
+        QCOMPARE(second.flags, KIMAP2::MessageFlags() << "\\Seen" << "\\Flagged");
+        QCOMPARE(second.header, QByteArray("Subject: Message 2\r\n"));
+
+        // Written after opening, so only in the file beyond the mapping
+        QVERIFY(cache.insert(message(6)));
+        QCOMPARE(cache.entry(6).header, QByteArray("Subject: Message 6\r\n"));
+
+        const qint64 size = QFileInfo(fileName).size();
+        QVERIFY(cache.compact());
+        QVERIFY(QFileInfo(fileName).size() < size);
+        QCOMPARE(cache.uids().toImapSequenceSet(), QByteArray("1:2,5:6"));
+        QCOMPARE(cache.entry(2).flags, KIMAP2::MessageFlags() << "\\Seen" << "\\Flagged");
+        QCOMPARE(cache.entry(5).header, QByteArray("Subject: Message 5\r\n"));
+    }
+
+    void testRemoveOpenRange()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString fileName = dir.path() + QStringLiteral("/INBOX");
+
+        {
+            MessageCache cache(fileName);
+            QVERIFY(cache.open(42));
+            for (qint64 uid = 1; uid <= 5; ++uid) {
+                QVERIFY(cache.insert(message(uid)));
+            }
+            //Everything from 4 on, however few messages the cache has
+            QVERIFY(cache.remove(KIMAP2::ImapSet::fromImapSequenceSet("4:*")));
+            QCOMPARE(cache.uids().toImapSequenceSet(), QByteArray("1:3"));
+        }
+
+        MessageCache cache(fileName);
+        QVERIFY(cache.open(42));
+        QCOMPARE(cache.uids().toImapSequenceSet(), QByteArray("1:3"));
+    }
+
+    void testUidValidityChange()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString fileName = dir.path() + QStringLiteral("/INBOX");
+
+        {
+            MessageCache cache(fileName);
+            QVERIFY(cache.open(42));
+            QVERIFY(cache.insert(message(1)));
+        }
+
+        MessageCache cache(fileName);
+        QVERIFY(cache.open(43));
+        QCOMPARE(cache.uidValidity(), qint64(43));
+        QCOMPARE(cache.count(), 0);
+        QVERIFY(cache.insert(message(7)));
+        cache.close();
+        QVERIFY(cache.open(43));
+        QCOMPARE(cache.uids().toImapSequenceSet(), QByteArray("7"));
+    }
+
+    void testTruncatedRecord()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString fileName = dir.path() + QStringLiteral("/INBOX");
+
+        qint64 complete;
+        {
+            MessageCache cache(fileName);
+            QVERIFY(cache.open(42));
+            QVERIFY(cache.insert(message(1)));
+            complete = QFileInfo(fileName).size();
+            QVERIFY(cache.insert(message(2)));
+        }
+        QFile file(fileName);
+        QVERIFY(file.resize(complete + 10));
+
+        MessageCache cache(fileName);
+        QVERIFY(cache.open(42));
+        QCOMPARE(cache.uids().toImapSequenceSet(), QByteArray("1"));
+        QCOMPARE(QFileInfo(fileName).size(), complete);
+        QVERIFY(cache.insert(message(3)));
+        QCOMPARE(cache.entry(3).size, qint64(1003));
+    }
+};
+
+QTEST_GUILESS_MAIN(MessageCacheTest)
+
+#include "messagecachetest.moc"
@@ -83,6 +83,43 @@ private Q_SLOTS:
         fakeServer.quit();
     }
 
+    void testMoveInChunks()
+    {
+        QList<QByteArray> scenario;
+        scenario << FakeServer::preauth()
+                 << "C: A000001 UID MOVE 1,3,5 \"foo\""
+                 << "C: A000002 UID MOVE 7:9 \"foo\""
+                 << "S: * OK [COPYUID 12345 1,3,5 20:22]\r\n"
+                    "A000001 OK MOVE completed\r\n"
+                    "* OK [COPYUID 12345 7:9 23:25]\r\n"
+                    "A000002 OK MOVE completed";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        auto job = new KIMAP2::MoveJob(&session);
+        job->setMailBox(QStringLiteral("foo"));
+        job->setUidBased(true);
+        job->setSequenceSet(KIMAP2::ImapSet::fromImapSequenceSet("7:9,1,3,5"));
+        job->setMaximumSetLength(5);
+        QVERIFY(job->exec());
+        QCOMPARE(job->resultingUids().toImapSequenceSet(), QByteArray("20:22,23:25"));
+        QCOMPARE(job->sourceUids().toImapSequenceSet(), QByteArray("1,3,5,7:9"));
+        QCOMPARE(job->resultingUid(1), qint64(20));
+        QCOMPARE(job->resultingUid(3), qint64(21));
+        QCOMPARE(job->resultingUid(5), qint64(22));
+        QCOMPARE(job->resultingUid(8), qint64(24));
+        QCOMPARE(job->resultingUid(9), qint64(25));
+        QCOMPARE(job->uidValidity(), qint64(12345));
+        QCOMPARE(job->resultingUid(2), qint64(0));
+        QCOMPARE(job->resultingUid(10), qint64(0));
+
+        fakeServer.quit();
+    }
+
 };
 
 QTEST_GUILESS_MAIN(MoveJobTest)
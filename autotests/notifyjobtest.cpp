@@ -0,0 +1,159 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+#include <qtest.h>
+
+#include "kimap2test/fakeserver.h"
+#include "kimap2/session.h"
+#include "kimap2/notifyjob.h"
+
+#include <QtTest>
+
+class NotifyJobTest: public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testEvents()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 IDLE NOTIFY] localhost Test Library server ready"
+                               << "C: A000001 NOTIFY SET (SELECTED (MessageNew MessageExpunge FlagChange)) (SUBTREE (\"INBOX\" \"Lists\") (MessageNew MessageExpunge MailboxName)) (MAILBOXES (\"Archive\") (MessageNew MessageExpunge))"
+                               << "S: A000001 OK NOTIFY completed"
+                               << "C: A000002 IDLE"
+                               << "S: + idling"
+                               << "S: * 5 EXISTS"
+                               << "S: * 3 EXPUNGE"
+                               << "S: * 2 FETCH (UID 17 FLAGS (\\Seen $Forwarded))"
+                               << "S: * STATUS \"Lists/KDE\" (MESSAGES 12 UIDNEXT 4392)"
+                               << "S: * LIST () \"/\" \"Lists/Qt\""
+                               << "S: * LIST (\\NonExistent) \"/\" \"Lists/Old\""
+                               << "S: * LIST () \"/\" \"Lists/New\" (\"OLDNAME\" (\"Lists/Renamed\"))"
+                               << "S: A000002 OK done idling");
+        fakeServer.startAndWait();
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        KIMAP2::NotifyJob *job = new KIMAP2::NotifyJob(&session);
+        job->setSelectedEvents(KIMAP2::NotifyJob::MessageNew | KIMAP2::NotifyJob::MessageExpunge | KIMAP2::NotifyJob::FlagChange);
+        job->addSubtree(QStringList() << QStringLiteral("INBOX") << QStringLiteral("Lists"),
+                        KIMAP2::NotifyJob::MessageNew | KIMAP2::NotifyJob::MessageExpunge | KIMAP2::NotifyJob::MailBoxName);
+        job->addMailBoxes(QStringList() << QStringLiteral("Archive"), KIMAP2::NotifyJob::MessageNew | KIMAP2::NotifyJob::MessageExpunge);
+
+        QSignalSpy countSpy(job, &KIMAP2::NotifyJob::selectedMessageCountChanged);
+        QSignalSpy expungeSpy(job, &KIMAP2::NotifyJob::selectedMessageExpunged);
+        QSignalSpy flagsSpy(job, &KIMAP2::NotifyJob::selectedMessageFlagsChanged);
+        QSignalSpy statusSpy(job, &KIMAP2::NotifyJob::mailBoxStatusChanged);
+        QSignalSpy createdSpy(job, &KIMAP2::NotifyJob::mailBoxCreated);
+        QSignalSpy deletedSpy(job, &KIMAP2::NotifyJob::mailBoxDeleted);
+        QSignalSpy renamedSpy(job, &KIMAP2::NotifyJob::mailBoxRenamed);
+        QVERIFY(job->exec());
+
+        QCOMPARE(countSpy.count(), 1);
+        QCOMPARE(countSpy.at(0).at(1).toLongLong(), qint64(5));
+        QCOMPARE(expungeSpy.count(), 1);
+        QCOMPARE(expungeSpy.at(0).at(1).toLongLong(), qint64(3));
+        QCOMPARE(flagsSpy.count(), 1);
+        QCOMPARE(flagsSpy.at(0).at(1).toLongLong(), qint64(2));
+        QCOMPARE(flagsSpy.at(0).at(2).toLongLong(), qint64(17));
+        QCOMPARE(flagsSpy.at(0).at(3).value<QList<QByteArray> >(), QList<QByteArray>() << "\\Seen" << "$Forwarded");
+        QCOMPARE(statusSpy.count(), 1);
+        QCOMPARE(statusSpy.at(0).at(1).toString(), QStringLiteral("Lists/KDE"));
+        const QList<QPair<QByteArray, qint64> > status = statusSpy.at(0).at(2).value<QList<QPair<QByteArray, qint64> > >();
+        QCOMPARE(status, QList<QPair<QByteArray, qint64> >() << qMakePair(QByteArray("MESSAGES"), qint64(12)) << qMakePair(QByteArray("UIDNEXT"), qint64(4392)));
+        QCOMPARE(createdSpy.count(), 1);
+        QCOMPARE(createdSpy.at(0).at(1).toString(), QStringLiteral("Lists/Qt"));
+        QCOMPARE(deletedSpy.count(), 1);
+        QCOMPARE(deletedSpy.at(0).at(1).toString(), QStringLiteral("Lists/Old"));
+        QCOMPARE(renamedSpy.count(), 1);
+        QCOMPARE(renamedSpy.at(0).at(1).toString(), QStringLiteral("Lists/Renamed"));
+        QCOMPARE(renamedSpy.at(0).at(2).toString(), QStringLiteral("Lists/New"));
+
+        fakeServer.quit();
+    }
+
+    void testStop()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 IDLE NOTIFY] localhost Test Library server ready"
+                               << "C: A000001 NOTIFY SET (SUBTREE (\"INBOX\") (MessageNew MessageExpunge))"
+                               << "S: A000001 OK NOTIFY completed"
+                               << "C: A000002 IDLE"
+                               << "S: + idling"
+                               << "S: * STATUS \"INBOX\" (MESSAGES 3 UIDNEXT 8)"
+                               << "C: DONE"
+                               << "S: A000002 OK done idling");
+        fakeServer.startAndWait();
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        const int originalTimeout = session.timeout();
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        KIMAP2::NotifyJob *job = new KIMAP2::NotifyJob(&session);
+        job->addSubtree(QStringList() << QStringLiteral("INBOX"), KIMAP2::NotifyJob::MessageNew | KIMAP2::NotifyJob::MessageExpunge);
+        connect(job, &KIMAP2::NotifyJob::mailBoxStatusChanged, job, &KIMAP2::NotifyJob::stop);
+        QVERIFY(job->exec());
+        QCOMPARE(session.timeout(), originalTimeout);
+
+        fakeServer.quit();
+    }
+
+    void testPollsWithoutIdle()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 NOTIFY] localhost Test Library server ready"
+                               << "C: A000001 NOTIFY SET (SUBTREE (\"INBOX\") (MessageNew MessageExpunge))"
+                               << "S: A000001 OK NOTIFY completed"
+                               << "C: A000002 NOOP"
+                               << "S: * STATUS \"INBOX\" (MESSAGES 3 UIDNEXT 8)"
+                               << "S: A000002 OK NOOP completed");
+        fakeServer.startAndWait();
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        KIMAP2::NotifyJob *job = new KIMAP2::NotifyJob(&session);
+        job->addSubtree(QStringList() << QStringLiteral("INBOX"), KIMAP2::NotifyJob::MessageNew | KIMAP2::NotifyJob::MessageExpunge);
+        job->setPollInterval(1);
+        QSignalSpy spy(job, &KIMAP2::NotifyJob::mailBoxStatusChanged);
+        connect(job, &KIMAP2::NotifyJob::mailBoxStatusChanged, job, &KIMAP2::NotifyJob::stop);
+        QVERIFY(job->exec());
+        QCOMPARE(spy.count(), 1);
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testUnsupported()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth());
+        fakeServer.startAndWait();
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::NotifyJob *job = new KIMAP2::NotifyJob(&session);
+        job->addSubtree(QStringList() << QStringLiteral("INBOX"), KIMAP2::NotifyJob::MessageNew | KIMAP2::NotifyJob::MessageExpunge);
+        QVERIFY(!job->exec());
+
+        fakeServer.quit();
+    }
+};
+
+QTEST_GUILESS_MAIN(NotifyJobTest)
+
+#include "notifyjobtest.moc"
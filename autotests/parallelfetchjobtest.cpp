@@ -0,0 +1,146 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#include <qtest.h>
+
+#include "kimap2test/loadserver.h"
+#include "kimap2/bandwidthlimiter.h"
+#include "kimap2/parallelfetchjob.h"
+#include "kimap2/session.h"
+#include "kimap2/sessionpool.h"
+
+#include <QtTest>
+
+#include <algorithm>
+
+using namespace KIMAP2;
+
+class ParallelFetchJobTest: public QObject
+{
+    Q_OBJECT
+
+private:
+    static QVector<qint64> fetch(ParallelFetchJob *job, bool *ok)
+    {
+        FetchJob::FetchScope scope;
+        scope.mode = FetchJob::FetchScope::Flags;
+        job->setMailBox(QStringLiteral("INBOX"));
+        job->setScope(scope);
+        QVector<qint64> uids;
+        connect(job, &ParallelFetchJob::resultReceived, [&uids](const FetchJob::Result &result) {
+            uids << result.uid;
+        });
+        *ok = job->exec();
+        return uids;
+    }
+
+private Q_SLOTS:
+    void testOrdered()
+    {
+        LoadServer::Options options;
+        options.port = 0;
+        options.messages = 200;
+        LoadServer server(options);
+        QVERIFY(server.startAndWait());
+
+        SessionPool pool(QStringLiteral("127.0.0.1"), server.port(), SessionPool::SessionSetup());
+        ParallelFetchJob *job = new ParallelFetchJob(&pool);
+        job->setSessionCount(3);
+        job->setChunkSize(20);
+        job->setOrdered(true);
+        bool ok = false;
+        const QVector<qint64> uids = fetch(job, &ok);
+        QVERIFY(ok);
+
+        QCOMPARE(uids.size(), 200);
+        for (int i = 1; i < uids.size(); ++i) {
+            QVERIFY(uids.at(i - 1) < uids.at(i));
+        }
+        QCOMPARE(pool.sessions().size(), 3);
+        QCOMPARE(server.connectionCount(), 3);
+    }
+
+    void testGivenUids()
+    {
+        LoadServer::Options options;
+        options.port = 0;
+        options.messages = 100;
+        LoadServer server(options);
+        QVERIFY(server.startAndWait());
+
+        SessionPool pool(QStringLiteral("127.0.0.1"), server.port(), SessionPool::SessionSetup());
+        ParallelFetchJob *job = new ParallelFetchJob(&pool);
+        job->setSessionCount(2);
+        job->setChunkSize(10);
+        job->setUids(ImapSet(1, 50));
+        bool ok = false;
+        QVector<qint64> uids = fetch(job, &ok);
+        QVERIFY(ok);
+
+        QCOMPARE(uids.size(), 50);
+        std::sort(uids.begin(), uids.end());
+        QVERIFY(std::adjacent_find(uids.begin(), uids.end()) == uids.end());
+        QCOMPARE(uids.first(), qint64(1));
+        QCOMPARE(uids.last(), qint64(50));
+    }
+
+    void testRebalancing()
+    {
+        LoadServer::Options options;
+        options.port = 0;
+        options.messages = 300;
+        options.latency = 5;
+        LoadServer server(options);
+        QVERIFY(server.startAndWait());
+
+        //The first session reads slowly, so it still has most of its chunk left when the others are done
+        BandwidthLimiter limiter;
+        limiter.setRate(BandwidthLimiter::Download, BandwidthLimiter::Interactive, 500, 100);
+        int sessions = 0;
+        SessionPool pool(QStringLiteral("127.0.0.1"), server.port(), [&limiter, &sessions](Session *session) {
+            if (sessions++ == 0) {
+                session->setBandwidthLimiter(&limiter);
+            }
+        });
+        ParallelFetchJob *job = new ParallelFetchJob(&pool);
+        job->setSessionCount(3);
+        job->setChunkSize(100);
+        job->setRebalanceInterval(1);
+        job->setAutoDelete(false);
+        bool ok = false;
+        QVector<qint64> uids = fetch(job, &ok);
+        QVERIFY(ok);
+
+        QVERIFY(job->rebalanceCount() > 0);
+        delete job;
+        QCOMPARE(uids.size(), 300);
+        std::sort(uids.begin(), uids.end());
+        QVERIFY(std::adjacent_find(uids.begin(), uids.end()) == uids.end());
+    }
+
+    void testNoMailBox()
+    {
+        SessionPool pool(QStringLiteral("127.0.0.1"), 5989, SessionPool::SessionSetup());
+        ParallelFetchJob *job = new ParallelFetchJob(&pool);
+        QVERIFY(!job->exec());
+        QVERIFY(pool.sessions().isEmpty());
+    }
+};
+
+QTEST_GUILESS_MAIN(ParallelFetchJobTest)
+
+#include "parallelfetchjobtest.moc"
@@ -0,0 +1,130 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#include <qtest.h>
+
+#include "kimap2test/fakeserver.h"
+#include "kimap2/session.h"
+#include "kimap2/selectjob.h"
+#include "kimap2/prefetchscheduler.h"
+
+#include <QtTest>
+
+class PrefetchSchedulerTest: public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testRankedChunks()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 SELECT \"INBOX\""
+                               << "S: A000001 OK selected"
+                               << "C: A000002 UID FETCH 10:11 (FLAGS UID)"
+                               << "S: * 5 FETCH (UID 10 FLAGS ())"
+                               << "S: * 6 FETCH (UID 11 FLAGS ())"
+                               << "S: A000002 OK fetch done"
+                               << "C: A000003 UID FETCH 1:2 (FLAGS UID)"
+                               << "S: * 1 FETCH (UID 1 FLAGS ())"
+                               << "S: * 2 FETCH (UID 2 FLAGS ())"
+                               << "S: A000003 OK fetch done"
+                               << "C: A000004 UID FETCH 3 (FLAGS UID)"
+                               << "S: * 3 FETCH (UID 3 FLAGS ())"
+                               << "S: A000004 OK fetch done");
+        fakeServer.startAndWait();
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::SelectJob *select = new KIMAP2::SelectJob(&session);
+        select->setMailBox(QStringLiteral("INBOX"));
+        QVERIFY(select->exec());
+
+        KIMAP2::FetchJob::FetchScope scope;
+        scope.mode = KIMAP2::FetchJob::FetchScope::Flags;
+        KIMAP2::PrefetchScheduler scheduler(&session);
+        scheduler.setChunkSize(2);
+        scheduler.addRange(QStringLiteral("INBOX"), KIMAP2::ImapSet(1, 3), scope, 1);
+        scheduler.addRange(QStringLiteral("INBOX"), KIMAP2::ImapSet(10, 11), scope, 0);
+        scheduler.addRange(QStringLiteral("Archive"), KIMAP2::ImapSet(7), scope, 0);
+
+        QList<qint64> uids;
+        connect(&scheduler, &KIMAP2::PrefetchScheduler::resultReceived, [&uids](const QString &mailBox, const KIMAP2::FetchJob::Result &result) {
+            QCOMPARE(mailBox, QStringLiteral("INBOX"));
+            uids << result.uid;
+        });
+        QSignalSpy finished(&scheduler, SIGNAL(runFinished()));
+        scheduler.start();
+        QTRY_COMPARE(finished.count(), 1);
+
+        QCOMPARE(uids, QList<qint64>() << 10 << 11 << 1 << 2 << 3);
+        QVERIFY(!scheduler.isRunning());
+        // The range of the mailbox that isn't selected is left
+        QVERIFY(!scheduler.isEmpty());
+        scheduler.clear(QStringLiteral("Archive"));
+        QVERIFY(scheduler.isEmpty());
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testByteBudget()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 SELECT \"INBOX\""
+                               << "S: A000001 OK selected"
+                               << "C: A000002 UID FETCH 1:2 (FLAGS UID)"
+                               << "S: * 1 FETCH (UID 1 FLAGS ())"
+                               << "S: * 2 FETCH (UID 2 FLAGS ())"
+                               << "S: A000002 OK fetch done"
+                               << "C: A000003 UID FETCH 3:4 (FLAGS UID)"
+                               << "S: * 3 FETCH (UID 3 FLAGS ())"
+                               << "S: * 4 FETCH (UID 4 FLAGS ())"
+                               << "S: A000003 OK fetch done");
+        fakeServer.startAndWait();
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::SelectJob *select = new KIMAP2::SelectJob(&session);
+        select->setMailBox(QStringLiteral("INBOX"));
+        QVERIFY(select->exec());
+
+        KIMAP2::FetchJob::FetchScope scope;
+        scope.mode = KIMAP2::FetchJob::FetchScope::Flags;
+        KIMAP2::PrefetchScheduler scheduler(&session);
+        scheduler.setChunkSize(2);
+        scheduler.setByteBudget(1);
+        scheduler.addRange(QStringLiteral("INBOX"), KIMAP2::ImapSet(1, 4), scope);
+
+        QSignalSpy finished(&scheduler, SIGNAL(runFinished()));
+        scheduler.start();
+        QTRY_COMPARE(finished.count(), 1);
+        QVERIFY(!scheduler.isEmpty());
+
+        scheduler.start();
+        QTRY_COMPARE(finished.count(), 2);
+        QVERIFY(scheduler.isEmpty());
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+};
+
+QTEST_GUILESS_MAIN(PrefetchSchedulerTest)
+
+#include "prefetchschedulertest.moc"
@@ -21,6 +21,9 @@
 #include "kimap2test/fakeserver.h"
 #include "kimap2/session.h"
 #include "kimap2/getquotarootjob.h"
+#include "kimap2/myrightsjob.h"
+#include "kimap2/setacljob.h"
+#include "kimap2/setquotajob.h"
 
 #include <QtTest>
 
@@ -179,6 +182,75 @@ private Q_SLOTS:
         fakeServer.quit();
     }
 
+    void testMailBoxInfoCache()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 GETQUOTAROOT \"INBOX\""
+                               << "S: * QUOTAROOT INBOX \"root1\""
+                               << "S: * QUOTA \"root1\" (STORAGE 10 512)"
+                               << "S: A000001 OK GETQUOTA completed"
+                               << "C: A000002 MYRIGHTS \"INBOX\""
+                               << "S: * MYRIGHTS \"INBOX\" lrswi"
+                               << "S: A000002 OK MYRIGHTS completed"
+                               << "C: A000003 SETQUOTA \"root1\" (STORAGE 1024)"
+                               << "S: A000003 OK SETQUOTA completed"
+                               << "C: A000004 GETQUOTAROOT \"INBOX\""
+                               << "S: * QUOTAROOT INBOX \"root1\""
+                               << "S: * QUOTA \"root1\" (STORAGE 10 1024)"
+                               << "S: A000004 OK GETQUOTA completed"
+                               << "C: A000005 SETACL \"INBOX\" \"fred\" \"lr\""
+                               << "S: A000005 OK SETACL completed"
+                               << "C: A000006 MYRIGHTS \"INBOX\""
+                               << "S: * MYRIGHTS \"INBOX\" lr"
+                               << "S: A000006 OK MYRIGHTS completed"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QCOMPARE(session.mailBoxInfoCacheTimeout(), 0);
+        session.setMailBoxInfoCacheTimeout(60);
+
+        // The second of each is answered without asking the server
+        for (int i = 0; i < 2; i++) {
+            auto quotaJob = new KIMAP2::GetQuotaRootJob(&session);
+            quotaJob->setMailBox(QStringLiteral("INBOX"));
+            QVERIFY(quotaJob->exec());
+            QCOMPARE(quotaJob->roots(), QList<QByteArray>() << "root1");
+            QCOMPARE(quotaJob->limit("root1", "STORAGE"), qint64(512));
+
+            auto rightsJob = new KIMAP2::MyRightsJob(&session);
+            rightsJob->setMailBox(QStringLiteral("INBOX"));
+            QVERIFY(rightsJob->exec());
+            QVERIFY(rightsJob->hasRightEnabled(KIMAP2::Acl::Insert));
+        }
+
+        auto setQuotaJob = new KIMAP2::SetQuotaJob(&session);
+        setQuotaJob->setRoot("root1");
+        setQuotaJob->setQuota("STORAGE", 1024);
+        QVERIFY(setQuotaJob->exec());
+
+        auto quotaJob = new KIMAP2::GetQuotaRootJob(&session);
+        quotaJob->setMailBox(QStringLiteral("INBOX"));
+        QVERIFY(quotaJob->exec());
+        QCOMPARE(quotaJob->limit("root1", "STORAGE"), qint64(1024));
+
+        auto setAclJob = new KIMAP2::SetAclJob(&session);
+        setAclJob->setMailBox(QStringLiteral("INBOX"));
+        setAclJob->setIdentifier("fred");
+        setAclJob->setRights(KIMAP2::AclJobBase::Change, KIMAP2::Acl::Lookup | KIMAP2::Acl::Read);
+        QVERIFY(setAclJob->exec());
+
+        auto rightsJob = new KIMAP2::MyRightsJob(&session);
+        rightsJob->setMailBox(QStringLiteral("INBOX"));
+        QVERIFY(rightsJob->exec());
+        QVERIFY(!rightsJob->hasRightEnabled(KIMAP2::Acl::Insert));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
 };
 
 QTEST_GUILESS_MAIN(QuotaRootJobTest)
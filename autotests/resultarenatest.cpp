@@ -0,0 +1,76 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+#include <qtest.h>
+
+#include "kimap2/resultarena.h"
+
+#include <QtTest>
+
+using namespace KIMAP2;
+
+class ResultArenaTest: public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+
+    void testCopy()
+    {
+        ResultArena arena(64);
+        const QByteArray first = arena.copy(QByteArray("hello"));
+        const QByteArray second = arena.copy("world", 5);
+        QCOMPARE(first, QByteArray("hello"));
+        QCOMPARE(second, QByteArray("world"));
+        QCOMPARE(first.constData()[first.size()], '\0');
+        QVERIFY(arena.contains(first.constData()));
+        QVERIFY(arena.contains(second.constData()));
+        QVERIFY(!arena.contains(QByteArray("hello").constData()));
+        QCOMPARE(arena.size(), qint64(10));
+        QCOMPARE(arena.capacity(), qint64(64));
+
+        QVERIFY(arena.copy(QByteArray()).isNull());
+        QVERIFY(!arena.copy(QByteArray("")).isNull());
+    }
+
+    void testBlocks()
+    {
+        ResultArena arena(64);
+        arena.copy(QByteArray(40, 'a'));
+        //Doesn't fit into what is left of the first block
+        arena.copy(QByteArray(40, 'b'));
+        QCOMPARE(arena.capacity(), qint64(128));
+
+        //Gets a block of its own, the small copies continue in the current one
+        const QByteArray large = arena.copy(QByteArray(1000, 'c'));
+        QCOMPARE(large, QByteArray(1000, 'c'));
+        QVERIFY(arena.capacity() >= 128 + 1001);
+        arena.copy(QByteArray(10, 'd'));
+        QVERIFY(arena.capacity() < 3 * 64 + 1000 + 16);
+
+        //Only the blocks of the regular size are kept
+        arena.reset();
+        QCOMPARE(arena.size(), qint64(0));
+        QCOMPARE(arena.capacity(), qint64(128));
+        arena.copy(QByteArray(40, 'e'));
+        arena.copy(QByteArray(40, 'f'));
+        QCOMPARE(arena.capacity(), qint64(128));
+    }
+};
+
+QTEST_GUILESS_MAIN(ResultArenaTest)
+
+#include "resultarenatest.moc"
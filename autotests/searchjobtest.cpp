@@ -20,9 +20,11 @@
 #include <qtest.h>
 
 #include "kimap2test/fakeserver.h"
+#include "kimap2/flagssnapshot.h"
 #include "kimap2/loginjob.h"
 #include "kimap2/session.h"
 #include "kimap2/searchjob.h"
+#include "kimap2/storejob.h"
 
 #include <QtTest>
 
@@ -88,6 +90,16 @@ private Q_SLOTS:
                                                KIMAP2::Term{QStringLiteral("Message-Id"), QStringLiteral("<gfedcba@mail.box>")}}};
             QTest::newRow("OR with multiple subterms") << scenario << true << 4 << term;
         }
+        {
+            QList<QByteArray> scenario;
+            scenario << FakeServer::preauth()
+                     << "C: A000001 UID SEARCH X-GM-RAW \"has:attachment subject:\\\"weekly report\\\"\" X-GM-THRID 1266894439832287888"
+                     << "S: * SEARCH 3 5"
+                     << "S: A000001 OK search done";
+            KIMAP2::Term term{KIMAP2::Term::And, {KIMAP2::Term{KIMAP2::Term::GmailRaw, QStringLiteral("has:attachment subject:\"weekly report\"")},
+                                                KIMAP2::Term{KIMAP2::Term::GmailThreadId, Q_INT64_C(1266894439832287888)}}};
+            QTest::newRow("gmail search") << scenario << true << 2 << term;
+        }
     }
 
     void testSearchTerm()
@@ -117,6 +129,340 @@ private Q_SLOTS:
         fakeServer.quit();
     }
 
+    void testTermCopies()
+    {
+        const KIMAP2::Term seen(KIMAP2::Term::Seen);
+        KIMAP2::Term notSeen = seen;
+        notSeen.setNegated(true);
+        QCOMPARE(seen.serialize(), QByteArray("SEEN"));
+        QCOMPARE(notSeen.serialize(), QByteArray("NOT SEEN"));
+        QVERIFY(!(seen == notSeen));
+
+        KIMAP2::Term null;
+        QVERIFY(null.isNull());
+        QVERIFY(KIMAP2::Term().isNull());
+        null = KIMAP2::Term(KIMAP2::Term::Or, QVector<KIMAP2::Term>() << seen << KIMAP2::Term(QStringLiteral("Subject"), QStringLiteral("foo")));
+        QVERIFY(!null.isNull());
+        QCOMPARE(null.serialize(), QByteArray("(OR SEEN HEADER Subject \"foo\")"));
+        QVERIFY(KIMAP2::Term().isNull());
+    }
+
+    void testESearch()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 ESEARCH] localhost Test Library server ready"
+                               << "C: A000001 UID SEARCH RETURN (MIN MAX COUNT ALL) NOT SEEN"
+                               << "S: * ESEARCH (TAG \"A000001\") UID MIN 2 MAX 900000 COUNT 5 ALL 2,10:11,899999:900000"
+                               << "S: A000001 OK search done");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QLatin1String("127.0.0.1"), 5989);
+
+        KIMAP2::SearchJob *job = new KIMAP2::SearchJob(&session);
+        job->setUidBased(true);
+        job->setTerm(KIMAP2::Term(KIMAP2::Term::Seen).setNegated(true));
+        job->setReturnOptions(KIMAP2::SearchJob::ReturnMin | KIMAP2::SearchJob::ReturnMax
+                              | KIMAP2::SearchJob::ReturnCount | KIMAP2::SearchJob::ReturnAll);
+        QVERIFY(job->exec());
+
+        QVERIFY(job->results().isEmpty());
+        QCOMPARE(job->minimumResult(), qint64(2));
+        QCOMPARE(job->maximumResult(), qint64(900000));
+        QCOMPARE(job->resultCount(), qint64(5));
+        QCOMPARE(job->resultSet().toImapSequenceSet(), QByteArray("2,10:11,899999:900000"));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testESearchFallback()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 SEARCH NOT SEEN"
+                               << "S: * SEARCH 4 2 3"
+                               << "S: A000001 OK search done");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QLatin1String("127.0.0.1"), 5989);
+
+        KIMAP2::SearchJob *job = new KIMAP2::SearchJob(&session);
+        job->setTerm(KIMAP2::Term(KIMAP2::Term::Seen).setNegated(true));
+        job->setReturnOptions(KIMAP2::SearchJob::ReturnCount);
+        QVERIFY(job->exec());
+
+        QCOMPARE(job->resultCount(), qint64(3));
+        QCOMPARE(job->minimumResult(), qint64(2));
+        QCOMPARE(job->maximumResult(), qint64(4));
+        QCOMPARE(job->resultSet().toImapSequenceSet(), QByteArray("2:4"));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testPartial()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 ESEARCH PARTIAL] localhost Test Library server ready"
+                               << "C: A000001 UID SEARCH RETURN (PARTIAL -1:-100 COUNT) ALL"
+                               << "S: * ESEARCH (TAG \"A000001\") UID COUNT 300000 PARTIAL (-1:-100 299901:300000)"
+                               << "S: A000001 OK search done"
+                               << "C: A000002 UID SEARCH RETURN (PARTIAL 301:400) ALL"
+                               << "S: * ESEARCH (TAG \"A000002\") UID PARTIAL (301:400 NIL)"
+                               << "S: A000002 OK search done");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QLatin1String("127.0.0.1"), 5989);
+
+        KIMAP2::SearchJob *job = new KIMAP2::SearchJob(&session);
+        job->setUidBased(true);
+        job->setTerm(KIMAP2::Term(KIMAP2::Term::All, QString()));
+        job->setPartial(-1, -100);
+        job->setReturnOptions(KIMAP2::SearchJob::ReturnCount | KIMAP2::SearchJob::ReturnAll);
+        QVERIFY(job->exec());
+        QCOMPARE(job->resultCount(), qint64(300000));
+        QCOMPARE(job->resultSet().toImapSequenceSet(), QByteArray("299901:300000"));
+
+        job = new KIMAP2::SearchJob(&session);
+        job->setUidBased(true);
+        job->setTerm(KIMAP2::Term(KIMAP2::Term::All, QString()));
+        job->setPartial(301, 400);
+        QVERIFY(job->exec());
+        QVERIFY(job->resultSet().isEmpty());
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testPartialFallback()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 SEARCH NOT SEEN"
+                               << "S: * SEARCH 4 2 3 9 7"
+                               << "S: A000001 OK search done");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QLatin1String("127.0.0.1"), 5989);
+
+        KIMAP2::SearchJob *job = new KIMAP2::SearchJob(&session);
+        job->setTerm(KIMAP2::Term(KIMAP2::Term::Seen).setNegated(true));
+        job->setPartial(-1, -2);
+        QVERIFY(job->exec());
+
+        QCOMPARE(job->results(), QVector<qint64>() << 7 << 9);
+        QCOMPARE(job->resultSet().toImapSequenceSet(), QByteArray("7,9"));
+        QCOMPARE(job->resultCount(), qint64(5));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testPartialFromEsearch()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 ESEARCH] localhost Test Library server ready"
+                               << "C: A000001 UID SEARCH RETURN (COUNT ALL) ALL"
+                               << "S: * ESEARCH (TAG \"A000001\") UID COUNT 5 ALL 2:4,9,7"
+                               << "S: A000001 OK search done");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QLatin1String("127.0.0.1"), 5989);
+
+        //Without PARTIAL the window is cut from all results
+        KIMAP2::SearchJob *job = new KIMAP2::SearchJob(&session);
+        job->setUidBased(true);
+        job->setTerm(KIMAP2::Term(KIMAP2::Term::All, QString()));
+        job->setPartial(-1, -2);
+        job->setReturnOptions(KIMAP2::SearchJob::ReturnCount);
+        QVERIFY(job->exec());
+        QCOMPARE(job->resultCount(), qint64(5));
+        QCOMPARE(job->resultSet().toImapSequenceSet(), QByteArray("7,9"));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testResultSet_data()
+    {
+        QTest::addColumn<QByteArray>("response");
+        QTest::addColumn<QByteArray>("set");
+        QTest::addColumn<QVector<qint64> >("results");
+
+        QTest::newRow("ordered") << QByteArray("S: * SEARCH 1 2 3 4 7 9 10")
+                                 << QByteArray("1:4,7,9:10")
+                                 << (QVector<qint64>() << 1 << 2 << 3 << 4 << 7 << 9 << 10);
+        QTest::newRow("unordered") << QByteArray("S: * SEARCH 9 10 1 2 5")
+                                   << QByteArray("1:2,5,9:10")
+                                   << (QVector<qint64>() << 9 << 10 << 1 << 2 << 5);
+        QTest::newRow("empty") << QByteArray("S: * SEARCH") << QByteArray() << QVector<qint64>();
+    }
+
+    void testResultSet()
+    {
+        QFETCH(QByteArray, response);
+        QFETCH(QByteArray, set);
+        QFETCH(QVector<qint64>, results);
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 UID SEARCH NOT SEEN"
+                               << response
+                               << "S: A000001 OK search done");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QLatin1String("127.0.0.1"), 5989);
+
+        KIMAP2::SearchJob *job = new KIMAP2::SearchJob(&session);
+        job->setUidBased(true);
+        job->setTerm(KIMAP2::Term(KIMAP2::Term::Seen).setNegated(true));
+        QVERIFY(job->exec());
+
+        QCOMPARE(job->resultSet().toImapSequenceSet(), set);
+        QCOMPARE(job->results(), results);
+        QCOMPARE(job->resultCount(), qint64(results.size()));
+
+        fakeServer.quit();
+    }
+
+    void testIncrementalDelivery()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 UID SEARCH NOT SEEN"
+                               << "S: * SEARCH 1 2 3 4 5 9 10"
+                               << "S: A000001 OK search done");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QLatin1String("127.0.0.1"), 5989);
+
+        KIMAP2::SearchJob *job = new KIMAP2::SearchJob(&session);
+        job->setUidBased(true);
+        job->setTerm(KIMAP2::Term(KIMAP2::Term::Seen).setNegated(true));
+        job->setIncrementalDelivery(true, 3);
+        QList<QByteArray> chunks;
+        connect(job, &KIMAP2::SearchJob::resultsReceived, [&chunks](const KIMAP2::ImapSet &results) {
+            chunks << results.toImapSequenceSet();
+        });
+        QVERIFY(job->exec());
+
+        QCOMPARE(chunks, QList<QByteArray>() << "1:3" << "4:5,9" << "10");
+        QCOMPARE(job->resultCount(), qint64(7));
+        QCOMPARE(job->minimumResult(), qint64(1));
+        QCOMPARE(job->maximumResult(), qint64(10));
+        QVERIFY(job->results().isEmpty());
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testFlagsSnapshot()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 UID SEARCH NOT SEEN SUBJECT \"Hello\""
+                               << "S: * SEARCH 3"
+                               << "S: A000001 OK search done");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QLatin1String("127.0.0.1"), 5989);
+        KIMAP2::FlagsSnapshot snapshot;
+        snapshot.set(1, KIMAP2::MessageFlags() << "\\Seen");
+        snapshot.set(2, KIMAP2::MessageFlags() << "\\Flagged" << "\\Deleted");
+        snapshot.set(3, KIMAP2::MessageFlags() << "\\Flagged");
+        snapshot.set(4, KIMAP2::MessageFlags());
+
+        //Answered without the server
+        KIMAP2::SearchJob *job = new KIMAP2::SearchJob(&session);
+        job->setUidBased(true);
+        job->setFlagsSnapshot(snapshot);
+        job->setTerm(KIMAP2::Term(KIMAP2::Term::Seen).setNegated(true));
+        job->setReturnOptions(KIMAP2::SearchJob::ReturnCount | KIMAP2::SearchJob::ReturnMax);
+        QVERIFY(job->exec());
+        QVERIFY(job->isAnsweredLocally());
+        QCOMPARE(job->resultSet().toImapSequenceSet(), QByteArray("2:4"));
+        QCOMPARE(job->resultCount(), qint64(3));
+        QCOMPARE(job->maximumResult(), qint64(4));
+
+        job = new KIMAP2::SearchJob(&session);
+        job->setUidBased(true);
+        job->setFlagsSnapshot(snapshot);
+        job->setTerm(KIMAP2::Term(KIMAP2::Term::And, QVector<KIMAP2::Term>() << KIMAP2::Term(KIMAP2::Term::Flagged)
+                                  << KIMAP2::Term(KIMAP2::Term::Deleted).setNegated(true)));
+        QVERIFY(job->exec());
+        QCOMPARE(job->results(), QVector<qint64>() << 3);
+
+        //The subject is only known to the server
+        job = new KIMAP2::SearchJob(&session);
+        job->setUidBased(true);
+        job->setFlagsSnapshot(snapshot);
+        job->setTerm(KIMAP2::Term(KIMAP2::Term::And, QVector<KIMAP2::Term>() << KIMAP2::Term(KIMAP2::Term::Seen).setNegated(true)
+                                  << KIMAP2::Term(KIMAP2::Term::Subject, QStringLiteral("Hello"))));
+        QVERIFY(job->exec());
+        QVERIFY(!job->isAnsweredLocally());
+        QCOMPARE(job->results(), QVector<qint64>() << 3);
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testSavedResult()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 ESEARCH SEARCHRES] localhost Test Library server ready"
+                               << "C: A000001 UID SEARCH RETURN (SAVE) NOT SEEN"
+                               << "S: A000001 OK search done"
+                               << "C: A000002 UID STORE $ +FLAGS (\\Seen)"
+                               << "S: * 3 FETCH (FLAGS (\\Seen) UID 1096)"
+                               << "S: A000002 OK STORE completed");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QLatin1String("127.0.0.1"), 5989);
+
+        KIMAP2::SearchJob *search = new KIMAP2::SearchJob(&session);
+        search->setUidBased(true);
+        search->setTerm(KIMAP2::Term(KIMAP2::Term::Seen).setNegated(true));
+        search->setReturnOptions(KIMAP2::SearchJob::ReturnSave);
+        search->start();
+
+        KIMAP2::StoreJob *store = new KIMAP2::StoreJob(&session);
+        store->setUidBased(true);
+        store->setSequenceSet(KIMAP2::ImapSet::savedSearchResult());
+        store->setFlags(QList<QByteArray>() << "\\Seen");
+        store->setMode(KIMAP2::StoreJob::AppendFlags);
+        QVERIFY(store->exec());
+        QVERIFY(store->resultingFlags().contains(1096));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testSavedResultUnsupported()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 ESEARCH] localhost Test Library server ready");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QLatin1String("127.0.0.1"), 5989);
+
+        KIMAP2::SearchJob *job = new KIMAP2::SearchJob(&session);
+        job->setTerm(KIMAP2::Term(KIMAP2::Term::Seen).setNegated(true));
+        job->setReturnOptions(KIMAP2::SearchJob::ReturnSave | KIMAP2::SearchJob::ReturnCount);
+        QVERIFY(!job->exec());
+
+        fakeServer.quit();
+    }
+
 };
 
 QTEST_GUILESS_MAIN(SearchJobTest)
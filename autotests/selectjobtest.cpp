@@ -146,6 +146,174 @@ private Q_SLOTS:
         QVERIFY(job->exec());
     }
 
+    void testSelectStateTransitions()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 SELECT \"INBOX\""
+                               << "S: A000001 OK [READ-WRITE] SELECT completed"
+                               << "C: A000002 SELECT \"Missing\""
+                               << "S: A000002 NO no such mailbox"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::SelectJob *job = new KIMAP2::SelectJob(&session);
+        job->setMailBox(QStringLiteral("INBOX"));
+        QVERIFY(job->exec());
+        QCOMPARE(session.state(), KIMAP2::Session::Selected);
+        QCOMPARE(session.selectedMailBox(), QStringLiteral("INBOX"));
+
+        //A failed SELECT leaves the previous mailbox unselected
+        job = new KIMAP2::SelectJob(&session);
+        job->setMailBox(QStringLiteral("Missing"));
+        QVERIFY(!job->exec());
+        QCOMPARE(session.state(), KIMAP2::Session::Authenticated);
+        QCOMPARE(session.selectedMailBox(), QString());
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testCachedSelect()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 SELECT \"INBOX\" (CONDSTORE)"
+                               << "S: * 3 EXISTS"
+                               << "S: * OK [UIDVALIDITY 42] UIDs valid"
+                               << "S: * OK [UIDNEXT 10] Predicted next UID"
+                               << "S: * OK [HIGHESTMODSEQ 100]"
+                               << "S: A000001 OK [READ-WRITE] SELECT completed"
+                               << "C: A000002 NOOP"
+                               << "S: * 2 EXPUNGE"
+                               << "S: * 1 FETCH (UID 10 MODSEQ (105) FLAGS (\\Seen))"
+                               << "S: A000002 OK NOOP completed"
+                               << "C: A000003 EXAMINE \"INBOX\" (CONDSTORE)"
+                               << "S: A000003 OK [READ-ONLY] EXAMINE completed"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        session.setSelectCacheEnabled(true);
+        QVERIFY(session.isSelectCacheEnabled());
+
+        KIMAP2::SelectJob *job = new KIMAP2::SelectJob(&session);
+        job->setMailBox(QStringLiteral("INBOX"));
+        job->setCondstoreEnabled(true);
+        QVERIFY(job->exec());
+
+        QEventLoop loop;
+        session.sendCommand("NOOP", QByteArray(), [&](const KIMAP2::CommandResult &) {
+            loop.quit();
+        });
+        loop.exec();
+
+        //Answered from what we know
+        job = new KIMAP2::SelectJob(&session);
+        job->setMailBox(QStringLiteral("INBOX"));
+        job->setCondstoreEnabled(true);
+        QVERIFY(job->exec());
+        QCOMPARE(job->messageCount(), 2);
+        QCOMPARE(job->uidValidity(), qint64(42));
+        QCOMPARE(job->nextUid(), qint64(11));
+        QCOMPARE(job->highestModSequence(), quint64(105));
+
+        //Other options need the server
+        job = new KIMAP2::SelectJob(&session);
+        job->setMailBox(QStringLiteral("INBOX"));
+        job->setCondstoreEnabled(true);
+        job->setOpenReadOnly(true);
+        QVERIFY(job->exec());
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testMailBoxId()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 SELECT \"INBOX\""
+                               << "S: * 3 EXISTS"
+                               << "S: * OK [MAILBOXID (F2212ea87-6097-4256-9d51-71338625)] Ok"
+                               << "S: A000001 OK [READ-WRITE] mailbox selected"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::SelectJob *job = new KIMAP2::SelectJob(&session);
+        job->setMailBox(QStringLiteral("INBOX"));
+        QVERIFY(job->exec());
+        QCOMPARE(job->mailBoxId(), QByteArray("F2212ea87-6097-4256-9d51-71338625"));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testQResync()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 ENABLE QRESYNC"
+                               << "C: A000002 SELECT \"INBOX\" (QRESYNC (67890007 90060115194045000 41:211,214:541 (1:20 41:60)))"
+                               << "S: * ENABLED QRESYNC"
+                               << "S: A000001 OK ENABLE completed"
+                               << "S: * 314 EXISTS"
+                               << "S: * OK [UIDVALIDITY 67890007] UIDs valid"
+                               << "S: * OK [HIGHESTMODSEQ 90060115205545359] Highest mailbox mod-sequence"
+                               << "S: * VANISHED (EARLIER) 41,43:116,118,120:211,214:540"
+                               << "S: * 49 FETCH (UID 117 FLAGS (\\Seen \\Answered) MODSEQ (90060115194045001))"
+                               << "S: A000002 OK [READ-WRITE] mailbox selected"
+                               << "C: A000003 SELECT \"Archive\" (QRESYNC (42 7))"
+                               << "S: A000003 OK [READ-WRITE] mailbox selected"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::SelectJob *job = new KIMAP2::SelectJob(&session);
+        job->setMailBox(QStringLiteral("INBOX"));
+        job->setQResync(67890007, 90060115194045000ULL, KIMAP2::ImapSet::fromImapSequenceSet("41:211,214:541"));
+        job->setQResyncSequenceMatch(KIMAP2::ImapSet(1, 20), KIMAP2::ImapSet(41, 60));
+        QList<KIMAP2::ImapSet> vanished;
+        connect(job, &KIMAP2::SelectJob::vanished, [&vanished](const KIMAP2::ImapSet &uids) {
+            vanished << uids;
+        });
+        QList<qint64> changedUids;
+        QList<QByteArray> changedFlags;
+        quint64 changedModSequence = 0;
+        connect(job, &KIMAP2::SelectJob::messageFlagsChanged, [&](qint64 uid, const QList<QByteArray> &flags, quint64 modSequence) {
+            changedUids << uid;
+            changedFlags = flags;
+            changedModSequence = modSequence;
+        });
+        QVERIFY(job->exec());
+
+        QCOMPARE(job->messageCount(), 314);
+        QCOMPARE(job->highestModSequence(), quint64(90060115205545359ULL));
+        QCOMPARE(vanished.size(), 1);
+        QCOMPARE(vanished.first().toImapSequenceSet(), QByteArray("41,43:116,118,120:211,214:540"));
+        QCOMPARE(changedUids, QList<qint64>() << 117);
+        QCOMPARE(changedFlags, QList<QByteArray>() << "\\Seen" << "\\Answered");
+        QCOMPARE(changedModSequence, quint64(90060115194045001ULL));
+
+        //Enabled already
+        job = new KIMAP2::SelectJob(&session);
+        job->setMailBox(QStringLiteral("Archive"));
+        job->setQResync(42, 7);
+        QVERIFY(job->exec());
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
 };
 
 QTEST_GUILESS_MAIN(SelectJobTest)
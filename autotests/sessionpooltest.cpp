@@ -0,0 +1,153 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#include <qtest.h>
+
+#include "kimap2test/fakeserver.h"
+#include "kimap2/session.h"
+#include "kimap2/sessionpool.h"
+#include "kimap2/expungejob.h"
+#include "kimap2/keepalivescheduler.h"
+
+#include <QtTest>
+
+class SessionPoolTest: public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+
+    void testMailBoxAffinity()
+    {
+        FakeServer fakeServer;
+        //Only the first job for a mailbox selects it
+        fakeServer.addScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 SELECT \"INBOX\""
+                               << "S: A000001 OK [READ-WRITE] SELECT completed"
+                               << "C: A000002 EXPUNGE"
+                               << "S: A000002 OK EXPUNGE completed"
+                               << "C: A000003 EXPUNGE"
+                               << "S: A000003 OK EXPUNGE completed"
+                              );
+        fakeServer.addScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 SELECT \"Foo\""
+                               << "S: A000001 OK [READ-WRITE] SELECT completed"
+                               << "C: A000002 EXPUNGE"
+                               << "S: A000002 OK EXPUNGE completed"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::SessionPool pool(QStringLiteral("127.0.0.1"), 5989, KIMAP2::SessionPool::SessionSetup());
+        pool.setMaximumSessions(2);
+
+        const auto expunge = [](KIMAP2::Session *session) {
+            return new KIMAP2::ExpungeJob(session);
+        };
+        QList<KIMAP2::Job *> jobs;
+        jobs << pool.submit(QStringLiteral("INBOX"), expunge);
+        jobs << pool.submit(QStringLiteral("INBOX"), expunge);
+        jobs << pool.submit(QStringLiteral("Foo"), expunge);
+        QCOMPARE(pool.sessions().size(), 2);
+
+        int finished = 0;
+        for (KIMAP2::Job *job : jobs) {
+            QVERIFY(job);
+            job->setAutoDelete(false);
+            connect(job, &KJob::result, [&finished](KJob *job) {
+                QCOMPARE(job->error(), 0);
+                finished++;
+            });
+        }
+        QTRY_COMPARE(finished, 3);
+
+        QCOMPARE(pool.sessions().at(0)->selectedMailBox(), QStringLiteral("INBOX"));
+        QCOMPARE(pool.sessions().at(1)->selectedMailBox(), QStringLiteral("Foo"));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testConnectionLimit()
+    {
+        //Nothing has to listen there, the sessions are only created
+        KIMAP2::SessionPool::setConnectionLimit(QStringLiteral("127.0.0.2"), 1);
+        QCOMPARE(KIMAP2::SessionPool::connectionLimit(QStringLiteral("127.0.0.2")), 1);
+
+        KIMAP2::SessionPool pool(QStringLiteral("127.0.0.2"), 5989, KIMAP2::SessionPool::SessionSetup());
+        KIMAP2::SessionPool otherPool(QStringLiteral("127.0.0.2"), 5989, KIMAP2::SessionPool::SessionSetup());
+
+        const auto expunge = [](KIMAP2::Session *session) {
+            return new KIMAP2::ExpungeJob(session);
+        };
+        QVERIFY(pool.submit(QStringLiteral("INBOX"), expunge));
+        //The busy session is shared instead of opening another connection
+        QVERIFY(pool.submit(QStringLiteral("Foo"), expunge));
+        QCOMPARE(pool.sessions().size(), 1);
+        //The limit applies to all pools for the server
+        QVERIFY(!otherPool.submit(QStringLiteral("INBOX"), expunge));
+        QCOMPARE(otherPool.sessions().size(), 0);
+    }
+
+    void testKeepAlive()
+    {
+        FakeServer fakeServer;
+        fakeServer.addScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 SELECT \"INBOX\""
+                               << "S: A000001 OK [READ-WRITE] SELECT completed"
+                               << "C: A000002 EXPUNGE"
+                               << "S: A000002 OK EXPUNGE completed"
+                               << "C: A000003 NOOP"
+                               << "S: A000003 OK NOOP completed"
+                               << "C: A000004 NOOP"
+                               << "S: A000004 NO not now"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::KeepAliveScheduler scheduler;
+        scheduler.setInterval(2);
+        KIMAP2::SessionPool pool(QStringLiteral("127.0.0.1"), 5989, KIMAP2::SessionPool::SessionSetup());
+        pool.setKeepAliveScheduler(&scheduler);
+        QSignalSpy alive(&scheduler, SIGNAL(sessionAlive(KIMAP2::Session*)));
+        QSignalSpy unresponsive(&scheduler, SIGNAL(sessionUnresponsive(KIMAP2::Session*)));
+
+        KIMAP2::Job *job = pool.submit(QStringLiteral("INBOX"), [](KIMAP2::Session *session) {
+            return new KIMAP2::ExpungeJob(session);
+        });
+        QVERIFY(job);
+        QCOMPARE(scheduler.sessions(), pool.sessions());
+
+        //The session is only kept alive once it stayed silent
+        QTRY_COMPARE(alive.count(), 1);
+        QCOMPARE(unresponsive.count(), 0);
+
+        //A session that doesn't answer leaves the pool
+        QTRY_COMPARE(unresponsive.count(), 1);
+        QTRY_VERIFY(pool.sessions().isEmpty());
+        QVERIFY(scheduler.sessions().isEmpty());
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+};
+
+QTEST_GUILESS_MAIN(SessionPoolTest)
+
+#include "sessionpooltest.moc"
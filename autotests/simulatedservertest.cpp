@@ -0,0 +1,263 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+#include <qtest.h>
+
+#include "kimap2test/fakeserver.h"
+#include "kimap2test/simulatedserver.h"
+#include "kimap2/appendjob.h"
+#include "kimap2/fetchjob.h"
+#include "kimap2/session.h"
+#include "kimap2/statusjob.h"
+
+#include <QtTest>
+
+using namespace KIMAP2;
+
+typedef QList<QPair<QByteArray, qint64>> StatusMap;
+
+class SimulatedServerTest: public QObject
+{
+    Q_OBJECT
+
+private:
+    static QList<QByteArray> statusScenario()
+    {
+        return QList<QByteArray>()
+               << FakeServer::preauth()
+               << "C: A000001 STATUS \"INBOX\" (MESSAGES)"
+               << "S: * STATUS \"INBOX\" (MESSAGES 294)"
+               << "S: A000001 OK STATUS Completed"
+               << "C: A000002 STATUS \"Drafts\" (MESSAGES)"
+               << "S: * STATUS \"Drafts\" (MESSAGES 3)"
+               << "S: A000002 OK STATUS Completed";
+    }
+
+    // The milliseconds from starting a STATUS of INBOX and Drafts to both results
+    static void statusBoth(Session *session, qint64 *elapsed)
+    {
+        StatusJob *inbox = new StatusJob(session);
+        inbox->setMailBox(QStringLiteral("INBOX"));
+        inbox->setDataItems({ "MESSAGES" });
+        StatusJob *drafts = new StatusJob(session);
+        drafts->setMailBox(QStringLiteral("Drafts"));
+        drafts->setDataItems({ "MESSAGES" });
+
+        QSignalSpy inboxSpy(inbox, &KJob::result);
+        QSignalSpy draftsSpy(drafts, &KJob::result);
+        QElapsedTimer timer;
+        timer.start();
+        inbox->start();
+        drafts->start();
+        QTRY_COMPARE(inboxSpy.count(), 1);
+        QTRY_COMPARE(draftsSpy.count(), 1);
+        *elapsed = timer.elapsed();
+    }
+
+private Q_SLOTS:
+
+    void testRoundTripTime()
+    {
+#ifndef Q_OS_UNIX
+        QSKIP("Transports require a Unix system");
+#endif
+        SimulatedServer::Options options;
+        options.roundTripTime = 100;
+        SimulatedServer server(options);
+        server.setScenario(QList<QByteArray>()
+                           << FakeServer::preauth()
+                           << "C: A000001 STATUS \"INBOX\" (MESSAGES)"
+                           << "W: 50"
+                           << "S: * STATUS \"INBOX\" (MESSAGES 294)"
+                           << "S: A000001 OK STATUS Completed");
+
+        QElapsedTimer timer;
+        timer.start();
+        Session session(server.transport());
+        QTRY_COMPARE(session.state(), Session::Authenticated);
+        //The greeting takes a round trip
+        QVERIFY(timer.elapsed() >= 100);
+
+        timer.restart();
+        StatusJob *job = new StatusJob(&session);
+        job->setMailBox(QStringLiteral("INBOX"));
+        job->setDataItems({ "MESSAGES" });
+        QVERIFY(job->exec());
+        QCOMPARE(job->status(), StatusMap({ { "MESSAGES", 294 } }));
+        //A round trip and the wait
+        QVERIFY(timer.elapsed() >= 150);
+
+        QCOMPARE(server.commandCount(), 1);
+        QCOMPARE(server.maximumCommandsInFlight(), 1);
+        QVERIFY(server.isAllScenarioDone());
+        QVERIFY(server.isIdle());
+    }
+
+    void testPipelining()
+    {
+#ifndef Q_OS_UNIX
+        QSKIP("Transports require a Unix system");
+#endif
+        SimulatedServer::Options options;
+        options.roundTripTime = 100;
+
+        qint64 serial = 0;
+        {
+            SimulatedServer server(options);
+            server.setScenario(statusScenario());
+            Session session(server.transport());
+            QTRY_COMPARE(session.state(), Session::Authenticated);
+            statusBoth(&session, &serial);
+            QCOMPARE(server.maximumCommandsInFlight(), 1);
+            QVERIFY(server.isAllScenarioDone());
+        }
+        //The second command waits for the response to the first
+        QVERIFY(serial >= 200);
+
+        qint64 pipelined = 0;
+        {
+            SimulatedServer server(options);
+            server.setScenario(statusScenario());
+            Session session(server.transport());
+            session.setPipeliningEnabled(true);
+            QTRY_COMPARE(session.state(), Session::Authenticated);
+            statusBoth(&session, &pipelined);
+            QCOMPARE(server.maximumCommandsInFlight(), 2);
+            QVERIFY(server.isAllScenarioDone());
+        }
+        //Both in one round trip
+        QVERIFY(pipelined >= 100);
+        QVERIFY(pipelined < serial);
+    }
+
+    void testBandwidth()
+    {
+#ifndef Q_OS_UNIX
+        QSKIP("Transports require a Unix system");
+#endif
+        const QByteArray body = "Subject: big\r\n\r\n" + QByteArray(20000, 'a') + "\r\n";
+
+        SimulatedServer::Options options;
+        //The body takes 200ms
+        options.bandwidth = 100000;
+        SimulatedServer server(options);
+        server.setScenario(QList<QByteArray>()
+                           << FakeServer::preauth()
+                           << "C: A000001 UID FETCH 20 (BODY.PEEK[] UID)"
+                           << "S: * 1 FETCH (UID 20 BODY[] {" + QByteArray::number(body.size()) + "}\r\n" + body + ")"
+                           << "S: A000001 OK fetch done");
+
+        Session session(server.transport());
+        QTRY_COMPARE(session.state(), Session::Authenticated);
+
+        FetchJob::FetchScope scope;
+        scope.mode = FetchJob::FetchScope::Content;
+        FetchJob *job = new FetchJob(&session);
+        job->setUidBased(true);
+        job->setSequenceSet(ImapSet(20));
+        job->setScope(scope);
+        job->setRawResults(true);
+        QByteArray content;
+        connect(job, &FetchJob::resultReceived, [&content](const FetchJob::Result &result) {
+            content = result.rawContent;
+        });
+
+        QElapsedTimer timer;
+        timer.start();
+        QVERIFY(job->exec());
+        QVERIFY(timer.elapsed() >= 200);
+        QCOMPARE(content, body);
+        QVERIFY(server.isAllScenarioDone());
+    }
+
+    void testChunks()
+    {
+#ifndef Q_OS_UNIX
+        QSKIP("Transports require a Unix system");
+#endif
+        const QByteArray body = "Subject: one\r\n\r\nHi\r\n";
+
+        SimulatedServer::Options options;
+        //Splits the responses inside the literal and its size
+        options.chunkSize = 3;
+        SimulatedServer server(options);
+        server.setScenario(QList<QByteArray>()
+                           << FakeServer::preauth()
+                           << "C: A000001 APPEND \"INBOX\" {7}\r\ncontent"
+                           << "S: A000001 OK APPEND completed. [ APPENDUID 492 20 ]"
+                           << "C: A000002 UID FETCH 20 (BODY.PEEK[] UID)"
+                           << "S: * 1 FETCH (UID 20 BODY[] {" + QByteArray::number(body.size()) + "}\r\n" + body + ")"
+                           << "S: A000002 OK fetch done");
+
+        Session session(server.transport());
+
+        //Waits for the continuation of the synchronizing literal
+        AppendJob *append = new AppendJob(&session);
+        append->setMailBox(QStringLiteral("INBOX"));
+        append->setContent("content");
+        QVERIFY(append->exec());
+        QCOMPARE(append->uid(), qint64(20));
+
+        FetchJob::FetchScope scope;
+        scope.mode = FetchJob::FetchScope::Content;
+        FetchJob *fetch = new FetchJob(&session);
+        fetch->setUidBased(true);
+        fetch->setSequenceSet(ImapSet(20));
+        fetch->setScope(scope);
+        fetch->setRawResults(true);
+        QByteArray content;
+        connect(fetch, &FetchJob::resultReceived, [&content](const FetchJob::Result &result) {
+            content = result.rawContent;
+        });
+        QVERIFY(fetch->exec());
+        QCOMPARE(content, body);
+
+        QCOMPARE(server.commandCount(), 2);
+        QVERIFY(server.isAllScenarioDone());
+    }
+
+    void testDisconnect()
+    {
+#ifndef Q_OS_UNIX
+        QSKIP("Transports require a Unix system");
+#endif
+        SimulatedServer server;
+        server.setScenario(QList<QByteArray>()
+                           << FakeServer::preauth()
+                           << "C: A000001 STATUS \"INBOX\" (MESSAGES)"
+                           << "S: * STATUS \"INBOX\" (MESSAGES 294)"
+                           << "S: A000001 OK STATUS Completed"
+                           << "X");
+
+        Session session(server.transport());
+        QTRY_COMPARE(session.state(), Session::Authenticated);
+
+        StatusJob *job = new StatusJob(&session);
+        job->setMailBox(QStringLiteral("INBOX"));
+        job->setDataItems({ "MESSAGES" });
+        QVERIFY(job->exec());
+        QCOMPARE(job->status(), StatusMap({ { "MESSAGES", 294 } }));
+
+        //The server closes the connection after the response
+        QTRY_COMPARE(session.state(), Session::Disconnected);
+        QVERIFY(server.isAllScenarioDone());
+        QVERIFY(server.isIdle());
+    }
+};
+
+QTEST_GUILESS_MAIN(SimulatedServerTest)
+
+#include "simulatedservertest.moc"
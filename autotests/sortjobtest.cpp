@@ -0,0 +1,114 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#include <qtest.h>
+
+#include "kimap2test/fakeserver.h"
+#include "kimap2/session.h"
+#include "kimap2/sortjob.h"
+
+#include <QtTest>
+
+class SortJobTest: public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testSort()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 SORT] localhost Test Library server ready"
+                               << "C: A000001 UID SORT (REVERSE DATE SUBJECT) UTF-8 NOT SEEN"
+                               << "S: * SORT 10 11 12 4 20 21"
+                               << "S: A000001 OK SORT completed"
+                               << "C: A000002 SORT (ARRIVAL) UTF-8 ALL"
+                               << "S: * SORT 1 2 3 4 5"
+                               << "S: A000002 OK SORT completed");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        KIMAP2::SortJob *job = new KIMAP2::SortJob(&session);
+        job->setUidBased(true);
+        job->addSortKey(KIMAP2::SortJob::Date, true);
+        job->addSortKey(KIMAP2::SortJob::Subject);
+        job->setTerm(KIMAP2::Term(KIMAP2::Term::Seen).setNegated(true));
+        QVERIFY(job->exec());
+        QCOMPARE(job->results(), QVector<qint64>({ 10, 11, 12, 4, 20, 21 }));
+        QCOMPARE(job->resultSet().toImapSequenceSet(), QByteArray("10:12,4,20:21"));
+        QCOMPARE(job->resultCount(), qint64(6));
+
+        //Without CONTEXT=SORT the window is cut out on the client
+        job = new KIMAP2::SortJob(&session);
+        job->addSortKey(KIMAP2::SortJob::Arrival);
+        job->setPartial(2, 3);
+        QVERIFY(job->exec());
+        QCOMPARE(job->results(), QVector<qint64>({ 2, 3 }));
+        QCOMPARE(job->resultCount(), qint64(5));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testPartial()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 SORT ESORT CONTEXT=SORT] localhost Test Library server ready"
+                               << "C: A000001 UID SORT RETURN (PARTIAL 1:5 COUNT) (REVERSE ARRIVAL) UTF-8 ALL"
+                               << "S: * ESEARCH (TAG \"A000001\") UID PARTIAL (1:5 300000:299998,17,9) COUNT 300000"
+                               << "S: A000001 OK SORT completed");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        KIMAP2::SortJob *job = new KIMAP2::SortJob(&session);
+        job->setUidBased(true);
+        job->addSortKey(KIMAP2::SortJob::Arrival, true);
+        job->setPartial(1, 5);
+        QVERIFY(job->exec());
+        QCOMPARE(job->results(), QVector<qint64>({ 300000, 299999, 299998, 17, 9 }));
+        QCOMPARE(job->resultCount(), qint64(300000));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testSortUnsupported()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth());
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        KIMAP2::SortJob *job = new KIMAP2::SortJob(&session);
+        job->addSortKey(KIMAP2::SortJob::Date);
+        QVERIFY(!job->exec());
+
+        fakeServer.quit();
+    }
+};
+
+QTEST_GUILESS_MAIN(SortJobTest)
+
+#include "sortjobtest.moc"
@@ -18,6 +18,8 @@
 */
 
 #include <qtest.h>
+#include <QSignalSpy>
+#include <QThread>
 
 #include "kimap2test/fakeserver.h"
 #include "kimap2/loginjob.h"
@@ -27,6 +29,21 @@
 typedef QList<QPair<QByteArray, qint64>> StatusMap;
 Q_DECLARE_METATYPE(StatusMap)
 
+class SubmitThread : public QThread
+{
+public:
+    explicit SubmitThread(const std::function<void()> &call) : call(call) { }
+
+protected:
+    void run() Q_DECL_OVERRIDE
+    {
+        call();
+    }
+
+private:
+    std::function<void()> call;
+};
+
 class StatusJobTest: public QObject
 {
     Q_OBJECT
@@ -119,6 +136,211 @@ private Q_SLOTS:
 
         fakeServer.quit();
     }
+
+    void testMailBoxId()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 STATUS \"INBOX\" (MESSAGES MAILBOXID)"
+                               << "S: * STATUS \"INBOX\" (MESSAGES 294 MAILBOXID (F2212ea87-6097-4256-9d51-71338625))"
+                               << "S: A000001 OK STATUS Completed");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        KIMAP2::StatusJob *job = new KIMAP2::StatusJob(&session);
+        job->setMailBox(QStringLiteral("INBOX"));
+        job->setDataItems({ "MESSAGES", "MAILBOXID" });
+        QVERIFY(job->exec());
+
+        QCOMPARE(job->mailBoxId(), QByteArray("F2212ea87-6097-4256-9d51-71338625"));
+        QCOMPARE(job->status(), StatusMap({ { "MESSAGES", 294 } }));
+
+        fakeServer.quit();
+    }
+
+    void testSize()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 STATUS \"INBOX\" (MESSAGES SIZE APPENDLIMIT)"
+                               << "S: * STATUS \"INBOX\" (MESSAGES 294 SIZE 8219025113 APPENDLIMIT 52428800)"
+                               << "S: A000001 OK STATUS Completed");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        KIMAP2::StatusJob *job = new KIMAP2::StatusJob(&session);
+        job->setMailBox(QStringLiteral("INBOX"));
+        job->setDataItems({ "MESSAGES", "SIZE", "APPENDLIMIT" });
+        QVERIFY(job->exec());
+
+        QCOMPARE(job->size(), qint64(8219025113LL));
+        QCOMPARE(job->appendLimit(), qint64(52428800));
+        QCOMPARE(job->size(QStringLiteral("Archive")), qint64(-1));
+
+        fakeServer.quit();
+    }
+
+    void testPipelinedStatus()
+    {
+        FakeServer fakeServer;
+        //The server only answers once it received both commands
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 STATUS \"INBOX\" (MESSAGES)"
+                               << "C: A000002 STATUS \"Drafts\" (MESSAGES)"
+                               << "S: * STATUS \"Drafts\" (MESSAGES 3)"
+                               << "S: * STATUS \"INBOX\" (MESSAGES 294)"
+                               << "S: A000002 OK STATUS Completed"
+                               << "S: A000001 OK STATUS Completed"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        session.setPipeliningEnabled(true);
+
+        KIMAP2::StatusJob *inbox = new KIMAP2::StatusJob(&session);
+        inbox->setMailBox(QStringLiteral("INBOX"));
+        inbox->setDataItems({ "MESSAGES" });
+        inbox->setAutoDelete(false);
+        KIMAP2::StatusJob *drafts = new KIMAP2::StatusJob(&session);
+        drafts->setMailBox(QStringLiteral("Drafts"));
+        drafts->setDataItems({ "MESSAGES" });
+        drafts->setAutoDelete(false);
+
+        QSignalSpy inboxSpy(inbox, &KJob::result);
+        QSignalSpy draftsSpy(drafts, &KJob::result);
+        inbox->start();
+        drafts->start();
+        QTRY_COMPARE(draftsSpy.count(), 1);
+        QTRY_COMPARE(inboxSpy.count(), 1);
+
+        QCOMPARE(inbox->error(), 0);
+        QCOMPARE(drafts->error(), 0);
+        QCOMPARE(inbox->status(), StatusMap({ { "MESSAGES", 294 } }));
+        QCOMPARE(drafts->status(), StatusMap({ { "MESSAGES", 3 } }));
+        QCOMPARE(session.jobQueueSize(), 0);
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testMultipleMailBoxes()
+    {
+        FakeServer fakeServer;
+        //The server only answers once it received all commands
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 STATUS \"INBOX\" (UNSEEN)"
+                               << "C: A000002 STATUS \"Drafts\" (UNSEEN)"
+                               << "C: A000003 STATUS \"Gone\" (UNSEEN)"
+                               << "S: * STATUS inbox (UNSEEN 7)"
+                               << "S: A000001 OK STATUS Completed"
+                               << "S: * STATUS \"Drafts\" (UNSEEN 0)"
+                               << "S: A000002 OK STATUS Completed"
+                               << "S: A000003 NO [NONEXISTENT] No such mailbox"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        KIMAP2::StatusJob *job = new KIMAP2::StatusJob(&session);
+        job->setMailBoxes(QStringList() << QStringLiteral("INBOX") << QStringLiteral("Drafts") << QStringLiteral("Gone"));
+        job->setDataItems({ "UNSEEN" });
+        QStringList received;
+        connect(job, &KIMAP2::StatusJob::statusReceived, [&](const QString &mailBox, const StatusMap &) {
+            received << mailBox;
+        });
+        QVERIFY(!job->exec());
+
+        QCOMPARE(received, QStringList() << QStringLiteral("INBOX") << QStringLiteral("Drafts"));
+        QCOMPARE(job->mailBox(), QStringLiteral("INBOX"));
+        QCOMPARE(job->status(), StatusMap({ { "UNSEEN", 7 } }));
+        QCOMPARE(job->status(QStringLiteral("Drafts")), StatusMap({ { "UNSEEN", 0 } }));
+        QVERIFY(job->status(QStringLiteral("Gone")).isEmpty());
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testWorkerThread()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 STATUS \"INBOX\" (MESSAGES)"
+                               << "S: * STATUS \"INBOX\" (MESSAGES 294)"
+                               << "S: A000001 OK STATUS Completed"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989, KIMAP2::Session::WorkerThread);
+
+        KIMAP2::StatusJob *job = new KIMAP2::StatusJob(&session);
+        job->setMailBox(QStringLiteral("INBOX"));
+        job->setDataItems({ "MESSAGES" });
+        job->setAutoDelete(false);
+
+        //The result is emitted on the worker thread and queued to us
+        int results = 0;
+        QThread *resultThread = Q_NULLPTR;
+        connect(job, &KJob::result, this, [&results, &resultThread]() {
+            results++;
+            resultThread = QThread::currentThread();
+        });
+        job->start();
+        QTRY_COMPARE(results, 1);
+
+        QCOMPARE(resultThread, QThread::currentThread());
+        QCOMPARE(job->error(), 0);
+        QCOMPARE(job->status(), StatusMap({ { "MESSAGES", 294 } }));
+        QCOMPARE(session.state(), KIMAP2::Session::Authenticated);
+        QTRY_COMPARE(session.jobQueueSize(), 0);
+
+        delete job;
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testSubmitToSharedWorkerThread()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 STATUS \"INBOX\" (MESSAGES)"
+                               << "S: * STATUS \"INBOX\" (MESSAGES 294)"
+                               << "S: A000001 OK STATUS Completed"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989, KIMAP2::Session::SharedWorkerThread);
+
+        int results = 0;
+        StatusMap status;
+        QThread *factoryThread = Q_NULLPTR;
+        SubmitThread submitter([&]() {
+            session.submit([&](KIMAP2::Session *session) {
+                factoryThread = QThread::currentThread();
+                KIMAP2::StatusJob *job = new KIMAP2::StatusJob(session);
+                job->setMailBox(QStringLiteral("INBOX"));
+                job->setDataItems({ "MESSAGES" });
+                connect(job, &KJob::result, this, [&results, &status, job]() {
+                    results++;
+                    status = job->status();
+                });
+                return job;
+            });
+        });
+        submitter.start();
+        QVERIFY(submitter.wait());
+        QTRY_COMPARE(results, 1);
+
+        QCOMPARE(factoryThread, QThread::currentThread());
+        QCOMPARE(status, StatusMap({ { "MESSAGES", 294 } }));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
 };
 
 QTEST_GUILESS_MAIN(StatusJobTest)
@@ -22,6 +22,8 @@
 #include <qtest.h>
 
 #include "kimap2test/fakeserver.h"
+#include "kimap2/enablejob.h"
+#include "kimap2/selectjob.h"
 #include "kimap2/session.h"
 #include "kimap2/storejob.h"
 
@@ -102,6 +104,212 @@ private Q_SLOTS:
         fakeServer.quit();
     }
 
+    void testStoreInChunks()
+    {
+        QList<QByteArray> scenario;
+        scenario << FakeServer::preauth()
+                 << "C: A000001 UID STORE 10,20 +FLAGS (\\Seen)"
+                 << "C: A000002 UID STORE 30 +FLAGS (\\Seen)"
+                 << "S: * 1 FETCH (FLAGS (\\Seen) UID 10)\r\n"
+                    "* 2 FETCH (FLAGS (\\Seen) UID 20)\r\n"
+                    "A000001 OK STORE completed\r\n"
+                    "A000002 NO STORE failed";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::StoreJob *job = new KIMAP2::StoreJob(&session);
+        job->setUidBased(true);
+        job->setSequenceSet(KIMAP2::ImapSet::fromImapSequenceSet("10,20,30"));
+        job->setFlags(QList<QByteArray>() << "\\Seen");
+        job->setMode(KIMAP2::StoreJob::AppendFlags);
+        job->setMaximumSetLength(5);
+        QVERIFY(!job->exec());
+        QCOMPARE(job->resultingFlags().keys(), QList<int>() << 10 << 20);
+
+        fakeServer.quit();
+    }
+
+    void testUnchangedSince()
+    {
+        QList<QByteArray> scenario;
+        scenario << FakeServer::preauth()
+                 << "C: A000001 UID STORE 7,9 (UNCHANGEDSINCE 12345) +FLAGS (\\Seen)"
+                 << "S: * 5 FETCH (UID 7 MODSEQ (12346) FLAGS (\\Seen))"
+                 << "S: A000001 OK [MODIFIED 9] Conditional STORE failed";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::StoreJob *job = new KIMAP2::StoreJob(&session);
+        job->setUidBased(true);
+        job->setSequenceSet(KIMAP2::ImapSet::fromImapSequenceSet("7,9"));
+        job->setFlags(QList<QByteArray>() << "\\Seen");
+        job->setMode(KIMAP2::StoreJob::AppendFlags);
+        job->setUnchangedSince(12345);
+        QVERIFY(job->exec());
+        QCOMPARE(job->modifiedSet(), KIMAP2::ImapSet(9));
+        QCOMPARE(job->resultingFlags().keys(), QList<int>() << 7);
+        QCOMPARE(job->resultingModSeqs().value(7), quint64(12346));
+
+        fakeServer.quit();
+    }
+
+    void testCoalescing()
+    {
+        QList<QByteArray> scenario;
+        scenario << FakeServer::preauth()
+                 << "C: A000001 UID STORE 10:11,13 +FLAGS (\\Seen)"
+                 << "S: * 1 FETCH (FLAGS (\\Seen) UID 10)\r\n"
+                    "* 2 FETCH (FLAGS (\\Seen) UID 11)\r\n"
+                    "* 4 FETCH (FLAGS (\\Seen) UID 13)\r\n"
+                    "A000001 OK STORE completed"
+                 << "C: A000002 UID STORE 12 -FLAGS (\\Seen)"
+                 << "S: A000002 OK STORE completed";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        session.setJobCoalescingEnabled(true);
+
+        QList<KIMAP2::StoreJob *> jobs;
+        QList<QSharedPointer<QSignalSpy> > spies;
+        for (qint64 uid : { 13, 10, 11, 12 }) {
+            KIMAP2::StoreJob *job = new KIMAP2::StoreJob(&session);
+            job->setUidBased(true);
+            job->setSequenceSet(KIMAP2::ImapSet(uid));
+            job->setFlags(QList<QByteArray>() << "\\Seen");
+            job->setMode(uid == 12 ? KIMAP2::StoreJob::RemoveFlags : KIMAP2::StoreJob::AppendFlags);
+            job->setAutoDelete(false);
+            spies << QSharedPointer<QSignalSpy>(new QSignalSpy(job, &KJob::result));
+            jobs << job;
+        }
+        foreach (KIMAP2::StoreJob *job, jobs) {
+            job->start();
+        }
+        QTRY_COMPARE(spies.last()->count(), 1);
+
+        for (int i = 0; i < 3; ++i) {
+            QCOMPARE(spies.at(i)->count(), 1);
+            QCOMPARE(jobs.at(i)->error(), 0);
+        }
+        // Each job gets the flags of its own messages
+        QCOMPARE(jobs.at(0)->resultingFlags().keys(), QList<int>() << 13);
+        QCOMPARE(jobs.at(1)->resultingFlags().keys(), QList<int>() << 10);
+        QCOMPARE(jobs.at(0)->sequenceSet(), KIMAP2::ImapSet(13));
+        QCOMPARE(session.jobQueueSize(), 0);
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+        qDeleteAll(jobs);
+    }
+
+    void testCoalescingKeepsMailBoxesApart()
+    {
+        QList<QByteArray> scenario;
+        scenario << FakeServer::preauth()
+                 << "C: A000001 SELECT \"INBOX\""
+                 << "S: A000001 OK [READ-WRITE] SELECT completed"
+                 << "C: A000002 SELECT \"Archive\""
+                 << "S: A000002 OK [READ-WRITE] SELECT completed"
+                 << "C: A000003 UID STORE 10 +FLAGS (\\Seen)"
+                 << "S: A000003 OK STORE completed"
+                 << "C: A000004 UID STORE 11 +FLAGS (\\Seen)"
+                 << "S: A000004 OK STORE completed";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        session.setJobCoalescingEnabled(true);
+
+        auto store = [&session](qint64 uid) {
+            KIMAP2::StoreJob *job = new KIMAP2::StoreJob(&session);
+            job->setUidBased(true);
+            job->setSequenceSet(KIMAP2::ImapSet(uid));
+            job->setFlags(QList<QByteArray>() << "\\Seen");
+            job->setMode(KIMAP2::StoreJob::AppendFlags);
+            job->setPriority(KIMAP2::Job::BackgroundPriority);
+            return job;
+        };
+
+        // The first store is queued while INBOX is selected, the second one once the
+        // select of Archive that went ahead of it completed
+        KIMAP2::StoreJob *last = Q_NULLPTR;
+        KIMAP2::SelectJob *inbox = new KIMAP2::SelectJob(&session);
+        inbox->setMailBox(QStringLiteral("INBOX"));
+        connect(inbox, &KJob::result, this, [&]() {
+            store(10)->start();
+            KIMAP2::SelectJob *archive = new KIMAP2::SelectJob(&session);
+            archive->setMailBox(QStringLiteral("Archive"));
+            connect(archive, &KJob::result, this, [&]() {
+                last = store(11);
+                last->setAutoDelete(false);
+                last->start();
+            });
+            archive->start();
+        });
+        inbox->start();
+
+        QTRY_VERIFY(last);
+        QSignalSpy spy(last, &KJob::result);
+        QTRY_COMPARE(spy.count(), 1);
+        QCOMPARE(last->error(), 0);
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+        delete last;
+    }
+
+    void testStoreUidOnly()
+    {
+        QList<QByteArray> scenario;
+        scenario << "S: * PREAUTH [CAPABILITY IMAP4rev1 ENABLE UIDONLY] localhost Test Library server ready"
+                 << "C: A000001 ENABLE UIDONLY"
+                 << "S: * ENABLED UIDONLY"
+                 << "S: A000001 OK enabled"
+                 << "C: A000002 UID STORE 10 +FLAGS (\\Seen)"
+                 << "S: * 10 UIDFETCH (FLAGS (\\Seen))"
+                 << "S: A000002 OK STORE completed";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        KIMAP2::EnableJob *enable = new KIMAP2::EnableJob(&session);
+        enable->setExtensions(QList<QByteArray>() << "UIDONLY");
+        QVERIFY(enable->exec());
+
+        KIMAP2::StoreJob *job = new KIMAP2::StoreJob(&session);
+        job->setUidBased(true);
+        job->setSequenceSet(KIMAP2::ImapSet(10));
+        job->setFlags(QList<QByteArray>() << "\\Seen");
+        job->setMode(KIMAP2::StoreJob::AppendFlags);
+        job->setAutoDelete(false);
+        QVERIFY(job->exec());
+        QCOMPARE(job->resultingFlags().value(10), KIMAP2::MessageFlags() << "\\Seen");
+        delete job;
+
+        //Sequence numbers aren't available, so this fails without asking the server
+        job = new KIMAP2::StoreJob(&session);
+        job->setSequenceSet(KIMAP2::ImapSet(1));
+        job->setFlags(QList<QByteArray>() << "\\Seen");
+        QVERIFY(!job->exec());
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
 };
 
 QTEST_GUILESS_MAIN(StoreJobTest)
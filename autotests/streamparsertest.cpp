@@ -25,6 +25,96 @@
 
 using namespace KIMAP2;
 
+/*
+ * A connection that is fed by the test, and keeps what is written to it.
+ */
+class DuplexDevice : public QIODevice
+{
+public:
+    DuplexDevice()
+    {
+        open(QIODevice::ReadWrite);
+    }
+
+    bool isSequential() const Q_DECL_OVERRIDE
+    {
+        return true;
+    }
+    qint64 bytesAvailable() const Q_DECL_OVERRIDE
+    {
+        return input.size() + QIODevice::bytesAvailable();
+    }
+    void feed(const QByteArray &data)
+    {
+        input += data;
+        emit readyRead();
+    }
+
+    QByteArray input;
+    QByteArray output;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) Q_DECL_OVERRIDE
+    {
+        const qint64 size = qMin(maxSize, qint64(input.size()));
+        memcpy(data, input.constData(), size);
+        input.remove(0, size);
+        return size;
+    }
+    qint64 writeData(const char *data, qint64 size) Q_DECL_OVERRIDE
+    {
+        output.append(data, size);
+        return size;
+    }
+};
+
+/*
+ * A handler that only picks the UIDs and literals out of FETCH responses.
+ */
+struct FetchUidHandler {
+    QList<qint64> uids;
+    QByteArray literal;
+    int lines = 0;
+    bool inList = false;
+    bool nextIsUid = false;
+
+    void string(const char *data, int size)
+    {
+        const QByteArray token = QByteArray::fromRawData(data, size);
+        if (nextIsUid) {
+            uids << token.toLongLong();
+            nextIsUid = false;
+        } else if (inList && token == "UID") {
+            nextIsUid = true;
+        }
+    }
+    void listStart()
+    {
+        inList = true;
+    }
+    void listEnd()
+    {
+        inList = false;
+    }
+    void sublistStart() {}
+    void sublistEnd() {}
+    void responseCodeStart() {}
+    void responseCodeEnd() {}
+    bool literalStart(qint64)
+    {
+        return true;
+    }
+    void literalPart(const char *data, int size)
+    {
+        literal.append(data, size);
+    }
+    void literalEnd(const QByteArray &) {}
+    void lineEnd()
+    {
+        lines++;
+    }
+};
+
 class StreamParserTest: public QObject
 {
     Q_OBJECT
@@ -109,6 +199,36 @@ private Q_SLOTS:
         QVERIFY(!parser.error());
     }
 
+    void testCounters()
+    {
+        QByteArray buffer("* 1 FETCH (UID 7 FLAGS (\\Seen) BODY[] {5}\r\nhello)\r\n");
+        QBuffer readSocket(&buffer);
+        readSocket.open(QBuffer::ReadOnly);
+        ImapStreamParser parser(&readSocket);
+        bool gotResponse = false;
+        parser.onResponseReceived([&gotResponse](const Message &) {
+            gotResponse = true;
+        });
+        parser.parseStream();
+        QVERIFY(gotResponse);
+
+        const ParserCounters &counters = parser.counters();
+        const qint64 stateBytes = counters.initBytes + counters.quotedStringBytes + counters.literalStringBytes
+                                  + counters.stringBytes + counters.whitespaceBytes + counters.angleBracketStringBytes
+                                  + counters.crlfBytes;
+        if (!ParserCounters::isEnabled()) {
+            QCOMPARE(stateBytes, qint64(0));
+            QCOMPARE(counters.reads, qint64(0));
+            return;
+        }
+        //Every byte is counted once, for the state that consumed it
+        QCOMPARE(stateBytes, qint64(buffer.size()));
+        QCOMPARE(counters.sublistBytes, qint64(7));
+        QVERIFY(counters.literalStringBytes >= 5);
+        QCOMPARE(counters.reads, qint64(1));
+        QCOMPARE(counters.smallReads, qint64(1));
+    }
+
     void testParseInPieces()
     {
         QByteArray buffer;
@@ -376,6 +496,598 @@ private Q_SLOTS:
         QVERIFY(!parser.error());
     }
 
+    void testParseLiteral8()
+    {
+        const QByteArray payload("a\0b\r\nc)", 7);
+        QByteArray buffer;
+        QBuffer socket(&buffer);
+        socket.open(QBuffer::WriteOnly);
+        QVERIFY(socket.write("* 11 FETCH (UID 123 BINARY[1] ~{7}\r\n" + payload + " FLAGS ())\r\n") != -1);
+
+        QBuffer readSocket(&buffer);
+        readSocket.open(QBuffer::ReadOnly);
+        ImapStreamParser parser(&readSocket);
+
+        QList<QByteArray> expectedList;
+        expectedList << "UID" << "123" << "BINARY[1]" << payload << "FLAGS" << "()";
+
+        bool gotResponse = false;
+        Message message;
+        parser.onResponseReceived([&gotResponse, &message](const Message &response) {
+            gotResponse = true;
+            message = response;
+        });
+        parser.parseStream();
+        QVERIFY(gotResponse);
+        QCOMPARE(message.content.last().toList(), expectedList);
+        QVERIFY(!parser.error());
+    }
+
+    void testParsePartialOrigin()
+    {
+        QByteArray buffer;
+        QBuffer socket(&buffer);
+        socket.open(QBuffer::WriteOnly);
+        QVERIFY(socket.write("* 11 FETCH (UID 123 BODY[1]<4> {4}\r\no Ja BODY[]<0> \"Hi\")\r\n") != -1);
+
+        QBuffer readSocket(&buffer);
+        readSocket.open(QBuffer::ReadOnly);
+        ImapStreamParser parser(&readSocket);
+
+        QList<QByteArray> expectedList;
+        expectedList << "UID" << "123" << "BODY[1]<4>" << "o Ja" << "BODY[]<0>" << "Hi";
+
+        bool gotResponse = false;
+        Message message;
+        parser.onResponseReceived([&gotResponse, &message](const Message &response) {
+            gotResponse = true;
+            message = response;
+        });
+        parser.parseStream();
+        QVERIFY(gotResponse);
+        QCOMPARE(message.content.last().toList(), expectedList);
+        QVERIFY(!parser.error());
+    }
+
+    void testParseLongTokens()
+    {
+        const QByteArray atom(100, 'a');
+        const QByteArray quoted = QByteArray(50, 'q') + "\\\"" + QByteArray(50, 'q');
+        QByteArray buffer;
+        QBuffer socket(&buffer);
+        socket.open(QBuffer::WriteOnly);
+        QVERIFY(socket.write("* 1 FETCH (" + atom + " \"" + quoted + "\" BODY[" + atom + "] (" + atom + " (" + atom + ")))\r\n") != -1);
+
+        QBuffer readSocket(&buffer);
+        readSocket.open(QBuffer::ReadOnly);
+        ImapStreamParser parser(&readSocket);
+
+        QList<QByteArray> expectedList;
+        expectedList << atom;
+        expectedList << quoted;
+        expectedList << "BODY[" + atom + "]";
+        expectedList << "(" + atom + " (" + atom + "))";
+
+        bool gotResponse = false;
+        Message message;
+        parser.onResponseReceived([&gotResponse, &message](const Message &response) {
+            gotResponse = true;
+            message = response;
+        });
+        parser.parseStream();
+        QVERIFY(gotResponse);
+        QCOMPARE(message.content.last().toList(), expectedList);
+        QVERIFY(parser.availableDataSize() == 0);
+        QVERIFY(!parser.error());
+    }
+
+    void testZeroCopy()
+    {
+        QByteArray buffer;
+        QBuffer socket(&buffer);
+        socket.open(QBuffer::WriteOnly);
+        QVERIFY(socket.write(completeMessage) != -1);
+
+        QBuffer readSocket(&buffer);
+        readSocket.open(QBuffer::ReadOnly);
+        ImapStreamParser parser(&readSocket);
+        parser.setZeroCopyEnabled(true);
+
+        bool gotResponse = false;
+        Message message;
+        parser.onResponseReceived([&gotResponse, &message](const Message &response) {
+            gotResponse = true;
+            message = response;
+        });
+        parser.parseStream();
+        QVERIFY(gotResponse);
+        QVERIFY(message.isBorrowed());
+        QCOMPARE(message.content.last().toList(), expectedList);
+
+        const Message detached = message.detached();
+        QVERIFY(!detached.isBorrowed());
+        QCOMPARE(detached.content.last().toList(), expectedList);
+        QVERIFY(!parser.error());
+    }
+
+    void testZeroCopyKeepsBuffersAlive()
+    {
+        QByteArray data;
+        const int count = 2000;
+        for (int i = 1; i <= count; i++) {
+            data += QString("* %1 FETCH (UID %2 FLAGS (\\Seen \\Answered))\r\n").arg(i).arg(i * 10).toLatin1();
+        }
+        QBuffer readSocket(&data);
+        readSocket.open(QBuffer::ReadOnly);
+        ImapStreamParser parser(&readSocket);
+        parser.setZeroCopyEnabled(true);
+
+        QList<Message> messages;
+        parser.onResponseReceived([&messages](const Message &response) {
+            messages << response;
+        });
+        while (parser.availableDataSize()) {
+            parser.parseStream();
+        }
+        QVERIFY(!parser.error());
+        QCOMPARE(messages.size(), count);
+        for (int i = 0; i < count; i++) {
+            const QList<QByteArray> list = messages.at(i).content.last().toList();
+            QCOMPARE(messages.at(i).content.at(1).toString(), QByteArray::number(i + 1));
+            QCOMPARE(list.at(1), QByteArray::number((i + 1) * 10));
+            QCOMPARE(list.at(3), QByteArray("(\\Seen \\Answered)"));
+        }
+    }
+
+    void testNestedListStructure()
+    {
+        QByteArray buffer;
+        QBuffer socket(&buffer);
+        socket.open(QBuffer::WriteOnly);
+        const QByteArray structure = "((\"TEXT\" \"PLAIN\" (\"CHARSET\" \"UTF-8\") NIL NIL \"7BIT\" 5 1 NIL NIL NIL)"
+                                     "(\"IMAGE\" \"PNG\" NIL NIL {4}\r\nlogo \"BASE64\" 42 NIL (\"ATTACHMENT\" (\"FILENAME\" \"a b.png\")) NIL) \"MIXED\")";
+        QVERIFY(socket.write("* 1 FETCH (UID 10 BODYSTRUCTURE " + structure + " FLAGS (\\Seen))\r\n") != -1);
+
+        QBuffer readSocket(&buffer);
+        readSocket.open(QBuffer::ReadOnly);
+        ImapStreamParser parser(&readSocket);
+
+        Message message;
+        parser.onResponseReceived([&](const Message &response) {
+            message = response;
+        });
+        parser.parseStream();
+        QVERIFY(!parser.error());
+
+        const Message::Part part = message.content.last();
+        // The nested lists are still available as sent
+        QCOMPARE(part.toList().at(3), structure);
+        QCOMPARE(part.toList().at(5), QByteArray("(\\Seen)"));
+        QVERIFY(!part.sublist(2).isList());
+
+        const Message::Node body = part.sublist(3);
+        QVERIFY(body.isList());
+        QCOMPARE(body.size(), 3);
+        QCOMPARE(body.stringAt(2), QByteArray("MIXED"));
+
+        const Message::Node text = body.at(0);
+        QCOMPARE(text.stringAt(0), QByteArray("TEXT"));
+        QCOMPARE(text.at(2).stringAt(1), QByteArray("UTF-8"));
+        QVERIFY(text.at(3).isNil());
+        QCOMPARE(text.stringAt(3), QByteArray());
+
+        const Message::Node image = body.at(1);
+        QCOMPARE(image.stringAt(4), QByteArray("logo"));
+        QCOMPARE(image.at(8).stringAt(0), QByteArray("ATTACHMENT"));
+        QCOMPARE(image.at(8).at(1).stringAt(1), QByteArray("a b.png"));
+
+        const Message::Node flags = part.sublist(5);
+        QCOMPARE(flags.size(), 1);
+        QCOMPARE(flags.stringAt(0), QByteArray("\\Seen"));
+    }
+
+    void testKeywords()
+    {
+        QByteArray buffer;
+        QBuffer socket(&buffer);
+        socket.open(QBuffer::WriteOnly);
+        QVERIFY(socket.write("* 3 FETCH (UID 10 RFC822.SIZE 42 X-GM-LABELS (\\Inbox) uid 7 BODY[] {3}\r\nUID)\r\n") != -1);
+        QVERIFY(socket.write("A1 OK [UIDNEXT 11] done\r\n") != -1);
+
+        QBuffer readSocket(&buffer);
+        readSocket.open(QBuffer::ReadOnly);
+        ImapStreamParser parser(&readSocket);
+
+        QList<Message> messages;
+        parser.onResponseReceived([&](const Message &response) {
+            messages << response;
+        });
+        parser.parseStream();
+        QVERIFY(!parser.error());
+        QCOMPARE(messages.size(), 2);
+
+        const Message fetch = messages.at(0);
+        QCOMPARE(fetch.content.at(0).keyword(), ImapKeyword::None);
+        QCOMPARE(fetch.content.at(2).keyword(), ImapKeyword::Fetch);
+        const Message::Part list = fetch.content.at(3);
+        QCOMPARE(list.keywordAt(0), ImapKeyword::Uid);
+        QCOMPARE(list.keywordAt(1), ImapKeyword::None);
+        QCOMPARE(list.keywordAt(2), ImapKeyword::Rfc822Size);
+        QCOMPARE(list.keywordAt(4), ImapKeyword::XGmLabels);
+        // Matching is exact, like the comparisons it replaces
+        QCOMPARE(list.keywordAt(6), ImapKeyword::None);
+        // Literals are never keywords
+        QCOMPARE(list.keywordAt(9), ImapKeyword::None);
+
+        const Message ok = messages.at(1);
+        QCOMPARE(ok.content.at(1).keyword(), ImapKeyword::Ok);
+        QCOMPARE(ok.responseCode.at(0).keyword(), ImapKeyword::UidNext);
+    }
+
+    void testTrafficObserver()
+    {
+        QByteArray buffer;
+        QBuffer socket(&buffer);
+        socket.open(QBuffer::WriteOnly);
+        const QByteArray literal(50000, 'x');
+        QVERIFY(socket.write("* 1 FETCH (UID 1 BODY[] {50000}\r\n" + literal + ")\r\n") != -1);
+        QVERIFY(socket.write("A1 OK fetch done\r\n") != -1);
+
+        QBuffer readSocket(&buffer);
+        readSocket.open(QBuffer::ReadOnly);
+        ImapStreamParser parser(&readSocket);
+        parser.setBufferSizeLimits(1000, 4000);
+
+        QByteArray traffic;
+        parser.setTrafficObserver([&](const char *data, int size) {
+            traffic.append(data, size);
+        });
+        int responses = 0;
+        parser.onResponseReceived([&](const Message &) {
+            responses++;
+        });
+        parser.parseStream();
+        QVERIFY(!parser.error());
+        QCOMPARE(responses, 2);
+        //Every byte is observed exactly once, including the literal read past the buffer
+        QCOMPARE(traffic, buffer);
+    }
+
+    void testPartHandoff()
+    {
+        QByteArray buffer("* 1 FETCH (UID 7 FLAGS (\\Seen))\r\n");
+        QBuffer readSocket(&buffer);
+        readSocket.open(QBuffer::ReadOnly);
+        ImapStreamParser parser(&readSocket);
+
+        Message message;
+        const QByteArray *listItem = Q_NULLPTR;
+        parser.onResponseReceived([&](const Message &response) {
+            //The accessors return references into the message itself
+            QCOMPARE(&response.content[3].toList(), &response.content[3].toList());
+            listItem = &response.content[3].toList().first();
+            message = response;
+        });
+        parser.parseStream();
+
+        //The list the parser built was handed to the message, not copied
+        QCOMPARE(&message.content[3].toList().first(), listItem);
+
+        Message::Part &part = message.content[3];
+        const QList<QByteArray> items = part.takeList();
+        QCOMPARE(items, QList<QByteArray>() << "UID" << "7" << "FLAGS" << "(\\Seen)");
+        QVERIFY(part.toList().isEmpty());
+        QVERIFY(!part.sublist(3).isList());
+        QCOMPARE(message.content[0].takeString(), QByteArray("*"));
+        QVERIFY(message.content[0].toString().isEmpty());
+    }
+
+    void testSpillLiteral()
+    {
+        QTemporaryDir directory;
+        QVERIFY(directory.isValid());
+        QByteArray buffer;
+        QBuffer socket(&buffer);
+        socket.open(QBuffer::WriteOnly);
+        const QByteArray literal(50000, 'x');
+        QVERIFY(socket.write("* 1 FETCH (UID 1 BODY[HEADER] {5}\r\nhello BODY[] {50000}\r\n" + literal + ")\r\n") != -1);
+
+        QBuffer readSocket(&buffer);
+        readSocket.open(QBuffer::ReadOnly);
+        ImapStreamParser parser(&readSocket);
+        parser.setBufferSizeLimits(1000, 4000);
+        parser.setSpillThreshold(1000, directory.path());
+
+        Message message;
+        QStringList files;
+        parser.onResponseReceived([&](const Message &response) {
+            message = response;
+            files = QDir(directory.path()).entryList(QDir::Files);
+        });
+        parser.parseStream();
+        QVERIFY(!parser.error());
+
+        //Only the large literal went to a file
+        QCOMPARE(files.size(), 1);
+        QCOMPARE(message.spilledLiterals.size(), 1);
+        QVERIFY(message.isBorrowed());
+        const QList<QByteArray> list = message.content.last().toList();
+        QCOMPARE(list.at(1), QByteArray("hello"));
+        QCOMPARE(list.at(3), literal);
+        QVERIFY(message.spilledLiteral(list.at(3)));
+        QVERIFY(!message.spilledLiteral(list.at(1)));
+        QCOMPARE(parser.literalBytesBuffered(), qint64(0));
+        QCOMPARE(parser.largestLiteral(), qint64(50000));
+
+        //The file is removed with the last message referencing it
+        const QByteArray copy = message.detached().content.last().toList().at(3);
+        message = Message();
+        QVERIFY(QDir(directory.path()).entryList(QDir::Files).isEmpty());
+        QCOMPARE(copy, literal);
+    }
+
+    void testServerMode()
+    {
+        DuplexDevice device;
+        ImapStreamParser parser(&device, true);
+        QVERIFY(parser.isServerModeEnabled());
+        QList<Message> commands;
+        parser.onResponseReceived([&commands](const Message &command) {
+            commands << command;
+        });
+
+        //The command arrives in pieces, each parsed as it comes
+        device.feed("A1 NOOP\r\nA2 LOGIN {3}\r\n");
+        parser.parseStream();
+        QCOMPARE(commands.size(), 1);
+        QCOMPARE(commands[0].content[1].toString(), QByteArray("NOOP"));
+        QVERIFY(device.output.startsWith("+ "));
+
+        //No continuation request for a non-synchronizing literal
+        device.output.clear();
+        device.feed("foo {3+}\r\nba");
+        parser.parseStream();
+        QCOMPARE(commands.size(), 1);
+        device.feed("r\r\n");
+        parser.parseStream();
+        QVERIFY(device.output.isEmpty());
+        QVERIFY(!parser.error());
+
+        QCOMPARE(commands.size(), 2);
+        QCOMPARE(commands[1].content.size(), 4);
+        QCOMPARE(commands[1].content[0].toString(), QByteArray("A2"));
+        QCOMPARE(commands[1].content[1].toString(), QByteArray("LOGIN"));
+        QCOMPARE(commands[1].content[2].toString(), QByteArray("foo"));
+        QCOMPARE(commands[1].content[3].toString(), QByteArray("bar"));
+    }
+
+    void testAdaptiveBufferSize()
+    {
+        QByteArray buffer;
+        QBuffer socket(&buffer);
+        socket.open(QBuffer::WriteOnly);
+        const int count = 5000;
+        for (int i = 1; i <= count; i++) {
+            QVERIFY(socket.write("* " + QByteArray::number(i) + " FETCH (UID " + QByteArray::number(i) + " FLAGS (\\Seen))\r\n") != -1);
+        }
+        //A token that is larger than the maximum buffer size
+        const QByteArray longAtom(100000, 'a');
+        QVERIFY(socket.write("* 1 FETCH (X-LONG " + longAtom + ")\r\n") != -1);
+
+        QBuffer readSocket(&buffer);
+        readSocket.open(QBuffer::ReadOnly);
+        ImapStreamParser parser(&readSocket);
+        parser.setBufferSizeLimits(1000, 64000);
+
+        int responses = 0;
+        QByteArray lastValue;
+        parser.onResponseReceived([&](const Message &response) {
+            responses++;
+            lastValue = response.content.last().toList().last();
+        });
+        parser.parseStream();
+        QCOMPARE(responses, count + 1);
+        QCOMPARE(lastValue, longAtom);
+        //Everything was available at once, so the buffer grew
+        QVERIFY(parser.bufferSize() >= 64000);
+        QVERIFY(parser.trimmedBytes() > 0);
+        QVERIFY(!parser.error());
+    }
+
+    void testTokenLimit()
+    {
+        QByteArray buffer;
+        QBuffer socket(&buffer);
+        socket.open(QBuffer::WriteOnly);
+        const QByteArray longAtom(1000000, 'a');
+        QVERIFY(socket.write("* 1 FETCH (X-LONG " + longAtom + " UID 5)\r\n") != -1);
+        QVERIFY(socket.write("* 2 FETCH (X-LONG \"" + longAtom + "\" UID 6 (" + longAtom + "))\r\n") != -1);
+        QVERIFY(socket.write("* 3 FETCH (UID 7)\r\n") != -1);
+
+        QBuffer readSocket(&buffer);
+        readSocket.open(QBuffer::ReadOnly);
+        ImapStreamParser parser(&readSocket);
+        parser.setBufferSizeLimits(1000, 64000);
+        ParseLimits limits;
+        limits.tokenSize = 1000;
+        QStringList reasons;
+        QList<QByteArray> droppedNumbers;
+        parser.setLimits(limits, [&](const Message &partial, const QString &reason) {
+            reasons << reason;
+            droppedNumbers << partial.content.at(1).toString();
+        });
+        QList<QByteArray> uids;
+        parser.onResponseReceived([&uids](const Message &response) {
+            uids << response.content.last().toList().value(1);
+        });
+        parser.parseStream();
+        QCOMPARE(uids, QList<QByteArray>() << "7");
+        QCOMPARE(droppedNumbers, QList<QByteArray>() << "1" << "2");
+        QCOMPARE(reasons.first(), QStringLiteral("a token of more than 1000 bytes"));
+        //The dropped tokens weren't kept, so they were hardly copied around
+        QVERIFY(parser.trimmedBytes() < longAtom.size() / 4);
+        QVERIFY(parser.bufferCapacity() < longAtom.size() / 4);
+        QVERIFY(!parser.error());
+    }
+
+    void testLiteralLimit()
+    {
+        QByteArray buffer;
+        QBuffer socket(&buffer);
+        socket.open(QBuffer::WriteOnly);
+        QVERIFY(socket.write("* 1 FETCH (UID 5 BODY[] {200000}\r\n" + QByteArray(200000, 'x') + " FLAGS (\\Seen))\r\n") != -1);
+        QVERIFY(socket.write("* 2 FETCH (UID 6 BODY[] {5}\r\nhello)\r\n") != -1);
+        QVERIFY(socket.write("* 3 FETCH (UID 7 BODY[] {4000000000}\r\n" + QByteArray(1000, 'y')) != -1);
+
+        QBuffer readSocket(&buffer);
+        readSocket.open(QBuffer::ReadOnly);
+        ImapStreamParser parser(&readSocket);
+        ParseLimits limits;
+        limits.literalSize = 100000;
+        QCOMPARE(parser.limits().literalSize, qint64(0));
+        QStringList reasons;
+        parser.setLimits(limits, [&reasons](const Message &, const QString &reason) {
+            reasons << reason;
+        });
+        QCOMPARE(parser.limits().literalSize, qint64(100000));
+        QList<Message> messages;
+        parser.onResponseReceived([&messages](const Message &response) {
+            messages << response;
+        });
+        parser.parseStream();
+        QCOMPARE(messages.size(), 1);
+        QCOMPARE(messages.first().content.last().toList().last(), QByteArray("hello"));
+        QCOMPARE(reasons, QStringList() << QStringLiteral("a literal of 200000 bytes"));
+        //The announced literal isn't allocated, and what arrives of it is dropped
+        QCOMPARE(parser.literalBytesPending(), qint64(4000000000LL - 1000));
+        QCOMPARE(parser.literalBytesBuffered(), qint64(0));
+        QVERIFY(parser.bufferCapacity() < 1000000);
+        QVERIFY(!parser.error());
+    }
+
+    void testLineLimit()
+    {
+        QByteArray line = "* SEARCH";
+        for (int i = 1; i <= 100; i++) {
+            line += ' ' + QByteArray::number(i);
+        }
+        QByteArray buffer(line + "\r\n* 5 EXISTS\r\n");
+        QBuffer readSocket(&buffer);
+        readSocket.open(QBuffer::ReadOnly);
+        ImapStreamParser parser(&readSocket);
+        ParseLimits limits;
+        limits.lineSize = 100;
+        QStringList reasons;
+        parser.setLimits(limits, [&reasons](const Message &, const QString &reason) {
+            reasons << reason;
+        });
+        QList<QByteArray> received;
+        parser.onResponseReceived([&received](const Message &response) {
+            received << response.content.at(2).toString();
+        });
+        parser.parseStream();
+        QCOMPARE(received, QList<QByteArray>() << "EXISTS");
+        QCOMPARE(reasons, QStringList() << QStringLiteral("a response of more than 100 bytes"));
+        QVERIFY(!parser.error());
+
+        //Without a handler it's an error
+        QByteArray otherBuffer(line + "\r\n");
+        QBuffer otherSocket(&otherBuffer);
+        otherSocket.open(QBuffer::ReadOnly);
+        ImapStreamParser strictParser(&otherSocket);
+        strictParser.setLimits(limits);
+        strictParser.onResponseReceived([](const Message &) {
+            QFAIL("Unexpected response");
+        });
+        strictParser.parseStream();
+        QVERIFY(strictParser.error());
+    }
+
+    void testReleaseIdleBuffers()
+    {
+        QByteArray buffer;
+        QBuffer socket(&buffer);
+        socket.open(QBuffer::WriteOnly);
+
+        QBuffer readSocket(&buffer);
+        readSocket.open(QBuffer::ReadOnly);
+        ImapStreamParser parser(&readSocket);
+        parser.setZeroCopyEnabled(true);
+        parser.setReleaseIdleBuffers(true);
+
+        QList<Message> messages;
+        parser.onResponseReceived([&messages](const Message &response) {
+            messages << response;
+        });
+        QVERIFY(socket.write("* 1 FETCH (UID 10 FLAGS (\\Seen))\r\n* 2 FE") != -1);
+        parser.parseStream();
+        QCOMPARE(messages.size(), 1);
+        //In the middle of a response the buffer stays
+        QVERIFY(parser.bufferCapacity() > 0);
+
+        QVERIFY(socket.write("TCH (UID 20 FLAGS (\\Seen))\r\n") != -1);
+        parser.parseStream();
+        QCOMPARE(messages.size(), 2);
+        QCOMPARE(parser.bufferCapacity(), qint64(0));
+
+        QVERIFY(socket.write("* 3 FETCH (UID 30 FLAGS ())\r\n") != -1);
+        parser.parseStream();
+        QCOMPARE(messages.size(), 3);
+        QCOMPARE(parser.bufferCapacity(), qint64(0));
+        //The borrowed data outlives the buffers
+        QCOMPARE(messages.at(0).content.last().toList().at(1), QByteArray("10"));
+        QCOMPARE(messages.at(1).content.last().toList().at(1), QByteArray("20"));
+        QVERIFY(!parser.error());
+    }
+
+    void testKeptPartsSurviveReuse()
+    {
+        QByteArray buffer;
+        QBuffer socket(&buffer);
+        socket.open(QBuffer::WriteOnly);
+        for (int i = 1; i <= 3; i++) {
+            QVERIFY(socket.write("* " + QByteArray::number(i) + " FETCH (UID " + QByteArray::number(i * 10) + " FLAGS (\\Seen))\r\n") != -1);
+        }
+
+        QBuffer readSocket(&buffer);
+        readSocket.open(QBuffer::ReadOnly);
+        ImapStreamParser parser(&readSocket);
+
+        QList<QByteArray> kept;
+        QList<QByteArray> uids;
+        parser.onResponseReceived([&](const Message &response) {
+            const QList<QByteArray> list = response.content.last().toList();
+            uids << list.at(1);
+            if (response.content.at(1).toString() == "2") {
+                kept = list;
+            }
+        });
+        parser.parseStream();
+        QCOMPARE(uids, QList<QByteArray>() << "10" << "20" << "30");
+        QCOMPARE(kept, QList<QByteArray>() << "UID" << "20" << "FLAGS" << "(\\Seen)");
+        QVERIFY(!parser.error());
+    }
+
+    void testCustomHandler()
+    {
+        QByteArray buffer;
+        QBuffer socket(&buffer);
+        socket.open(QBuffer::WriteOnly);
+        QVERIFY(socket.write(completeMessage + "* 231 FETCH (UID 231 FLAGS ())\r\n") != -1);
+
+        QBuffer readSocket(&buffer);
+        readSocket.open(QBuffer::ReadOnly);
+        ImapStreamParser parser(&readSocket);
+
+        FetchUidHandler handler;
+        parser.parseStream(handler);
+        QCOMPARE(handler.lines, 2);
+        QCOMPARE(handler.uids, QList<qint64>() << 230 << 231);
+        QCOMPARE(handler.literal, QByteArray("Date: Fri, 01 Nov 2013 12:31:13 +0000"));
+        QVERIFY(parser.availableDataSize() == 0);
+        QVERIFY(!parser.error());
+    }
+
     void testRecursiveParse()
     {
         QByteArray buffer;
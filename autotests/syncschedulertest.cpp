@@ -0,0 +1,173 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+#include <qtest.h>
+
+#include "kimap2test/fakeserver.h"
+#include "kimap2/bandwidthlimiter.h"
+#include "kimap2/expungejob.h"
+#include "kimap2/session.h"
+#include "kimap2/sessionpool.h"
+#include "kimap2/syncscheduler.h"
+
+#include <QtTest>
+
+using namespace KIMAP2;
+
+class SyncSchedulerTest: public QObject
+{
+    Q_OBJECT
+
+private:
+    static Job *expunge(Session *session)
+    {
+        ExpungeJob *job = new ExpungeJob(session);
+        job->setPriority(Job::BackgroundPriority);
+        return job;
+    }
+
+private Q_SLOTS:
+
+    void testReusesWarmSessions()
+    {
+        FakeServer fakeServer;
+        //The second task finds the mailbox selected
+        fakeServer.addScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 SELECT \"INBOX\""
+                               << "S: A000001 OK [READ-WRITE] SELECT completed"
+                               << "C: A000002 EXPUNGE"
+                               << "S: A000002 OK EXPUNGE completed"
+                               << "C: A000003 EXPUNGE"
+                               << "S: A000003 OK EXPUNGE completed"
+                              );
+        fakeServer.startAndWait();
+
+        SessionPool pool(QStringLiteral("127.0.0.1"), 5989, SessionPool::SessionSetup());
+        SyncScheduler scheduler;
+        scheduler.setBandwidthLimit(1024 * 1024);
+        int finished = 0;
+        connect(&scheduler, &SyncScheduler::taskFinished, [&finished](SessionPool *, const QString &, Job *job) {
+            QCOMPARE(job->error(), 0);
+            finished++;
+        });
+
+        scheduler.schedule(&pool, QStringLiteral("INBOX"), QDateTime(), expunge);
+        QTRY_COMPARE(finished, 1);
+        scheduler.schedule(&pool, QStringLiteral("INBOX"), QDateTime(), expunge);
+        QTRY_COMPARE(finished, 2);
+
+        QCOMPARE(pool.sessions().size(), 1);
+        QCOMPARE(pool.sessions().first()->bandwidthLimiter(), scheduler.bandwidthLimiter());
+        QCOMPARE(scheduler.pendingTasks(), 0);
+        QCOMPARE(scheduler.runningTasks(), 0);
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testStalestFirstWithinConnectionLimit()
+    {
+        FakeServer fakeServer;
+        fakeServer.addScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 SELECT \"Never\""
+                               << "S: A000001 OK [READ-WRITE] SELECT completed"
+                               << "C: A000002 EXPUNGE"
+                               << "S: A000002 OK EXPUNGE completed"
+                              );
+        //The idle session of the first account is closed for the second one
+        fakeServer.addScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 SELECT \"Recent\""
+                               << "S: A000001 OK [READ-WRITE] SELECT completed"
+                               << "C: A000002 EXPUNGE"
+                               << "S: A000002 OK EXPUNGE completed"
+                              );
+        fakeServer.startAndWait();
+
+        SessionPool recentAccount(QStringLiteral("127.0.0.1"), 5989, SessionPool::SessionSetup());
+        SessionPool staleAccount(QStringLiteral("127.0.0.1"), 5989, SessionPool::SessionSetup());
+        SyncScheduler scheduler;
+        scheduler.setMaximumConnections(1);
+
+        QStringList started;
+        int maximumConnections = 0;
+        connect(&scheduler, &SyncScheduler::taskStarted, [&](SessionPool *, const QString &mailBox, Job *) {
+            started << mailBox;
+            maximumConnections = qMax(maximumConnections, scheduler.connectionCount());
+        });
+        bool idle = false;
+        connect(&scheduler, &SyncScheduler::idle, [&idle]() {
+            idle = true;
+        });
+
+        scheduler.schedule(&recentAccount, QStringLiteral("Recent"), QDateTime::currentDateTime(), expunge);
+        scheduler.schedule(&staleAccount, QStringLiteral("Never"), QDateTime(), expunge);
+        QCOMPARE(scheduler.pendingTasks(), 2);
+
+        QTRY_VERIFY(idle);
+        QCOMPARE(started, QStringList() << QStringLiteral("Never") << QStringLiteral("Recent"));
+        QCOMPARE(maximumConnections, 1);
+        QCOMPARE(staleAccount.sessions().size(), 0);
+        QCOMPARE(recentAccount.sessions().size(), 1);
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testHandshakeRate()
+    {
+        FakeServer fakeServer;
+        for (int i = 0; i < 2; ++i) {
+            fakeServer.addScenario(QList<QByteArray>()
+                                   << FakeServer::preauth()
+                                   << "C: A000001 SELECT \"INBOX\""
+                                   << "S: A000001 OK [READ-WRITE] SELECT completed"
+                                   << "C: A000002 EXPUNGE"
+                                   << "S: A000002 OK EXPUNGE completed"
+                                  );
+        }
+        fakeServer.startAndWait();
+
+        SessionPool first(QStringLiteral("127.0.0.1"), 5989, SessionPool::SessionSetup());
+        SessionPool second(QStringLiteral("127.0.0.1"), 5989, SessionPool::SessionSetup());
+        SyncScheduler scheduler;
+        scheduler.setHandshakeRate(1);
+
+        QElapsedTimer timer;
+        QList<qint64> startTimes;
+        connect(&scheduler, &SyncScheduler::taskStarted, [&](SessionPool *, const QString &, Job *) {
+            startTimes << timer.elapsed();
+        });
+
+        timer.start();
+        scheduler.schedule(&first, QStringLiteral("INBOX"), QDateTime(), expunge);
+        scheduler.schedule(&second, QStringLiteral("INBOX"), QDateTime(), expunge);
+        QTRY_COMPARE(startTimes.size(), 1);
+        QCOMPARE(scheduler.pendingTasks(), 1);
+        QTRY_COMPARE_WITH_TIMEOUT(startTimes.size(), 2, 3000);
+        QVERIFY(startTimes.at(1) - startTimes.at(0) >= 900);
+        QTRY_COMPARE(scheduler.runningTasks(), 0);
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+};
+
+QTEST_GUILESS_MAIN(SyncSchedulerTest)
+
+#include "syncschedulertest.moc"
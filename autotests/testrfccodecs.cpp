@@ -24,6 +24,9 @@
 QTEST_GUILESS_MAIN(RFCCodecsTest)
 
 #include "rfccodecs.h"
+
+#include <cstring>
+
 using namespace KIMAP2;
 
 void RFCCodecsTest::testIMAPEncoding()
@@ -65,6 +68,307 @@ void RFCCodecsTest::testIMAPEncoding()
     // With UTF8 characters
     bEncoded = "INBOX/&AOQ- &APY- &APw- @ &IKw-";
     QCOMPARE(decodeImapFolderName(bEncoded), QByteArray("INBOX/ä ö ü @ €"));
+
+    // Outside the basic plane
+    QCOMPARE(encodeImapFolderName(QByteArray("Ablage \xf0\x9f\x93\x81")), QByteArray("Ablage &2D3cwQ-"));
+    QCOMPARE(decodeImapFolderName(QByteArray("Ablage &2D3cwQ-")), QByteArray("Ablage \xf0\x9f\x93\x81"));
+
+    // Quoted, also when nothing else needs encoding
+    QCOMPARE(encodeImapFolderName(QByteArray("Tom \"Allen\" \\ Jerry")), QByteArray("Tom \\\"Allen\\\" \\\\ Jerry"));
+    QCOMPARE(encodeImapFolderName(QStringLiteral("tom\"allen")), QStringLiteral("tom\\\"allen"));
+    QCOMPARE(encodeImapFolderName(QString::fromUtf8("\"Rønning\"")), QStringLiteral("\\\"R&APg-nning\\\""));
+
+    // Control characters, and a '&' without anything to decode
+    QCOMPARE(encodeImapFolderName(QByteArray("a\tb")), QByteArray("a&AAk-b"));
+    QCOMPARE(decodeImapFolderName(QByteArray("a&AAk-b")), QByteArray("a\tb"));
+    QCOMPARE(decodeImapFolderName(QByteArray("tom&")), QByteArray("tom"));
+}
+
+void RFCCodecsTest::testRFC2047_data()
+{
+    QTest::addColumn<QString>("encoded");
+    QTest::addColumn<QString>("decoded");
+    QTest::addColumn<QString>("charset");
+    QTest::addColumn<QString>("language");
+
+    QTest::newRow("plain") << QStringLiteral("Re: your mail") << QStringLiteral("Re: your mail") << QString() << QString();
+    QTest::newRow("quoted-printable") << QStringLiteral("=?iso-8859-1?q?Andr=E9?= Pirard")
+                                      << QString::fromUtf8("André Pirard") << QStringLiteral("iso-8859-1") << QString();
+    QTest::newRow("base64") << QStringLiteral("=?UTF-8?B?w6TDtsO8?=")
+                            << QString::fromUtf8("äöü") << QStringLiteral("UTF-8") << QString();
+    QTest::newRow("language") << QStringLiteral("=?utf-8*de?Q?Gr=C3=BC=C3=9Fe_aus?= Berlin")
+                              << QString::fromUtf8("Grüße aus Berlin") << QStringLiteral("utf-8") << QStringLiteral("de");
+    QTest::newRow("unterminated") << QStringLiteral("Hello =?bogus") << QStringLiteral("Hello =?bogus") << QString() << QString();
+}
+
+void RFCCodecsTest::testRFC2047()
+{
+    QFETCH(QString, encoded);
+    QFETCH(QString, decoded);
+    QFETCH(QString, charset);
+    QFETCH(QString, language);
+
+    QString foundCharset;
+    QString foundLanguage;
+    // Twice, the second time with the cached codec
+    for (int i = 0; i < 2; ++i) {
+        QCOMPARE(decodeRFC2047String(encoded, foundCharset, foundLanguage), decoded);
+        QCOMPARE(foundCharset, charset);
+        QCOMPARE(foundLanguage, language);
+    }
+}
+
+// The codec before the table driven one, as the reference for benchmarkFolderNames()
+static const unsigned char referenceBase64chars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+,";
+#define UNDEFINED 64
+#define UTF16MASK       0x03FFUL
+#define UTF16SHIFT      10
+#define UTF16BASE       0x10000UL
+#define UTF16HIGHSTART  0xD800UL
+#define UTF16HIGHEND    0xDBFFUL
+#define UTF16LOSTART    0xDC00UL
+#define UTF16LOEND      0xDFFFUL
+
+static bool referenceIsPrintableAscii(const QByteArray &src)
+{
+    for (const char c : src) {
+        if (c < ' ' || c > '~' || c == '&' || c == '"' || c == '\\') {
+            return false;
+        }
+    }
+    return true;
+}
+
+static QByteArray referenceDecodeImapFolderName(const QByteArray &inSrc)
+{
+    unsigned char c, i, bitcount;
+    unsigned long ucs4, utf16, bitbuf;
+    unsigned char base64[256], utf8[6];
+    unsigned int srcPtr = 0;
+    QByteArray dst;
+    QByteArray src = inSrc;
+    uint srcLen = inSrc.length();
+
+    /* everything but '&' is copied literally, so most names come back unchanged */
+    if (!inSrc.contains('&')) {
+        return inSrc;
+    }
+
+    /* initialize modified base64 decoding table */
+    memset(base64, UNDEFINED, sizeof(base64));
+    for (i = 0; i < sizeof(referenceBase64chars); ++i) {
+        base64[(int)referenceBase64chars[i]] = i;
+    }
+
+    /* loop until end of string */
+    while (srcPtr < srcLen) {
+        c = src[srcPtr++];
+        /* deal with literal characters and &- */
+        if (c != '&' || src[srcPtr] == '-') {
+            /* encode literally */
+            dst += c;
+            /* skip over the '-' if this is an &- sequence */
+            if (c == '&') {
+                srcPtr++;
+            }
+        } else {
+            /* convert modified UTF-7 -> UTF-16 -> UCS-4 -> UTF-8 -> HEX */
+            bitbuf = 0;
+            bitcount = 0;
+            ucs4 = 0;
+            while ((c = base64[(unsigned char)src[srcPtr]]) != UNDEFINED) {
+                ++srcPtr;
+                bitbuf = (bitbuf << 6) | c;
+                bitcount += 6;
+                /* enough bits for a UTF-16 character? */
+                if (bitcount >= 16) {
+                    bitcount -= 16;
+                    utf16 = (bitcount ? bitbuf >> bitcount : bitbuf) & 0xffff;
+                    /* convert UTF16 to UCS4 */
+                    if (utf16 >= UTF16HIGHSTART && utf16 <= UTF16HIGHEND) {
+                        ucs4 = (utf16 - UTF16HIGHSTART) << UTF16SHIFT;
+                        continue;
+                    } else if (utf16 >= UTF16LOSTART && utf16 <= UTF16LOEND) {
+                        ucs4 += utf16 - UTF16LOSTART + UTF16BASE;
+                    } else {
+                        ucs4 = utf16;
+                    }
+                    /* convert UTF-16 range of UCS4 to UTF-8 */
+                    if (ucs4 <= 0x7fUL) {
+                        utf8[0] = ucs4;
+                        i = 1;
+                    } else if (ucs4 <= 0x7ffUL) {
+                        utf8[0] = 0xc0 | (ucs4 >> 6);
+                        utf8[1] = 0x80 | (ucs4 & 0x3f);
+                        i = 2;
+                    } else if (ucs4 <= 0xffffUL) {
+                        utf8[0] = 0xe0 | (ucs4 >> 12);
+                        utf8[1] = 0x80 | ((ucs4 >> 6) & 0x3f);
+                        utf8[2] = 0x80 | (ucs4 & 0x3f);
+                        i = 3;
+                    } else {
+                        utf8[0] = 0xf0 | (ucs4 >> 18);
+                        utf8[1] = 0x80 | ((ucs4 >> 12) & 0x3f);
+                        utf8[2] = 0x80 | ((ucs4 >> 6) & 0x3f);
+                        utf8[3] = 0x80 | (ucs4 & 0x3f);
+                        i = 4;
+                    }
+                    /* copy it */
+                    for (c = 0; c < i; ++c) {
+                        dst += utf8[c];
+                    }
+                }
+            }
+            /* skip over trailing '-' in modified UTF-7 encoding */
+            if (src[srcPtr] == '-') {
+                ++srcPtr;
+            }
+        }
+    }
+    return dst;
+}
+
+static QByteArray referenceEncodeImapFolderName(const QByteArray &inSrc)
+{
+    unsigned int utf8pos, utf8total, c, utf7mode, bitstogo, utf16flag;
+    unsigned int ucs4, bitbuf;
+    if (referenceIsPrintableAscii(inSrc)) {
+        return inSrc;
+    }
+
+    QByteArray src = inSrc;
+    QByteArray dst;
+
+    int srcPtr = 0;
+    utf7mode = 0;
+    utf8total = 0;
+    bitstogo = 0;
+    utf8pos = 0;
+    bitbuf = 0;
+    ucs4 = 0;
+    while (srcPtr < src.length()) {
+        c = (unsigned char)src[srcPtr++];
+        /* normal character? */
+        if (c >= ' ' && c <= '~') {
+            /* switch out of UTF-7 mode */
+            if (utf7mode) {
+                if (bitstogo) {
+                    dst += referenceBase64chars[(bitbuf << (6 - bitstogo)) & 0x3F];
+                    bitstogo = 0;
+                }
+                dst += '-';
+                utf7mode = 0;
+            }
+            dst += c;
+            /* encode '&' as '&-' */
+            if (c == '&') {
+                dst += '-';
+            }
+            continue;
+        }
+        /* switch to UTF-7 mode */
+        if (!utf7mode) {
+            dst += '&';
+            utf7mode = 1;
+        }
+        /* Encode US-ASCII characters as themselves */
+        if (c < 0x80) {
+            ucs4 = c;
+            utf8total = 1;
+        } else if (utf8total) {
+            /* save UTF8 bits into UCS4 */
+            ucs4 = (ucs4 << 6) | (c & 0x3FUL);
+            if (++utf8pos < utf8total) {
+                continue;
+            }
+        } else {
+            utf8pos = 1;
+            if (c < 0xE0) {
+                utf8total = 2;
+                ucs4 = c & 0x1F;
+            } else if (c < 0xF0) {
+                utf8total = 3;
+                ucs4 = c & 0x0F;
+            } else {
+                /* NOTE: can't convert UTF8 sequences longer than 4 */
+                utf8total = 4;
+                ucs4 = c & 0x03;
+            }
+            continue;
+        }
+        /* loop to split ucs4 into two utf16 chars if necessary */
+        utf8total = 0;
+        do {
+            if (ucs4 >= UTF16BASE) {
+                ucs4 -= UTF16BASE;
+                bitbuf =
+                    (bitbuf << 16) | ((ucs4 >> UTF16SHIFT) + UTF16HIGHSTART);
+                ucs4 = (ucs4 & UTF16MASK) + UTF16LOSTART;
+                utf16flag = 1;
+            } else {
+                bitbuf = (bitbuf << 16) | ucs4;
+                utf16flag = 0;
+            }
+            bitstogo += 16;
+            /* spew out base64 */
+            while (bitstogo >= 6) {
+                bitstogo -= 6;
+                dst +=
+                    referenceBase64chars[(bitstogo ? (bitbuf >> bitstogo) : bitbuf) & 0x3F];
+            }
+        } while (utf16flag);
+    }
+    /* if in UTF-7 mode, finish in ASCII */
+    if (utf7mode) {
+        if (bitstogo) {
+            dst += referenceBase64chars[(bitbuf << (6 - bitstogo)) & 0x3F];
+        }
+        dst += '-';
+    }
+    return quoteIMAP(dst);
+}
+
+void RFCCodecsTest::benchmarkFolderNames_data()
+{
+    QTest::addColumn<QByteArray>("name");
+    QTest::addColumn<bool>("reference");
+
+    const QByteArray ascii("INBOX/Archives/2016/Mailing Lists/kde-pim");
+    const QByteArray utf8("INBOX/Archiv/2016/Entw\xc3\xbcrfe f\xc3\xbcr M\xc3\xa4rz");
+    QTest::newRow("ascii") << ascii << false;
+    QTest::newRow("ascii/reference") << ascii << true;
+    QTest::newRow("utf-8") << utf8 << false;
+    QTest::newRow("utf-8/reference") << utf8 << true;
+}
+
+void RFCCodecsTest::benchmarkFolderNames()
+{
+    QFETCH(QByteArray, name);
+    QFETCH(bool, reference);
+
+    const QByteArray encoded = encodeImapFolderName(name);
+    QCOMPARE(referenceEncodeImapFolderName(name), encoded);
+    QCOMPARE(decodeImapFolderName(encoded), name);
+    QCOMPARE(referenceDecodeImapFolderName(encoded), name);
+    if (reference) {
+        QBENCHMARK {
+            referenceDecodeImapFolderName(referenceEncodeImapFolderName(name));
+        }
+    } else {
+        QBENCHMARK {
+            decodeImapFolderName(encodeImapFolderName(name));
+        }
+    }
+}
+
+void RFCCodecsTest::benchmarkRFC2047()
+{
+    const QString subject = QStringLiteral("Re: =?utf-8?Q?Gr=C3=BC=C3=9Fe?= =?utf-8?B?YXVzIELDpHJsaW4=?=");
+    QCOMPARE(decodeRFC2047String(subject), QString::fromUtf8("Re: Grüße aus Bärlin"));
+    QBENCHMARK {
+        decodeRFC2047String(subject);
+    }
 }
 
 void RFCCodecsTest::testQuotes()
@@ -76,3 +380,56 @@ void RFCCodecsTest::testQuotes()
     test =  QStringLiteral("tom\\allen");
     QCOMPARE(quoteIMAP(test), QString::fromLatin1("tom\\\\allen"));
 }
+
+void RFCCodecsTest::testImapDateTime_data()
+{
+    QTest::addColumn<QByteArray>("dateTime");
+    QTest::addColumn<bool>("valid");
+    QTest::addColumn<qint64>("seconds");
+
+    QTest::newRow("RFC 3501 example") << QByteArray("17-Jul-1996 02:44:25 -0700") << true << qint64(837596665);
+    QTest::newRow("space padded day") << QByteArray(" 1-Nov-2013 13:31:17 +0100") << true << qint64(1383309077);
+    QTest::newRow("single digit day") << QByteArray("1-Nov-2013 13:31:17 +0100") << true << qint64(1383309077);
+    QTest::newRow("lower case month") << QByteArray("11-oct-2010 03:33:50 +0100") << true << qint64(1286764430);
+    QTest::newRow("leap day") << QByteArray("29-Feb-2000 23:59:59 +0000") << true << qint64(951868799);
+    QTest::newRow("epoch") << QByteArray("01-Jan-1970 00:00:00 +0000") << true << qint64(0);
+    QTest::newRow("bad month") << QByteArray("11-Foo-2010 03:33:50 +0100") << false << qint64(0);
+    QTest::newRow("no zone") << QByteArray("11-Oct-2010 03:33:50") << false << qint64(0);
+    QTest::newRow("RFC 2822") << QByteArray("Mon, 11 Oct 2010 03:33:50 +0100") << false << qint64(0);
+    QTest::newRow("empty") << QByteArray() << false << qint64(0);
+}
+
+void RFCCodecsTest::testImapDateTime()
+{
+    QFETCH(QByteArray, dateTime);
+    QFETCH(bool, valid);
+    QFETCH(qint64, seconds);
+
+    bool ok;
+    QCOMPARE(parseImapDateTime(dateTime, &ok), seconds);
+    QCOMPARE(ok, valid);
+}
+
+void RFCCodecsTest::testCrlfToLf_data()
+{
+    QTest::addColumn<QByteArray>("input");
+    QTest::addColumn<QByteArray>("output");
+
+    QTest::newRow("message") << QByteArray("Subject: foo\r\n\r\nbar\r\n") << QByteArray("Subject: foo\n\nbar\n");
+    QTest::newRow("lone CR") << QByteArray("a\rb\r\nc\r") << QByteArray("a\rb\nc\r");
+    QTest::newRow("CR before CRLF") << QByteArray("a\r\r\nb") << QByteArray("a\r\nb");
+    QTest::newRow("LF only") << QByteArray("a\nb\n") << QByteArray("a\nb\n");
+    QTest::newRow("empty") << QByteArray() << QByteArray();
+}
+
+void RFCCodecsTest::testCrlfToLf()
+{
+    QFETCH(QByteArray, input);
+    QFETCH(QByteArray, output);
+
+    const QByteArray converted = crlfToLf(input);
+    QCOMPARE(converted, output);
+    if (!input.contains("\r\n")) {
+        QCOMPARE(converted.constData(), input.constData());
+    }
+}
@@ -30,6 +30,15 @@ class RFCCodecsTest : public QObject
 private Q_SLOTS:
     void testIMAPEncoding();
     void testQuotes();
+    void testRFC2047_data();
+    void testRFC2047();
+    void benchmarkFolderNames_data();
+    void benchmarkFolderNames();
+    void benchmarkRFC2047();
+    void testImapDateTime_data();
+    void testImapDateTime();
+    void testCrlfToLf_data();
+    void testCrlfToLf();
 };
 
 #endif
@@ -25,14 +25,70 @@
 #include <QtCore/QObject>
 #include <QtTest/QtTest>
 
+#include <cstring>
+#include <numeric>
+
 #include "session.h"
 #include "job.h"
+#include "fetchjob.h"
+#include "loginjob.h"
+#include "searchjob.h"
+#include "selectjob.h"
+#include "transport.h"
 #include "kimap2test/fakeserver.h"
+#include "kimap2test/loadserver.h"
 #include "kimap2test/mockjob.h"
 
 Q_DECLARE_METATYPE(KIMAP2::Session::State)
 Q_DECLARE_METATYPE(KJob *)
 
+class RecordingObserver : public KIMAP2::SessionObserver
+{
+public:
+    RecordingObserver() : bytesRead(0), bytesWritten(0) { }
+
+    void jobEnqueued(KIMAP2::Job *) Q_DECL_OVERRIDE
+    {
+        events << "enqueued";
+    }
+    void jobStarted(KIMAP2::Job *) Q_DECL_OVERRIDE
+    {
+        events << "started";
+    }
+    void commandSent(const QByteArray &tag, const QByteArray &command, qint64 bytes) Q_DECL_OVERRIDE
+    {
+        events << "sent " + tag + ' ' + command + ' ' + QByteArray::number(bytes);
+    }
+    void firstResponseByte(const QByteArray &tag) Q_DECL_OVERRIDE
+    {
+        events << "first byte " + tag;
+    }
+    void commandCompleted(const QByteArray &tag, const QByteArray &command, const QByteArray &status) Q_DECL_OVERRIDE
+    {
+        events << "completed " + tag + ' ' + command + ' ' + status;
+    }
+    void literalStarted(qint64 size) Q_DECL_OVERRIDE
+    {
+        events << "literal started " + QByteArray::number(size);
+    }
+    void literalFinished(qint64 size) Q_DECL_OVERRIDE
+    {
+        events << "literal finished " + QByteArray::number(size);
+    }
+    void dataRead(qint64 bytes) Q_DECL_OVERRIDE
+    {
+        bytesRead += bytes;
+    }
+    void dataWritten(qint64 bytes) Q_DECL_OVERRIDE
+    {
+        bytesWritten += bytes;
+    }
+
+    QList<QByteArray> events;
+    qint64 bytesRead;
+    qint64 bytesWritten;
+};
+
 class SessionTest : public QObject
 {
     Q_OBJECT
@@ -42,6 +98,8 @@ private Q_SLOTS:
     void initTestCase()
     {
         qRegisterMetaType<KIMAP2::Session::State>();
+        qRegisterMetaType<KIMAP2::ImapSet>();
+        qRegisterMetaType<QList<QByteArray> >();
     }
 
     void shouldStartDisconnected()
@@ -216,6 +274,33 @@ private Q_SLOTS:
         QCOMPARE(queueSpy.at(3).at(0).toInt(), 0);
     }
 
+    void shouldAddJobsAtOnce()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::greeting()
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session s(QStringLiteral("127.0.0.1"), 5989);
+
+        QSignalSpy queueSpy(&s, SIGNAL(jobQueueSizeChanged(int)));
+
+        QList<KIMAP2::Job *> jobs;
+        for (int i = 0; i < 4; ++i) {
+            jobs << new MockJob(&s);
+        }
+        connect(jobs.last(), SIGNAL(result(KJob*)), &m_eventLoop, SLOT(quit()));
+
+        s.addJobs(jobs);
+        QCOMPARE(s.jobQueueSize(), 4);
+        QCOMPARE(queueSpy.size(), 1);
+        QCOMPARE(queueSpy.at(0).at(0).toInt(), 4);
+
+        m_eventLoop.exec();
+        QCOMPARE(s.jobQueueSize(), 0);
+    }
+
     void shouldTimeoutOnNoReply()
     {
         FakeServer fakeServer;
@@ -328,6 +413,224 @@ private Q_SLOTS:
         delete mock;
     }
 
+    void shouldRaceAddresses()
+    {
+#if QT_VERSION < QT_VERSION_CHECK(5, 4, 0)
+        QSKIP("Connection racing requires Qt 5.4");
+#endif
+        LoadServer::Options options;
+        options.port = 0;
+        options.messages = 1;
+        LoadServer server(options);
+        QVERIFY(server.startAndWait());
+
+        KIMAP2::Session::setConnectionRacingEnabled(true);
+        QVERIFY(KIMAP2::Session::isConnectionRacingEnabled());
+        QCOMPARE(KIMAP2::Session::hostLookupCacheTimeout(), 300);
+
+        //localhost may well have an IPv6 address, which the server doesn't listen on
+        {
+            KIMAP2::Session session(QStringLiteral("localhost"), server.port());
+            KIMAP2::SelectJob *select = new KIMAP2::SelectJob(&session);
+            select->setMailBox(QStringLiteral("INBOX"));
+            QVERIFY(select->exec());
+        }
+        const int connections = server.connectionCount();
+
+        //The address that won is used right away
+        {
+            KIMAP2::Session session(QStringLiteral("localhost"), server.port());
+            KIMAP2::SelectJob *select = new KIMAP2::SelectJob(&session);
+            select->setMailBox(QStringLiteral("INBOX"));
+            QVERIFY(select->exec());
+        }
+        QCOMPARE(server.connectionCount(), connections + 1);
+
+        KIMAP2::Session::setConnectionRacingEnabled(false);
+    }
+
+    void shouldConnectThroughTransport()
+    {
+#ifndef Q_OS_UNIX
+        QSKIP("Transports require a Unix system");
+#endif
+        LoadServer::Options options;
+        options.port = 0;
+        options.messages = 5;
+        LoadServer server(options);
+        QVERIFY(server.startAndWait());
+
+        QSharedPointer<KIMAP2::Transport> transport(new KIMAP2::SocketPairTransport([&server](qintptr descriptor) {
+            server.addConnection(descriptor);
+        }));
+        KIMAP2::Session session(transport);
+        QCOMPARE(session.hostName(), QStringLiteral("localhost"));
+        QCOMPARE(session.port(), quint16(0));
+
+        KIMAP2::SelectJob *select = new KIMAP2::SelectJob(&session);
+        select->setMailBox(QStringLiteral("INBOX"));
+        QVERIFY(select->exec());
+        QCOMPARE(select->messageCount(), 5);
+        QCOMPARE(server.connectionCount(), 1);
+    }
+
+    void shouldKillServerProcessesThatDontExit()
+    {
+#ifndef Q_OS_UNIX
+        QSKIP("Transports require a Unix system");
+#endif
+        //Ignores the end of its input
+        QSharedPointer<KIMAP2::ProcessTransport> transport(new KIMAP2::ProcessTransport(QStringLiteral("/bin/sh"),
+                QStringList() << QStringLiteral("-c") << QStringLiteral("printf '* PREAUTH ready\\r\\n'; exec sleep 60")));
+        QElapsedTimer timer;
+        {
+            KIMAP2::Session session(transport);
+            QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+            timer.start();
+        }
+        transport.reset();
+        QVERIFY(timer.elapsed() < 5000);
+    }
+
+    void shouldConnectThroughEpollTransport()
+    {
+#ifndef Q_OS_LINUX
+        QSKIP("The epoll transport requires Linux");
+#endif
+        LoadServer::Options options;
+        options.port = 0;
+        options.messages = 20;
+        //Larger than the buffers of the relay
+        options.bodySize = 100 * 1024;
+        LoadServer server(options);
+        QVERIFY(server.startAndWait());
+
+        QSharedPointer<KIMAP2::EpollTransport> transport(new KIMAP2::EpollTransport(QStringLiteral("127.0.0.1"), server.port()));
+        {
+            KIMAP2::Session session(transport);
+            QCOMPARE(session.hostName(), QStringLiteral("127.0.0.1"));
+
+            KIMAP2::SelectJob *select = new KIMAP2::SelectJob(&session);
+            select->setMailBox(QStringLiteral("INBOX"));
+            QVERIFY(select->exec());
+            QCOMPARE(select->messageCount(), 20);
+
+            KIMAP2::FetchJob::FetchScope scope;
+            scope.mode = KIMAP2::FetchJob::FetchScope::Content;
+            KIMAP2::FetchJob *fetch = new KIMAP2::FetchJob(&session);
+            fetch->setSequenceSet(KIMAP2::ImapSet(1, 20));
+            fetch->setScope(scope);
+            fetch->setRawResults(true);
+            int fetched = 0;
+            connect(fetch, &KIMAP2::FetchJob::resultReceived, [&fetched, &options](const KIMAP2::FetchJob::Result &result) {
+                if (result.rawContent.size() >= options.bodySize) {
+                    fetched++;
+                }
+            });
+            QVERIFY(fetch->exec());
+            QCOMPARE(fetched, 20);
+            QCOMPARE(transport->connectionCount(), 1);
+        }
+        //The relay goes away with the session
+        QTRY_COMPARE(transport->connectionCount(), 0);
+    }
+
+    void shouldFailThroughEpollTransportWithoutServer()
+    {
+#ifndef Q_OS_LINUX
+        QSKIP("The epoll transport requires Linux");
+#endif
+        quint16 port = 0;
+        {
+            LoadServer::Options options;
+            options.port = 0;
+            LoadServer server(options);
+            QVERIFY(server.startAndWait());
+            port = server.port();
+        }
+
+        QSharedPointer<KIMAP2::EpollTransport> transport(new KIMAP2::EpollTransport(QStringLiteral("127.0.0.1"), port));
+        KIMAP2::Session session(transport);
+        KIMAP2::SelectJob *select = new KIMAP2::SelectJob(&session);
+        select->setMailBox(QStringLiteral("INBOX"));
+        QVERIFY(!select->exec());
+        QTRY_COMPARE(transport->connectionCount(), 0);
+
+        //A host that can't be resolved fails the same way
+        QSharedPointer<KIMAP2::EpollTransport> unresolved(new KIMAP2::EpollTransport(QStringLiteral("host.invalid"), port));
+        KIMAP2::Session unresolvedSession(unresolved);
+        select = new KIMAP2::SelectJob(&unresolvedSession);
+        select->setMailBox(QStringLiteral("INBOX"));
+        QVERIFY(!select->exec());
+        QCOMPARE(unresolved->connectionCount(), 0);
+    }
+
+    void shouldApplySocketOptions()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                                << FakeServer::preauth()
+                                << "C: A000001 DUMMY"
+                                << "S: A000001 OK DUMMY completed"
+                                );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session s(QStringLiteral("127.0.0.1"), 5989);
+        KIMAP2::SocketOptions options;
+        QVERIFY(options.keepAlive);
+        QVERIFY(!options.lowDelay);
+        options.lowDelay = true;
+        options.receiveBufferSize = 256 * 1024;
+        options.keepAliveIdle = 30;
+        options.keepAliveInterval = 5;
+        options.keepAliveCount = 3;
+        s.setSocketOptions(options);
+        QCOMPARE(s.socketOptions().receiveBufferSize, 256 * 1024);
+        QVERIFY(s.socketOptions().lowDelay);
+
+        MockJob *mock = new MockJob(&s);
+        mock->setCommand("DUMMY");
+        QVERIFY(mock->exec());
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void shouldRecoverFromMalformedResponse()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                                << FakeServer::preauth()
+                                << "C: A000001 DUMMY"
+                                << "S: * DUMMY %)"
+                                << "S: A000001 OK DUMMY completed (oops"
+                                << "C: A000002 DUMMY"
+                                << "S: A000002 OK DUMMY completed"
+                                );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session s(QStringLiteral("127.0.0.1"), 5989);
+        s.setParseErrorRecoveryEnabled(true);
+
+        MockJob *mock = new MockJob(&s);
+        mock->setTimeout(5000);
+        mock->setCommand("DUMMY");
+        mock->setAutoDelete(false);
+        QSignalSpy spyWarning(mock, SIGNAL(warning(KJob*,QString,QString)));
+        QVERIFY(mock->exec());
+        QCOMPARE(spyWarning.count(), 2);
+        delete mock;
+
+        //The connection is still usable
+        mock = new MockJob(&s);
+        mock->setCommand("DUMMY");
+        QVERIFY(mock->exec());
+        QCOMPARE(s.state(), KIMAP2::Session::Authenticated);
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
     void shouldAbortJobWhenDisconnected()
     {
         KIMAP2::Session session(QStringLiteral("0.0.0.0"), 1234);
@@ -344,6 +647,560 @@ private Q_SLOTS:
         }
     }
 
+    void shouldCollectMetrics()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 DUMMY"
+                               << "S: A000001 OK done"
+                               << "C: A000002 DUMMY"
+                               << "S: A000002 NO failed"
+                              );
+        fakeServer.startAndWait();
+
+        qRegisterMetaType<KIMAP2::SessionMetrics>();
+        KIMAP2::Session s(QStringLiteral("127.0.0.1"), 5989);
+        QSignalSpy spyMetrics(&s, SIGNAL(metricsUpdated(KIMAP2::SessionMetrics)));
+        s.setMetricsInterval(10);
+
+        for (int i = 0; i < 2; i++) {
+            MockJob *mock = new MockJob(&s);
+            mock->setTimeout(5000);
+            mock->setCommand("DUMMY");
+            mock->exec();
+        }
+
+        const KIMAP2::SessionMetrics metrics = s.metrics();
+        QCOMPARE(metrics.commands.keys(), QList<QByteArray>() << "DUMMY");
+        const KIMAP2::SessionMetrics::Command dummy = metrics.commands.value("DUMMY");
+        QCOMPARE(dummy.count, qint64(2));
+        QCOMPARE(dummy.failed, qint64(1));
+        QCOMPARE(std::accumulate(dummy.latencyHistogram.constBegin(), dummy.latencyHistogram.constEnd(), qint64(0)), qint64(2));
+        QCOMPARE(metrics.bytesSent, qint64(2 * strlen("A000001 DUMMY\r\n")));
+        QVERIFY(metrics.bytesReceived > 0);
+        QCOMPARE(metrics.jobsStarted, qint64(2));
+        QCOMPARE(metrics.tlsHandshakes, qint64(0));
+        QCOMPARE(metrics.tlsSessionCacheHits, qint64(0));
+
+        QTRY_VERIFY(!spyMetrics.isEmpty());
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void shouldNotifyObserver()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 DUMMY"
+                               << "S: * 1 FETCH (BODY[] {5}\r\nhello)"
+                               << "S: A000001 OK done"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session s(QStringLiteral("127.0.0.1"), 5989);
+        RecordingObserver observer;
+        s.setObserver(&observer);
+        QCOMPARE(s.observer(), &observer);
+
+        MockJob *mock = new MockJob(&s);
+        mock->setTimeout(5000);
+        mock->setCommand("DUMMY");
+        QVERIFY(mock->exec());
+
+        QCOMPARE(observer.events, QList<QByteArray>()
+                 << "enqueued"
+                 << "started"
+                 << "sent A000001 DUMMY 15"
+                 << "first byte A000001"
+                 << "literal started 5"
+                 << "literal finished 5"
+                 << "completed A000001 DUMMY OK");
+        QCOMPARE(observer.bytesWritten, qint64(strlen("A000001 DUMMY\r\n")));
+        QCOMPARE(observer.bytesRead, s.metrics().bytesReceived);
+
+        s.setObserver(Q_NULLPTR);
+        QVERIFY(!s.observer());
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void shouldFailJobsOverMemoryLimits()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 DUMMY"
+                               << "S: * 1 FETCH (BODY[] {100}\r\n" + QByteArray(100, 'x') + ")"
+                               << "S: * 2 FETCH (FLAGS (\\Seen))"
+                               << "S: A000001 OK done"
+                               << "C: A000002 DUMMY"
+                               << "S: A000002 OK done"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session s(QStringLiteral("127.0.0.1"), 5989);
+        s.setMaximumLiteralSize(50);
+        s.setMaximumQueuedJobs(2);
+        QCOMPARE(s.maximumLiteralSize(), qint64(50));
+
+        QList<MockJob *> jobs;
+        for (int i = 0; i < 3; i++) {
+            MockJob *mock = new MockJob(&s);
+            mock->setTimeout(5000);
+            mock->setCommand("DUMMY");
+            jobs << mock;
+        }
+        QSignalSpy spyFirst(jobs[0], SIGNAL(result(KJob*)));
+        QSignalSpy spySecond(jobs[1], SIGNAL(result(KJob*)));
+        QSignalSpy spyThird(jobs[2], SIGNAL(result(KJob*)));
+        for (MockJob *mock : jobs) {
+            mock->setAutoDelete(false);
+            mock->start();
+        }
+
+        //Nothing runs before the greeting, so the third job doesn't fit into the queue
+        QCOMPARE(spyThird.count(), 1);
+        QCOMPARE(jobs[2]->error(), int(KIMAP2::LimitExceeded));
+
+        QTRY_COMPARE(spyFirst.count(), 1);
+        QCOMPARE(jobs[0]->error(), int(KIMAP2::LimitExceeded));
+        //The connection is still usable
+        QTRY_COMPARE(spySecond.count(), 1);
+        QCOMPARE(jobs[1]->error(), 0);
+
+        const KIMAP2::SessionMemoryUsage usage = s.memoryUsage();
+        QCOMPARE(usage.largestLiteral, qint64(100));
+        QCOMPARE(usage.literalBytes, qint64(0));
+        QCOMPARE(usage.queuedJobs, 0);
+        QVERIFY(usage.parserBufferCapacity > 0);
+
+        qDeleteAll(jobs);
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void shouldFailJobsOverParseLimits()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 DUMMY"
+                               << "S: * 1 FETCH (X-LONG " + QByteArray(5000, 'x') + ")"
+                               << "S: * 2 FETCH (FLAGS (\\Seen))"
+                               << "S: A000001 OK done"
+                               << "C: A000002 DUMMY"
+                               << "S: A000002 OK done"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session s(QStringLiteral("127.0.0.1"), 5989);
+        KIMAP2::ParseLimits limits;
+        limits.tokenSize = 1000;
+        s.setParseLimits(limits);
+        QCOMPARE(s.parseLimits().tokenSize, qint64(1000));
+
+        QList<MockJob *> jobs;
+        for (int i = 0; i < 2; i++) {
+            MockJob *mock = new MockJob(&s);
+            mock->setTimeout(5000);
+            mock->setCommand("DUMMY");
+            mock->setAutoDelete(false);
+            jobs << mock;
+        }
+        QSignalSpy spyFirst(jobs[0], SIGNAL(result(KJob*)));
+        QSignalSpy spySecond(jobs[1], SIGNAL(result(KJob*)));
+        for (MockJob *mock : jobs) {
+            mock->start();
+        }
+
+        QTRY_COMPARE(spyFirst.count(), 1);
+        QCOMPARE(jobs[0]->error(), int(KIMAP2::LimitExceeded));
+        QVERIFY(jobs[0]->errorText().contains(QStringLiteral("a token of more than 1000 bytes")));
+        //The connection is still usable
+        QTRY_COMPARE(spySecond.count(), 1);
+        QCOMPARE(jobs[1]->error(), 0);
+        QCOMPARE(s.state(), KIMAP2::Session::Authenticated);
+
+        qDeleteAll(jobs);
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void shouldToggleTlsSessionCache()
+    {
+        QVERIFY(!KIMAP2::Session::isTlsSessionCacheEnabled());
+        KIMAP2::Session::setTlsSessionCacheEnabled(true);
+        QVERIFY(KIMAP2::Session::isTlsSessionCacheEnabled());
+        KIMAP2::Session::setTlsSessionCacheEnabled(false);
+        QVERIFY(!KIMAP2::Session::isTlsSessionCacheEnabled());
+    }
+
+    void shouldSendLightweightCommands()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 NOOP"
+                               << "C: A000002 STATUS \"INBOX\" (MESSAGES UIDNEXT)"
+                               << "S: A000001 OK NOOP completed"
+                               << "S: * STATUS INBOX (MESSAGES 3 UIDNEXT 7)"
+                               << "S: A000002 NO [TRYCREATE] No such mailbox"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session s(QStringLiteral("127.0.0.1"), 5989);
+        QList<KIMAP2::CommandResult> results;
+        QEventLoop loop;
+        s.sendCommand("NOOP", QByteArray(), [&](const KIMAP2::CommandResult &result) {
+            results << result;
+        });
+        s.sendCommand("STATUS", "\"INBOX\" (MESSAGES UIDNEXT)", [&](const KIMAP2::CommandResult &result) {
+            results << result;
+            loop.quit();
+        });
+        QTimer::singleShot(5000, &loop, SLOT(quit()));
+        loop.exec();
+
+        QCOMPARE(results.size(), 2);
+        QVERIFY(results[0].isOk());
+        QVERIFY(results[0].untaggedResponses.isEmpty());
+        QVERIFY(!results[1].isOk());
+        QCOMPARE(results[1].status, QByteArray("NO"));
+        QCOMPARE(results[1].text, QByteArray("[TRYCREATE] No such mailbox"));
+        QCOMPARE(results[1].untaggedResponses.size(), 1);
+        QCOMPARE(results[1].untaggedResponses[0], QList<QByteArray>() << "*" << "STATUS" << "INBOX" << "(MESSAGES 3 UIDNEXT 7)");
+        QTRY_COMPARE(s.jobQueueSize(), 0);
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void shouldMapSequenceNumbersToUids()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 SELECT \"INBOX\""
+                               << "S: * 4 EXISTS"
+                               << "S: A000001 OK [READ-WRITE] SELECT completed"
+                               << "C: A000002 UID SEARCH ALL"
+                               << "S: * SEARCH 12 10 11 15"
+                               << "S: A000002 OK SEARCH completed"
+                               << "C: A000003 NOOP"
+                               << "S: * 2 EXPUNGE"
+                               << "S: * 4 EXISTS"
+                               << "S: * 4 FETCH (UID 20 FLAGS ())"
+                               << "S: A000003 OK NOOP completed"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session s(QStringLiteral("127.0.0.1"), 5989);
+        s.setUidMapEnabled(true);
+        KIMAP2::SelectJob *select = new KIMAP2::SelectJob(&s);
+        select->setMailBox(QStringLiteral("INBOX"));
+        QVERIFY(select->exec());
+        QVERIFY(!s.isUidMapComplete());
+        QCOMPARE(s.uidForSequenceNumber(1), qint64(0));
+
+        KIMAP2::SearchJob *search = new KIMAP2::SearchJob(&s);
+        search->setUidBased(true);
+        search->setTerm(KIMAP2::Term(KIMAP2::Term::All, QString()));
+        QVERIFY(search->exec());
+        QVERIFY(s.isUidMapComplete());
+        QCOMPARE(s.uidForSequenceNumber(1), qint64(10));
+        QCOMPARE(s.uidForSequenceNumber(4), qint64(15));
+
+        bool done = false;
+        s.sendCommand("NOOP", QByteArray(), [&done](const KIMAP2::CommandResult &) {
+            done = true;
+        });
+        QTRY_VERIFY(done);
+        QCOMPARE(s.uidForSequenceNumber(1), qint64(10));
+        QCOMPARE(s.uidForSequenceNumber(2), qint64(12));
+        QCOMPARE(s.uidForSequenceNumber(3), qint64(15));
+        QCOMPARE(s.uidForSequenceNumber(4), qint64(20));
+        QCOMPARE(s.uidForSequenceNumber(5), qint64(0));
+        QVERIFY(s.isUidMapComplete());
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void shouldBoundTheUidsOfEsearch()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 ESEARCH] localhost Test Library server ready"
+                               << "C: A000001 SELECT \"INBOX\""
+                               << "S: * 4 EXISTS"
+                               << "S: A000001 OK [READ-WRITE] SELECT completed"
+                               << "C: A000002 UID SEARCH RETURN (ALL) ALL"
+                               << "S: * ESEARCH (TAG \"A000002\") UID ALL 10:*"
+                               << "S: A000002 OK SEARCH completed"
+                               << "C: A000003 UID SEARCH RETURN (ALL) ALL"
+                               << "S: * ESEARCH (TAG \"A000003\") UID ALL 10:4000000000"
+                               << "S: A000003 OK SEARCH completed"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session s(QStringLiteral("127.0.0.1"), 5989);
+        s.setUidMapEnabled(true);
+        KIMAP2::SelectJob *select = new KIMAP2::SelectJob(&s);
+        select->setMailBox(QStringLiteral("INBOX"));
+        QVERIFY(select->exec());
+
+        //An open range lists no UIDs
+        bool done = false;
+        s.sendCommand("UID SEARCH", "RETURN (ALL) ALL", [&done](const KIMAP2::CommandResult &) {
+            done = true;
+        });
+        QTRY_VERIFY(done);
+        QVERIFY(!s.isUidMapComplete());
+        QCOMPARE(s.uidForSequenceNumber(1), qint64(0));
+
+        //No more UIDs than messages
+        done = false;
+        s.sendCommand("UID SEARCH", "RETURN (ALL) ALL", [&done](const KIMAP2::CommandResult &) {
+            done = true;
+        });
+        QTRY_VERIFY(done);
+        QVERIFY(s.isUidMapComplete());
+        QCOMPARE(s.uidForSequenceNumber(1), qint64(10));
+        QCOMPARE(s.uidForSequenceNumber(4), qint64(13));
+        QCOMPARE(s.uidForSequenceNumber(5), qint64(0));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void shouldNotCompleteAResetUidMap()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 SELECT \"INBOX\""
+                               << "S: * 3 EXISTS"
+                               << "S: A000001 OK [READ-WRITE] SELECT completed"
+                               << "C: A000002 NOOP"
+                               << "S: * VANISHED 10"
+                               << "S: A000002 OK NOOP completed"
+                               << "C: A000003 SELECT \"Empty\""
+                               << "S: * 0 EXISTS"
+                               << "S: A000003 OK [READ-WRITE] SELECT completed"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session s(QStringLiteral("127.0.0.1"), 5989);
+        s.setUidMapEnabled(true);
+        KIMAP2::SelectJob *select = new KIMAP2::SelectJob(&s);
+        select->setMailBox(QStringLiteral("INBOX"));
+        QVERIFY(select->exec());
+        QVERIFY(!s.isUidMapComplete());
+
+        //The messages that are not known may have vanished as well, so the map is dropped
+        bool done = false;
+        s.sendCommand("NOOP", QByteArray(), [&done](const KIMAP2::CommandResult &) {
+            done = true;
+        });
+        QTRY_VERIFY(done);
+        QVERIFY(!s.isUidMapComplete());
+
+        //All UIDs of an empty mailbox are known
+        select = new KIMAP2::SelectJob(&s);
+        select->setMailBox(QStringLiteral("Empty"));
+        QVERIFY(select->exec());
+        QVERIFY(s.isUidMapComplete());
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void shouldReportUnsolicitedUpdates()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << FakeServer::preauth()
+                               << "C: A000001 SELECT \"INBOX\""
+                               << "S: * 3 EXISTS"
+                               << "S: A000001 OK [READ-WRITE] SELECT completed"
+                               << "C: A000002 UID SEARCH ALL"
+                               << "S: * SEARCH 10 11 12"
+                               << "S: A000002 OK SEARCH completed"
+                               << "S: * 2 EXPUNGE"
+                               << "S: * 2 FETCH (FLAGS (\\Seen))"
+                               << "S: * 3 EXISTS"
+                               << "S: * VANISHED 10"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session s(QStringLiteral("127.0.0.1"), 5989);
+        s.setUidMapEnabled(true);
+        QSignalSpy expunged(&s, SIGNAL(selectedMessageExpunged(qint64,qint64)));
+        QSignalSpy flagsChanged(&s, SIGNAL(selectedMessageFlagsChanged(qint64,qint64,QList<QByteArray>,quint64)));
+        QSignalSpy countChanged(&s, SIGNAL(selectedMessageCountChanged(qint64)));
+        QSignalSpy vanished(&s, SIGNAL(selectedMessagesVanished(KIMAP2::ImapSet)));
+
+        KIMAP2::SelectJob *select = new KIMAP2::SelectJob(&s);
+        select->setMailBox(QStringLiteral("INBOX"));
+        QVERIFY(select->exec());
+        KIMAP2::SearchJob *search = new KIMAP2::SearchJob(&s);
+        search->setUidBased(true);
+        search->setTerm(KIMAP2::Term(KIMAP2::Term::All, QString()));
+        QVERIFY(search->exec());
+
+        QTRY_COMPARE(vanished.count(), 1);
+        QCOMPARE(expunged.count(), 1);
+        QCOMPARE(expunged.at(0).at(0).toLongLong(), qint64(2));
+        QCOMPARE(expunged.at(0).at(1).toLongLong(), qint64(11));
+        QCOMPARE(flagsChanged.count(), 1);
+        QCOMPARE(flagsChanged.at(0).at(0).toLongLong(), qint64(2));
+        QCOMPARE(flagsChanged.at(0).at(1).toLongLong(), qint64(12));
+        QCOMPARE(flagsChanged.at(0).at(2).value<QList<QByteArray> >(), QList<QByteArray>() << "\\Seen");
+        QCOMPARE(countChanged.count(), 1);
+        QCOMPARE(countChanged.at(0).at(0).toLongLong(), qint64(3));
+        QCOMPARE(vanished.at(0).at(0).value<KIMAP2::ImapSet>(), KIMAP2::ImapSet(10));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void shouldReconnectAndReplay()
+    {
+        FakeServer fakeServer;
+        fakeServer.addScenario(QList<QByteArray>()
+                               << FakeServer::greeting()
+                               << "C: A000001 CAPABILITY"
+                               << "S: A000001 OK"
+                               << "C: A000002 LOGIN \"user\" \"password\""
+                               << "S: A000002 OK User logged in"
+                               << "C: A000003 SELECT \"INBOX\""
+                               << "S: * 2 EXISTS"
+                               << "S: A000003 OK [READ-WRITE] SELECT completed"
+                               << "C: A000004 UID FETCH 1:* (FLAGS UID)"
+                               << "S: * 1 FETCH (UID 10 FLAGS ())"
+                               << "X"
+                              );
+        fakeServer.addScenario(QList<QByteArray>()
+                               << FakeServer::greeting()
+                               << "C: A000005 CAPABILITY"
+                               << "S: A000005 OK"
+                               << "C: A000006 LOGIN \"user\" \"password\""
+                               << "S: A000006 OK User logged in"
+                               << "C: A000007 SELECT \"INBOX\""
+                               << "S: * 2 EXISTS"
+                               << "S: A000007 OK [READ-WRITE] SELECT completed"
+                               << "C: A000008 UID FETCH 1:* (FLAGS UID)"
+                               << "S: * 1 FETCH (UID 10 FLAGS ())"
+                               << "S: * 2 FETCH (UID 20 FLAGS ())"
+                               << "S: A000008 OK fetch done"
+                               << "C: A000009 DUMMY"
+                               << "S: A000009 OK done"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session s(QStringLiteral("127.0.0.1"), 5989);
+        KIMAP2::ReconnectPolicy policy;
+        policy.maximumAttempts = 3;
+        policy.initialDelay = 10;
+        s.setReconnectPolicy(policy);
+        QSignalSpy spyFail(&s, SIGNAL(connectionFailed()));
+
+        KIMAP2::LoginJob *login = new KIMAP2::LoginJob(&s);
+        login->setUserName(QStringLiteral("user"));
+        login->setPassword(QStringLiteral("password"));
+        QVERIFY(login->exec());
+        KIMAP2::SelectJob *select = new KIMAP2::SelectJob(&s);
+        select->setMailBox(QStringLiteral("INBOX"));
+        QVERIFY(select->exec());
+
+        KIMAP2::FetchJob::FetchScope scope;
+        scope.mode = KIMAP2::FetchJob::FetchScope::Flags;
+        KIMAP2::FetchJob *fetch = new KIMAP2::FetchJob(&s);
+        fetch->setUidBased(true);
+        fetch->setSequenceSet(KIMAP2::ImapSet(1, 0));
+        fetch->setScope(scope);
+        QList<qint64> uids;
+        connect(fetch, &KIMAP2::FetchJob::resultReceived, [&uids](const KIMAP2::FetchJob::Result &result) {
+            uids << result.uid;
+        });
+        QSignalSpy spyFetch(fetch, SIGNAL(result(KJob*)));
+        fetch->start();
+
+        //Was queued while the connection was lost, so it waits for the next one
+        MockJob *mock = new MockJob(&s);
+        mock->setCommand("DUMMY");
+        QVERIFY(mock->exec());
+
+        QCOMPARE(spyFetch.count(), 1);
+        QCOMPARE(uids, QList<qint64>() << 10 << 10 << 20);
+        QCOMPARE(s.state(), KIMAP2::Session::Selected);
+        QCOMPARE(s.selectedMailBox(), QStringLiteral("INBOX"));
+        QCOMPARE(spyFail.count(), 0);
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void shouldGiveUpReconnecting()
+    {
+        FakeServer fakeServer;
+        fakeServer.addScenario(QList<QByteArray>()
+                               << FakeServer::greeting()
+                               << "C: A000001 CAPABILITY"
+                               << "S: A000001 OK"
+                               << "C: A000002 LOGIN \"user\" \"password\""
+                               << "S: A000002 OK User logged in"
+                               << "C: A000003 DUMMY"
+                               << "X"
+                              );
+        fakeServer.addScenario(QList<QByteArray>()
+                               << FakeServer::greeting()
+                               << "C: A000004 CAPABILITY"
+                               << "S: A000004 OK"
+                               << "C: A000005 LOGIN \"user\" \"password\""
+                               << "S: A000005 NO Password expired"
+                              );
+        fakeServer.startAndWait();
+
+        KIMAP2::Session s(QStringLiteral("127.0.0.1"), 5989);
+        KIMAP2::ReconnectPolicy policy;
+        policy.maximumAttempts = 3;
+        policy.initialDelay = 10;
+        s.setReconnectPolicy(policy);
+
+        KIMAP2::LoginJob *login = new KIMAP2::LoginJob(&s);
+        login->setUserName(QStringLiteral("user"));
+        login->setPassword(QStringLiteral("password"));
+        QVERIFY(login->exec());
+
+        //Not sent again, since it isn't known to be idempotent
+        MockJob *running = new MockJob(&s);
+        running->setCommand("DUMMY");
+        running->setAutoDelete(false);
+        QSignalSpy spyRunning(running, SIGNAL(result(KJob*)));
+        running->start();
+        MockJob *queued = new MockJob(&s);
+        queued->setCommand("DUMMY");
+        queued->setAutoDelete(false);
+        QSignalSpy spyQueued(queued, SIGNAL(result(KJob*)));
+        queued->start();
+
+        QTRY_COMPARE(spyRunning.count(), 1);
+        QCOMPARE(running->error(), int(KIMAP2::ConnectionLost));
+        QTRY_COMPARE(spyQueued.count(), 1);
+        QVERIFY(queued->error() != 0);
+        QCOMPARE(s.state(), KIMAP2::Session::Disconnected);
+        QTRY_COMPARE(s.jobQueueSize(), 0);
+        delete running;
+        delete queued;
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
 public Q_SLOTS:
     void jobDone(KJob *job)
     {
@@ -0,0 +1,90 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#include <qtest.h>
+
+#include "kimap2test/fakeserver.h"
+#include "kimap2/session.h"
+#include "kimap2/threadjob.h"
+
+#include <QtTest>
+
+class ThreadJobTest: public QObject
+{
+    Q_OBJECT
+
+private:
+    // "3 (4) (5 6)" style, to compare trees in one line
+    static QByteArray toString(const KIMAP2::ThreadNode &node)
+    {
+        QByteArray result = QByteArray::number(node.id);
+        foreach (const KIMAP2::ThreadNode &child, node.children) {
+            result += node.children.size() > 1 ? " (" + toString(child) + ')' : ' ' + toString(child);
+        }
+        return result;
+    }
+
+private Q_SLOTS:
+    void testThread()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 THREAD=REFERENCES] localhost Test Library server ready"
+                               << "C: A000001 UID THREAD REFERENCES UTF-8 ALL"
+                               << "S: * THREAD (2)(3 6 (4 23)(44 7 96))((11)(12 13))"
+                               << "S: A000001 OK THREAD completed");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        KIMAP2::ThreadJob *job = new KIMAP2::ThreadJob(&session);
+        job->setUidBased(true);
+        QVERIFY(job->exec());
+
+        const QVector<KIMAP2::ThreadNode> threads = job->threads();
+        QCOMPARE(threads.size(), 3);
+        QCOMPARE(toString(threads[0]), QByteArray("2"));
+        QCOMPARE(toString(threads[1]), QByteArray("3 6 (4 23) (44 7 96)"));
+        //The message 11 and 12 reply to is missing
+        QCOMPARE(toString(threads[2]), QByteArray("0 (11) (12 13)"));
+
+        QVERIFY(fakeServer.isAllScenarioDone());
+        fakeServer.quit();
+    }
+
+    void testThreadUnsupported()
+    {
+        FakeServer fakeServer;
+        fakeServer.setScenario(QList<QByteArray>()
+                               << "S: * PREAUTH [CAPABILITY IMAP4rev1 THREAD=REFERENCES] localhost Test Library server ready");
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+        QTRY_COMPARE(session.state(), KIMAP2::Session::Authenticated);
+
+        KIMAP2::ThreadJob *job = new KIMAP2::ThreadJob(&session);
+        job->setAlgorithm(KIMAP2::ThreadJob::OrderedSubject);
+        QVERIFY(!job->exec());
+
+        fakeServer.quit();
+    }
+};
+
+QTEST_GUILESS_MAIN(ThreadJobTest)
+
+#include "threadjobtest.moc"
@@ -0,0 +1,108 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+#include <qtest.h>
+
+#include "kimap2test/fakeserver.h"
+#include "kimap2test/trafficcapture.h"
+#include "kimap2/session.h"
+#include "kimap2/fetchjob.h"
+
+#include <QtTest>
+#include <QTemporaryDir>
+
+class TrafficCaptureTest: public QObject
+{
+    Q_OBJECT
+
+private:
+    QList<qint64> fetchUids()
+    {
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::FetchJob::FetchScope scope;
+        scope.mode = KIMAP2::FetchJob::FetchScope::Content;
+        KIMAP2::FetchJob *job = new KIMAP2::FetchJob(&session);
+        job->setUidBased(true);
+        job->setSequenceSet(KIMAP2::ImapSet(1, 2));
+        job->setScope(scope);
+        QList<qint64> uids;
+        connect(job, &KIMAP2::FetchJob::resultReceived, [&uids](const KIMAP2::FetchJob::Result &result) {
+            uids << result.uid;
+        });
+        job->exec();
+        return uids;
+    }
+
+private Q_SLOTS:
+
+    void testCaptureAndReplay()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        qputenv("KIMAP2_LOGFILE", QFile::encodeName(dir.path() + QStringLiteral("/capture")));
+        qputenv("KIMAP2_LOGFILE_CAPTURE", "1");
+
+        {
+            FakeServer fakeServer;
+            fakeServer.setScenario(QList<QByteArray>()
+                                   << FakeServer::preauth()
+                                   << "C: A000001 UID FETCH 1:2 (BODY.PEEK[] UID)"
+                                   << "S: * 1 FETCH (UID 1 BODY[] {7}\r\nHello\r\n)"
+                                   << "S: * 2 FETCH (UID 2 BODY[] {5}\r\nWorld)"
+                                   << "S: A000001 OK fetch done"
+                                  );
+            fakeServer.startAndWait();
+            QCOMPARE(fetchUids(), QList<qint64>() << 1 << 2);
+        }
+
+        qunsetenv("KIMAP2_LOGFILE");
+        qunsetenv("KIMAP2_LOGFILE_CAPTURE");
+
+        const QStringList files = QDir(dir.path()).entryList(QStringList() << QStringLiteral("capture.*"));
+        QCOMPARE(files.size(), 1);
+        TrafficCapture capture;
+        QVERIFY(capture.load(dir.path() + QLatin1Char('/') + files.first()));
+        QVERIFY(!capture.isIncomplete());
+
+        //The exact bytes, literals included
+        const QList<TrafficCapture::Record> records = capture.records();
+        QVERIFY(records.size() >= 3);
+        QCOMPARE(records.first().type, TrafficCapture::Record::Received);
+        QVERIFY(capture.receivedData().contains("{7}\r\nHello\r\n)\r\n"));
+        qint64 timestamp = 0;
+        bool sentFetch = false;
+        foreach (const TrafficCapture::Record &record, records) {
+            QVERIFY(record.timestamp >= timestamp);
+            timestamp = record.timestamp;
+            if (record.type == TrafficCapture::Record::Sent) {
+                sentFetch = sentFetch || record.data == "A000001 UID FETCH 1:2 (BODY.PEEK[] UID)\r\n";
+            }
+        }
+        QVERIFY(sentFetch);
+
+        //Played back to a client doing the same
+        CaptureServer server(capture, CaptureServer::RecordedPacing);
+        QVERIFY(server.listen());
+        QCOMPARE(fetchUids(), QList<qint64>() << 1 << 2);
+        QVERIFY(server.isReplayDone());
+        QCOMPARE(server.bytesSent(), qint64(capture.receivedData().size()));
+    }
+};
+
+QTEST_GUILESS_MAIN(TrafficCaptureTest)
+
+#include "trafficcapturetest.moc"
@@ -19,24 +19,142 @@
 
 #include "appendjob.h"
 
+#include "kimap_debug.h"
+
 #include "job_p.h"
 #include "message_p.h"
 #include "session_p.h"
 #include "rfccodecs.h"
 
+#include <QtCore/QIODevice>
+#include <QtCore/QPointer>
+
 namespace KIMAP2
 {
 class AppendJobPrivate : public JobPrivate
 {
 public:
-    AppendJobPrivate(Session *session, const QString &name) : JobPrivate(session, name), uid(0) { }
+    struct Part {
+        bool url;
+        QByteArray data;
+    };
+
+    struct Entry {
+        Entry() : size(0) {}
+
+        QList<QByteArray> flags;
+        QDateTime internalDate;
+        QByteArray content;
+        QPointer<QIODevice> device;
+        qint64 size;
+        QList<Part> parts;
+    };
+
+    struct Literal {
+        QByteArray content;
+        QPointer<QIODevice> device;
+        qint64 size;
+        bool nonSynchronizing;
+    };
+
+    AppendJobPrivate(Session *session, const QString &name) : JobPrivate(session, name), uid(0), uidValidity(0), next(0), offset(0) { }
     ~AppendJobPrivate() { }
 
+    /**
+     * Ends the current text with the announcement of a literal.
+     */
+    void addLiteral(const QByteArray &content, QIODevice *device, qint64 size)
+    {
+        //Without waiting for the continuation request we save a round trip
+        const Literal literal = {content, device, size, sessionInternal()->canSendNonSynchronizingLiteral(size)};
+        texts.last() += '{' + QByteArray::number(size) + (literal.nonSynchronizing ? "+}" : "}");
+        literals << literal;
+        texts << QByteArray();
+    }
+
+    /**
+     * Adds the flags, date and content of @p entry to the command.
+     */
+    void addMessage(const Entry &entry)
+    {
+        QByteArray &parameters = texts.last();
+        if (!entry.flags.isEmpty()) {
+            parameters += " (";
+            foreach (const QByteArray &flag, entry.flags) {
+                parameters += flag + ' ';
+            }
+            parameters.chop(1);
+            parameters += ')';
+        }
+
+        if (!entry.internalDate.isNull()) {
+            const QDateTime utcDateTime = entry.internalDate.toUTC();
+            parameters += " \"" + QLocale::c().toString(utcDateTime, QStringLiteral("dd-MMM-yyyy hh:mm:ss")).toLatin1() + " +0000" + '\"';
+        }
+
+        if (entry.parts.isEmpty()) {
+            parameters += ' ';
+            addLiteral(entry.content, entry.device, entry.size);
+            return;
+        }
+
+        parameters += " CATENATE (";
+        for (int i = 0; i < entry.parts.size(); ++i) {
+            const Part &part = entry.parts.at(i);
+            if (i > 0) {
+                texts.last() += ' ';
+            }
+            if (part.url) {
+                texts.last() += "URL \"" + KIMAP2::quoteIMAP(part.data) + '\"';
+            } else {
+                texts.last() += "TEXT ";
+                addLiteral(part.data, Q_NULLPTR, part.data.size());
+            }
+        }
+        texts.last() += ')';
+    }
+
+    /**
+     * Sends the literal the server is ready for, followed by the rest of the
+     * command as long as the literals in it need no continuation request.
+     */
+    void sendLiterals(AppendJob *job)
+    {
+        while (next < literals.size()) {
+            const Literal &literal = literals.at(next++);
+            if (literal.device) {
+                QPointer<AppendJob> guard(job);
+                const qint64 base = offset;
+                sessionInternal()->sendDevice(literal.device, literal.size, [guard, base](qint64 written) {
+                    if (guard) {
+                        guard->setProcessedAmount(KJob::Bytes, base + written);
+                    }
+                }, false);
+            } else {
+                sessionInternal()->sendData(literal.content, false);
+                job->setProcessedAmount(KJob::Bytes, offset + literal.size);
+            }
+            offset += literal.size;
+            sessionInternal()->sendData(texts.at(next));
+            if (next < literals.size() && !literals.at(next).nonSynchronizing) {
+                break;
+            }
+        }
+    }
+
     QString mailBox;
-    QList<QByteArray> flags;
-    QDateTime internalDate;
-    QByteArray content;
+    Entry message;
+    QList<Entry> additionalMessages;
+    //The command is sent as texts[0], literals[0], texts[1], ... up to the last text
+    QList<QByteArray> texts;
+    QList<Literal> literals;
+    // What doStart() appended, in order
+    QList<Entry> appended;
+    ImapSet uids;
     qint64 uid;
+    qint64 uidValidity;
+    int next;
+    qint64 offset;
 };
 }
 
@@ -66,37 +184,83 @@ QString AppendJob::mailBox() const
 void AppendJob::setFlags(const QList<QByteArray> &flags)
 {
     Q_D(AppendJob);
-    d->flags = flags;
+    d->message.flags = flags;
 }
 
 QList<QByteArray> AppendJob::flags() const
 {
     Q_D(const AppendJob);
-    return d->flags;
+    return d->message.flags;
 }
 
 void AppendJob::setInternalDate(const QDateTime &internalDate)
 {
     Q_D(AppendJob);
-    d->internalDate = internalDate;
+    d->message.internalDate = internalDate;
 }
 
 QDateTime AppendJob::internalDate() const
 {
     Q_D(const AppendJob);
-    return d->internalDate;
+    return d->message.internalDate;
 }
 
 void AppendJob::setContent(const QByteArray &content)
 {
     Q_D(AppendJob);
-    d->content = content;
+    d->message.content = content;
+    d->message.device = Q_NULLPTR;
+    d->message.size = content.size();
 }
 
 QByteArray AppendJob::content() const
 {
     Q_D(const AppendJob);
-    return d->content;
+    return d->message.content;
+}
+
+void AppendJob::setContent(QIODevice *device, qint64 size)
+{
+    Q_D(AppendJob);
+    d->message.content.clear();
+    d->message.device = device;
+    d->message.size = size;
+}
+
+void AppendJob::addTextPart(const QByteArray &text)
+{
+    Q_D(AppendJob);
+    const AppendJobPrivate::Part part = {false, text};
+    d->message.parts << part;
+}
+
+void AppendJob::addUrlPart(const QByteArray &url)
+{
+    Q_D(AppendJob);
+    const AppendJobPrivate::Part part = {true, url};
+    d->message.parts << part;
+}
+
+void AppendJob::addMessage(const QByteArray &content, const QList<QByteArray> &flags, const QDateTime &internalDate)
+{
+    Q_D(AppendJob);
+    AppendJobPrivate::Entry entry;
+    entry.flags = flags;
+    entry.internalDate = internalDate;
+    entry.content = content;
+    entry.size = content.size();
+    d->additionalMessages << entry;
+}
+
+void AppendJob::addMessage(QIODevice *device, qint64 size, const QList<QByteArray> &flags, const QDateTime &internalDate)
+{
+    Q_D(AppendJob);
+    AppendJobPrivate::Entry entry;
+    entry.flags = flags;
+    entry.internalDate = internalDate;
+    entry.device = device;
+    entry.size = size;
+    d->additionalMessages << entry;
 }
 
 qint64 AppendJob::uid() const
@@ -105,29 +269,120 @@ qint64 AppendJob::uid() const
     return d->uid;
 }
 
+ImapSet AppendJob::uids() const
+{
+    Q_D(const AppendJob);
+    return d->uids;
+}
+
+qint64 AppendJob::uidValidity() const
+{
+    Q_D(const AppendJob);
+    return d->uidValidity;
+}
+
+QList<FetchJob::Result> AppendJob::results() const
+{
+    Q_D(const AppendJob);
+
+    QList<qint64> uids;
+    foreach (const ImapInterval &interval, d->uids.intervals()) {
+        for (qint64 uid = interval.begin(); uid <= interval.end() && uids.size() < d->appended.size(); ++uid) {
+            uids << uid;
+        }
+    }
+
+    QList<FetchJob::Result> results;
+    for (int i = 0; i < d->appended.size() && i < uids.size(); ++i) {
+        const AppendJobPrivate::Entry &entry = d->appended.at(i);
+        FetchJob::Result result;
+        result.uid = uids.at(i);
+        result.flags = entry.flags;
+        result.flagSet = FlagSet::fromMessageFlags(entry.flags);
+        if (entry.internalDate.isValid()) {
+            result.internalDate = entry.internalDate.toMSecsSinceEpoch() / 1000;
+        }
+        //The server builds catenated messages, the size is only known to it
+        if (entry.parts.isEmpty()) {
+            result.size = entry.size;
+        }
+        if (!entry.device && entry.parts.isEmpty()) {
+            result.rawContent = entry.content;
+            int end = entry.content.indexOf("\r\n\r\n");
+            if (end >= 0) {
+                result.rawHeader = entry.content.left(end + 4);
+            } else if ((end = entry.content.indexOf("\n\n")) >= 0) {
+                result.rawHeader = entry.content.left(end + 2);
+            } else {
+                result.rawHeader = entry.content;
+            }
+        }
+        results << result;
+    }
+    return results;
+}
+
 void AppendJob::doStart()
 {
     Q_D(AppendJob);
 
-    QByteArray parameters = '\"' + KIMAP2::encodeImapFolderName(d->mailBox.toUtf8()) + '\"';
+    //Only messages added with addMessage() if there is no content of its own
+    QList<AppendJobPrivate::Entry> messages;
+    if (d->additionalMessages.isEmpty() || d->message.device || !d->message.content.isEmpty() || !d->message.parts.isEmpty()) {
+        messages << d->message;
+    }
+    messages << d->additionalMessages;
+    d->appended = messages;
+
+    if (messages.size() > 1 && !d->m_session->capabilities().contains(QStringLiteral("MULTIAPPEND"), Qt::CaseInsensitive)) {
+        qCWarning(KIMAP2_LOG) << "Appending several messages at once requires MULTIAPPEND";
+        setError(KJob::UserDefinedError);
+        setErrorText(QStringLiteral("The server does not support MULTIAPPEND"));
+        emitResult();
+        return;
+    }
+    if (!d->message.parts.isEmpty() && !d->m_session->capabilities().contains(QStringLiteral("CATENATE"), Qt::CaseInsensitive)) {
+        qCWarning(KIMAP2_LOG) << "Building a message from parts requires CATENATE";
+        setError(KJob::UserDefinedError);
+        setErrorText(QStringLiteral("The server does not support CATENATE"));
+        emitResult();
+        return;
+    }
 
-    if (!d->flags.isEmpty()) {
-        parameters += " (";
-        foreach (const QByteArray &flag, d->flags) {
-            parameters += flag + ' ';
+    //RFC 7889: rather than uploading a message only to have it rejected afterwards
+    const qint64 limit = d->sessionInternal()->appendLimit(d->mailBox);
+    if (limit >= 0) {
+        foreach (const AppendJobPrivate::Entry &entry, messages) {
+            //The size of a catenated message is only known to the server
+            if (entry.parts.isEmpty() && entry.size > limit) {
+                qCWarning(KIMAP2_LOG) << "Message of" << entry.size << "bytes exceeds the APPENDLIMIT of" << limit;
+                setError(KJob::UserDefinedError);
+                setErrorText(QStringLiteral("The message exceeds the size limit of %1 bytes").arg(limit));
+                emitResult();
+                return;
+            }
         }
-        parameters.chop(1);
-        parameters += ')';
     }
 
-    if (!d->internalDate.isNull()) {
-        const QDateTime utcDateTime = d->internalDate.toUTC();
-        parameters += " \"" + QLocale::c().toString(utcDateTime, QStringLiteral("dd-MMM-yyyy hh:mm:ss")).toLatin1() + " +0000" + '\"';
+    d->texts.clear();
+    d->literals.clear();
+    d->next = 0;
+    d->offset = 0;
+    d->texts << '\"' + d->sessionInternal()->encodeMailBoxName(d->mailBox) + '\"';
+    foreach (const AppendJobPrivate::Entry &entry, messages) {
+        d->addMessage(entry);
     }
 
-    parameters += " {" + QByteArray::number(d->content.size()) + '}';
+    qint64 total = 0;
+    foreach (const AppendJobPrivate::Literal &literal, d->literals) {
+        total += literal.size;
+    }
+    setTotalAmount(KJob::Bytes, total);
 
-    d->sendCommand("APPEND", parameters);
+    d->sendCommand("APPEND", d->texts.first());
+    if (!d->literals.isEmpty() && d->literals.first().nonSynchronizing) {
+        d->sendLiterals(this);
+    }
 }
 
 void AppendJob::handleResponse(const Message &response)
@@ -137,9 +392,15 @@ void AppendJob::handleResponse(const Message &response)
     for (QList<Message::Part>::ConstIterator it = response.responseCode.begin();
             it != response.responseCode.end(); ++it) {
         if (it->toString() == "APPENDUID") {
-            it = it + 2;
-            if (it != response.responseCode.end()) {
-                d->uid = it->toString().toLongLong();
+            if (++it == response.responseCode.end()) {
+                break;
+            }
+            d->uidValidity = it->toString().toLongLong();
+            if (++it != response.responseCode.end()) {
+                //A single UID, or one for each message with MULTIAPPEND
+                d->uids = ImapSet::fromImapSequenceSet(it->toString());
+                const ImapInterval::List intervals = d->uids.intervals();
+                d->uid = intervals.isEmpty() ? 0 : intervals.first().begin();
             }
             break;
         }
@@ -147,7 +408,7 @@ void AppendJob::handleResponse(const Message &response)
 
     if (handleErrorReplies(response) == NotHandled) {
         if (!response.content.isEmpty() && response.content[0].toString() == "+") {
-            d->sessionInternal()->sendData(d->content);
+            d->sendLiterals(this);
         }
     }
 }
@@ -22,9 +22,13 @@
 
 #include "kimap2_export.h"
 
+#include "fetchjob.h"
 #include "job.h"
+#include "imapset.h"
 #include <QDateTime>
 
+class QIODevice;
+
 namespace KIMAP2
 {
 
@@ -35,11 +39,18 @@ class AppendJobPrivate;
 /**
  * Appends a message to a mailbox.
  *
+ * Several messages can be appended with one command if the server
+ * supports MULTIAPPEND (RFC 3502), see addMessage().
+ *
  * This job can only be run when the session is in the
  * authenticated (or selected) state.
  *
  * If the server supports ACLs, the user will need the
  * Acl::Insert right on the mailbox.
+ *
+ * A message larger than the APPENDLIMIT (RFC 7889) the server announced,
+ * or reported for the mailbox with StatusJob or ListJob, makes the job fail
+ * before anything is uploaded.
  */
 class KIMAP2_EXPORT AppendJob : public Job
 {
@@ -113,6 +124,62 @@ public:
      */
     QByteArray content() const;
 
+    /**
+     * Streams the content of the message from @p device instead.
+     *
+     * The message is read from the device's current position a chunk at a time
+     * while it is written to the server, so large messages do not have to be loaded
+     * into memory. The progress is reported with KJob::processedAmount(KJob::Bytes).
+     *
+     * The device has to be open, has to provide exactly @p size bytes and has to stay
+     * valid until the job is done. It is read from the thread of the session.
+     *
+     * @param device  the device to read the message from
+     * @param size  the number of bytes of the message
+     */
+    void setContent(QIODevice *device, qint64 size);
+
+    /**
+     * Adds literal text to the message built by the server with CATENATE (RFC 4469).
+     *
+     * Once a part is added, the message consists of the text and URL parts in the
+     * order they were added, and the content set with setContent() is not used.
+     * The job fails if the server does not support CATENATE.
+     *
+     * @param text  a part of the message as it is sent, e.g. headers or a MIME boundary
+     */
+    void addTextPart(const QByteArray &text);
+
+    /**
+     * Adds a part the server copies from an existing message with CATENATE,
+     * so that it does not need to be downloaded and uploaded again.
+     *
+     * @param url  a relative IMAP URL (RFC 5092), e.g. "/INBOX;UIDVALIDITY=385759045/;UID=20/;SECTION=2"
+     */
+    void addUrlPart(const QByteArray &url);
+
+    /**
+     * Adds another message to append after the one set with setContent().
+     *
+     * All messages are sent in a single APPEND command, which requires the
+     * MULTIAPPEND extension (RFC 3502); the job fails without it. The server
+     * appends either all of them or none. If no content was set with setContent(),
+     * only the messages added here are appended.
+     *
+     * @param content  usually an RFC-2822 message
+     * @param flags  the flags to set on the message
+     * @param internalDate  the internal date of the message, or the current date if not valid
+     */
+    void addMessage(const QByteArray &content, const QList<QByteArray> &flags = QList<QByteArray>(),
+                    const QDateTime &internalDate = QDateTime());
+
+    /**
+     * Adds another message that is streamed from @p device, with the same
+     * requirements as setContent(QIODevice *, qint64).
+     */
+    void addMessage(QIODevice *device, qint64 size, const QList<QByteArray> &flags = QList<QByteArray>(),
+                    const QDateTime &internalDate = QDateTime());
+
     /**
      * The UID of the new message.
      *
@@ -124,6 +191,31 @@ public:
      */
     qint64 uid() const;
 
+    /**
+     * The UIDs of the new messages, in the order they were appended in.
+     *
+     * As with uid(), this is only known if the server supports UIDPLUS.
+     */
+    ImapSet uids() const;
+
+    /**
+     * The UIDVALIDITY of the mailbox the messages were appended to, which the UIDs are
+     * valid for. Zero unless the server supports UIDPLUS.
+     */
+    qint64 uidValidity() const;
+
+    /**
+     * Returns what a FetchJob of the new messages would report, built from what was appended,
+     * so they can go into a local cache without downloading them again. Only available
+     * once uids() is known.
+     *
+     * Each result has the UID, flags and size of its message, and the internal date if
+     * one was set, otherwise it is 0. The content and header are in Result::rawContent and
+     * Result::rawHeader, unless the message was streamed from a device or built with CATENATE.
+     * Whatever else the server adds, like the \Recent flag, is not in the results.
+     */
+    QList<FetchJob::Result> results() const;
+
 protected:
     void doStart() Q_DECL_OVERRIDE;
     void handleResponse(const Message &response) Q_DECL_OVERRIDE;
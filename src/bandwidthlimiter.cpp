@@ -0,0 +1,155 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "bandwidthlimiter.h"
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMutex>
+
+namespace KIMAP2
+{
+
+class BandwidthLimiterPrivate
+{
+public:
+    struct Bucket {
+        Bucket() : rate(0), burst(0), tokens(0), refilledAt(0) { }
+
+        bool isLimited() const
+        {
+            return rate > 0;
+        }
+
+        void refill(qint64 now)
+        {
+            if (!isLimited() || tokens >= burst) {
+                refilledAt = now;
+                return;
+            }
+            //Waits for a whole byte, so frequent calls don't lose the fractions
+            const qint64 added = (now - refilledAt) * rate / 1000;
+            if (added > 0) {
+                tokens = qMin(burst, tokens + added);
+                refilledAt = now;
+            }
+        }
+
+        void charge(qint64 bytes)
+        {
+            if (isLimited()) {
+                //More debt than a burst would stall the budget for too long
+                tokens = qMax(-burst, qMin(burst, tokens - bytes));
+            }
+        }
+
+        qint64 rate;
+        qint64 burst;
+        qint64 tokens;
+        qint64 refilledAt;
+    };
+
+    BandwidthLimiterPrivate()
+    {
+        clock.start();
+    }
+
+    Bucket &bucket(BandwidthLimiter::Direction direction, BandwidthLimiter::Budget budget)
+    {
+        return buckets[direction][budget];
+    }
+
+    /*
+     * Interactive traffic also goes against the background budget.
+     */
+    void charge(BandwidthLimiter::Direction direction, BandwidthLimiter::Budget budget, qint64 bytes)
+    {
+        bucket(direction, budget).charge(bytes);
+        if (budget == BandwidthLimiter::Interactive) {
+            bucket(direction, BandwidthLimiter::Background).charge(bytes);
+        }
+    }
+
+    void refill(BandwidthLimiter::Direction direction)
+    {
+        const qint64 now = clock.elapsed();
+        bucket(direction, BandwidthLimiter::Interactive).refill(now);
+        bucket(direction, BandwidthLimiter::Background).refill(now);
+    }
+
+    mutable QMutex mutex;
+    QElapsedTimer clock;
+    Bucket buckets[2][2];
+};
+
+}
+
+using namespace KIMAP2;
+
+BandwidthLimiter::BandwidthLimiter()
+    : d(new BandwidthLimiterPrivate)
+{
+}
+
+BandwidthLimiter::~BandwidthLimiter()
+{
+    delete d;
+}
+
+void BandwidthLimiter::setRate(Direction direction, Budget budget, qint64 bytesPerSecond, qint64 burst)
+{
+    QMutexLocker locker(&d->mutex);
+    d->refill(direction);
+    BandwidthLimiterPrivate::Bucket &bucket = d->bucket(direction, budget);
+    bucket.rate = qMax(qint64(0), bytesPerSecond);
+    bucket.burst = burst > 0 ? burst : bucket.rate;
+    bucket.tokens = bucket.burst;
+}
+
+qint64 BandwidthLimiter::rate(Direction direction, Budget budget) const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->bucket(direction, budget).rate;
+}
+
+qint64 BandwidthLimiter::acquire(Direction direction, Budget budget, qint64 maximum)
+{
+    QMutexLocker locker(&d->mutex);
+    d->refill(direction);
+    const BandwidthLimiterPrivate::Bucket &bucket = d->bucket(direction, budget);
+    const qint64 granted = bucket.isLimited() ? qBound(qint64(0), bucket.tokens, maximum) : maximum;
+    d->charge(direction, budget, granted);
+    return granted;
+}
+
+void BandwidthLimiter::consume(Direction direction, Budget budget, qint64 bytes)
+{
+    QMutexLocker locker(&d->mutex);
+    d->refill(direction);
+    d->charge(direction, budget, bytes);
+}
+
+int BandwidthLimiter::delay(Direction direction, Budget budget) const
+{
+    QMutexLocker locker(&d->mutex);
+    d->refill(direction);
+    const BandwidthLimiterPrivate::Bucket &bucket = d->bucket(direction, budget);
+    if (!bucket.isLimited() || bucket.tokens > 0) {
+        return 0;
+    }
+    //Until there is at least one byte again
+    return int(qMin(qint64(60 * 1000), ((1 - bucket.tokens) * 1000 + bucket.rate - 1) / bucket.rate));
+}
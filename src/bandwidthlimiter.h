@@ -0,0 +1,98 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_BANDWIDTHLIMITER_H
+#define KIMAP2_BANDWIDTHLIMITER_H
+
+#include "kimap2_export.h"
+
+#include <QtCore/QtGlobal>
+
+namespace KIMAP2
+{
+
+class BandwidthLimiterPrivate;
+
+/**
+ * Limits the bandwidth of one or more sessions, see Session::setBandwidthLimiter().
+ *
+ * Each direction has a token bucket for interactive and one for background traffic.
+ * The traffic of a session counts as background while its current job has
+ * Job::BackgroundPriority, and as interactive otherwise. Interactive traffic also uses up the
+ * background budget, so background transfers slow down while the user waits for something,
+ * whereas background traffic never delays interactive traffic.
+ *
+ * Sessions that share a limiter share its rates, each getting what is left when it reads or
+ * writes. The limiter can be used from any thread.
+ *
+ * @code
+ * KIMAP2::BandwidthLimiter limiter;
+ * limiter.setRate(KIMAP2::BandwidthLimiter::Download, KIMAP2::BandwidthLimiter::Background, 512 * 1024);
+ * for (KIMAP2::Session *session : sessions) {
+ *     session->setBandwidthLimiter(&limiter);
+ * }
+ * @endcode
+ */
+class KIMAP2_EXPORT BandwidthLimiter
+{
+public:
+    enum Direction {
+        Download,
+        Upload
+    };
+
+    enum Budget {
+        Interactive,
+        Background
+    };
+
+    BandwidthLimiter();
+    ~BandwidthLimiter();
+
+    /**
+     * Limits @p budget of @p direction to @p bytesPerSecond, 0 (the default) doesn't limit it.
+     *
+     * After a pause up to @p burst bytes can be transferred at once, by default a second worth.
+     */
+    void setRate(Direction direction, Budget budget, qint64 bytesPerSecond, qint64 burst = 0);
+    qint64 rate(Direction direction, Budget budget) const;
+
+    /**
+     * Takes up to @p maximum bytes from @p budget and returns how many may be transferred now.
+     */
+    qint64 acquire(Direction direction, Budget budget, qint64 maximum);
+
+    /**
+     * Charges @p bytes that were transferred without acquiring them first, which can leave the
+     * budget in debt for a while. Negative values give back bytes that were acquired but not used.
+     */
+    void consume(Direction direction, Budget budget, qint64 bytes);
+
+    /**
+     * Returns the milliseconds until @p budget allows transferring something again, 0 if it
+     * does now.
+     */
+    int delay(Direction direction, Budget budget) const;
+
+private:
+    Q_DISABLE_COPY(BandwidthLimiter)
+    BandwidthLimiterPrivate *const d;
+};
+
+}
+
+#endif
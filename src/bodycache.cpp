@@ -0,0 +1,295 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "bodycache.h"
+
+#include <QtCore/QCache>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+
+#include <limits>
+
+namespace KIMAP2
+{
+
+class BodyCachePrivate
+{
+public:
+    BodyCachePrivate() : hits(0) { }
+
+    struct Locations {
+        Locations() : uidValidity(0) { }
+
+        qint64 uidValidity;
+        QHash<qint64, QByteArray> keys;
+    };
+
+    // The locations of @p mailBox for @p uidValidity, those for another one are dropped
+    Locations &locationsFor(const QString &mailBox, qint64 uidValidity)
+    {
+        Locations &mailBoxLocations = locations[mailBox];
+        if (mailBoxLocations.uidValidity != uidValidity) {
+            mailBoxLocations.keys.clear();
+            mailBoxLocations.uidValidity = uidValidity;
+        }
+        return mailBoxLocations;
+    }
+
+    const Locations *findLocations(const QString &mailBox, qint64 uidValidity) const
+    {
+        const auto found = locations.constFind(mailBox);
+        if (uidValidity <= 0 || found == locations.constEnd() || found->uidValidity != uidValidity) {
+            return Q_NULLPTR;
+        }
+        return &*found;
+    }
+
+    // The cost of a content in KiB, so that QCache's int limit allows for large caches
+    static int cost(qint64 bytes)
+    {
+        return int(qMax<qint64>(1, bytes / 1024));
+    }
+
+    mutable QMutex mutex;
+    QCache<QByteArray, QByteArray> contents;
+    QHash<QString, Locations> locations;
+    qint64 hits;
+};
+
+}
+
+using namespace KIMAP2;
+
+/**
+ * Returns the Message-ID in the header at the start of @p data, unfolded, or a null array.
+ */
+static QByteArray headerMessageId(const QByteArray &data)
+{
+    int position = 0;
+    while (position < data.size()) {
+        int end = data.indexOf('\n', position);
+        if (end < 0) {
+            end = data.size();
+        }
+        const QByteArray line = data.mid(position, end - position).trimmed();
+        if (line.isEmpty()) {
+            // The end of the header
+            return QByteArray();
+        }
+        if (qstrnicmp(line.constData(), "Message-ID:", 11) == 0) {
+            QByteArray value = line.mid(11);
+            // Folded onto the following lines
+            while (end + 1 < data.size() && (data.at(end + 1) == ' ' || data.at(end + 1) == '\t')) {
+                const int next = end + 1;
+                end = data.indexOf('\n', next);
+                if (end < 0) {
+                    end = data.size();
+                }
+                value += ' ' + data.mid(next, end - next).trimmed();
+            }
+            return value.trimmed();
+        }
+        position = end + 1;
+    }
+    return QByteArray();
+}
+
+BodyCache::BodyCache(qint64 maximumSize)
+    : d(new BodyCachePrivate)
+{
+    setMaximumSize(maximumSize);
+}
+
+BodyCache::~BodyCache()
+{
+    delete d;
+}
+
+void BodyCache::setMaximumSize(qint64 bytes)
+{
+    QMutexLocker locker(&d->mutex);
+    d->contents.setMaxCost(BodyCachePrivate::cost(qMin<qint64>(bytes, qint64(std::numeric_limits<int>::max()) * 1024)));
+}
+
+qint64 BodyCache::maximumSize() const
+{
+    QMutexLocker locker(&d->mutex);
+    return qint64(d->contents.maxCost()) * 1024;
+}
+
+qint64 BodyCache::size() const
+{
+    QMutexLocker locker(&d->mutex);
+    return qint64(d->contents.totalCost()) * 1024;
+}
+
+QByteArray BodyCache::emailIdKey(const QByteArray &emailId)
+{
+    return "EMAILID " + emailId;
+}
+
+QByteArray BodyCache::gmailMessageIdKey(qint64 messageId)
+{
+    return "X-GM-MSGID " + QByteArray::number(messageId);
+}
+
+QByteArray BodyCache::messageIdKey(qint64 size, const QByteArray &messageId)
+{
+    return "MESSAGE-ID " + QByteArray::number(size) + ' ' + messageId;
+}
+
+QByteArray BodyCache::keyOf(const FetchJob::Result &result)
+{
+    if (!result.emailId.isEmpty()) {
+        return emailIdKey(result.emailId);
+    }
+    if (result.gmailMessageId) {
+        return gmailMessageIdKey(result.gmailMessageId);
+    }
+
+    // RFC822.SIZE is the size of BODY[]
+    const qint64 size = result.size > 0 ? result.size : result.rawContent.size();
+    if (size <= 0) {
+        return QByteArray();
+    }
+    QByteArray messageId = result.envelope.messageId;
+    if (messageId.isEmpty()) {
+        messageId = headerMessageId(result.rawHeader.isNull() ? result.rawContent : result.rawHeader);
+    }
+#ifndef KIMAP2_NO_KMIME
+    if (messageId.isEmpty() && result.message && result.message->messageID(false)) {
+        messageId = result.message->messageID()->as7BitString(false);
+    }
+#endif
+    return messageId.isEmpty() ? QByteArray() : messageIdKey(size, messageId);
+}
+
+void BodyCache::insert(const QByteArray &key, const QByteArray &content)
+{
+    if (key.isEmpty() || content.isNull()) {
+        return;
+    }
+    //The content may point into a receive buffer or a mapped file
+    QByteArray *copy = new QByteArray(content.constData(), content.size());
+    QMutexLocker locker(&d->mutex);
+    d->contents.insert(key, copy, BodyCachePrivate::cost(content.size()));
+}
+
+QByteArray BodyCache::content(const QByteArray &key) const
+{
+    QMutexLocker locker(&d->mutex);
+    //The lookup makes it the most recently used
+    const QByteArray *content = d->contents.object(key);
+    if (!content) {
+        return QByteArray();
+    }
+    d->hits++;
+    return *content;
+}
+
+bool BodyCache::contains(const QByteArray &key) const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->contents.contains(key);
+}
+
+void BodyCache::setLocation(const QString &mailBox, qint64 uidValidity, qint64 uid, const QByteArray &key)
+{
+    if (key.isEmpty() || uidValidity <= 0) {
+        return;
+    }
+    QMutexLocker locker(&d->mutex);
+    d->locationsFor(mailBox, uidValidity).keys.insert(uid, key);
+}
+
+QByteArray BodyCache::keyAt(const QString &mailBox, qint64 uidValidity, qint64 uid) const
+{
+    QMutexLocker locker(&d->mutex);
+    const BodyCachePrivate::Locations *locations = d->findLocations(mailBox, uidValidity);
+    return locations ? locations->keys.value(uid) : QByteArray();
+}
+
+QHash<qint64, QByteArray> BodyCache::contents(const QString &mailBox, qint64 uidValidity, const ImapSet &uids) const
+{
+    QHash<qint64, QByteArray> result;
+    QMutexLocker locker(&d->mutex);
+    const BodyCachePrivate::Locations *locations = d->findLocations(mailBox, uidValidity);
+    if (!locations) {
+        return result;
+    }
+    for (auto it = locations->keys.constBegin(); it != locations->keys.constEnd(); ++it) {
+        if (!uids.contains(it.key())) {
+            continue;
+        }
+        if (const QByteArray *content = d->contents.object(it.value())) {
+            result.insert(it.key(), *content);
+            d->hits++;
+        }
+    }
+    return result;
+}
+
+void BodyCache::addCopies(const QString &sourceMailBox, qint64 sourceUidValidity, const ImapSet &sourceUids,
+                          const QString &mailBox, qint64 uidValidity, const ImapSet &uids)
+{
+    const QVector<ImapSet::Range> sources = sourceUids.ranges();
+    const QVector<ImapSet::Range> destinations = uids.ranges();
+    QMutexLocker locker(&d->mutex);
+    const BodyCachePrivate::Locations *source = d->findLocations(sourceMailBox, sourceUidValidity);
+    if (!source || source->keys.isEmpty() || uidValidity <= 0) {
+        return;
+    }
+    const QHash<qint64, QByteArray> sourceKeys = source->keys;
+    BodyCachePrivate::Locations &locations = d->locationsFor(mailBox, uidValidity);
+
+    // Without open ends, as in COPYUID
+    int j = 0;
+    qint64 destination = destinations.isEmpty() ? 0 : destinations.first().begin;
+    for (int i = 0; i < sources.size() && j < destinations.size(); ++i) {
+        const qint64 end = qMax(sources.at(i).begin, sources.at(i).end);
+        for (qint64 uid = sources.at(i).begin; uid <= end && j < destinations.size(); ++uid) {
+            const QByteArray key = sourceKeys.value(uid);
+            if (!key.isEmpty()) {
+                locations.keys.insert(destination, key);
+            }
+            if (destination < qMax(destinations.at(j).begin, destinations.at(j).end)) {
+                destination++;
+            } else if (++j < destinations.size()) {
+                destination = destinations.at(j).begin;
+            }
+        }
+    }
+}
+
+void BodyCache::removeMailBox(const QString &mailBox)
+{
+    QMutexLocker locker(&d->mutex);
+    d->locations.remove(mailBox);
+}
+
+void BodyCache::clear()
+{
+    QMutexLocker locker(&d->mutex);
+    d->contents.clear();
+    d->locations.clear();
+}
+
+qint64 BodyCache::hits() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->hits;
+}
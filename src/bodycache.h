@@ -0,0 +1,150 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_BODYCACHE_H
+#define KIMAP2_BODYCACHE_H
+
+#include "kimap2_export.h"
+
+#include "fetchjob.h"
+#include "imapset.h"
+
+#include <QtCore/QHash>
+
+namespace KIMAP2
+{
+
+class BodyCachePrivate;
+
+/**
+ * Keeps the content of messages by what identifies them across mailboxes, so a message that is
+ * in several mailboxes is only downloaded once, e.g. with Gmail's "All Mail" or archive copies.
+ *
+ * A message is identified by its EMAILID (RFC 8474), its X-GM-MSGID, or else by its size
+ * together with its Message-ID, see keyOf(). The cache also knows which UIDs of a mailbox
+ * hold which message, from FetchJobs that fetched these UIDs with the cache set, and from the
+ * COPYUID responses of CopyJobs and MoveJobs. A FetchJob with the cache set then leaves the
+ * UIDs whose content is cached out of the BODY.PEEK[] it sends, and fills their results from
+ * the cache instead.
+ *
+ * The contents are dropped least recently used first once maximumSize() is exceeded. The
+ * locations of a mailbox hold for one UIDVALIDITY, and are dropped once a location for another
+ * one is recorded, or removeMailBox() is called. Nothing is recorded or found for an unknown
+ * UIDVALIDITY of 0 or less. The cache can be shared by the sessions of one server,
+ * on any thread.
+ *
+ * @code
+ * KIMAP2::BodyCache cache;
+ * // Learns the X-GM-MSGID of the messages in "[Gmail]/All Mail"
+ * headerFetch->setBodyCache(&cache);
+ * ...
+ * // Only downloads what wasn't fetched from another mailbox before
+ * bodyFetch->setBodyCache(&cache);
+ * @endcode
+ */
+class KIMAP2_EXPORT BodyCache
+{
+public:
+    explicit BodyCache(qint64 maximumSize = 64 * 1024 * 1024);
+    ~BodyCache();
+
+    /**
+     * Sets how many bytes of content the cache keeps at most.
+     */
+    void setMaximumSize(qint64 bytes);
+    qint64 maximumSize() const;
+
+    /**
+     * The bytes of content the cache keeps now, rounded to KiB.
+     */
+    qint64 size() const;
+
+    /**
+     * The keys of a message by its EMAILID, its X-GM-MSGID or its size and Message-ID.
+     */
+    static QByteArray emailIdKey(const QByteArray &emailId);
+    static QByteArray gmailMessageIdKey(qint64 messageId);
+    static QByteArray messageIdKey(qint64 size, const QByteArray &messageId);
+
+    /**
+     * Returns the best key @p result has the data for, or an empty key.
+     *
+     * The Message-ID is taken from the envelope or from the fetched headers or content.
+     */
+    static QByteArray keyOf(const FetchJob::Result &result);
+
+    /**
+     * Keeps a copy of @p content, the message as the server sent it, under @p key.
+     */
+    void insert(const QByteArray &key, const QByteArray &content);
+
+    /**
+     * Returns the content kept under @p key, or a null array.
+     */
+    QByteArray content(const QByteArray &key) const;
+    bool contains(const QByteArray &key) const;
+
+    /**
+     * Records that the message with the UID @p uid in @p mailBox, while it has the UIDVALIDITY
+     * @p uidValidity, is the one of @p key.
+     */
+    void setLocation(const QString &mailBox, qint64 uidValidity, qint64 uid, const QByteArray &key);
+
+    /**
+     * Returns the key of the message with the UID @p uid in @p mailBox with the UIDVALIDITY
+     * @p uidValidity, or an empty key.
+     */
+    QByteArray keyAt(const QString &mailBox, qint64 uidValidity, qint64 uid) const;
+
+    /**
+     * Returns the cached contents of those messages among @p uids in @p mailBox with the
+     * UIDVALIDITY @p uidValidity whose location is known, by UID.
+     */
+    QHash<qint64, QByteArray> contents(const QString &mailBox, qint64 uidValidity, const ImapSet &uids) const;
+
+    /**
+     * Records that the messages @p sourceUids of @p sourceMailBox were copied to @p uids of
+     * @p mailBox, the n-th one to the n-th one, as a COPYUID response code lists them together
+     * with the UIDVALIDITY @p uidValidity of @p mailBox.
+     */
+    void addCopies(const QString &sourceMailBox, qint64 sourceUidValidity, const ImapSet &sourceUids,
+                   const QString &mailBox, qint64 uidValidity, const ImapSet &uids);
+
+    /**
+     * Forgets the locations in @p mailBox, e.g. after it was deleted.
+     */
+    void removeMailBox(const QString &mailBox);
+
+    /**
+     * Drops all contents and locations.
+     */
+    void clear();
+
+    /**
+     * How often content() and contents() found what they were asked for, i.e. the results
+     * of FetchJobs that were filled from the cache.
+     */
+    qint64 hits() const;
+
+private:
+    Q_DISABLE_COPY(BodyCache)
+    BodyCachePrivate *const d;
+};
+
+}
+
+#endif
@@ -0,0 +1,572 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "bodystructure.h"
+
+#include <QtCore/QSharedData>
+#include <QtCore/QVector>
+
+#ifndef KIMAP2_NO_KMIME
+#include <kmime/kmime_content.h>
+#endif
+
+using namespace KIMAP2;
+
+namespace
+{
+
+/**
+ * Where a string is in the text of the structure. NIL and missing strings have no offset.
+ */
+struct Span {
+    Span() : offset(-1), length(0), escaped(false) { }
+
+    bool isNull() const
+    {
+        return offset < 0;
+    }
+
+    int offset;
+    int length;
+    // A quoted string with backslash escapes
+    bool escaped;
+};
+
+struct Record {
+    Record()
+        : size(-1), lines(-1), parent(-1), ordinal(0), firstChild(-1), nextSibling(-1), childCount(0), multipart(false)
+    {
+    }
+
+    Span type;
+    Span subType;
+    // The parameter lists, including the parentheses
+    Span parameters;
+    Span id;
+    Span description;
+    Span encoding;
+    Span disposition;
+    Span dispositionParameters;
+    qint64 size;
+    qint64 lines;
+    int parent;
+    // The position among the parts of the parent, starting at 1
+    int ordinal;
+    int firstChild;
+    int nextSibling;
+    int childCount;
+    bool multipart;
+};
+
+/**
+ * Walks the text of a BODYSTRUCTURE once, recording the parts without copying any of it.
+ */
+class Decoder
+{
+public:
+    Decoder(const QByteArray &text, int begin, int end, QVector<Record> *records)
+        : data(text.constData()), pos(begin), end(end), records(records)
+    {
+    }
+
+    bool body(int parent, int ordinal, int *index);
+    bool string(Span *span);
+    bool atListEnd();
+
+private:
+    void skipSpaces()
+    {
+        while (pos < end && data[pos] == ' ') {
+            ++pos;
+        }
+    }
+    bool peek(char c)
+    {
+        skipSpaces();
+        return pos < end && data[pos] == c;
+    }
+    bool number(qint64 *value);
+    bool list(Span *span);
+    bool skipValue();
+    bool skipRemaining();
+    bool dispositionOf(int index);
+
+    const char *data;
+    int pos;
+    const int end;
+    QVector<Record> *records;
+};
+
+}
+
+bool Decoder::atListEnd()
+{
+    skipSpaces();
+    return pos >= end || data[pos] == ')';
+}
+
+bool Decoder::string(Span *span)
+{
+    skipSpaces();
+    if (pos >= end) {
+        return false;
+    }
+    *span = Span();
+    const char c = data[pos];
+    if (c == '"') {
+        const int start = ++pos;
+        while (pos < end && data[pos] != '"') {
+            if (data[pos] == '\\') {
+                span->escaped = true;
+                ++pos;
+            }
+            ++pos;
+        }
+        if (pos >= end) {
+            return false;
+        }
+        span->offset = start;
+        span->length = pos - start;
+        ++pos;
+        return true;
+    }
+    if (c == '{') {
+        qint64 size = 0;
+        ++pos;
+        while (pos < end && data[pos] >= '0' && data[pos] <= '9') {
+            size = size * 10 + (data[pos++] - '0');
+        }
+        // Also skips the CRLF after the closing brace
+        pos += 3;
+        if (pos + size > end) {
+            return false;
+        }
+        span->offset = pos;
+        span->length = size;
+        pos += size;
+        return true;
+    }
+    if (c == '(' || c == ')') {
+        return false;
+    }
+    const int start = pos;
+    while (pos < end && data[pos] != ' ' && data[pos] != '(' && data[pos] != ')') {
+        ++pos;
+    }
+    if (pos - start != 3 || qstrnicmp(data + start, "NIL", 3) != 0) {
+        span->offset = start;
+        span->length = pos - start;
+    }
+    return true;
+}
+
+bool Decoder::number(qint64 *value)
+{
+    Span span;
+    if (!string(&span)) {
+        return false;
+    }
+    *value = 0;
+    for (int i = span.offset; i < span.offset + span.length; ++i) {
+        if (data[i] < '0' || data[i] > '9') {
+            return false;
+        }
+        *value = *value * 10 + (data[i] - '0');
+    }
+    return true;
+}
+
+bool Decoder::list(Span *span)
+{
+    skipSpaces();
+    if (pos < end && data[pos] == '(') {
+        const int start = pos;
+        if (!skipValue()) {
+            return false;
+        }
+        span->offset = start;
+        span->length = pos - start;
+        span->escaped = false;
+        return true;
+    }
+    // NIL
+    return string(span);
+}
+
+bool Decoder::skipValue()
+{
+    if (!peek('(')) {
+        Span span;
+        return string(&span);
+    }
+    ++pos;
+    while (!peek(')')) {
+        if (pos >= end || !skipValue()) {
+            return false;
+        }
+    }
+    ++pos;
+    return true;
+}
+
+bool Decoder::skipRemaining()
+{
+    while (!peek(')')) {
+        if (pos >= end || !skipValue()) {
+            return false;
+        }
+    }
+    ++pos;
+    return true;
+}
+
+bool Decoder::dispositionOf(int index)
+{
+    if (!peek('(')) {
+        Span span;
+        return string(&span);
+    }
+    ++pos;
+    Span type;
+    Span parameters;
+    if (!string(&type) || !list(&parameters)) {
+        return false;
+    }
+    (*records)[index].disposition = type;
+    (*records)[index].dispositionParameters = parameters;
+    return skipRemaining();
+}
+
+bool Decoder::body(int parent, int ordinal, int *index)
+{
+    if (!peek('(')) {
+        return false;
+    }
+    ++pos;
+    *index = records->size();
+    Record record;
+    record.parent = parent;
+    record.ordinal = ordinal;
+    records->append(record);
+    // Only refer to the records by index below, they move when the vector grows
+
+    if (peek('(')) {
+        (*records)[*index].multipart = true;
+        int previous = -1;
+        int count = 0;
+        while (peek('(')) {
+            int child;
+            if (!body(*index, ++count, &child)) {
+                return false;
+            }
+            if (previous < 0) {
+                (*records)[*index].firstChild = child;
+            } else {
+                (*records)[previous].nextSibling = child;
+            }
+            previous = child;
+        }
+        (*records)[*index].childCount = count;
+        Span subType;
+        if (!string(&subType)) {
+            return false;
+        }
+        (*records)[*index].subType = subType;
+        // The extension data
+        if (!atListEnd()) {
+            Span parameters;
+            if (!list(&parameters)) {
+                return false;
+            }
+            (*records)[*index].parameters = parameters;
+        }
+        if (!atListEnd() && !dispositionOf(*index)) {
+            return false;
+        }
+        return skipRemaining();
+    }
+
+    Record fields;
+    if (!string(&fields.type) || !string(&fields.subType) || !list(&fields.parameters) ||
+            !string(&fields.id) || !string(&fields.description) || !string(&fields.encoding) ||
+            !number(&fields.size)) {
+        return false;
+    }
+    Record &current = (*records)[*index];
+    current.type = fields.type;
+    current.subType = fields.subType;
+    current.parameters = fields.parameters;
+    current.id = fields.id;
+    current.description = fields.description;
+    current.encoding = fields.encoding;
+    current.size = fields.size;
+
+    const bool text = fields.type.length == 4 && qstrnicmp(data + fields.type.offset, "TEXT", 4) == 0;
+    const bool message = fields.type.length == 7 && qstrnicmp(data + fields.type.offset, "MESSAGE", 7) == 0 &&
+                         fields.subType.length == 6 && qstrnicmp(data + fields.subType.offset, "RFC822", 6) == 0;
+    qint64 lines = -1;
+    if (text) {
+        if (!number(&lines)) {
+            return false;
+        }
+    } else if (message) {
+        int child;
+        if (!skipValue() || !body(*index, 1, &child) || !number(&lines)) {
+            return false;
+        }
+        (*records)[*index].firstChild = child;
+        (*records)[*index].childCount = 1;
+    }
+    (*records)[*index].lines = lines;
+
+    // The extension data starts with the MD5
+    if (!atListEnd() && !skipValue()) {
+        return false;
+    }
+    if (!atListEnd() && !dispositionOf(*index)) {
+        return false;
+    }
+    return skipRemaining();
+}
+
+class BodyStructure::Private : public QSharedData
+{
+public:
+    QByteArray string(const Span &span) const
+    {
+        if (span.isNull()) {
+            return QByteArray();
+        }
+        QByteArray result(text.constData() + span.offset, span.length);
+        if (span.escaped) {
+            int out = 0;
+            for (int in = 0; in < result.size(); ++in) {
+                if (result[in] == '\\' && in + 1 < result.size()) {
+                    ++in;
+                }
+                result[out++] = result[in];
+            }
+            result.truncate(out);
+        }
+        return result;
+    }
+
+    QByteArray parameter(const Span &list, const char *name) const
+    {
+        if (list.isNull() || list.length < 2) {
+            return QByteArray();
+        }
+        const int nameLength = qstrlen(name);
+        Decoder decoder(text, list.offset + 1, list.offset + list.length - 1, Q_NULLPTR);
+        Span key;
+        Span value;
+        while (!decoder.atListEnd() && decoder.string(&key) && decoder.string(&value)) {
+            if (key.length == nameLength && qstrnicmp(text.constData() + key.offset, name, nameLength) == 0) {
+                return string(value);
+            }
+        }
+        return QByteArray();
+    }
+
+    QByteArray partId(int index) const
+    {
+        const Record &record = records.at(index);
+        if (record.parent < 0) {
+            return record.multipart ? QByteArray() : QByteArray("1");
+        }
+        const QByteArray parentId = partId(record.parent);
+        if (records.at(record.parent).multipart) {
+            return parentId.isEmpty() ? QByteArray::number(record.ordinal) : parentId + '.' + QByteArray::number(record.ordinal);
+        }
+        // The body of a message/rfc822 part, a multipart has no number of its own
+        return record.multipart ? parentId : parentId + ".1";
+    }
+
+    QByteArray text;
+    QVector<Record> records;
+};
+
+BodyStructure::BodyStructure()
+    : d(new Private), m_index(-1)
+{
+}
+
+BodyStructure::BodyStructure(const BodyStructure &other)
+    : d(other.d), m_index(other.m_index)
+{
+}
+
+BodyStructure::~BodyStructure()
+{
+}
+
+BodyStructure &BodyStructure::operator=(const BodyStructure &other)
+{
+    if (this != &other) {
+        d = other.d;
+        m_index = other.m_index;
+    }
+    return *this;
+}
+
+BodyStructure BodyStructure::fromImapList(const QByteArray &structure)
+{
+    BodyStructure result;
+    result.d->text = structure;
+    Decoder decoder(result.d->text, 0, result.d->text.size(), &result.d->records);
+    int index;
+    if (!decoder.body(-1, 1, &index)) {
+        return BodyStructure();
+    }
+    result.m_index = index;
+    return result;
+}
+
+bool BodyStructure::isValid() const
+{
+    return m_index >= 0;
+}
+
+QByteArray BodyStructure::partId() const
+{
+    return isValid() ? d->partId(m_index) : QByteArray();
+}
+
+QByteArray BodyStructure::type() const
+{
+    if (!isValid()) {
+        return QByteArray();
+    }
+    return isMultipart() ? QByteArray("MULTIPART") : d->string(d->records.at(m_index).type);
+}
+
+QByteArray BodyStructure::subType() const
+{
+    return isValid() ? d->string(d->records.at(m_index).subType) : QByteArray();
+}
+
+bool BodyStructure::isMultipart() const
+{
+    return isValid() && d->records.at(m_index).multipart;
+}
+
+QByteArray BodyStructure::parameter(const char *name) const
+{
+    return isValid() ? d->parameter(d->records.at(m_index).parameters, name) : QByteArray();
+}
+
+QByteArray BodyStructure::id() const
+{
+    return isValid() ? d->string(d->records.at(m_index).id) : QByteArray();
+}
+
+QByteArray BodyStructure::description() const
+{
+    return isValid() ? d->string(d->records.at(m_index).description) : QByteArray();
+}
+
+QByteArray BodyStructure::encoding() const
+{
+    return isValid() ? d->string(d->records.at(m_index).encoding) : QByteArray();
+}
+
+qint64 BodyStructure::size() const
+{
+    return isValid() ? d->records.at(m_index).size : -1;
+}
+
+qint64 BodyStructure::lines() const
+{
+    return isValid() ? d->records.at(m_index).lines : -1;
+}
+
+QByteArray BodyStructure::disposition() const
+{
+    return isValid() ? d->string(d->records.at(m_index).disposition) : QByteArray();
+}
+
+QByteArray BodyStructure::dispositionParameter(const char *name) const
+{
+    return isValid() ? d->parameter(d->records.at(m_index).dispositionParameters, name) : QByteArray();
+}
+
+int BodyStructure::childCount() const
+{
+    return isValid() ? d->records.at(m_index).childCount : 0;
+}
+
+BodyStructure BodyStructure::child(int index) const
+{
+    BodyStructure result;
+    if (index < 0 || index >= childCount()) {
+        return result;
+    }
+    int child = d->records.at(m_index).firstChild;
+    for (int i = 0; i < index; ++i) {
+        child = d->records.at(child).nextSibling;
+    }
+    result.d = d;
+    result.m_index = child;
+    return result;
+}
+
+#ifndef KIMAP2_NO_KMIME
+KMime::Content *BodyStructure::toContent() const
+{
+    KMime::Content *content = new KMime::Content;
+    applyTo(content);
+    return content;
+}
+
+void BodyStructure::applyTo(KMime::Content *content) const
+{
+    if (!isValid()) {
+        return;
+    }
+
+    if (isMultipart()) {
+        content->contentType()->setMimeType("MULTIPART/MIXED");
+        for (int i = 0; i < childCount(); ++i) {
+            KMime::Content *childContent = new KMime::Content;
+            content->addContent(childContent);
+            child(i).applyTo(childContent);
+            childContent->assemble();
+        }
+        content->contentType()->setMimeType("MULTIPART/" + subType());
+        const QByteArray boundary = parameter("BOUNDARY");
+        if (!boundary.isEmpty()) {
+            content->contentType()->setBoundary(boundary);
+        }
+    } else {
+        content->contentType()->setMimeType(type() + '/' + subType());
+        content->contentDescription()->from7BitString(description());
+    }
+
+    const QByteArray dispositionType = disposition();
+    if (qstricmp(dispositionType.constData(), "INLINE") == 0) {
+        content->contentDisposition()->setDisposition(KMime::Headers::CDinline);
+    } else if (qstricmp(dispositionType.constData(), "ATTACHMENT") == 0) {
+        content->contentDisposition()->setDisposition(KMime::Headers::CDattachment);
+    } else {
+        return;
+    }
+    const QByteArray filename = dispositionParameter("FILENAME");
+    if (!filename.isEmpty()) {
+        content->contentDisposition()->setFilename(QLatin1String(filename));
+    }
+}
+#endif
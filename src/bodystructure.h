@@ -0,0 +1,134 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_BODYSTRUCTURE_H
+#define KIMAP2_BODYSTRUCTURE_H
+
+#include "kimap2_export.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QMetaType>
+#include <QtCore/QSharedDataPointer>
+
+#ifndef KIMAP2_NO_KMIME
+namespace KMime
+{
+class Content;
+}
+#endif
+
+namespace KIMAP2
+{
+
+/**
+  The MIME structure of a message as described by a BODYSTRUCTURE response (RFC 3501).
+
+  The structure is decoded in a single pass that only records where the fields are in
+  the text sent by the server, the strings are only copied out when asked for. A part and
+  all parts of its tree share the text and are cheap to copy. This class is implicitly shared.
+
+  Use toContent() to get the structure as KMime objects if required, which isn't
+  available in the KIMAP2Core library.
+*/
+class KIMAP2_EXPORT BodyStructure
+{
+public:
+    /**
+      Constructs an invalid structure.
+    */
+    BodyStructure();
+    BodyStructure(const BodyStructure &other);
+    ~BodyStructure();
+    BodyStructure &operator=(const BodyStructure &other);
+
+    /**
+      Decodes a BODYSTRUCTURE list, including the outer parentheses.
+
+      Returns an invalid structure if @p structure is malformed.
+    */
+    static BodyStructure fromImapList(const QByteArray &structure);
+
+    bool isValid() const;
+
+    /**
+      The part number to use in BODY[...], e.g. "1.2", or an empty one for the
+      top-level multipart of a message.
+    */
+    QByteArray partId() const;
+
+    /**
+      The media type and subtype as sent, e.g. "TEXT" and "PLAIN".
+    */
+    QByteArray type() const;
+    QByteArray subType() const;
+    bool isMultipart() const;
+
+    /**
+      Returns the body parameter @p name, e.g. "CHARSET" or "BOUNDARY", ignoring the case.
+    */
+    QByteArray parameter(const char *name) const;
+
+    QByteArray id() const;
+    QByteArray description() const;
+    QByteArray encoding() const;
+    /**
+      The size of the encoded body in octets, or -1 for multiparts.
+    */
+    qint64 size() const;
+    /**
+      The number of lines of text and message/rfc822 parts, -1 otherwise.
+    */
+    qint64 lines() const;
+
+    /**
+      The disposition type, e.g. "ATTACHMENT", or an empty one if the server didn't send one.
+    */
+    QByteArray disposition() const;
+    QByteArray dispositionParameter(const char *name) const;
+
+    /**
+      The parts of a multipart, or the encapsulated body of a message/rfc822 part.
+    */
+    int childCount() const;
+    BodyStructure child(int index) const;
+
+#ifndef KIMAP2_NO_KMIME
+    /**
+      Builds the KMime representation of this part and all parts below it.
+
+      The contents only have headers, since the structure doesn't contain the bodies.
+      The caller owns the returned content.
+    */
+    KMime::Content *toContent() const;
+
+    /**
+      Describes this part and all parts below it as KMime headers on @p content.
+    */
+    void applyTo(KMime::Content *content) const;
+#endif
+
+private:
+    class Private;
+    QSharedDataPointer<Private> d;
+    int m_index;
+};
+
+}
+
+Q_DECLARE_METATYPE(KIMAP2::BodyStructure)
+
+#endif
@@ -55,6 +55,14 @@ QStringList CapabilitiesJob::capabilities() const
 void CapabilitiesJob::doStart()
 {
     Q_D(CapabilitiesJob);
+    //Kept up to date by the session, from every announcement on this connection
+    const QStringList known = d->m_session->capabilities();
+    if (!known.isEmpty()) {
+        d->capabilities = known;
+        emit capabilitiesReceived(d->capabilities);
+        emitResult();
+        return;
+    }
     d->sendCommand("CAPABILITY", {});
 }
 
@@ -42,6 +42,9 @@ class CapabilitiesJobPrivate;
  * inaccurate: the server may claim to support something
  * it does not implement properly, or it may omit a feature
  * that it does, in reality, support.
+ *
+ * If the session already knows the capabilities of the connection, see
+ * Session::capabilities(), the job finishes with them without sending CAPABILITY.
  */
 class KIMAP2_EXPORT CapabilitiesJob : public Job
 {
@@ -29,7 +29,7 @@ extern "C" {
 #include <sasl/sasl.h>
 }
 
-inline bool initSASL()
+inline bool initSASLLibrary()
 {
 #ifdef Q_OS_WIN
     for (const auto &path : QCoreApplication::libraryPaths()) {
@@ -52,4 +52,13 @@ inline bool initSASL()
     return true;
 }
 
+/**
+ * Initializes the SASL library on first use, later calls only return the outcome.
+ */
+inline bool initSASL()
+{
+    static const bool initialized = initSASLLibrary();
+    return initialized;
+}
+
 #endif
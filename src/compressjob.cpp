@@ -0,0 +1,68 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "compressjob.h"
+
+#include "job_p.h"
+#include "message_p.h"
+#include "session_p.h"
+
+namespace KIMAP2
+{
+class CompressJobPrivate : public JobPrivate
+{
+public:
+    CompressJobPrivate(Session *session, const QString &name) : JobPrivate(session, name) { }
+    ~CompressJobPrivate() { }
+};
+}
+
+using namespace KIMAP2;
+
+CompressJob::CompressJob(Session *session)
+    : Job(*new CompressJobPrivate(session, "Compress"))
+{
+}
+
+CompressJob::~CompressJob()
+{
+}
+
+void CompressJob::doStart()
+{
+    Q_D(CompressJob);
+    if (d->sessionInternal()->isCompressionActive()) {
+        setError(CommandFailed);
+        setErrorText(QStringLiteral("Compression is already active."));
+        emitResult();
+        return;
+    }
+    d->sendCommand("COMPRESS", "DEFLATE");
+}
+
+void CompressJob::handleResponse(const Message &response)
+{
+    Q_D(CompressJob);
+
+    //The server compresses everything after the tagged OK, so switch before parsing on
+    if (response.content.size() >= 2
+            && d->tags.contains(response.content.first().toString())
+            && response.content[1].keyword() == ImapKeyword::Ok) {
+        d->sessionInternal()->startCompression();
+    }
+    handleErrorReplies(response);
+}
@@ -19,6 +19,7 @@
 
 #include "copyjob.h"
 
+#include "bodycache.h"
 #include "job_p.h"
 #include "message_p.h"
 #include "session_p.h"
@@ -31,13 +32,17 @@ namespace KIMAP2
 class CopyJobPrivate : public JobPrivate
 {
 public:
-    CopyJobPrivate(Session *session, const QString &name) : JobPrivate(session, name), uidBased(false) { }
+    CopyJobPrivate(Session *session, const QString &name) : JobPrivate(session, name), uidBased(false), maximumSetLength(0), bodyCache(Q_NULLPTR), sourceUidValidity(-1) { }
     ~CopyJobPrivate() { }
 
     QString mailBox;
     ImapSet set;
     bool uidBased;
-    ImapSet resultingUids;
+    int maximumSetLength;
+    CopyUidMap copyUids;
+    BodyCache *bodyCache;
+    QString sourceMailBox;
+    qint64 sourceUidValidity;
 };
 }
 
@@ -90,42 +95,81 @@ bool CopyJob::isUidBased() const
     return d->uidBased;
 }
 
+void CopyJob::setMaximumSetLength(int length)
+{
+    Q_D(CopyJob);
+    d->maximumSetLength = length;
+}
+
+int CopyJob::maximumSetLength() const
+{
+    Q_D(const CopyJob);
+    return d->maximumSetLength;
+}
+
 ImapSet CopyJob::resultingUids() const
 {
     Q_D(const CopyJob);
-    return d->resultingUids;
+    return d->copyUids.destination;
+}
+
+ImapSet CopyJob::sourceUids() const
+{
+    Q_D(const CopyJob);
+    return d->copyUids.source;
+}
+
+qint64 CopyJob::resultingUid(qint64 sourceUid) const
+{
+    Q_D(const CopyJob);
+    return d->copyUids.destinationOf(sourceUid);
+}
+
+qint64 CopyJob::uidValidity() const
+{
+    Q_D(const CopyJob);
+    return d->copyUids.uidValidity;
+}
+
+void CopyJob::setBodyCache(BodyCache *cache)
+{
+    Q_D(CopyJob);
+    d->bodyCache = cache;
 }
 
 void CopyJob::doStart()
 {
     Q_D(CopyJob);
+    d->sourceMailBox = d->m_session->selectedMailBox();
+    d->sourceUidValidity = d->sessionInternal()->selectedUidValidity;
 
     d->set.optimize();
-    QByteArray parameters = d->set.toImapSequenceSet() + ' ';
-    parameters += '\"' + KIMAP2::encodeImapFolderName(d->mailBox.toUtf8()) + '\"';
+    const QByteArray mailBox = '\"' + d->sessionInternal()->encodeMailBoxName(d->mailBox) + '\"';
 
     QByteArray command = "COPY";
     if (d->uidBased) {
         command = "UID " + command;
     }
 
-    d->sendCommand(command, parameters);
+    const QList<ImapSet> chunks = d->uidBased ? d->set.split(d->maximumSetLength) : QList<ImapSet>() << d->set;
+    foreach (const ImapSet &chunk, chunks) {
+        d->sendCommand(command, chunk.toImapSequenceSet() + ' ' + mailBox);
+    }
 }
 
 void CopyJob::handleResponse(const Message &response)
 {
     Q_D(CopyJob);
 
-    for (QList<Message::Part>::ConstIterator it = response.responseCode.begin();
-            it != response.responseCode.end(); ++it) {
-        if (it->toString() == "COPYUID") {
-            it = it + 3;
-            if (it < response.responseCode.end()) {
-                d->resultingUids = ImapSet::fromImapSequenceSet(it->toString());
-            }
-            break;
+    if (d->bodyCache) {
+        CopyUidMap copied;
+        copied.parse(response);
+        if (!copied.source.isEmpty()) {
+            d->bodyCache->addCopies(d->sourceMailBox, d->sourceUidValidity, copied.source,
+                                    d->mailBox, copied.uidValidity, copied.destination);
         }
     }
+    d->copyUids.parse(response);
 
     handleErrorReplies(response);
 }
@@ -30,6 +30,7 @@ namespace KIMAP2
 
 class Session;
 struct Message;
+class BodyCache;
 class CopyJobPrivate;
 
 /**
@@ -80,6 +81,8 @@ public:
      * RFC 3501 is unclear as to what should happen if invalid sequence numbers
      * are passed.  If non-existent UIDs are passed, they will be ignored.
      *
+     * ImapSet::savedSearchResult() copies the result a SearchJob saved on the server.
+     *
      * @param set  the sequence numbers or UIDs of the messages to be copied
      */
     void setSequenceSet(const ImapSet &set);
@@ -110,6 +113,17 @@ public:
      */
     bool isUidBased() const;
 
+    /**
+     * Splits the sequence set so that each command carries at most @p length bytes of it.
+     *
+     * Servers limit the length of command lines, which sparse UID sets easily exceed.
+     * The commands are sent back-to-back without waiting for each other, and the job
+     * fails if one of them fails. resultingUids() collects the UIDs of all of them, in order.
+     * Only for UID based copies. The default is 0, which copies everything with a single command.
+     */
+    void setMaximumSetLength(int length);
+    int maximumSetLength() const;
+
     /**
      * The UIDs of the new copies of the messages
      *
@@ -118,6 +132,37 @@ public:
      */
     ImapSet resultingUids() const;
 
+    /**
+     * The UIDs of the copied messages in the source mailbox, as the server listed them
+     * for resultingUids(). Each one was copied to the UID at the same position there.
+     *
+     * This will be an empty set if the server does not support the UIDPLUS extension.
+     */
+    ImapSet sourceUids() const;
+
+    /**
+     * Returns the UID of the copy of the message with the UID @p sourceUid,
+     * or 0 if the server didn't report it.
+     *
+     * Pairs sourceUids() and resultingUids() interval by interval, so this is cheap
+     * even for large sets.
+     */
+    qint64 resultingUid(qint64 sourceUid) const;
+
+    /**
+     * The UIDVALIDITY of the destination mailbox from the COPYUID response code, which
+     * resultingUids() are valid for. Zero if the server does not support the UIDPLUS extension.
+     */
+    qint64 uidValidity() const;
+
+    /**
+     * Records in @p cache which messages the copies are, from the COPYUID response code,
+     * so a FetchJob in the destination mailbox takes their content from the cache.
+     *
+     * The cache is not owned and has to stay valid until the job finished.
+     */
+    void setBodyCache(BodyCache *cache);
+
 protected:
     void doStart() Q_DECL_OVERRIDE;
     void handleResponse(const Message &response) Q_DECL_OVERRIDE;
@@ -50,7 +50,7 @@ CreateJob::~CreateJob()
 void CreateJob::doStart()
 {
     Q_D(CreateJob);
-    d->sendCommand("CREATE", '\"' + KIMAP2::encodeImapFolderName(d->mailBox.toUtf8()) + '\"');
+    d->sendCommand("CREATE", '\"' + d->sessionInternal()->encodeMailBoxName(d->mailBox) + '\"');
 }
 
 void CreateJob::handleResponse(const Message &response)
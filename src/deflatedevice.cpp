@@ -0,0 +1,166 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "deflatedevice_p.h"
+
+#include "kimap_debug.h"
+
+#include <cstring>
+
+using namespace KIMAP2;
+
+static const int chunkSize = 16 * 1024;
+// Don't decompress further ahead than this
+static const int maximumBuffered = 64 * 1024;
+
+DeflateDevice::DeflateDevice(QIODevice *device, const QByteArray &pendingInput)
+    : QIODevice(),
+      m_device(device),
+      m_input(pendingInput),
+      m_position(0),
+      m_chunk(chunkSize, Qt::Uninitialized),
+      m_compressedBytesRead(0),
+      m_decompressedBytesRead(0),
+      m_error(false)
+{
+    memset(&m_deflate, 0, sizeof(m_deflate));
+    memset(&m_inflate, 0, sizeof(m_inflate));
+    //Negative window bits select raw deflate without zlib header
+    if (deflateInit2(&m_deflate, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK
+            || inflateInit2(&m_inflate, -15) != Z_OK) {
+        qCWarning(KIMAP2_LOG) << "Failed to initialize zlib";
+        m_error = true;
+    }
+    open(QIODevice::ReadWrite | QIODevice::Unbuffered);
+}
+
+DeflateDevice::~DeflateDevice()
+{
+    deflateEnd(&m_deflate);
+    inflateEnd(&m_inflate);
+}
+
+bool DeflateDevice::isSequential() const
+{
+    return true;
+}
+
+qint64 DeflateDevice::bytesAvailable() const
+{
+    //Only decompressed data is available, and the device may have more
+    const_cast<DeflateDevice *>(this)->inflateAvailable();
+    return m_output.size() - m_position + QIODevice::bytesAvailable();
+}
+
+bool DeflateDevice::waitForReadyRead(int msecs)
+{
+    if (bytesAvailable()) {
+        return true;
+    }
+    return m_device->waitForReadyRead(msecs) && bytesAvailable();
+}
+
+bool DeflateDevice::error() const
+{
+    return m_error;
+}
+
+qint64 DeflateDevice::compressedBytesRead() const
+{
+    return m_compressedBytesRead;
+}
+
+qint64 DeflateDevice::decompressedBytesRead() const
+{
+    return m_decompressedBytesRead;
+}
+
+qint64 DeflateDevice::readData(char *data, qint64 maxSize)
+{
+    inflateAvailable();
+    const int size = qMin(maxSize, qint64(m_output.size() - m_position));
+    memcpy(data, m_output.constData() + m_position, size);
+    m_position += size;
+    if (m_position == m_output.size()) {
+        m_output.resize(0);
+        m_position = 0;
+    }
+    return size;
+}
+
+qint64 DeflateDevice::writeData(const char *data, qint64 size)
+{
+    if (m_error) {
+        return -1;
+    }
+    m_deflate.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    m_deflate.avail_in = size;
+    //Flush after every write, the server waits for the complete command
+    do {
+        m_deflate.next_out = reinterpret_cast<Bytef *>(m_chunk.data());
+        m_deflate.avail_out = chunkSize;
+        if (deflate(&m_deflate, Z_SYNC_FLUSH) == Z_STREAM_ERROR) {
+            qCWarning(KIMAP2_LOG) << "Failed to compress data";
+            m_error = true;
+            return -1;
+        }
+        const int compressed = chunkSize - m_deflate.avail_out;
+        if (m_device->write(m_chunk.constData(), compressed) != compressed) {
+            return -1;
+        }
+    } while (m_deflate.avail_out == 0);
+    return size;
+}
+
+void DeflateDevice::inflateAvailable()
+{
+    if (m_error) {
+        return;
+    }
+    while (m_output.size() - m_position < maximumBuffered) {
+        if (m_input.isEmpty()) {
+            if (!m_device->bytesAvailable()) {
+                return;
+            }
+            m_input = m_device->read(chunkSize);
+            m_compressedBytesRead += m_input.size();
+        }
+
+        //Drop what was read before growing the buffer
+        if (m_position > 0) {
+            m_output.remove(0, m_position);
+            m_position = 0;
+        }
+        const int outputStart = m_output.size();
+        m_output.resize(outputStart + chunkSize);
+        m_inflate.next_in = reinterpret_cast<Bytef *>(m_input.data());
+        m_inflate.avail_in = m_input.size();
+        m_inflate.next_out = reinterpret_cast<Bytef *>(m_output.data() + outputStart);
+        m_inflate.avail_out = chunkSize;
+        const int result = inflate(&m_inflate, Z_SYNC_FLUSH);
+        m_output.resize(outputStart + chunkSize - m_inflate.avail_out);
+        m_decompressedBytesRead += chunkSize - m_inflate.avail_out;
+        m_input.remove(0, m_input.size() - m_inflate.avail_in);
+
+        if (result != Z_OK && result != Z_BUF_ERROR) {
+            //There is no way to recover the stream
+            qCWarning(KIMAP2_LOG) << "Failed to decompress data:" << result;
+            m_error = true;
+            return;
+        }
+    }
+}
@@ -0,0 +1,79 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_DEFLATEDEVICE_P_H
+#define KIMAP2_DEFLATEDEVICE_P_H
+
+#include <QtCore/QIODevice>
+
+#include <zlib.h>
+
+namespace KIMAP2
+{
+
+/**
+ * Compresses what is written to and decompresses what is read from another device,
+ * as raw deflate streams (RFC 1951) like COMPRESS=DEFLATE (RFC 4978) uses them.
+ *
+ * Every write is flushed, so a command never waits in the compressor.
+ * The wrapped device must only be read and written through this one, but still emits its own signals.
+ */
+class DeflateDevice : public QIODevice
+{
+public:
+    /**
+     * @param pendingInput compressed data that was already read from @p device
+     */
+    explicit DeflateDevice(QIODevice *device, const QByteArray &pendingInput = QByteArray());
+    ~DeflateDevice();
+
+    bool isSequential() const Q_DECL_OVERRIDE;
+    qint64 bytesAvailable() const Q_DECL_OVERRIDE;
+    bool waitForReadyRead(int msecs) Q_DECL_OVERRIDE;
+
+    /**
+     * Returns true if the streams are broken, after which nothing is read or written anymore.
+     */
+    bool error() const;
+
+    qint64 compressedBytesRead() const;
+    qint64 decompressedBytesRead() const;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) Q_DECL_OVERRIDE;
+    qint64 writeData(const char *data, qint64 size) Q_DECL_OVERRIDE;
+
+private:
+    void inflateAvailable();
+
+    QIODevice *m_device;
+    z_stream m_deflate;
+    z_stream m_inflate;
+    // Compressed input the inflater hasn't consumed yet
+    QByteArray m_input;
+    // Decompressed data from m_position on is ready to be read
+    QByteArray m_output;
+    int m_position;
+    QByteArray m_chunk;
+    qint64 m_compressedBytesRead;
+    qint64 m_decompressedBytesRead;
+    bool m_error;
+};
+
+}
+
+#endif
@@ -51,7 +51,8 @@ void DeleteAclJob::doStart()
 {
     Q_D(DeleteAclJob);
 
-    d->sendCommand("DELETEACL", '\"' + KIMAP2::encodeImapFolderName(d->mailBox.toUtf8()) + "\" \"" + d->id);
+    d->sessionInternal()->forgetMailBoxInfo(d->mailBox);
+    d->sendCommand("DELETEACL", '\"' + d->sessionInternal()->encodeMailBoxName(d->mailBox) + "\" \"" + d->id);
 }
 
 void DeleteAclJob::setIdentifier(const QByteArray &identifier)
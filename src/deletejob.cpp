@@ -50,7 +50,8 @@ DeleteJob::~DeleteJob()
 void DeleteJob::doStart()
 {
     Q_D(DeleteJob);
-    d->sendCommand("DELETE", '\"' + KIMAP2::encodeImapFolderName(d->mailBox.toUtf8()) + '\"');
+    d->sessionInternal()->forgetMailBoxInfo(d->mailBox);
+    d->sendCommand("DELETE", '\"' + d->sessionInternal()->encodeMailBoxName(d->mailBox) + '\"');
 }
 
 void DeleteJob::handleResponse(const Message &response)
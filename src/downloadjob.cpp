@@ -0,0 +1,276 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "downloadjob.h"
+
+#include "job_p.h"
+#include "message_p.h"
+#include "session_p.h"
+
+#include <QIODevice>
+
+namespace KIMAP2
+{
+class DownloadJobPrivate : public JobPrivate
+{
+public:
+    DownloadJobPrivate(DownloadJob *job, Session *session, const QString &name)
+        : JobPrivate(session, name)
+        , q(job)
+        , uid(0)
+        , rangeSize(4 * 1024 * 1024)
+        , maximumPendingRanges(2)
+        , offset(0)
+        , nextOrigin(0)
+        , found(false)
+        , complete(false)
+        , failed(false)
+    {
+        literalSinkProvider = [this](const Message &, const QByteArray &name, qint64) {
+            qint64 origin;
+            if (!parseItem(name, &origin)) {
+                return ImapStreamParser::LiteralSink();
+            }
+            return ImapStreamParser::LiteralSink([this, origin](const char *data, const int size) {
+                write(origin, data, size);
+            });
+        };
+    }
+    ~DownloadJobPrivate() { }
+
+    bool parseItem(const QByteArray &name, qint64 *origin) const;
+    void sendNextRange();
+    void write(qint64 origin, const char *data, int size);
+    void fail(const QString &text);
+
+    DownloadJob *const q;
+    qint64 uid;
+    QByteArray part;
+    qint64 rangeSize;
+    int maximumPendingRanges;
+    // Everything before it was passed on
+    qint64 offset;
+    qint64 nextOrigin;
+    // The origin of the range requested with each tag
+    QHash<QByteArray, qint64> rangeOrigins;
+    // How much of each requested range arrived
+    QHash<qint64, qint64> received;
+    DownloadJob::DataSink sink;
+    QByteArray data;
+    bool found;
+    // A range came back short, so the end of the content was reached
+    bool complete;
+    bool failed;
+};
+}
+
+using namespace KIMAP2;
+
+bool DownloadJobPrivate::parseItem(const QByteArray &name, qint64 *origin) const
+{
+    // BODY[<part>]<origin>
+    const QByteArray section = "BODY[" + part + "]<";
+    if (!name.startsWith(section) || !name.endsWith('>')) {
+        return false;
+    }
+    bool ok;
+    *origin = name.mid(section.size(), name.size() - section.size() - 1).toLongLong(&ok);
+    return ok;
+}
+
+void DownloadJobPrivate::sendNextRange()
+{
+    QByteArray items = "(BODY.PEEK[" + part + "]<" + QByteArray::number(nextOrigin) + '.' + QByteArray::number(rangeSize) + '>';
+    if (part.isEmpty() && rangeOrigins.isEmpty() && !found) {
+        // For the progress
+        items += " RFC822.SIZE";
+    }
+    items += ')';
+    sendCommand("UID FETCH", QByteArray::number(uid) + ' ' + items);
+    rangeOrigins.insert(tags.last(), nextOrigin);
+    received.insert(nextOrigin, 0);
+    nextOrigin += rangeSize;
+}
+
+void DownloadJobPrivate::write(qint64 origin, const char *data, int size)
+{
+    if (failed || size <= 0) {
+        return;
+    }
+    if (!received.contains(origin) || origin + received.value(origin) != offset) {
+        fail(QStringLiteral("%1 failed, the ranges arrived out of order.").arg(m_name));
+        return;
+    }
+    if (sink) {
+        sink(data, size);
+    } else {
+        this->data.append(data, size);
+    }
+    received[origin] += size;
+    offset += size;
+    q->setProcessedAmount(KJob::Bytes, offset);
+}
+
+void DownloadJobPrivate::fail(const QString &text)
+{
+    failed = true;
+    q->setError(CommandFailed);
+    q->setErrorText(text);
+}
+
+DownloadJob::DownloadJob(Session *session)
+    : Job(*new DownloadJobPrivate(this, session, "Download"))
+{
+}
+
+DownloadJob::~DownloadJob()
+{
+}
+
+void DownloadJob::setUid(qint64 uid)
+{
+    Q_D(DownloadJob);
+    d->uid = uid;
+}
+
+qint64 DownloadJob::uid() const
+{
+    Q_D(const DownloadJob);
+    return d->uid;
+}
+
+void DownloadJob::setPart(const QByteArray &part)
+{
+    Q_D(DownloadJob);
+    d->part = part;
+}
+
+QByteArray DownloadJob::part() const
+{
+    Q_D(const DownloadJob);
+    return d->part;
+}
+
+void DownloadJob::setRangeSize(qint64 size)
+{
+    Q_D(DownloadJob);
+    Q_ASSERT(size > 0);
+    d->rangeSize = size;
+}
+
+qint64 DownloadJob::rangeSize() const
+{
+    Q_D(const DownloadJob);
+    return d->rangeSize;
+}
+
+void DownloadJob::setMaximumPendingRanges(int count)
+{
+    Q_D(DownloadJob);
+    d->maximumPendingRanges = qMax(1, count);
+}
+
+int DownloadJob::maximumPendingRanges() const
+{
+    Q_D(const DownloadJob);
+    return d->maximumPendingRanges;
+}
+
+void DownloadJob::setOffset(qint64 offset)
+{
+    Q_D(DownloadJob);
+    d->offset = offset;
+}
+
+qint64 DownloadJob::offset() const
+{
+    Q_D(const DownloadJob);
+    return d->offset;
+}
+
+void DownloadJob::setSink(const DataSink &sink)
+{
+    Q_D(DownloadJob);
+    d->sink = sink;
+}
+
+void DownloadJob::setDevice(QIODevice *device)
+{
+    Q_ASSERT(device);
+    setSink([device](const char *data, int size) {
+        device->write(data, size);
+    });
+}
+
+QByteArray DownloadJob::data() const
+{
+    Q_D(const DownloadJob);
+    return d->data;
+}
+
+void DownloadJob::doStart()
+{
+    Q_D(DownloadJob);
+
+    d->nextOrigin = d->offset;
+    setProcessedAmount(KJob::Bytes, d->offset);
+    for (int i = 0; i < d->maximumPendingRanges; ++i) {
+        d->sendNextRange();
+    }
+}
+
+void DownloadJob::handleResponse(const Message &response)
+{
+    Q_D(DownloadJob);
+
+    if (!response.content.isEmpty() && d->tags.contains(response.content.first().toString())) {
+        const qint64 origin = d->rangeOrigins.take(response.content.first().toString());
+        const qint64 received = d->received.take(origin);
+        if (response.content.size() >= 2 && response.content[1].keyword() == ImapKeyword::Ok && !d->failed) {
+            if (!d->found) {
+                d->fail(QStringLiteral("%1 failed, the message was not found.").arg(d->m_name));
+            } else if (received < d->rangeSize) {
+                d->complete = true;
+            } else if (!d->complete) {
+                d->sendNextRange();
+            }
+        } else {
+            d->failed = true;
+        }
+        handleErrorReplies(response);
+        return;
+    }
+
+    if (response.content.size() == 4 &&
+            (response.content[2].keyword() == ImapKeyword::Fetch || response.content[2].keyword() == ImapKeyword::UidFetch) &&
+            response.content[3].type() == Message::Part::List) {
+        const QList<QByteArray> &content = response.content[3].toList();
+        for (int i = 0; i + 1 < content.size(); i += 2) {
+            qint64 origin;
+            if (content[i] == "RFC822.SIZE") {
+                setTotalAmount(KJob::Bytes, content[i + 1].toLongLong());
+            } else if (d->parseItem(content[i], &origin)) {
+                d->found = true;
+                // Some servers answer ranges beyond the end with NIL
+                if (content[i + 1] != "NIL") {
+                    // Small ranges may come as quoted strings, literals went to the sink already
+                    d->write(origin, content[i + 1].constData(), content[i + 1].size());
+                }
+            }
+        }
+    }
+}
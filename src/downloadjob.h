@@ -0,0 +1,127 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_DOWNLOADJOB_H
+#define KIMAP2_DOWNLOADJOB_H
+
+#include "kimap2_export.h"
+
+#include "job.h"
+
+#include <functional>
+
+class QIODevice;
+
+namespace KIMAP2
+{
+
+class Session;
+struct Message;
+class DownloadJobPrivate;
+
+/**
+ * Downloads the content of a message, or of one of its parts, in ranges.
+ *
+ * Every range is fetched with its own BODY.PEEK[]<offset.length> command, and a few
+ * of them are kept in flight so the connection doesn't idle between them. The data is
+ * passed on in order as it arrives and never held in memory as a whole if a sink is set.
+ *
+ * If the job fails, e.g. because the connection was lost, offset() tells how much was
+ * already passed on. A job on a new session started with setOffset() continues from there.
+ *
+ * Progress is reported in KJob::Bytes. The total is only known for complete messages.
+ *
+ * This job can only be run when the session is in the selected state.
+ */
+class KIMAP2_EXPORT DownloadJob : public Job
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(DownloadJob)
+
+    friend class SessionPrivate;
+
+public:
+    /**
+     * Receives the downloaded data in consecutive chunks.
+     */
+    typedef std::function<void(const char *data, int size)> DataSink;
+
+    explicit DownloadJob(Session *session);
+    virtual ~DownloadJob();
+
+    /**
+     * Sets the UID of the message to download.
+     */
+    void setUid(qint64 uid);
+    qint64 uid() const;
+
+    /**
+     * Sets the part to download, as in FetchJob::FetchScope::parts.
+     *
+     * The default is an empty part, which downloads the complete message.
+     */
+    void setPart(const QByteArray &part);
+    QByteArray part() const;
+
+    /**
+     * Sets the number of octets fetched with one command. The default is 4 MiB.
+     */
+    void setRangeSize(qint64 size);
+    qint64 rangeSize() const;
+
+    /**
+     * Sets how many ranges are requested before the first of them arrived. The default is 2.
+     */
+    void setMaximumPendingRanges(int count);
+    int maximumPendingRanges() const;
+
+    /**
+     * Starts the download at @p offset, to resume an earlier one.
+     *
+     * Must be called before the job is started.
+     */
+    void setOffset(qint64 offset);
+    /**
+     * Returns the number of octets that were downloaded, including the starting offset.
+     */
+    qint64 offset() const;
+
+    /**
+     * Passes the data to @p sink instead of collecting it in data().
+     *
+     * Must be called before the job is started.
+     */
+    void setSink(const DataSink &sink);
+
+    /**
+     * Writes the data to @p device, which has to stay valid until the job finished.
+     */
+    void setDevice(QIODevice *device);
+
+    /**
+     * Returns the downloaded data if no sink was set.
+     */
+    QByteArray data() const;
+
+protected:
+    void doStart() Q_DECL_OVERRIDE;
+    void handleResponse(const Message &response) Q_DECL_OVERRIDE;
+};
+
+}
+
+#endif
@@ -0,0 +1,103 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "enablejob.h"
+
+#include "kimap_debug.h"
+
+#include "job_p.h"
+#include "message_p.h"
+#include "session_p.h"
+
+namespace KIMAP2
+{
+class EnableJobPrivate : public JobPrivate
+{
+public:
+    EnableJobPrivate(Session *session, const QString &name) : JobPrivate(session, name) { }
+    ~EnableJobPrivate() { }
+
+    QList<QByteArray> extensions;
+    QList<QByteArray> enabledExtensions;
+};
+}
+
+using namespace KIMAP2;
+
+EnableJob::EnableJob(Session *session)
+    : Job(*new EnableJobPrivate(session, "Enable"))
+{
+}
+
+EnableJob::~EnableJob()
+{
+}
+
+void EnableJob::setExtensions(const QList<QByteArray> &extensions)
+{
+    Q_D(EnableJob);
+    d->extensions = extensions;
+}
+
+QList<QByteArray> EnableJob::extensions() const
+{
+    Q_D(const EnableJob);
+    return d->extensions;
+}
+
+QList<QByteArray> EnableJob::enabledExtensions() const
+{
+    Q_D(const EnableJob);
+    return d->enabledExtensions;
+}
+
+void EnableJob::doStart()
+{
+    Q_D(EnableJob);
+
+    if (d->extensions.isEmpty()) {
+        qCWarning(KIMAP2_LOG) << "No extensions to enable";
+        setError(KJob::UserDefinedError);
+        setErrorText(QStringLiteral("No extensions to enable"));
+        emitResult();
+        return;
+    }
+    if (!d->m_session->capabilities().contains(QStringLiteral("ENABLE"), Qt::CaseInsensitive)) {
+        qCWarning(KIMAP2_LOG) << "Enabling extensions requires ENABLE";
+        setError(KJob::UserDefinedError);
+        setErrorText(QStringLiteral("The server does not support ENABLE"));
+        emitResult();
+        return;
+    }
+    d->sendCommand("ENABLE", d->extensions.join(' '));
+}
+
+void EnableJob::handleResponse(const Message &response)
+{
+    Q_D(EnableJob);
+
+    if (handleErrorReplies(response) == NotHandled) {
+        //The session already recorded them for the other jobs
+        if (response.content.size() >= 2 && response.content[1].keyword() == ImapKeyword::Enabled) {
+            for (int i = 2; i < response.content.size(); ++i) {
+                d->enabledExtensions << response.content[i].toString().toUpper();
+            }
+        }
+    }
+}
+
+#include "moc_enablejob.cpp"
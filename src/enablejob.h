@@ -0,0 +1,79 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_ENABLEJOB_H
+#define KIMAP2_ENABLEJOB_H
+
+#include "kimap2_export.h"
+
+#include "job.h"
+
+namespace KIMAP2
+{
+
+class Session;
+struct Message;
+class EnableJobPrivate;
+
+/**
+ * Turns on extensions for the rest of the connection (RFC 5161).
+ *
+ * This job can be run in the authenticated state, before a mailbox is
+ * selected, and requires the ENABLE capability.
+ *
+ * The session keeps track of what the server enabled, so that other jobs can
+ * rely on it. With UTF8=ACCEPT (RFC 6855) enabled, mailbox names are sent and
+ * received as UTF-8 instead of modified UTF-7. With UIDONLY (RFC 9586) enabled, messages
+ * are identified by UID only: FetchJob and SearchJob have to be UID based, and expunged
+ * messages are reported as vanished. With IMAP4rev2 (RFC 9051) enabled on a server that offers
+ * both revisions, the jobs use what IMAP4rev2 includes: mailbox names are UTF-8, ListJob lists
+ * subscriptions with LIST (SUBSCRIBED) and statuses with LIST-STATUS, SearchJob uses ESEARCH and
+ * IdleJob doesn't wait for RECENT. Servers that only offer IMAP4rev2 get this without ENABLE.
+ */
+class KIMAP2_EXPORT EnableJob : public Job
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(EnableJob)
+
+    friend class SessionPrivate;
+
+public:
+    explicit EnableJob(Session *session);
+    virtual ~EnableJob();
+
+    /**
+     * Sets the extensions to enable, e.g. "CONDSTORE", "QRESYNC" or "UTF8=ACCEPT".
+     */
+    void setExtensions(const QList<QByteArray> &extensions);
+    QList<QByteArray> extensions() const;
+
+    /**
+     * The extensions the server reported as enabled.
+     *
+     * A server silently ignores the ones it doesn't know, so this may be fewer than
+     * were asked for. Empty until the job has completed.
+     */
+    QList<QByteArray> enabledExtensions() const;
+
+protected:
+    void doStart() Q_DECL_OVERRIDE;
+    void handleResponse(const Message &response) Q_DECL_OVERRIDE;
+};
+
+}
+
+#endif
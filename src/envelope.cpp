@@ -0,0 +1,81 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "envelope.h"
+
+#include "rfccodecs.h"
+
+#include <QtCore/QDateTime>
+
+using namespace KIMAP2;
+
+/*
+ * Encoded words are plain ASCII, everything else is taken as the UTF-8 many servers send.
+ */
+static QString decodeHeaderText(const QByteArray &text)
+{
+    if (text.contains("=?")) {
+        return decodeRFC2047String(QString::fromLatin1(text));
+    }
+    return QString::fromUtf8(text);
+}
+
+QByteArray EnvelopeAddress::address() const
+{
+    if (host.isEmpty()) {
+        return mailbox;
+    }
+    return mailbox + '@' + host;
+}
+
+QString EnvelopeAddress::displayName() const
+{
+    return decodeHeaderText(name);
+}
+
+bool EnvelopeAddress::isGroupMarker() const
+{
+    return host.isNull();
+}
+
+bool Envelope::isNull() const
+{
+    return date.isNull() && subject.isNull() && from.isEmpty() && messageId.isNull();
+}
+
+qint64 Envelope::dateTime() const
+{
+    if (date.isEmpty()) {
+        return 0;
+    }
+    //Comments such as "(CET)" trip up the parser
+    QByteArray text = date;
+    const int comment = text.indexOf('(');
+    if (comment > 0) {
+        text.truncate(comment);
+    }
+    const QDateTime parsed = QDateTime::fromString(QString::fromLatin1(text.trimmed()), Qt::RFC2822Date);
+    if (!parsed.isValid()) {
+        return 0;
+    }
+    return parsed.toMSecsSinceEpoch() / 1000;
+}
+
+QString Envelope::decodedSubject() const
+{
+    return decodeHeaderText(subject);
+}
@@ -0,0 +1,104 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_ENVELOPE_H
+#define KIMAP2_ENVELOPE_H
+
+#include "kimap2_export.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+namespace KIMAP2
+{
+
+/**
+  An address of an ENVELOPE (RFC 3501), with the fields as the server sent them.
+*/
+struct KIMAP2_EXPORT EnvelopeAddress {
+    /**
+      The display name, which may contain RFC 2047 encoded words, see displayName().
+    */
+    QByteArray name;
+    QByteArray sourceRoute;
+    QByteArray mailbox;
+    QByteArray host;
+
+    /**
+      Returns the address as "mailbox@host".
+    */
+    QByteArray address() const;
+
+    /**
+      Returns the display name with encoded words decoded.
+    */
+    QString displayName() const;
+
+    /**
+      Whether this marks the start or the end of an RFC 2822 group instead of being an
+      address. The start has the group name as mailbox, the end has none.
+    */
+    bool isGroupMarker() const;
+};
+
+typedef QVector<EnvelopeAddress> EnvelopeAddressList;
+
+/**
+  The envelope of a message, as fetched with FetchJob::FetchScope::Envelope.
+
+  The fields are taken from the response without KMime and kept as sent, so decoding
+  is only paid for the fields that are shown, with decodedSubject() and
+  EnvelopeAddress::displayName().
+*/
+struct KIMAP2_EXPORT Envelope {
+    /**
+      The Date header as sent.
+    */
+    QByteArray date;
+    /**
+      The subject, which may contain RFC 2047 encoded words, see decodedSubject().
+    */
+    QByteArray subject;
+    EnvelopeAddressList from;
+    EnvelopeAddressList sender;
+    EnvelopeAddressList replyTo;
+    EnvelopeAddressList to;
+    EnvelopeAddressList cc;
+    EnvelopeAddressList bcc;
+    QByteArray inReplyTo;
+    QByteArray messageId;
+
+    /**
+      Returns true if no envelope was fetched.
+    */
+    bool isNull() const;
+
+    /**
+      Returns the date in seconds since the epoch (UTC), or 0 if it is missing or malformed.
+    */
+    qint64 dateTime() const;
+
+    /**
+      Returns the subject with encoded words decoded.
+    */
+    QString decodedSubject() const;
+};
+
+}
+
+#endif
@@ -32,9 +32,27 @@ class ExpungeJobPrivate : public JobPrivate
 public:
     ExpungeJobPrivate(Session *session, const QString &name) : JobPrivate(session, name) { }
     ~ExpungeJobPrivate() { }
-#if 0
-    QList< int > items;
-#endif
+
+    /**
+     * Returns the sequence number @p sequenceNumber had before the messages
+     * in expunged were removed.
+     */
+    qint64 originalSequenceNumber(qint64 sequenceNumber) const
+    {
+        qint64 original = sequenceNumber;
+        foreach (const ImapSet::Range &range, expunged.ranges()) {
+            if (range.begin > original) {
+                break;
+            }
+            original += range.end - range.begin + 1;
+        }
+        return original;
+    }
+
+    ImapSet uidSet;
+    // Built with united(), so the intervals are sorted
+    ImapSet expunged;
+    ImapSet vanished;
 };
 }
 
@@ -49,29 +67,71 @@ ExpungeJob::~ExpungeJob()
 {
 }
 
+void ExpungeJob::setUidSet(const ImapSet &uids)
+{
+    Q_D(ExpungeJob);
+    d->uidSet = uids;
+}
+
+ImapSet ExpungeJob::uidSet() const
+{
+    Q_D(const ExpungeJob);
+    return d->uidSet;
+}
+
+ImapSet ExpungeJob::expungedSequenceNumbers() const
+{
+    Q_D(const ExpungeJob);
+    return d->expunged;
+}
+
+ImapSet ExpungeJob::vanishedUids() const
+{
+    Q_D(const ExpungeJob);
+    return d->vanished;
+}
+
 void ExpungeJob::doStart()
 {
     Q_D(ExpungeJob);
-    d->sendCommand("EXPUNGE", {});
+    if (d->uidSet.isEmpty()) {
+        d->sendCommand("EXPUNGE", {});
+        return;
+    }
+
+    if (!d->m_session->capabilities().contains(QStringLiteral("UIDPLUS"), Qt::CaseInsensitive)) {
+        qCWarning(KIMAP2_LOG) << "The server can't expunge by UID";
+        setError(KJob::UserDefinedError);
+        setErrorText(QStringLiteral("The server doesn't support UIDPLUS"));
+        emitResult();
+        return;
+    }
+    d->uidSet.optimize();
+    d->sendCommand("UID EXPUNGE", d->uidSet.toImapSequenceSet());
 }
 
 void ExpungeJob::handleResponse(const Message &response)
 {
-//  Q_D(ExpungeJob);
+    Q_D(ExpungeJob);
 
     if (handleErrorReplies(response) == NotHandled) {
+        ImapSet uids;
+        if (JobPrivate::parseVanished(response, &uids)) {
+            d->vanished = d->vanished.united(uids);
+            emit vanished(uids);
+            return;
+        }
         if (response.content.size() >= 3) {
             QByteArray code = response.content[2].toString();
             if (code == "EXPUNGE") {
-#if 0
-                QByteArray s = response.content[1].toString();
-                bool ok = true;
-                int id = s.toInt(&ok);
-                if (ok) {
-                    d->items.append(id);
+                bool ok = false;
+                const qint64 id = response.content[1].toString().toLongLong(&ok);
+                if (ok && id > 0) {
+                    d->expunged = d->expunged.united(ImapSet(d->originalSequenceNumber(id)));
+                    emit expunged(id);
+                } else {
+                    qCWarning(KIMAP2_LOG) << "Invalid EXPUNGE response: " << response.toString().constData();
                 }
-                //TODO error handling
-#endif
                 return;
             }
         }
@@ -23,6 +23,7 @@
 #include "kimap2_export.h"
 
 #include "job.h"
+#include "imapset.h"
 
 namespace KIMAP2
 {
@@ -35,7 +36,8 @@ class ExpungeJobPrivate;
  * Expunges the deleted messages in the selected mailbox.
  *
  * This permanently removes any messages that have the
- * \Deleted flag set in the selected mailbox.
+ * \Deleted flag set in the selected mailbox, or only those
+ * of them given with setUidSet().
  *
  * This job can only be run when the session is in the
  * selected state.
@@ -54,6 +56,39 @@ public:
     explicit ExpungeJob(Session *session);
     virtual ~ExpungeJob();
 
+    /**
+     * Only expunges the messages with these UIDs, with UID EXPUNGE (RFC 4315).
+     *
+     * Messages without the \Deleted flag stay. The job fails if the server doesn't
+     * support UIDPLUS. By default all deleted messages are expunged.
+     */
+    void setUidSet(const ImapSet &uids);
+    ImapSet uidSet() const;
+
+    /**
+     * The sequence numbers the expunged messages had before the job started,
+     * collected from the EXPUNGE responses.
+     */
+    ImapSet expungedSequenceNumbers() const;
+
+    /**
+     * The UIDs of the expunged messages, if the server reported them with VANISHED
+     * responses as it does once QRESYNC (RFC 7162) or UIDONLY (RFC 9586) is enabled.
+     */
+    ImapSet vanishedUids() const;
+
+Q_SIGNALS:
+    /**
+     * A message was expunged, @p sequenceNumber is as the server reported it and
+     * already takes the messages expunged before it into account.
+     */
+    void expunged(qint64 sequenceNumber);
+
+    /**
+     * The messages with @p uids were expunged.
+     */
+    void vanished(const KIMAP2::ImapSet &uids);
+
 protected:
     void doStart() Q_DECL_OVERRIDE;
     void handleResponse(const Message &response) Q_DECL_OVERRIDE;
@@ -22,95 +22,1204 @@
 
 #include "kimap_debug.h"
 
+#include "bodycache.h"
+#include "flagset_p.h"
 #include "job_p.h"
 #include "message_p.h"
+#include "resultarena.h"
+#include "rfccodecs.h"
 #include "session_p.h"
 
+#include <QCoreApplication>
+#include <QGlobalStatic>
+#include <QHash>
+#include <QIODevice>
+#include <QMutex>
+#include <QPointer>
+#include <QRunnable>
+#include <QSet>
+#include <QThreadPool>
+
+#include <deque>
+#include <utility>
+
+/**
+ * Sets @p part to the part named by a BODY[...] or BINARY[...] item, returns false for other items.
+ * The origin of partial items is ignored.
+ */
+static bool sectionPart(QByteArray name, QByteArray *part)
+{
+    if (name.endsWith('>') && name.lastIndexOf('<') > 0) {
+        // The origin of a partial fetch
+        name.truncate(name.lastIndexOf('<'));
+    }
+    if (!name.endsWith(']')) {
+        return false;
+    }
+    if (name.startsWith("BODY[")) {     //krazy:exclude=strings
+        *part = name.mid(5, name.size() - 6);
+        return true;
+    }
+    if (name.startsWith("BINARY[")) {     //krazy:exclude=strings
+        *part = name.mid(7, name.size() - 8);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Parses the KMime objects of @p result, see FetchJob::setParseExecutor().
+ */
+static void parseResult(KIMAP2::FetchJob::Result *result, bool parseMessage, bool parseParts)
+{
+#ifdef KIMAP2_NO_KMIME
+    // Only raw results, nothing to parse
+    Q_UNUSED(result);
+    Q_UNUSED(parseMessage);
+    Q_UNUSED(parseParts);
+#else
+    if (parseMessage && result->message) {
+        result->message->parse();
+    }
+    if (parseParts) {
+        foreach (const KIMAP2::ContentPtr &part, result->parts) {
+            part->parse();
+        }
+    }
+    foreach (const QByteArray &partId, result->decodedParts) {
+        // After the MIME header was parsed, which names the original encoding
+        if (result->parts.contains(partId)) {
+            result->parts[partId]->contentTransferEncoding()->setDecoded(true);
+        }
+    }
+#endif
+}
+
 namespace KIMAP2
 {
+class FetchJobPrivate;
+
+/**
+ * The results that are parsed by the executor, in the order they are delivered.
+ *
+ * Lives on the session thread, which the workers notify with an event when a result is parsed.
+ */
+class ParseQueue : public QObject
+{
+public:
+    struct Entry {
+        Entry() : size(0), isCompletion(false), ready(0) { }
+
+        FetchJob::Result result;
+        qint64 size;
+        // A tagged response that waited for the results before it
+        Message completion;
+        bool isCompletion;
+        QAtomicInt ready;
+    };
+
+    ParseQueue() : mutex(QMutex::Recursive), job(Q_NULLPTR) { }
+
+    static QEvent::Type eventType()
+    {
+        static const QEvent::Type type = static_cast<QEvent::Type>(QEvent::registerEventType());
+        return type;
+    }
+
+    bool event(QEvent *event) Q_DECL_OVERRIDE;
+
+    // Guards job, which is reset when the job finishes, possibly on another thread
+    QMutex mutex;
+    FetchJobPrivate *job;
+    std::deque<QSharedPointer<Entry> > entries;
+};
+
+/**
+ * Runs a task of the parse executor on a thread pool.
+ */
+class ParseRunnable : public QRunnable
+{
+public:
+    explicit ParseRunnable(const std::function<void()> &task) : task(task) { }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        task();
+    }
+
+    std::function<void()> task;
+};
+
 class FetchJobPrivate : public JobPrivate
 {
 public:
     FetchJobPrivate(FetchJob *job, Session *session, const QString &name)
         : JobPrivate(session, name)
         , q(job)
+        , preparedFeatures(0)
         , uidBased(false)
         , avoidParsing(false)
-    { }
+        , incremental(false)
+        , incrementalItemActive(false)
+        , expectingAttributeName(false)
+        , incrementalSequenceNumber(0)
+        , chunkSize(0)
+        , maximumSetLength(0)
+        , partialFirst(0)
+        , partialLast(0)
+        , pipelinedChunks(1)
+        , resultWindow(0)
+        , aborted(false)
+#ifdef KIMAP2_NO_KMIME
+        , rawResults(true)
+#else
+        , rawResults(false)
+#endif
+        , mappedResults(false)
+        , arena(Q_NULLPTR)
+        , replayingCompletion(false)
+        , batchCount(0)
+        , batchMaximumBytes(0)
+        , batchBytes(0)
+        , compactBatchCount(0)
+        , highestModSeq(0)
+        , bodyCache(Q_NULLPTR)
+        , selectedUidValidity(-1)
+    {
+        handlesBorrowedResponses = true;
+        resume = [this]() {
+            fillPipeline();
+        };
+        replay = [this]() {
+            chunkOfTag.clear();
+            incrementalItemActive = false;
+            expectingAttributeName = false;
+        };
+        literalSinkProvider = [this](const Message &message, const QByteArray &name, qint64) {
+            if (aborted) {
+                //Read past it without keeping anything
+                return ImapStreamParser::LiteralSink([](const char *, const int) { });
+            }
+            if (incremental) {
+                return incrementalLiteralSink();
+            }
+            QByteArray part;
+            if (!sectionPart(name, &part)) {
+                return ImapStreamParser::LiteralSink();
+            }
+            const FetchJob::PartSink sink = partSinks.value(part);
+            if (!sink) {
+                return ImapStreamParser::LiteralSink();
+            }
+            streamedParts.insert(part);
+            const qint64 sequenceNumber = message.content.size() > 1 ? message.content[1].toString().toLongLong() : 0;
+            return ImapStreamParser::LiteralSink([this, sink, sequenceNumber](const char *data, const int size) {
+                if (!aborted) {
+                    sink(sequenceNumber, data, size);
+                }
+            });
+        };
+    }
+
+    ~FetchJobPrivate()
+    {
+        if (parseQueue) {
+            QMutexLocker locker(&parseQueue->mutex);
+            parseQueue->job = Q_NULLPTR;
+        }
+    }
+
+    bool defersParsing() const
+    {
+        return parseExecutor && !incremental;
+    }
+    void ensureParseQueue();
+    void parseLater(FetchJob::Result &&result, qint64 size, bool parseMessage);
+    void enqueueCompletion(const Message &response);
+    void deliverParsed();
+
+    void setupIncrementalDelivery();
+    QList<ImapSet> splitSet(const ImapSet &set) const;
+    void splitCachedSet();
+    bool useBodyCache(FetchJob::Result *result, const QByteArray &fetchedContent);
+    void sendNextChunk();
+    void fillPipeline();
+    void resultDelivered(int count = 1);
+    void deliver(FetchJob::Result &&result, qint64 size);
+    void flushBatch();
+    bool usesCompactResults() const;
+    void handleCompactResult(const Message &response);
+    void updateReading();
+    void abort();
+    void finishAborted();
+    QByteArray rawValue(FetchJob::Result *result, const Message &response, const QByteArray &value) const;
+    ImapStreamParser::LiteralSink incrementalLiteralSink();
+
+    FetchJob *const q;
+
+    ImapSet set;
+    bool uidBased;
+    FetchJob::FetchScope scope;
+    QString selectedMailBox;
+    bool avoidParsing;
+    QMap<QByteArray, FetchJob::PartSink> partSinks;
+    // The parts of the response being parsed that went to their sink, an empty string takes their place
+    QSet<QByteArray> streamedParts;
+    bool incremental;
+    bool incrementalItemActive;
+    bool expectingAttributeName;
+    qint64 incrementalSequenceNumber;
+    int chunkSize;
+    int maximumSetLength;
+    // The window of setPartial(), none while both are 0
+    qint64 partialFirst;
+    qint64 partialLast;
+    int pipelinedChunks;
+    // The set each chunk command that is still running was sent for
+    QHash<QByteArray, ImapSet> chunkOfTag;
+    // The command and the items to fetch, sent once per chunk
+    QByteArray command;
+    QByteArray items;
+    // From a FetchJob::PreparedScope, for sessions with the ItemFeatures it was prepared for
+    QByteArray preparedItems;
+    int preparedFeatures;
+    QList<ImapSet> chunks;
+    int resultWindow;
+    // Delivered results the consumer didn't acknowledge yet
+    QAtomicInt unacknowledged;
+    bool aborted;
+    bool rawResults;
+    bool mappedResults;
+    ResultArena *arena;
+    FetchJob::ParseExecutor parseExecutor;
+    QSharedPointer<ParseQueue> parseQueue;
+    // While a deferred completion is handled
+    bool replayingCompletion;
+    FetchJob::ResultBatchHandler batchHandler;
+    int batchCount;
+    qint64 batchMaximumBytes;
+    QVector<FetchJob::Result> batch;
+    qint64 batchBytes;
+    FetchJob::CompactResultBatchHandler compactHandler;
+    int compactBatchCount;
+    QVector<FetchJob::CompactResult> compactBatch;
+    quint64 highestModSeq;
+    BodyCache *bodyCache;
+    // Of selectedMailBox, for the locations in the body cache
+    qint64 selectedUidValidity;
+    // The contents of the requested UIDs the cache had
+    QHash<qint64, QByteArray> cachedContents;
+    // The items to fetch for each of the chunks, if they differ from items
+    QList<QByteArray> chunkItems;
+};
+}
+
+using namespace KIMAP2;
+
+FetchJob::FetchScope::FetchScope():
+    mode(FetchScope::Content),
+    changedSince(0),
+    vanishedEnabled(false),
+    modSeqEnabled(false),
+    gmailExtensionsEnabled(false),
+    binaryEnabled(false),
+    partialOffset(0),
+    partialLength(0),
+    previewEnabled(false),
+    previewLazy(false),
+    objectIdEnabled(false)
+{
+
+}
+
+FetchJob::FetchJob(Session *session)
+    : Job(*new FetchJobPrivate(this, session, "Fetch"))
+{
+}
+
+FetchJob::~FetchJob()
+{
+}
+
+FetchJob::CompactResult::CompactResult()
+    : sequenceNumber(0)
+    , uid(0)
+    , size(0)
+    , internalDate(0)
+    , modSeq(0)
+    , gmailMessageId(0)
+    , gmailThreadId(0)
+{
+}
+
+FetchJob::Result::Result()
+    : sequenceNumber(0)
+    , uid(0)
+    , size(0)
+    , internalDate(0)
+    , modSeq(0)
+    , gmailMessageId(0)
+    , gmailThreadId(0)
+{
+}
+
+#ifndef KIMAP2_NO_KMIME
+MessagePtr FetchJob::Result::parsedMessage() const
+{
+    if (!message && (!rawHeader.isNull() || !rawContent.isNull())) {
+        message = MessagePtr(new KMime::Message);
+        if (!rawContent.isNull()) {
+            message->setContent(crlfToLf(rawContent));
+            message->parse();
+        } else if (!rawHeader.isNull()) {
+            message->setHead(rawHeader);
+            message->parse();
+        }
+    }
+    if (!message && bodyStructure.isValid()) {
+        message = MessagePtr(new KMime::Message);
+        bodyStructure.applyTo(message.data());
+        message->assemble();
+    }
+    return message;
+}
+#endif
+
+QByteArray FetchJob::Result::rawContentWithLf() const
+{
+    return crlfToLf(rawContent);
+}
+
+#ifndef KIMAP2_NO_KMIME
+ContentPtr FetchJob::Result::parsedPart(const QByteArray &partId) const
+{
+    ContentPtr part = parts.value(partId);
+    if (!part && (rawPartHeaders.contains(partId) || rawParts.contains(partId))) {
+        part = ContentPtr(new KMime::Content);
+        if (rawPartHeaders.contains(partId)) {
+            part->setHead(rawPartHeaders.value(partId));
+        }
+        if (rawParts.contains(partId)) {
+            part->setBody(rawParts.value(partId));
+        }
+        part->parse();
+        if (decodedParts.contains(partId)) {
+            part->contentTransferEncoding()->setDecoded(true);
+        }
+        parts.insert(partId, part);
+    }
+    return part;
+}
+#endif
+
+void FetchJob::setRawResults(bool raw)
+{
+    Q_D(FetchJob);
+#ifdef KIMAP2_NO_KMIME
+    // There are no other results without KMime
+    Q_UNUSED(raw);
+    Q_UNUSED(d);
+#else
+    d->rawResults = raw;
+#endif
+}
+
+bool FetchJob::rawResults() const
+{
+    Q_D(const FetchJob);
+    return d->rawResults;
+}
+
+void FetchJob::setMappedResultsEnabled(bool enabled)
+{
+    Q_D(FetchJob);
+    d->mappedResults = enabled;
+}
+
+bool FetchJob::isMappedResultsEnabled() const
+{
+    Q_D(const FetchJob);
+    return d->mappedResults;
+}
+
+void FetchJob::setResultArena(ResultArena *arena)
+{
+    Q_D(FetchJob);
+    d->arena = arena;
+}
+
+ResultArena *FetchJob::resultArena() const
+{
+    Q_D(const FetchJob);
+    return d->arena;
+}
+
+#ifndef KIMAP2_NO_KMIME
+void FetchJob::setParseExecutor(const ParseExecutor &executor)
+{
+    Q_D(FetchJob);
+    d->parseExecutor = executor;
+}
+
+void FetchJob::setParseThreadPool(QThreadPool *pool)
+{
+    Q_ASSERT(pool);
+    setParseExecutor([pool](const std::function<void()> &task) {
+        pool->start(new ParseRunnable(task));
+    });
+}
+
+void FetchJob::setAvoidParsing(bool avoid)
+{
+    Q_D(FetchJob);
+    d->avoidParsing = avoid;
+}
+#endif
+
+void FetchJob::setPartSink(const QByteArray &part, const PartSink &sink)
+{
+    Q_D(FetchJob);
+    d->partSinks.insert(part, sink);
+}
+
+void FetchJob::setPartSink(const QByteArray &part, QIODevice *device)
+{
+    Q_ASSERT(device);
+    setPartSink(part, [device](qint64, const char *data, int size) {
+        device->write(data, size);
+    });
+}
+
+void FetchJob::setBodyCache(BodyCache *cache)
+{
+    Q_D(FetchJob);
+    d->bodyCache = cache;
+}
+
+BodyCache *FetchJob::bodyCache() const
+{
+    Q_D(const FetchJob);
+    return d->bodyCache;
+}
+
+void FetchJob::setIncrementalDelivery(bool incremental)
+{
+    Q_D(FetchJob);
+    d->incremental = incremental;
+    if (incremental) {
+        d->setupIncrementalDelivery();
+    } else {
+        d->listObserver = ImapStreamParser::ListObserver();
+    }
+}
+
+void FetchJobPrivate::setupIncrementalDelivery()
+{
+    listObserver.started = [this](const Message &message) {
+        incrementalItemActive = !aborted && message.content.size() >= 3
+                                && (message.content[2].keyword() == ImapKeyword::Fetch || message.content[2].keyword() == ImapKeyword::UidFetch);
+        if (incrementalItemActive) {
+            incrementalSequenceNumber = message.content[1].toString().toLongLong();
+            expectingAttributeName = true;
+            emit q->itemStarted(incrementalSequenceNumber);
+        }
+    };
+    listObserver.item = [this](const QByteArray &item) {
+        if (!incrementalItemActive) {
+            return;
+        }
+        //The items may reference the receive buffer, so we copy what we pass on
+        if (expectingAttributeName) {
+            emit q->attributeStarted(incrementalSequenceNumber, QByteArray(item.constData(), item.size()));
+        } else {
+            emit q->attributeData(incrementalSequenceNumber, QByteArray(item.constData(), item.size()));
+        }
+        expectingAttributeName = !expectingAttributeName;
+    };
+    listObserver.finished = [this]() {
+        if (incrementalItemActive) {
+            incrementalItemActive = false;
+            emit q->itemFinished(incrementalSequenceNumber);
+            resultDelivered();
+        }
+    };
+}
+
+ImapStreamParser::LiteralSink FetchJobPrivate::incrementalLiteralSink()
+{
+    if (!incrementalItemActive || expectingAttributeName) {
+        return ImapStreamParser::LiteralSink();
+    }
+    //The literal is the value of the current attribute
+    expectingAttributeName = true;
+    const qint64 sequenceNumber = incrementalSequenceNumber;
+    return [this, sequenceNumber](const char *data, const int size) {
+        if (!aborted) {
+            emit q->attributeData(sequenceNumber, QByteArray(data, size));
+        }
+    };
+}
+
+QList<ImapSet> FetchJobPrivate::splitSet(const ImapSet &set) const
+{
+    //Sequence numbers could change between the chunks
+    //The window of PARTIAL is taken from everything the command covers
+    if ((chunkSize <= 0 && maximumSetLength <= 0) || !uidBased || set.isSavedSearchResult() || partialFirst) {
+        return QList<ImapSet>() << set;
+    }
+    QList<ImapSet> result;
+    ImapSet current;
+    qint64 currentSize = 0;
+    int currentLength = 0;
+    foreach (const ImapSet::Range &range, set.ranges()) {
+        if (!range.begin || !range.end) {
+            current.add(ImapInterval(range.begin, range.end));
+            continue;
+        }
+        ImapInterval::Id begin = range.begin;
+        while (begin <= range.end) {
+            ImapInterval::Id end = range.end;
+            if (chunkSize > 0) {
+                end = qMin(end, begin + chunkSize - currentSize - 1);
+            }
+            // Including the separating comma
+            const int length = ImapInterval(begin, end).toImapSequence().size() + 1;
+            if (maximumSetLength > 0 && currentLength > 0 && currentLength + length > maximumSetLength) {
+                result << current;
+                current = ImapSet();
+                currentSize = 0;
+                currentLength = 0;
+                continue;
+            }
+            current.add(ImapInterval(begin, end));
+            currentSize += end - begin + 1;
+            currentLength += length;
+            begin = end + 1;
+            if (chunkSize > 0 && currentSize >= chunkSize) {
+                result << current;
+                current = ImapSet();
+                currentSize = 0;
+                currentLength = 0;
+            }
+        }
+    }
+    if (!current.isEmpty()) {
+        result << current;
+    }
+    return result;
+}
+
+void FetchJobPrivate::splitCachedSet()
+{
+    cachedContents = bodyCache->contents(selectedMailBox, selectedUidValidity, set);
+    if (cachedContents.isEmpty()) {
+        chunks = splitSet(set);
+        return;
+    }
+    //Only as many steps as there are cached messages, the set may be large
+    ImapSet cached;
+    cached.add(cachedContents.keys().toVector());
+    cached.optimize();
+    const ImapSet missing = set.subtracted(cached);
+    chunks.clear();
+    chunkItems.clear();
+    if (!missing.isEmpty()) {
+        chunks = splitSet(missing);
+        for (int i = 0; i < chunks.size(); ++i) {
+            chunkItems << items;
+        }
+    }
+    //The rest of the items still comes from the server
+    QByteArray cachedItems = items;
+    cachedItems.replace("BODY.PEEK[] ", "");
+    foreach (const ImapSet &chunk, splitSet(cached)) {
+        chunks << chunk;
+        chunkItems << cachedItems;
+    }
+}
+
+/**
+ * Fills in the content of @p result from the body cache or adds it to the cache.
+ *
+ * Returns true if a message was filled in that still needs parsing.
+ */
+bool FetchJobPrivate::useBodyCache(FetchJob::Result *result, const QByteArray &fetchedContent)
+{
+    const auto cached = cachedContents.constFind(result->uid);
+    if (cached != cachedContents.constEnd()) {
+#ifndef KIMAP2_NO_KMIME
+        if (!rawResults) {
+            result->message = MessagePtr(new KMime::Message);
+            result->message->setContent(crlfToLf(*cached));
+            return true;
+        }
+#endif
+        result->rawContent = *cached;
+        return false;
+    }
+
+    //The key may need the content, which is only kept as message otherwise
+    const QByteArray rawContent = result->rawContent;
+    if (result->rawContent.isNull()) {
+        result->rawContent = fetchedContent;
+    }
+    const QByteArray key = BodyCache::keyOf(*result);
+    result->rawContent = rawContent;
+    if (key.isEmpty()) {
+        return false;
+    }
+    bodyCache->setLocation(selectedMailBox, selectedUidValidity, result->uid, key);
+    if (!fetchedContent.isNull()) {
+        bodyCache->insert(key, fetchedContent);
+    }
+    return false;
+}
+
+void FetchJobPrivate::sendNextChunk()
+{
+    const ImapSet chunk = chunks.takeFirst();
+    sendCommand(command, chunk.toImapSequenceSet() + ' ' + (chunkItems.isEmpty() ? items : chunkItems.takeFirst()));
+    chunkOfTag.insert(tags.last(), chunk);
+}
+
+void FetchJobPrivate::fillPipeline()
+{
+    do {
+        sendNextChunk();
+    } while (!chunks.isEmpty() && tags.size() < pipelinedChunks);
+}
+
+void FetchJobPrivate::resultDelivered(int count)
+{
+    if (resultWindow > 0) {
+        unacknowledged.fetchAndAddOrdered(count);
+        updateReading();
+    }
+}
+
+void FetchJobPrivate::deliver(FetchJob::Result &&result, qint64 size)
+{
+    if (!batchHandler) {
+        emit q->resultReceived(result);
+        resultDelivered();
+        return;
+    }
+#if QT_VERSION >= QT_VERSION_CHECK(5, 6, 0)
+    batch.append(std::move(result));
+#else
+    batch.append(result);
+#endif
+    batchBytes += size;
+    if (batch.size() >= batchCount || batchBytes >= batchMaximumBytes
+            || (resultWindow > 0 && unacknowledged.load() + batch.size() >= resultWindow)) {
+        flushBatch();
+    }
+}
+
+void FetchJobPrivate::flushBatch()
+{
+    if (!compactBatch.isEmpty()) {
+        QVector<FetchJob::CompactResult> results;
+        results.swap(compactBatch);
+        const int count = results.size();
+        compactHandler(std::move(results));
+        resultDelivered(count);
+    }
+    if (batch.isEmpty()) {
+        return;
+    }
+    QVector<FetchJob::Result> results;
+    results.swap(batch);
+    batchBytes = 0;
+    const int count = results.size();
+    batchHandler(std::move(results));
+    resultDelivered(count);
+}
+
+bool FetchJobPrivate::usesCompactResults() const
+{
+    return compactHandler && !incremental && (scope.mode == FetchJob::FetchScope::Flags ||
+            scope.mode == FetchJob::FetchScope::Headers || scope.mode == FetchJob::FetchScope::FullHeaders ||
+            scope.mode == FetchJob::FetchScope::Envelope);
+}
+
+/**
+ * Returns the HEADER.FIELDS section for @p fields, built once for the default fields.
+ */
+static QByteArray headerFieldsSection(const QList<QByteArray> &fields)
+{
+    static const QByteArray defaultSection = "HEADER.FIELDS (TO FROM MESSAGE-ID REFERENCES IN-REPLY-TO SUBJECT DATE)";
+    if (fields.isEmpty()) {
+        return defaultSection;
+    }
+    QByteArray section = "HEADER.FIELDS (";
+    for (int i = 0; i < fields.size(); ++i) {
+        if (i > 0) {
+            section += ' ';
+        }
+        section += fields.at(i);
+    }
+    section += ')';
+    return section;
+}
+
+/**
+ * Decodes a PREVIEW value, a quoted string with backslash escapes or a literal, in UTF-8.
+ */
+static QString parsePreview(const QByteArray &value)
+{
+    if (value == "NIL") {
+        return QString();
+    }
+    QByteArray text(value.constData(), value.size());
+    if (text.contains('\\')) {
+        int out = 0;
+        for (int in = 0; in < text.size(); ++in) {
+            if (text[in] == '\\' && in + 1 < text.size()) {
+                ++in;
+            }
+            text[out++] = text[in];
+        }
+        text.truncate(out);
+    }
+    return QString::fromUtf8(text);
+}
+
+static quint64 parseModSeq(const QByteArray &value)
+{
+    // MODSEQ (12345)
+    if (value.startsWith('(') && value.endsWith(')')) {
+        return QByteArray::fromRawData(value.constData() + 1, value.size() - 2).toULongLong();
+    }
+    return value.toULongLong();
+}
+
+static EnvelopeAddressList parseEnvelopeAddresses(const Message &response, const Message::Node &list)
+{
+    EnvelopeAddressList addresses;
+    if (!list.isList()) {
+        return addresses;
+    }
+    addresses.reserve(list.size());
+    foreach (const Message::Node &node, list.children()) {
+        EnvelopeAddress address;
+        address.name = response.owned(node.stringAt(0));
+        address.sourceRoute = response.owned(node.stringAt(1));
+        address.mailbox = response.owned(node.stringAt(2));
+        address.host = response.owned(node.stringAt(3));
+        addresses.append(address);
+    }
+    return addresses;
+}
+
+/*
+ * Takes the fields from the nodes the parser built, in the order of RFC 3501 7.4.2.
+ */
+static Envelope parseEnvelope(const Message &response, const Message::Node &node)
+{
+    Envelope envelope;
+    envelope.date = response.owned(node.stringAt(0));
+    envelope.subject = response.owned(node.stringAt(1));
+    envelope.from = parseEnvelopeAddresses(response, node.at(2));
+    envelope.sender = parseEnvelopeAddresses(response, node.at(3));
+    envelope.replyTo = parseEnvelopeAddresses(response, node.at(4));
+    envelope.to = parseEnvelopeAddresses(response, node.at(5));
+    envelope.cc = parseEnvelopeAddresses(response, node.at(6));
+    envelope.bcc = parseEnvelopeAddresses(response, node.at(7));
+    envelope.inReplyTo = response.owned(node.stringAt(8));
+    envelope.messageId = response.owned(node.stringAt(9));
+    return envelope;
+}
+
+static FetchJob::CompactResult::PartHeader *partHeader(FetchJob::CompactResult *result, const QByteArray &partId)
+{
+    for (int i = 0; i < result->partHeaders.size(); ++i) {
+        if (result->partHeaders[i].partId == partId) {
+            return &result->partHeaders[i];
+        }
+    }
+    FetchJob::CompactResult::PartHeader header;
+    header.partId = QByteArray(partId.constData(), partId.size());
+    result->partHeaders.append(header);
+    return &result->partHeaders.last();
+}
+
+void FetchJobPrivate::handleCompactResult(const Message &response)
+{
+    const QList<QByteArray> &content = response.content[3].toList();
+
+    FetchJob::CompactResult result;
+    if (response.content[2].keyword() == ImapKeyword::UidFetch) {
+        result.uid = response.content[1].toString().toLongLong();
+    } else {
+        result.sequenceNumber = response.content[1].toString().toLongLong();
+    }
+    for (int i = 0; i + 1 < content.size(); i += 2) {
+        const QByteArray &name = content.at(i);
+        const QByteArray &value = content.at(i + 1);
+        switch (response.content[3].keywordAt(i)) {
+        case ImapKeyword::Uid:
+            result.uid = value.toLongLong();
+            continue;
+        case ImapKeyword::Rfc822Size:
+            result.size = value.toLongLong();
+            continue;
+        case ImapKeyword::InternalDate:
+            result.internalDate = parseImapDateTime(value);
+            continue;
+        case ImapKeyword::ModSeq:
+            result.modSeq = parseModSeq(value);
+            highestModSeq = qMax(highestModSeq, result.modSeq);
+            continue;
+        case ImapKeyword::XGmMsgId:
+            result.gmailMessageId = value.toLongLong();
+            continue;
+        case ImapKeyword::XGmThrId:
+            result.gmailThreadId = value.toLongLong();
+            continue;
+        case ImapKeyword::XGmLabels:
+            FlagTable::parseLabels(sessionInternal()->flagTable, value, &result.gmailLabels);
+            continue;
+        case ImapKeyword::Flags:
+            FlagTable::parse(sessionInternal()->flagTable, value, &result.flags);
+            continue;
+        case ImapKeyword::Envelope:
+            result.envelope = parseEnvelope(response, response.content[3].sublist(i + 1));
+            continue;
+        default:
+            break;
+        }
+
+        if (name == "PREVIEW") {
+            result.preview = parsePreview(value);
+        } else if (name == "EMAILID") {
+            result.emailId = JobPrivate::parseObjectId(value);
+        } else if (name == "THREADID") {
+            result.threadId = JobPrivate::parseObjectId(value);
+        } else if (name.startsWith("BINARY.SIZE[") && name.endsWith(']')) {     //krazy:exclude=strings
+            partHeader(&result, name.mid(12, name.size() - 13))->binarySize = value.toLongLong();
+        } else if (name.startsWith("BODY[") && name.endsWith(".MIME]")) {     //krazy:exclude=strings
+            partHeader(&result, name.mid(5, name.size() - 11))->header = response.owned(value);
+        } else if (name.startsWith("BODY[HEADER")) {     //krazy:exclude=strings
+            result.header = response.owned(value);
+        }
+    }
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 6, 0)
+    compactBatch.append(std::move(result));
+#else
+    compactBatch.append(result);
+#endif
+    if (compactBatch.size() >= compactBatchCount
+            || (resultWindow > 0 && unacknowledged.load() + compactBatch.size() >= resultWindow)) {
+        flushBatch();
+    }
+}
+
+void FetchJobPrivate::updateReading()
+{
+    //The consumer may have acknowledged from another thread in the meantime
+    if (unacknowledged.load() >= resultWindow) {
+        sessionInternal()->pauseReading(q);
+    } else {
+        sessionInternal()->resumeReading(q);
+    }
+}
+
+bool ParseQueue::event(QEvent *event)
+{
+    if (event->type() == eventType()) {
+        QMutexLocker locker(&mutex);
+        if (job) {
+            job->deliverParsed();
+        }
+        return true;
+    }
+    return QObject::event(event);
+}
+
+void FetchJobPrivate::ensureParseQueue()
+{
+    if (parseQueue) {
+        return;
+    }
+    //Created on the session thread, where the results are delivered
+    parseQueue = QSharedPointer<ParseQueue>(new ParseQueue, &QObject::deleteLater);
+    parseQueue->job = this;
+    ParseQueue *queue = parseQueue.data();
+    QObject::connect(q, &KJob::finished, queue, [queue]() {
+        QMutexLocker locker(&queue->mutex);
+        queue->job = Q_NULLPTR;
+    }, Qt::DirectConnection);
+}
+
+void FetchJobPrivate::parseLater(FetchJob::Result &&result, qint64 size, bool parseMessage)
+{
+#ifdef KIMAP2_NO_KMIME
+    Q_UNUSED(parseMessage);
+    const bool needsParsing = false;
+#else
+    const bool needsParsing = !result.parts.isEmpty() || (parseMessage && result.message);
+#endif
+    if (!needsParsing && (!parseQueue || parseQueue->entries.empty())) {
+        parseResult(&result, false, false);
+        deliver(std::move(result), size);
+        return;
+    }
+    ensureParseQueue();
+    QSharedPointer<ParseQueue::Entry> entry(new ParseQueue::Entry);
+    entry->result = std::move(result);
+    entry->size = size;
+    parseQueue->entries.push_back(entry);
+    if (!needsParsing) {
+        //Waits for the ones before it
+        parseResult(&entry->result, false, false);
+        entry->ready.storeRelease(1);
+        return;
+    }
+    const QSharedPointer<ParseQueue> queue = parseQueue;
+    parseExecutor([entry, queue, parseMessage]() {
+        parseResult(&entry->result, parseMessage, true);
+        entry->ready.storeRelease(1);
+        QCoreApplication::postEvent(queue.data(), new QEvent(ParseQueue::eventType()));
+    });
+}
+
+void FetchJobPrivate::enqueueCompletion(const Message &response)
+{
+    QSharedPointer<ParseQueue::Entry> entry(new ParseQueue::Entry);
+    entry->completion = response;
+    entry->isCompletion = true;
+    entry->ready.storeRelease(1);
+    parseQueue->entries.push_back(entry);
+}
+
+void FetchJobPrivate::deliverParsed()
+{
+    while (!aborted && !parseQueue->entries.empty() && parseQueue->entries.front()->ready.loadAcquire()) {
+        const QSharedPointer<ParseQueue::Entry> entry = parseQueue->entries.front();
+        parseQueue->entries.pop_front();
+        if (entry->isCompletion) {
+            replayingCompletion = true;
+            q->handleResponse(entry->completion);
+            replayingCompletion = false;
+        } else {
+            deliver(std::move(entry->result), entry->size);
+        }
+    }
+    flushBatch();
+}
+
+void FetchJobPrivate::abort()
+{
+    //Draining costs about as much as a new connection once this much is left
+    static const qint64 maximumDrainSize = 1024 * 1024;
+
+    if (aborted) {
+        return;
+    }
+    aborted = true;
+    chunks.clear();
+    chunkItems.clear();
+    batch.clear();
+    incrementalItemActive = false;
+
+    if (parseQueue && !parseQueue->entries.empty()) {
+        //The results are dropped, but the completions that waited for them still count
+        bool completed = false;
+        for (const QSharedPointer<ParseQueue::Entry> &entry : parseQueue->entries) {
+            if (entry->isCompletion) {
+                tags.removeAll(entry->completion.content.first().toString());
+                completed = true;
+            }
+        }
+        parseQueue->entries.clear();
+        if (completed && tags.isEmpty()) {
+            finishAborted();
+            return;
+        }
+    }
+
+    SessionPrivate *session = sessionInternal();
+    if (session->cancelQueuedJob(q)) {
+        finishAborted();
+        return;
+    }
+    if (tags.isEmpty()) {
+        //Not started yet, doStart() finishes it
+        return;
+    }
+    if (resultWindow > 0) {
+        resultWindow = 0;
+        session->resumeReading(q);
+    }
+    const qint64 pending = session->literalBytesPending();
+    if (pending > maximumDrainSize && session->isOnlyJob(q)) {
+        qCDebug(KIMAP2_LOG) << "Closing the connection instead of reading" << pending << "bytes of an aborted fetch";
+        finishAborted();
+        session->closeSocket();
+    }
+}
+
+void FetchJobPrivate::finishAborted()
+{
+    tags.clear();
+    q->setError(KJob::KilledJobError);
+    q->setErrorText(QStringLiteral("Fetch aborted."));
+    q->emitResult();
+}
+
+void FetchJob::setSequenceSet(const ImapSet &set)
+{
+    Q_D(FetchJob);
+    Q_ASSERT(!set.isEmpty());
+    d->set = set;
+}
+
+ImapSet FetchJob::sequenceSet() const
+{
+    Q_D(const FetchJob);
+    return d->set;
+}
+
+void FetchJob::setUidBased(bool uidBased)
+{
+    Q_D(FetchJob);
+    d->uidBased = uidBased;
+}
 
-    ~FetchJobPrivate()
-    { }
+bool FetchJob::isUidBased() const
+{
+    Q_D(const FetchJob);
+    return d->uidBased;
+}
 
-    void parseBodyStructure(const QByteArray &structure, int &pos, KMime::Content *content);
-    void parsePart(const QByteArray &structure, int &pos, KMime::Content *content);
-    QByteArray parseString(const QByteArray &structure, int &pos);
-    QByteArray parseSentence(const QByteArray &structure, int &pos);
-    void skipLeadingSpaces(const QByteArray &structure, int &pos);
+void FetchJob::setChunkSize(int count)
+{
+    Q_D(FetchJob);
+    d->chunkSize = count;
+}
 
-    FetchJob *const q;
+int FetchJob::chunkSize() const
+{
+    Q_D(const FetchJob);
+    return d->chunkSize;
+}
 
-    ImapSet set;
-    bool uidBased;
-    FetchJob::FetchScope scope;
-    QString selectedMailBox;
-    bool avoidParsing;
-};
+void FetchJob::setMaximumSetLength(int length)
+{
+    Q_D(FetchJob);
+    d->maximumSetLength = length;
 }
 
-using namespace KIMAP2;
+int FetchJob::maximumSetLength() const
+{
+    Q_D(const FetchJob);
+    return d->maximumSetLength;
+}
 
-FetchJob::FetchScope::FetchScope():
-    mode(FetchScope::Content),
-    changedSince(0),
-    gmailExtensionsEnabled(false)
+void FetchJob::setPartial(qint64 first, qint64 last)
 {
+    Q_D(FetchJob);
+    d->partialFirst = first;
+    d->partialLast = last;
+}
 
+void FetchJob::setPipelinedChunks(int count)
+{
+    Q_D(FetchJob);
+    d->pipelinedChunks = qMax(1, count);
 }
 
-FetchJob::FetchJob(Session *session)
-    : Job(*new FetchJobPrivate(this, session, "Fetch"))
+int FetchJob::pipelinedChunks() const
 {
+    Q_D(const FetchJob);
+    return d->pipelinedChunks;
 }
 
-FetchJob::~FetchJob()
+quint64 FetchJob::highestModSequence() const
 {
+    Q_D(const FetchJob);
+    return d->highestModSeq;
 }
 
-void FetchJob::setAvoidParsing(bool avoid)
+void FetchJob::setResultWindow(int count)
 {
     Q_D(FetchJob);
-    d->avoidParsing = avoid;
+    d->resultWindow = count;
 }
 
-void FetchJob::setSequenceSet(const ImapSet &set)
+int FetchJob::resultWindow() const
+{
+    Q_D(const FetchJob);
+    return d->resultWindow;
+}
+
+void FetchJob::acknowledgeResults(int count)
 {
     Q_D(FetchJob);
-    Q_ASSERT(!set.isEmpty());
-    d->set = set;
+    d->unacknowledged.fetchAndAddOrdered(-count);
+    QPointer<FetchJob> job(this);
+    d->sessionInternal()->callInSessionThread([job, d]() {
+        if (job && d->resultWindow > 0) {
+            d->updateReading();
+        }
+    });
 }
 
-ImapSet FetchJob::sequenceSet() const
+void FetchJob::abort()
 {
-    Q_D(const FetchJob);
-    return d->set;
+    Q_D(FetchJob);
+    QPointer<FetchJob> job(this);
+    d->sessionInternal()->callInSessionThread([job, d]() {
+        if (job) {
+            d->abort();
+        }
+    });
 }
 
-void FetchJob::setUidBased(bool uidBased)
+void FetchJob::setResultBatchHandler(const ResultBatchHandler &handler, int maximumCount, qint64 maximumBytes)
 {
     Q_D(FetchJob);
-    d->uidBased = uidBased;
+    d->batchHandler = handler;
+    d->batchCount = maximumCount;
+    d->batchMaximumBytes = maximumBytes;
+    if (handler || d->compactHandler) {
+        d->parsePassFinished = [d]() {
+            d->flushBatch();
+        };
+    } else {
+        d->parsePassFinished = std::function<void()>();
+    }
 }
 
-bool FetchJob::isUidBased() const
+void FetchJob::setCompactResultHandler(const CompactResultBatchHandler &handler, int maximumCount)
 {
-    Q_D(const FetchJob);
-    return d->uidBased;
+    Q_D(FetchJob);
+    d->compactHandler = handler;
+    d->compactBatchCount = maximumCount;
+    if (handler || d->batchHandler) {
+        d->parsePassFinished = [d]() {
+            d->flushBatch();
+        };
+    } else {
+        d->parsePassFinished = std::function<void()>();
+    }
 }
 
 void FetchJob::setScope(const FetchScope &scope)
 {
     Q_D(FetchJob);
     d->scope = scope;
+    d->preparedItems = QByteArray();
+}
+
+void FetchJob::setScope(const PreparedScope &scope)
+{
+    Q_D(FetchJob);
+    d->scope = scope.m_scope;
+    d->preparedItems = scope.m_items;
+    d->preparedFeatures = scope.m_features;
 }
 
 FetchJob::FetchScope FetchJob::scope() const
@@ -119,22 +1228,64 @@ FetchJob::FetchScope FetchJob::scope() const
     return d->scope;
 }
 
-void FetchJob::doStart()
+/**
+ * The capabilities the FETCH items of a scope depend on.
+ */
+enum ItemFeature {
+    BinaryItems = 1,
+    PreviewItems = 2,
+    ObjectIdItems = 4
+};
+
+/**
+ * Returns the ItemFeatures @p scope asks for that the server of @p session supports.
+ *
+ * Only looks at the capabilities if the scope asks for any of them.
+ */
+static int itemFeatures(const FetchJob::FetchScope &scope, Session *session)
 {
-    Q_D(FetchJob);
+    if (!scope.binaryEnabled && !scope.previewEnabled && !scope.objectIdEnabled) {
+        return 0;
+    }
+    const QStringList capabilities = session->capabilities();
+    int features = 0;
+    if (scope.binaryEnabled && capabilities.contains(QStringLiteral("BINARY"), Qt::CaseInsensitive)) {
+        features |= BinaryItems;
+    }
+    if (scope.previewEnabled && capabilities.contains(QStringLiteral("PREVIEW"), Qt::CaseInsensitive)) {
+        features |= PreviewItems;
+    }
+    if (scope.objectIdEnabled && capabilities.contains(QStringLiteral("OBJECTID"), Qt::CaseInsensitive)) {
+        features |= ObjectIdItems;
+    }
+    return features;
+}
 
-    d->set.optimize();
-    QByteArray parameters = d->set.toImapSequenceSet() + ' ';
-    Q_ASSERT(!parameters.trimmed().isEmpty());
+/**
+ * Formats the parenthesized list of FETCH items for @p scope, without the modifiers.
+ */
+static QByteArray buildItems(const FetchJob::FetchScope &scope, int features)
+{
+    typedef FetchJob::FetchScope FetchScope;
+    QByteArray parameters;
+    const bool binary = features & BinaryItems;
+    const QByteArray partContent = binary ? "BINARY.PEEK[" : "BODY.PEEK[";
+    QByteArray range;
+    if (scope.partialLength > 0) {
+        range = '<' + QByteArray::number(scope.partialOffset) + '.' + QByteArray::number(scope.partialLength) + '>';
+    }
 
-    switch (d->scope.mode) {
+    switch (scope.mode) {
     case FetchScope::Headers:
-        if (d->scope.parts.isEmpty()) {
-            parameters += "(RFC822.SIZE INTERNALDATE BODY.PEEK[HEADER.FIELDS (TO FROM MESSAGE-ID REFERENCES IN-REPLY-TO SUBJECT DATE)] FLAGS UID";
+        if (scope.parts.isEmpty()) {
+            parameters += "(RFC822.SIZE INTERNALDATE BODY.PEEK[" + headerFieldsSection(scope.headerFields) + "] FLAGS UID";
         } else {
             parameters += '(';
-            foreach (const QByteArray &part, d->scope.parts) {
+            foreach (const QByteArray &part, scope.parts) {
                 parameters += "BODY.PEEK[" + part + ".MIME] ";
+                if (binary) {
+                    parameters += "BINARY.SIZE[" + part + "] ";
+                }
             }
             parameters += "UID";
         }
@@ -146,12 +1297,12 @@ void FetchJob::doStart()
         parameters += "(BODYSTRUCTURE UID";
         break;
     case FetchScope::Content:
-        if (d->scope.parts.isEmpty()) {
-            parameters += "(BODY.PEEK[] UID";
+        if (scope.parts.isEmpty()) {
+            parameters += "(BODY.PEEK[]" + range + " UID";
         } else {
             parameters += '(';
-            foreach (const QByteArray &part, d->scope.parts) {
-                parameters += "BODY.PEEK[" + part + "] ";
+            foreach (const QByteArray &part, scope.parts) {
+                parameters += partContent + part + ']' + range + ' ';
             }
             parameters += "UID";
         }
@@ -160,12 +1311,12 @@ void FetchJob::doStart()
         parameters += "(RFC822.SIZE INTERNALDATE BODY.PEEK[] FLAGS UID";
         break;
     case FetchScope::HeaderAndContent:
-        if (d->scope.parts.isEmpty()) {
+        if (scope.parts.isEmpty()) {
             parameters += "(BODY.PEEK[] FLAGS UID";
         } else {
-            parameters += "(BODY.PEEK[HEADER.FIELDS (TO FROM MESSAGE-ID REFERENCES IN-REPLY-TO SUBJECT DATE)]";
-            foreach (const QByteArray &part, d->scope.parts) {
-                parameters += " BODY.PEEK[" + part + ".MIME] BODY.PEEK[" + part + "]"; //krazy:exclude=doublequote_chars
+            parameters += "(BODY.PEEK[" + headerFieldsSection(scope.headerFields) + ']';
+            foreach (const QByteArray &part, scope.parts) {
+                parameters += " BODY.PEEK[" + part + ".MIME] " + partContent + part + "]"; //krazy:exclude=doublequote_chars
             }
             parameters += " FLAGS UID";
         }
@@ -173,40 +1324,270 @@ void FetchJob::doStart()
     case FetchScope::FullHeaders:
         parameters += "(RFC822.SIZE INTERNALDATE BODY.PEEK[HEADER] FLAGS UID";
         break;
+    case FetchScope::Envelope:
+        parameters += "(RFC822.SIZE INTERNALDATE ENVELOPE FLAGS UID";
+        break;
     }
 
-    if (d->scope.gmailExtensionsEnabled) {
+    if (scope.gmailExtensionsEnabled) {
         parameters += " X-GM-LABELS X-GM-MSGID X-GM-THRID";
     }
+    if (scope.modSeqEnabled && scope.changedSince == 0) {
+        parameters += " MODSEQ";
+    }
+    if (features & PreviewItems) {
+        parameters += scope.previewLazy ? " PREVIEW (LAZY)" : " PREVIEW";
+    }
+    if (features & ObjectIdItems) {
+        parameters += " EMAILID THREADID";
+    }
     parameters += ")";
+    return parameters;
+}
 
-    if (d->scope.changedSince > 0) {
-        parameters += " (CHANGEDSINCE " + QByteArray::number(d->scope.changedSince) + ")";
+/*
+ * The items of the scopes without parts, header fields or ranges, which is what a synchronization
+ * uses over and over, are only formatted once per process. They are indexed by their mode,
+ * ItemFeatures and options.
+ */
+struct ItemCache {
+    QMutex mutex;
+    QHash<int, QByteArray> items;
+};
+Q_GLOBAL_STATIC(ItemCache, itemCache)
+
+static QByteArray cachedItems(const FetchJob::FetchScope &scope, int features)
+{
+    if (!scope.parts.isEmpty() || !scope.headerFields.isEmpty() || scope.partialLength > 0) {
+        return buildItems(scope, features);
+    }
+    const int key = int(scope.mode) | features << 4 | int(scope.gmailExtensionsEnabled) << 8
+                    | int(scope.modSeqEnabled && scope.changedSince == 0) << 9 | int(scope.previewLazy) << 10;
+    ItemCache *cache = itemCache();
+    QMutexLocker locker(&cache->mutex);
+    QByteArray &items = cache->items[key];
+    if (items.isNull()) {
+        items = buildItems(scope, features);
+    }
+    return items;
+}
+
+FetchJob::PreparedScope::PreparedScope()
+    : m_features(0)
+{
+}
+
+FetchJob::PreparedScope::PreparedScope(const FetchScope &scope, Session *session)
+    : m_scope(scope),
+      m_features(itemFeatures(scope, session))
+{
+    m_items = buildItems(scope, m_features);
+}
+
+bool FetchJob::PreparedScope::isValid() const
+{
+    return !m_items.isNull();
+}
+
+FetchJob::FetchScope FetchJob::PreparedScope::scope() const
+{
+    return m_scope;
+}
+
+void FetchJob::doStart()
+{
+    Q_D(FetchJob);
+
+    if (d->aborted) {
+        d->finishAborted();
+        return;
+    }
+
+    if (d->partialFirst && !d->m_session->capabilities().contains(QStringLiteral("PARTIAL"), Qt::CaseInsensitive)) {
+        qCWarning(KIMAP2_LOG) << "Fetching a window of the messages requires PARTIAL";
+        setError(KJob::UserDefinedError);
+        setErrorText(QStringLiteral("The server does not support PARTIAL"));
+        emitResult();
+        return;
+    }
+
+    if (!d->uidBased && d->sessionInternal()->isExtensionEnabled("UIDONLY")) {
+        qCWarning(KIMAP2_LOG) << "Fetching by sequence number isn't possible with UIDONLY";
+        setError(KJob::UserDefinedError);
+        setErrorText(QStringLiteral("Sequence numbers are not available once UIDONLY is enabled"));
+        emitResult();
+        return;
     }
 
-    QByteArray command = "FETCH";
-    if (d->uidBased) {
-        command = "UID " + command;
+    d->set.optimize();
+    Q_ASSERT(!d->set.isEmpty());
+    const int features = itemFeatures(d->scope, d->m_session);
+    QByteArray parameters;
+    if (!d->preparedItems.isNull() && d->preparedFeatures == features) {
+        parameters = d->preparedItems;
+    } else {
+        parameters = cachedItems(d->scope, features);
+    }
+
+    QList<QByteArray> modifiers;
+    if (d->scope.changedSince > 0) {
+        modifiers << "CHANGEDSINCE " + QByteArray::number(d->scope.changedSince);
+        if (d->scope.vanishedEnabled && d->uidBased) {
+            modifiers << "VANISHED";
+        }
+    }
+    if (d->partialFirst) {
+        modifiers << "PARTIAL " + QByteArray::number(d->partialFirst) + ':' + QByteArray::number(d->partialLast);
+    }
+    if (!modifiers.isEmpty()) {
+        parameters += " (" + modifiers.join(' ') + ')';
     }
 
+    d->command = d->uidBased ? QByteArrayLiteral("UID FETCH") : QByteArrayLiteral("FETCH");
+    d->items = parameters;
     d->selectedMailBox = d->m_session->selectedMailBox();
-    d->sendCommand(command, parameters);
+    d->selectedUidValidity = d->sessionInternal()->selectedUidValidity;
+
+    bool openEnded = false;
+    foreach (const ImapSet::Range &range, d->set.ranges()) {
+        openEnded = openEnded || !range.begin || !range.end;
+    }
+    if (d->bodyCache && d->uidBased && !d->incremental && !d->partialFirst && !openEnded
+            && !d->set.isSavedSearchResult() && d->items.contains("BODY.PEEK[] ")) {
+        d->splitCachedSet();
+    } else {
+        d->chunks = d->splitSet(d->set);
+    }
+    d->fillPipeline();
+}
+
+/**
+ * Returns @p value to keep in @p result, pointing into the file it was spilled to if mapped
+ * results are enabled, or into the result arena if there is one.
+ */
+QByteArray FetchJobPrivate::rawValue(FetchJob::Result *result, const Message &response, const QByteArray &value) const
+{
+    if (mappedResults) {
+        const QSharedPointer<SpilledLiteral> literal = response.spilledLiteral(value);
+        if (literal) {
+            result->rawFiles << literal;
+            return value;
+        }
+    }
+    if (arena) {
+        return arena->copy(value);
+    }
+    return response.owned(value);
+}
+
+/**
+ * Keeps the value of a BODY[...] item @p name as it is, see FetchJob::setRawResults().
+ */
+static void storeRaw(FetchJob::Result *result, const QByteArray &name, const QByteArray &value)
+{
+    int index;
+    if ((index = name.indexOf("HEADER")) > 0 || (index = name.indexOf("MIME")) > 0) {
+        if (name[index - 1] == '.') {
+            result->rawPartHeaders.insert(name.mid(5, index - 6), value);
+        } else {
+            result->rawHeader = value;
+        }
+    } else if (name == "BODY[]") {
+        result->rawContent = value;
+    } else {
+        result->rawParts.insert(name.mid(5, name.size() - 6), value);
+    }
 }
 
 void FetchJob::handleResponse(const Message &response)
 {
     Q_D(FetchJob);
+    QSet<QByteArray> streamedParts;
+    streamedParts.swap(d->streamedParts);
+
+    if (d->aborted) {
+        //Only wait for the completion, whatever it says
+        if (!response.content.isEmpty() && d->tags.removeAll(response.content.first().toString()) > 0
+                && d->tags.isEmpty()) {
+            d->finishAborted();
+        }
+        return;
+    }
+
+    if (d->parseQueue && !d->parseQueue->entries.empty() && !d->replayingCompletion
+            && !response.content.isEmpty() && d->tags.contains(response.content.first().toString())) {
+        //Handled once the results before it were parsed and delivered
+        d->enqueueCompletion(response.detached());
+        return;
+    }
+
+    if (!response.content.isEmpty() && d->tags.contains(response.content.first().toString())) {
+        const QByteArray tag = response.content.first().toString();
+        if (response.content.size() < 2 || response.content[1].keyword() != ImapKeyword::Ok) {
+            //Don't go on with the other chunks
+            d->chunks.clear();
+            d->chunkItems.clear();
+        } else {
+            //Everything of the chunk goes out before its checkpoint
+            d->flushBatch();
+            emit chunkCompleted(d->chunkOfTag.value(tag));
+            if (d->aborted) {
+                //From the slot
+                d->tags.removeAll(tag);
+                if (d->tags.isEmpty()) {
+                    d->finishAborted();
+                }
+                return;
+            }
+            if (!d->chunks.isEmpty() || d->tags.size() > 1) {
+                d->tags.removeAll(tag);
+                d->chunkOfTag.remove(tag);
+                if (!d->chunks.isEmpty() && !(d->tags.isEmpty() && d->sessionInternal()->stepAside(this))) {
+                    d->fillPipeline();
+                }
+                return;
+            }
+        }
+        d->chunkOfTag.remove(tag);
+    }
+
+    if ((!d->batch.isEmpty() || !d->compactBatch.isEmpty()) &&
+            !response.content.isEmpty() && d->tags.contains(response.content.first().toString())) {
+        //Before the result
+        d->flushBatch();
+    }
 
     if (handleErrorReplies(response) == NotHandled) {
-        if (response.content.size() == 4 &&
-                response.content[2].toString() == "FETCH" &&
+        ImapSet vanishedUids;
+        if (JobPrivate::parseVanished(response, &vanishedUids)) {
+            emit vanished(vanishedUids);
+            return;
+        }
+        if (d->incremental) {
+            // Already delivered while it was parsed
+            return;
+        }
+        const ImapKeyword code = response.content.size() == 4 ? response.content[2].keyword() : ImapKeyword::None;
+        if ((code == ImapKeyword::Fetch || code == ImapKeyword::UidFetch) &&
                 response.content[3].type() == Message::Part::List) {
+            if (d->usesCompactResults()) {
+                d->handleCompactResult(response);
+                return;
+            }
 
-            const QList<QByteArray> content = response.content[3].toList();
+            const QList<QByteArray> &content = response.content[3].toList();
 
             Result result;
-            result.sequenceNumber = response.content[1].toString().toLongLong();
+            if (code == ImapKeyword::UidFetch) {
+                // * 117 UIDFETCH (FLAGS (\Seen)), with the UID in place of the sequence number
+                result.uid = response.content[1].toString().toLongLong();
+            } else {
+                result.sequenceNumber = response.content[1].toString().toLongLong();
+            }
             bool shouldParseMessage = false;
+            // BODY[] as it was received, for the body cache
+            QByteArray fetchedContent;
+            qint64 responseSize = 0;
             for (QList<QByteArray>::ConstIterator it = content.constBegin();
                     it != content.constEnd(); ++it) {
                 QByteArray str = *it;
@@ -219,45 +1600,122 @@ void FetchJob::handleResponse(const Message &response)
                     qCWarning(KIMAP2_LOG) << str;
                     break;
                 }
+                responseSize += it->size();
 
-                if (str == "UID") {
+                switch (response.content[3].keywordAt(it - content.constBegin() - 1)) {
+                case ImapKeyword::Uid:
                     result.uid = it->toLongLong();
-                } else if (str == "RFC822.SIZE") {
+                    continue;
+                case ImapKeyword::Rfc822Size:
                     result.size = it->toLongLong();
-                } else if (str == "INTERNALDATE") {
-                    if (!result.message) {
-                        result.message = MessagePtr(new KMime::Message);
+                    continue;
+                case ImapKeyword::InternalDate:
+                    result.internalDate = parseImapDateTime(*it);
+                    continue;
+                case ImapKeyword::ModSeq:
+                    result.modSeq = parseModSeq(*it);
+                    d->highestModSeq = qMax(d->highestModSeq, result.modSeq);
+                    continue;
+                case ImapKeyword::Flags:
+                    result.flagSet = FlagTable::parse(d->sessionInternal()->flagTable, *it, &result.flags);
+                    continue;
+                //Still also in the attributes, for code that reads them from there
+                case ImapKeyword::XGmLabels:
+                    FlagTable::parseLabels(d->sessionInternal()->flagTable, *it, &result.gmailLabels);
+                    result.attributes << qMakePair<QByteArray, QVariant>("X-GM-LABELS", response.owned(*it));
+                    continue;
+                case ImapKeyword::XGmThrId:
+                    result.gmailThreadId = it->toLongLong();
+                    result.attributes << qMakePair<QByteArray, QVariant>("X-GM-THRID", response.owned(*it));
+                    continue;
+                case ImapKeyword::XGmMsgId:
+                    result.gmailMessageId = it->toLongLong();
+                    result.attributes << qMakePair<QByteArray, QVariant>("X-GM-MSGID", response.owned(*it));
+                    continue;
+                case ImapKeyword::Envelope:
+                    result.envelope = parseEnvelope(response, response.content[3].sublist(it - content.constBegin()));
+                    continue;
+                case ImapKeyword::BodyStructure:
+                    result.bodyStructure = BodyStructure::fromImapList(response.owned(*it));
+#ifndef KIMAP2_NO_KMIME
+                    if (!d->rawResults) {
+                        if (!result.message) {
+                            result.message = MessagePtr(new KMime::Message);
+                        }
+                        result.bodyStructure.applyTo(result.message.data());
+                        result.message->assemble();
+                    }
+#endif
+                    continue;
+                default:
+                    break;
+                }
+
+                if (str == "PREVIEW") {
+                    result.preview = parsePreview(*it);
+                    continue;
+                } else if (str == "EMAILID") {
+                    result.emailId = JobPrivate::parseObjectId(*it);
+                    continue;
+                } else if (str == "THREADID") {
+                    result.threadId = JobPrivate::parseObjectId(*it);
+                    continue;
+                }
+
+                bool partial = false;
+                if (str.endsWith('>') && str.lastIndexOf('<') > 0) {
+                    // The origin of a partial fetch, the content is kept as it is
+                    str.truncate(str.lastIndexOf('<'));
+                    partial = true;
+                }
+
+                if (str.startsWith("BINARY.SIZE[")) {     //krazy:exclude=strings
+                    result.attributes << qMakePair<QByteArray, QVariant>(response.owned(str), it->toLongLong());
+                    continue;
+                }
+
+                if (str.startsWith("BINARY[") && str.endsWith(']')) {     //krazy:exclude=strings
+                    const QByteArray partId = str.mid(7, str.size() - 8);
+                    if (streamedParts.contains(partId)) {
+                        continue;
+                    }
+                    result.decodedParts.insert(partId);
+                    if (d->rawResults || partial) {
+                        result.rawParts.insert(partId, d->rawValue(&result, response, *it));
+                        continue;
                     }
-                    result.message->date()->setDateTime(QDateTime::fromString(QLatin1String(*it), Qt::RFC2822Date));
-                } else if (str == "FLAGS") {
-                    if ((*it).startsWith('(') && (*it).endsWith(')')) {
-                        QByteArray str = *it;
-                        str.chop(1);
-                        str.remove(0, 1);
-                        result.flags = str.split(' ');
-                    } else {
-                        result.flags << *it;
+#ifndef KIMAP2_NO_KMIME
+                    if (!result.parts.contains(partId)) {
+                        result.parts[partId] = ContentPtr(new KMime::Content);
                     }
-                } else if (str == "X-GM-LABELS") {
-                    result.attributes << qMakePair<QByteArray, QVariant>("X-GM-LABELS", *it);
-                } else if (str == "X-GM-THRID") {
-                    result.attributes << qMakePair<QByteArray, QVariant>("X-GM-THRID", *it);
-                } else if (str == "X-GM-MSGID") {
-                    result.attributes << qMakePair<QByteArray, QVariant>("X-GM-MSGID", *it);
-                } else if (str == "BODYSTRUCTURE") {
-                    if (!result.message) {
-                        result.message = MessagePtr(new KMime::Message);
+                    result.parts[partId]->setBody(response.owned(*it));
+                    if (!d->defersParsing()) {
+                        result.parts[partId]->parse();
                     }
-                    int pos = 0;
-                    d->parseBodyStructure(*it, pos, result.message.data());
-                    result.message->assemble();
-                } else if (str.startsWith("BODY[")) {     //krazy:exclude=strings
+#endif
+                    continue;
+                }
+
+                if (str.startsWith("BODY[")) {     //krazy:exclude=strings
                     if (!str.endsWith(']')) {     // BODY[ ... ] might have been split, skip until we find the ]
                         while (it != content.constEnd() && !(*it).endsWith(']')) {
                             ++it;
                         }
                     }
+                    if (streamedParts.contains(str.mid(5, str.size() - 6))) {
+                        // Already streamed to the sink by the parser
+                        continue;
+                    }
+
+                    if (d->rawResults || partial) {
+                        storeRaw(&result, str, d->rawValue(&result, response, *it));
+                        if (str == "BODY[]" && !partial) {
+                            fetchedContent = result.rawContent;
+                        }
+                        continue;
+                    }
 
+#ifndef KIMAP2_NO_KMIME
                     int index;
                     if ((index = str.indexOf("HEADER")) > 0 || (index = str.indexOf("MIME")) > 0) {           // headers
                         if (str[index - 1] == '.') {
@@ -265,14 +1723,16 @@ void FetchJob::handleResponse(const Message &response)
                             if (!result.parts.contains(partId)) {
                                 result.parts[partId] = ContentPtr(new KMime::Content);
                             }
-                            result.parts[partId]->setHead(*it);
-                            result.parts[partId]->parse();
+                            result.parts[partId]->setHead(response.owned(*it));
+                            if (!d->defersParsing()) {
+                                result.parts[partId]->parse();
+                            }
                         } else {
                             if (!result.message) {
                                 result.message = MessagePtr(new KMime::Message);
                             }
                             shouldParseMessage = true;
-                            result.message->setHead(*it);
+                            result.message->setHead(response.owned(*it));
                         }
                     } else { // full payload
                         if (str == "BODY[]") {
@@ -280,237 +1740,37 @@ void FetchJob::handleResponse(const Message &response)
                                 result.message = MessagePtr(new KMime::Message);
                             }
                             shouldParseMessage = true;
-                            result.message->setContent(KMime::CRLFtoLF(*it));
+                            fetchedContent = *it;
+                            //Converting straight from the receive buffer copies the data once
+                            const QByteArray content = crlfToLf(*it);
+                            result.message->setContent(content.constData() == it->constData() ? response.owned(*it) : content);
                         } else {
                             QByteArray partId = str.mid(5, str.size() - 6);
                             if (!result.parts.contains(partId)) {
                                 result.parts[partId] = ContentPtr(new KMime::Content);
                             }
-                            result.parts[partId]->setBody(*it);
-                            result.parts[partId]->parse();
+                            result.parts[partId]->setBody(response.owned(*it));
+                            if (!d->defersParsing()) {
+                                result.parts[partId]->parse();
+                            }
                         }
                     }
+#endif
                 }
             }
 
-            if (result.message && shouldParseMessage && !d->avoidParsing) {
-                result.message->parse();
+            if (d->bodyCache && d->uidBased && result.uid > 0 && d->useBodyCache(&result, fetchedContent)) {
+                shouldParseMessage = true;
             }
-            emit resultReceived(result);
-        }
-    }
-}
-
-void FetchJobPrivate::parseBodyStructure(const QByteArray &structure, int &pos, KMime::Content *content)
-{
-    skipLeadingSpaces(structure, pos);
-
-    if (structure[pos] != '(') {
-        return;
-    }
-
-    pos++;
-
-    if (structure[pos] != '(') {   // simple part
-        pos--;
-        parsePart(structure, pos, content);
-    } else { // multi part
-        content->contentType()->setMimeType("MULTIPART/MIXED");
-        while (pos < structure.size() && structure[pos] == '(') {
-            KMime::Content *child = new KMime::Content;
-            content->addContent(child);
-            parseBodyStructure(structure, pos, child);
-            child->assemble();
-        }
-
-        QByteArray subType = parseString(structure, pos);
-        content->contentType()->setMimeType("MULTIPART/" + subType);
-
-        QByteArray parameters = parseSentence(structure, pos);   // FIXME: Read the charset
-        if (parameters.contains("BOUNDARY")) {
-            content->contentType()->setBoundary(parameters.remove(0, parameters.indexOf("BOUNDARY") + 11).split('\"')[0]);
-        }
 
-        QByteArray disposition = parseSentence(structure, pos);
-        if (disposition.contains("INLINE")) {
-            content->contentDisposition()->setDisposition(KMime::Headers::CDinline);
-        } else if (disposition.contains("ATTACHMENT")) {
-            content->contentDisposition()->setDisposition(KMime::Headers::CDattachment);
-        }
-
-        parseSentence(structure, pos);   // Ditch the body language
-    }
-
-    // Consume what's left
-    while (pos < structure.size() && structure[pos] != ')') {
-        skipLeadingSpaces(structure, pos);
-        parseSentence(structure, pos);
-        skipLeadingSpaces(structure, pos);
-    }
-
-    pos++;
-}
-
-void FetchJobPrivate::parsePart(const QByteArray &structure, int &pos, KMime::Content *content)
-{
-    if (structure[pos] != '(') {
-        return;
-    }
-
-    pos++;
-
-    QByteArray mainType = parseString(structure, pos);
-    QByteArray subType = parseString(structure, pos);
-
-    content->contentType()->setMimeType(mainType + '/' + subType);
-
-    parseSentence(structure, pos);   // Ditch the parameters... FIXME: Read it to get charset and name
-    parseString(structure, pos);   // ... and the id
-
-    content->contentDescription()->from7BitString(parseString(structure, pos));
-
-    parseString(structure, pos);   // Ditch the encoding too
-    parseString(structure, pos);   // ... and the size
-    parseString(structure, pos);   // ... and the line count
-
-    QByteArray disposition = parseSentence(structure, pos);
-    if (disposition.contains("INLINE")) {
-        content->contentDisposition()->setDisposition(KMime::Headers::CDinline);
-    } else if (disposition.contains("ATTACHMENT")) {
-        content->contentDisposition()->setDisposition(KMime::Headers::CDattachment);
-    }
-    if ((content->contentDisposition()->disposition() == KMime::Headers::CDattachment ||
-            content->contentDisposition()->disposition() == KMime::Headers::CDinline) &&
-            disposition.contains("FILENAME")) {
-        QByteArray filename = disposition.remove(0, disposition.indexOf("FILENAME") + 11).split('\"')[0];
-        content->contentDisposition()->setFilename(QLatin1String(filename));
-    }
-
-    // Consume what's left
-    while (pos < structure.size() && structure[pos] != ')') {
-        skipLeadingSpaces(structure, pos);
-        parseSentence(structure, pos);
-        skipLeadingSpaces(structure, pos);
-    }
-}
-
-QByteArray FetchJobPrivate::parseSentence(const QByteArray &structure, int &pos)
-{
-    QByteArray result;
-    int stack = 0;
-
-    skipLeadingSpaces(structure, pos);
-
-    if (structure[pos] != '(') {
-        return parseString(structure, pos);
-    }
-
-    int start = pos;
-
-    do {
-        switch (structure[pos]) {
-        case '(':
-            pos++;
-            stack++;
-            break;
-        case ')':
-            pos++;
-            stack--;
-            break;
-        case '[':
-            pos++;
-            stack++;
-            break;
-        case ']':
-            pos++;
-            stack--;
-            break;
-        default:
-            skipLeadingSpaces(structure, pos);
-            parseString(structure, pos);
-            skipLeadingSpaces(structure, pos);
-            break;
-        }
-    } while (pos < structure.size() && stack != 0);
-
-    result = structure.mid(start, pos - start);
-
-    return result;
-}
-
-QByteArray FetchJobPrivate::parseString(const QByteArray &structure, int &pos)
-{
-    QByteArray result;
-
-    skipLeadingSpaces(structure, pos);
-
-    int start = pos;
-    bool foundSlash = false;
-
-    // quoted string
-    if (structure[pos] == '"') {
-        pos++;
-        Q_FOREVER {
-        if (structure[pos] == '\\')
-            {
-                pos += 2;
-                foundSlash = true;
-                continue;
+            if (d->defersParsing()) {
+                d->parseLater(std::move(result), responseSize, shouldParseMessage && !d->avoidParsing);
+                return;
             }
-            if (structure[pos] == '"')
-            {
-                result = structure.mid(start + 1, pos - start - 1);
-                pos++;
-                break;
-            }
-            pos++;
-        }
-    } else { // unquoted string
-        Q_FOREVER {
-        if (structure[pos] == ' ' ||
-            structure[pos] == '(' ||
-            structure[pos] == ')' ||
-            structure[pos] == '[' ||
-            structure[pos] == ']' ||
-            structure[pos] == '\n' ||
-            structure[pos] == '\r' ||
-            structure[pos] == '"')
-            {
-                break;
-            }
-            if (structure[pos] == '\\')
-            {
-                foundSlash = true;
-            }
-            pos++;
-        }
-
-        result = structure.mid(start, pos - start);
-
-        // transform unquoted NIL
-        if (result == "NIL") {
-            result.clear();
-        }
-    }
-
-    // simplify slashes
-    if (foundSlash) {
-        while (result.contains("\\\"")) {
-            result.replace("\\\"", "\"");
-        }
-        while (result.contains("\\\\")) {
-            result.replace("\\\\", "\\");
+            parseResult(&result, shouldParseMessage && !d->avoidParsing, false);
+            d->deliver(std::move(result), responseSize);
         }
     }
-
-    return result;
-}
-
-void FetchJobPrivate::skipLeadingSpaces(const QByteArray &structure, int &pos)
-{
-    while (pos < structure.size() && structure[pos] == ' ') {
-        pos++;
-    }
 }
 
 #include "moc_fetchjob.cpp"
@@ -23,23 +23,43 @@
 
 #include "kimap2_export.h"
 
+#include "bodystructure.h"
+#include "envelope.h"
+#include "flagset.h"
 #include "imapset.h"
 #include "job.h"
 
+#ifndef KIMAP2_NO_KMIME
 #include <kmime/kmime_content.h>
 #include <kmime/kmime_message.h>
+#endif
+
+#include <QtCore/QFileDevice>
+#include <QtCore/QSet>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QVarLengthArray>
+#include <QtCore/QVector>
+
+#include <functional>
+
+class QIODevice;
+class QThreadPool;
 
 namespace KIMAP2
 {
 
+class BodyCache;
+class ResultArena;
 class Session;
 struct Message;
 class FetchJobPrivate;
 
+#ifndef KIMAP2_NO_KMIME
 typedef QSharedPointer<KMime::Content> ContentPtr;
 typedef QMap<QByteArray, ContentPtr> MessageParts;
 
 typedef QSharedPointer<KMime::Message> MessagePtr;
+#endif
 typedef QList<QByteArray> MessageFlags;
 
 typedef QPair<QByteArray, QVariant> MessageAttribute;
@@ -136,7 +156,15 @@ public:
              *
              * The @p parts field is ignored when using this scope
              */
-            FullHeaders
+            FullHeaders,
+            /**
+             * Fetch message size (in octets), internal date of the message, flags, UID
+             * and the ENVELOPE, into Result::envelope.
+             *
+             * Gets the headers a message list shows for less than fetching them, and
+             * without parsing them with KMime. The @p parts field is ignored.
+             */
+            Envelope
         };
 
         /**
@@ -162,6 +190,14 @@ public:
          */
         Mode mode;
 
+        /**
+         * The header fields fetched in Headers and HeaderAndContent mode, e.g. "CC" or "LIST-ID".
+         *
+         * Default value is empty, which fetches TO, FROM, MESSAGE-ID, REFERENCES,
+         * IN-REPLY-TO, SUBJECT and DATE.
+         */
+        QList<QByteArray> headerFields;
+
         /**
          * Specify to fetch only items with mod-sequence higher then @p changedSince.
          *
@@ -172,6 +208,28 @@ public:
          */
         quint64 changedSince;
 
+        /**
+         * Reports the messages expunged since @p changedSince with FetchJob::vanished(),
+         * by adding VANISHED to the CHANGEDSINCE modifier (RFC 7162).
+         *
+         * Only used for UID based fetches with @p changedSince. The server must
+         * have QRESYNC capability, and QRESYNC must have been enabled on the session,
+         * e.g. by a SelectJob with SelectJob::setQResync().
+         *
+         * Default value is false.
+         */
+        bool vanishedEnabled;
+
+        /**
+         * Fetches the MODSEQ of each message into Result::modSeq (RFC 7162).
+         *
+         * The server must have CONDSTORE capability. Fetches with @p changedSince
+         * always return it.
+         *
+         * Default value is false.
+         */
+        bool modSeqEnabled;
+
         /**
         * Enables retrieving of Gmail-specific extensions
         *
@@ -181,18 +239,273 @@ public:
         * request may fail.
         */
         bool gmailExtensionsEnabled;
+
+        /**
+         * Fetches the content of @p parts with BINARY.PEEK (RFC 3516), so the server removes
+         * the content transfer encoding and the decoded data is transferred.
+         *
+         * In Headers mode the decoded size of each part is fetched as well, and added
+         * to Result::attributes as e.g. "BINARY.SIZE[1.2]".
+         *
+         * Only used if the server has the BINARY capability, otherwise the parts are
+         * fetched as usual. Parts fetched this way are listed in Result::decodedParts.
+         * Only use this for single parts, not for multiparts.
+         *
+         * Default value is false.
+         */
+        bool binaryEnabled;
+
+        /**
+         * Fetches only @p partialLength octets of the content starting at @p partialOffset,
+         * e.g. BODY.PEEK[]<0.1024>, so large contents can be fetched piecewise.
+         *
+         * Only used in Content mode, and for the message as well as for each part in @p parts.
+         * Partial contents are never parsed, they are returned in Result::rawContent and
+         * Result::rawParts, and may be shorter than requested at the end of the content.
+         *
+         * Default value is 0 (the complete content is fetched).
+         */
+        qint64 partialOffset;
+        qint64 partialLength;
+
+        /**
+         * Fetches the preview text the server generates for each message (RFC 8970),
+         * into Result::preview, e.g. for a line in a message list.
+         *
+         * With @p previewLazy the server may leave out previews it would have to generate
+         * first, these come back as null and can be fetched again later.
+         *
+         * Only used if the server has the PREVIEW capability.
+         *
+         * Default value is false.
+         */
+        bool previewEnabled;
+        bool previewLazy;
+
+        /**
+         * Fetches the EMAILID and THREADID of each message (RFC 8474), into Result::emailId
+         * and Result::threadId.
+         *
+         * The ids don't change when a message is moved or copied, so a message that
+         * appears in another mailbox can be recognized without fetching it again.
+         *
+         * Only used if the server has the OBJECTID capability.
+         *
+         * Default value is false.
+         */
+        bool objectIdEnabled;
+    };
+
+    /**
+     * A FetchScope with its FETCH items formatted up front.
+     *
+     * Jobs that fetch with the same scope over and over, like the chunks of a synchronization,
+     * can share one PreparedScope so that starting them only formats the sequence set and
+     * the modifiers. The items depend on the BINARY, PREVIEW and OBJECTID capabilities of the
+     * session they were prepared for; a job on a session with other capabilities formats
+     * its own items.
+     */
+    class KIMAP2_EXPORT PreparedScope
+    {
+    public:
+        /**
+         * Constructs an invalid PreparedScope.
+         */
+        PreparedScope();
+        /**
+         * Formats the items of @p scope for the capabilities of @p session.
+         */
+        PreparedScope(const FetchScope &scope, Session *session);
+
+        bool isValid() const;
+        FetchScope scope() const;
+
+    private:
+        friend class FetchJob;
+        FetchScope m_scope;
+        QByteArray m_items;
+        int m_features;
     };
 
     class KIMAP2_EXPORT Result
     {
     public:
+        Result();
+
+        /**
+         * The sequence number, 0 once UIDONLY (RFC 9586) is enabled, where the server only sends UIDs.
+         */
         qint64 sequenceNumber;
         qint64 uid;
         qint64 size;
+        /**
+         * The INTERNALDATE in seconds since the epoch (UTC), or 0 if it wasn't fetched.
+         */
+        qint64 internalDate;
+        /**
+         * The MODSEQ, or 0 if it wasn't fetched, see FetchScope::modSeqEnabled.
+         */
+        quint64 modSeq;
+        /**
+         * The flags as the server spelled them. The strings are shared by all results
+         * of the session.
+         */
         KIMAP2::MessageFlags flags;
-        KIMAP2::MessagePtr message;
-        KIMAP2::MessageParts parts;
+        /**
+         * The same flags in compact form, for keeping them around for many messages.
+         */
+        KIMAP2::FlagSet flagSet;
+        /**
+         * The preview text, or a null string if none was fetched, see FetchScope::previewEnabled.
+         */
+        QString preview;
+        /**
+         * The EMAILID and THREADID, or null arrays if they weren't fetched or the server
+         * didn't assign one, see FetchScope::objectIdEnabled.
+         */
+        QByteArray emailId;
+        QByteArray threadId;
+        /**
+         * The X-GM-MSGID and X-GM-THRID, or 0 if they weren't fetched, see
+         * FetchScope::gmailExtensionsEnabled.
+         */
+        qint64 gmailMessageId;
+        qint64 gmailThreadId;
+        /**
+         * The X-GM-LABELS, unquoted but otherwise as the server sent them, so labels of
+         * nested folders keep their separator and non-ASCII labels are in modified UTF-7.
+         * The strings are shared by all results of the session, like the flags.
+         */
+        KIMAP2::MessageFlags gmailLabels;
+#ifndef KIMAP2_NO_KMIME
+        mutable KIMAP2::MessagePtr message;
+        mutable KIMAP2::MessageParts parts;
+#endif
         KIMAP2::MessageAttributes attributes;
+
+        /**
+         * The data as the server sent it, only set by jobs with rawResults() enabled.
+         *
+         * rawContent is the full BODY[] with CRLF line endings, rawHeader the message
+         * header, rawParts and rawPartHeaders the bodies and headers of fetched parts.
+         */
+        QByteArray rawHeader;
+        QByteArray rawContent;
+        QMap<QByteArray, QByteArray> rawParts;
+        QMap<QByteArray, QByteArray> rawPartHeaders;
+        /**
+         * The memory-mapped files the raw data points into, see FetchJob::setMappedResultsEnabled().
+         * The byte arrays are only valid while these exist.
+         */
+        QList<QSharedPointer<QFileDevice> > rawFiles;
+
+        /**
+         * Returns rawContent with LF line endings, converting it on each call.
+         *
+         * Only meant for code that needs LF without parsing the message, parsedMessage()
+         * converts on its own. Without CRLF in rawContent no copy is made.
+         */
+        QByteArray rawContentWithLf() const;
+
+        /**
+         * The parts the server already decoded, see FetchScope::binaryEnabled.
+         */
+        QSet<QByteArray> decodedParts;
+
+        /**
+         * The structure of the message if it was fetched, see FetchScope::Structure.
+         */
+        KIMAP2::BodyStructure bodyStructure;
+
+        /**
+         * The envelope of the message if it was fetched, see FetchScope::Envelope.
+         */
+        KIMAP2::Envelope envelope;
+
+#ifndef KIMAP2_NO_KMIME
+        /**
+         * Returns message, parsing it from the raw data on first use.
+         * A message built from a fetched BODYSTRUCTURE is returned as it is, in raw
+         * mode it is built from bodyStructure on first use.
+         */
+        KIMAP2::MessagePtr parsedMessage() const;
+        /**
+         * Returns the part @p partId, parsing it from the raw data on first use.
+         */
+        KIMAP2::ContentPtr parsedPart(const QByteArray &partId) const;
+#endif
+    };
+
+    /**
+     * A slim result for the metadata-only scopes, see setCompactResultHandler().
+     *
+     * It holds no KMime objects, maps or variants, only plain integers and byte arrays,
+     * so keeping the results of a large flag scan costs about the same for each message.
+     */
+    class KIMAP2_EXPORT CompactResult
+    {
+    public:
+        struct PartHeader {
+            PartHeader() : binarySize(-1) { }
+
+            QByteArray partId;
+            /**
+             * The MIME header of the part as sent, with CRLF line endings.
+             */
+            QByteArray header;
+            /**
+             * The decoded size from BINARY.SIZE, or -1 if it wasn't fetched.
+             */
+            qint64 binarySize;
+        };
+
+        CompactResult();
+
+        /**
+         * The sequence number, 0 once UIDONLY is enabled.
+         */
+        qint64 sequenceNumber;
+        qint64 uid;
+        qint64 size;
+        /**
+         * The INTERNALDATE in seconds since the epoch (UTC), or 0 if it wasn't fetched.
+         */
+        qint64 internalDate;
+        /**
+         * The MODSEQ, or 0 if it wasn't fetched, see FetchScope::modSeqEnabled.
+         */
+        quint64 modSeq;
+        qint64 gmailMessageId;
+        qint64 gmailThreadId;
+        /**
+         * The X-GM-LABELS, shared like the flags.
+         */
+        QVector<QByteArray> gmailLabels;
+        /**
+         * The preview text, or a null string if none was fetched, see FetchScope::previewEnabled.
+         */
+        QString preview;
+        /**
+         * The EMAILID and THREADID, see FetchScope::objectIdEnabled.
+         */
+        QByteArray emailId;
+        QByteArray threadId;
+        /**
+         * The flags. Equal flags of all results of the session share their data.
+         */
+        QVector<QByteArray> flags;
+        /**
+         * The message header as sent, with CRLF line endings, empty for FetchScope::Flags.
+         */
+        QByteArray header;
+        /**
+         * The headers of the parts in FetchScope::parts.
+         */
+        QVarLengthArray<PartHeader, 2> partHeaders;
+        /**
+         * The envelope, for FetchScope::Envelope.
+         */
+        KIMAP2::Envelope envelope;
     };
 
     explicit FetchJob(Session *session);
@@ -202,7 +515,8 @@ public:
      * Set which messages to fetch data for.
      *
      * If sequence numbers are given, isUidBased() should be false.  If UIDs
-     * are given, isUidBased() should be true.
+     * are given, isUidBased() should be true. ImapSet::savedSearchResult() fetches the
+     * result a SearchJob saved on the server, which is never split into chunks.
      *
      * @param set  the sequence numbers or UIDs of the messages to fetch data for
      */
@@ -215,6 +529,10 @@ public:
     /**
      * Set how the sequence set should be interpreted.
      *
+     * Once UIDONLY (RFC 9586) is enabled the job has to be UID based. The server then
+     * identifies the messages by UID only, which the incremental delivery signals and the
+     * part sinks get in place of the sequence number.
+     *
      * @param uidBased  if @c true the argument to setSequenceSet will be
      *                  interpreted as UIDs, if @c false it will be interpreted
      *                  as sequence numbers
@@ -229,6 +547,58 @@ public:
      */
     bool isUidBased() const;
 
+    /**
+     * Fetches the messages with one command for at most @p count UIDs each.
+     *
+     * Between two of the commands, the job lets queued jobs of a higher priority go
+     * first (see Job::setPriority()). Only used for UID based fetches, and ranges
+     * without an upper bound are fetched with the last command. The default is 0,
+     * which fetches everything with a single command.
+     */
+    void setChunkSize(int count);
+    int chunkSize() const;
+
+    /**
+     * Splits the sequence set so that each command carries at most @p length bytes of it.
+     *
+     * Servers limit the length of command lines, e.g. to 8 or 64 KiB, which sparse UID sets
+     * easily exceed. Works together with setChunkSize(), and like it only for UID based fetches.
+     * The default is 0, which doesn't limit the length.
+     */
+    void setMaximumSetLength(int length);
+    int maximumSetLength() const;
+
+    /**
+     * Only fetches the messages from position @p first to @p last of the sequence set
+     * (RFC 9394), e.g. 1 and 100 for the first messages of "1:*", or -1 and -100 for the
+     * last ones, counting from the highest UID.
+     *
+     * Only one screen of a huge mailbox is transferred without knowing its UIDs first.
+     * The server must have the PARTIAL capability, otherwise the job fails. The set is
+     * sent with a single command, setChunkSize() and setMaximumSetLength() are not used.
+     */
+    void setPartial(qint64 first, qint64 last);
+
+    /**
+     * Sends up to @p count of the chunk commands before the first of them completed.
+     *
+     * This avoids a round trip per chunk. The job only steps aside for jobs of a higher
+     * priority once no chunk is in flight anymore. The default is 1.
+     */
+    void setPipelinedChunks(int count);
+    int pipelinedChunks() const;
+
+    /**
+     * Returns the highest MODSEQ of the results received so far, or 0 if none had one.
+     *
+     * The results arrive in the order of their sequence numbers, not of their mod-sequences,
+     * so this is only a safe FetchScope::changedSince for the messages of the chunks that
+     * completed already (see chunkCompleted()). An interrupted synchronization can fetch the
+     * remaining chunks with the original changedSince, and continue with the highest of
+     * both values afterwards.
+     */
+    quint64 highestModSequence() const;
+
     /**
      * Sets what data should be fetched.
      *
@@ -238,19 +608,234 @@ public:
      *               should be fetched
      */
     void setScope(const FetchScope &scope);
+    /**
+     * Sets what data should be fetched, reusing the items formatted by @p scope.
+     */
+    void setScope(const PreparedScope &scope);
     /**
      * Specifies what data will be fetched.
      */
     FetchScope scope() const;
 
+    /**
+     * Keep fetched headers and bodies as raw bytes instead of building KMime objects.
+     *
+     * Results then carry rawHeader, rawContent and friends, and message and parts
+     * stay empty until Result::parsedMessage() or Result::parsedPart() are called,
+     * which saves the parsing cost for callers that only store or forward the data.
+     * Disabled by default, except in the KIMAP2Core library, which has no KMime objects
+     * and always returns raw results.
+     */
+    void setRawResults(bool raw);
+    bool rawResults() const;
+
+    /**
+     * Leaves the raw data of literals the session spilled to a file in the file, instead of
+     * copying it into memory, see Session::setLiteralSpillThreshold().
+     *
+     * The byte arrays then point into the mapped files listed in Result::rawFiles, so they
+     * have to be copied to be kept without the result. Only has an effect with raw results.
+     * Disabled by default.
+     */
+    void setMappedResultsEnabled(bool enabled);
+    bool isMappedResultsEnabled() const;
+
+    /**
+     * Copies the raw data of the results into @p arena instead of allocating a byte array for
+     * each header, body and part, so a batch of results can be released at once with
+     * ResultArena::reset(). The data of mapped results stays in its file.
+     *
+     * The byte arrays are then only valid until the arena is reset. The arena isn't owned.
+     * Only has an effect with raw results, null (the default) doesn't use one.
+     */
+    void setResultArena(ResultArena *arena);
+    ResultArena *resultArena() const;
+
+#ifndef KIMAP2_NO_KMIME
+    /**
+     * Runs a parsing task, e.g. on a thread pool. Tasks may run concurrently.
+     */
+    typedef std::function<void(const std::function<void()> &task)> ParseExecutor;
+
+    /**
+     * Parses the KMime objects of the results with @p executor instead of on the session thread.
+     *
+     * The session keeps reading while the results are parsed, and the results are still
+     * delivered in order on the session thread, as soon as they and all before them are
+     * parsed. The job finishes after the last result was delivered. Not used with
+     * incremental delivery. Must be called before the job is started.
+     */
+    void setParseExecutor(const ParseExecutor &executor);
+
+    /**
+     * Parses the results on @p pool, see setParseExecutor().
+     *
+     * The pool has to stay valid until the job finished.
+     */
+    void setParseThreadPool(QThreadPool *pool);
+
     /**
      * Avoid calling parse() on returned KMime::Messages
      */
     void setAvoidParsing(bool);
+#endif
+
+    /**
+     * Receives the content of a streamed part in consecutive chunks.
+     */
+    typedef std::function<void(qint64 sequenceNumber, const char *data, int size)> PartSink;
+
+    /**
+     * Streams the content of @p part to @p sink instead of adding it to the Result.
+     *
+     * The part is identified as in FetchScope::parts, use an empty @p part for the complete
+     * message (BODY[]). The data is passed on as received from the server, i.e. with CRLF
+     * line endings and already decoded if FetchScope::binaryEnabled is in effect,
+     * and the part is never held in memory as a whole.
+     *
+     * Must be called before the job is started.
+     */
+    void setPartSink(const QByteArray &part, const PartSink &sink);
+
+    /**
+     * Writes the content of @p part to @p device.
+     *
+     * The device has to stay valid until the job finished.
+     */
+    void setPartSink(const QByteArray &part, QIODevice *device);
+
+    /**
+     * Takes the content of messages that are known from other mailboxes from @p cache.
+     *
+     * For a UID based job whose scope fetches the complete message (Content or HeaderAndContent
+     * without parts, or Full), the UIDs the cache has the content for are left out of
+     * BODY.PEEK[] and their results are filled from the cache. This needs a set without open
+     * ends. Every result with a key for the cache (see BodyCache::keyOf()) records its location,
+     * and a fetched content is added to the cache. Not used with incremental delivery.
+     *
+     * The cache is not owned and has to stay valid until the job finished.
+     * Must be called before the job is started.
+     */
+    void setBodyCache(BodyCache *cache);
+    BodyCache *bodyCache() const;
+
+    /**
+     * Delivers the FETCH responses incrementally while they are parsed.
+     *
+     * Instead of resultReceived(), itemStarted(), attributeStarted(), attributeData() and
+     * itemFinished() are emitted as the data arrives. Literal values are passed on in chunks
+     * and never held in memory as a whole, so the first messages of a large fetch can be
+     * processed before the rest of it was received.
+     *
+     * Must be called before the job is started.
+     */
+    void setIncrementalDelivery(bool incremental);
+
+    /**
+     * Limits how many results are delivered before the consumer acknowledged them.
+     *
+     * Once @p count results (or items with incremental delivery) were delivered and not
+     * acknowledged with acknowledgeResults(), the session stops reading from the socket at
+     * the end of the current response until more are acknowledged. Use together with
+     * Session::setReadBufferSize() so that a slow consumer throttles the server. The default
+     * of 0 delivers the results without waiting.
+     *
+     * Must be called before the job is started.
+     */
+    void setResultWindow(int count);
+    int resultWindow() const;
+
+    /**
+     * Acknowledges that @p count of the delivered results were processed. Can be called from any thread.
+     */
+    void acknowledgeResults(int count = 1);
+
+    /**
+     * Stops the job, without delivering any further results.
+     *
+     * A job that didn't run yet leaves the queue. Otherwise the rest of the response is skipped
+     * without parsing or buffering it, and no further chunks are requested. If more than 1 MiB of
+     * a literal is still to come and no other job uses the session, the connection is closed
+     * instead, since a new one (e.g. from a SessionPool) is cheaper than reading the rest.
+     *
+     * The job then finishes with KJob::KilledJobError. Can be called from any thread.
+     */
+    void abort();
+
+    /**
+     * Receives a batch of results, see setResultBatchHandler().
+     */
+    typedef std::function<void(QVector<Result> &&results)> ResultBatchHandler;
+
+    /**
+     * Delivers the results in batches to @p handler instead of emitting resultReceived() for each.
+     *
+     * A batch is handed over once it holds @p maximumCount results or about @p maximumBytes of
+     * data, once the data that arrived so far is parsed, and before the job finishes. The results
+     * are moved into the batch, so the handler can keep them without copying. It is called on the
+     * thread of the session. A result window (see setResultWindow()) also limits the batches.
+     * Not used with incremental delivery.
+     *
+     * Must be called before the job is started.
+     */
+    void setResultBatchHandler(const ResultBatchHandler &handler, int maximumCount = 1000, qint64 maximumBytes = 1024 * 1024);
+
+    /**
+     * Receives a batch of compact results, see setCompactResultHandler().
+     */
+    typedef std::function<void(QVector<CompactResult> &&results)> CompactResultBatchHandler;
+
+    /**
+     * Delivers CompactResult batches of up to @p maximumCount results to @p handler, instead
+     * of building a Result for every message.
+     *
+     * Only used with FetchScope::Flags, FetchScope::Headers, FetchScope::FullHeaders and
+     * FetchScope::Envelope, other scopes and incremental delivery still deliver full results. The batches are handed over
+     * like those of setResultBatchHandler().
+     *
+     * Must be called before the job is started.
+     */
+    void setCompactResultHandler(const CompactResultBatchHandler &handler, int maximumCount = 1000);
 
 Q_SIGNALS:
     void resultReceived(const Result &);
 
+    /**
+     * The FETCH response for @p sequenceNumber started, only used with incremental delivery.
+     */
+    void itemStarted(qint64 sequenceNumber);
+
+    /**
+     * The value of the attribute @p name, e.g. UID or BODY[], follows.
+     */
+    void attributeStarted(qint64 sequenceNumber, const QByteArray &name);
+
+    /**
+     * A chunk of the value of the attribute that was started last.
+     *
+     * Literal values may arrive in several chunks, all other values in one.
+     */
+    void attributeData(qint64 sequenceNumber, const QByteArray &data);
+
+    /**
+     * The FETCH response for @p sequenceNumber is complete.
+     */
+    void itemFinished(qint64 sequenceNumber);
+
+    /**
+     * All results for @p set were delivered, emitted when each of the commands completes.
+     *
+     * With setChunkSize() or setMaximumSetLength() that is once per chunk, in the order they
+     * were sent, so a synchronization can record its progress without waiting for the whole job.
+     */
+    void chunkCompleted(const KIMAP2::ImapSet &set);
+
+    /**
+     * The messages with @p uids were expunged since FetchScope::changedSince,
+     * see FetchScope::vanishedEnabled.
+     */
+    void vanished(const KIMAP2::ImapSet &uids);
+
 protected:
     void doStart() Q_DECL_OVERRIDE;
     void handleResponse(const Message &response) Q_DECL_OVERRIDE;
@@ -0,0 +1,244 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "flagset_p.h"
+
+#include <algorithm>
+
+using namespace KIMAP2;
+
+static const char *const systemFlagNames[] = {
+    "\\Seen",
+    "\\Answered",
+    "\\Flagged",
+    "\\Deleted",
+    "\\Draft"
+};
+static const int systemFlagCount = 5;
+
+quint8 FlagTable::systemFlag(const QByteArray &flag)
+{
+    if (!flag.startsWith('\\')) {
+        return 0;
+    }
+    for (int i = 0; i < systemFlagCount; ++i) {
+        if (qstricmp(flag.constData(), systemFlagNames[i]) == 0) {
+            return 1 << i;
+        }
+    }
+    return 0;
+}
+
+quint32 FlagTable::internId(const QByteArray &flag, QByteArray *interned)
+{
+    {
+        QReadLocker locker(&lock);
+        const auto it = spellings.constFind(flag);
+        if (it != spellings.constEnd()) {
+            *interned = flags.at(*it);
+            return folded.at(*it);
+        }
+    }
+    QWriteLocker locker(&lock);
+    const auto it = spellings.constFind(flag);
+    if (it != spellings.constEnd()) {
+        *interned = flags.at(*it);
+        return folded.at(*it);
+    }
+    //A deep copy, the flag may point into the receive buffer
+    *interned = QByteArray(flag.constData(), flag.size());
+    const QByteArray key = interned->toLower();
+    const quint32 id = ids.value(key, keywords.size());
+    if (id == quint32(keywords.size())) {
+        ids.insert(key, id);
+        keywords.append(*interned);
+    }
+    spellings.insert(*interned, flags.size());
+    flags.append(*interned);
+    folded.append(id);
+    return id;
+}
+
+QByteArray FlagTable::intern(const QByteArray &flag)
+{
+    QByteArray interned;
+    internId(flag, &interned);
+    return interned;
+}
+
+QByteArray FlagTable::keyword(quint32 id) const
+{
+    QReadLocker locker(&lock);
+    return keywords.value(id);
+}
+
+template <typename List>
+FlagSet FlagTable::parseInto(const QSharedPointer<FlagTable> &table, const QByteArray &value, List *flags)
+{
+    FlagSet set;
+    set.m_table = table;
+    int begin = value.startsWith('(') ? 1 : 0;
+    const int end = value.endsWith(')') ? value.size() - 1 : value.size();
+    while (begin < end) {
+        int next = value.indexOf(' ', begin);
+        if (next < 0 || next > end) {
+            next = end;
+        }
+        if (next > begin) {
+            QByteArray interned;
+            const quint32 id = table->internId(QByteArray::fromRawData(value.constData() + begin, next - begin), &interned);
+            if (flags) {
+                flags->append(interned);
+            }
+            const quint8 bit = systemFlag(interned);
+            if (bit) {
+                set.m_systemFlags |= bit;
+            } else {
+                set.m_keywords.append(id);
+            }
+        }
+        begin = next + 1;
+    }
+    std::sort(set.m_keywords.begin(), set.m_keywords.end());
+    set.m_keywords.erase(std::unique(set.m_keywords.begin(), set.m_keywords.end()), set.m_keywords.end());
+    return set;
+}
+
+FlagSet FlagTable::parse(const QSharedPointer<FlagTable> &table, const QByteArray &value, MessageFlags *flags)
+{
+    return parseInto(table, value, flags);
+}
+
+FlagSet FlagTable::parse(const QSharedPointer<FlagTable> &table, const QByteArray &value, QVector<QByteArray> *flags)
+{
+    return parseInto(table, value, flags);
+}
+
+template <typename List>
+void FlagTable::parseLabelsInto(const QSharedPointer<FlagTable> &table, const QByteArray &value, List *labels)
+{
+    int pos = value.startsWith('(') ? 1 : 0;
+    const int end = value.endsWith(')') ? value.size() - 1 : value.size();
+    while (pos < end) {
+        if (value.at(pos) == ' ') {
+            ++pos;
+        } else if (value.at(pos) == '"') {
+            QByteArray label;
+            for (++pos; pos < end && value.at(pos) != '"'; ++pos) {
+                if (value.at(pos) == '\\' && pos + 1 < end) {
+                    ++pos;
+                }
+                label += value.at(pos);
+            }
+            ++pos;
+            labels->append(table->intern(label));
+        } else {
+            int next = value.indexOf(' ', pos);
+            if (next < 0 || next > end) {
+                next = end;
+            }
+            labels->append(table->intern(QByteArray::fromRawData(value.constData() + pos, next - pos)));
+            pos = next;
+        }
+    }
+}
+
+void FlagTable::parseLabels(const QSharedPointer<FlagTable> &table, const QByteArray &value, MessageFlags *labels)
+{
+    parseLabelsInto(table, value, labels);
+}
+
+void FlagTable::parseLabels(const QSharedPointer<FlagTable> &table, const QByteArray &value, QVector<QByteArray> *labels)
+{
+    parseLabelsInto(table, value, labels);
+}
+
+FlagSet::FlagSet()
+    : m_systemFlags(0)
+{
+}
+
+FlagSet FlagSet::fromMessageFlags(const MessageFlags &flags)
+{
+    QSharedPointer<FlagTable> table(new FlagTable);
+    return FlagTable::parse(table, flags.join(' '), static_cast<MessageFlags *>(Q_NULLPTR));
+}
+
+bool FlagSet::isEmpty() const
+{
+    return !m_systemFlags && m_keywords.isEmpty();
+}
+
+int FlagSet::count() const
+{
+    int count = m_keywords.size();
+    for (int i = 0; i < systemFlagCount; ++i) {
+        if (m_systemFlags & (1 << i)) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+bool FlagSet::contains(const QByteArray &flag) const
+{
+    const quint8 bit = FlagTable::systemFlag(flag);
+    if (bit) {
+        return m_systemFlags & bit;
+    }
+    foreach (quint32 id, m_keywords) {
+        if (qstricmp(m_table->keyword(id).constData(), flag.constData()) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+MessageFlags FlagSet::toMessageFlags() const
+{
+    MessageFlags flags;
+    for (int i = 0; i < systemFlagCount; ++i) {
+        if (m_systemFlags & (1 << i)) {
+            flags << QByteArray::fromRawData(systemFlagNames[i], qstrlen(systemFlagNames[i]));
+        }
+    }
+    foreach (quint32 id, m_keywords) {
+        flags << m_table->keyword(id);
+    }
+    return flags;
+}
+
+bool FlagSet::operator==(const FlagSet &other) const
+{
+    if (m_systemFlags != other.m_systemFlags || m_keywords.size() != other.m_keywords.size()) {
+        return false;
+    }
+    if (m_table == other.m_table) {
+        return m_keywords == other.m_keywords;
+    }
+    foreach (quint32 id, m_keywords) {
+        if (!other.contains(m_table->keyword(id))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FlagSet::operator!=(const FlagSet &other) const
+{
+    return !(*this == other);
+}
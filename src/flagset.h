@@ -0,0 +1,88 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_FLAGSET_H
+#define KIMAP2_FLAGSET_H
+
+#include "kimap2_export.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+#include <QtCore/QMetaType>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QVector>
+
+namespace KIMAP2
+{
+
+typedef QList<QByteArray> MessageFlags;
+
+class FlagTable;
+
+/**
+  The flags of a message in a compact form.
+
+  The system flags are kept as bits and the keywords as ids into a table of the
+  session that fetched them, so the flags of many messages share one copy of each
+  keyword. toMessageFlags() converts them to the list form on demand.
+
+  A set built from a list with fromMessageFlags() has a table of its own.
+*/
+class KIMAP2_EXPORT FlagSet
+{
+public:
+    /**
+      Constructs an empty set.
+    */
+    FlagSet();
+
+    static FlagSet fromMessageFlags(const MessageFlags &flags);
+
+    bool isEmpty() const;
+
+    /**
+      Returns the number of flags.
+    */
+    int count() const;
+
+    /**
+      Returns true if @p flag is in this set, flags are compared case-insensitively.
+    */
+    bool contains(const QByteArray &flag) const;
+
+    /**
+      Returns the flags as a list, the system flags first, e.g. "\\Seen".
+    */
+    MessageFlags toMessageFlags() const;
+
+    bool operator==(const FlagSet &other) const;
+    bool operator!=(const FlagSet &other) const;
+
+private:
+    friend class FlagTable;
+
+    quint8 m_systemFlags;
+    // Sorted ids into m_table
+    QVector<quint32> m_keywords;
+    QSharedPointer<FlagTable> m_table;
+};
+
+}
+
+Q_DECLARE_METATYPE(KIMAP2::FlagSet)
+
+#endif
@@ -0,0 +1,88 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_FLAGSET_P_H
+#define KIMAP2_FLAGSET_P_H
+
+#include "flagset.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QReadWriteLock>
+
+namespace KIMAP2
+{
+
+/**
+ * Every distinct flag a session received, once.
+ *
+ * Each spelling is kept as it was received, while the ids a FlagSet holds are those of
+ * the case-folded flags, since flags are case-insensitive. Results may be read in other
+ * threads than the session's, hence the lock.
+ */
+class FlagTable
+{
+public:
+    /**
+     * Returns @p flag from the table, adding a copy of it first if it's new.
+     * @p flag may point into a receive buffer.
+     */
+    QByteArray intern(const QByteArray &flag);
+
+    /**
+     * Reads a FLAGS value such as "(\\Seen $Forwarded)" into @p flags, with the strings
+     * from the table, and returns the same flags as a set.
+     */
+    static FlagSet parse(const QSharedPointer<FlagTable> &table, const QByteArray &value, MessageFlags *flags);
+    static FlagSet parse(const QSharedPointer<FlagTable> &table, const QByteArray &value, QVector<QByteArray> *flags);
+
+    /**
+     * Reads an X-GM-LABELS value such as "(\\Inbox \"Work Items\" Travel)" into @p labels, with
+     * the strings from the table. Unlike flags, labels may be quoted strings.
+     */
+    static void parseLabels(const QSharedPointer<FlagTable> &table, const QByteArray &value, MessageFlags *labels);
+    static void parseLabels(const QSharedPointer<FlagTable> &table, const QByteArray &value, QVector<QByteArray> *labels);
+
+    /**
+     * Returns the bit of FlagSet for a system flag, 0 for a keyword.
+     */
+    static quint8 systemFlag(const QByteArray &flag);
+
+    /**
+     * Returns the keyword with @p id, as it was first spelled.
+     */
+    QByteArray keyword(quint32 id) const;
+
+private:
+    quint32 internId(const QByteArray &flag, QByteArray *interned);
+    template <typename List>
+    static FlagSet parseInto(const QSharedPointer<FlagTable> &table, const QByteArray &value, List *flags);
+    template <typename List>
+    static void parseLabelsInto(const QSharedPointer<FlagTable> &table, const QByteArray &value, List *labels);
+
+    mutable QReadWriteLock lock;
+    // The spellings, with the id of the folded flag of each
+    QVector<QByteArray> flags;
+    QVector<quint32> folded;
+    QHash<QByteArray, int> spellings;
+    // By id, the first spelling of each folded flag
+    QVector<QByteArray> keywords;
+    QHash<QByteArray, quint32> ids;
+};
+
+}
+
+#endif
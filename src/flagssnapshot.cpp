@@ -0,0 +1,853 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "flagssnapshot.h"
+
+#include "imapbitmap.h"
+#include "searchjob.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QSharedData>
+
+#include <algorithm>
+#include <limits>
+
+using namespace KIMAP2;
+
+// The largest IMAP number
+static const qint64 maxUid = Q_INT64_C(0xFFFFFFFF);
+
+namespace
+{
+
+/**
+ * A column of numbers stored as Narrow until a value doesn't fit, then all of them are
+ * converted to Wide.
+ */
+template <typename Narrow, typename Wide>
+class PackedColumn
+{
+public:
+    PackedColumn() : wide(false) {}
+
+    int size() const
+    {
+        return wide ? wideValues.size() : narrowValues.size();
+    }
+
+    Wide at(int i) const
+    {
+        return wide ? wideValues.at(i) : Wide(narrowValues.at(i));
+    }
+
+    void set(int i, Wide value)
+    {
+        widenFor(value);
+        if (wide) {
+            wideValues[i] = value;
+        } else {
+            narrowValues[i] = Narrow(value);
+        }
+    }
+
+    void append(Wide value)
+    {
+        widenFor(value);
+        if (wide) {
+            wideValues.append(value);
+        } else {
+            narrowValues.append(Narrow(value));
+        }
+    }
+
+    void insert(int i, Wide value)
+    {
+        widenFor(value);
+        if (wide) {
+            wideValues.insert(i, value);
+        } else {
+            narrowValues.insert(i, Narrow(value));
+        }
+    }
+
+    void reserve(int size)
+    {
+        if (wide) {
+            wideValues.reserve(size);
+        } else {
+            narrowValues.reserve(size);
+        }
+    }
+
+    void squeeze()
+    {
+        wideValues.squeeze();
+        narrowValues.squeeze();
+    }
+
+    // Keeps the values at the positions in @p keep
+    void filter(const QVector<bool> &keep)
+    {
+        int j = 0;
+        for (int i = 0; i < size(); ++i) {
+            if (keep.at(i)) {
+                set(j++, at(i));
+            }
+        }
+        if (wide) {
+            wideValues.resize(j);
+        } else {
+            narrowValues.resize(j);
+        }
+    }
+
+    qint64 memoryUsage() const
+    {
+        return wide ? qint64(wideValues.capacity()) * sizeof(Wide) : qint64(narrowValues.capacity()) * sizeof(Narrow);
+    }
+
+private:
+    void widenFor(Wide value)
+    {
+        if (wide || value <= Wide(std::numeric_limits<Narrow>::max())) {
+            return;
+        }
+        wideValues.reserve(narrowValues.capacity());
+        for (Narrow narrow : narrowValues) {
+            wideValues.append(narrow);
+        }
+        narrowValues = QVector<Narrow>();
+        wide = true;
+    }
+
+    bool wide;
+    QVector<Narrow> narrowValues;
+    QVector<Wide> wideValues;
+};
+
+struct SystemFlagName {
+    const char *name;
+    FlagsSnapshot::SystemFlag flag;
+};
+
+static const SystemFlagName systemFlagNames[] = {
+    { "\\Seen", FlagsSnapshot::Seen },
+    { "\\Answered", FlagsSnapshot::Answered },
+    { "\\Flagged", FlagsSnapshot::Flagged },
+    { "\\Deleted", FlagsSnapshot::Deleted },
+    { "\\Draft", FlagsSnapshot::Draft }
+};
+
+static quint8 systemFlag(const QByteArray &flag)
+{
+    if (!flag.startsWith('\\')) {
+        return 0;
+    }
+    for (const SystemFlagName &name : systemFlagNames) {
+        if (qstricmp(flag.constData(), name.name) == 0) {
+            return name.flag;
+        }
+    }
+    return 0;
+}
+
+// A message in the form it is stored
+struct PackedMessage {
+    quint32 uid;
+    quint8 systemFlags;
+    quint32 keywordSet;
+    quint64 modSeq;
+};
+
+// A search key compiled for matching against the columns, see FlagsSnapshot::search()
+struct SearchNode {
+    enum Kind {
+        All,
+        System,
+        Keyword,
+        Uids,
+        Not,
+        And,
+        Or
+    };
+
+    SearchNode() : kind(All), systemFlag(0) {}
+
+    Kind kind;
+    quint8 systemFlag;
+    // Whether each keyword set contains the keyword
+    QVector<bool> keywordSets;
+    ImapBitmap uids;
+    QList<SearchNode> children;
+};
+
+struct SearchFlagName {
+    const char *name;
+    FlagsSnapshot::SystemFlag flag;
+    bool negated;
+};
+
+static const SearchFlagName searchFlagNames[] = {
+    { "SEEN", FlagsSnapshot::Seen, false },
+    { "UNSEEN", FlagsSnapshot::Seen, true },
+    { "ANSWERED", FlagsSnapshot::Answered, false },
+    { "UNANSWERED", FlagsSnapshot::Answered, true },
+    { "FLAGGED", FlagsSnapshot::Flagged, false },
+    { "UNFLAGGED", FlagsSnapshot::Flagged, true },
+    { "DELETED", FlagsSnapshot::Deleted, false },
+    { "UNDELETED", FlagsSnapshot::Deleted, true },
+    { "DRAFT", FlagsSnapshot::Draft, false },
+    { "UNDRAFT", FlagsSnapshot::Draft, true }
+};
+
+static void skipSpaces(const QByteArray &program, int &pos)
+{
+    while (pos < program.size() && program.at(pos) == ' ') {
+        ++pos;
+    }
+}
+
+// An atom, up to the next space or closing bracket
+static QByteArray atom(const QByteArray &program, int &pos)
+{
+    skipSpaces(program, pos);
+    const int start = pos;
+    while (pos < program.size() && program.at(pos) != ' ' && program.at(pos) != ')' && program.at(pos) != '(') {
+        ++pos;
+    }
+    return program.mid(start, pos - start);
+}
+
+// An atom or a quoted string
+static bool argument(const QByteArray &program, int &pos, QByteArray *value)
+{
+    skipSpaces(program, pos);
+    if (pos >= program.size()) {
+        return false;
+    }
+    if (program.at(pos) != '"') {
+        *value = atom(program, pos);
+        return !value->isEmpty();
+    }
+    for (++pos; pos < program.size(); ++pos) {
+        const char c = program.at(pos);
+        if (c == '"') {
+            ++pos;
+            return true;
+        }
+        if (c == '\\' && pos + 1 < program.size()) {
+            ++pos;
+        }
+        *value += program.at(pos);
+    }
+    return false;
+}
+
+/*
+ * Returns the flags a message needs to have and must not have to match @p node, if it only
+ * depends on the system flags, so that only that column has to be scanned.
+ */
+static bool systemMasks(const SearchNode &node, quint8 *set, quint8 *unset)
+{
+    switch (node.kind) {
+    case SearchNode::All:
+        return true;
+    case SearchNode::System:
+        *set |= node.systemFlag;
+        return true;
+    case SearchNode::Not:
+        if (node.children.first().kind != SearchNode::System) {
+            return false;
+        }
+        *unset |= node.children.first().systemFlag;
+        return true;
+    case SearchNode::And:
+        for (const SearchNode &child : node.children) {
+            if (!systemMasks(child, set, unset)) {
+                return false;
+            }
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+}
+
+class FlagsSnapshot::Private : public QSharedData
+{
+public:
+    Private() : QSharedData()
+    {
+        keywordSetTable.append(QVector<int>());
+        keywordSetIds.insert(QByteArray(), 0);
+    }
+
+    int lowerBound(qint64 uid, int from = 0) const
+    {
+        return std::lower_bound(uids.constBegin() + from, uids.constEnd(), quint32(uid)) - uids.constBegin();
+    }
+
+    int indexOf(qint64 uid) const
+    {
+        if (uid <= 0 || uid > maxUid) {
+            return -1;
+        }
+        const int i = lowerBound(uid);
+        return i < uids.size() && uids.at(i) == uid ? i : -1;
+    }
+
+    PackedMessage pack(const MessageState &message);
+    bool lookup(const MessageFlags &flags, quint8 *system, quint32 *keywordSet) const;
+    void append(const PackedMessage &message);
+    void store(int i, const PackedMessage &message);
+
+    // Compile the serialized search keys, and fail on keys that need more than the columns
+    bool compileKeys(const QByteArray &program, int &pos, bool inGroup, SearchNode *node) const;
+    bool compileKey(const QByteArray &program, int &pos, SearchNode *node) const;
+    bool matches(const SearchNode &node, int i) const;
+
+    QVector<quint32> uids;
+    QVector<quint8> systemFlags;
+    PackedColumn<quint16, quint32> keywordSets;
+    PackedColumn<quint32, quint64> modSeqs;
+
+    // The keywords as they were first stored, and their ids by lower case name
+    QList<QByteArray> keywords;
+    QHash<QByteArray, int> keywordIds;
+    // The sorted keyword ids of each keyword set, the set 0 is empty
+    QVector<QVector<int> > keywordSetTable;
+    QHash<QByteArray, quint32> keywordSetIds;
+};
+
+static QByteArray keywordSetKey(const QVector<int> &ids)
+{
+    return QByteArray(reinterpret_cast<const char *>(ids.constData()), ids.size() * int(sizeof(int)));
+}
+
+PackedMessage FlagsSnapshot::Private::pack(const MessageState &message)
+{
+    PackedMessage packed;
+    packed.uid = quint32(message.uid);
+    packed.systemFlags = 0;
+    packed.modSeq = message.modSeq;
+
+    QVector<int> ids;
+    foreach (const QByteArray &flag, message.flags) {
+        const quint8 system = systemFlag(flag);
+        if (system) {
+            packed.systemFlags |= system;
+            continue;
+        }
+        const QByteArray key = flag.toLower();
+        auto it = keywordIds.constFind(key);
+        if (it == keywordIds.constEnd()) {
+            it = keywordIds.insert(key, keywords.size());
+            keywords << flag;
+        }
+        ids << *it;
+    }
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+    const QByteArray key = keywordSetKey(ids);
+    auto it = keywordSetIds.constFind(key);
+    if (it == keywordSetIds.constEnd()) {
+        it = keywordSetIds.insert(key, keywordSetTable.size());
+        keywordSetTable << ids;
+    }
+    packed.keywordSet = *it;
+    return packed;
+}
+
+bool FlagsSnapshot::Private::lookup(const MessageFlags &flags, quint8 *system, quint32 *keywordSet) const
+{
+    *system = 0;
+    QVector<int> ids;
+    foreach (const QByteArray &flag, flags) {
+        const quint8 bit = systemFlag(flag);
+        if (bit) {
+            *system |= bit;
+            continue;
+        }
+        const auto it = keywordIds.constFind(flag.toLower());
+        if (it == keywordIds.constEnd()) {
+            return false;
+        }
+        ids << *it;
+    }
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    const auto it = keywordSetIds.constFind(keywordSetKey(ids));
+    if (it == keywordSetIds.constEnd()) {
+        return false;
+    }
+    *keywordSet = *it;
+    return true;
+}
+
+void FlagsSnapshot::Private::append(const PackedMessage &message)
+{
+    uids.append(message.uid);
+    systemFlags.append(message.systemFlags);
+    keywordSets.append(message.keywordSet);
+    modSeqs.append(message.modSeq);
+}
+
+void FlagsSnapshot::Private::store(int i, const PackedMessage &message)
+{
+    systemFlags[i] = message.systemFlags;
+    keywordSets.set(i, message.keywordSet);
+    modSeqs.set(i, message.modSeq);
+}
+
+bool FlagsSnapshot::Private::compileKeys(const QByteArray &program, int &pos, bool inGroup, SearchNode *node) const
+{
+    node->kind = SearchNode::And;
+    Q_FOREVER {
+        skipSpaces(program, pos);
+        if (pos >= program.size()) {
+            return !inGroup;
+        }
+        if (program.at(pos) == ')') {
+            ++pos;
+            return inGroup;
+        }
+        SearchNode child;
+        if (!compileKey(program, pos, &child)) {
+            return false;
+        }
+        node->children << child;
+    }
+}
+
+bool FlagsSnapshot::Private::compileKey(const QByteArray &program, int &pos, SearchNode *node) const
+{
+    skipSpaces(program, pos);
+    if (pos >= program.size()) {
+        return false;
+    }
+    if (program.at(pos) == '(') {
+        ++pos;
+        return compileKeys(program, pos, true, node);
+    }
+    const QByteArray name = atom(program, pos).toUpper();
+    if (name == "ALL") {
+        node->kind = SearchNode::All;
+        return true;
+    }
+    if (name == "NOT" || name == "OR") {
+        node->kind = name == "NOT" ? SearchNode::Not : SearchNode::Or;
+        for (int i = name == "NOT" ? 1 : 2; i > 0; --i) {
+            SearchNode child;
+            if (!compileKey(program, pos, &child)) {
+                return false;
+            }
+            node->children << child;
+        }
+        return true;
+    }
+    if (name == "FUZZY") {
+        //Flags match exactly or not at all
+        return compileKey(program, pos, node);
+    }
+    for (const SearchFlagName &flag : searchFlagNames) {
+        if (name == flag.name) {
+            SearchNode key;
+            key.kind = SearchNode::System;
+            key.systemFlag = flag.flag;
+            if (flag.negated) {
+                node->kind = SearchNode::Not;
+                node->children << key;
+            } else {
+                *node = key;
+            }
+            return true;
+        }
+    }
+    if (name == "KEYWORD" || name == "UNKEYWORD") {
+        QByteArray keyword;
+        if (!argument(program, pos, &keyword)) {
+            return false;
+        }
+        SearchNode key;
+        key.kind = SearchNode::Keyword;
+        key.keywordSets.fill(false, keywordSetTable.size());
+        const int id = keywordIds.value(keyword.toLower(), -1);
+        for (int set = 0; id >= 0 && set < keywordSetTable.size(); ++set) {
+            const QVector<int> &ids = keywordSetTable.at(set);
+            key.keywordSets[set] = std::binary_search(ids.constBegin(), ids.constEnd(), id);
+        }
+        if (name == "UNKEYWORD") {
+            node->kind = SearchNode::Not;
+            node->children << key;
+        } else {
+            *node = key;
+        }
+        return true;
+    }
+    if (name == "UID") {
+        const QByteArray set = atom(program, pos);
+        //A saved search result only the server knows
+        if (set.isEmpty() || set.startsWith('$')) {
+            return false;
+        }
+        node->kind = SearchNode::Uids;
+        //"*" is the highest UID in use, even if it is below the start of the interval
+        const ImapSet::Id highest = uids.isEmpty() ? 0 : uids.last();
+        foreach (const ImapSet::Range &range, ImapSet::fromImapSequenceSet(set).ranges()) {
+            if (range.begin < 1) {
+                continue;
+            }
+            if (range.end) {
+                node->uids.add(qMin(range.begin, range.end), qMin(qMax(range.begin, range.end), maxUid));
+            } else if (highest) {
+                node->uids.add(qMin(range.begin, highest), qMin(qMax(range.begin, highest), maxUid));
+            }
+        }
+        return true;
+    }
+    //Headers, dates, sizes, the body, sequence numbers, \Recent ...
+    return false;
+}
+
+bool FlagsSnapshot::Private::matches(const SearchNode &node, int i) const
+{
+    switch (node.kind) {
+    case SearchNode::All:
+        return true;
+    case SearchNode::System:
+        return systemFlags.at(i) & node.systemFlag;
+    case SearchNode::Keyword: {
+        const quint32 set = keywordSets.at(i);
+        return set < quint32(node.keywordSets.size()) && node.keywordSets.at(set);
+    }
+    case SearchNode::Uids:
+        return node.uids.contains(uids.at(i));
+    case SearchNode::Not:
+        return !matches(node.children.first(), i);
+    case SearchNode::And:
+        for (const SearchNode &child : node.children) {
+            if (!matches(child, i)) {
+                return false;
+            }
+        }
+        return true;
+    case SearchNode::Or:
+        return matches(node.children.at(0), i) || matches(node.children.at(1), i);
+    }
+    return false;
+}
+
+FlagsSnapshot::FlagsSnapshot()
+    : d(new Private)
+{
+}
+
+FlagsSnapshot::FlagsSnapshot(const FlagsSnapshot &other)
+    : d(other.d)
+{
+}
+
+FlagsSnapshot::~FlagsSnapshot()
+{
+}
+
+FlagsSnapshot &FlagsSnapshot::operator=(const FlagsSnapshot &other)
+{
+    d = other.d;
+    return *this;
+}
+
+int FlagsSnapshot::count() const
+{
+    return d->uids.size();
+}
+
+bool FlagsSnapshot::isEmpty() const
+{
+    return d->uids.isEmpty();
+}
+
+bool FlagsSnapshot::contains(qint64 uid) const
+{
+    return d->indexOf(uid) >= 0;
+}
+
+void FlagsSnapshot::set(qint64 uid, const MessageFlags &flags, quint64 modSeq)
+{
+    if (uid <= 0 || uid > maxUid) {
+        return;
+    }
+    MessageState message;
+    message.uid = uid;
+    message.flags = flags;
+    message.modSeq = modSeq;
+    const PackedMessage packed = d->pack(message);
+
+    const int i = d->lowerBound(uid);
+    if (i < d->uids.size() && d->uids.at(i) == uid) {
+        d->store(i, packed);
+    } else if (i == d->uids.size()) {
+        d->append(packed);
+    } else {
+        d->uids.insert(i, packed.uid);
+        d->systemFlags.insert(i, packed.systemFlags);
+        d->keywordSets.insert(i, packed.keywordSet);
+        d->modSeqs.insert(i, packed.modSeq);
+    }
+}
+
+void FlagsSnapshot::apply(const QVector<MessageState> &messages)
+{
+    if (messages.isEmpty()) {
+        return;
+    }
+    QVector<MessageState> sorted = messages;
+    std::stable_sort(sorted.begin(), sorted.end(), [](const MessageState &left, const MessageState &right) {
+        return left.uid < right.uid;
+    });
+
+    QVector<PackedMessage> additions;
+    int from = 0;
+    for (int i = 0; i < sorted.size(); ++i) {
+        const MessageState &message = sorted.at(i);
+        //The last one of a UID wins
+        if (message.uid <= 0 || message.uid > maxUid || (i + 1 < sorted.size() && sorted.at(i + 1).uid == message.uid)) {
+            continue;
+        }
+        const PackedMessage packed = d->pack(message);
+        from = d->lowerBound(message.uid, from);
+        if (from < d->uids.size() && d->uids.at(from) == packed.uid) {
+            d->store(from, packed);
+        } else {
+            additions << packed;
+        }
+    }
+    if (additions.isEmpty()) {
+        return;
+    }
+
+    //Appending is the common case, new messages have higher UIDs
+    if (d->uids.isEmpty() || additions.first().uid > d->uids.last()) {
+        for (const PackedMessage &message : additions) {
+            d->append(message);
+        }
+        return;
+    }
+
+    //Merge both sorted lists into new columns
+    Private *const old = d.data();
+    const int size = old->uids.size() + additions.size();
+    QVector<quint32> uids;
+    QVector<quint8> systemFlags;
+    PackedColumn<quint16, quint32> keywordSets;
+    PackedColumn<quint32, quint64> modSeqs;
+    uids.reserve(size);
+    systemFlags.reserve(size);
+    keywordSets.reserve(size);
+    modSeqs.reserve(size);
+    int i = 0;
+    int j = 0;
+    while (i < old->uids.size() || j < additions.size()) {
+        if (j == additions.size() || (i < old->uids.size() && old->uids.at(i) < additions.at(j).uid)) {
+            uids.append(old->uids.at(i));
+            systemFlags.append(old->systemFlags.at(i));
+            keywordSets.append(old->keywordSets.at(i));
+            modSeqs.append(old->modSeqs.at(i));
+            ++i;
+        } else {
+            const PackedMessage &message = additions.at(j++);
+            uids.append(message.uid);
+            systemFlags.append(message.systemFlags);
+            keywordSets.append(message.keywordSet);
+            modSeqs.append(message.modSeq);
+        }
+    }
+    old->uids = uids;
+    old->systemFlags = systemFlags;
+    old->keywordSets = keywordSets;
+    old->modSeqs = modSeqs;
+}
+
+void FlagsSnapshot::remove(const ImapSet &uids)
+{
+    if (uids.isEmpty() || isEmpty()) {
+        return;
+    }
+    ImapSet sorted = uids;
+    sorted.optimize();
+    const QVector<ImapSet::Range> ranges = sorted.ranges();
+
+    QVector<bool> keep(d->uids.size(), true);
+    bool removed = false;
+    foreach (const ImapSet::Range &range, ranges) {
+        const qint64 end = range.end ? range.end : maxUid;
+        for (int i = d->lowerBound(range.begin); i < d->uids.size() && d->uids.at(i) <= end; ++i) {
+            keep[i] = false;
+            removed = true;
+        }
+    }
+    if (!removed) {
+        return;
+    }
+
+    int j = 0;
+    for (int i = 0; i < d->uids.size(); ++i) {
+        if (keep.at(i)) {
+            d->uids[j] = d->uids.at(i);
+            d->systemFlags[j] = d->systemFlags.at(i);
+            ++j;
+        }
+    }
+    d->uids.resize(j);
+    d->systemFlags.resize(j);
+    d->keywordSets.filter(keep);
+    d->modSeqs.filter(keep);
+}
+
+FlagsSnapshot::Diff FlagsSnapshot::diff(const QVector<MessageState> &messages) const
+{
+    Diff diff;
+    foreach (const MessageState &message, messages) {
+        const int i = d->indexOf(message.uid);
+        if (i < 0) {
+            diff.added << message;
+            continue;
+        }
+        quint8 system;
+        quint32 keywordSet;
+        if (!d->lookup(message.flags, &system, &keywordSet) || system != d->systemFlags.at(i)
+                || keywordSet != d->keywordSets.at(i) || message.modSeq != d->modSeqs.at(i)) {
+            diff.changed << message;
+        }
+    }
+    return diff;
+}
+
+MessageFlags FlagsSnapshot::flags(qint64 uid) const
+{
+    MessageFlags flags;
+    const int i = d->indexOf(uid);
+    if (i < 0) {
+        return flags;
+    }
+    for (const SystemFlagName &name : systemFlagNames) {
+        if (d->systemFlags.at(i) & name.flag) {
+            flags << QByteArray(name.name);
+        }
+    }
+    foreach (int id, d->keywordSetTable.at(d->keywordSets.at(i))) {
+        flags << d->keywords.at(id);
+    }
+    return flags;
+}
+
+FlagsSnapshot::SystemFlags FlagsSnapshot::systemFlags(qint64 uid) const
+{
+    const int i = d->indexOf(uid);
+    return i < 0 ? SystemFlags() : SystemFlags(QFlag(d->systemFlags.at(i)));
+}
+
+quint64 FlagsSnapshot::modSeq(qint64 uid) const
+{
+    const int i = d->indexOf(uid);
+    return i < 0 ? 0 : d->modSeqs.at(i);
+}
+
+ImapSet FlagsSnapshot::uids() const
+{
+    ImapSetBuilder builder;
+    foreach (quint32 uid, d->uids) {
+        builder.add(uid);
+    }
+    return builder.toSet();
+}
+
+ImapSet FlagsSnapshot::uids(SystemFlag flag) const
+{
+    ImapSetBuilder builder;
+    for (int i = 0; i < d->uids.size(); ++i) {
+        if (d->systemFlags.at(i) & flag) {
+            builder.add(d->uids.at(i));
+        }
+    }
+    return builder.toSet();
+}
+
+ImapSet FlagsSnapshot::search(const Term &term, bool *ok) const
+{
+    SearchNode node;
+    int pos = 0;
+    const bool compiled = !term.isNull() && d->compileKeys(term.serialize(), pos, false, &node);
+    if (ok) {
+        *ok = compiled;
+    }
+    if (!compiled) {
+        return ImapSet();
+    }
+    ImapSetBuilder builder;
+    quint8 set = 0;
+    quint8 unset = 0;
+    if (systemMasks(node, &set, &unset)) {
+        //The common case, e.g. UNSEEN or FLAGGED NOT DELETED
+        for (int i = 0; i < d->uids.size(); ++i) {
+            const quint8 flags = d->systemFlags.at(i);
+            if ((flags & set) == set && !(flags & unset)) {
+                builder.add(d->uids.at(i));
+            }
+        }
+    } else {
+        for (int i = 0; i < d->uids.size(); ++i) {
+            if (d->matches(node, i)) {
+                builder.add(d->uids.at(i));
+            }
+        }
+    }
+    return builder.toSet();
+}
+
+quint64 FlagsSnapshot::highestModSequence() const
+{
+    quint64 highest = 0;
+    for (int i = 0; i < d->modSeqs.size(); ++i) {
+        highest = qMax(highest, d->modSeqs.at(i));
+    }
+    return highest;
+}
+
+void FlagsSnapshot::squeeze()
+{
+    d->uids.squeeze();
+    d->systemFlags.squeeze();
+    d->keywordSets.squeeze();
+    d->modSeqs.squeeze();
+}
+
+qint64 FlagsSnapshot::memoryUsage() const
+{
+    qint64 usage = qint64(d->uids.capacity()) * sizeof(quint32) + d->systemFlags.capacity()
+                   + d->keywordSets.memoryUsage() + d->modSeqs.memoryUsage();
+    foreach (const QByteArray &keyword, d->keywords) {
+        usage += 2 * keyword.size();
+    }
+    foreach (const QVector<int> &set, d->keywordSetTable) {
+        usage += 2 * set.size() * sizeof(int);
+    }
+    return usage;
+}
@@ -0,0 +1,161 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_FLAGSSNAPSHOT_H
+#define KIMAP2_FLAGSSNAPSHOT_H
+
+#include "kimap2_export.h"
+
+#include "imapset.h"
+#include "mailboxsyncjob.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QSharedDataPointer>
+#include <QtCore/QVector>
+
+namespace KIMAP2
+{
+
+class Term;
+
+/**
+  Holds the UIDs, flags and mod-sequences of all messages of a mailbox.
+
+  The data is stored in columns sorted by UID: the UID as 32 bits, the system flags
+  as bits of one byte, the keywords as the id of an interned set of keywords and the
+  mod-sequence as 32 bits until a larger one is stored. A message takes 11 bytes
+  that way, 15 with large mod-sequences, instead of the few hundred a
+  QMap<qint64, MessageFlags> needs.
+
+  The flags of a message are returned with the system flags first, the order and
+  spelling of the keywords is the one they were first stored with.
+
+  This class is implicitly shared.
+*/
+class KIMAP2_EXPORT FlagsSnapshot
+{
+public:
+    typedef MailboxSyncJob::MessageState MessageState;
+
+    enum SystemFlag {
+        Seen = 0x01,
+        Answered = 0x02,
+        Flagged = 0x04,
+        Deleted = 0x08,
+        Draft = 0x10
+    };
+    Q_DECLARE_FLAGS(SystemFlags, SystemFlag)
+
+    /**
+      How a batch of messages differs from the snapshot.
+    */
+    struct Diff {
+        QVector<MessageState> added;
+        QVector<MessageState> changed;
+    };
+
+    /**
+      Constructs an empty snapshot.
+    */
+    FlagsSnapshot();
+    FlagsSnapshot(const FlagsSnapshot &other);
+    ~FlagsSnapshot();
+    FlagsSnapshot &operator=(const FlagsSnapshot &other);
+
+    /**
+      Returns the number of messages.
+    */
+    int count() const;
+    bool isEmpty() const;
+    bool contains(qint64 uid) const;
+
+    /**
+      Adds a message or replaces its flags and mod-sequence.
+    */
+    void set(qint64 uid, const MessageFlags &flags, quint64 modSeq = 0);
+
+    /**
+      Stores a batch of messages, e.g. from MailboxSyncJob::changedMessages().
+
+      The batch is sorted and merged in one pass, which is much cheaper than calling
+      set() for each message when many of them are new.
+    */
+    void apply(const QVector<MessageState> &messages);
+
+    /**
+      Removes messages, e.g. from MailboxSyncJob::vanishedMessages().
+    */
+    void remove(const ImapSet &uids);
+
+    /**
+      Returns the messages of @p messages that aren't in the snapshot, and those whose
+      flags or mod-sequence differ from it. The snapshot isn't changed.
+    */
+    Diff diff(const QVector<MessageState> &messages) const;
+
+    /**
+      Return the flags of a message, empty if it isn't in the snapshot.
+    */
+    MessageFlags flags(qint64 uid) const;
+    SystemFlags systemFlags(qint64 uid) const;
+    quint64 modSeq(qint64 uid) const;
+
+    /**
+      Returns the UIDs of all messages.
+    */
+    ImapSet uids() const;
+
+    /**
+      Returns the UIDs of the messages with @p flag.
+    */
+    ImapSet uids(SystemFlag flag) const;
+
+    /**
+      Returns the UIDs of the messages that match @p term, without asking the server.
+
+      Only terms on what the snapshot holds can be evaluated: ALL, the flags but \\Recent
+      (so not NEW, OLD and RECENT), KEYWORD, UID sets, and AND, OR and NOT of those.
+      For other terms, e.g. on headers or the body, @p ok is set to false and an empty set
+      is returned, so that the search can be sent to the server instead.
+    */
+    ImapSet search(const Term &term, bool *ok = Q_NULLPTR) const;
+
+    /**
+      Returns the largest mod-sequence stored.
+    */
+    quint64 highestModSequence() const;
+
+    /**
+      Releases the memory reserved for messages still to come, e.g. after loading a mailbox.
+    */
+    void squeeze();
+
+    /**
+      Returns roughly how many bytes the snapshot takes.
+    */
+    qint64 memoryUsage() const;
+
+private:
+    class Private;
+    QSharedDataPointer<Private> d;
+};
+
+}
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(KIMAP2::FlagsSnapshot::SystemFlags)
+
+#endif
@@ -53,7 +53,12 @@ void GetAclJob::doStart()
 {
     Q_D(GetAclJob);
 
-    d->sendCommand("GETACL", '\"' + KIMAP2::encodeImapFolderName(d->mailBox.toUtf8()) + '\"');
+    if (d->sessionInternal()->cachedAcl(d->mailBox, &d->userRights)) {
+        emitResult();
+        return;
+    }
+
+    d->sendCommand("GETACL", '\"' + d->sessionInternal()->encodeMailBoxName(d->mailBox) + '\"');
 }
 
 void GetAclJob::handleResponse(const Message &response)
@@ -61,12 +66,17 @@ void GetAclJob::handleResponse(const Message &response)
     Q_D(GetAclJob);
 //   qCDebug(KIMAP2_LOG) << response.toString();
 
+    if (response.content.size() >= 2 && !d->tags.isEmpty() && response.content.first().toString() == d->tags.last()
+            && response.content[1].keyword() == ImapKeyword::Ok) {
+        d->sessionInternal()->rememberAcl(d->mailBox, d->userRights);
+    }
+
     if (handleErrorReplies(response) == NotHandled) {
         if (response.content.size() >= 4 &&
                 response.content[1].toString() == "ACL") {
             int i = 3;
             while (i < response.content.size() - 1) {
-                QByteArray id = response.content[i].toString();
+                const QByteArray id = response.owned(response.content[i].toString());
                 QByteArray rights = response.content[i + 1].toString();
                 d->userRights[id] = Acl::rightsFromString(rights);
                 i += 2;
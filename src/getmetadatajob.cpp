@@ -31,15 +31,62 @@ namespace KIMAP2
 class GetMetaDataJobPrivate : public MetaDataJobBasePrivate
 {
 public:
-    GetMetaDataJobPrivate(Session *session, const QString &name) : MetaDataJobBasePrivate(session, name), maxSize(-1), depth("0") { }
+    GetMetaDataJobPrivate(Session *session, const QString &name) : MetaDataJobBasePrivate(session, name), maxSize(-1), depth("0"), wildcard(false), storage(GetMetaDataJob::MapStorage) { }
     ~GetMetaDataJobPrivate() { }
 
+    static QByteArray normalizedName(const QByteArray &name)
+    {
+        //INBOX is case-insensitive
+        return name.toUpper() == "INBOX" ? QByteArray("INBOX") : name;
+    }
+
+    /**
+     * Returns the decoded name of @p name, which is only decoded the first time.
+     */
+    QString decodedName(const QByteArray &name)
+    {
+        auto it = decodedNames.constFind(name);
+        if (it == decodedNames.constEnd()) {
+            //The name may point into the receive buffer
+            it = decodedNames.insert(QByteArray(name.constData(), name.size()), sessionInternal()->decodeMailBoxName(name));
+        }
+        return *it;
+    }
+
+    void store(const QString &mailBox, const QByteArray &entry, const QByteArray &attribute, const QByteArray &value, GetMetaDataJob *q)
+    {
+        GetMetaDataJob::Entry result;
+        result.mailBox = mailBox;
+        result.entry = addPrefix(entry, attribute);
+        result.attribute = attribute;
+        result.value = value;
+        switch (storage) {
+        case GetMetaDataJob::MapStorage:
+            metadata[mailBox][entry][attribute] = value;
+            break;
+        case GetMetaDataJob::FlatStorage:
+            flat << result;
+            break;
+        case GetMetaDataJob::NoStorage:
+            break;
+        }
+        emit q->resultReceived(result);
+    }
+
     qint64 maxSize;
     QByteArray depth;
     QSet<QByteArray> entries;
     QSet<QByteArray> attributes;
     QMap<QString, QMap<QByteArray, QMap<QByteArray, QByteArray> > > metadata;
     //    ^ mailbox        ^ entry          ^attribute  ^ value
+    QStringList mailBoxes;
+    //The names as sent, to tell our responses apart from those of pipelined jobs
+    QSet<QByteArray> encodedNames;
+    bool wildcard;
+    GetMetaDataJob::Storage storage;
+    QVector<GetMetaDataJob::Entry> flat;
+    // The decoded mailbox names by the names as received, so that equal names share their data
+    QHash<QByteArray, QString> decodedNames;
 };
 }
 
@@ -48,6 +95,19 @@ using namespace KIMAP2;
 GetMetaDataJob::GetMetaDataJob(Session *session)
     : MetaDataJobBase(*new GetMetaDataJobPrivate(session, "GetMetaData"))
 {
+    Q_D(GetMetaDataJob);
+    //Like STATUS, the responses name the mailbox and nothing else changes
+    d->pipelineSafe = true;
+    d->isInterestedIn = [d](const Message &response) {
+        if (response.content.size() < 4) {
+            return false;
+        }
+        const QByteArray keyword = response.content[1].toString();
+        if (keyword != "METADATA" && keyword != "ANNOTATION") {
+            return false;
+        }
+        return d->wildcard || d->encodedNames.contains(GetMetaDataJobPrivate::normalizedName(response.content[2].toString()));
+    };
 }
 
 GetMetaDataJob::~GetMetaDataJob()
@@ -64,39 +124,39 @@ static QList<QByteArray> sort(const QSet<QByteArray> &set)
 void GetMetaDataJob::doStart()
 {
     Q_D(GetMetaDataJob);
-    QByteArray parameters;
-    parameters = '\"' + KIMAP2::encodeImapFolderName(d->mailBox.toUtf8()) + "\" ";
+    //What goes before and after the mailbox name
+    QByteArray options;
+    QByteArray arguments;
 
     QByteArray command = "GETMETADATA";
     if (d->serverCapability == Annotatemore) {
         d->m_name = "GetAnnotation";
         command = "GETANNOTATION";
         if (d->entries.size() > 1) {
-            parameters += '(';
+            arguments += '(';
         }
         Q_FOREACH (const QByteArray &entry, sort(d->entries)) {
-            parameters += '\"' + entry + "\" ";
+            arguments += '\"' + entry + "\" ";
         }
         if (d->entries.size() > 1) {
-            parameters[parameters.length() - 1 ] = ')';
-            parameters += ' ';
+            arguments[arguments.length() - 1 ] = ')';
+            arguments += ' ';
         }
 
         if (d->attributes.size() > 1) {
-            parameters += '(';
+            arguments += '(';
         }
         Q_FOREACH (const QByteArray &attribute, sort(d->attributes)) {
-            parameters += '\"' + attribute + "\" ";
+            arguments += '\"' + attribute + "\" ";
         }
         if (d->attributes.size() > 1) {
-            parameters[parameters.length() - 1 ] = ')';
+            arguments[arguments.length() - 1 ] = ')';
         } else {
-            parameters.truncate(parameters.length() - 1);
+            arguments.chop(1);
         }
 
     } else {
 
-        QByteArray options;
         if (d->depth != "0") {
             options = "DEPTH " + d->depth;
         }
@@ -108,21 +168,34 @@ void GetMetaDataJob::doStart()
         }
 
         if (!options.isEmpty()) {
-            parameters = "(" + options + ") " + parameters;
+            options = "(" + options + ") ";
         }
 
         if (d->entries.size() >= 1) {
-            parameters += '(';
+            arguments += '(';
             Q_FOREACH (const QByteArray &entry, sort(d->entries)) {
-                parameters += entry + " ";
+                arguments += entry + " ";
             }
-            parameters[parameters.length() - 1 ] = ')';
-        } else {
-            parameters.truncate(parameters.length() - 1);
+            arguments[arguments.length() - 1 ] = ')';
         }
     }
 
-    d->sendCommand(command, parameters);
+    //All commands go out at once, the result comes with the last completion
+    const QStringList mailBoxes = d->mailBoxes.isEmpty() ? QStringList() << d->mailBox : d->mailBoxes;
+    d->encodedNames.clear();
+    d->wildcard = false;
+    foreach (const QString &mailBox, mailBoxes) {
+        const QByteArray name = d->sessionInternal()->encodeMailBoxName(mailBox);
+        d->encodedNames.insert(GetMetaDataJobPrivate::normalizedName(name));
+        if (mailBox.contains(QLatin1Char('*')) || mailBox.contains(QLatin1Char('%'))) {
+            d->wildcard = true;
+        }
+        QByteArray parameters = options + '\"' + name + '\"';
+        if (!arguments.isEmpty()) {
+            parameters += ' ' + arguments;
+        }
+        d->sendCommand(command, parameters);
+    }
 //  qCDebug(KIMAP2_LOG) << "SENT: " << command << " " << parameters;
 }
 
@@ -136,32 +209,42 @@ void GetMetaDataJob::handleResponse(const Message &response)
     if (handleErrorReplies(response) == NotHandled) {
         if (response.content.size() >= 4) {
             if (d->serverCapability == Annotatemore && response.content[1].toString() == "ANNOTATION") {
-                QString mailBox = QString::fromUtf8(KIMAP2::decodeImapFolderName(response.content[2].toString()));
+                const QString mailBox = d->decodedName(response.content[2].toString());
 
+                QMap<QByteArray, QByteArray> received;
                 int i = 3;
                 while (i < response.content.size() - 1) {
-                    QByteArray entry = response.content[i].toString();
+                    const QByteArray entry = response.owned(response.content[i].toString());
                     QList<QByteArray> attributes = response.content[i + 1].toList();
                     int j = 0;
                     while (j < attributes.size() - 1) {
-                        d->metadata[mailBox][entry][attributes[j]] = attributes[j + 1];
+                        const QByteArray attribute = response.owned(attributes[j]);
+                        const QByteArray value = response.owned(attributes[j + 1]);
+                        d->store(mailBox, entry, attribute, value, this);
+                        received.insert(d->addPrefix(entry, attribute), value);
                         j += 2;
                     }
                     i += 2;
                 }
+                emit metaDataReceived(mailBox, received);
             } else if (d->serverCapability == Metadata && response.content[1].toString() == "METADATA") {
-                QString mailBox = QString::fromUtf8(KIMAP2::decodeImapFolderName(response.content[2].toString()));
+                const QString mailBox = d->decodedName(response.content[2].toString());
 
+                QMap<QByteArray, QByteArray> received;
                 const QList<QByteArray> &entries = response.content[3].toList();
                 int i = 0;
                 while (i < entries.size() - 1) {
                     const QByteArray &value = entries[i + 1];
-                    QByteArray &targetValue = d->metadata[mailBox][entries[i]][""];
+                    const QByteArray entry = response.owned(entries[i]);
+                    QByteArray targetValue;
                     if (value != "NIL") {   //This just indicates no value
-                        targetValue = value;
+                        targetValue = response.owned(value);
                     }
+                    d->store(mailBox, entry, "", targetValue, this);
+                    received.insert(entry, targetValue);
                     i += 2;
                 }
+                emit metaDataReceived(mailBox, received);
             }
         }
     }
@@ -184,6 +267,18 @@ void GetMetaDataJob::addRequestedEntry(const QByteArray &entry)
     d->attributes.insert(d->getAttribute(entry));
 }
 
+void GetMetaDataJob::setMailBoxes(const QStringList &mailBoxes)
+{
+    Q_D(GetMetaDataJob);
+    d->mailBoxes = mailBoxes;
+}
+
+QStringList GetMetaDataJob::mailBoxes() const
+{
+    Q_D(const GetMetaDataJob);
+    return d->mailBoxes;
+}
+
 void GetMetaDataJob::setMaximumSize(qint64 size)
 {
     Q_D(GetMetaDataJob);
@@ -270,3 +365,36 @@ QHash<QString, QMap<QByteArray, QByteArray> > GetMetaDataJob::allMetaDataForMail
     return mailboxHash;
 }
 
+void GetMetaDataJob::setStorage(Storage storage)
+{
+    Q_D(GetMetaDataJob);
+    d->storage = storage;
+}
+
+GetMetaDataJob::Storage GetMetaDataJob::storage() const
+{
+    Q_D(const GetMetaDataJob);
+    return d->storage;
+}
+
+QVector<GetMetaDataJob::Entry> GetMetaDataJob::entries() const
+{
+    Q_D(const GetMetaDataJob);
+    if (d->storage != MapStorage) {
+        return d->flat;
+    }
+    QVector<Entry> result;
+    for (auto mailBox = d->metadata.constBegin(); mailBox != d->metadata.constEnd(); ++mailBox) {
+        for (auto entry = mailBox->constBegin(); entry != mailBox->constEnd(); ++entry) {
+            for (auto attribute = entry->constBegin(); attribute != entry->constEnd(); ++attribute) {
+                Entry flatEntry;
+                flatEntry.mailBox = mailBox.key();
+                flatEntry.entry = d->addPrefix(entry.key(), attribute.key());
+                flatEntry.attribute = attribute.key();
+                flatEntry.value = attribute.value();
+                result << flatEntry;
+            }
+        }
+    }
+    return result;
+}
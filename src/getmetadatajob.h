@@ -24,6 +24,9 @@
 
 #include "metadatajobbase.h"
 
+#include <QStringList>
+#include <QVector>
+
 namespace KIMAP2
 {
 
@@ -81,6 +84,29 @@ public:
 
     Q_DECLARE_FLAGS(Depths, Depth)
 
+    /**
+     * One metadata entry of a mailbox, see entries().
+     */
+    struct KIMAP2_EXPORT Entry {
+        // Empty for server metadata. The names of all entries of a mailbox share their data.
+        QString mailBox;
+        // METADATA style, with a /shared or /private prefix, in Annotatemore mode as well
+        QByteArray entry;
+        // Only in Annotatemore mode, e.g. "value.shared" or "content-type"
+        QByteArray attribute;
+        // Null if the server reported NIL
+        QByteArray value;
+    };
+
+    /**
+     * How the job keeps the received metadata, see setStorage().
+     */
+    enum Storage {
+        MapStorage,  /**< In maps by mailbox, entry and attribute, for metaData() and allMetaData() */
+        FlatStorage, /**< Only as a list of entries in the order they arrived, see entries() */
+        NoStorage    /**< Only passed on with resultReceived() and metaDataReceived() */
+    };
+
     /**
      * Add an entry to the query list.
      *
@@ -110,6 +136,19 @@ public:
      */
     void addRequestedEntry(const QByteArray &entry);
 
+    /**
+     * Fetches the metadata of several mailboxes at once.
+     *
+     * One command per mailbox is sent without waiting for the previous ones, and
+     * the results of all of them end up in allMetaDataForMailboxes(). Servers in
+     * Annotatemore mode also take patterns such as "*" for all mailboxes, whereas
+     * METADATA (RFC 5464) only allows names. Replaces the mailbox set with setMailBox().
+     *
+     * @param mailBoxes the mailbox names, an empty string stands for server metadata
+     */
+    void setMailBoxes(const QStringList &mailBoxes);
+    QStringList mailBoxes() const;
+
     /**
      * Limits the size of returned metadata entries.
      *
@@ -253,6 +292,40 @@ public:
      */
      QHash<QString, QMap<QByteArray, QByteArray> > allMetaDataForMailboxes() const;
 
+    /**
+     * Sets how the received metadata is kept. The default is MapStorage.
+     *
+     * With many annotated mailboxes FlatStorage needs a fraction of the memory of the maps.
+     * The accessors for the maps stay empty then. With NoStorage the metadata is only
+     * passed on as it arrives, with resultReceived().
+     *
+     * Must be called before the job is started.
+     */
+    void setStorage(Storage storage);
+    Storage storage() const;
+
+    /**
+     * All received entries.
+     *
+     * With FlatStorage they are listed in the order they arrived, with MapStorage sorted by
+     * mailbox and entry. Empty with NoStorage.
+     */
+    QVector<Entry> entries() const;
+
+Q_SIGNALS:
+    /**
+     * Emitted for each entry as it arrives, before metaDataReceived() for its response.
+     */
+    void resultReceived(const KIMAP2::GetMetaDataJob::Entry &entry);
+
+    /**
+     * Emitted for each response, with the entries it carried for @p mailBox.
+     *
+     * The entries use METADATA style names like allMetaDataForMailbox(), in
+     * Annotatemore mode as well.
+     */
+    void metaDataReceived(const QString &mailBox, const QMap<QByteArray, QByteArray> &metaData);
+
 protected:
     void doStart() Q_DECL_OVERRIDE;
     void handleResponse(const Message &response) Q_DECL_OVERRIDE;
@@ -261,4 +334,6 @@ protected:
 
 }
 
+Q_DECLARE_METATYPE(KIMAP2::GetMetaDataJob::Entry)
+
 #endif
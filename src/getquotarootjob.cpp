@@ -52,12 +52,27 @@ GetQuotaRootJob::~GetQuotaRootJob()
 void GetQuotaRootJob::doStart()
 {
     Q_D(GetQuotaRootJob);
-    d->sendCommand("GETQUOTAROOT", '\"' + KIMAP2::encodeImapFolderName(d->mailBox.toUtf8()) + '\"');
+
+    QuotaRootState cached;
+    if (d->sessionInternal()->cachedQuotaRoot(d->mailBox, &cached)) {
+        d->rootList = cached.roots;
+        d->quotas = cached.quotas;
+        emitResult();
+        return;
+    }
+
+    d->sendCommand("GETQUOTAROOT", '\"' + d->sessionInternal()->encodeMailBoxName(d->mailBox) + '\"');
 }
 
 void GetQuotaRootJob::handleResponse(const Message &response)
 {
     Q_D(GetQuotaRootJob);
+
+    if (response.content.size() >= 2 && !d->tags.isEmpty() && response.content.first().toString() == d->tags.last()
+            && response.content[1].keyword() == ImapKeyword::Ok) {
+        d->sessionInternal()->rememberQuotaRoot(d->mailBox, {d->rootList, d->quotas});
+    }
+
     if (handleErrorReplies(response) == NotHandled) {
         if (response.content.size() >= 3) {
             if (response.content[1].toString() == "QUOTAROOT") {
@@ -69,7 +84,7 @@ void GetQuotaRootJob::handleResponse(const Message &response)
                 } else {
                     int i = 3;
                     while (i < response.content.size()) {
-                        d->rootList.append(response.content[i].toString());
+                        d->rootList.append(response.owned(response.content[i].toString()));
                         i++;
                     }
                 }
@@ -80,7 +95,7 @@ void GetQuotaRootJob::handleResponse(const Message &response)
                 if (response.content.size() == 3) {
                     quotaContentIndex = 2;
                 } else {
-                    rootName = response.content[2].toString();
+                    rootName = response.owned(response.content[2].toString());
                 }
 
                 const QMap<QByteArray, QPair<qint64, qint64> > &quota = d->readQuota(response.content[quotaContentIndex]);
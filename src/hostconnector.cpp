@@ -0,0 +1,283 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "hostconnector_p.h"
+
+#include "kimap_debug.h"
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QGlobalStatic>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtNetwork/QHostInfo>
+#include <QtNetwork/QTcpSocket>
+
+using namespace KIMAP2;
+
+namespace
+{
+
+/**
+ * The addresses of the hosts the sessions connected to.
+ */
+class HostCache
+{
+public:
+    struct Entry {
+        Entry() : expiresAt(0), confirmed(false) { }
+
+        QList<QHostAddress> addresses;
+        qint64 expiresAt;
+        // The first address accepted a connection
+        bool confirmed;
+    };
+
+    HostCache()
+        : enabled(false),
+          timeout(300)
+    {
+        clock.start();
+    }
+
+    QMutex mutex;
+    bool enabled;
+    int timeout;
+    QElapsedTimer clock;
+    QHash<QString, Entry> entries;
+};
+
+// RFC 8305 recommends 250 ms between the attempts
+static const int attemptDelay = 250;
+
+}
+
+Q_GLOBAL_STATIC(HostCache, hostCache)
+
+/*
+ * Alternates between the address families, starting with the family of the first address.
+ */
+static QList<QHostAddress> interleaved(const QList<QHostAddress> &addresses)
+{
+    if (addresses.isEmpty()) {
+        return addresses;
+    }
+    const QAbstractSocket::NetworkLayerProtocol first = addresses.first().protocol();
+    QList<QHostAddress> preferred;
+    QList<QHostAddress> other;
+    for (const QHostAddress &address : addresses) {
+        (address.protocol() == first ? preferred : other) << address;
+    }
+    QList<QHostAddress> result;
+    while (!preferred.isEmpty() || !other.isEmpty()) {
+        if (!preferred.isEmpty()) {
+            result << preferred.takeFirst();
+        }
+        if (!other.isEmpty()) {
+            result << other.takeFirst();
+        }
+    }
+    return result;
+}
+
+HostConnector::HostConnector(QObject *parent)
+    : QObject(parent),
+      m_port(0),
+      m_lookupId(-1),
+      m_running(false),
+      m_attemptTimer(this)
+{
+    m_attemptTimer.setSingleShot(true);
+    connect(&m_attemptTimer, &QTimer::timeout, this, &HostConnector::startAttempt);
+}
+
+HostConnector::~HostConnector()
+{
+    abort();
+}
+
+void HostConnector::setEnabled(bool enabled)
+{
+    QMutexLocker locker(&hostCache->mutex);
+    hostCache->enabled = enabled;
+    if (!enabled) {
+        hostCache->entries.clear();
+    }
+}
+
+bool HostConnector::isEnabled()
+{
+    QMutexLocker locker(&hostCache->mutex);
+    return hostCache->enabled;
+}
+
+void HostConnector::setCacheTimeout(int seconds)
+{
+    QMutexLocker locker(&hostCache->mutex);
+    hostCache->timeout = qMax(0, seconds);
+    hostCache->entries.clear();
+}
+
+int HostConnector::cacheTimeout()
+{
+    QMutexLocker locker(&hostCache->mutex);
+    return hostCache->timeout;
+}
+
+void HostConnector::forget(const QString &hostName)
+{
+    QMutexLocker locker(&hostCache->mutex);
+    hostCache->entries.remove(hostName);
+}
+
+void HostConnector::start(const QString &hostName, quint16 port)
+{
+    abort();
+    m_hostName = hostName;
+    m_port = port;
+    m_running = true;
+
+    HostCache::Entry entry;
+    {
+        QMutexLocker locker(&hostCache->mutex);
+        const auto it = hostCache->entries.constFind(hostName);
+        if (it != hostCache->entries.constEnd() && it->expiresAt > hostCache->clock.elapsed()) {
+            entry = *it;
+        }
+    }
+    if (entry.confirmed) {
+        finish(entry.addresses.first());
+    } else if (!entry.addresses.isEmpty()) {
+        race(entry.addresses);
+    } else {
+        m_lookupId = QHostInfo::lookupHost(hostName, this, SLOT(hostFound(QHostInfo)));
+    }
+}
+
+void HostConnector::abort()
+{
+    if (m_lookupId != -1) {
+        QHostInfo::abortHostLookup(m_lookupId);
+        m_lookupId = -1;
+    }
+    stopProbes();
+    m_pending.clear();
+    m_running = false;
+}
+
+bool HostConnector::isRunning() const
+{
+    return m_running;
+}
+
+void HostConnector::hostFound(const QHostInfo &info)
+{
+    m_lookupId = -1;
+    if (info.error() != QHostInfo::NoError || info.addresses().isEmpty()) {
+        qCDebug(KIMAP2_LOG) << "Host lookup failed:" << info.errorString();
+        finish(QHostAddress());
+        return;
+    }
+    {
+        QMutexLocker locker(&hostCache->mutex);
+        if (hostCache->timeout) {
+            HostCache::Entry entry;
+            entry.addresses = info.addresses();
+            entry.expiresAt = hostCache->clock.elapsed() + hostCache->timeout * 1000;
+            hostCache->entries.insert(m_hostName, entry);
+        }
+    }
+    race(info.addresses());
+}
+
+void HostConnector::race(const QList<QHostAddress> &addresses)
+{
+    if (addresses.size() == 1) {
+        //Nothing to race against, the session reports if it fails
+        finish(addresses.first());
+        return;
+    }
+    m_pending = interleaved(addresses);
+    startAttempt();
+}
+
+void HostConnector::startAttempt()
+{
+    if (m_pending.isEmpty()) {
+        //Waits for the attempts in flight
+        return;
+    }
+    const QHostAddress address = m_pending.takeFirst();
+    qCDebug(KIMAP2_LOG) << "Trying" << address.toString();
+    QTcpSocket *probe = new QTcpSocket(this);
+    m_probes << probe;
+    connect(probe, &QTcpSocket::connected, this, [this, address]() {
+        finish(address);
+    });
+    connect(probe, static_cast<void (QTcpSocket::*)(QAbstractSocket::SocketError)>(&QTcpSocket::error), this, [this, probe]() {
+        attemptFailed(probe);
+    });
+    if (!m_pending.isEmpty()) {
+        m_attemptTimer.start(attemptDelay);
+    }
+    probe->connectToHost(address, m_port);
+}
+
+void HostConnector::attemptFailed(QTcpSocket *probe)
+{
+    if (!m_probes.removeOne(probe)) {
+        return;
+    }
+    qCDebug(KIMAP2_LOG) << "Connecting to" << probe->peerName() << "failed:" << probe->errorString();
+    probe->disconnect(this);
+    probe->deleteLater();
+    if (!m_pending.isEmpty()) {
+        //No need to wait for the delay
+        m_attemptTimer.stop();
+        startAttempt();
+    } else if (m_probes.isEmpty()) {
+        forget(m_hostName);
+        finish(QHostAddress());
+    }
+}
+
+void HostConnector::finish(const QHostAddress &address)
+{
+    stopProbes();
+    m_pending.clear();
+    m_running = false;
+    if (!address.isNull()) {
+        QMutexLocker locker(&hostCache->mutex);
+        const auto it = hostCache->entries.find(m_hostName);
+        if (it != hostCache->entries.end() && it->addresses.contains(address)) {
+            it->addresses.removeOne(address);
+            it->addresses.prepend(address);
+            it->confirmed = true;
+        }
+    }
+    emit finished(address);
+}
+
+void HostConnector::stopProbes()
+{
+    m_attemptTimer.stop();
+    for (QTcpSocket *probe : m_probes) {
+        probe->disconnect(this);
+        probe->abort();
+        probe->deleteLater();
+    }
+    m_probes.clear();
+}
@@ -0,0 +1,92 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_HOSTCONNECTOR_P_H
+#define KIMAP2_HOSTCONNECTOR_P_H
+
+#include <QtCore/QList>
+#include <QtCore/QObject>
+#include <QtCore/QTimer>
+#include <QtNetwork/QHostAddress>
+
+class QHostInfo;
+class QTcpSocket;
+
+namespace KIMAP2
+{
+
+/**
+ * Finds the address of a host that accepts connections, see Session::setConnectionRacingEnabled().
+ *
+ * The addresses are looked up once for all sessions and kept for Session::hostLookupCacheTimeout().
+ * If there are several, they are raced as in RFC 8305 (Happy Eyeballs): alternating between
+ * IPv6 and IPv4, another attempt starts every 250 ms until one of them connects. The address
+ * that won is tried first from then on, without racing.
+ */
+class HostConnector : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit HostConnector(QObject *parent = Q_NULLPTR);
+    ~HostConnector();
+
+    static void setEnabled(bool enabled);
+    static bool isEnabled();
+    static void setCacheTimeout(int seconds);
+    static int cacheTimeout();
+
+    /**
+     * Drops what is known about @p hostName, e.g. when connecting to the address that was
+     * found failed after all.
+     */
+    static void forget(const QString &hostName);
+
+    void start(const QString &hostName, quint16 port);
+    void abort();
+    bool isRunning() const;
+
+Q_SIGNALS:
+    /**
+     * Emitted with the address to connect to, or a null address if none could be reached.
+     * The host name should then be connected to as usual, so that the error is reported.
+     */
+    void finished(const QHostAddress &address);
+
+private Q_SLOTS:
+    void hostFound(const QHostInfo &info);
+    void startAttempt();
+
+private:
+    void race(const QList<QHostAddress> &addresses);
+    void attemptFailed(QTcpSocket *probe);
+    void finish(const QHostAddress &address);
+    void stopProbes();
+
+    QString m_hostName;
+    quint16 m_port;
+    int m_lookupId;
+    bool m_running;
+    // Not tried yet, in the order of the attempts
+    QList<QHostAddress> m_pending;
+    QList<QTcpSocket *> m_probes;
+    QTimer m_attemptTimer;
+};
+
+}
+
+#endif
@@ -19,8 +19,10 @@
 
 #include "idlejob.h"
 
+#include <QtCore/QPointer>
 #include <QtCore/QTimer>
 
+#include "imapset.h"
 #include "job_p.h"
 #include "message_p.h"
 #include "session_p.h"
@@ -34,9 +36,43 @@ public:
         : JobPrivate(session, name), q(job),
           messageCount(-1), recentCount(-1),
           lastMessageCount(-1), lastRecentCount(-1),
-          originalSocketTimeout(-1) { }
+          originalSocketTimeout(-1), statsDelay(200), expectRecent(true), renewInterval(0),
+          polling(false), idling(false), renewing(false), stopRequested(false) { }
     ~IdleJobPrivate() { }
 
+    void startRenewTimer()
+    {
+        if (renewInterval > 0) {
+            //The timer lives on the thread of the job, which is not necessarily ours
+            QMetaObject::invokeMethod(&renewTimer, "start", Q_ARG(int, renewInterval * 1000));
+        }
+    }
+
+    void renew()
+    {
+        QPointer<IdleJob> guard(q);
+        sessionInternal()->callInSessionThread([this, guard]() {
+            if (!guard || stopRequested) {
+                return;
+            }
+            if (polling) {
+                sendCommand("NOOP", {});
+            } else if (idling) {
+                //The server has to answer in time, or the connection is gone
+                idling = false;
+                renewing = true;
+                sessionInternal()->setSocketTimeout(originalSocketTimeout);
+                sessionInternal()->sendData("DONE");
+            }
+        });
+    }
+
+    void sendIdle()
+    {
+        sessionInternal()->setSocketTimeout(-1);
+        sendCommand("IDLE", {});
+    }
+
     void emitStats()
     {
         emitStatsTimer.stop();
@@ -51,8 +87,27 @@ public:
         recentCount = -1;
     }
 
+    void statsTimedOut()
+    {
+        if (messageCount >= 0 && recentCount < 0) {
+            //The server does not pair EXISTS with RECENT, so there is nothing to wait for next time
+            expectRecent = false;
+        }
+        emitStats();
+    }
+
+    void emitMessageCounts()
+    {
+        messageCountsTimer.stop();
+        if (!pendingMessageCounts.isEmpty()) {
+            emit q->messageCountsChanged(q, m_session->selectedMailBox(), pendingMessageCounts);
+            pendingMessageCounts.clear();
+        }
+    }
+
     void resetTimeout()
     {
+        renewTimer.stop();
         sessionInternal()->setSocketTimeout(originalSocketTimeout);
     }
 
@@ -67,6 +122,18 @@ public:
     int lastRecentCount;
 
     int originalSocketTimeout;
+
+    int statsDelay;
+    bool expectRecent;
+    QTimer messageCountsTimer;
+    QList<int> pendingMessageCounts;
+
+    QTimer renewTimer;
+    int renewInterval;
+    bool polling;
+    bool idling;
+    bool renewing;
+    bool stopRequested;
 };
 }
 
@@ -76,11 +143,19 @@ IdleJob::IdleJob(Session *session)
     : Job(*new IdleJobPrivate(this, session, "Idle"))
 {
     Q_D(IdleJob);
+    d->emitStatsTimer.setSingleShot(true);
     connect(&d->emitStatsTimer, SIGNAL(timeout()),
-            this, SLOT(emitStats()));
+            this, SLOT(statsTimedOut()));
+    d->messageCountsTimer.setSingleShot(true);
+    connect(&d->messageCountsTimer, SIGNAL(timeout()),
+            this, SLOT(emitMessageCounts()));
 
     connect(this, SIGNAL(result(KJob*)),
             this, SLOT(resetTimeout()));
+
+    d->renewTimer.setSingleShot(true);
+    connect(&d->renewTimer, SIGNAL(timeout()),
+            this, SLOT(renew()));
 }
 
 IdleJob::~IdleJob()
@@ -90,16 +165,68 @@ IdleJob::~IdleJob()
 void KIMAP2::IdleJob::stop()
 {
     Q_D(IdleJob);
-    d->sessionInternal()->setSocketTimeout(d->originalSocketTimeout);
-    d->sessionInternal()->sendData("DONE");
+    d->renewTimer.stop();
+    QPointer<IdleJob> guard(this);
+    d->sessionInternal()->callInSessionThread([d, guard]() {
+        if (!guard || d->stopRequested) {
+            return;
+        }
+        d->stopRequested = true;
+        d->sessionInternal()->setSocketTimeout(d->originalSocketTimeout);
+        if (d->polling) {
+            if (d->tags.isEmpty()) {
+                //Waiting for the next NOOP
+                guard->emitResult();
+            }
+        } else if (d->idling) {
+            //Otherwise DONE follows the continuation, or was already sent to renew
+            d->idling = false;
+            d->sessionInternal()->sendData("DONE");
+        }
+    });
+}
+
+void IdleJob::setRenewInterval(int seconds)
+{
+    Q_D(IdleJob);
+    d->renewInterval = seconds;
+}
+
+int IdleJob::renewInterval() const
+{
+    Q_D(const IdleJob);
+    return d->renewInterval;
+}
+
+void IdleJob::setStatsDelay(int msecs)
+{
+    Q_D(IdleJob);
+    d->statsDelay = msecs;
+}
+
+int IdleJob::statsDelay() const
+{
+    Q_D(const IdleJob);
+    return d->statsDelay;
 }
 
 void IdleJob::doStart()
 {
     Q_D(IdleJob);
     d->originalSocketTimeout = d->sessionInternal()->socketTimeout();
-    d->sessionInternal()->setSocketTimeout(-1);
-    d->sendCommand("IDLE", {});
+    //Without knowing the capabilities we try IDLE anyway
+    const QStringList capabilities = d->m_session->capabilities();
+    d->polling = d->renewInterval > 0 && !capabilities.isEmpty()
+                 && !capabilities.contains(QStringLiteral("IDLE"), Qt::CaseInsensitive);
+    //IMAP4rev2 (RFC 9051) dropped RECENT
+    if (d->sessionInternal()->isImap4Rev2()) {
+        d->expectRecent = false;
+    }
+    if (d->polling) {
+        d->sendCommand("NOOP", {});
+    } else {
+        d->sendIdle();
+    }
 }
 
 void IdleJob::handleResponse(const Message &response)
@@ -112,38 +239,101 @@ void IdleJob::handleResponse(const Message &response)
     if (!response.content.isEmpty() &&
             d->tags.size() == 1 &&
             d->tags.contains(response.content.first().toString()) &&
-            (d->messageCount >= 0 || d->recentCount >= 0)) {
-        d->emitStats();
+            (d->messageCount >= 0 || d->recentCount >= 0 || !d->pendingMessageCounts.isEmpty())) {
+        if (d->messageCount >= 0 || d->recentCount >= 0) {
+            d->emitStats();
+        }
+        d->emitMessageCounts();
+    }
+
+    if (!response.content.isEmpty() && d->tags.contains(response.content.first().toString())
+            && response.content.size() >= 2 && response.content[1].keyword() == ImapKeyword::Ok
+            && (d->polling || d->renewing) && !d->stopRequested) {
+        //The job goes on, with the next NOOP or a new IDLE
+        d->tags.removeAll(response.content.first().toString());
+        if (d->polling) {
+            d->startRenewTimer();
+        } else {
+            d->renewing = false;
+            d->sendIdle();
+        }
+        return;
+    }
+
+    if (!response.content.isEmpty() && d->tags.contains(response.content.first().toString())) {
+        //Nothing is renewed once the job is done
+        d->stopRequested = true;
+        d->idling = false;
     }
 
     if (handleErrorReplies(response) == NotHandled) {
+        ImapSet vanishedUids;
+        if (JobPrivate::parseVanished(response, &vanishedUids)) {
+            Q_EMIT mailBoxMessagesVanished(this, vanishedUids);
+            return;
+        }
         if (response.content.size() > 0 && response.content[0].toString() == "+") {
             // Got the continuation all is fine
+            d->idling = true;
+            if (d->stopRequested) {
+                d->idling = false;
+                d->sessionInternal()->sendData("DONE");
+            } else {
+                d->startRenewTimer();
+            }
             return;
 
         } else if (response.content.size() > 2) {
-            if (response.content[2].toString() == "EXISTS") {
+            const ImapKeyword code = response.content[2].keyword();
+            if (code == ImapKeyword::Exists) {
                 if (d->messageCount >= 0) {
                     d->emitStats();
                 }
 
                 d->messageCount = response.content[1].toString().toInt();
-            } else if (response.content[2].toString() == "RECENT") {
+                d->pendingMessageCounts << d->messageCount;
+                if (d->statsDelay <= 0) {
+                    d->emitMessageCounts();
+                } else {
+                    //Restarted with every EXISTS, so a burst is delivered at once
+                    QMetaObject::invokeMethod(&d->messageCountsTimer, "start", Q_ARG(int, d->statsDelay));
+                }
+            } else if (code == ImapKeyword::Recent) {
+                d->expectRecent = true;
                 if (d->recentCount >= 0) {
                     d->emitStats();
                 }
 
                 d->recentCount = response.content[1].toString().toInt();
-            } else if (response.content[2].toString() == "FETCH") {
-                const qint64 uid = response.content[1].toString().toLongLong();
-                Q_EMIT mailBoxMessageFlagsChanged(this, uid);
+            } else if (code == ImapKeyword::Expunge) {
+                const qint64 sequenceNumber = response.content[1].toString().toLongLong();
+                //The session already removed it from its map
+                const qint64 uid = d->sessionInternal()->sequenceMap.expungedUid;
+                Q_EMIT messageExpunged(this, sequenceNumber);
+                if (uid) {
+                    Q_EMIT messageUidExpunged(this, sequenceNumber, uid);
+                }
+            } else if (code == ImapKeyword::Fetch || code == ImapKeyword::UidFetch) {
+                if (code == ImapKeyword::Fetch) {
+                    Q_EMIT mailBoxMessageFlagsChanged(this, response.content[1].toString().toLongLong());
+                }
+                JobPrivate::MessageUpdate update;
+                if (JobPrivate::parseMessageUpdate(response, &update)) {
+                    if (!update.uid && update.sequenceNumber) {
+                        update.uid = m_session->uidForSequenceNumber(update.sequenceNumber);
+                    }
+                    Q_EMIT messageFlagsChanged(this, update.sequenceNumber, update.uid, update.flags, update.modSeq);
+                }
             }
         }
 
         if (d->messageCount >= 0 && d->recentCount >= 0) {
             d->emitStats();
+        } else if ((d->messageCount >= 0 && !d->expectRecent) || ((d->messageCount >= 0 || d->recentCount >= 0) && d->statsDelay <= 0)) {
+            d->emitStats();
         } else if (d->messageCount >= 0 || d->recentCount >= 0) {
-            d->emitStatsTimer.start(200);
+            //The timer lives on the thread of the job, which is not necessarily ours
+            QMetaObject::invokeMethod(&d->emitStatsTimer, "start", Q_ARG(int, d->statsDelay));
         }
     }
 }
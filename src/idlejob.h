@@ -25,8 +25,10 @@
 #include "imapset.h"
 #include "job.h"
 
+#ifndef KIMAP2_NO_KMIME
 #include <kmime/kmime_content.h>
 #include <kmime/kmime_message.h>
+#endif
 
 namespace KIMAP2
 {
@@ -42,10 +44,9 @@ class IdleJobPrivate;
  * for the connection, and the server will send updates
  * about the selected mailbox.
  *
- * Note that although the server may send a variety of
- * responses while the job is running (including EXPUNGE,
- * for example), only RECENT and EXISTS responses are
- * actually reported by this job.
+ * RECENT and EXISTS responses are reported with mailBoxStats(),
+ * flag changes and expunges with messageFlagsChanged(),
+ * messageExpunged() and mailBoxMessagesVanished().
  *
  * The job also processes updates in pairs - if the server
  * sends an EXISTS update but not a RECENT one (because
@@ -100,6 +101,36 @@ public:
      */
     int lastRecentCount() const;
 
+    /**
+     * Renews the idle command every @p seconds by ending it with DONE and
+     * sending IDLE again, without finishing the job.
+     *
+     * Servers and NAT routers may silently drop connections that did not carry
+     * any traffic for a while (RFC 2177 recommends renewing at least every 29 minutes).
+     * While the server answers DONE, the session timeout applies again, so a dead
+     * connection is noticed within the timeout after each renewal.
+     *
+     * If the server does not support IDLE, the job sends a NOOP every @p seconds
+     * instead and reports the changes the server sends with its responses.
+     *
+     * The default of 0 idles until the job is stopped, and always uses IDLE.
+     */
+    void setRenewInterval(int seconds);
+    int renewInterval() const;
+
+    /**
+     * Sets how long to wait for the RECENT response that goes with an EXISTS
+     * response, or the other way around, before mailBoxStats() is emitted
+     * with only one of them. This is also the window in which messageCountsChanged()
+     * collects EXISTS responses. The default is 200 ms, 0 emits right away.
+     *
+     * Once the server is known not to send RECENT, because it only implements
+     * IMAP4rev2 or did not send it after the last EXISTS, EXISTS is reported
+     * without waiting.
+     */
+    void setStatsDelay(int msecs);
+    int statsDelay() const;
+
 public Q_SLOTS:
     /**
      * Stops the idle job.
@@ -118,23 +149,82 @@ Q_SIGNALS:
      */
     void mailBoxStats(KIMAP2::IdleJob *job, const QString &mailBox, int messageCount, int recentCount);
 
+    /**
+     * Signals all message counts the server reported since the last time
+     * this signal was emitted, once no new one arrived for statsDelay().
+     *
+     * @param job           this object
+     * @param mailBox       the selected mailbox
+     * @param messageCounts the message counts, in the order EXISTS reported them
+     */
+    void messageCountsChanged(KIMAP2::IdleJob *job, const QString &mailBox, const QList<int> &messageCounts);
+
     /**
      * Signals that the server has notified that the some messages flags
      * have changed
      *
+     * Not emitted once UIDONLY (RFC 9586) is enabled, see messageFlagsChanged().
+     *
      * @param job this object
-     * @param uid UID of message that has changed
+     * @param uid the sequence number of the message that has changed, despite its name;
+     *            messageFlagsChanged() has the UID and the flags
      * @since 4.12
      */
     void mailBoxMessageFlagsChanged(KIMAP2::IdleJob *job, qint64 uid);
 
+    /**
+     * Signals that the flags of a message changed, with everything the
+     * server sent about it, so that it does not need to be fetched again.
+     *
+     * @param job this object
+     * @param sequenceNumber the sequence number of the message, 0 once UIDONLY (RFC 9586) is enabled
+     * @param uid the UID of the message, or 0 if neither the server sent it
+     *            nor the UID map of the session knows it (see Session::setUidMapEnabled())
+     * @param flags the flags the message has now
+     * @param modSeq the new mod-sequence of the message (RFC 7162), or 0 if the server did not send it
+     */
+    void messageFlagsChanged(KIMAP2::IdleJob *job, qint64 sequenceNumber, qint64 uid,
+                             const QList<QByteArray> &flags, quint64 modSeq);
+
+    /**
+     * Signals that the server has notified that a message was expunged.
+     *
+     * The sequence numbers of the messages after it decrease by one.
+     *
+     * @param job this object
+     * @param sequenceNumber the sequence number the message had
+     */
+    void messageExpunged(KIMAP2::IdleJob *job, qint64 sequenceNumber);
+
+    /**
+     * Signals the UID of a message that messageExpunged() reported, right after it,
+     * if the UID map of the session knew it (see Session::setUidMapEnabled()).
+     *
+     * @param job this object
+     * @param sequenceNumber the sequence number the message had
+     * @param uid the UID of the message
+     */
+    void messageUidExpunged(KIMAP2::IdleJob *job, qint64 sequenceNumber, qint64 uid);
+
+    /**
+     * Signals that the server has notified that messages were expunged,
+     * with a VANISHED response instead of EXPUNGE once QRESYNC (RFC 7162)
+     * or UIDONLY (RFC 9586) is enabled.
+     *
+     * @param job this object
+     * @param uids the UIDs of the expunged messages
+     */
+    void mailBoxMessagesVanished(KIMAP2::IdleJob *job, const KIMAP2::ImapSet &uids);
+
 protected:
     void doStart() Q_DECL_OVERRIDE;
     void handleResponse(const Message &response) Q_DECL_OVERRIDE;
 
 private:
-    Q_PRIVATE_SLOT(d_func(), void emitStats())
+    Q_PRIVATE_SLOT(d_func(), void statsTimedOut())
+    Q_PRIVATE_SLOT(d_func(), void emitMessageCounts())
     Q_PRIVATE_SLOT(d_func(), void resetTimeout())
+    Q_PRIVATE_SLOT(d_func(), void renew())
 };
 
 }
@@ -0,0 +1,466 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "imapbitmap.h"
+
+#include <QtCore/QSharedData>
+#include <QtCore/QtAlgorithms>
+#include <QtCore/QVector>
+
+#include <algorithm>
+#include <iterator>
+
+using namespace KIMAP2;
+
+// The largest IMAP number
+static const ImapBitmap::Id maxValue = Q_INT64_C(0xFFFFFFFF);
+// A dense block has a bit for each of its 65536 values
+static const int wordCount = 1024;
+// Above this a bitmap is smaller than the sorted array
+static const int arrayLimit = 4096;
+
+namespace
+{
+
+/**
+ * The values sharing their upper 16 bits.
+ * Holds a sorted array of the lower 16 bits while count <= arrayLimit and a bitmap otherwise.
+ */
+struct Block {
+    Block() : key(0), count(0) {}
+
+    quint16 key;
+    int count;
+    QVector<quint16> values;
+    QVector<quint64> words;
+
+    bool isDense() const
+    {
+        return !words.isEmpty();
+    }
+
+    bool operator==(const Block &other) const
+    {
+        return key == other.key && count == other.count && values == other.values && words == other.words;
+    }
+};
+
+enum Operation {
+    Union,
+    Intersection,
+    Difference
+};
+
+}
+
+class ImapBitmap::Private : public QSharedData
+{
+public:
+    Private() : QSharedData() {}
+    Private(const Private &other) :
+        QSharedData(other)
+    {
+        blocks = other.blocks;
+    }
+
+    // The non-empty blocks sorted by key
+    QVector<Block> blocks;
+};
+
+static bool blockBefore(const Block &block, quint16 key)
+{
+    return block.key < key;
+}
+
+static bool hasBit(const QVector<quint64> &words, quint16 value)
+{
+    return words.at(value >> 6) & (Q_UINT64_C(1) << (value & 63));
+}
+
+static QVector<quint64> toWords(const Block &block)
+{
+    if (block.isDense()) {
+        return block.words;
+    }
+    QVector<quint64> words(wordCount, 0);
+    foreach (quint16 value, block.values) {
+        words[value >> 6] |= Q_UINT64_C(1) << (value & 63);
+    }
+    return words;
+}
+
+/**
+ * Sets the content of @p block to the values in @p words, choosing the smaller representation.
+ */
+static void setWords(Block &block, const QVector<quint64> &words)
+{
+    int count = 0;
+    foreach (quint64 word, words) {
+        count += qPopulationCount(word);
+    }
+    block.count = count;
+    if (count > arrayLimit) {
+        block.words = words;
+        block.values.clear();
+        return;
+    }
+    block.words.clear();
+    block.values.clear();
+    block.values.reserve(count);
+    for (int i = 0; i < wordCount; ++i) {
+        quint64 word = words.at(i);
+        for (int bit = 0; word; ++bit, word >>= 1) {
+            if (word & 1) {
+                block.values.append(quint16(i * 64 + bit));
+            }
+        }
+    }
+}
+
+static void setValues(Block &block, const QVector<quint16> &values)
+{
+    block.count = values.size();
+    block.values = values;
+    block.words.clear();
+    if (block.count > arrayLimit) {
+        block.words = toWords(block);
+        block.values.clear();
+    }
+}
+
+static void addToBlock(Block &block, quint16 begin, quint16 end)
+{
+    const int size = end - begin + 1;
+    if (block.isDense() || block.count + size > arrayLimit) {
+        QVector<quint64> words = toWords(block);
+        for (int value = begin; value <= end;) {
+            if ((value & 63) == 0 && value + 63 <= end) {
+                words[value >> 6] = ~Q_UINT64_C(0);
+                value += 64;
+            } else {
+                words[value >> 6] |= Q_UINT64_C(1) << (value & 63);
+                ++value;
+            }
+        }
+        setWords(block, words);
+        return;
+    }
+    if (size == 1) {
+        QVector<quint16>::iterator it = std::lower_bound(block.values.begin(), block.values.end(), begin);
+        if (it == block.values.end() || *it != begin) {
+            block.values.insert(it, begin);
+            ++block.count;
+        }
+        return;
+    }
+    QVector<quint16> range;
+    range.reserve(size);
+    for (int value = begin; value <= end; ++value) {
+        range.append(quint16(value));
+    }
+    QVector<quint16> values;
+    values.reserve(block.count + size);
+    std::set_union(block.values.constBegin(), block.values.constEnd(), range.constBegin(), range.constEnd(),
+                   std::back_inserter(values));
+    setValues(block, values);
+}
+
+static bool blockContains(const Block &block, quint16 value)
+{
+    if (block.isDense()) {
+        return hasBit(block.words, value);
+    }
+    return std::binary_search(block.values.constBegin(), block.values.constEnd(), value);
+}
+
+/**
+ * Returns the values of @p block that are (or with @p keep false, are not) in the dense block @p filter.
+ */
+static Block filtered(const Block &block, const Block &filter, bool keep)
+{
+    Block result;
+    result.key = block.key;
+    QVector<quint16> values;
+    values.reserve(block.count);
+    foreach (quint16 value, block.values) {
+        if (hasBit(filter.words, value) == keep) {
+            values.append(value);
+        }
+    }
+    setValues(result, values);
+    return result;
+}
+
+static Block combined(const Block &a, const Block &b, Operation operation)
+{
+    Block result;
+    result.key = a.key;
+    if (!a.isDense() && !b.isDense()) {
+        QVector<quint16> values;
+        values.reserve(operation == Union ? a.count + b.count : a.count);
+        switch (operation) {
+        case Union:
+            std::set_union(a.values.constBegin(), a.values.constEnd(), b.values.constBegin(), b.values.constEnd(),
+                           std::back_inserter(values));
+            break;
+        case Intersection:
+            std::set_intersection(a.values.constBegin(), a.values.constEnd(), b.values.constBegin(), b.values.constEnd(),
+                                  std::back_inserter(values));
+            break;
+        case Difference:
+            std::set_difference(a.values.constBegin(), a.values.constEnd(), b.values.constBegin(), b.values.constEnd(),
+                                std::back_inserter(values));
+            break;
+        }
+        setValues(result, values);
+        return result;
+    }
+
+    // A sparse block only needs a lookup per value in the dense one
+    if (operation == Intersection && !a.isDense()) {
+        return filtered(a, b, true);
+    }
+    if (operation == Intersection && !b.isDense()) {
+        return filtered(b, a, true);
+    }
+    if (operation == Difference && !a.isDense()) {
+        return filtered(a, b, false);
+    }
+
+    QVector<quint64> words = toWords(a);
+    const QVector<quint64> otherWords = toWords(b);
+    for (int i = 0; i < wordCount; ++i) {
+        switch (operation) {
+        case Union:
+            words[i] |= otherWords.at(i);
+            break;
+        case Intersection:
+            words[i] &= otherWords.at(i);
+            break;
+        case Difference:
+            words[i] &= ~otherWords.at(i);
+            break;
+        }
+    }
+    setWords(result, words);
+    return result;
+}
+
+/**
+ * Merges the blocks of @p a and @p b by key, combining those with the same key.
+ */
+static QVector<Block> combined(const QVector<Block> &a, const QVector<Block> &b, Operation operation)
+{
+    QVector<Block> result;
+    result.reserve(operation == Union ? a.size() + b.size() : a.size());
+    int i = 0;
+    int j = 0;
+    while (i < a.size() || j < b.size()) {
+        if (j >= b.size() || (i < a.size() && a.at(i).key < b.at(j).key)) {
+            if (operation != Intersection) {
+                result.append(a.at(i));
+            }
+            ++i;
+        } else if (i >= a.size() || b.at(j).key < a.at(i).key) {
+            if (operation == Union) {
+                result.append(b.at(j));
+            }
+            ++j;
+        } else {
+            const Block block = combined(a.at(i), b.at(j), operation);
+            if (block.count) {
+                result.append(block);
+            }
+            ++i;
+            ++j;
+        }
+    }
+    return result;
+}
+
+ImapBitmap::ImapBitmap() :
+    d(new Private)
+{
+}
+
+ImapBitmap::ImapBitmap(const ImapBitmap &other) :
+    d(other.d)
+{
+}
+
+ImapBitmap::~ImapBitmap()
+{
+}
+
+ImapBitmap &ImapBitmap::operator=(const ImapBitmap &other)
+{
+    if (this != &other) {
+        d = other.d;
+    }
+    return *this;
+}
+
+bool ImapBitmap::operator==(const ImapBitmap &other) const
+{
+    // Each block always has the smaller representation, so equal sets store the same
+    return d == other.d || d->blocks == other.d->blocks;
+}
+
+void ImapBitmap::add(Id value)
+{
+    add(value, value);
+}
+
+void ImapBitmap::add(Id begin, Id end)
+{
+    //0 would end up in the first block, where it can't be told apart from a real UID
+    begin = qMax<Id>(begin, 1);
+    end = qMin(end, maxValue);
+    if (begin > end) {
+        return;
+    }
+    const quint16 firstKey = quint16(begin >> 16);
+    const quint16 lastKey = quint16(end >> 16);
+    QVector<Block> &blocks = d->blocks;
+    QVector<Block>::iterator it = std::lower_bound(blocks.begin(), blocks.end(), firstKey, blockBefore);
+    for (int key = firstKey; key <= lastKey; ++key, ++it) {
+        if (it == blocks.end() || it->key != key) {
+            Block block;
+            block.key = quint16(key);
+            it = blocks.insert(it, block);
+        }
+        addToBlock(*it, key == firstKey ? quint16(begin & 0xFFFF) : 0, key == lastKey ? quint16(end & 0xFFFF) : 0xFFFF);
+    }
+}
+
+void ImapBitmap::remove(Id value)
+{
+    if (!contains(value)) {
+        return;
+    }
+    const quint16 low = quint16(value & 0xFFFF);
+    QVector<Block> &blocks = d->blocks;
+    QVector<Block>::iterator it = std::lower_bound(blocks.begin(), blocks.end(), quint16(value >> 16), blockBefore);
+    if (it->count == 1) {
+        blocks.erase(it);
+    } else if (it->isDense()) {
+        QVector<quint64> words = it->words;
+        words[low >> 6] &= ~(Q_UINT64_C(1) << (low & 63));
+        setWords(*it, words);
+    } else {
+        it->values.erase(std::lower_bound(it->values.begin(), it->values.end(), low));
+        --it->count;
+    }
+}
+
+bool ImapBitmap::contains(Id value) const
+{
+    if (value < 1 || value > maxValue) {
+        return false;
+    }
+    const quint16 key = quint16(value >> 16);
+    const QVector<Block> &blocks = d->blocks;
+    const QVector<Block>::const_iterator it = std::lower_bound(blocks.constBegin(), blocks.constEnd(), key, blockBefore);
+    return it != blocks.constEnd() && it->key == key && blockContains(*it, quint16(value & 0xFFFF));
+}
+
+ImapBitmap::Id ImapBitmap::count() const
+{
+    Id count = 0;
+    foreach (const Block &block, d->blocks) {
+        count += block.count;
+    }
+    return count;
+}
+
+bool ImapBitmap::isEmpty() const
+{
+    return d->blocks.isEmpty();
+}
+
+ImapBitmap ImapBitmap::united(const ImapBitmap &other) const
+{
+    ImapBitmap result;
+    result.d->blocks = combined(d->blocks, other.d->blocks, Union);
+    return result;
+}
+
+ImapBitmap ImapBitmap::intersected(const ImapBitmap &other) const
+{
+    ImapBitmap result;
+    result.d->blocks = combined(d->blocks, other.d->blocks, Intersection);
+    return result;
+}
+
+ImapBitmap ImapBitmap::subtracted(const ImapBitmap &other) const
+{
+    ImapBitmap result;
+    result.d->blocks = combined(d->blocks, other.d->blocks, Difference);
+    return result;
+}
+
+ImapSet ImapBitmap::toImapSet() const
+{
+    ImapSetBuilder builder;
+    foreach (const Block &block, d->blocks) {
+        const Id base = Id(block.key) << 16;
+        if (!block.isDense()) {
+            foreach (quint16 value, block.values) {
+                builder.add(base + value);
+            }
+            continue;
+        }
+        for (int i = 0; i < wordCount; ++i) {
+            quint64 word = block.words.at(i);
+            const Id first = base + i * 64;
+            if (word == ~Q_UINT64_C(0)) {
+                builder.add(first, first + 63);
+                continue;
+            }
+            for (int bit = 0; word; ++bit, word >>= 1) {
+                if (word & 1) {
+                    builder.add(first + bit);
+                }
+            }
+        }
+    }
+    return builder.toSet();
+}
+
+QByteArray ImapBitmap::toImapSequenceSet() const
+{
+    return toImapSet().toImapSequenceSet();
+}
+
+ImapBitmap ImapBitmap::fromImapSet(const ImapSet &set, Id highest)
+{
+    ImapBitmap result;
+    foreach (const ImapSet::Range &range, set.ranges()) {
+        if (range.begin < 1 || range.begin > maxValue) {
+            continue;
+        }
+        const Id end = range.end ? range.end : qMax(range.begin, highest);
+        result.add(range.begin, qMin(end, maxValue));
+    }
+    return result;
+}
+
+QDebug &operator<<(QDebug &d, const ImapBitmap &set)
+{
+    d << set.toImapSequenceSet();
+    return d;
+}
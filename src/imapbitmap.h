@@ -0,0 +1,142 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_IMAPBITMAP_H
+#define KIMAP2_IMAPBITMAP_H
+
+#include "kimap2_export.h"
+
+#include "imapset.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QMetaType>
+#include <QtCore/QSharedDataPointer>
+
+namespace KIMAP2
+{
+
+/**
+  Represents a set of UIDs or sequence numbers as a compressed bitmap.
+
+  Unlike ImapSet, which stores intervals, the values are split by their upper
+  16 bits into blocks, and each block is stored as a sorted array while it is
+  sparse and as a bitmap once it gets dense. This keeps sets that fragment into
+  many intervals small, such as the messages with a given flag in a large mailbox,
+  and makes the set algebra and count() cheap.
+
+  Values have to be in the range of IMAP numbers, 1 to 4294967295.
+
+  This class is implicitly shared.
+*/
+class KIMAP2_EXPORT ImapBitmap
+{
+public:
+    typedef ImapSet::Id Id;
+
+    /**
+      Constructs an empty set.
+    */
+    ImapBitmap();
+
+    /**
+      Copy constructor.
+    */
+    ImapBitmap(const ImapBitmap &other);
+
+    /**
+      Destructor.
+    */
+    ~ImapBitmap();
+
+    /**
+      Assignment operator.
+    */
+    ImapBitmap &operator=(const ImapBitmap &other);
+
+    /**
+      Comparison operator.
+    */
+    bool operator==(const ImapBitmap &other) const;
+
+    /**
+      Adds a single value. Values outside of 1 to 4294967295 are ignored.
+    */
+    void add(Id value);
+
+    /**
+      Adds all values from @p begin to @p end, both included, as far as they are within
+      1 to 4294967295.
+    */
+    void add(Id begin, Id end);
+
+    /**
+      Removes a single value.
+    */
+    void remove(Id value);
+
+    /**
+      Returns true if @p value is in this set.
+    */
+    bool contains(Id value) const;
+
+    /**
+      Returns the number of values in this set.
+    */
+    Id count() const;
+
+    /**
+      Returns true if this set contains no values.
+    */
+    bool isEmpty() const;
+
+    /**
+      Return the union, intersection and difference of this set and @p other.
+    */
+    ImapBitmap united(const ImapBitmap &other) const;
+    ImapBitmap intersected(const ImapBitmap &other) const;
+    ImapBitmap subtracted(const ImapBitmap &other) const;
+
+    /**
+      Returns the values as an optimized ImapSet.
+    */
+    ImapSet toImapSet() const;
+
+    /**
+      Returns the values in IMAP sequence set syntax, the same as toImapSet().toImapSequenceSet().
+    */
+    QByteArray toImapSequenceSet() const;
+
+    /**
+      Returns a set of the values in @p set.
+
+      An interval without end ("n:*") is taken to end at @p highest, e.g. UIDNEXT - 1,
+      or to only contain n if @p highest is lower. A saved search result is empty.
+    */
+    static ImapBitmap fromImapSet(const ImapSet &set, Id highest = 0);
+
+private:
+    class Private;
+    QSharedDataPointer<Private> d;
+};
+
+}
+
+KIMAP2_EXPORT QDebug &operator<<(QDebug &d, const KIMAP2::ImapBitmap &set);
+
+Q_DECLARE_METATYPE(KIMAP2::ImapBitmap)
+
+#endif
@@ -0,0 +1,253 @@
+/*
+    Copyright (c) 2017 Christian Mollekopf <mollekopf@kolabsys.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_IMAPKEYWORD_P_H
+#define KIMAP2_IMAPKEYWORD_P_H
+
+#include <QtCore/QByteArray>
+
+#include <cstring>
+
+namespace KIMAP2
+{
+
+/**
+ * The IMAP keywords responses are dispatched on.
+ *
+ * Atoms are classified once while parsing, see Message::Part::keyword().
+ */
+enum class ImapKeyword : quint8 {
+    None = 0,
+    Ok, // OK
+    No, // NO
+    Bad, // BAD
+    Bye, // BYE
+    Preauth, // PREAUTH
+    Capability, // CAPABILITY
+    Fetch, // FETCH
+    UidFetch, // UIDFETCH, instead of FETCH once UIDONLY is enabled (RFC 9586)
+    Exists, // EXISTS
+    Recent, // RECENT
+    Expunge, // EXPUNGE
+    Flags, // FLAGS
+    Uid, // UID
+    Rfc822Size, // RFC822.SIZE
+    InternalDate, // INTERNALDATE
+    BodyStructure, // BODYSTRUCTURE
+    Body, // BODY
+    Envelope, // ENVELOPE
+    ModSeq, // MODSEQ
+    XGmLabels, // X-GM-LABELS
+    XGmMsgId, // X-GM-MSGID
+    XGmThrId, // X-GM-THRID
+    Search, // SEARCH
+    ESearch, // ESEARCH
+    List, // LIST
+    Lsub, // LSUB
+    Status, // STATUS
+    Namespace, // NAMESPACE
+    Vanished, // VANISHED
+    UidValidity, // UIDVALIDITY
+    UidNext, // UIDNEXT
+    Unseen, // UNSEEN
+    PermanentFlags, // PERMANENTFLAGS
+    HighestModSeq, // HIGHESTMODSEQ
+    NoModSeq, // NOMODSEQ
+    ReadWrite, // READ-WRITE
+    ReadOnly, // READ-ONLY
+    Metadata, // METADATA
+    Annotation, // ANNOTATION
+    Quota, // QUOTA
+    QuotaRoot, // QUOTAROOT
+    Acl, // ACL
+    MyRights, // MYRIGHTS
+    ListRights, // LISTRIGHTS
+    Enabled, // ENABLED
+    Id, // ID
+    CopyUid, // COPYUID
+    AppendUid, // APPENDUID
+    Alert, // ALERT
+    TryCreate, // TRYCREATE
+    Messages, // MESSAGES
+};
+
+/**
+ * Returns the keyword @p data is, or ImapKeyword::None.
+ *
+ * Uses a perfect hash over the length and three characters of the token, so there is
+ * at most one comparison per token. Keywords are matched case-sensitively, as everywhere else.
+ */
+inline ImapKeyword imapKeyword(const char *data, int size)
+{
+    struct Entry {
+        const char *name;
+        int size;
+        ImapKeyword keyword;
+    };
+    // Generated for the hash below, every slot holds at most one keyword
+    static const Entry table[128] = {
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { "INTERNALDATE", 12, ImapKeyword::InternalDate },
+        { nullptr, 0, ImapKeyword::None },
+        { "NAMESPACE", 9, ImapKeyword::Namespace },
+        { "X-GM-LABELS", 11, ImapKeyword::XGmLabels },
+        { "ESEARCH", 7, ImapKeyword::ESearch },
+        { "ANNOTATION", 10, ImapKeyword::Annotation },
+        { "ALERT", 5, ImapKeyword::Alert },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { "RFC822.SIZE", 11, ImapKeyword::Rfc822Size },
+        { "MESSAGES", 8, ImapKeyword::Messages },
+        { "READ-WRITE", 10, ImapKeyword::ReadWrite },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { "LIST", 4, ImapKeyword::List },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { "BAD", 3, ImapKeyword::Bad },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { "QUOTA", 5, ImapKeyword::Quota },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { "EXPUNGE", 7, ImapKeyword::Expunge },
+        { "UIDVALIDITY", 11, ImapKeyword::UidValidity },
+        { "TRYCREATE", 9, ImapKeyword::TryCreate },
+        { "QUOTAROOT", 9, ImapKeyword::QuotaRoot },
+        { nullptr, 0, ImapKeyword::None },
+        { "CAPABILITY", 10, ImapKeyword::Capability },
+        { nullptr, 0, ImapKeyword::None },
+        { "FETCH", 5, ImapKeyword::Fetch },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { "LISTRIGHTS", 10, ImapKeyword::ListRights },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { "PREAUTH", 7, ImapKeyword::Preauth },
+        { "EXISTS", 6, ImapKeyword::Exists },
+        { "STATUS", 6, ImapKeyword::Status },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { "VANISHED", 8, ImapKeyword::Vanished },
+        { nullptr, 0, ImapKeyword::None },
+        { "MYRIGHTS", 8, ImapKeyword::MyRights },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { "MODSEQ", 6, ImapKeyword::ModSeq },
+        { "UNSEEN", 6, ImapKeyword::Unseen },
+        { nullptr, 0, ImapKeyword::None },
+        { "BODYSTRUCTURE", 13, ImapKeyword::BodyStructure },
+        { "PERMANENTFLAGS", 14, ImapKeyword::PermanentFlags },
+        { nullptr, 0, ImapKeyword::None },
+        { "ACL", 3, ImapKeyword::Acl },
+        { "HIGHESTMODSEQ", 13, ImapKeyword::HighestModSeq },
+        { "X-GM-MSGID", 10, ImapKeyword::XGmMsgId },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { "OK", 2, ImapKeyword::Ok },
+        { nullptr, 0, ImapKeyword::None },
+        { "FLAGS", 5, ImapKeyword::Flags },
+        { nullptr, 0, ImapKeyword::None },
+        { "UID", 3, ImapKeyword::Uid },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { "UIDFETCH", 8, ImapKeyword::UidFetch },
+        { "RECENT", 6, ImapKeyword::Recent },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { "APPENDUID", 9, ImapKeyword::AppendUid },
+        { "COPYUID", 7, ImapKeyword::CopyUid },
+        { nullptr, 0, ImapKeyword::None },
+        { "BODY", 4, ImapKeyword::Body },
+        { "ENVELOPE", 8, ImapKeyword::Envelope },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { "LSUB", 4, ImapKeyword::Lsub },
+        { "METADATA", 8, ImapKeyword::Metadata },
+        { "BYE", 3, ImapKeyword::Bye },
+        { "UIDNEXT", 7, ImapKeyword::UidNext },
+        { "ID", 2, ImapKeyword::Id },
+        { "NO", 2, ImapKeyword::No },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { "NOMODSEQ", 8, ImapKeyword::NoModSeq },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { "ENABLED", 7, ImapKeyword::Enabled },
+        { "READ-ONLY", 9, ImapKeyword::ReadOnly },
+        { "X-GM-THRID", 10, ImapKeyword::XGmThrId },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+        { "SEARCH", 6, ImapKeyword::Search },
+        { nullptr, 0, ImapKeyword::None },
+        { nullptr, 0, ImapKeyword::None },
+    };
+    if (size < 2 || size > 14) {
+        return ImapKeyword::None;
+    }
+    const uchar *s = reinterpret_cast<const uchar *>(data);
+    const uint hash = (size + 27 * s[0] + 39 * s[size - 1] + 7 * s[size / 2]) % 128;
+    const Entry &entry = table[hash];
+    if (entry.size == size && std::memcmp(entry.name, data, size) == 0) {
+        return entry.keyword;
+    }
+    return ImapKeyword::None;
+}
+
+inline ImapKeyword imapKeyword(const QByteArray &token)
+{
+    return imapKeyword(token.constData(), token.size());
+}
+
+}
+
+#endif
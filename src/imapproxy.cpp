@@ -0,0 +1,687 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "imapproxy.h"
+
+#include "kimap_debug.h"
+
+#include "imapstreamparser.h"
+#include "job.h"
+#include "job_p.h"
+#include "message_p.h"
+#include "rfccodecs.h"
+#include "session.h"
+#include "sessionpool.h"
+
+#include <QtCore/QPointer>
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QTcpSocket>
+
+namespace KIMAP2
+{
+
+/*
+ * The parser doesn't keep how a string was sent, so strings are sent again in the form
+ * their content needs. Quoted strings keep their escapes in the Message, and are quoted again as they are.
+ */
+static bool isQuotable(const QByteArray &string)
+{
+    for (int i = 0; i < string.size(); ++i) {
+        const char c = string.at(i);
+        if (c == '\r' || c == '\n' || c == '\0' || (c & 0x80)) {
+            return false;
+        }
+        if (c == '\\') {
+            //An escape, skip what it escapes
+            if (++i >= string.size()) {
+                return false;
+            }
+        } else if (c == '"') {
+            return false;
+        }
+    }
+    return true;
+}
+
+static QByteArray literal(const QByteArray &string, bool nonSynchronizing)
+{
+    return '{' + QByteArray::number(string.size()) + (nonSynchronizing ? "+}\r\n" : "}\r\n") + string;
+}
+
+static QByteArray quoted(const QByteArray &string)
+{
+    return '"' + string + '"';
+}
+
+/**
+ * Serializes a string token. Literals are non-synchronizing towards the server, and
+ * @p usedLiteral is set whenever one is written.
+ */
+static QByteArray serializeString(const QByteArray &string, bool toServer, bool *usedLiteral)
+{
+    if (string.isEmpty()) {
+        return "\"\"";
+    }
+    if (string.size() > 1024 || !isQuotable(string)) {
+        if (usedLiteral) {
+            *usedLiteral = true;
+        }
+        return literal(string, toServer);
+    }
+    const int bracket = string.indexOf('[');
+    if (bracket > 0 && (string.endsWith(']') || string.endsWith('>'))) {
+        //A fetch attribute like BODY.PEEK[HEADER.FIELDS (FROM TO)]<0>
+        return string;
+    }
+    if (string.size() == 1 && string != "*" && string != "%" && !QChar::isLetterOrNumber(uint(uchar(string.at(0))))) {
+        //A hierarchy delimiter
+        return quoted(string);
+    }
+    for (int i = 0; i < string.size(); ++i) {
+        const char c = string.at(i);
+        //A leading backslash is part of a flag
+        if (c == ' ' || c == '(' || c == ')' || c == '{' || (c == '\\' && i > 0)) {
+            return quoted(string);
+        }
+    }
+    return string;
+}
+
+/**
+ * Whether the item following @p name in a FETCH response is message data, which is sent as a literal.
+ */
+static bool isMessageData(const QByteArray &name)
+{
+    return name.startsWith("BODY[") || name.startsWith("BINARY[")
+           || ((name == "RFC822" || name.startsWith("RFC822.")) && name != "RFC822.SIZE");
+}
+
+static QByteArray serializePart(const Message::Part &part, bool toServer, bool *usedLiteral)
+{
+    if (part.type() == Message::Part::String) {
+        return serializeString(part.toString(), toServer, usedLiteral);
+    }
+    const QList<QByteArray> items = part.toList();
+    QByteArray result = "(";
+    for (int i = 0; i < items.size(); ++i) {
+        if (i > 0) {
+            result += ' ';
+        }
+        const QByteArray &item = items.at(i);
+        if (part.sublist(i).isList()) {
+            //Nested lists are kept as they were sent
+            result += item;
+        } else if (!toServer && i > 0 && isMessageData(items.at(i - 1).toUpper()) && item != "NIL") {
+            result += literal(item, toServer);
+            if (usedLiteral) {
+                *usedLiteral = true;
+            }
+        } else {
+            result += serializeString(item, toServer, usedLiteral);
+        }
+    }
+    return result + ')';
+}
+
+static QByteArray serializeParts(const QList<Message::Part> &parts, int from, bool toServer, bool *usedLiteral = Q_NULLPTR)
+{
+    QByteArray result;
+    for (int i = from; i < parts.size(); ++i) {
+        if (i > from) {
+            result += ' ';
+        }
+        result += serializePart(parts.at(i), toServer, usedLiteral);
+    }
+    return result;
+}
+
+static bool isStatus(const Message::Part &part)
+{
+    switch (part.keyword()) {
+    case ImapKeyword::Ok:
+    case ImapKeyword::No:
+    case ImapKeyword::Bad:
+    case ImapKeyword::Bye:
+    case ImapKeyword::Preauth:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * Serializes a status response from the status on, e.g. "OK [UIDNEXT 12] Predicted next UID".
+ *
+ * The human readable text is joined as it was received.
+ */
+static QByteArray serializeStatus(const Message &response, int statusIndex)
+{
+    QByteArray result = response.content.value(statusIndex).toString();
+    if (!response.responseCode.isEmpty()) {
+        result += " [" + serializeParts(response.responseCode, 0, false) + ']';
+    }
+    for (int i = statusIndex + 1; i < response.content.size(); ++i) {
+        const Message::Part &part = response.content.at(i);
+        result += ' ';
+        result += part.type() == Message::Part::String ? part.toString() : serializePart(part, false, Q_NULLPTR);
+    }
+    return result;
+}
+
+static QByteArray serializeResponse(const Message &response)
+{
+    if (response.content.size() >= 2 && isStatus(response.content.at(1))) {
+        return response.content.first().toString() + ' ' + serializeStatus(response, 1);
+    }
+    return response.content.value(0).toString() + ' ' + serializeParts(response.content, 1, false);
+}
+
+class ProxyCommandJobPrivate : public JobPrivate
+{
+public:
+    ProxyCommandJobPrivate(Session *session, const QByteArray &command, const QByteArray &args)
+        : JobPrivate(session, QStringLiteral("ProxyCommand")), command(command), args(args), usesLiteral(false)
+    {
+        //Responses are serialized right away
+        handlesBorrowedResponses = true;
+    }
+
+    QByteArray command;
+    QByteArray args;
+    bool usesLiteral;
+    std::function<void(Job *job, const Message &response)> untaggedResponse;
+    // The tagged response without the tag, empty if the command didn't complete
+    QByteArray completion;
+};
+
+/**
+ * Sends a command of a client and passes on what the server responds.
+ */
+class ProxyCommandJob : public Job
+{
+    Q_DECLARE_PRIVATE(ProxyCommandJob)
+
+public:
+    ProxyCommandJob(Session *session, const QByteArray &command, const QByteArray &args, bool usesLiteral)
+        : Job(*new ProxyCommandJobPrivate(session, command, args))
+    {
+        Q_D(ProxyCommandJob);
+        d->usesLiteral = usesLiteral;
+    }
+
+    void setUntaggedResponseHandler(const std::function<void(Job *job, const Message &response)> &handler)
+    {
+        Q_D(ProxyCommandJob);
+        d->untaggedResponse = handler;
+    }
+
+    QByteArray completion() const
+    {
+        Q_D(const ProxyCommandJob);
+        return d->completion;
+    }
+
+private:
+    void doStart() Q_DECL_OVERRIDE
+    {
+        Q_D(ProxyCommandJob);
+        if (d->usesLiteral && !session()->capabilities().contains(QStringLiteral("LITERAL+"))) {
+            d->completion = "NO [CANNOT] Literals are not supported by the server";
+            emitResult();
+            return;
+        }
+        d->sendCommand(d->command, d->args);
+    }
+
+    void handleResponse(const Message &response) Q_DECL_OVERRIDE
+    {
+        Q_D(ProxyCommandJob);
+        if (response.content.size() >= 2 && d->tags.contains(response.content.first().toString())) {
+            d->completion = serializeStatus(response, 1);
+            d->tags.clear();
+            emitResult();
+        } else if (d->untaggedResponse && !response.content.isEmpty() && response.content.first().toString() == "*") {
+            d->untaggedResponse(this, response);
+        }
+    }
+};
+
+class ProxyClient;
+
+class ImapProxyPrivate
+{
+public:
+    ImapProxyPrivate(ImapProxy *proxy, SessionPool *pool)
+        : q(proxy),
+          pool(pool),
+          server(Q_NULLPTR)
+    {
+    }
+
+    /**
+     * Queues @p line for the clients other than @p origin that have @p mailBox selected.
+     */
+    void broadcast(ProxyClient *origin, const QString &mailBox, const QByteArray &line);
+
+    ImapProxy *const q;
+    SessionPool *const pool;
+    ImapProxy::Authenticator authenticator;
+    QTcpServer *server;
+    QList<ProxyClient *> clients;
+};
+
+/**
+ * A connected client. It runs one command at a time, the others wait in the order they arrived.
+ */
+class ProxyClient : public QObject
+{
+public:
+    ProxyClient(ImapProxyPrivate *proxy, QTcpSocket *socket);
+
+    void readCommands();
+    void processNext();
+    void execute(const Message &command);
+    void forward(const QByteArray &tag, const QByteArray &name, const QByteArray &command, const QByteArray &args,
+                 bool usesLiteral, const QString &mailBox);
+    void untaggedResponse(Job *job, const QByteArray &name, const Message &response);
+    void finish(const QByteArray &tag, const QByteArray &name, ProxyCommandJob *job);
+    void complete(const QByteArray &tag, const QByteArray &completion, bool flushUpdates = true);
+    void sendLine(const QByteArray &line);
+
+    ImapProxyPrivate *const proxy;
+    QTcpSocket *const socket;
+    ImapStreamParser parser;
+    QList<Message> commands;
+    // Mailbox updates caused by other clients
+    QList<QByteArray> pendingUpdates;
+    // The selected mailbox as the sessions report it, empty if none is selected
+    QString mailBox;
+    bool authenticated;
+    bool readOnly;
+    bool busy;
+    bool executing;
+};
+
+static bool isMailboxUpdate(const Message &response, bool *broadcast)
+{
+    if (response.content.size() >= 2 && response.content.at(1).keyword() == ImapKeyword::Vanished) {
+        *broadcast = true;
+        return true;
+    }
+    if (response.content.size() < 3) {
+        return false;
+    }
+    switch (response.content.at(2).keyword()) {
+    case ImapKeyword::Exists:
+    case ImapKeyword::Recent:
+    case ImapKeyword::Expunge:
+        *broadcast = true;
+        return true;
+    case ImapKeyword::Fetch:
+        *broadcast = false;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Commands during which the server must not send EXPUNGE responses (RFC 3501 section 7.4.1)
+static bool deliversUpdates(const QByteArray &name)
+{
+    return name != "FETCH" && name != "STORE" && name != "SEARCH"
+           && !name.startsWith("UID ");
+}
+
+static bool isMailboxCommand(const QByteArray &name)
+{
+    static const QList<QByteArray> commands = QList<QByteArray>() << "FETCH" << "STORE" << "SEARCH" << "COPY" << "MOVE"
+            << "EXPUNGE" << "SORT" << "THREAD" << "CHECK" << "NOOP";
+    return commands.contains(name.startsWith("UID ") ? name.mid(4) : name) && name != "UID CHECK" && name != "UID NOOP";
+}
+
+/**
+ * Whether a command that doesn't need a selected mailbox is forwarded. Everything else could change the
+ * state of the shared session, e.g. COMPRESS or NOTIFY, and is refused.
+ */
+static bool isForwardedCommand(const QByteArray &name)
+{
+    static const QList<QByteArray> commands = QList<QByteArray>() << "LIST" << "LSUB" << "STATUS" << "CREATE" << "DELETE"
+            << "RENAME" << "SUBSCRIBE" << "UNSUBSCRIBE" << "APPEND" << "NAMESPACE" << "GETQUOTA" << "GETQUOTAROOT"
+            << "SETQUOTA" << "GETACL" << "SETACL" << "DELETEACL" << "MYRIGHTS" << "LISTRIGHTS" << "GETMETADATA"
+            << "SETMETADATA";
+    return commands.contains(name);
+}
+
+static bool modifiesMailbox(const QByteArray &name)
+{
+    return name == "STORE" || name == "UID STORE" || name == "EXPUNGE" || name == "UID EXPUNGE"
+           || name == "MOVE" || name == "UID MOVE";
+}
+
+}
+
+using namespace KIMAP2;
+
+void ImapProxyPrivate::broadcast(ProxyClient *origin, const QString &mailBox, const QByteArray &line)
+{
+    if (mailBox.isEmpty()) {
+        return;
+    }
+    for (ProxyClient *client : clients) {
+        if (client != origin && client->mailBox == mailBox) {
+            client->pendingUpdates << line;
+        }
+    }
+}
+
+ProxyClient::ProxyClient(ImapProxyPrivate *proxy, QTcpSocket *socket)
+    : QObject(proxy->q),
+      proxy(proxy),
+      socket(socket),
+      parser(socket, true),
+      authenticated(!proxy->authenticator),
+      readOnly(false),
+      busy(false),
+      executing(false)
+{
+    socket->setParent(this);
+    parser.onResponseReceived([this](const Message &command) {
+        commands << command.detached();
+    });
+    connect(socket, &QIODevice::readyRead, this, &ProxyClient::readCommands);
+    connect(socket, &QAbstractSocket::disconnected, this, [this]() {
+        this->proxy->clients.removeAll(this);
+        deleteLater();
+    });
+
+    sendLine(authenticated ? "* PREAUTH [CAPABILITY IMAP4rev1 LITERAL+] KIMAP2 proxy ready"
+                           : "* OK [CAPABILITY IMAP4rev1 LITERAL+] KIMAP2 proxy ready");
+    if (socket->bytesAvailable()) {
+        readCommands();
+    }
+}
+
+void ProxyClient::readCommands()
+{
+    parser.parseStream();
+    if (parser.error()) {
+        qCWarning(KIMAP2_LOG) << "Closing the connection of a proxy client that sent an invalid command";
+        sendLine("* BYE Invalid command");
+        socket->disconnectFromHost();
+        return;
+    }
+    processNext();
+}
+
+void ProxyClient::processNext()
+{
+    //Commands that complete right away are handled in the loop, not recursively
+    if (executing) {
+        return;
+    }
+    executing = true;
+    while (!busy && !commands.isEmpty()) {
+        execute(commands.takeFirst());
+    }
+    executing = false;
+}
+
+void ProxyClient::execute(const Message &command)
+{
+    const QByteArray tag = command.content.value(0).toString();
+    if (command.content.size() < 2 || !command.responseCode.isEmpty()) {
+        sendLine((tag.isEmpty() ? "*" : tag) + " BAD Invalid command");
+        return;
+    }
+    QByteArray name = command.content.at(1).toString().toUpper();
+    int argsIndex = 2;
+    if (name == "UID" && command.content.size() >= 3) {
+        name += ' ' + command.content.at(2).toString().toUpper();
+        argsIndex = 3;
+    }
+
+    if (name == "CAPABILITY") {
+        sendLine("* CAPABILITY IMAP4rev1 LITERAL+");
+        complete(tag, "OK CAPABILITY completed");
+    } else if (name == "LOGOUT") {
+        sendLine("* BYE KIMAP2 proxy logging out");
+        complete(tag, "OK LOGOUT completed", false);
+        socket->disconnectFromHost();
+    } else if (name == "NOOP" && mailBox.isEmpty()) {
+        complete(tag, "OK NOOP completed");
+    } else if (name == "LOGIN") {
+        if (authenticated) {
+            complete(tag, "BAD Already logged in");
+        } else if (command.content.size() != 4) {
+            complete(tag, "BAD LOGIN expects a user and a password");
+        } else if (proxy->authenticator(QString::fromUtf8(command.content.at(2).toString()),
+                                        QString::fromUtf8(command.content.at(3).toString()))) {
+            authenticated = true;
+            complete(tag, "OK [CAPABILITY IMAP4rev1 LITERAL+] LOGIN completed");
+        } else {
+            complete(tag, "NO [AUTHENTICATIONFAILED] Invalid credentials");
+        }
+    } else if (name == "AUTHENTICATE" || name == "STARTTLS") {
+        complete(tag, "NO [CANNOT] " + name + " is not supported");
+    } else if (!authenticated) {
+        complete(tag, "BAD Log in first");
+    } else if (name == "IDLE") {
+        complete(tag, "BAD IDLE is not supported");
+    } else if (name == "ENABLE") {
+        //The sessions are shared, no extension can be enabled for a single client
+        complete(tag, "OK Nothing enabled");
+    } else if (name == "SELECT" || name == "EXAMINE") {
+        if (command.content.size() != 3 || command.content.at(2).type() != Message::Part::String) {
+            complete(tag, "BAD " + name + " expects a mailbox");
+            return;
+        }
+        //A failed SELECT leaves the client unselected
+        mailBox.clear();
+        readOnly = false;
+        pendingUpdates.clear();
+        const QByteArray encodedName = command.content.at(2).toString();
+        const QString decodedName = QString::fromUtf8(KIMAP2::decodeImapFolderName(encodedName));
+        //The session tracks the mailbox from the quoted name. EXAMINE is sent as SELECT so that the session
+        //serves all clients of the mailbox, the client is kept from modifying it instead.
+        bool usesLiteral = !isQuotable(encodedName);
+        const QByteArray args = usesLiteral ? literal(encodedName, true) : quoted(encodedName);
+        forward(tag, name, "SELECT", args, usesLiteral, decodedName);
+    } else if (name == "UNSELECT") {
+        if (mailBox.isEmpty()) {
+            complete(tag, "BAD No mailbox selected");
+        } else {
+            mailBox.clear();
+            pendingUpdates.clear();
+            complete(tag, "OK UNSELECT completed", false);
+        }
+    } else if (name == "CLOSE") {
+        if (mailBox.isEmpty()) {
+            complete(tag, "BAD No mailbox selected");
+        } else if (readOnly) {
+            mailBox.clear();
+            pendingUpdates.clear();
+            complete(tag, "OK CLOSE completed", false);
+        } else {
+            //CLOSE would deselect the mailbox for all clients of the session
+            forward(tag, name, "EXPUNGE", QByteArray(), false, mailBox);
+        }
+    } else if (isMailboxCommand(name)) {
+        if (mailBox.isEmpty()) {
+            complete(tag, "BAD No mailbox selected");
+        } else if (readOnly && modifiesMailbox(name)) {
+            complete(tag, "NO [READ-ONLY] The mailbox is read-only");
+        } else {
+            bool usesLiteral = false;
+            QByteArray args = serializeParts(command.content, argsIndex, true, &usesLiteral);
+            if (readOnly && (name == "FETCH" || name == "UID FETCH")) {
+                args.replace("BODY[", "BODY.PEEK[");
+            }
+            forward(tag, name, name, args, usesLiteral, mailBox);
+        }
+    } else if (isForwardedCommand(name)) {
+        bool usesLiteral = false;
+        const QByteArray args = serializeParts(command.content, argsIndex, true, &usesLiteral);
+        forward(tag, name, name, args, usesLiteral, QString());
+    } else {
+        complete(tag, "BAD " + name + " is not supported");
+    }
+}
+
+void ProxyClient::forward(const QByteArray &tag, const QByteArray &name, const QByteArray &command, const QByteArray &args,
+                          bool usesLiteral, const QString &mailBox)
+{
+    QPointer<ProxyClient> client(this);
+    busy = true;
+    Job *job = proxy->pool->submit(mailBox, [client, tag, name, command, args, usesLiteral](Session *session) {
+        ProxyCommandJob *job = new ProxyCommandJob(session, command, args, usesLiteral);
+        job->setUntaggedResponseHandler([client, name](Job *job, const Message &response) {
+            if (client) {
+                client->untaggedResponse(job, name, response);
+            }
+        });
+        QObject::connect(job, &KJob::result, [client, tag, name, job]() {
+            if (client) {
+                client->finish(tag, name, job);
+            }
+        });
+        return job;
+    });
+    if (!job) {
+        busy = false;
+        complete(tag, "NO [UNAVAILABLE] No connection to the server available");
+    }
+}
+
+void ProxyClient::untaggedResponse(Job *job, const QByteArray &name, const Message &response)
+{
+    const QByteArray line = serializeResponse(response);
+    if (name == "SELECT" || name == "EXAMINE") {
+        sendLine(line);
+        return;
+    }
+    bool broadcast = false;
+    if (!isMailboxUpdate(response, &broadcast)) {
+        sendLine(line);
+        return;
+    }
+    const QString sessionMailBox = job->session()->selectedMailBox();
+    if (broadcast || name == "STORE" || name == "UID STORE") {
+        proxy->broadcast(this, sessionMailBox, line);
+    }
+    //Responses for another mailbox would confuse the client, and those of a CLOSE are not expected
+    if (name != "CLOSE" && sessionMailBox == mailBox) {
+        sendLine(line);
+    }
+}
+
+void ProxyClient::finish(const QByteArray &tag, const QByteArray &name, ProxyCommandJob *job)
+{
+    QByteArray completion = job->completion();
+    if (completion.isEmpty()) {
+        completion = "NO [UNAVAILABLE] Connection to the server lost";
+    }
+    const bool ok = completion.startsWith("OK");
+    if (name == "SELECT" || name == "EXAMINE") {
+        if (ok) {
+            mailBox = job->session()->selectedMailBox();
+            readOnly = name == "EXAMINE";
+            if (readOnly) {
+                completion.replace("[READ-WRITE]", "[READ-ONLY]");
+            }
+        }
+    } else if (name == "CLOSE") {
+        //The client leaves the mailbox whatever the server says
+        mailBox.clear();
+        pendingUpdates.clear();
+        if (ok) {
+            completion = "OK CLOSE completed";
+        }
+    }
+    busy = false;
+    complete(tag, completion, deliversUpdates(name));
+    processNext();
+}
+
+void ProxyClient::complete(const QByteArray &tag, const QByteArray &completion, bool flushUpdates)
+{
+    if (flushUpdates) {
+        for (const QByteArray &update : pendingUpdates) {
+            sendLine(update);
+        }
+        pendingUpdates.clear();
+    }
+    sendLine(tag + ' ' + completion);
+}
+
+void ProxyClient::sendLine(const QByteArray &line)
+{
+    socket->write(line + "\r\n");
+}
+
+ImapProxy::ImapProxy(SessionPool *pool, QObject *parent)
+    : QObject(parent), d(new ImapProxyPrivate(this, pool))
+{
+}
+
+ImapProxy::~ImapProxy()
+{
+    //The clients are children, but must not remove themselves from the list while it's destroyed
+    const QList<ProxyClient *> clients = d->clients;
+    d->clients.clear();
+    for (ProxyClient *client : clients) {
+        client->socket->disconnect(client);
+        delete client;
+    }
+    delete d;
+}
+
+void ImapProxy::setAuthenticator(const Authenticator &authenticator)
+{
+    d->authenticator = authenticator;
+}
+
+bool ImapProxy::listen(const QHostAddress &address, quint16 port)
+{
+    if (!d->server) {
+        d->server = new QTcpServer(this);
+        connect(d->server, &QTcpServer::newConnection, this, [this]() {
+            while (QTcpSocket *socket = d->server->nextPendingConnection()) {
+                addConnection(socket);
+            }
+        });
+    }
+    if (!d->server->listen(address, port)) {
+        qCWarning(KIMAP2_LOG) << "The proxy can't listen on" << address << port << d->server->errorString();
+        return false;
+    }
+    return true;
+}
+
+quint16 ImapProxy::serverPort() const
+{
+    return d->server ? d->server->serverPort() : 0;
+}
+
+void ImapProxy::addConnection(QTcpSocket *socket)
+{
+    d->clients << new ProxyClient(d, socket);
+}
+
+int ImapProxy::clientCount() const
+{
+    return d->clients.size();
+}
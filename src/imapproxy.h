@@ -0,0 +1,104 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_IMAPPROXY_H
+#define KIMAP2_IMAPPROXY_H
+
+#include "kimap2_export.h"
+
+#include <QtCore/QObject>
+#include <QtNetwork/QHostAddress>
+
+#include <functional>
+
+class QTcpSocket;
+
+namespace KIMAP2
+{
+
+class SessionPool;
+class ImapProxyPrivate;
+
+/**
+ * An IMAP server that serves its clients from the sessions of a SessionPool.
+ *
+ * The commands of the clients are parsed with a server mode ImapStreamParser and sent on a
+ * session of the pool under a tag of that session, the tagged completion goes back to the client
+ * under its own tag. Commands on the selected mailbox go to a session that has it selected,
+ * so the number of backend connections follows the number of mailboxes in use rather than
+ * the number of clients.
+ *
+ * Untagged responses go to the client whose command they answer. EXISTS, RECENT, EXPUNGE and
+ * VANISHED responses, and the FETCH responses of a STORE, are also passed to the other clients
+ * that have the mailbox selected, before the completion of their next command.
+ *
+ * The proxy keeps no state of the mailboxes, and sequence numbers are those of the session that
+ * ran the command, which may have seen other expunges than the client. Clients should use UIDs.
+ * IDLE and AUTHENTICATE are not supported, literals in commands are only
+ * forwarded to servers that support LITERAL+. Commands that could change the state of the
+ * shared session, e.g. COMPRESS or NOTIFY, are refused with BAD.
+ */
+class KIMAP2_EXPORT ImapProxy : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * Decides whether a client may log in. Returns true to accept.
+     */
+    typedef std::function<bool(const QString &user, const QString &password)> Authenticator;
+
+    /**
+     * Creates a proxy for the sessions of @p pool, which it doesn't own.
+     */
+    explicit ImapProxy(SessionPool *pool, QObject *parent = Q_NULLPTR);
+    ~ImapProxy();
+
+    /**
+     * Makes clients log in with LOGIN. Without an authenticator, the default,
+     * they are greeted with PREAUTH.
+     */
+    void setAuthenticator(const Authenticator &authenticator);
+
+    /**
+     * Accepts clients on @p address and @p port, or a free port for 0.
+     *
+     * Returns false if the port can't be used.
+     */
+    bool listen(const QHostAddress &address = QHostAddress::LocalHost, quint16 port = 0);
+    quint16 serverPort() const;
+
+    /**
+     * Serves a client that is already connected, e.g. after a TLS handshake.
+     *
+     * The proxy takes ownership of @p socket.
+     */
+    void addConnection(QTcpSocket *socket);
+
+    /**
+     * The number of clients connected now.
+     */
+    int clientCount() const;
+
+private:
+    friend class ImapProxyPrivate;
+    ImapProxyPrivate *const d;
+};
+
+}
+
+#endif
@@ -21,6 +21,10 @@
 
 #include <QtCore/QSharedData>
 
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
 using namespace KIMAP2;
 
 class ImapInterval::Private : public QSharedData
@@ -46,16 +50,140 @@ public:
 class ImapSet::Private : public QSharedData
 {
 public:
-    Private() : QSharedData() {}
+    Private() : QSharedData(), savedSearchResult(false) {}
     Private(const Private &other) :
         QSharedData(other)
     {
-        intervals = other.intervals;
+        ranges = other.ranges;
+        savedSearchResult = other.savedSearchResult;
     }
 
-    ImapInterval::List intervals;
+    void append(Id begin, Id end)
+    {
+        const Range range = { begin, end };
+        ranges.append(range);
+    }
+
+    // The intervals inline, in the order they were added
+    QVector<Range> ranges;
+    bool savedSearchResult;
 };
 
+static int digitCount(ImapSet::Id value)
+{
+    int count = 1;
+    while (value >= 10) {
+        value /= 10;
+        ++count;
+    }
+    return count;
+}
+
+/**
+ * Returns the length of the IMAP sequence of the interval from @p begin to @p end.
+ */
+static int sequenceLength(ImapSet::Id begin, ImapSet::Id end)
+{
+    if (!begin && !end) {
+        return 0;
+    }
+    if (begin == end) {
+        return digitCount(begin);
+    }
+    return digitCount(begin) + 1 + (end ? digitCount(end) : 1);
+}
+
+static void appendNumber(QByteArray &result, ImapSet::Id value)
+{
+    Q_ASSERT(value >= 0);
+    // A qint64 has at most 19 digits
+    char buffer[20];
+    char *const bufferEnd = buffer + sizeof(buffer);
+    char *pos = bufferEnd;
+    do {
+        *--pos = char('0' + value % 10);
+        value /= 10;
+    } while (value);
+    result.append(pos, bufferEnd - pos);
+}
+
+/**
+ * Appends the IMAP sequence of the interval from @p begin to @p end to @p result,
+ * the same as ImapInterval::toImapSequence().
+ */
+static void appendSequence(QByteArray &result, ImapSet::Id begin, ImapSet::Id end)
+{
+    if (!begin && !end) {
+        return;
+    }
+    appendNumber(result, begin);
+    if (begin == end) {
+        return;
+    }
+    result += ':';
+    if (end) {
+        appendNumber(result, end);
+    } else {
+        result += '*';
+    }
+}
+
+/**
+ * Parses the digits at @p pos, leaving @p pos behind them.
+ * Returns false if there are none or the number doesn't fit.
+ */
+static bool parseNumber(const char *&pos, const char *end, ImapSet::Id *value)
+{
+    const char *const start = pos;
+    ImapSet::Id result = 0;
+    for (; pos != end && *pos >= '0' && *pos <= '9'; ++pos) {
+        const int digit = *pos - '0';
+        if (result > (std::numeric_limits<ImapSet::Id>::max() - digit) / 10) {
+            return false;
+        }
+        result = result * 10 + digit;
+    }
+    *value = result;
+    return pos != start;
+}
+
+/**
+ * Parses a single interval like "3", "3:7" or "3:*" from @p begin to @p end,
+ * setting both ends to 0 if it is invalid.
+ */
+static void parseSequence(const char *begin, const char *end, ImapSet::Id *first, ImapSet::Id *last)
+{
+    *first = 0;
+    *last = 0;
+    const char *pos = begin;
+    ImapSet::Id from;
+    if (!parseNumber(pos, end, &from)) {
+        return;
+    }
+    ImapSet::Id to = from;
+    if (pos != end) {
+        if (*pos++ != ':') {
+            return;
+        }
+        if (pos != end && *pos == '*') {
+            to = 0;
+            ++pos;
+        } else if (!parseNumber(pos, end, &to)) {
+            return;
+        }
+        if (pos != end) {
+            return;
+        }
+    }
+    *first = from;
+    *last = to;
+}
+
+static bool rangeBefore(const ImapSet::Range &lhs, const ImapSet::Range &rhs)
+{
+    return lhs.begin < rhs.begin || (lhs.begin == rhs.begin && lhs.end < rhs.end);
+}
+
 ImapInterval::ImapInterval() :
     d(new Private)
 {
@@ -140,50 +268,19 @@ void ImapInterval::setEnd(Id value)
 
 QByteArray ImapInterval::toImapSequence() const
 {
-    if (size() == 0) {
-        return QByteArray();
-    }
-    if (size() == 1) {
-        return QByteArray::number(d->begin);
-    }
     QByteArray rv;
-    rv += QByteArray::number(d->begin) + ':';
-    if (hasDefinedEnd()) {
-        rv += QByteArray::number(d->end);
-    } else {
-        rv += '*';
+    const int length = sequenceLength(d->begin, d->end);
+    if (length) {
+        rv.reserve(length);
+        appendSequence(rv, d->begin, d->end);
     }
     return rv;
 }
 
 ImapInterval ImapInterval::fromImapSequence(const QByteArray &sequence)
 {
-    QList<QByteArray> values = sequence.split(':');
-    if (values.isEmpty() || values.size() > 2) {
-        return ImapInterval();
-    }
-
-    bool ok = false;
-    Id begin = values[0].toLongLong(&ok);
-
-    if (!ok) {
-        return ImapInterval();
-    }
-
-    Id end;
-
-    if (values.size() == 1) {
-        end = begin;
-    } else if (values[1] == QByteArray("*")) {
-        end = 0;
-    } else {
-        ok = false;
-        end = values[1].toLongLong(&ok);
-        if (!ok) {
-            return ImapInterval();
-        }
-    }
-
+    Id begin, end;
+    parseSequence(sequence.constData(), sequence.constData() + sequence.size(), &begin, &end);
     return ImapInterval(begin, end);
 }
 
@@ -195,13 +292,13 @@ ImapSet::ImapSet() :
 ImapSet::ImapSet(Id begin, Id end) :
     d(new Private)
 {
-    add(ImapInterval(begin, end));
+    d->append(begin, end);
 }
 
 ImapSet::ImapSet(Id value) :
     d(new Private)
 {
-    add(QVector<Id>() << value);
+    d->append(value, value);
 }
 
 ImapSet::ImapSet(const ImapSet &other) :
@@ -223,12 +320,21 @@ ImapSet &ImapSet::operator =(const ImapSet &other)
 
 bool ImapSet::operator ==(const ImapSet &other) const
 {
-    if (d->intervals.size() != other.d->intervals.size()) {
+    if (d == other.d) {
+        return true;
+    }
+    if (d->savedSearchResult != other.d->savedSearchResult
+            || d->ranges.size() != other.d->ranges.size()) {
         return false;
     }
 
-    foreach (const ImapInterval &interval, d->intervals) {
-        if (!other.d->intervals.contains(interval)) {
+    // The order the intervals were added in doesn't matter
+    QVector<Range> ranges = d->ranges;
+    QVector<Range> otherRanges = other.d->ranges;
+    std::sort(ranges.begin(), ranges.end(), rangeBefore);
+    std::sort(otherRanges.begin(), otherRanges.end(), rangeBefore);
+    for (int i = 0; i < ranges.size(); ++i) {
+        if (ranges.at(i).begin != otherRanges.at(i).begin || ranges.at(i).end != otherRanges.at(i).end) {
             return false;
         }
     }
@@ -238,18 +344,21 @@ bool ImapSet::operator ==(const ImapSet &other) const
 
 void ImapSet::add(Id value)
 {
-    add(QVector<Id>() << value);
+    d->append(value, value);
 }
 
 void ImapSet::add(const QVector<Id> &values)
 {
     QVector<Id> vals = values;
-    std::sort(vals.begin(), vals.end());
+    if (!std::is_sorted(vals.constBegin(), vals.constEnd())) {
+        std::sort(vals.begin(), vals.end());
+    }
+    d->ranges.reserve(d->ranges.size() + vals.size());
     for (auto i = 0; i < vals.count(); ++i) {
         const auto begin = vals[i];
         Q_ASSERT(begin >= 0);
         if (i == vals.count() - 1) {
-            d->intervals << ImapInterval(begin, begin);
+            d->append(begin, begin);
             break;
         }
         do {
@@ -260,32 +369,33 @@ void ImapSet::add(const QVector<Id> &values)
                 break;
             }
         } while (i < vals.count() - 1);
-        d->intervals << ImapInterval(begin, vals[i]);
+        d->append(begin, vals[i]);
     }
 }
 
 void ImapSet::add(const ImapInterval &interval)
 {
-    d->intervals << interval;
+    d->append(interval.begin(), interval.hasDefinedEnd() ? interval.end() : 0);
 }
 
 QByteArray ImapSet::toImapSequenceSet() const
 {
-    QList<QByteArray> rv;
-    rv.reserve(d->intervals.count());
-    foreach (const ImapInterval &interval, d->intervals) {
-        rv << interval.toImapSequence();
+    if (d->savedSearchResult) {
+        return "$";
     }
 
-    QByteArray result;
+    int length = d->ranges.isEmpty() ? 0 : d->ranges.size() - 1;
+    foreach (const Range &range, d->ranges) {
+        length += sequenceLength(range.begin, range.end);
+    }
 
-    if (!rv.isEmpty()) {
-        result = rv.first();
-        QList<QByteArray>::ConstIterator it = rv.constBegin();
-        ++it;
-        for (; it != rv.constEnd(); ++it) {
-            result += ',' + (*it);
+    QByteArray result;
+    result.reserve(length);
+    for (int i = 0; i < d->ranges.size(); ++i) {
+        if (i > 0) {
+            result += ',';
         }
+        appendSequence(result, d->ranges.at(i).begin, d->ranges.at(i).end);
     }
 
     return result;
@@ -293,14 +403,28 @@ QByteArray ImapSet::toImapSequenceSet() const
 
 ImapSet ImapSet::fromImapSequenceSet(const QByteArray &sequence)
 {
-    ImapSet result;
+    if (sequence == "$") {
+        return savedSearchResult();
+    }
 
-    QList<QByteArray> intervals = sequence.split(',');
+    ImapSet result;
 
-    foreach (const QByteArray &interval, intervals) {
-        if (!interval.isEmpty()) {
-            result.add(ImapInterval::fromImapSequence(interval));
+    const char *pos = sequence.constData();
+    const char *const end = pos + sequence.size();
+    if (pos != end) {
+        result.d->ranges.reserve(sequence.count(',') + 1);
+    }
+    while (pos < end) {
+        const char *next = static_cast<const char *>(memchr(pos, ',', end - pos));
+        if (!next) {
+            next = end;
         }
+        if (next > pos) {
+            Id begin, last;
+            parseSequence(pos, next, &begin, &last);
+            result.d->append(begin, last);
+        }
+        pos = next + 1;
     }
 
     return result;
@@ -308,44 +432,306 @@ ImapSet ImapSet::fromImapSequenceSet(const QByteArray &sequence)
 
 ImapInterval::List ImapSet::intervals() const
 {
-    return d->intervals;
+    ImapInterval::List intervals;
+    intervals.reserve(d->ranges.size());
+    foreach (const Range &range, d->ranges) {
+        intervals << ImapInterval(range.begin, range.end);
+    }
+    return intervals;
+}
+
+QVector<ImapSet::Range> ImapSet::ranges() const
+{
+    return d->ranges;
 }
 
 bool ImapSet::isEmpty() const
 {
-    return d->intervals.isEmpty();
+    return d->ranges.isEmpty() && !d->savedSearchResult;
+}
+
+ImapSet ImapSet::savedSearchResult()
+{
+    ImapSet result;
+    result.d->savedSearchResult = true;
+    return result;
+}
+
+bool ImapSet::isSavedSearchResult() const
+{
+    return d->savedSearchResult;
 }
 
 void ImapSet::optimize()
 {
     // There's nothing to optimize if we have fewer than 2 intervals
-    if (d->intervals.size() < 2) {
+    if (d->ranges.size() < 2) {
         return;
     }
 
     // Sort the intervals in ascending order by their beginning value
-    std::sort(d->intervals.begin(), d->intervals.end(),
-              [](const ImapInterval &lhs, const ImapInterval &rhs) {
-                   return lhs.begin() < rhs.begin();
-              });
-
-    auto it = d->intervals.begin();
-    while (it != d->intervals.end() && it != std::prev(d->intervals.end())) {
-        auto next = std::next(it);
+    QVector<Range> &ranges = d->ranges;
+    if (!std::is_sorted(ranges.constBegin(), ranges.constEnd(), rangeBefore)) {
+        std::sort(ranges.begin(), ranges.end(), rangeBefore);
+    }
+
+    // Merge in place, keeping the merged intervals at the front
+    int last = 0;
+    for (int i = 1; i < ranges.size(); ++i) {
+        Range &current = ranges[last];
+        if (!current.end) {
+            // An open end eats up all the remaining intervals
+            break;
+        }
+        const Range &next = ranges.at(i);
         // +1 so that we also merge neighbouring intervals, e.g. 1:2,3:4 -> 1:4
-        if (it->hasDefinedEnd() && it->end() + 1 >= next->begin()) {
-            next->setBegin(it->begin());
-            if (next->hasDefinedEnd() && it->end() > next->end()) {
-                next->setEnd(it->end());
+        if (current.end + 1 >= next.begin) {
+            if (!next.end || next.end > current.end) {
+                current.end = next.end;
             }
-            it = d->intervals.erase(it);
-        } else if (!it->hasDefinedEnd()) {
-            // We can eat up all the remaining intervals
-            it = d->intervals.erase(next, d->intervals.end());
         } else {
-            ++it;
+            ranges[++last] = next;
         }
     }
+    ranges.resize(last + 1);
+}
+
+QList<ImapSet> ImapSet::split(int maximumLength) const
+{
+    if (maximumLength <= 0 || d->savedSearchResult || d->ranges.isEmpty()) {
+        return QList<ImapSet>() << *this;
+    }
+
+    QList<ImapSet> result;
+    ImapSet current;
+    int currentLength = 0;
+    foreach (const Range &range, d->ranges) {
+        const int length = sequenceLength(range.begin, range.end);
+        if (!length) {
+            continue;
+        }
+        // Including the separating comma
+        if (currentLength > 0 && currentLength + 1 + length > maximumLength) {
+            result << current;
+            current = ImapSet();
+            currentLength = 0;
+        }
+        current.d->append(range.begin, range.end);
+        currentLength += (currentLength > 0 ? 1 : 0) + length;
+    }
+    if (!current.d->ranges.isEmpty() || result.isEmpty()) {
+        result << current;
+    }
+    return result;
+}
+
+// The end of an interval without end, so the set operations can compare ends directly
+static const ImapSet::Id openEnd = std::numeric_limits<ImapSet::Id>::max();
+
+static bool isEmptyRange(const ImapSet::Range &range)
+{
+    return !range.begin && !range.end;
+}
+
+QVector<ImapSet::Range> ImapSet::normalized() const
+{
+    ImapSet optimized = *this;
+    // Invalid intervals are empty, optimize() would take them for 0:*
+    QVector<Range> &valid = optimized.d->ranges;
+    valid.erase(std::remove_if(valid.begin(), valid.end(), isEmptyRange), valid.end());
+    optimized.optimize();
+    QVector<Range> ranges = optimized.d->ranges;
+    for (int i = 0; i < ranges.size(); ++i) {
+        if (!ranges.at(i).end) {
+            ranges[i].end = openEnd;
+        }
+    }
+    return ranges;
+}
+
+/**
+ * Appends the interval from @p begin to @p end to @p set, merging it with the last one if they touch.
+ */
+static void appendNormalized(QVector<ImapSet::Range> &set, ImapSet::Id begin, ImapSet::Id end)
+{
+    if (!set.isEmpty() && set.last().end != openEnd && set.last().end + 1 >= begin) {
+        set.last().end = qMax(set.last().end, end);
+        return;
+    }
+    const ImapSet::Range range = { begin, end };
+    set.append(range);
+}
+
+ImapSet ImapSet::fromNormalized(const QVector<Range> &ranges)
+{
+    ImapSet result;
+    result.d->ranges = ranges;
+    for (int i = 0; i < result.d->ranges.size(); ++i) {
+        if (result.d->ranges.at(i).end == openEnd) {
+            result.d->ranges[i].end = 0;
+        }
+    }
+    return result;
+}
+
+bool ImapSet::contains(Id value) const
+{
+    foreach (const Range &range, d->ranges) {
+        // Invalid intervals are empty, as for the other set operations
+        if (isEmptyRange(range)) {
+            continue;
+        }
+        if (value >= range.begin && (!range.end || value <= range.end)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+ImapSet ImapSet::united(const ImapSet &other) const
+{
+    const QVector<Range> a = normalized();
+    const QVector<Range> b = other.normalized();
+    QVector<Range> result;
+    result.reserve(a.size() + b.size());
+    int i = 0;
+    int j = 0;
+    while (i < a.size() || j < b.size()) {
+        // Always take the interval that begins first
+        const Range &next = (j >= b.size() || (i < a.size() && a.at(i).begin <= b.at(j).begin)) ? a.at(i++) : b.at(j++);
+        appendNormalized(result, next.begin, next.end);
+    }
+    return fromNormalized(result);
+}
+
+ImapSet ImapSet::intersected(const ImapSet &other) const
+{
+    const QVector<Range> a = normalized();
+    const QVector<Range> b = other.normalized();
+    QVector<Range> result;
+    int i = 0;
+    int j = 0;
+    while (i < a.size() && j < b.size()) {
+        const Id begin = qMax(a.at(i).begin, b.at(j).begin);
+        const Id end = qMin(a.at(i).end, b.at(j).end);
+        if (begin <= end) {
+            appendNormalized(result, begin, end);
+        }
+        // The interval that ends first can't overlap any further one of the other set
+        if (a.at(i).end < b.at(j).end) {
+            ++i;
+        } else {
+            ++j;
+        }
+    }
+    return fromNormalized(result);
+}
+
+ImapSet ImapSet::subtracted(const ImapSet &other) const
+{
+    const QVector<Range> a = normalized();
+    const QVector<Range> b = other.normalized();
+    QVector<Range> result;
+    result.reserve(a.size());
+    int j = 0;
+    for (int i = 0; i < a.size(); ++i) {
+        Id begin = a.at(i).begin;
+        const Id end = a.at(i).end;
+        // Skip the intervals of other that end before this one
+        while (j < b.size() && b.at(j).end < begin) {
+            ++j;
+        }
+        bool covered = false;
+        for (int k = j; k < b.size() && b.at(k).begin <= end; ++k) {
+            if (b.at(k).begin > begin) {
+                appendNormalized(result, begin, b.at(k).begin - 1);
+            }
+            if (b.at(k).end >= end) {
+                covered = true;
+                break;
+            }
+            begin = b.at(k).end + 1;
+        }
+        if (!covered) {
+            appendNormalized(result, begin, end);
+        }
+    }
+    return fromNormalized(result);
+}
+
+class ImapSetBuilder::Private
+{
+public:
+    Private() : ordered(true) {}
+
+    ImapSet set;
+    // False once an interval was appended before the last one, toSet() has to optimize then
+    bool ordered;
+};
+
+ImapSetBuilder::ImapSetBuilder() :
+    d(new Private)
+{
+}
+
+ImapSetBuilder::~ImapSetBuilder()
+{
+}
+
+void ImapSetBuilder::add(ImapSet::Id value)
+{
+    add(value, value);
+}
+
+void ImapSetBuilder::add(ImapSet::Id begin, ImapSet::Id end)
+{
+    Q_ASSERT(begin >= 0);
+    QVector<ImapSet::Range> &ranges = d->set.d->ranges;
+    if (!ranges.isEmpty()) {
+        ImapSet::Range &last = ranges.last();
+        if (begin >= last.begin) {
+            if (!last.end) {
+                // Already covered by the open end
+                return;
+            }
+            // +1 so that neighbours extend the interval, e.g. 1:3 and 4 -> 1:4
+            if (begin <= last.end + 1) {
+                if (!end || end > last.end) {
+                    last.end = end;
+                }
+                return;
+            }
+        } else {
+            d->ordered = false;
+        }
+    }
+    const ImapSet::Range range = { begin, end };
+    ranges.append(range);
+}
+
+void ImapSetBuilder::reserve(int intervals)
+{
+    d->set.d->ranges.reserve(intervals);
+}
+
+bool ImapSetBuilder::isEmpty() const
+{
+    return d->set.isEmpty();
+}
+
+void ImapSetBuilder::clear()
+{
+    d->set = ImapSet();
+    d->ordered = true;
+}
+
+ImapSet ImapSetBuilder::toSet() const
+{
+    if (!d->ordered) {
+        d->set.optimize();
+        d->ordered = true;
+    }
+    return d->set;
 }
 
 QDebug &operator<<(QDebug &d, const ImapInterval &interval)
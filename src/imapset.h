@@ -26,7 +26,9 @@
 #include <QtCore/QDebug>
 #include <QtCore/QList>
 #include <QtCore/QMetaType>
+#include <QtCore/QScopedPointer>
 #include <QtCore/QSharedDataPointer>
+#include <QtCore/QVector>
 
 namespace KIMAP2
 {
@@ -136,6 +138,7 @@ private:
 /**
   Represents a set of natural numbers (1->∞) in a as compact as possible form.
   Used to address Akonadi items via the IMAP protocol or in the database.
+  The intervals are stored inline in a single vector, not as ImapInterval objects.
   This class is implicitly shared.
 */
 class KIMAP2_EXPORT ImapSet
@@ -146,6 +149,14 @@ public:
      */
     typedef qint64 Id;
 
+    /**
+      An interval as it is stored in the set, @p end is 0 for an interval without end ("n:*").
+    */
+    struct Range {
+        Id begin;
+        Id end;
+    };
+
     /**
       Constructs an empty set.
     */
@@ -183,8 +194,7 @@ public:
 
     /**
       Adds a single positive integer numbers to the set.
-      The list is sorted and split into as large as possible intervals.
-      No interval merging is performed.
+      No interval merging is performed, use ImapSetBuilder to build a set value by value.
       @param value A positive integer number
     */
     void add(Id value);
@@ -219,11 +229,32 @@ public:
     */
     ImapInterval::List intervals() const;
 
+    /**
+      Returns the intervals this set consists of, as they are stored.
+
+      Unlike intervals() this creates no ImapInterval objects, so it is the cheaper
+      way to iterate over large sets.
+    */
+    QVector<Range> ranges() const;
+
     /**
       Returns true if this set doesn't contains any values.
     */
     bool isEmpty() const;
 
+    /**
+      Returns the set that refers to the result last saved on the server with
+      SearchJob::ReturnSave (RFC 5182), written as "$".
+
+      It has no intervals, the server knows the values. Nothing should be added to it.
+    */
+    static ImapSet savedSearchResult();
+
+    /**
+      Returns true if this is the set returned by savedSearchResult().
+    */
+    bool isSavedSearchResult() const;
+
     /**
      * Optimizes the ImapSet by sorting and merging overlapping intervals.
      *
@@ -233,11 +264,96 @@ public:
      */
     void optimize();
 
+    /**
+      Splits the set into sets whose toImapSequenceSet() is at most @p maximumLength bytes,
+      keeping the order of the intervals.
+
+      Use it to keep commands within the line length servers accept. Intervals aren't
+      split, an interval longer than @p maximumLength makes a set of its own.
+      A @p maximumLength of 0 or less, an empty set and savedSearchResult() give
+      a list of only this set.
+    */
+    QList<ImapSet> split(int maximumLength) const;
+
+    /**
+      Returns true if @p value is in this set.
+    */
+    bool contains(Id value) const;
+
+    /**
+      Return the union, intersection and difference of this set and @p other.
+
+      They work on the intervals only, by merging the sorted intervals of both sets,
+      so their cost depends on the number of intervals, not on the numbers in them.
+      The results are optimized. Not for savedSearchResult().
+    */
+    ImapSet united(const ImapSet &other) const;
+    ImapSet intersected(const ImapSet &other) const;
+    ImapSet subtracted(const ImapSet &other) const;
+
 private:
+    /**
+      Returns the intervals sorted, merged and with open ends made explicit.
+    */
+    QVector<Range> normalized() const;
+    static ImapSet fromNormalized(const QVector<Range> &ranges);
+
+    friend class ImapSetBuilder;
     class Private;
     QSharedDataPointer<Private> d;
 };
 
+/**
+  Builds an ImapSet from values that arrive one at a time.
+
+  A value that is adjacent to or inside the last interval extends that interval in
+  place, so values added in ascending order cost no allocation and the set never
+  fragments. Values out of order are appended and the set is optimized once, when
+  it is requested with toSet().
+*/
+class KIMAP2_EXPORT ImapSetBuilder
+{
+public:
+    ImapSetBuilder();
+    ~ImapSetBuilder();
+
+    /**
+      Adds a single positive integer number.
+    */
+    void add(ImapSet::Id value);
+
+    /**
+      Adds the interval from @p begin to @p end, an @p end of 0 means no end ("n:*").
+    */
+    void add(ImapSet::Id begin, ImapSet::Id end);
+
+    /**
+      Reserves room for @p intervals intervals.
+    */
+    void reserve(int intervals);
+
+    /**
+      Returns true if nothing has been added.
+    */
+    bool isEmpty() const;
+
+    /**
+      Removes all values.
+    */
+    void clear();
+
+    /**
+      Returns the set of the values added so far, optimized.
+      Adding more values afterwards doesn't change the returned set.
+    */
+    ImapSet toSet() const;
+
+private:
+    Q_DISABLE_COPY(ImapSetBuilder)
+    class Private;
+    QScopedPointer<Private> d;
+};
+
 }
 
 KIMAP2_EXPORT QDebug &operator<<(QDebug &d, const KIMAP2::ImapInterval &interval);
@@ -246,5 +362,6 @@ KIMAP2_EXPORT QDebug &operator<<(QDebug &d, const KIMAP2::ImapSet &set);
 Q_DECLARE_METATYPE(KIMAP2::ImapInterval)
 Q_DECLARE_METATYPE(KIMAP2::ImapInterval::List)
 Q_DECLARE_METATYPE(KIMAP2::ImapSet)
+Q_DECLARE_TYPEINFO(KIMAP2::ImapSet::Range, Q_PRIMITIVE_TYPE);
 
 #endif
@@ -25,30 +25,366 @@
 
 #include "imapstreamparser.h"
 
+#include <QDir>
 #include <QIODevice>
 #include <QDebug>
 
+#include <limits>
+
 using namespace KIMAP2;
 
+/*
+ * The default handler, building a Message for every response.
+ *
+ * The message and its lists act as an arena that is reset after every response:
+ * storage that nobody kept a reference to is cleared without releasing the memory,
+ * and used again for the next response.
+ */
+class ImapStreamParser::MessageBuilder
+{
+public:
+    explicit MessageBuilder(ImapStreamParser &parser)
+        : parser(parser),
+        currentPayload(nullptr),
+        hasMessage(false),
+        inList(false),
+        hasPendingSublist(false),
+        literalSize(0),
+        spillFailed(false)
+    {
+    }
+
+    void ensureMessage()
+    {
+        if (!hasMessage) {
+            //We just assume that we always get a string first
+            hasMessage = true;
+            currentPayload = &message.content;
+        }
+    }
+
+    void addString(const QByteArray &string, ImapKeyword keyword = ImapKeyword::None)
+    {
+        ensureMessage();
+        if (inList) {
+            list << string;
+            keywords.append(static_cast<char>(keyword));
+        } else {
+            *currentPayload << Message::Part(string, keyword);
+        }
+    }
+
+    inline QByteArray token(const char *data, const int size)
+    {
+        if (parser.m_zeroCopy) {
+            ensureMessage();
+            //Keep the buffer alive for as long as the message references it
+            if (message.slabs.isEmpty() || !message.slabs.last().isSharedWith(parser.buffer())) {
+                message.slabs << parser.buffer();
+            }
+            return QByteArray::fromRawData(data, size);
+        }
+        return QByteArray(data, size);
+    }
+
+    inline void string(const char *data, const int size)
+    {
+        if (!nodeStack.isEmpty()) {
+            nodeStack.last().append(Message::Node(token(data, size)));
+            return;
+        }
+        if (!inList && hasMessage && parser.m_listObserver.string
+                && parser.m_listObserver.string(message, QByteArray::fromRawData(data, size))) {
+            return;
+        }
+        //Classify atoms once here, so the jobs can dispatch on the keyword
+        addString(token(data, size), imapKeyword(data, size));
+        if (hasPendingSublist) {
+            //This is the nested list that was just completed
+            sublists << qMakePair(list.size() - 1, pendingSublist);
+            pendingSublist = Message::Node();
+            hasPendingSublist = false;
+        }
+        if (inList && parser.m_listObserver.item) {
+            parser.m_listObserver.item(QByteArray::fromRawData(data, size));
+        }
+    }
+
+    inline void sublistStart()
+    {
+        nodeStack << Message::Node::makeList();
+    }
+
+    inline void sublistEnd()
+    {
+        const Message::Node node = nodeStack.takeLast();
+        if (nodeStack.isEmpty()) {
+            pendingSublist = node;
+            hasPendingSublist = true;
+        } else {
+            nodeStack.last().append(node);
+        }
+    }
+
+    inline void listStart()
+    {
+        if (!inList) {
+            inList = true;
+            if (!spareLists.isEmpty()) {
+                list = spareLists.takeLast();
+            }
+            if (parser.m_listObserver.started) {
+                parser.m_listObserver.started(message);
+            }
+        }
+    }
+
+    inline void listEnd()
+    {
+        Q_ASSERT(currentPayload);
+        Q_ASSERT(inList);
+        //The part takes over the list, the next one starts from a spare list or empty
+        *currentPayload << Message::Part(std::move(list), std::move(sublists), std::move(keywords));
+        list = QList<QByteArray>();
+        sublists.clear();
+        keywords.clear();
+        inList = false;
+        if (parser.m_listObserver.finished) {
+            parser.m_listObserver.finished();
+        }
+    }
+
+    inline void responseCodeStart()
+    {
+        ensureMessage();
+        currentPayload = &message.responseCode;
+    }
+
+    inline void responseCodeEnd()
+    {
+        currentPayload = &message.content;
+    }
+
+    bool literalStart(qint64 size)
+    {
+        sink = LiteralSink();
+        if (parser.m_literalObserver.started) {
+            literalSize = size;
+            parser.m_literalObserver.started(size);
+        }
+        if (!nodeStack.isEmpty()) {
+            //Part of a nested list
+            return false;
+        }
+        if (parser.m_literalSinkProvider) {
+            QByteArray name;
+            if (inList && !list.isEmpty()) {
+                name = list.last();
+            } else if (currentPayload && !currentPayload->isEmpty()) {
+                name = currentPayload->last().toString();
+            }
+            sink = parser.m_literalSinkProvider(hasMessage ? message : Message(), name, size);
+        }
+        if (!sink && parser.m_spillThreshold && size >= parser.m_spillThreshold && size <= std::numeric_limits<int>::max()) {
+            spill();
+        }
+        return bool(sink);
+    }
+
+    void spill()
+    {
+        const QString directory = parser.m_spillDirectory.isEmpty() ? QDir::tempPath() : parser.m_spillDirectory;
+        QSharedPointer<SpilledLiteral> literal(new SpilledLiteral(QDir(directory).filePath(QStringLiteral("kimap2-literal-XXXXXX"))));
+        if (!literal->open()) {
+            qWarning() << "Failed to create a file for a literal, keeping it in memory:" << literal->errorString();
+            return;
+        }
+        spilling = literal;
+        sink = [this](const char *data, const int size) {
+            if (spilling->write(data, size) != size) {
+                spillFailed = true;
+            }
+        };
+    }
+
+    inline void literalPart(const char *data, const int size)
+    {
+        sink(data, size);
+    }
+
+    inline void literalEnd(const QByteArray &literal)
+    {
+        if (parser.m_literalObserver.finished) {
+            parser.m_literalObserver.finished(literalSize);
+        }
+        if (!nodeStack.isEmpty()) {
+            nodeStack.last().append(Message::Node(literal));
+            return;
+        }
+        sink = LiteralSink();
+        if (spilling) {
+            const QSharedPointer<SpilledLiteral> spilled = spilling;
+            spilling.clear();
+            if (spillFailed || !spilled->mapData()) {
+                qWarning() << "Failed to write a literal to" << spilled->fileName() << ":" << spilled->errorString();
+                spillFailed = false;
+                parser.m_error = true;
+                addString(QByteArray());
+                return;
+            }
+            ensureMessage();
+            message.spilledLiterals << spilled;
+            addString(spilled->data());
+            return;
+        }
+        //If the literal went to a sink it is empty.
+        addString(literal);
+    }
+
+    void lineEnd()
+    {
+        Q_ASSERT(parser.responseReceived);
+        if (hasMessage) {
+            parser.responseReceived(message);
+            reset();
+        }
+        currentPayload = nullptr;
+    }
+
+    /*
+     * Drops the line instead of passing it on, see ImapStreamParser::setErrorRecoveryEnabled().
+     */
+    void discard(const MalformedResponseHandler &handler, const QString &reason)
+    {
+        if (inList) {
+            recycle(list);
+            inList = false;
+            if (parser.m_listObserver.finished) {
+                parser.m_listObserver.finished();
+            }
+        }
+        if (handler) {
+            handler(message, reason);
+        }
+        reset();
+        sink = LiteralSink();
+        spilling.clear();
+        spillFailed = false;
+        currentPayload = nullptr;
+    }
+
+private:
+    /*
+     * Empties @p container, keeping its memory unless somebody still references it.
+     */
+    template <typename T>
+    static void recycle(T &container)
+    {
+        if (container.isDetached()) {
+            container.erase(container.begin(), container.end());
+        } else {
+            container = T();
+        }
+    }
+
+    void recycle(QList<Message::Part> &payload)
+    {
+        QList<QList<QByteArray>> lists;
+        for (const Message::Part &part : payload) {
+            if (part.type() == Message::Part::List) {
+                lists << part.toList();
+            }
+        }
+        recycle<QList<Message::Part>>(payload);
+        for (QList<QByteArray> &l : lists) {
+            //Only lists that weren't kept by the receiver are left with a single reference
+            if (l.isDetached() && spareLists.size() < maxSpareLists) {
+                l.erase(l.begin(), l.end());
+                spareLists << l;
+            }
+        }
+    }
+
+    void reset()
+    {
+        recycle(message.content);
+        recycle(message.responseCode);
+        recycle(message.slabs);
+        message.spilledLiterals.clear();
+        nodeStack.clear();
+        sublists.clear();
+        keywords.clear();
+        pendingSublist = Message::Node();
+        hasPendingSublist = false;
+        hasMessage = false;
+    }
+
+    static const int maxSpareLists = 4;
+
+public:
+    ImapStreamParser &parser;
+    Message message;
+    QList<Message::Part> *currentPayload;
+    bool hasMessage;
+    QList<QByteArray> list;
+    bool inList;
+    QList<QList<QByteArray>> spareLists;
+    QByteArray keywords;
+    QList<Message::Node> nodeStack;
+    QList<QPair<int, Message::Node> > sublists;
+    Message::Node pendingSublist;
+    bool hasPendingSublist;
+    LiteralSink sink;
+    // Of the literal being read, for the literal observer
+    qint64 literalSize;
+    // The file the literal being read goes to, see ImapStreamParser::setSpillThreshold()
+    QSharedPointer<SpilledLiteral> spilling;
+    bool spillFailed;
+};
+
 ImapStreamParser::ImapStreamParser(QIODevice *socket, bool serverModeEnabled)
     : m_socket(socket),
     m_isServerModeEnabled(serverModeEnabled),
+    m_blockingContinuations(false),
+    m_zeroCopy(false),
     m_processing(false),
+    m_paused(false),
+    m_releaseIdleBuffers(false),
     m_position(0),
     m_readPosition(0),
     m_literalSize(0),
     m_bufferSize(16000),
+    m_minimumBufferSize(16000),
+    m_maximumBufferSize(1024 * 1024),
+    m_calmTrims(0),
+    m_trimmedBytes(0),
+    m_bytesRead(0),
+    m_literalBytesRead(0),
+    m_largestLiteral(0),
+    m_readLimit(-1),
     m_currentState(InitState),
     m_listCounter(0),
     m_stringStartPos(0),
+    m_sublistStartPos(-1),
     m_readingLiteral(false),
+    m_streamingLiteral(false),
+    m_nonSynchronizingLiteral(false),
     m_error(false),
-    m_list(nullptr)
+    m_errorRecovery(false),
+    m_skippingLine(false),
+    m_lineStart(0),
+    m_lineLiteralBytes(0),
+    m_spillThreshold(0)
 {
+    //The second buffer is only allocated once the first one needs trimming
     m_data1.resize(m_bufferSize);
-    m_data2.resize(m_bufferSize);
     m_current = &m_data1;
-    setupCallbacks();
+    m_writable = m_data1.data();
+    m_builder.reset(new MessageBuilder(*this));
+}
+
+ImapStreamParser::~ImapStreamParser()
+{
 }
 
 QByteArray &ImapStreamParser::buffer()
@@ -61,6 +397,16 @@ const QByteArray &ImapStreamParser::buffer() const
     return *m_current;
 }
 
+char *ImapStreamParser::writableBuffer()
+{
+    //In zero-copy mode the buffer may be shared with messages that are still alive.
+    //They only ever reference data before m_readPosition though, so we write behind it
+    //through the pointer taken while the buffer was detached, instead of detaching it
+    //again (which would copy the whole buffer).
+    Q_ASSERT(m_writable && m_writable == m_current->constData());
+    return m_writable;
+}
+
 char ImapStreamParser::at(int pos) const
 {
     return m_current->constData()[pos];
@@ -81,126 +427,6 @@ int ImapStreamParser::length() const
     return m_readPosition;
 }
 
-int ImapStreamParser::readFromSocket()
-{
-    if (m_readingLiteral && !m_isServerModeEnabled) {
-        Q_ASSERT(m_currentState == LiteralStringState);
-        Q_ASSERT(m_literalSize > 0);
-        const auto amountToRead = qMin(m_socket->bytesAvailable(), m_literalSize);
-        Q_ASSERT(amountToRead > 0);
-        auto pos = m_literalData.size();
-        m_literalData.resize(m_literalData.size() + amountToRead);
-        const auto readBytes = m_socket->read(m_literalData.data() + pos, amountToRead);
-        if (readBytes < 0) {
-            qWarning() << "Failed to read data";
-            return 0;
-        }
-        // qDebug() << "Read literal data: " << readBytes << m_literalSize;
-        m_literalSize -= readBytes;
-        Q_ASSERT(m_literalSize >= 0);
-        return readBytes;
-    } else {
-        if (m_readPosition == m_bufferSize) {
-            // qDebug() << "Buffer is full, trimming";
-            trimBuffer();
-        }
-        const auto amountToRead = qMin(m_socket->bytesAvailable(), qint64(m_bufferSize - m_readPosition));
-        Q_ASSERT(amountToRead > 0);
-        const auto readBytes = m_socket->read(buffer().data() + m_readPosition, amountToRead);
-        if (readBytes < 0) {
-            qWarning() << "Failed to read data";
-            return 0;
-        }
-        m_readPosition += readBytes;
-        // qDebug() << "Buffer: " << buffer().mid(0, m_readPosition);
-        // qDebug() << "Read data: " << readBytes;
-        return readBytes;
-    }
-}
-
-void ImapStreamParser::setupCallbacks()
-{
-    onString([&](const char *data, const int size) {
-        if (!m_message) {
-            //We just assume that we always get a string first
-            m_message.reset(new Message);
-            m_currentPayload = &m_message->content;
-        }
-        if (m_list) {
-            *m_list << QByteArray(data, size);
-        } else {
-            *m_currentPayload << Message::Part(QByteArray(data, size));
-        }
-    });
-
-    onListStart([&]() {
-        m_listCounter++;
-        if (m_listCounter > 1) {
-            //Parse sublists as string
-            setState(SublistString);
-            m_stringStartPos = m_position;
-        } else {
-            if (!m_list) {
-                m_list = new QList<QByteArray>;
-            }
-        }
-    });
-
-    onListEnd([&]() {
-        if (m_listCounter <= 0) {
-            qWarning() << "Brackets are off";
-            m_error = true;
-            return;
-        }
-        m_listCounter--;
-        if (m_listCounter == 0) {
-            Q_ASSERT(m_currentPayload);
-            Q_ASSERT(m_list);
-            *m_currentPayload << Message::Part(*m_list);
-            delete m_list;
-            m_list = nullptr;
-        }
-    });
-
-    onResponseCodeStart([&]() {
-        m_currentPayload = &m_message->responseCode;
-    });
-
-    onResponseCodeEnd([&]() {
-        m_currentPayload = &m_message->content;
-    });
-
-    onLiteralStart([&](const int size) {
-        m_literalData.clear();
-        m_literalData.reserve(size);
-    });
-
-    onLiteralPart([&](const char *data, const int size) {
-        m_literalData.append(QByteArray::fromRawData(data, size));
-    });
-
-    onLiteralEnd([&]() {
-        string(m_literalData.constData(), m_literalData.size());
-    });
-
-    onLineEnd([&]() {
-        if (m_list || m_listCounter != 0) {
-            qWarning() << "List parsing in progress: " << m_listCounter;
-            m_error = true;
-        }
-        if (m_literalSize || m_readingLiteral) {
-            qWarning() << "Literal parsing in progress: " << m_literalSize;
-            m_error = true;
-        }
-        Q_ASSERT(responseReceived);
-        if (m_message) {
-            responseReceived(*m_message);
-            m_message.reset(nullptr);
-        }
-        m_currentPayload = nullptr;
-    });
-}
-
 void ImapStreamParser::setState(States state)
 {
     m_lastState = m_currentState;
@@ -217,188 +443,9 @@ void ImapStreamParser::resetState()
     m_currentState = m_lastState;
 }
 
-void ImapStreamParser::processBuffer()
-{
-    if (m_error) {
-        qWarning() << "An error occurred";
-        return;
-    }
-    if (m_currentState == LiteralStringState && m_literalSize == 0 && m_readingLiteral) {
-        literalEnd();
-        resetState();
-        m_readingLiteral = false;
-    }
-
-    while (m_position < m_readPosition) {
-        Q_ASSERT(m_position < length());
-        const char c = buffer()[m_position];
-        // qDebug() << "Checking :" << c << m_position << m_readPosition << m_currentState << m_listCounter;
-        switch (m_currentState) {
-            case InitState:
-                if (c == '(') {
-                    listStart();
-                } else if (c == ')') {
-                    listEnd();
-                } else if (c == '[') {
-                    if (m_listCounter >= 1) {
-                        //Inside lists angle brackets are parsed as strings
-                        setState(AngleBracketStringState);
-                        m_stringStartPos = m_position;
-                    } else {
-                        responseCodeStart();
-                    }
-                } else if (c == ']') {
-                    responseCodeEnd();
-                } else if (c == ' ') {
-                    //Skip whitespace
-                    setState(WhitespaceState);
-                } else if (c == '\r') {
-                    setState(CRLFState);
-                } else if (c == '{') {
-                    setState(LiteralStringState);
-                    m_stringStartPos = m_position + 1;
-                } else if (c == '\"') {
-                    setState(QuotedStringState);
-                    m_stringStartPos = m_position + 1;
-                } else {
-                    setState(StringState);
-                    m_stringStartPos = m_position;
-                }
-                break;
-            case QuotedStringState:
-                if (c == '\"' && buffer().at(m_position - 1) != '\\') {
-                    //Unescaped quote
-                    resetState();
-                    const auto endPos = m_position;
-                    string(buffer().constData() + m_stringStartPos, endPos - m_stringStartPos);
-                    m_stringStartPos = 0;
-                }
-                break;
-            case LiteralStringState:
-                if (c == '}') {
-                    m_literalSize = strtol(buffer().constData() + m_stringStartPos, nullptr, 10);
-                    // qDebug() << "Found literal size: " << m_literalSize;
-                    literalStart(m_literalSize);
-                    m_readingLiteral = false;
-                    m_stringStartPos = 0;
-                    break;
-                }
-                if (!m_readingLiteral) {
-                    //Skip CRLF after literal size
-                    if (c == '\n') {
-                        m_readingLiteral = true;
-                        if (m_isServerModeEnabled && m_literalSize > 0) {
-                            sendContinuationResponse(m_literalSize);
-                        }
-                    }
-                } else {
-                    Q_ASSERT(m_position < length());
-                    if (m_literalSize) {
-                        int size = m_literalSize;
-                        if (length() < m_position + size) {
-                            //If the literal is not complete we take what is available
-                            size = length() - m_position;
-                        }
-                        literalPart(buffer().constData() + m_position, size);
-                        m_position += size;
-                        m_literalSize -= size;
-                    }
-                    if (m_literalSize <= 0) {
-                        Q_ASSERT(m_literalSize == 0);
-                        literalEnd();
-                        resetState();
-                        m_readingLiteral = false;
-                    }
-                    continue;
-                }
-                break;
-            case StringState:
-                if (c == ' ' ||
-                    c == ')' || //End of list
-                    c == '(' || //New list
-                    //FIXME because we want to concat in sublists.
-                    // c == '[' ||
-                    c == ']' ||
-                    c == '\r' || //CRLF
-                    c == '\"') {
-                    resetState();
-                    string(buffer().constData() + m_stringStartPos, m_position - m_stringStartPos);
-                    m_stringStartPos = 0;
-                    continue;
-                }
-                //Inside lists we want to parse the angle brackets as part of the string.
-                if (c == '[') {
-                    if (m_listCounter >= 1) {
-                        // qDebug() << "Switching to angle bracket state";
-                        forwardToState(AngleBracketStringState);
-                        break;
-                    }
-                }
-                break;
-            case AngleBracketStringState:
-                if (c == ']') {
-                    resetState();
-                    string(buffer().constData() + m_stringStartPos, m_position - m_stringStartPos + 1);
-                    m_stringStartPos = 0;
-                }
-                break;
-            case SublistString:
-                if (c == '(') {
-                    m_listCounter++;
-                } else if (c == ')') {
-                    m_listCounter--;
-                    if (m_listCounter <= 1) {
-                        resetState();
-                        string(buffer().constData() + m_stringStartPos, m_position - m_stringStartPos + 1);
-                        m_stringStartPos = 0;
-                    }
-                }
-                break;
-            case WhitespaceState:
-                if (c != ' ') {
-                    //Skip whitespace
-                    resetState();
-                    continue;
-                }
-                break;
-            case CRLFState:
-                if (c == '\n') {
-                    lineEnd();
-                    resetState();
-                } else {
-                    //Skip over the \r that isn't part of the CRLF
-                    resetState();
-                    continue;
-                }
-                break;
-        }
-        m_position++;
-    }
-}
-
 void ImapStreamParser::parseStream()
 {
-    if (m_processing) {
-        return;
-    }
-    if (m_error) {
-        qWarning() << "An error occurred";
-        return;
-    }
-    m_processing = true;
-    while (m_socket->bytesAvailable()) {
-        if (readFromSocket() <= 0) {
-            //If we're not making progress we could loop forever,
-            //and given that we check beforehand if there is data,
-            //this should never happen.
-            qWarning() << "Read nothing from the socket.";
-            m_error = true;
-            Q_ASSERT(false);
-            return;
-        };
-        processBuffer();
-    }
-    m_processing = false;
+    parseStream(*m_builder);
 }
 
 void ImapStreamParser::trimBuffer()
@@ -407,27 +454,90 @@ void ImapStreamParser::trimBuffer()
     if (m_stringStartPos) {
         offset = qMin(m_stringStartPos, m_position);
     }
+    if (m_sublistStartPos >= 0) {
+        offset = qMin(m_sublistStartPos, offset);
+    }
 
     auto remainderSize = m_readPosition - offset;
     Q_ASSERT( remainderSize >= 0);
+    const int newSize = adaptedBufferSize(remainderSize);
     QByteArray *otherBuffer;
     if (m_current == &m_data1) {
         otherBuffer = &m_data2;
     } else {
         otherBuffer = &m_data1;
     }
+    if (!otherBuffer->isDetached() || otherBuffer->size() != newSize) {
+        //Borrowed messages still reference the buffer, leave it to them.
+        *otherBuffer = QByteArray(newSize, Qt::Uninitialized);
+    }
     if (remainderSize) {
         otherBuffer->replace(0, remainderSize, buffer().constData() + offset, remainderSize);
+        m_trimmedBytes += remainderSize;
+#ifdef KIMAP2_PARSER_COUNTERS
+        m_counters.trimCopies++;
+        m_counters.trimCopiedBytes += remainderSize;
+#endif
     }
+#ifdef KIMAP2_PARSER_COUNTERS
+    m_counters.trims++;
+#endif
     m_current = otherBuffer;
+    //Still detached, either allocated above or not shared
+    m_writable = otherBuffer->data();
+    m_bufferSize = newSize;
     m_readPosition = remainderSize;
     m_position -= offset;
     if (m_stringStartPos) {
         m_stringStartPos -= offset;
     }
+    if (m_sublistStartPos >= 0) {
+        m_sublistStartPos -= offset;
+    }
     // qDebug() << "Buffer after trim: " << mid(0, m_readPosition);
 }
 
+int ImapStreamParser::adaptedBufferSize(int remainderSize)
+{
+    int size = m_bufferSize;
+    const qint64 pending = m_socket->bytesAvailable();
+    if (pending >= m_bufferSize) {
+        //The data arrives faster than we read it, so read it in larger blocks
+        size = m_bufferSize * 2;
+        m_calmTrims = 0;
+    } else if (pending + remainderSize < m_bufferSize / 4) {
+        //Only shrink once traffic stayed low for a while, so we don't oscillate
+        if (++m_calmTrims >= 8) {
+            size = m_bufferSize / 2;
+            m_calmTrims = 0;
+        }
+    } else {
+        m_calmTrims = 0;
+    }
+    size = qBound(m_minimumBufferSize, size, m_maximumBufferSize);
+    //Leave room to make progress on tokens that don't fit into the buffer
+    return qMax(size, remainderSize * 2);
+}
+
+void ImapStreamParser::releaseIdleBuffers()
+{
+    //Only between two responses, where nothing refers to the buffer anymore
+    const bool idle = m_currentState == InitState && !m_readingLiteral && !m_listCounter
+                      && m_position == m_readPosition && m_readPosition > 0
+                      && at(m_readPosition - 1) == '\n' && !m_paused;
+    if (!idle || m_socket->bytesAvailable()) {
+        return;
+    }
+    //Borrowed messages hold their own reference to the data
+    m_data1 = QByteArray();
+    m_data2 = QByteArray();
+    m_literalChunk = QByteArray();
+    m_current = &m_data1;
+    m_writable = Q_NULLPTR;
+    m_position = 0;
+    m_readPosition = 0;
+}
+
 int ImapStreamParser::availableDataSize() const
 {
     return m_socket->bytesAvailable() + length() - m_position;
@@ -435,35 +545,67 @@ int ImapStreamParser::availableDataSize() const
 
 QByteArray ImapStreamParser::readUntilCommandEnd()
 {
+    //Only looks for the end of the command, the command itself is returned as is.
+    struct CommandEndHandler {
+        ImapStreamParser &parser;
+        QByteArray &result;
+        const int startPos;
+
+        void string(const char *, int) {}
+        void listStart() {}
+        void listEnd() {}
+        void sublistStart() {}
+        void sublistEnd() {}
+        void responseCodeStart() {}
+        void responseCodeEnd() {}
+        bool literalStart(qint64)
+        {
+            return true;
+        }
+        void literalPart(const char *, int) {}
+        void literalEnd(const QByteArray &) {}
+        void lineEnd()
+        {
+            result = parser.mid(startPos, parser.m_position - startPos - 1);
+        }
+    };
+
     QByteArray result;
-    auto startPos = m_position;
-    onLineEnd([&result, this, startPos]() {
-        result = mid(startPos, m_position - startPos - 1);
-    });
+    CommandEndHandler handler{*this, result, m_position};
+    m_blockingContinuations = true;
     Q_FOREVER {
         if (!m_socket->bytesAvailable()) {
             if (!m_socket->waitForReadyRead(10000)) {
                 qWarning() << "No data available";
-                return result;
+                break;
             }
         }
-        parseStream();
+        parseStream(handler);
         if (!result.isEmpty() && m_currentState == InitState) {
             // qDebug() << "Got a result: " << m_readingLiteral;
             // result.append(m_literalData);
+            qDebug() << "Read until command end: " << result;
             break;
         }
     }
-    qDebug() << "Read until command end: " << result;
+    m_blockingContinuations = false;
     return result;
 }
 
+bool ImapStreamParser::isServerModeEnabled() const
+{
+    return m_isServerModeEnabled;
+}
+
 void ImapStreamParser::sendContinuationResponse(qint64 size)
 {
     QByteArray block = "+ Ready for literal data (expecting " +
                        QByteArray::number(size) + " bytes)\r\n";
     m_socket->write(block);
-    m_socket->waitForBytesWritten(30000);
+    if (m_blockingContinuations) {
+        m_socket->waitForBytesWritten(30000);
+    }
+    //Otherwise the event loop writes it, the client doesn't send anything before
 }
 
 void ImapStreamParser::onResponseReceived(std::function<void(const Message &)> f)
@@ -471,11 +613,313 @@ void ImapStreamParser::onResponseReceived(std::function<void(const Message &)> f
     responseReceived = f;
 }
 
+void ImapStreamParser::setZeroCopyEnabled(bool enabled)
+{
+    m_zeroCopy = enabled;
+}
+
+bool ImapStreamParser::isZeroCopyEnabled() const
+{
+    return m_zeroCopy;
+}
+
+QByteArray ImapStreamParser::switchDevice(QIODevice *device)
+{
+    //While the response is handled we're still on its line feed
+    const int start = m_currentState == CRLFState ? m_position + 1 : m_position;
+    QByteArray unparsed;
+    if (start < m_readPosition) {
+        unparsed = QByteArray(buffer().constData() + start, m_readPosition - start);
+        m_readPosition = start;
+    }
+    m_socket = device;
+    return unparsed;
+}
+
+void ImapStreamParser::setLiteralSinkProvider(LiteralSinkProvider provider)
+{
+    m_literalSinkProvider = provider;
+}
+
+void ImapStreamParser::setBufferSizeLimits(int minimum, int maximum)
+{
+    Q_ASSERT(minimum > 0 && minimum <= maximum);
+    m_minimumBufferSize = minimum;
+    m_maximumBufferSize = maximum;
+}
+
+void ImapStreamParser::setListObserver(const ListObserver &observer)
+{
+    m_listObserver = observer;
+}
+
+void ImapStreamParser::setLiteralObserver(const LiteralObserver &observer)
+{
+    m_literalObserver = observer;
+}
+
+void ImapStreamParser::setSpillThreshold(qint64 size, const QString &directory)
+{
+    m_spillThreshold = size;
+    m_spillDirectory = directory;
+}
+
+qint64 ImapStreamParser::spillThreshold() const
+{
+    return m_spillThreshold;
+}
+
+void ImapStreamParser::setTrafficObserver(TrafficObserver observer)
+{
+    m_trafficObserver = observer;
+}
+
+int ImapStreamParser::bufferSize() const
+{
+    return m_bufferSize;
+}
+
+qint64 ImapStreamParser::trimmedBytes() const
+{
+    return m_trimmedBytes;
+}
+
+qint64 ImapStreamParser::bytesRead() const
+{
+    return m_bytesRead;
+}
+
+const ParserCounters &ImapStreamParser::counters() const
+{
+    return m_counters;
+}
+
+void ImapStreamParser::countStateBytes(States state, qint64 bytes)
+{
+    switch (state) {
+    case InitState:
+        m_counters.initBytes += bytes;
+        break;
+    case QuotedStringState:
+        m_counters.quotedStringBytes += bytes;
+        break;
+    case LiteralStringState:
+        m_counters.literalStringBytes += bytes;
+        break;
+    case StringState:
+        m_counters.stringBytes += bytes;
+        break;
+    case WhitespaceState:
+        m_counters.whitespaceBytes += bytes;
+        break;
+    case AngleBracketStringState:
+        m_counters.angleBracketStringBytes += bytes;
+        break;
+    case CRLFState:
+        m_counters.crlfBytes += bytes;
+        break;
+    }
+}
+
+void ImapStreamParser::countRead(qint64 bytes)
+{
+    m_counters.reads++;
+    if (bytes < ParserCounters::smallReadSize) {
+        m_counters.smallReads++;
+    }
+}
+
+qint64 ImapStreamParser::literalBytesRead() const
+{
+    return m_literalBytesRead;
+}
+
+qint64 ImapStreamParser::literalBytesPending() const
+{
+    return m_readingLiteral ? m_literalSize : 0;
+}
+
+qint64 ImapStreamParser::bufferCapacity() const
+{
+    return m_data1.capacity() + m_data2.capacity();
+}
+
+void ImapStreamParser::setReleaseIdleBuffers(bool release)
+{
+    m_releaseIdleBuffers = release;
+}
+
+bool ImapStreamParser::releasesIdleBuffers() const
+{
+    return m_releaseIdleBuffers;
+}
+
+qint64 ImapStreamParser::literalBytesBuffered() const
+{
+    return m_readingLiteral ? m_literalData.size() : 0;
+}
+
+qint64 ImapStreamParser::largestLiteral() const
+{
+    return m_largestLiteral;
+}
+
 bool ImapStreamParser::error() const
 {
     return m_error;
 }
 
+void ImapStreamParser::reset()
+{
+    m_builder.reset(new MessageBuilder(*this));
+    //Left set when parsing stopped on an error
+    m_processing = false;
+    m_position = 0;
+    m_readPosition = 0;
+    m_literalSize = 0;
+    m_currentState = InitState;
+    m_lastState = InitState;
+    m_listCounter = 0;
+    m_stringStartPos = 0;
+    m_sublistStartPos = -1;
+    m_readingLiteral = false;
+    m_streamingLiteral = false;
+    m_nonSynchronizingLiteral = false;
+    m_error = false;
+    m_malformedReason.clear();
+    m_skippingLine = false;
+    m_limitReason.clear();
+    m_lineStart = m_bytesRead;
+    m_lineLiteralBytes = m_literalBytesRead;
+    m_literalData.clear();
+    m_literalChunk.clear();
+}
+
+void ImapStreamParser::setErrorRecoveryEnabled(bool enabled, MalformedResponseHandler handler)
+{
+    m_errorRecovery = enabled;
+    m_malformedResponseHandler = handler;
+}
+
+void ImapStreamParser::setReadLimit(qint64 bytes)
+{
+    m_readLimit = bytes;
+}
+
+qint64 ImapStreamParser::readLimit() const
+{
+    return m_readLimit;
+}
+
+qint64 ImapStreamParser::readableBytes() const
+{
+    const qint64 available = m_socket->bytesAvailable();
+    return m_readLimit >= 0 ? qMin(available, m_readLimit) : available;
+}
+
+bool ImapStreamParser::isErrorRecoveryEnabled() const
+{
+    return m_errorRecovery;
+}
+
+void ImapStreamParser::markMalformed(const char *reason)
+{
+    //The first problem is the interesting one
+    if (m_malformedReason.isEmpty()) {
+        m_malformedReason = QString::fromLatin1(reason);
+    }
+}
+
+void ImapStreamParser::malformedLineEnd(MessageBuilder &builder)
+{
+    builder.discard(m_malformedResponseHandler, m_malformedReason);
+}
+
+void ImapStreamParser::setLimits(const ParseLimits &limits, MalformedResponseHandler handler)
+{
+    m_limits = limits;
+    m_limitHandler = handler;
+}
+
+const ParseLimits &ImapStreamParser::limits() const
+{
+    return m_limits;
+}
+
+qint64 ImapStreamParser::lineBytes() const
+{
+    //Literals announced on the line but not read yet make up for the unread data
+    return m_bytesRead - (m_readPosition - m_position) - m_lineStart - (m_literalBytesRead - m_lineLiteralBytes);
+}
+
+bool ImapStreamParser::exceedLimit(const QString &what)
+{
+    qWarning() << "Parse limit exceeded by" << what;
+    //The first problem is the interesting one
+    if (m_limitReason.isEmpty()) {
+        m_limitReason = what;
+    }
+    m_skippingLine = true;
+    if (!m_limitHandler) {
+        m_error = true;
+        return false;
+    }
+    return true;
+}
+
+bool ImapStreamParser::checkLimits()
+{
+    const bool inToken = m_currentState == StringState || m_currentState == QuotedStringState
+                         || m_currentState == AngleBracketStringState;
+    if (!m_skippingLine) {
+        const qint64 tokenLimit = m_limits.tokenSize;
+        if (tokenLimit && inToken && m_position - m_stringStartPos > tokenLimit) {
+            if (!exceedLimit(QStringLiteral("a token of more than %1 bytes").arg(tokenLimit))) {
+                return false;
+            }
+        } else if (tokenLimit && m_currentState == LiteralStringState && !m_readingLiteral
+                   && m_stringStartPos && m_position - m_stringStartPos > tokenLimit) {
+            if (!exceedLimit(QStringLiteral("a literal size of more than %1 bytes").arg(tokenLimit))) {
+                return false;
+            }
+        } else if (tokenLimit && m_sublistStartPos >= 0 && m_position - m_sublistStartPos > tokenLimit) {
+            if (!exceedLimit(QStringLiteral("a nested list of more than %1 bytes").arg(tokenLimit))) {
+                return false;
+            }
+        } else if (m_limits.lineSize && lineBytes() > m_limits.lineSize) {
+            if (!exceedLimit(QStringLiteral("a response of more than %1 bytes").arg(m_limits.lineSize))) {
+                return false;
+            }
+        } else {
+            return true;
+        }
+    }
+    //Nothing of the line is passed on anymore, so trimBuffer() doesn't have to keep it.
+    //Two bytes stay, for escaped quotes and so that the start of a literal8 isn't mistaken.
+    if (inToken && m_position - 2 > m_stringStartPos) {
+        m_stringStartPos = m_position - 2;
+    }
+    if (m_sublistStartPos >= 0) {
+        m_sublistStartPos = m_position;
+    }
+    return true;
+}
+
+void ImapStreamParser::limitedLineEnd(MessageBuilder &builder)
+{
+    builder.discard(m_limitHandler, m_limitReason);
+}
+
+void ImapStreamParser::setPaused(bool paused)
+{
+    m_paused = paused;
+}
+
+bool ImapStreamParser::isPaused() const
+{
+    return m_paused;
+}
+
 QByteArray ImapStreamParser::currentBuffer() const
 {
     return mid(0, m_readPosition);
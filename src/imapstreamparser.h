@@ -23,20 +23,28 @@
 #define KIMAP2_IMAPSTREAMPARSER_P_H
 
 #include "kimap2_export.h"
+#include "parselimits.h"
+#include "parsercounters.h"
 
 #include <QtCore/QByteArray>
 #include <QtCore/QList>
 #include <QtCore/QScopedPointer>
+#include <QtCore/QIODevice>
+#include <QtCore/QString>
+#include <QtCore/QDebug>
 #include <functional>
+#include <limits>
 #include <message_p.h>
 
-class QIODevice;
-
 namespace KIMAP2
 {
 
 /**
   Parser for IMAP messages that operates on a local socket stream.
+
+  The tokenizer is a template that calls a handler directly for every token,
+  so the handler can be inlined. parseStream() uses the default handler, which builds
+  a Message for each response and passes it to the callback set with onResponseReceived().
 */
 class KIMAP2_EXPORT ImapStreamParser
 {
@@ -46,11 +54,23 @@ public:
      * @param socket the local socket to work with.
      * @param serverModeEnabled true if the parser has to assume we're writing a server (e.g. sends
      * continuation message automatically)
+     *
+     * In server mode parseStream() parses commands instead of responses: call it whenever the
+     * socket has data, and every complete command is passed to the callback set with
+     * onResponseReceived(), with its literals inline. Continuation requests for synchronizing
+     * literals are written without waiting for them to be sent, non-synchronizing literals
+     * ({N+}, LITERAL+ and LITERAL-) get none. Nothing blocks, so one thread can serve many
+     * connections with a parser each.
      */
     explicit ImapStreamParser(QIODevice *socket, bool serverModeEnabled = false);
+    ~ImapStreamParser();
+
+    bool isServerModeEnabled() const;
 
     /**
      * Return everything that remained from the command.
+     *
+     * Blocks until the command is complete, including the continuation requests it needs.
      * @return the remaining command data
      */
     QByteArray readUntilCommandEnd();
@@ -59,27 +79,275 @@ public:
 
     void parseStream();
 
+    /**
+     * Parses the available data with a custom handler instead of building Messages.
+     *
+     * The handler has to provide the following members:
+     * @code
+     * void string(const char *data, int size);     // An atom, quoted string or nested list, pointing into the receive buffer
+     * void listStart();                            // The first level list
+     * void listEnd();
+     * void sublistStart();                         // A list nested in the first level list
+     * void sublistEnd();                           // Followed by string() with the complete nested list if it was the outermost one
+     * void responseCodeStart();
+     * void responseCodeEnd();
+     * bool literalStart(qint64 size);              // Also for literal8 (~{N}). Return true to receive the literal through literalPart()
+     * void literalPart(const char *data, int size);
+     * void literalEnd(const QByteArray &literal);  // The complete literal, or empty if it went to literalPart()
+     * void lineEnd();
+     * @endcode
+     *
+     * The data passed to string() and literalPart() is only valid for the duration of the call.
+     */
+    template <typename Handler>
+    void parseStream(Handler &handler);
+
     void onResponseReceived(std::function<void(const Message &)>);
 
     bool error() const;
 
+    /**
+     * Drops what was read but not parsed yet, including an unfinished response, and clears the
+     * error, e.g. before the device connects again. The settings and statistics are kept.
+     *
+     * Must not be called while parsing.
+     */
+    void reset();
+
+    /**
+     * Stops parsing at the end of the current response, until unpaused.
+     *
+     * Nothing is read from the device while paused. Call parseStream() after unpausing to continue
+     * with what was already read, since the device won't signal that data again.
+     */
+    void setPaused(bool paused);
+    bool isPaused() const;
+
     QByteArray currentBuffer() const;
 
+    /**
+     * Enables the zero-copy mode.
+     *
+     * In zero-copy mode the parts of a Message reference the receive buffer instead of copying
+     * every token. Such messages are borrowed (see Message::isBorrowed()), and the buffers they
+     * reference are not reused by the parser while they are still alive.
+     */
+    void setZeroCopyEnabled(bool enabled);
+    bool isZeroCopyEnabled() const;
+
+    /**
+     * Reads from @p device from now on, e.g. a decompressing wrapper of the socket.
+     *
+     * Returns the data that was already read from the previous device but not parsed yet,
+     * so that it can be passed through the new one. When called while a response is handled,
+     * that is everything following the response.
+     */
+    QByteArray switchDevice(QIODevice *device);
+
+    typedef std::function<void(const char *data, const int size)> LiteralSink;
+    typedef std::function<LiteralSink(const Message &message, const QByteArray &name, qint64 size)> LiteralSinkProvider;
+
+    /**
+     * Installs a provider that is asked for a sink whenever a literal starts.
+     *
+     * The provider receives the response parsed so far, the token preceding the literal (e.g. the
+     * attribute name of a FETCH item) and the size of the literal. If it returns a sink, the literal
+     * is passed to it in chunks of at most the buffer size instead of being accumulated,
+     * and an empty string takes its place in the Message.
+     */
+    void setLiteralSinkProvider(LiteralSinkProvider provider);
+
+    /**
+     * Observes the first level list of a response while it is parsed.
+     */
+    struct ListObserver {
+        /**
+         * Called with the response parsed so far when the list starts.
+         */
+        std::function<void(const Message &message)> started;
+        /**
+         * Called for every string in the list. Literals are only passed to the literal sink provider.
+         */
+        std::function<void(const QByteArray &item)> item;
+        std::function<void()> finished;
+        /**
+         * Called with the response parsed so far for every string outside of lists, e.g. the
+         * numbers of a SEARCH response. Returning true drops the string from the response.
+         */
+        std::function<bool(const Message &message, const QByteArray &string)> string;
+    };
+
+    void setListObserver(const ListObserver &observer);
+
+    /**
+     * Observes the literals of all responses, including those in nested lists.
+     */
+    struct LiteralObserver {
+        std::function<void(qint64 size)> started;
+        std::function<void(qint64 size)> finished;
+    };
+
+    void setLiteralObserver(const LiteralObserver &observer);
+
+    /**
+     * Writes literals of at least @p size bytes to a temporary file in @p directory instead of
+     * memory, unless they go to a sink. 0, the default, disables it.
+     *
+     * The file is mapped once the literal is complete, the Message points into the mapping and
+     * keeps the file in Message::spilledLiterals. A literal that can't be written is an error.
+     */
+    void setSpillThreshold(qint64 size, const QString &directory = QString());
+    qint64 spillThreshold() const;
+
+    typedef std::function<void(const char *data, const int size)> TrafficObserver;
+
+    /**
+     * Installs an observer that receives the raw data as it is read from the socket.
+     *
+     * The data is only valid for the duration of the call.
+     */
+    void setTrafficObserver(TrafficObserver observer);
+
+    /**
+     * Reads at most @p bytes from the device until it is called again, e.g. for bandwidth
+     * shaping. -1, the default, is no limit. What was already read is still parsed.
+     */
+    void setReadLimit(qint64 bytes);
+    qint64 readLimit() const;
+
+    typedef std::function<void(const Message &partial, const QString &reason)> MalformedResponseHandler;
+
+    /**
+     * Drops malformed responses instead of failing, e.g. unbalanced brackets.
+     *
+     * Parsing continues with the next line, a CRLF within a literal doesn't end the response.
+     * The response parsed up to that point is passed to @p handler instead of the response callback.
+     * Custom handlers of parseStream(Handler &) get lineEnd() for a malformed response as usual.
+     * Errors of the device or of spilled literals still stop the parser.
+     */
+    void setErrorRecoveryEnabled(bool enabled, MalformedResponseHandler handler = MalformedResponseHandler());
+    bool isErrorRecoveryEnabled() const;
+
+    /**
+     * Bounds the size of tokens, lines and literals, see ParseLimits.
+     *
+     * A line that goes over a limit is skipped up to its end: the rest of its tokens and literals
+     * are dropped as they arrive instead of being buffered, and the line parsed up to the limit is
+     * passed to @p handler instead of the response callback, with what went over the limit.
+     * Custom handlers of parseStream(Handler &) get lineEnd() for such a line as usual.
+     * Without a handler the line is dropped all the same, and going over a limit is an error.
+     * The limits apply in server mode as well, where a command whose synchronizing literal goes
+     * over the limit ends without the literal, since the client waits for a continuation request.
+     */
+    void setLimits(const ParseLimits &limits, MalformedResponseHandler handler = MalformedResponseHandler());
+    const ParseLimits &limits() const;
+
+    /**
+     * Sets the range in which the receive buffer size adapts.
+     *
+     * The buffer grows while more data is waiting on the socket than fits into it, and shrinks
+     * again once traffic stayed low for a while. A single token that doesn't fit into
+     * @p maximum still grows the buffer as far as necessary.
+     */
+    void setBufferSizeLimits(int minimum, int maximum);
+    int bufferSize() const;
+
+    /**
+     * Returns the number of bytes that were copied to move unfinished tokens to the other buffer.
+     */
+    qint64 trimmedBytes() const;
+
+    /**
+     * Returns the number of bytes read from the device so far.
+     */
+    qint64 bytesRead() const;
+
+    /**
+     * Returns what the parser did so far, in builds with KIMAP2_PARSER_COUNTERS.
+     */
+    const ParserCounters &counters() const;
+
+    /**
+     * Returns the number of bytes announced by the literals parsed so far.
+     */
+    qint64 literalBytesRead() const;
+
+    /**
+     * Returns how much of the literal being read is still to come, or 0 outside of a literal.
+     */
+    qint64 literalBytesPending() const;
+
+    /**
+     * Returns the memory allocated for the receive buffers.
+     */
+    qint64 bufferCapacity() const;
+
+    /**
+     * Frees the receive buffers whenever the parser runs out of data between two responses.
+     *
+     * Meant for processes with many mostly idle connections, where the buffers of the idle ones
+     * add up. A busy connection pays with an allocation per burst of data. Disabled by default.
+     */
+    void setReleaseIdleBuffers(bool release);
+    bool releasesIdleBuffers() const;
+
+    /**
+     * Returns how much of the literal being read is held in memory, i.e. 0 for a literal that
+     * goes to a sink.
+     */
+    qint64 literalBytesBuffered() const;
+
+    /**
+     * Returns the size of the largest literal announced so far.
+     */
+    qint64 largestLiteral() const;
+
 private:
+    class MessageBuilder;
 
     /**
      * Remove already read data from the internal buffer if necessary.
      */
     void trimBuffer();
+    int adaptedBufferSize(int remainderSize);
+    void releaseIdleBuffers();
 
     /**
      * Inform the client to send more literal data.
      */
     void sendContinuationResponse(qint64 size);
 
-
-    int readFromSocket();
-    void processBuffer();
+    /**
+     * Returns how much can be read from the device now, see setReadLimit().
+     */
+    qint64 readableBytes() const;
+
+    template <typename Handler>
+    int readFromSocket(Handler &handler);
+    template <typename Handler>
+    void processBuffer(Handler &handler);
+    template <typename Handler>
+    void lineEnd(Handler &handler);
+    template <typename Handler>
+    void malformedLineEnd(Handler &handler);
+    void malformedLineEnd(MessageBuilder &builder);
+    void markMalformed(const char *reason);
+    template <typename Handler>
+    void limitedLineEnd(Handler &handler);
+    void limitedLineEnd(MessageBuilder &builder);
+    /**
+     * Passes a token on, unless the line is being skipped.
+     */
+    template <typename Handler>
+    void string(Handler &handler, const char *data, int size);
+    /**
+     * Checks the token, line and literal being read against the limits, see setLimits().
+     * Returns false if that stopped the parser.
+     */
+    bool checkLimits();
+    bool exceedLimit(const QString &what);
+    // The bytes of the current line consumed so far, without its literals
+    qint64 lineBytes() const;
 
     char at(int pos) const;
     QByteArray mid(int start, int end = -1)  const;
@@ -88,20 +356,36 @@ private:
 
     QByteArray &buffer();
     const QByteArray &buffer() const;
+    char *writableBuffer();
 
-    QScopedPointer<Message> m_message;
-    QList<Message::Part> *m_currentPayload;
+    QScopedPointer<MessageBuilder> m_builder;
 
     QIODevice *m_socket;
     bool m_isServerModeEnabled;
+    // Set by readUntilCommandEnd(), which can wait for the continuation requests to be sent
+    bool m_blockingContinuations;
+    bool m_zeroCopy;
     bool m_processing;
+    bool m_paused;
+    bool m_releaseIdleBuffers;
     int m_position;
     int m_readPosition;
     qint64 m_literalSize;
     QByteArray m_data1;
     QByteArray m_data2;
     QByteArray *m_current;
+    // The data of m_current, taken from it while it wasn't shared, see writableBuffer()
+    char *m_writable;
     int m_bufferSize;
+    int m_minimumBufferSize;
+    int m_maximumBufferSize;
+    int m_calmTrims;
+    qint64 m_trimmedBytes;
+    qint64 m_bytesRead;
+    qint64 m_literalBytesRead;
+    qint64 m_largestLiteral;
+    qint64 m_readLimit;
+    ParserCounters m_counters;
 
     enum States {
         InitState,
@@ -110,7 +394,6 @@ private:
         StringState,
         WhitespaceState,
         AngleBracketStringState,
-        SublistString,
         CRLFState
     };
     States m_currentState;
@@ -120,73 +403,505 @@ private:
     void forwardToState(States state);
     void resetState();
 
+    // Only called in builds with KIMAP2_PARSER_COUNTERS
+    void countStateBytes(States state, qint64 bytes);
+    void countRead(qint64 bytes);
+
     int m_listCounter;
     int m_stringStartPos;
+    int m_sublistStartPos;
     bool m_readingLiteral;
+    bool m_streamingLiteral;
+    // A {N+} literal, which the client sends without waiting for a continuation request
+    bool m_nonSynchronizingLiteral;
     bool m_error;
+    bool m_errorRecovery;
+    // Why the current line is dropped, if it is, see setErrorRecoveryEnabled()
+    QString m_malformedReason;
+    ParseLimits m_limits;
+    MalformedResponseHandler m_limitHandler;
+    // The current line went over a limit and is skipped, see setLimits()
+    bool m_skippingLine;
+    QString m_limitReason;
+    // Where the current line started in the stream, and the literal bytes announced before it
+    qint64 m_lineStart;
+    qint64 m_lineLiteralBytes;
 
-    std::function<void(const char *data, const int size)> string;
-    std::function<void()> listStart;
-    std::function<void()> listEnd;
-    std::function<void()> responseCodeStart;
-    std::function<void()> responseCodeEnd;
-    std::function<void(int size)> literalStart;
-    std::function<void(const char *data, const int size)> literalPart;
-    std::function<void()> literalEnd;
-    std::function<void()> lineEnd;
+    std::function<void(const Message &)> responseReceived;
+    MalformedResponseHandler m_malformedResponseHandler;
 
-    void onString(std::function<void(const char *data, const int size)> f)
-    {
-        string = f;
-    }
+    QByteArray m_literalData;
+    QByteArray m_literalChunk;
+    LiteralSinkProvider m_literalSinkProvider;
+    ListObserver m_listObserver;
+    LiteralObserver m_literalObserver;
+    qint64 m_spillThreshold;
+    QString m_spillDirectory;
+    TrafficObserver m_trafficObserver;
+};
 
-    void onListStart(std::function<void()> f)
-    {
-        listStart = f;
+template <typename Handler>
+void ImapStreamParser::parseStream(Handler &handler)
+{
+    if (m_processing || m_paused) {
+        return;
     }
-
-    void onListEnd(std::function<void()> f)
-    {
-        listEnd = f;
+    if (m_error) {
+        qWarning() << "An error occurred";
+        return;
     }
-
-    void onResponseCodeStart(std::function<void()> f)
-    {
-        responseCodeStart = f;
+    m_processing = true;
+    if (m_position < m_readPosition) {
+        //The rest of the buffer when we were paused
+        processBuffer(handler);
     }
-
-    void onResponseCodeEnd(std::function<void()> f)
-    {
-        responseCodeEnd = f;
+    while (!m_paused && readableBytes()) {
+        if (readFromSocket(handler) <= 0) {
+            //If we're not making progress we could loop forever,
+            //and given that we check beforehand if there is data,
+            //this should never happen.
+            qWarning() << "Read nothing from the socket.";
+            m_error = true;
+            Q_ASSERT(false);
+            return;
+        };
+        processBuffer(handler);
     }
-
-    void onLiteralStart(std::function<void(int size)> f)
-    {
-        literalStart = f;
+    if (m_releaseIdleBuffers) {
+        releaseIdleBuffers();
     }
+    m_processing = false;
+}
 
-    void onLiteralPart(std::function<void(const char *data, const int size)> f)
-    {
-        literalPart = f;
+template <typename Handler>
+int ImapStreamParser::readFromSocket(Handler &handler)
+{
+    //Literals in nested lists stay in the buffer, since the nested list is also passed on as a whole
+    if (m_readingLiteral && !m_isServerModeEnabled && m_listCounter <= 1) {
+        Q_ASSERT(m_currentState == LiteralStringState);
+        Q_ASSERT(m_literalSize > 0);
+        if (m_streamingLiteral) {
+            //Never hold more than a buffer worth of the literal in memory
+            const auto amountToRead = qMin(qMin(readableBytes(), m_literalSize), qint64(m_bufferSize));
+            Q_ASSERT(amountToRead > 0);
+            m_literalChunk.resize(amountToRead);
+            const auto readBytes = m_socket->read(m_literalChunk.data(), amountToRead);
+            if (readBytes < 0) {
+                qWarning() << "Failed to read data";
+                return 0;
+            }
+            if (m_trafficObserver) {
+                m_trafficObserver(m_literalChunk.constData(), readBytes);
+            }
+            m_bytesRead += readBytes;
+            if (m_readLimit > 0) {
+                m_readLimit -= readBytes;
+            }
+#ifdef KIMAP2_PARSER_COUNTERS
+            countRead(readBytes);
+            countStateBytes(LiteralStringState, readBytes);
+#endif
+            if (!m_skippingLine) {
+                handler.literalPart(m_literalChunk.constData(), readBytes);
+            }
+            m_literalSize -= readBytes;
+            Q_ASSERT(m_literalSize >= 0);
+            return readBytes;
+        }
+        const auto amountToRead = qMin(readableBytes(), m_literalSize);
+        Q_ASSERT(amountToRead > 0);
+        auto pos = m_literalData.size();
+        m_literalData.resize(m_literalData.size() + amountToRead);
+        const auto readBytes = m_socket->read(m_literalData.data() + pos, amountToRead);
+        if (readBytes < 0) {
+            qWarning() << "Failed to read data";
+            return 0;
+        }
+        if (m_trafficObserver) {
+            m_trafficObserver(m_literalData.constData() + pos, readBytes);
+        }
+        m_bytesRead += readBytes;
+        if (m_readLimit > 0) {
+            m_readLimit -= readBytes;
+        }
+#ifdef KIMAP2_PARSER_COUNTERS
+        countRead(readBytes);
+        countStateBytes(LiteralStringState, readBytes);
+#endif
+        // qDebug() << "Read literal data: " << readBytes << m_literalSize;
+        m_literalSize -= readBytes;
+        Q_ASSERT(m_literalSize >= 0);
+        return readBytes;
+    } else {
+        if (buffer().isEmpty()) {
+            //Released while idle, see setReleaseIdleBuffers()
+            *m_current = QByteArray(m_bufferSize, Qt::Uninitialized);
+            m_writable = m_current->data();
+        } else if (m_readPosition == m_bufferSize) {
+            // qDebug() << "Buffer is full, trimming";
+            trimBuffer();
+        }
+        const auto amountToRead = qMin(readableBytes(), qint64(m_bufferSize - m_readPosition));
+        Q_ASSERT(amountToRead > 0);
+        const auto readBytes = m_socket->read(writableBuffer() + m_readPosition, amountToRead);
+        if (readBytes < 0) {
+            qWarning() << "Failed to read data";
+            return 0;
+        }
+        if (m_trafficObserver) {
+            m_trafficObserver(buffer().constData() + m_readPosition, readBytes);
+        }
+        m_bytesRead += readBytes;
+        if (m_readLimit > 0) {
+            m_readLimit -= readBytes;
+        }
+#ifdef KIMAP2_PARSER_COUNTERS
+        countRead(readBytes);
+#endif
+        m_readPosition += readBytes;
+        // qDebug() << "Buffer: " << buffer().mid(0, m_readPosition);
+        // qDebug() << "Read data: " << readBytes;
+        return readBytes;
     }
+}
 
-    void onLiteralEnd(std::function<void()> f)
-    {
-        literalEnd = f;
+template <typename Handler>
+void ImapStreamParser::lineEnd(Handler &handler)
+{
+    if (m_limits.lineSize && !m_skippingLine && lineBytes() > m_limits.lineSize) {
+        exceedLimit(QStringLiteral("a response of more than %1 bytes").arg(m_limits.lineSize));
     }
-
-    void onLineEnd(std::function<void()> f)
-    {
-        lineEnd = f;
+    //The next line starts behind the line feed
+    m_lineStart = m_bytesRead - (m_readPosition - m_position) + 1;
+    m_lineLiteralBytes = m_literalBytesRead;
+    if (!m_limitReason.isEmpty()) {
+        //Whatever else was wrong with the line, nothing of it was kept
+        m_listCounter = 0;
+        m_sublistStartPos = -1;
+        m_literalSize = 0;
+        m_readingLiteral = false;
+        m_streamingLiteral = false;
+        m_literalData.clear();
+        m_malformedReason.clear();
+        limitedLineEnd(handler);
+        m_limitReason.clear();
+        m_skippingLine = false;
+        return;
+    }
+    if (m_listCounter != 0) {
+        qWarning() << "List parsing in progress: " << m_listCounter;
+        if (m_errorRecovery) {
+            markMalformed("Unbalanced brackets");
+            m_listCounter = 0;
+            m_sublistStartPos = -1;
+        } else {
+            m_error = true;
+        }
+    }
+    if (m_literalSize || m_readingLiteral) {
+        qWarning() << "Literal parsing in progress: " << m_literalSize;
+        if (m_errorRecovery) {
+            markMalformed("Incomplete literal");
+            m_literalSize = 0;
+            m_readingLiteral = false;
+            m_streamingLiteral = false;
+            m_literalData.clear();
+        } else {
+            m_error = true;
+        }
+    }
+    if (!m_malformedReason.isEmpty()) {
+        malformedLineEnd(handler);
+        m_malformedReason.clear();
+        return;
     }
+    handler.lineEnd();
+}
 
-    std::function<void(const Message &)> responseReceived;
+template <typename Handler>
+void ImapStreamParser::malformedLineEnd(Handler &handler)
+{
+    handler.lineEnd();
+}
 
-    void setupCallbacks();
+template <typename Handler>
+void ImapStreamParser::limitedLineEnd(Handler &handler)
+{
+    handler.lineEnd();
+}
 
-    QList<QByteArray> *m_list;
-    QByteArray m_literalData;
-};
+template <typename Handler>
+inline void ImapStreamParser::string(Handler &handler, const char *data, int size)
+{
+    if (m_limits.tokenSize && size > m_limits.tokenSize && !m_skippingLine) {
+        exceedLimit(QStringLiteral("a token of more than %1 bytes").arg(m_limits.tokenSize));
+    }
+    if (!m_skippingLine) {
+        handler.string(data, size);
+    }
+}
+
+template <typename Handler>
+void ImapStreamParser::processBuffer(Handler &handler)
+{
+    if (m_error) {
+        qWarning() << "An error occurred";
+        return;
+    }
+    if (m_currentState == LiteralStringState && m_literalSize == 0 && m_readingLiteral) {
+        //The literal buffer is handed over as is, the next literal starts a new one.
+        if (!m_skippingLine) {
+            handler.literalEnd(m_literalData);
+        }
+        resetState();
+        m_readingLiteral = false;
+    }
+
+    while (m_position < m_readPosition) {
+        Q_ASSERT(m_position < length());
+        const char c = buffer()[m_position];
+#ifdef KIMAP2_PARSER_COUNTERS
+        //The byte counts for the state that consumes it
+        const States countedState = m_currentState;
+#endif
+        // qDebug() << "Checking :" << c << m_position << m_readPosition << m_currentState << m_listCounter;
+        switch (m_currentState) {
+            case InitState:
+                if (c == '(') {
+                    m_listCounter++;
+                    if (m_listCounter == 1) {
+                        handler.listStart();
+                    } else {
+                        if (m_listCounter == 2) {
+                            m_sublistStartPos = m_position;
+                        }
+                        handler.sublistStart();
+                    }
+                } else if (c == ')') {
+                    if (m_listCounter <= 0) {
+                        qWarning() << "Brackets are off";
+                        if (m_errorRecovery) {
+                            //Parse on to the end of the line, which is then dropped
+                            markMalformed("Brackets are off");
+                            break;
+                        }
+                        m_error = true;
+                        return;
+                    }
+                    m_listCounter--;
+                    if (m_listCounter == 0) {
+                        handler.listEnd();
+                    } else {
+                        handler.sublistEnd();
+                        if (m_listCounter == 1) {
+#ifdef KIMAP2_PARSER_COUNTERS
+                            m_counters.sublistBytes += m_position - m_sublistStartPos + 1;
+#endif
+                            //The nested list is also passed on as it was sent
+                            string(handler, buffer().constData() + m_sublistStartPos, m_position - m_sublistStartPos + 1);
+                            m_sublistStartPos = -1;
+                        }
+                    }
+                } else if (c == '[') {
+                    if (m_listCounter >= 1) {
+                        //Inside lists angle brackets are parsed as strings
+                        setState(AngleBracketStringState);
+                        m_stringStartPos = m_position;
+                    } else {
+                        handler.responseCodeStart();
+                    }
+                } else if (c == ']') {
+                    handler.responseCodeEnd();
+                } else if (c == ' ') {
+                    //Skip whitespace
+                    setState(WhitespaceState);
+                } else if (c == '\r') {
+                    setState(CRLFState);
+                } else if (c == '{') {
+                    setState(LiteralStringState);
+                    m_stringStartPos = m_position + 1;
+                } else if (c == '\"') {
+                    setState(QuotedStringState);
+                    m_stringStartPos = m_position + 1;
+                } else {
+                    setState(StringState);
+                    m_stringStartPos = m_position;
+                }
+                break;
+            case QuotedStringState:
+                if (c == '\"' && buffer().at(m_position - 1) != '\\') {
+                    //Unescaped quote
+                    resetState();
+                    const auto endPos = m_position;
+                    string(handler, buffer().constData() + m_stringStartPos, endPos - m_stringStartPos);
+                    m_stringStartPos = 0;
+                }
+                break;
+            case LiteralStringState:
+                if (c == '}') {
+                    m_literalSize = strtoll(buffer().constData() + m_stringStartPos, nullptr, 10);
+                    m_nonSynchronizingLiteral = buffer().at(m_position - 1) == '+';
+                    // qDebug() << "Found literal size: " << m_literalSize;
+                    m_literalData.clear();
+                    m_readingLiteral = false;
+                    m_stringStartPos = 0;
+                    if (m_literalSize < 0 || (m_limits.literalSize && m_literalSize > m_limits.literalSize)) {
+                        if (!exceedLimit(QStringLiteral("a literal of %1 bytes").arg(m_literalSize))) {
+                            return;
+                        }
+                        //Nothing follows that we could skip
+                        m_literalSize = qMax(m_literalSize, qint64(0));
+                    }
+                    m_literalBytesRead += m_literalSize;
+                    m_largestLiteral = qMax(m_largestLiteral, m_literalSize);
+                    if (m_skippingLine) {
+                        //Dropped as it arrives
+                        m_streamingLiteral = true;
+                        break;
+                    }
+                    m_streamingLiteral = handler.literalStart(m_literalSize);
+                    if (!m_streamingLiteral && m_literalSize > std::numeric_limits<int>::max()) {
+                        //More than a QByteArray can hold
+                        if (!exceedLimit(QStringLiteral("a literal of %1 bytes").arg(m_literalSize))) {
+                            return;
+                        }
+                        handler.literalEnd(QByteArray());
+                        m_streamingLiteral = true;
+                    }
+                    if (!m_streamingLiteral) {
+                        //The size is only what the server claims, the literal grows as its data arrives
+                        m_literalData.reserve(int(qMin(m_literalSize, qint64(m_maximumBufferSize))));
+                    }
+                    break;
+                }
+                if (!m_readingLiteral) {
+                    //Skip CRLF after literal size
+                    if (c == '\n' && m_skippingLine && m_isServerModeEnabled && m_literalSize > 0 && !m_nonSynchronizingLiteral) {
+                        //The client waits for a continuation request, so the command ends without its literal
+                        m_literalSize = 0;
+                        m_streamingLiteral = false;
+                        resetState();
+                        lineEnd(handler);
+                        break;
+                    }
+                    if (c == '\n') {
+                        m_readingLiteral = true;
+                        if (m_isServerModeEnabled && m_literalSize > 0 && !m_nonSynchronizingLiteral) {
+                            sendContinuationResponse(m_literalSize);
+                        }
+                    }
+                } else {
+                    Q_ASSERT(m_position < length());
+                    if (m_literalSize) {
+                        int size = m_literalSize;
+                        if (length() < m_position + size) {
+                            //If the literal is not complete we take what is available
+                            size = length() - m_position;
+                        }
+                        if (m_streamingLiteral) {
+                            if (!m_skippingLine) {
+                                handler.literalPart(buffer().constData() + m_position, size);
+                            }
+                        } else {
+                            m_literalData.append(buffer().constData() + m_position, size);
+                        }
+#ifdef KIMAP2_PARSER_COUNTERS
+                        countStateBytes(LiteralStringState, size);
+#endif
+                        m_position += size;
+                        m_literalSize -= size;
+                    }
+                    if (m_literalSize <= 0) {
+                        Q_ASSERT(m_literalSize == 0);
+                        if (!m_skippingLine) {
+                            handler.literalEnd(m_literalData);
+                        }
+                        resetState();
+                        m_readingLiteral = false;
+                    }
+                    continue;
+                }
+                break;
+            case StringState:
+                if (c == ' ' ||
+                    c == ')' || //End of list
+                    c == '(' || //New list
+                    //FIXME because we want to concat in sublists.
+                    // c == '[' ||
+                    c == ']' ||
+                    c == '\r' || //CRLF
+                    c == '\"') {
+                    resetState();
+                    string(handler, buffer().constData() + m_stringStartPos, m_position - m_stringStartPos);
+                    m_stringStartPos = 0;
+                    continue;
+                }
+                if (c == '{' && m_position == m_stringStartPos + 1 && at(m_stringStartPos) == '~') {
+                    //A literal8 (RFC 3516), which is read like any other literal
+                    forwardToState(LiteralStringState);
+                    m_stringStartPos = m_position + 1;
+                    break;
+                }
+                //Inside lists we want to parse the angle brackets as part of the string.
+                if (c == '[') {
+                    if (m_listCounter >= 1) {
+                        // qDebug() << "Switching to angle bracket state";
+                        forwardToState(AngleBracketStringState);
+                        break;
+                    }
+                }
+                break;
+            case AngleBracketStringState:
+                if (c == ']') {
+                    if (m_position + 1 >= m_readPosition) {
+                        //Wait for the next byte, which may start the origin of a partial fetch
+                        return;
+                    }
+                    if (at(m_position + 1) == '<') {
+                        //The origin belongs to the string, as in "BODY[]<0>"
+                        forwardToState(StringState);
+                        break;
+                    }
+                    resetState();
+                    string(handler, buffer().constData() + m_stringStartPos, m_position - m_stringStartPos + 1);
+                    m_stringStartPos = 0;
+                }
+                break;
+            case WhitespaceState:
+                if (c != ' ') {
+                    //Skip whitespace
+                    resetState();
+                    continue;
+                }
+                break;
+            case CRLFState:
+                if (c == '\n') {
+                    lineEnd(handler);
+                    if (m_error) {
+                        return;
+                    }
+                    resetState();
+                    if (m_paused) {
+#ifdef KIMAP2_PARSER_COUNTERS
+                        countStateBytes(CRLFState, 1);
+#endif
+                        m_position++;
+                        return;
+                    }
+                } else {
+                    //Skip over the \r that isn't part of the CRLF
+                    resetState();
+                    continue;
+                }
+                break;
+        }
+#ifdef KIMAP2_PARSER_COUNTERS
+        countStateBytes(countedState, 1);
+#endif
+        m_position++;
+    }
+    checkLimits();
+}
 
 }
 
@@ -19,27 +19,282 @@
 
 #include "job.h"
 #include "job_p.h"
+#include "imapset.h"
 #include "message_p.h"
 #include "session_p.h"
 
 #include "kimap_debug.h"
 
+#include <algorithm>
+
 using namespace KIMAP2;
 
 void JobPrivate::sendCommand(const QByteArray &command, const QByteArray &args)
 {
-    tags << sessionInternal()->sendCommand(command, args);
+    tags << sessionInternal()->sendCommand(command, args, q_ptr);
     m_currentCommand = command + "" + args;
 }
 
+bool JobPrivate::parseVanished(const Message &response, ImapSet *uids, bool *earlier)
+{
+    // * VANISHED (EARLIER) 41,43:116
+    if (response.content.size() < 3 || response.content[0].toString() != "*"
+            || response.content[1].keyword() != ImapKeyword::Vanished) {
+        return false;
+    }
+    if (earlier) {
+        *earlier = response.content[2].type() == Message::Part::List &&
+                   response.content[2].toList().contains("EARLIER");
+    }
+    *uids = ImapSet::fromImapSequenceSet(response.content.last().toString());
+    return true;
+}
+
+QByteArray JobPrivate::parseObjectId(const QByteArray &value)
+{
+    QByteArray id = value.trimmed();
+    if (id.startsWith('(') && id.endsWith(')')) {
+        id = id.mid(1, id.size() - 2).trimmed();
+    }
+    if (id.isEmpty() || id == "NIL") {
+        return QByteArray();
+    }
+    return id;
+}
+
+bool JobPrivate::parseMessageUpdate(const Message &response, MessageUpdate *update)
+{
+    if (response.content.size() < 4 || response.content[0].toString() != "*") {
+        return false;
+    }
+    switch (response.content[2].keyword()) {
+    case ImapKeyword::Fetch:
+        update->sequenceNumber = response.content[1].toString().toLongLong();
+        break;
+    case ImapKeyword::UidFetch:
+        // * 117 UIDFETCH (FLAGS (\Seen)), without sequence numbers (RFC 9586)
+        update->uid = response.content[1].toString().toLongLong();
+        break;
+    default:
+        return false;
+    }
+    const QList<QByteArray> &items = response.content[3].toList();
+    for (int i = 0; i + 1 < items.size(); i += 2) {
+        QByteArray value = items[i + 1];
+        if (value.startsWith('(') && value.endsWith(')')) {
+            value = value.mid(1, value.size() - 2);
+        }
+        switch (response.content[3].keywordAt(i)) {
+        case ImapKeyword::Uid:
+            update->uid = value.toLongLong();
+            break;
+        case ImapKeyword::ModSeq:
+            update->modSeq = value.toULongLong();
+            break;
+        case ImapKeyword::Flags:
+            //mid() copied the list, and splitting it copies again
+            update->flags = value.isEmpty() ? QList<QByteArray>() : value.split(' ');
+            break;
+        default:
+            break;
+        }
+    }
+    return true;
+}
+
+void CopyUidMap::parse(const Message &response)
+{
+    // [COPYUID 38505 304,319:320 3956:3958]
+    for (int i = 0; i + 3 < response.responseCode.size(); ++i) {
+        if (response.responseCode.at(i).toString() != "COPYUID") {
+            continue;
+        }
+        uidValidity = response.responseCode.at(i + 1).toString().toLongLong();
+        // One per chunk, in the order they were sent
+        foreach (const ImapSet::Range &range, ImapSet::fromImapSequenceSet(response.responseCode.at(i + 2).toString()).ranges()) {
+            source.add(ImapInterval(range.begin, range.end));
+        }
+        foreach (const ImapSet::Range &range, ImapSet::fromImapSequenceSet(response.responseCode.at(i + 3).toString()).ranges()) {
+            destination.add(ImapInterval(range.begin, range.end));
+        }
+        mapped = false;
+        return;
+    }
+}
+
+bool CopyUidMap::segmentBefore(const Segment &segment, qint64 sourceUid)
+{
+    return segment.sourceEnd < sourceUid;
+}
+
+qint64 CopyUidMap::destinationOf(qint64 sourceUid) const
+{
+    if (!mapped) {
+        // The n-th source UID went to the n-th destination UID
+        segments.clear();
+        const QVector<ImapSet::Range> sourceRanges = source.ranges();
+        const QVector<ImapSet::Range> destinationRanges = destination.ranges();
+        segments.reserve(sourceRanges.size() + destinationRanges.size());
+        int i = 0;
+        int j = 0;
+        qint64 sourceNext = sourceRanges.isEmpty() ? 0 : sourceRanges.first().begin;
+        qint64 destinationNext = destinationRanges.isEmpty() ? 0 : destinationRanges.first().begin;
+        while (i < sourceRanges.size() && j < destinationRanges.size()) {
+            // COPYUID has no open ends
+            const qint64 sourceEnd = qMax(sourceRanges.at(i).end, sourceRanges.at(i).begin);
+            const qint64 destinationEnd = qMax(destinationRanges.at(j).end, destinationRanges.at(j).begin);
+            const qint64 count = qMin(sourceEnd - sourceNext, destinationEnd - destinationNext) + 1;
+            const Segment segment = { sourceNext, sourceNext + count - 1, destinationNext };
+            segments.append(segment);
+            sourceNext += count;
+            destinationNext += count;
+            if (sourceNext > sourceEnd && ++i < sourceRanges.size()) {
+                sourceNext = sourceRanges.at(i).begin;
+            }
+            if (destinationNext > destinationEnd && ++j < destinationRanges.size()) {
+                destinationNext = destinationRanges.at(j).begin;
+            }
+        }
+        // The server may list the source UIDs in any order
+        std::sort(segments.begin(), segments.end(), [](const Segment &lhs, const Segment &rhs) {
+            return lhs.sourceBegin < rhs.sourceBegin;
+        });
+        mapped = true;
+    }
+
+    const QVector<Segment>::const_iterator it = std::lower_bound(segments.constBegin(), segments.constEnd(), sourceUid, segmentBefore);
+    if (it == segments.constEnd() || it->sourceBegin > sourceUid) {
+        return 0;
+    }
+    return it->destinationBegin + (sourceUid - it->sourceBegin);
+}
+
+void JobFutureState::bind(Job *job, const QSharedPointer<JobFutureState> &state)
+{
+    state->job = job;
+    if (const QSharedPointer<JobFutureState> existing = job->d_ptr->future) {
+        existing->addCallback([state](Job *job, int error, const QString &errorText) {
+            state->finish(job, error, errorText);
+        });
+        return;
+    }
+    job->d_ptr->future = state;
+    //Connected without a context, so the state finishes on the thread that emits the result
+    QObject::connect(job, &KJob::result, [state](KJob *job) {
+        state->finish(static_cast<Job *>(job), job->error(), job->errorText());
+    });
+}
+
+void JobFutureState::finish(Job *finishedJob, int finishedError, const QString &finishedErrorText)
+{
+    QList<Callback> pending;
+    {
+        QMutexLocker locker(&mutex);
+        if (finished) {
+            return;
+        }
+        finished = true;
+        error = finishedError;
+        errorText = finishedErrorText;
+        pending.swap(callbacks);
+    }
+    for (const Callback &callback : pending) {
+        callback(finishedJob, finishedError, finishedErrorText);
+    }
+}
+
+void JobFutureState::addCallback(const Callback &callback)
+{
+    QMutexLocker locker(&mutex);
+    if (!finished) {
+        callbacks << callback;
+        return;
+    }
+    const int finishedError = error;
+    const QString finishedErrorText = errorText;
+    locker.unlock();
+    callback(job.data(), finishedError, finishedErrorText);
+}
+
+JobFuture::JobFuture()
+{
+}
+
+JobFuture::JobFuture(const QSharedPointer<JobFutureState> &state)
+    : d(state)
+{
+}
+
+bool JobFuture::isValid() const
+{
+    return !d.isNull();
+}
+
+bool JobFuture::isFinished() const
+{
+    if (!d) {
+        return false;
+    }
+    QMutexLocker locker(&d->mutex);
+    return d->finished;
+}
+
+int JobFuture::error() const
+{
+    if (!d) {
+        return 0;
+    }
+    QMutexLocker locker(&d->mutex);
+    return d->error;
+}
+
+QString JobFuture::errorText() const
+{
+    if (!d) {
+        return QString();
+    }
+    QMutexLocker locker(&d->mutex);
+    return d->errorText;
+}
+
+JobFuture JobFuture::then(const Continuation &next) const
+{
+    Q_ASSERT(d);
+    QSharedPointer<JobFutureState> chained(new JobFutureState);
+    d->addCallback([chained, next](Job *job, int error, const QString &errorText) {
+        if (error) {
+            chained->finish(Q_NULLPTR, error, errorText);
+            return;
+        }
+        Job *nextJob = next(job);
+        if (!nextJob) {
+            chained->finish(Q_NULLPTR, 0, QString());
+            return;
+        }
+        JobFutureState::bind(nextJob, chained);
+        nextJob->start();
+    });
+    return JobFuture(chained);
+}
+
+void JobFuture::onFinished(const FinishedCallback &callback) const
+{
+    Q_ASSERT(d);
+    d->addCallback([callback](Job *, int error, const QString &errorText) {
+        callback(error, errorText);
+    });
+}
+
 Job::Job(Session *session)
     : KJob(session), d_ptr(new JobPrivate(session, "Job"))
 {
+    d_ptr->q_ptr = this;
 }
 
 Job::Job(JobPrivate &dd)
     : KJob(dd.m_session), d_ptr(&dd)
 {
+    d_ptr->q_ptr = this;
 }
 
 Job::~Job()
@@ -53,12 +308,33 @@ Session *Job::session() const
     return d->m_session;
 }
 
+void Job::setPriority(Priority priority)
+{
+    Q_D(Job);
+    d->priority = priority;
+}
+
+Job::Priority Job::priority() const
+{
+    Q_D(const Job);
+    return d->priority;
+}
+
 void Job::start()
 {
     Q_D(Job);
     d->sessionInternal()->addJob(this);
 }
 
+JobFuture Job::future()
+{
+    Q_D(Job);
+    if (!d->future) {
+        JobFutureState::bind(this, QSharedPointer<JobFutureState>(new JobFutureState));
+    }
+    return JobFuture(d->future);
+}
+
 void Job::handleResponse(const Message &response)
 {
     handleErrorReplies(response);
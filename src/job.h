@@ -23,14 +23,19 @@
 #include "kimap2_export.h"
 
 #include <KJob>
+#include <QtCore/QSharedPointer>
 #include <QtNetwork/QAbstractSocket>
 
+#include <functional>
+
 namespace KIMAP2
 {
 
 class Session;
 class SessionPrivate;
+class Job;
 class JobPrivate;
+class JobFutureState;
 struct Message;
 
 enum ErrorCodes {
@@ -40,23 +45,117 @@ enum ErrorCodes {
     SslHandshakeFailed,
     HostNotFound,
     LoginFailed,
+    LimitExceeded, ///< See Session::setMaximumLiteralSize()
     LastError
 };
 
+/**
+ * The outcome of a job, or of a chain of jobs, see Job::future().
+ *
+ * Continuations are called on the thread that emits the result of the job, the session thread,
+ * right when the job finished. A job a continuation starts is queued on its session at once,
+ * so with pipelining enabled the commands of a chain go out back to back, without a nested
+ * event loop or a return to the event loop in between.
+ *
+ * @code
+ * SelectJob *select = new SelectJob(session);
+ * select->setMailBox(QStringLiteral("INBOX"));
+ * select->future().then([session](Job *) {
+ *     FetchJob *fetch = new FetchJob(session);
+ *     ...
+ *     return fetch;
+ * }).onFinished([](int error, const QString &errorText) {
+ *     ...
+ * });
+ * select->start();
+ * @endcode
+ */
+class KIMAP2_EXPORT JobFuture
+{
+public:
+    /**
+     * Creates the next job of the chain from the job that finished, or returns null to end the chain.
+     *
+     * The returned job must not be started, the chain starts it.
+     */
+    typedef std::function<Job *(Job *finished)> Continuation;
+    typedef std::function<void(int error, const QString &errorText)> FinishedCallback;
+
+    // An invalid future
+    JobFuture();
+
+    bool isValid() const;
+    bool isFinished() const;
+
+    /**
+     * The error of the job, or of the first job of the chain that failed. 0 if none did.
+     */
+    int error() const;
+    QString errorText() const;
+
+    /**
+     * Calls @p next once the job finished without an error and starts the job it returns.
+     *
+     * The returned future finishes with that job. If this job fails, @p next is not called
+     * and the returned future fails with the same error. If this job already finished,
+     * @p next is called right away with the job, or null if it was already deleted.
+     */
+    JobFuture then(const Continuation &next) const;
+
+    /**
+     * Calls @p callback once the job finished, whether it failed or not.
+     */
+    void onFinished(const FinishedCallback &callback) const;
+
+private:
+    friend class Job;
+    explicit JobFuture(const QSharedPointer<JobFutureState> &state);
+
+    QSharedPointer<JobFutureState> d;
+};
+
 class KIMAP2_EXPORT Job : public KJob
 {
     Q_OBJECT
     Q_DECLARE_PRIVATE(Job)
 
     friend class SessionPrivate;
+    friend class JobFutureState;
 
 public:
+    /**
+     * Where the job is queued on the session.
+     */
+    enum Priority {
+        BackgroundPriority = -1, ///< For synchronizations nobody waits for
+        NormalPriority = 0,
+        InteractivePriority = 1 ///< For requests of the user
+    };
+
     virtual ~Job();
 
     Session *session() const;
 
+    /**
+     * Sets the priority of the job. The default is NormalPriority.
+     *
+     * Jobs are started ahead of all queued jobs with a lower priority, and after those with the
+     * same or a higher priority. So that lower priorities still make progress, a queued job is
+     * overtaken at most 8 times. Must be called before start().
+     */
+    void setPriority(Priority priority);
+    Priority priority() const;
+
     void start() Q_DECL_OVERRIDE;
 
+    /**
+     * Returns the future of this job, to attach continuations to.
+     *
+     * Has to be called before the job finished, i.e. before it is started or in the same
+     * call. All calls return the same future.
+     */
+    JobFuture future();
+
 private:
     virtual void doStart() = 0;
     virtual void handleResponse(const Message &response);
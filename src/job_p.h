@@ -21,6 +21,11 @@
 #define KIMAP2_JOB_P_H
 
 #include "session.h"
+#include "imapset.h"
+#include "imapstreamparser.h"
+#include <QtCore/QMutex>
+#include <QtCore/QPointer>
+#include <QtCore/QSet>
 #include <QtNetwork/QAbstractSocket>
 
 namespace KIMAP2
@@ -28,10 +33,136 @@ namespace KIMAP2
 
 class SessionPrivate;
 
+/**
+ * The source and destination UIDs of the COPYUID response codes (RFC 4315) a job received.
+ */
+class CopyUidMap
+{
+public:
+    CopyUidMap() : uidValidity(0), mapped(false) {}
+
+    /**
+     * Appends the sets of the COPYUID response code of @p response, if it has one.
+     */
+    void parse(const Message &response);
+
+    /**
+     * Returns the destination UID of @p sourceUid, or 0 if it wasn't reported.
+     *
+     * Pairs the intervals of both sets when called first, so the lookup costs
+     * a binary search over the intervals.
+     */
+    qint64 destinationOf(qint64 sourceUid) const;
+
+    // Of the destination mailbox
+    qint64 uidValidity;
+    ImapSet source;
+    ImapSet destination;
+
+private:
+    // A run of consecutive source UIDs that went to consecutive destination UIDs
+    struct Segment {
+        qint64 sourceBegin;
+        qint64 sourceEnd;
+        qint64 destinationBegin;
+    };
+    static bool segmentBefore(const Segment &segment, qint64 sourceUid);
+
+    mutable QVector<Segment> segments;
+    mutable bool mapped;
+};
+
+/**
+ * The tags of the commands a job is waiting for, in the order they were sent.
+ *
+ * Looked up for every response the job handles, so membership is a hash lookup
+ * rather than a scan over the tags of all pipelined commands.
+ */
+class JobTags
+{
+public:
+    inline JobTags &operator<<(const QByteArray &tag)
+    {
+        m_order << tag;
+        m_set.insert(tag);
+        return *this;
+    }
+
+    inline bool contains(const QByteArray &tag) const
+    {
+        //Untagged responses and continuation requests never match, skip hashing them
+        if (tag.size() <= 1) {
+            return false;
+        }
+        return m_set.contains(tag);
+    }
+
+    inline int removeAll(const QByteArray &tag)
+    {
+        if (!m_set.remove(tag)) {
+            return 0;
+        }
+        return m_order.removeAll(tag);
+    }
+
+    inline bool isEmpty() const
+    {
+        return m_order.isEmpty();
+    }
+    inline int size() const
+    {
+        return m_order.size();
+    }
+    inline const QByteArray &last() const
+    {
+        return m_order.last();
+    }
+    inline void clear()
+    {
+        m_order.clear();
+        m_set.clear();
+    }
+
+private:
+    QList<QByteArray> m_order;
+    QSet<QByteArray> m_set;
+};
+
+/**
+ * What a JobFuture shares with its job and its continuations.
+ */
+class JobFutureState
+{
+public:
+    typedef std::function<void(Job *job, int error, const QString &errorText)> Callback;
+
+    JobFutureState() : finished(false), error(0) { }
+
+    /**
+     * Makes @p state finish with @p job. A job that has a state already forwards its result to @p state.
+     */
+    static void bind(Job *job, const QSharedPointer<JobFutureState> &state);
+
+    void finish(Job *job, int error, const QString &errorText);
+
+    /**
+     * Calls @p callback once finished, right away if that already happened.
+     */
+    void addCallback(const Callback &callback);
+
+    // The fields are read from other threads than the session thread
+    mutable QMutex mutex;
+    bool finished;
+    int error;
+    QString errorText;
+    QPointer<Job> job;
+    QList<Callback> callbacks;
+};
+
 class JobPrivate
 {
 public:
-    JobPrivate(Session *session, const QString &name) : m_session(session), m_socketError(QAbstractSocket::UnknownSocketError)
+    JobPrivate(Session *session, const QString &name) : q_ptr(Q_NULLPTR), m_session(session), m_socketError(QAbstractSocket::UnknownSocketError), handlesBorrowedResponses(false), pipelineSafe(false), queuedAt(0), priority(Job::NormalPriority), overtaken(0), suspended(false), coalescedInto(Q_NULLPTR), limitExceeded(false)
     {
         m_name = name;
     }
@@ -49,12 +180,111 @@ public:
 
     void sendCommand(const QByteArray &command, const QByteArray &args);
 
-    QList<QByteArray> tags;
+    /**
+     * Reads the UIDs of a VANISHED response (RFC 7162), with or without the EARLIER tag.
+     *
+     * Returns false if @p response is no VANISHED response.
+     */
+    static bool parseVanished(const Message &response, ImapSet *uids, bool *earlier = Q_NULLPTR);
+
+    /**
+     * Reads an EMAILID, THREADID or MAILBOXID value (RFC 8474), e.g. "(M6d99ac3275bb4e)".
+     *
+     * Returns a null array for NIL.
+     */
+    static QByteArray parseObjectId(const QByteArray &value);
+
+    /**
+     * What an unsolicited FETCH response, e.g. "* 12 FETCH (UID 4827 FLAGS (\\Seen) MODSEQ (98305))",
+     * says about a message. The UID and MODSEQ are 0 if the server did not send them.
+     */
+    struct MessageUpdate {
+        MessageUpdate() : sequenceNumber(0), uid(0), modSeq(0) {}
+
+        qint64 sequenceNumber;
+        qint64 uid;
+        QList<QByteArray> flags;
+        quint64 modSeq;
+    };
+
+    /**
+     * Reads a FETCH response into @p update, copying everything out of the receive buffers.
+     * A UIDFETCH response (RFC 9586) leaves the sequence number at 0.
+     *
+     * Returns false if @p response is neither.
+     */
+    static bool parseMessageUpdate(const Message &response, MessageUpdate *update);
+
+    JobTags tags;
+    Job *q_ptr;
     Session *m_session;
     QString m_name;
     QString m_errorMessage;
     QString m_currentCommand;
     QAbstractSocket::SocketError m_socketError;
+    /**
+     * Set by jobs that pass everything they keep from a response through Message::owned().
+     * All other jobs receive a detached copy of borrowed responses.
+     */
+    bool handlesBorrowedResponses;
+    /**
+     * Consulted for every literal received while the job is running,
+     * see ImapStreamParser::setLiteralSinkProvider().
+     */
+    ImapStreamParser::LiteralSinkProvider literalSinkProvider;
+    /**
+     * Installed on the parser while the job is running.
+     */
+    ImapStreamParser::ListObserver listObserver;
+    /**
+     * Set by jobs that may be started while other pipeline-safe jobs are still running,
+     * if pipelining is enabled on the session.
+     *
+     * Such jobs must not depend on continuation requests, the session state or the parser hooks above.
+     */
+    bool pipelineSafe;
+    /**
+     * Claims untagged responses for a job while several jobs are running.
+     * Untagged responses nobody claims go to the job that was started first.
+     */
+    std::function<bool(const Message &response)> isInterestedIn;
+    // When the job was added to the session queue, for the metrics
+    qint64 queuedAt;
+    // The mailbox that was selected when the job was added to the session queue
+    QByteArray queuedMailBox;
+    Job::Priority priority;
+    // How often a job was queued ahead of this one
+    int overtaken;
+    /**
+     * Set by jobs that can step aside for a job of higher priority between two commands,
+     * see SessionPrivate::stepAside(). Called instead of doStart() when the job runs again.
+     */
+    std::function<void()> resume;
+    /**
+     * Called while the job is running, whenever the session parsed the data that arrived so far.
+     */
+    std::function<void()> parsePassFinished;
+    bool suspended;
+    // The mailbox that was selected when the job stepped aside
+    QByteArray suspendedMailBox;
+    /**
+     * Set by jobs that can do the work of the job queued behind them as well,
+     * see Session::setJobCoalescingEnabled(). Returns true if the job took over @p queued,
+     * which must then finish together with it.
+     */
+    std::function<bool(Job *queued)> coalesce;
+    // The job that does the work of this one
+    Job *coalescedInto;
+    /**
+     * Set by jobs that can be sent again when the session reconnected while they were running,
+     * see Session::setReconnectPolicy(). Resets what the job keeps about its commands, doStart()
+     * is called again once it is its turn.
+     */
+    std::function<void()> replay;
+    // Set once the job went over a memory limit of the session, see SessionPrivate::exceedLimit()
+    bool limitExceeded;
+    // Created by Job::future()
+    QSharedPointer<JobFutureState> future;
 };
 
 }
@@ -0,0 +1,154 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_JOBCOROUTINE_H
+#define KIMAP2_JOBCOROUTINE_H
+
+/*
+ * C++20 coroutine support for jobs. Only available to code built as C++20,
+ * the library itself doesn't need it.
+ */
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define KIMAP2_HAVE_COROUTINES 1
+#endif
+#endif
+
+#ifdef KIMAP2_HAVE_COROUTINES
+
+#include "job.h"
+
+#include <coroutine>
+#include <exception>
+
+namespace KIMAP2
+{
+
+/**
+ * Waits for a job, or a chain of jobs, in a coroutine.
+ *
+ * The coroutine is resumed on the session thread, right when the job finished and before the
+ * session starts the next one, so a job started after the co_await is queued without a return
+ * to the event loop. The result of the co_await is the error of the job, 0 for success.
+ * The job can be used until the coroutine waits again, since it is deleted once control returns
+ * to the event loop.
+ *
+ * @code
+ * Task synchronize(Session *session)
+ * {
+ *     SelectJob *select = new SelectJob(session);
+ *     select->setMailBox(QStringLiteral("INBOX"));
+ *     if (co_await *select) {
+ *         co_return;
+ *     }
+ *     const int messageCount = select->messageCount();
+ *     FetchJob *fetch = new FetchJob(session);
+ *     ...
+ *     co_await *fetch;
+ * }
+ * @endcode
+ *
+ * A coroutine that waits for a job that is deleted without emitting its result is never resumed.
+ */
+class JobAwaiter
+{
+public:
+    /**
+     * Starts @p job when the coroutine suspends, so it must not have been started yet.
+     */
+    explicit JobAwaiter(Job &job)
+        : m_job(&job), m_future(job.future())
+    {
+    }
+
+    explicit JobAwaiter(const JobFuture &future)
+        : m_job(Q_NULLPTR), m_future(future)
+    {
+    }
+
+    bool await_ready() const
+    {
+        return !m_job && m_future.isFinished();
+    }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        m_future.onFinished([handle](int, const QString &) {
+            handle.resume();
+        });
+        if (m_job) {
+            m_job->start();
+        }
+    }
+
+    int await_resume() const
+    {
+        return m_future.error();
+    }
+
+private:
+    Job *m_job;
+    JobFuture m_future;
+};
+
+inline JobAwaiter operator co_await(Job &job)
+{
+    return JobAwaiter(job);
+}
+
+inline JobAwaiter operator co_await(const JobFuture &future)
+{
+    return JobAwaiter(future);
+}
+
+/**
+ * The return type of a coroutine that waits for jobs.
+ *
+ * The coroutine starts running right away and nobody waits for it, it cleans up after itself
+ * when it returns.
+ */
+class Task
+{
+public:
+    struct promise_type {
+        Task get_return_object()
+        {
+            return Task();
+        }
+        std::suspend_never initial_suspend() noexcept
+        {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept
+        {
+            return {};
+        }
+        void return_void()
+        {
+        }
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+    };
+};
+
+}
+
+#endif
+
+#endif
@@ -0,0 +1,209 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "keepalivescheduler.h"
+
+#include "kimap_debug.h"
+
+#include "session.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QPointer>
+#include <QtCore/QTimer>
+#include <QtCore/QVector>
+
+namespace KIMAP2
+{
+
+class KeepAliveSchedulerPrivate
+{
+public:
+    struct State {
+        State() : slot(0), traffic(0), noopRunning(false) { }
+
+        int slot;
+        // Sent and received bytes at the last check
+        qint64 traffic;
+        bool noopRunning;
+    };
+
+    KeepAliveSchedulerPrivate(KeepAliveScheduler *scheduler)
+        : q(scheduler),
+          interval(25 * 60),
+          current(0),
+          wheel(slotCount)
+    {
+    }
+
+    static qint64 traffic(Session *session)
+    {
+        const SessionMetrics metrics = session->metrics();
+        return metrics.bytesSent + metrics.bytesReceived;
+    }
+
+    void updateTicker()
+    {
+        if (states.isEmpty()) {
+            ticker.stop();
+            return;
+        }
+        //The wheel turns once every half interval
+        const int tick = qMax(1, interval * 1000 / 2 / slotCount);
+        if (!ticker.isActive() || ticker.interval() != tick) {
+            ticker.start(tick);
+        }
+    }
+
+    int emptiestSlot() const
+    {
+        //The slot after the current one waits the longest, so new sessions aren't checked right away
+        int best = (current + slotCount - 1) % slotCount;
+        for (int i = 0; i < slotCount; ++i) {
+            const int slot = (current + slotCount - 1 - i) % slotCount;
+            if (wheel.at(slot).size() < wheel.at(best).size()) {
+                best = slot;
+            }
+        }
+        return best;
+    }
+
+    void tick();
+    void check(Session *session, State &state);
+    void noopFinished(QObject *object, bool ok);
+
+    static const int slotCount = 60;
+
+    KeepAliveScheduler *const q;
+    int interval;
+    int current;
+    QVector<QList<Session *> > wheel;
+    QHash<Session *, State> states;
+    QTimer ticker;
+};
+
+}
+
+using namespace KIMAP2;
+
+void KeepAliveSchedulerPrivate::tick()
+{
+    current = (current + 1) % slotCount;
+    for (Session *session : wheel.at(current)) {
+        check(session, states[session]);
+    }
+}
+
+void KeepAliveSchedulerPrivate::check(Session *session, State &state)
+{
+    const qint64 now = traffic(session);
+    const bool silent = now == state.traffic;
+    state.traffic = now;
+    if (!silent || state.noopRunning || session->jobQueueSize() > 0
+            || session->state() == Session::Disconnected) {
+        return;
+    }
+    qCDebug(KIMAP2_LOG) << "Keeping an idle session alive";
+    state.noopRunning = true;
+    QPointer<KeepAliveScheduler> scheduler(q);
+    QPointer<Session> target(session);
+    session->sendCommand("NOOP", QByteArray(), [scheduler, target](const CommandResult &result) {
+        //Called on the thread of the session
+        if (scheduler) {
+            QMetaObject::invokeMethod(scheduler.data(), "noopFinished", Qt::QueuedConnection,
+                                      Q_ARG(QObject *, target.data()), Q_ARG(bool, result.isOk()));
+        }
+    });
+}
+
+void KeepAliveSchedulerPrivate::noopFinished(QObject *object, bool ok)
+{
+    //Removed, or destroyed in the meantime
+    Session *session = static_cast<Session *>(object);
+    auto it = states.find(session);
+    if (!object || it == states.end()) {
+        return;
+    }
+    it->noopRunning = false;
+    //The NOOP itself isn't activity
+    it->traffic = traffic(session);
+    if (ok) {
+        emit q->sessionAlive(session);
+    } else {
+        qCWarning(KIMAP2_LOG) << "An idle session didn't answer the NOOP";
+        emit q->sessionUnresponsive(session);
+    }
+}
+
+KeepAliveScheduler::KeepAliveScheduler(QObject *parent)
+    : QObject(parent),
+      d(new KeepAliveSchedulerPrivate(this))
+{
+    QObject::connect(&d->ticker, &QTimer::timeout, this, [this]() {
+        d->tick();
+    });
+}
+
+KeepAliveScheduler::~KeepAliveScheduler()
+{
+    delete d;
+}
+
+void KeepAliveScheduler::setInterval(int seconds)
+{
+    d->interval = qMax(2, seconds);
+    d->updateTicker();
+}
+
+int KeepAliveScheduler::interval() const
+{
+    return d->interval;
+}
+
+void KeepAliveScheduler::addSession(Session *session)
+{
+    if (d->states.contains(session)) {
+        return;
+    }
+    KeepAliveSchedulerPrivate::State state;
+    state.slot = d->emptiestSlot();
+    state.traffic = KeepAliveSchedulerPrivate::traffic(session);
+    d->wheel[state.slot] << session;
+    d->states.insert(session, state);
+    connect(session, &QObject::destroyed, this, [this, session]() {
+        removeSession(session);
+    });
+    d->updateTicker();
+}
+
+void KeepAliveScheduler::removeSession(Session *session)
+{
+    const auto it = d->states.find(session);
+    if (it == d->states.end()) {
+        return;
+    }
+    d->wheel[it->slot].removeAll(session);
+    d->states.erase(it);
+    session->disconnect(this);
+    d->updateTicker();
+}
+
+QList<Session *> KeepAliveScheduler::sessions() const
+{
+    return d->states.keys();
+}
+
+#include "moc_keepalivescheduler.cpp"
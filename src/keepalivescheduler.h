@@ -0,0 +1,84 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_KEEPALIVESCHEDULER_H
+#define KIMAP2_KEEPALIVESCHEDULER_H
+
+#include "kimap2_export.h"
+
+#include <QtCore/QObject>
+
+namespace KIMAP2
+{
+
+class Session;
+class KeepAliveSchedulerPrivate;
+
+/**
+ * Keeps idle sessions from running into the idle timeout of their server, with one timer for
+ * all of them, see SessionPool::setKeepAliveScheduler().
+ *
+ * The sessions are spread over the slots of a timing wheel that turns once every half
+ * interval(), and a slot is checked on every tick. A session that neither sent nor received
+ * anything since its last check, and has no jobs queued, gets a NOOP. So a session stays
+ * silent for less than interval(), and the NOOPs of many sessions are spread across it instead
+ * of going out at once.
+ */
+class KIMAP2_EXPORT KeepAliveScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit KeepAliveScheduler(QObject *parent = Q_NULLPTR);
+    ~KeepAliveScheduler();
+
+    /**
+     * Sets the longest time in seconds a session may stay silent, which should be a bit less than
+     * the idle timeout of the servers. The default is 25 minutes, since RFC 3501 requires
+     * servers to wait at least 30.
+     */
+    void setInterval(int seconds);
+    int interval() const;
+
+    /**
+     * Keeps @p session alive until it is removed or destroyed.
+     */
+    void addSession(Session *session);
+    void removeSession(Session *session);
+    QList<Session *> sessions() const;
+
+Q_SIGNALS:
+    /**
+     * Emitted when @p session answered a NOOP.
+     */
+    void sessionAlive(KIMAP2::Session *session);
+
+    /**
+     * Emitted when a NOOP failed or the connection of @p session was lost while it was running.
+     */
+    void sessionUnresponsive(KIMAP2::Session *session);
+
+private:
+    Q_DISABLE_COPY(KeepAliveScheduler)
+    friend class KeepAliveSchedulerPrivate;
+    KeepAliveSchedulerPrivate *const d;
+    Q_PRIVATE_SLOT(d, void noopFinished(QObject *, bool))
+};
+
+}
+
+#endif
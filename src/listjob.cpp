@@ -31,14 +31,29 @@ namespace KIMAP2
 class ListJobPrivate : public JobPrivate
 {
 public:
-    ListJobPrivate(ListJob *job, Session *session, const QString &name) : JobPrivate(session, name), q(job), option(ListJob::NoOption) { }
+    ListJobPrivate(ListJob *job, Session *session, const QString &name) : JobPrivate(session, name), q(job), option(ListJob::NoOption), sessionNamespaces(false), mailBoxIdsEnabled(false), childrenOnly(false)
+    {
+        replay = [this]() {
+            lastSeparator = QChar();
+        };
+    }
     ~ListJobPrivate() { }
 
     ListJob *const q;
 
     ListJob::Option option;
     QList<MailBoxDescriptor> namespaces;
+    bool sessionNamespaces;
     QByteArray command;
+    bool mailBoxIdsEnabled;
+    QList<QByteArray> statusItems;
+    ListJob::ExtendedOptions extendedOptions;
+    QByteArray returnOptions;
+    // Only the level below childrenOf is listed
+    MailBoxDescriptor childrenOf;
+    bool childrenOnly;
+    // The separator of the mailbox last listed, for the STATUS response following it
+    QChar lastSeparator;
 };
 }
 
@@ -77,10 +92,81 @@ QList<MailBoxDescriptor> ListJob::queriedNamespaces() const
     return d->namespaces;
 }
 
+void ListJob::setQueriesSessionNamespaces(bool enabled)
+{
+    Q_D(ListJob);
+    d->sessionNamespaces = enabled;
+}
+
+bool ListJob::queriesSessionNamespaces() const
+{
+    Q_D(const ListJob);
+    return d->sessionNamespaces;
+}
+
+void ListJob::setMailBoxIdsEnabled(bool enabled)
+{
+    Q_D(ListJob);
+    d->mailBoxIdsEnabled = enabled;
+}
+
+bool ListJob::mailBoxIdsEnabled() const
+{
+    Q_D(const ListJob);
+    return d->mailBoxIdsEnabled;
+}
+
+void ListJob::setStatusItems(const QList<QByteArray> &items)
+{
+    Q_D(ListJob);
+    d->statusItems = items;
+}
+
+QList<QByteArray> ListJob::statusItems() const
+{
+    Q_D(const ListJob);
+    return d->statusItems;
+}
+
+void ListJob::setExtendedOptions(ExtendedOptions options)
+{
+    Q_D(ListJob);
+    d->extendedOptions = options;
+}
+
+ListJob::ExtendedOptions ListJob::extendedOptions() const
+{
+    Q_D(const ListJob);
+    return d->extendedOptions;
+}
+
+void ListJob::setChildrenOf(const MailBoxDescriptor &mailBox)
+{
+    Q_D(ListJob);
+    d->childrenOf = mailBox;
+    d->childrenOnly = true;
+}
+
+MailBoxDescriptor ListJob::childrenOf() const
+{
+    Q_D(const ListJob);
+    return d->childrenOf;
+}
+
+bool ListJob::listsChildrenOnly() const
+{
+    Q_D(const ListJob);
+    return d->childrenOnly;
+}
+
 void ListJob::doStart()
 {
     Q_D(ListJob);
+    SessionPrivate *session = d->sessionInternal();
 
+    //IMAP4rev2 (RFC 9051) deprecated LSUB for LIST (SUBSCRIBED)
+    const bool subscribedList = d->option != IncludeUnsubscribed && d->option != IncludeFolderRoleFlags
+                                && session->isImap4Rev2();
     switch (d->option) {
         break;
     case IncludeUnsubscribed:
@@ -91,24 +177,89 @@ void ListJob::doStart()
         break;
     case NoOption:
     default:
-        d->command = "LSUB";
+        d->command = subscribedList ? "LIST" : "LSUB";
     }
 
-    if (d->namespaces.isEmpty()) {
-        d->sendCommand(d->command, "\"\" *");
-    } else {
-        foreach (const MailBoxDescriptor &descriptor, d->namespaces) {
-            QString parameters = QStringLiteral("\"\" \"%1\"");
+    const bool listExtended = d->command == "LIST" && session->hasCapability("LIST-EXTENDED");
+    //Both SPECIAL-USE options are LIST-EXTENDED syntax
+    const bool specialUse = listExtended && session->hasCapability("SPECIAL-USE");
 
+    QList<QByteArray> selectionOptions;
+    QList<QByteArray> returnOptions;
+    if (listExtended) {
+        if ((d->extendedOptions & SelectSubscribed) || subscribedList) {
+            selectionOptions << "SUBSCRIBED";
+        }
+        if (d->extendedOptions & SelectRemote) {
+            selectionOptions << "REMOTE";
+        }
+        if ((d->extendedOptions & SelectRecursiveMatch) && !selectionOptions.isEmpty()) {
+            //Not valid on its own
+            selectionOptions << "RECURSIVEMATCH";
+        }
+        if (d->extendedOptions & ReturnSubscribed) {
+            returnOptions << "SUBSCRIBED";
+        }
+        //A level is of little use without knowing which mailboxes have one below
+        if ((d->extendedOptions & ReturnChildren) || d->childrenOnly) {
+            returnOptions << "CHILDREN";
+        }
+    }
+    if (specialUse) {
+        if (d->extendedOptions & SelectSpecialUse) {
+            selectionOptions << "SPECIAL-USE";
+        }
+        if (d->extendedOptions & ReturnSpecialUse) {
+            returnOptions << "SPECIAL-USE";
+        }
+    }
+    if (d->command == "LIST" && session->hasCapability("LIST-STATUS")) {
+        QList<QByteArray> items = d->statusItems;
+        if (d->mailBoxIdsEnabled && session->hasCapability("OBJECTID")) {
+            items << "MAILBOXID";
+        }
+        if (!items.isEmpty()) {
+            returnOptions << "STATUS (" + items.join(' ') + ')';
+        }
+    }
+    d->returnOptions = returnOptions.isEmpty() ? QByteArray() : " RETURN (" + returnOptions.join(' ') + ')';
+    const QByteArray selection = selectionOptions.isEmpty() ? QByteArray() : '(' + selectionOptions.join(' ') + ") ";
+
+    QList<MailBoxDescriptor> namespaces = d->namespaces;
+    if (namespaces.isEmpty() && d->sessionNamespaces && d->m_session->hasNamespaces()) {
+        namespaces = d->m_session->personalNamespaces() + d->m_session->userNamespaces() + d->m_session->sharedNamespaces();
+    }
+
+    QList<QByteArray> patterns;
+    if (d->childrenOnly) {
+        if (d->childrenOf.name.isEmpty()) {
+            patterns << "%";
+        } else {
+            QString pattern = d->childrenOf.name;
+            //Without a separator the name is taken as the prefix of the level
+            if (!d->childrenOf.separator.isNull() && !pattern.endsWith(d->childrenOf.separator)) {
+                pattern += d->childrenOf.separator;
+            }
+            patterns << '\"' + d->sessionInternal()->encodeMailBoxName(pattern + QLatin1Char('%')) + '\"';
+        }
+    } else if (namespaces.isEmpty()) {
+        patterns << "*";
+    } else {
+        foreach (const MailBoxDescriptor &descriptor, namespaces) {
             if (descriptor.name.endsWith(descriptor.separator)) {
-                QString name = encodeImapFolderName(descriptor.name);
+                QByteArray name = d->sessionInternal()->encodeMailBoxName(descriptor.name);
                 name.chop(1);
-                d->sendCommand(d->command,
-                        parameters.arg(name).toUtf8());
+                patterns << '\"' + name + '\"';
             }
+            patterns << '\"' + d->sessionInternal()->encodeMailBoxName(descriptor.name + QLatin1Char('*')) + '\"';
+        }
+    }
 
-            d->sendCommand(d->command,
-                    parameters.arg(descriptor.name + QLatin1Char('*')).toUtf8());
+    if (listExtended && patterns.size() > 1) {
+        d->sendCommand(d->command, selection + "\"\" (" + patterns.join(' ') + ')' + d->returnOptions);
+    } else {
+        foreach (const QByteArray &pattern, patterns) {
+            d->sendCommand(d->command, selection + "\"\" " + pattern + d->returnOptions);
         }
     }
 }
@@ -131,20 +282,51 @@ void ListJob::handleResponse(const Message &response)
                 separator = "/"; //krazy:exclude=doublequote_chars since a QByteArray
             }
             Q_ASSERT(separator.size() == 1);
-            QByteArray fullName;
-            for (int i = 4; i < response.content.size(); i++) {
-                fullName += response.content[i].toString() + ' ';
+            //Unquoted names with spaces come in several parts
+            QByteArray fullName = response.content[4].toString();
+            for (int i = 5; i < response.content.size(); i++) {
+                if (response.content[i].type() == Message::Part::List) {
+                    //Extended data like CHILDINFO (RFC 5258) follows the name
+                    break;
+                }
+                fullName += ' ' + response.content[i].toString();
             }
-            fullName.chop(1);
-
-            fullName = decodeImapFolderName(fullName);
 
             MailBoxDescriptor mailBoxDescriptor;
             mailBoxDescriptor.separator = QLatin1Char(separator[0]);
-            mailBoxDescriptor.name = QString::fromUtf8(fullName);
+            mailBoxDescriptor.name = d->sessionInternal()->decodeMailBoxName(fullName);
             convertInboxName(mailBoxDescriptor);
 
+            d->lastSeparator = mailBoxDescriptor.separator;
             emit resultReceived(mailBoxDescriptor, flags);
+        } else if (!d->returnOptions.isEmpty() && response.content.size() >= 4
+                   && response.content[1].keyword() == ImapKeyword::Status
+                   && response.content[3].type() == Message::Part::List) {
+            // * STATUS "INBOX" (MESSAGES 17 UNSEEN 2 MAILBOXID (F2212ea87-6097-4256-9d51-71338625))
+            MailBoxDescriptor mailBoxDescriptor;
+            mailBoxDescriptor.separator = d->lastSeparator;
+            mailBoxDescriptor.name = d->sessionInternal()->decodeMailBoxName(response.content[2].toString());
+            convertInboxName(mailBoxDescriptor);
+
+            QList<QPair<QByteArray, qint64> > status;
+            const QList<QByteArray> &items = response.content[3].toList();
+            for (int i = 0; i + 1 < items.size(); i += 2) {
+                if (items[i] == "MAILBOXID") {
+                    emit mailBoxIdReceived(mailBoxDescriptor, JobPrivate::parseObjectId(items[i + 1]));
+                    continue;
+                }
+                if (items[i] == "APPENDLIMIT") {
+                    //NIL if the mailbox has no limit
+                    const qint64 limit = items[i + 1] == "NIL" ? -1 : items[i + 1].toLongLong();
+                    d->sessionInternal()->rememberAppendLimit(mailBoxDescriptor.name, limit);
+                    status << qMakePair(QByteArray("APPENDLIMIT"), limit);
+                    continue;
+                }
+                status << qMakePair(response.owned(items[i]), items[i + 1].toLongLong());
+            }
+            if (!status.isEmpty()) {
+                emit statusReceived(mailBoxDescriptor, status);
+            }
         }
     }
 }
@@ -152,14 +334,11 @@ void ListJob::handleResponse(const Message &response)
 void ListJob::convertInboxName(KIMAP2::MailBoxDescriptor &descriptor)
 {
     //Inbox must be case sensitive, according to the RFC, so make it always uppercase
-    QStringList pathParts = descriptor.name.split(descriptor.separator);
-    if (!pathParts.isEmpty() &&
-            pathParts[0].compare(QLatin1String("INBOX"), Qt::CaseInsensitive) == 0) {
-        pathParts.removeAt(0);
-        descriptor.name = QStringLiteral("INBOX");
-        if (!pathParts.isEmpty()) {
-            descriptor.name += descriptor.separator + pathParts.join(descriptor.separator);
-        }
+    static const QString inbox = QStringLiteral("INBOX");
+    const QString &name = descriptor.name;
+    if (!name.startsWith(inbox) && name.startsWith(inbox, Qt::CaseInsensitive)
+            && (name.size() == inbox.size() || name.at(inbox.size()) == descriptor.separator)) {
+        descriptor.name.replace(0, inbox.size(), inbox);
     }
 }
 #include "moc_listjob.cpp"
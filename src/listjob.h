@@ -55,12 +55,27 @@ class KIMAP2_EXPORT ListJob : public Job
 
 public:
     enum Option {
-        NoOption = 0x0,         /**< List only subscribed mailboxes. (Uses the LSUB IMAP command.) */
+        NoOption = 0x0,         /**< List only subscribed mailboxes. (Uses the LSUB IMAP command, or LIST (SUBSCRIBED) with IMAP4rev2.) */
         IncludeUnsubscribed,    /**< List subscribed and unsubscribed mailboxes. (Uses the LIST IMAP command.) */
         IncludeFolderRoleFlags  /**< List subscribed and unsubscribed mailboxes with flags to identify standard mailboxes whose name may be localized.
                                    The server must support the XLIST extension. */
     };
 
+    /**
+     * The selection and return options of LIST-EXTENDED (RFC 5258) and SPECIAL-USE (RFC 6154).
+     */
+    enum ExtendedOption {
+        NoExtendedOption = 0x0,
+        SelectSubscribed = 0x1,     /**< Only subscribed mailboxes, including ones that don't exist (anymore). */
+        SelectRemote = 0x2,         /**< Include remote mailboxes, e.g. with mailbox referrals. */
+        SelectRecursiveMatch = 0x4, /**< Report parents of matching mailboxes with CHILDINFO, with SelectSubscribed. */
+        SelectSpecialUse = 0x8,     /**< Only mailboxes with a special use, like \Sent or \Drafts. */
+        ReturnSubscribed = 0x10,    /**< Add the \Subscribed flag to subscribed mailboxes. */
+        ReturnChildren = 0x20,      /**< Add \HasChildren or \HasNoChildren. */
+        ReturnSpecialUse = 0x40     /**< Add the special use flags, like \Sent or \Drafts. */
+    };
+    Q_DECLARE_FLAGS(ExtendedOptions, ExtendedOption)
+
     explicit ListJob(Session *session);
     virtual ~ListJob();
 
@@ -70,9 +85,76 @@ public:
     void setQueriedNamespaces(const QList<MailBoxDescriptor> &namespaces);
     QList<MailBoxDescriptor> queriedNamespaces() const;
 
+    /**
+     * Queries all namespaces the session knows from an earlier NamespaceJob, see
+     * Session::hasNamespaces(), unless setQueriedNamespaces() was given some.
+     *
+     * Without known namespaces everything is listed, as by default.
+     */
+    void setQueriesSessionNamespaces(bool enabled);
+    bool queriesSessionNamespaces() const;
+
+    /**
+     * Requests the MAILBOXID (RFC 8474) of each mailbox along with the list, so
+     * renamed mailboxes can be recognized, see mailBoxIdReceived().
+     *
+     * Only used with IncludeUnsubscribed and if the server has both the LIST-STATUS (RFC 5819)
+     * and the OBJECTID capability.
+     */
+    void setMailBoxIdsEnabled(bool enabled);
+    bool mailBoxIdsEnabled() const;
+
+    /**
+     * Requests the status of each mailbox along with the list, e.g. "MESSAGES",
+     * "UNSEEN" and "UIDNEXT", instead of a StatusJob per mailbox, see statusReceived().
+     *
+     * Only used with IncludeUnsubscribed and if the server has the LIST-STATUS (RFC 5819)
+     * capability, the status has to be requested separately otherwise.
+     */
+    void setStatusItems(const QList<QByteArray> &items);
+    QList<QByteArray> statusItems() const;
+
+    /**
+     * Sets the LIST-EXTENDED (RFC 5258) and SPECIAL-USE (RFC 6154) options.
+     *
+     * With ReturnSubscribed and ReturnSpecialUse, one LIST tells which mailboxes are
+     * subscribed and which roles they have, without a separate LSUB or XLIST. The flags
+     * are reported with resultReceived(), in lower case like all others.
+     *
+     * Only used with IncludeUnsubscribed and if the server has the LIST-EXTENDED capability,
+     * the special use options also need SPECIAL-USE. With LIST-EXTENDED, all queried
+     * namespaces are matched by a single command.
+     */
+    void setExtendedOptions(ExtendedOptions options);
+    ExtendedOptions extendedOptions() const;
+
+    /**
+     * Lists only the mailboxes one level below @p mailBox, with the % wildcard, instead of the
+     * whole hierarchy below the queried namespaces. A descriptor with an empty name lists the
+     * top level.
+     *
+     * The queried namespaces are not used then. With LIST-EXTENDED, CHILDREN is returned as well,
+     * so the results tell which mailboxes have children to list in turn, see MailBoxTree.
+     */
+    void setChildrenOf(const MailBoxDescriptor &mailBox);
+    MailBoxDescriptor childrenOf() const;
+    bool listsChildrenOnly() const;
+
 Q_SIGNALS:
     void resultReceived(const KIMAP2::MailBoxDescriptor &descriptors, const QList<QByteArray> &flags);
 
+    /**
+     * The MAILBOXID of a mailbox, emitted after its resultReceived(), see setMailBoxIdsEnabled().
+     */
+    void mailBoxIdReceived(const KIMAP2::MailBoxDescriptor &descriptor, const QByteArray &mailBoxId);
+
+    /**
+     * The status of a mailbox, emitted after its resultReceived(), see setStatusItems().
+     *
+     * Mailboxes that can't be selected have no status.
+     */
+    void statusReceived(const KIMAP2::MailBoxDescriptor &descriptor, const QList<QPair<QByteArray, qint64> > &status);
+
 protected:
     void doStart() Q_DECL_OVERRIDE;
     void handleResponse(const Message &response) Q_DECL_OVERRIDE;
@@ -90,6 +172,8 @@ private:
 
 }
 
+Q_DECLARE_OPERATORS_FOR_FLAGS(KIMAP2::ListJob::ExtendedOptions)
+
 Q_DECLARE_METATYPE(KIMAP2::MailBoxDescriptor)
 
 #endif
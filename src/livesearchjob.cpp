@@ -0,0 +1,225 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "livesearchjob.h"
+
+#include "kimap_debug.h"
+
+#include "job_p.h"
+#include "message_p.h"
+#include "session_p.h"
+
+namespace KIMAP2
+{
+class LiveSearchJobPrivate : public JobPrivate
+{
+public:
+    LiveSearchJobPrivate(Session *session, const QString &name)
+        : JobPrivate(session, name), uidBased(false), idling(false), stopRequested(false), originalSocketTimeout(-1) { }
+    ~LiveSearchJobPrivate() { }
+
+    /**
+     * Returns the sets of an ADDTO or REMOVEFROM like "(0 12:13 0 27)", ignoring the positions,
+     * which only matter for a sorted context.
+     */
+    static ImapSet updatedSet(const Message::Part &part)
+    {
+        ImapSet set;
+        const QList<QByteArray> items = part.toList();
+        for (int i = 0; i + 1 < items.size(); i += 2) {
+            foreach (const ImapSet::Range &range, ImapSet::fromImapSequenceSet(items.at(i + 1)).ranges()) {
+                set.add(ImapInterval(range.begin, range.end));
+            }
+        }
+        set.optimize();
+        return set;
+    }
+
+    /**
+     * Ends the updates of the search, the job finishes when this completes.
+     */
+    void cancelUpdate()
+    {
+        sendCommand("CANCELUPDATE", '\"' + searchTag + '\"');
+    }
+
+    bool uidBased;
+    Term term;
+    ImapSet results;
+    QByteArray searchTag;
+    QByteArray idleTag;
+    bool idling;
+    bool stopRequested;
+    int originalSocketTimeout;
+};
+}
+
+using namespace KIMAP2;
+
+LiveSearchJob::LiveSearchJob(Session *session)
+    : Job(*new LiveSearchJobPrivate(session, "LiveSearch"))
+{
+    connect(this, &KJob::result, this, [this]() {
+        Q_D(LiveSearchJob);
+        if (d->originalSocketTimeout != -1) {
+            d->sessionInternal()->setSocketTimeout(d->originalSocketTimeout);
+        }
+    });
+}
+
+LiveSearchJob::~LiveSearchJob()
+{
+}
+
+void LiveSearchJob::setUidBased(bool uidBased)
+{
+    Q_D(LiveSearchJob);
+    d->uidBased = uidBased;
+}
+
+bool LiveSearchJob::isUidBased() const
+{
+    Q_D(const LiveSearchJob);
+    return d->uidBased;
+}
+
+void LiveSearchJob::setTerm(const Term &term)
+{
+    Q_D(LiveSearchJob);
+    d->term = term;
+}
+
+ImapSet LiveSearchJob::results() const
+{
+    Q_D(const LiveSearchJob);
+    return d->results;
+}
+
+void LiveSearchJob::stop()
+{
+    Q_D(LiveSearchJob);
+    if (!d->idling) {
+        //Cancelled once the search or IDLE got that far
+        d->stopRequested = true;
+        return;
+    }
+    d->idling = false;
+    d->sessionInternal()->sendData("DONE");
+}
+
+void LiveSearchJob::doStart()
+{
+    Q_D(LiveSearchJob);
+
+    const QStringList capabilities = d->m_session->capabilities();
+    if (!capabilities.contains(QStringLiteral("CONTEXT=SEARCH"), Qt::CaseInsensitive)
+            || !capabilities.contains(QStringLiteral("IDLE"), Qt::CaseInsensitive)) {
+        qCWarning(KIMAP2_LOG) << "Search updates require CONTEXT=SEARCH and IDLE";
+        setError(KJob::UserDefinedError);
+        setErrorText(QStringLiteral("The server does not support CONTEXT=SEARCH and IDLE"));
+        emitResult();
+        return;
+    }
+
+    QByteArray criteria = "ALL";
+    if (!d->term.isNull()) {
+        criteria = d->term.serialize();
+        if (criteria.startsWith('(')) {
+            criteria = criteria.mid(1, criteria.size() - 2);
+        }
+    }
+    d->sendCommand(d->uidBased ? "UID SEARCH" : "SEARCH", "RETURN (ALL UPDATE) " + criteria);
+    //The updates refer to the search by its tag
+    d->searchTag = d->tags.last();
+}
+
+void LiveSearchJob::handleResponse(const Message &response)
+{
+    Q_D(LiveSearchJob);
+
+    if (response.content.size() >= 2 && response.content[1].keyword() == ImapKeyword::Ok) {
+        const QByteArray tag = response.content.first().toString();
+        if (tag == d->searchTag && d->tags.contains(tag)) {
+            //Instead of finishing, wait for the updates
+            d->tags.removeAll(tag);
+            if (d->stopRequested) {
+                d->cancelUpdate();
+                return;
+            }
+            d->originalSocketTimeout = d->sessionInternal()->socketTimeout();
+            d->sessionInternal()->setSocketTimeout(-1);
+            d->sendCommand("IDLE", {});
+            d->idleTag = d->tags.last();
+            return;
+        }
+        if (!d->idleTag.isEmpty() && tag == d->idleTag) {
+            d->tags.removeAll(tag);
+            d->idleTag.clear();
+            d->cancelUpdate();
+            return;
+        }
+    }
+
+    if (handleErrorReplies(response) == Handled) {
+        return;
+    }
+    if (response.content.isEmpty()) {
+        return;
+    }
+    if (response.content[0].toString() == "+") {
+        d->idling = true;
+        if (d->stopRequested) {
+            stop();
+        }
+        return;
+    }
+    if (response.content.size() < 2 || response.content[1].keyword() != ImapKeyword::ESearch) {
+        return;
+    }
+
+    // * ESEARCH (TAG "A000001") UID ADDTO (0 12:13)
+    for (int i = 2; i < response.content.size(); i++) {
+        const Message::Part &part = response.content[i];
+        if (part.type() == Message::Part::List) {
+            const QList<QByteArray> correlator = part.toList();
+            if (correlator.size() == 2 && correlator[0].toUpper() == "TAG" && correlator[1] != d->searchTag) {
+                return;
+            }
+            continue;
+        }
+        const QByteArray name = part.toString().toUpper();
+        if (name == "UID" || i + 1 >= response.content.size()) {
+            continue;
+        }
+        const Message::Part &value = response.content[++i];
+        if (name == "ALL") {
+            const ImapSet all = ImapSet::fromImapSequenceSet(value.toString());
+            d->results = d->results.united(all);
+            Q_EMIT resultsAdded(this, all);
+        } else if (name == "ADDTO") {
+            const ImapSet added = LiveSearchJobPrivate::updatedSet(value);
+            d->results = d->results.united(added);
+            Q_EMIT resultsAdded(this, added);
+        } else if (name == "REMOVEFROM") {
+            const ImapSet removed = LiveSearchJobPrivate::updatedSet(value);
+            d->results = d->results.subtracted(removed);
+            Q_EMIT resultsRemoved(this, removed);
+        }
+    }
+}
+
+#include "moc_livesearchjob.cpp"
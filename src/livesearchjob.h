@@ -0,0 +1,92 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_LIVESEARCHJOB_H
+#define KIMAP2_LIVESEARCHJOB_H
+
+#include "kimap2_export.h"
+
+#include "imapset.h"
+#include "job.h"
+#include "searchjob.h"
+
+namespace KIMAP2
+{
+
+class Session;
+struct Message;
+class LiveSearchJobPrivate;
+
+/**
+ * Keeps the result of a search in the selected mailbox up to date (RFC 5267).
+ *
+ * The job searches with RETURN (ALL UPDATE) and then idles the connection like
+ * IdleJob does, while the server reports the messages that start or stop matching,
+ * see resultsAdded() and resultsRemoved(). This replaces running the same SearchJob
+ * again and again.
+ *
+ * The job runs until stop() is called, which ends the idling and cancels the
+ * updates with CANCELUPDATE. It requires the CONTEXT=SEARCH and IDLE capabilities.
+ */
+class KIMAP2_EXPORT LiveSearchJob : public Job
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(LiveSearchJob)
+
+public:
+    explicit LiveSearchJob(Session *session);
+    virtual ~LiveSearchJob();
+
+    /**
+     * Whether the results are UIDs or sequence numbers. Sequence numbers shift with
+     * every expunge, so UIDs are the better choice for a long-lived search.
+     */
+    void setUidBased(bool uidBased);
+    bool isUidBased() const;
+
+    void setTerm(const Term &term);
+
+    /**
+     * The messages matching the term so far, with all updates applied.
+     */
+    ImapSet results() const;
+
+public Q_SLOTS:
+    /**
+     * Stops the updates. The job finishes once the server cancelled them.
+     */
+    void stop();
+
+Q_SIGNALS:
+    /**
+     * Messages started to match, first with all matches once the search completed.
+     */
+    void resultsAdded(KIMAP2::LiveSearchJob *job, const KIMAP2::ImapSet &added);
+
+    /**
+     * Messages no longer match, e.g. because they were flagged or expunged.
+     */
+    void resultsRemoved(KIMAP2::LiveSearchJob *job, const KIMAP2::ImapSet &removed);
+
+protected:
+    void doStart() Q_DECL_OVERRIDE;
+    void handleResponse(const Message &response) Q_DECL_OVERRIDE;
+};
+
+}
+
+#endif
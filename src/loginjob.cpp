@@ -29,6 +29,9 @@
 #include "rfccodecs.h"
 
 #include "common.h"
+#include "oauthtokenprovider.h"
+
+#include <QtCore/QPointer>
 
 extern "C" {
 #include <sasl/sasl.h>
@@ -68,10 +71,20 @@ public:
     bool startAuthentication();
     void sendPlainLogin();
     bool answerChallenge(const QByteArray &data);
+    bool isBearerMode() const;
+    void requestBearerToken();
+    void startBearerAuthentication();
+    QByteArray bearerResponse() const;
+    void answerBearerChallenge(const Message &response);
+    void tokenReceived(const QString &token);
     void sslResponse(bool response);
     void saveServerGreeting(const Message &response);
     void login();
     void retrieveCapabilities();
+    void setCapabilities(const QStringList &list);
+    void authenticate();
+    void pipelineFollowUp();
+    void rememberForReconnect();
 
     LoginJob *q;
 
@@ -87,6 +100,12 @@ public:
     QStringList capabilities;
     bool plainLoginDisabled = false;
     bool connectionIsEncrypted = false;
+    bool followUpPipelined = false;
+
+    QSharedPointer<OAuthTokenProvider> tokenProvider;
+    bool bearerResponseSent = false;
+    bool bearerRetried = false;
+    QByteArray bearerError;
 
     sasl_conn_t *conn;
     sasl_interact_t *client_interact;
@@ -221,15 +240,17 @@ void LoginJob::doStart()
 
     qCDebug(KIMAP2_LOG) << "doStart" << this;
 
-    connect(d->sessionInternal(), SIGNAL(encryptionNegotiationResult(bool)), this, SLOT(sslResponse(bool)));
+    //Direct, so that we keep talking to the server on the session thread
+    connect(d->sessionInternal(), SIGNAL(encryptionNegotiationResult(bool)), this, SLOT(sslResponse(bool)), Qt::DirectConnection);
 
     if (session()->state() == Session::Disconnected) {
         auto guard = new QObject(this);
         QObject::connect(session(), &Session::stateChanged, guard, [d, guard](KIMAP2::Session::State newState, KIMAP2::Session::State) {
             qCDebug(KIMAP2_LOG) << "Session state changed" << newState;
+            d->m_session->disconnect(guard);
+            guard->deleteLater();
             d->login();
-            delete guard;
-        });
+        }, Qt::DirectConnection);
         if (!d->startTls && d->encryptionMode != QSsl::UnknownProtocol) {
             //We have to encrypt for the greeting
             d->sessionInternal()->startSsl(d->encryptionMode);
@@ -292,11 +313,72 @@ void LoginJobPrivate::sslResponse(bool response)
 
 void LoginJobPrivate::retrieveCapabilities()
 {
-    qCDebug(KIMAP2_LOG) << "Retrieving capabilities.";
     authState = LoginJobPrivate::Capability;
+    //The server may have announced them already, e.g. in the greeting, or we know them from before
+    QStringList known = m_session->capabilities();
+    CapabilityCache *cache = m_session->capabilityCache();
+    if (known.isEmpty() && cache) {
+        known = cache->capabilities(m_session->hostName(), m_session->port());
+    }
+    if (!known.isEmpty()) {
+        qCDebug(KIMAP2_LOG) << "Using known capabilities: " << known;
+        setCapabilities(known);
+        authenticate();
+        return;
+    }
+    qCDebug(KIMAP2_LOG) << "Retrieving capabilities.";
     sendCommand("CAPABILITY", {});
 }
 
+void LoginJobPrivate::setCapabilities(const QStringList &list)
+{
+    capabilities = list;
+    plainLoginDisabled = list.contains(QLatin1String("LOGINDISABLED"), Qt::CaseInsensitive);
+}
+
+void LoginJobPrivate::authenticate()
+{
+    //cleartext login, if enabled
+    if (authMode.isEmpty()) {
+        if (plainLoginDisabled) {
+            q->setError(LoginFailed);
+            q->setErrorText(QString("Login failed, plain login is disabled by the server."));
+            q->emitResult();
+        } else {
+            sendPlainLogin();
+        }
+    } else {
+        bool authModeSupported = false;
+        //PLAIN is always supported as defined in the standard. We should also get an AUTH= capability, but in case a server doesn't properly announce it we'll just accept it anyways.
+        if (authMode == "PLAIN") {
+            authModeSupported = true;
+        }
+        //find the selected SASL authentication method
+        Q_FOREACH (const QString &capability, capabilities) {
+            if (capability.startsWith(QLatin1String("AUTH="), Qt::CaseInsensitive)) {
+                if (capability.mid(5).compare(authMode, Qt::CaseInsensitive) == 0) {
+                    authModeSupported = true;
+                    break;
+                }
+            }
+        }
+        if (!authModeSupported) {
+            q->setError(LoginFailed);
+            q->setErrorText(QString("Login failed, authentication mode %1 is not supported by the server.").arg(authMode));
+            q->emitResult();
+        } else if (isBearerMode()) {
+            authState = LoginJobPrivate::Authenticate;
+            if (tokenProvider) {
+                requestBearerToken();
+            } else {
+                startBearerAuthentication();
+            }
+        } else if (!startAuthentication()) {
+            q->emitResult(); //problem, we're done
+        }
+    }
+}
+
 void LoginJob::handleResponse(const Message &response)
 {
     Q_D(LoginJob);
@@ -353,25 +435,38 @@ void LoginJob::handleResponse(const Message &response)
         //server replied with NO or BAD for SASL authentication
         if (d->authState == LoginJobPrivate::Authenticate) {
             sasl_dispose(&d->conn);
+            if (d->isBearerMode() && d->tokenProvider) {
+                d->tokenProvider->invalidate(d->password);
+                if (!d->bearerRetried) {
+                    //The token may have expired since it was fetched, try once more with a fresh one
+                    d->bearerRetried = true;
+                    d->bearerResponseSent = false;
+                    d->bearerError.clear();
+                    d->requestBearerToken();
+                    return;
+                }
+            }
         }
 
         setError(LoginFailed);
-        setErrorText(QString("%1 failed, server replied: %2").arg(commandName).arg(QLatin1String(response.toString().constData())));
+        if (d->bearerError.isEmpty()) {
+            setErrorText(QString("%1 failed, server replied: %2").arg(commandName).arg(QLatin1String(response.toString().constData())));
+        } else {
+            setErrorText(QString("%1 failed, server replied: %2 %3").arg(commandName).arg(QLatin1String(response.toString().constData())).arg(QString::fromUtf8(d->bearerError)));
+        }
         emitResult();
         return;
 
     case UNTAGGED:
         // The only untagged response interesting for us here is CAPABILITY
         if (response.content[1].toString() == "CAPABILITY") {
+            QStringList capabilities = d->capabilities;
             QList<Message::Part>::const_iterator p = response.content.begin() + 2;
             while (p != response.content.end()) {
-                QString capability = QLatin1String(p->toString());
-                d->capabilities << capability;
-                if (capability == QLatin1String("LOGINDISABLED")) {
-                    d->plainLoginDisabled = true;
-                }
+                capabilities << QLatin1String(p->toString());
                 ++p;
             }
+            d->setCapabilities(capabilities);
             qCInfo(KIMAP2_LOG) << "Capabilities updated: " << d->capabilities;
         }
         break;
@@ -398,6 +493,9 @@ void LoginJob::handleResponse(const Message &response)
             challengeResponse += d->password.toUtf8();
             challengeResponse = challengeResponse.toBase64();
             d->sessionInternal()->sendData(challengeResponse);
+            d->pipelineFollowUp();
+        } else if (d->isBearerMode()) {
+            d->answerBearerChallenge(response);
         } else if (response.content.size() >= 2) {
             if (!d->answerChallenge(QByteArray::fromBase64(response.content[1].toString()))) {
                 emitResult(); //error, we're done
@@ -415,38 +513,12 @@ void LoginJob::handleResponse(const Message &response)
             d->sessionInternal()->startSsl(d->encryptionMode);
             break;
         case LoginJobPrivate::Capability:
-            //cleartext login, if enabled
-            if (d->authMode.isEmpty()) {
-                if (d->plainLoginDisabled) {
-                    setError(LoginFailed);
-                    setErrorText(QString("Login failed, plain login is disabled by the server."));
-                    emitResult();
-                } else {
-                    d->sendPlainLogin();
-                }
-            } else {
-                bool authModeSupported = false;
-                //PLAIN is always supported as defined in the standard. We should also get an AUTH= capability, but in case a server doesn't properly announce it we'll just accept it anyways.
-                if (d->authMode == "PLAIN") {
-                    authModeSupported = true;
-                }
-                //find the selected SASL authentication method
-                Q_FOREACH (const QString &capability, d->capabilities) {
-                    if (capability.startsWith(QLatin1String("AUTH="))) {
-                        if (capability.mid(5) == d->authMode) {
-                            authModeSupported = true;
-                            break;
-                        }
-                    }
-                }
-                if (!authModeSupported) {
-                    setError(LoginFailed);
-                    setErrorText(QString("Login failed, authentication mode %1 is not supported by the server.").arg(d->authMode));
-                    emitResult();
-                } else if (!d->startAuthentication()) {
-                    emitResult(); //problem, we're done
+            if (CapabilityCache *cache = session()->capabilityCache()) {
+                if (!d->capabilities.isEmpty()) {
+                    cache->setCapabilities(session()->hostName(), session()->port(), d->capabilities);
                 }
             }
+            d->authenticate();
             break;
 
         case LoginJobPrivate::Authenticate:
@@ -454,6 +526,7 @@ void LoginJob::handleResponse(const Message &response)
         // Fall through
         case LoginJobPrivate::Login:
             d->saveServerGreeting(response);
+            d->rememberForReconnect();
             emitResult(); //got an OK, command done
             break;
 
@@ -480,6 +553,8 @@ bool LoginJobPrivate::startAuthentication()
     const char *out = Q_NULLPTR;
     uint outlen = 0;
     const char *mechusing = Q_NULLPTR;
+    //RFC 4959, saves the round trip for the first continuation
+    const bool canSendInitialResponse = capabilities.contains(QStringLiteral("SASL-IR"), Qt::CaseInsensitive);
 
     int result = sasl_client_new("imap", m_session->hostName().toLatin1(), Q_NULLPTR, nullptr, callbacks, 0, &conn);
     if (result != SASL_OK) {
@@ -490,7 +565,7 @@ bool LoginJobPrivate::startAuthentication()
     }
 
     do {
-        result = sasl_client_start(conn, authMode.toLatin1(), &client_interact, capabilities.contains(QStringLiteral("SASL-IR")) ? &out : Q_NULLPTR, &outlen, &mechusing);
+        result = sasl_client_start(conn, authMode.toLatin1(), &client_interact, canSendInitialResponse ? &out : Q_NULLPTR, &outlen, &mechusing);
 
         if (result == SASL_INTERACT) {
             if (!sasl_interact()) {
@@ -513,15 +588,101 @@ bool LoginJobPrivate::startAuthentication()
     QByteArray tmp = QByteArray::fromRawData(out, outlen);
     QByteArray challenge = tmp.toBase64();
 
-    if (challenge.isEmpty()) {
+    if (challenge.isEmpty() && !(canSendInitialResponse && out)) {
         sendCommand("AUTHENTICATE", authMode.toLatin1());
     } else {
-        sendCommand("AUTHENTICATE", authMode.toLatin1() + ' ' + challenge);
+        //An empty initial response is sent as "="
+        sendCommand("AUTHENTICATE", authMode.toLatin1() + ' ' + (challenge.isEmpty() ? QByteArray("=") : challenge));
+        if (authMode == QLatin1String("PLAIN")) {
+            //The server completes PLAIN with the initial response without further challenges
+            pipelineFollowUp();
+        }
     }
 
     return true;
 }
 
+bool LoginJobPrivate::isBearerMode() const
+{
+    return authMode == QLatin1String("XOAUTH2") || authMode == QLatin1String("OAUTHBEARER");
+}
+
+void LoginJobPrivate::requestBearerToken()
+{
+    SessionPrivate *session = sessionInternal();
+    QPointer<LoginJob> guard(q);
+    tokenProvider->requestToken([session, guard](const QString &token) {
+        //The provider may call back from any thread
+        session->callInSessionThread([guard, token]() {
+            if (guard) {
+                guard->d_func()->tokenReceived(token);
+            }
+        });
+    });
+}
+
+void LoginJobPrivate::tokenReceived(const QString &token)
+{
+    if (token.isEmpty()) {
+        q->setError(LoginFailed);
+        q->setErrorText(QString("Login failed, no access token available."));
+        q->emitResult();
+        return;
+    }
+    password = token;
+    startBearerAuthentication();
+}
+
+/*
+ * XOAUTH2 and OAUTHBEARER only send the token, so we do without the SASL library.
+ */
+void LoginJobPrivate::startBearerAuthentication()
+{
+    authState = LoginJobPrivate::Authenticate;
+    if (capabilities.contains(QStringLiteral("SASL-IR"), Qt::CaseInsensitive)) {
+        bearerResponseSent = true;
+        sendCommand("AUTHENTICATE", authMode.toLatin1() + ' ' + bearerResponse().toBase64());
+    } else {
+        sendCommand("AUTHENTICATE", authMode.toLatin1());
+    }
+}
+
+QByteArray LoginJobPrivate::bearerResponse() const
+{
+    const char separator = '\x01';
+    const QByteArray auth = "auth=Bearer " + password.toUtf8();
+    if (authMode == QLatin1String("XOAUTH2")) {
+        return "user=" + userName.toUtf8() + separator + auth + separator + separator;
+    }
+    //RFC 7628, with the GS2 header of RFC 5801 where ',' and '=' in the authzid are escaped
+    QByteArray user = userName.toUtf8();
+    user.replace('=', "=3D").replace(',', "=2C");
+    return "n,a=" + user + ',' + separator
+           + "host=" + m_session->hostName().toUtf8() + separator
+           + "port=" + QByteArray::number(m_session->port()) + separator
+           + auth + separator + separator;
+}
+
+void LoginJobPrivate::answerBearerChallenge(const Message &response)
+{
+    if (!bearerResponseSent) {
+        //No SASL-IR, the server asks for the initial response
+        bearerResponseSent = true;
+        sessionInternal()->sendData(bearerResponse().toBase64());
+        return;
+    }
+    //The server rejected the token and sends the details as a challenge, which we have to
+    //acknowledge to get the tagged NO
+    if (response.content.size() >= 2) {
+        bearerError = QByteArray::fromBase64(response.content[1].toString());
+    }
+    if (authMode == QLatin1String("OAUTHBEARER")) {
+        sessionInternal()->sendData(QByteArray("\x01").toBase64());
+    } else {
+        sessionInternal()->sendData(QByteArray());
+    }
+}
+
 void LoginJobPrivate::sendPlainLogin()
 {
     authState = LoginJobPrivate::Login;
@@ -530,6 +691,14 @@ void LoginJobPrivate::sendPlainLogin()
             '"' + quoteIMAP(userName).toUtf8() + '"' +
             ' ' +
             '"' + quoteIMAP(password).toUtf8() + '"');
+    pipelineFollowUp();
+}
+
+void LoginJobPrivate::pipelineFollowUp()
+{
+    if (followUpPipelined) {
+        sessionInternal()->startFollowUp(q);
+    }
 }
 
 bool LoginJobPrivate::answerChallenge(const QByteArray &data)
@@ -583,6 +752,18 @@ QSsl::SslProtocol LoginJob::encryptionMode()
     return d->encryptionMode;
 }
 
+void LoginJob::setFollowUpPipelined(bool pipelined)
+{
+    Q_D(LoginJob);
+    d->followUpPipelined = pipelined;
+}
+
+bool LoginJob::isFollowUpPipelined() const
+{
+    Q_D(const LoginJob);
+    return d->followUpPipelined;
+}
+
 void LoginJob::setAuthenticationMode(AuthenticationMode mode)
 {
     Q_D(LoginJob);
@@ -603,11 +784,25 @@ void LoginJob::setAuthenticationMode(AuthenticationMode mode)
         break;
     case XOAuth2: d->authMode = QStringLiteral("XOAUTH2");
         break;
+    case OAuthBearer: d->authMode = QStringLiteral("OAUTHBEARER");
+        break;
     default:
         d->authMode = QStringLiteral("");
     }
 }
 
+void LoginJob::setTokenProvider(const QSharedPointer<OAuthTokenProvider> &provider)
+{
+    Q_D(LoginJob);
+    d->tokenProvider = provider;
+}
+
+QSharedPointer<OAuthTokenProvider> LoginJob::tokenProvider() const
+{
+    Q_D(const LoginJob);
+    return d->tokenProvider;
+}
+
 void LoginJob::connectionLost()
 {
     Q_D(LoginJob);
@@ -628,6 +823,29 @@ void LoginJob::connectionLost()
     }
 }
 
+void LoginJobPrivate::rememberForReconnect()
+{
+    //Copies, since the job is gone by the time the session reconnects
+    const QString userName = this->userName;
+    const QString authorizationName = this->authorizationName;
+    const QString password = this->password;
+    const QSsl::SslProtocol encryptionMode = this->encryptionMode;
+    const bool startTls = this->startTls;
+    const QString authMode = this->authMode;
+    const QSharedPointer<OAuthTokenProvider> tokenProvider = this->tokenProvider;
+    sessionInternal()->rememberLogin([=](Session *session) -> Job * {
+        LoginJob *job = new LoginJob(session);
+        job->setUserName(userName);
+        job->setAuthorizationName(authorizationName);
+        job->setPassword(password);
+        job->setEncryptionMode(encryptionMode, startTls);
+        job->d_func()->authMode = authMode;
+        //Asks again, since the token may have expired in the meantime
+        job->setTokenProvider(tokenProvider);
+        return job;
+    });
+}
+
 void LoginJobPrivate::saveServerGreeting(const Message &response)
 {
     // Concatenate the parts of the server response into a string, while dropping the first two parts
@@ -25,6 +25,7 @@
 #include "kimap2_export.h"
 
 #include "job.h"
+#include <QtCore/QSharedPointer>
 #include <QtNetwork/QSsl>
 
 namespace KIMAP2
@@ -33,6 +34,7 @@ namespace KIMAP2
 class Session;
 struct Message;
 class LoginJobPrivate;
+class OAuthTokenProvider;
 
 class KIMAP2_EXPORT LoginJob : public Job
 {
@@ -52,7 +54,8 @@ public:
         NTLM,
         GSSAPI,
         Anonymous,
-        XOAuth2
+        XOAuth2,
+        OAuthBearer
     };
 
     explicit LoginJob(Session *session);
@@ -108,8 +111,34 @@ public:
     */
     QSsl::SslProtocol encryptionMode();
 
+    /**
+     * XOAuth2 and OAuthBearer (RFC 7628) are handled without the SASL library and use the
+     * password as access token, unless a token provider is set. With SASL-IR they log in
+     * within a single round trip.
+     */
     void setAuthenticationMode(AuthenticationMode mode);
 
+    /**
+     * Gets the access token for XOAuth2 and OAuthBearer from @p provider instead of the password.
+     *
+     * A token the server rejects is invalidated and the login is tried once more with a new
+     * one, in case it had just expired. The provider is kept for the logins repeated when the
+     * session reconnects, and should be shared by all sessions of an account.
+     */
+    void setTokenProvider(const QSharedPointer<OAuthTokenProvider> &provider);
+    QSharedPointer<OAuthTokenProvider> tokenProvider() const;
+
+    /**
+     * Sends the command of the job queued after the login right behind the credentials,
+     * instead of waiting for the server to confirm the authentication first.
+     *
+     * Only used when the authentication finishes with the credentials we send, i.e. for
+     * LOGIN and PLAIN. The follow-up job, e.g. a SelectJob, fails with the server's reply
+     * if the login fails, and must not depend on continuation requests. Disabled by default.
+     */
+    void setFollowUpPipelined(bool pipelined);
+    bool isFollowUpPipelined() const;
+
 protected:
     void doStart() Q_DECL_OVERRIDE;
     void handleResponse(const Message &response) Q_DECL_OVERRIDE;
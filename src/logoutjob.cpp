@@ -47,6 +47,8 @@ LogoutJob::~LogoutJob()
 void LogoutJob::doStart()
 {
     Q_D(LogoutJob);
+    //The server closes the connection, which is no reason to reconnect
+    d->sessionInternal()->forgetLogin();
     d->sendCommand("LOGOUT", {});
 }
 
@@ -0,0 +1,258 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "mailboxscanjob.h"
+
+#include "kimap_debug.h"
+
+#include "job.h"
+#include "listjob.h"
+#include "session.h"
+#include "statusjob.h"
+
+#include <QtCore/QPointer>
+#include <QtCore/QSet>
+
+#include <algorithm>
+#include <limits>
+
+namespace KIMAP2
+{
+
+class MailboxScanJobPrivate
+{
+public:
+    MailboxScanJobPrivate(MailboxScanJob *job, Session *session)
+        : q(job),
+          session(session),
+          listStatus(false),
+          started(false),
+          finished(false)
+    {
+    }
+
+    QList<QByteArray> statusItems() const;
+    void statusReceived(const QString &mailBox, const QList<QPair<QByteArray, qint64> > &status);
+    void finish(KJob *job);
+
+    MailboxScanJob *const q;
+    QPointer<Session> session;
+    QHash<QString, MailboxFingerprint> previous;
+    QHash<QString, MailboxFingerprint> current;
+    // The mailboxes the LIST returned, and those a STATUS was refused for with [NONEXISTENT]
+    QSet<QString> listed;
+    QStringList nonexistent;
+    QStringList changed;
+    QStringList removed;
+    bool listStatus;
+    bool started;
+    bool finished;
+};
+
+}
+
+using namespace KIMAP2;
+
+MailboxFingerprint MailboxFingerprint::fromStatus(const QList<QPair<QByteArray, qint64> > &status)
+{
+    MailboxFingerprint fingerprint;
+    for (const QPair<QByteArray, qint64> &item : status) {
+        if (item.first == "MESSAGES") {
+            fingerprint.messages = item.second;
+        } else if (item.first == "UIDNEXT") {
+            fingerprint.uidNext = item.second;
+        } else if (item.first == "UIDVALIDITY") {
+            fingerprint.uidValidity = item.second;
+        } else if (item.first == "UNSEEN") {
+            fingerprint.unseen = item.second;
+        } else if (item.first == "HIGHESTMODSEQ") {
+            fingerprint.highestModSequence = quint64(item.second);
+        }
+    }
+    return fingerprint;
+}
+
+qint64 MailboxFingerprint::distance(const MailboxFingerprint &older) const
+{
+    if (uidValidity != older.uidValidity) {
+        return std::numeric_limits<qint64>::max();
+    }
+    //New messages, expunged ones on top of those, and changed flags
+    const qint64 added = qMax<qint64>(0, uidNext - older.uidNext);
+    const qint64 expunged = qMax<qint64>(0, older.messages + added - messages);
+    qint64 distance = added + expunged + qAbs(unseen - older.unseen);
+    if (highestModSequence != older.highestModSequence) {
+        //A mod-sequence can count several changes of the same message
+        distance += qMax<qint64>(1, qMin<qint64>(messages, highestModSequence - older.highestModSequence));
+    }
+    return distance;
+}
+
+bool MailboxFingerprint::operator==(const MailboxFingerprint &other) const
+{
+    return messages == other.messages && uidNext == other.uidNext && uidValidity == other.uidValidity
+           && unseen == other.unseen && highestModSequence == other.highestModSequence;
+}
+
+QList<QByteArray> MailboxScanJobPrivate::statusItems() const
+{
+    QList<QByteArray> items;
+    items << "MESSAGES" << "UIDNEXT" << "UIDVALIDITY" << "UNSEEN";
+    if (session->hasCapability(QStringLiteral("CONDSTORE")) || session->hasCapability(QStringLiteral("QRESYNC"))) {
+        items << "HIGHESTMODSEQ";
+    }
+    return items;
+}
+
+void MailboxScanJobPrivate::statusReceived(const QString &mailBox, const QList<QPair<QByteArray, qint64> > &status)
+{
+    if (!mailBox.isNull()) {
+        current.insert(mailBox, MailboxFingerprint::fromStatus(status));
+    }
+}
+
+void MailboxScanJobPrivate::finish(KJob *job)
+{
+    finished = true;
+    //A refused STATUS doesn't fail the scan as long as the server answered the others
+    if (job->error() && (job->error() != CommandFailed || listStatus || (current.isEmpty() && nonexistent.isEmpty()))) {
+        q->setError(job->error());
+        q->setErrorText(job->errorText());
+        current = previous;
+        q->emitResult();
+        return;
+    }
+
+    for (QHash<QString, MailboxFingerprint>::const_iterator it = previous.constBegin(); it != previous.constEnd(); ++it) {
+        if (current.contains(it.key())) {
+            continue;
+        }
+        if (listStatus ? !listed.contains(it.key()) : nonexistent.contains(it.key())) {
+            removed << it.key();
+        } else {
+            //No status this time, e.g. the mailbox can't be accessed right now, nothing is known to have changed
+            current.insert(it.key(), it.value());
+        }
+    }
+    std::sort(removed.begin(), removed.end());
+
+    QList<QPair<qint64, QString> > changes;
+    for (QHash<QString, MailboxFingerprint>::const_iterator it = current.constBegin(); it != current.constEnd(); ++it) {
+        const MailboxFingerprint older = previous.value(it.key());
+        if (!previous.contains(it.key()) || it.value() != older) {
+            changes << qMakePair(it.value().distance(older), it.key());
+        }
+    }
+    std::sort(changes.begin(), changes.end(), [](const QPair<qint64, QString> &left, const QPair<qint64, QString> &right) {
+        if (left.first != right.first) {
+            return left.first > right.first;
+        }
+        return left.second < right.second;
+    });
+
+    qCDebug(KIMAP2_LOG) << "Scanned" << current.size() << "mailboxes," << changes.size() << "changed," << removed.size() << "removed";
+
+    for (const QPair<qint64, QString> &change : changes) {
+        changed << change.second;
+        emit q->mailBoxChanged(change.second, current.value(change.second), previous.value(change.second));
+    }
+    q->emitResult();
+}
+
+MailboxScanJob::MailboxScanJob(Session *session, QObject *parent)
+    : KJob(parent), d(new MailboxScanJobPrivate(this, session))
+{
+}
+
+MailboxScanJob::~MailboxScanJob()
+{
+    delete d;
+}
+
+void MailboxScanJob::setFingerprints(const QHash<QString, MailboxFingerprint> &fingerprints)
+{
+    d->previous = fingerprints;
+}
+
+QHash<QString, MailboxFingerprint> MailboxScanJob::fingerprints() const
+{
+    return d->finished ? d->current : d->previous;
+}
+
+QStringList MailboxScanJob::changedMailBoxes() const
+{
+    return d->changed;
+}
+
+QStringList MailboxScanJob::removedMailBoxes() const
+{
+    return d->removed;
+}
+
+bool MailboxScanJob::usesListStatus() const
+{
+    return d->listStatus;
+}
+
+void MailboxScanJob::start()
+{
+    Q_ASSERT(!d->started);
+    d->started = true;
+    if (!d->session) {
+        setError(KJob::UserDefinedError);
+        setErrorText(QStringLiteral("The session was deleted"));
+        emitResult();
+        return;
+    }
+
+    d->listStatus = d->session->hasCapability(QStringLiteral("LIST-STATUS"));
+    if (d->listStatus) {
+        ListJob *list = new ListJob(d->session);
+        list->setOption(ListJob::IncludeUnsubscribed);
+        list->setStatusItems(d->statusItems());
+        connect(list, &ListJob::resultReceived, this, [this](const MailBoxDescriptor &descriptor, const QList<QByteArray> &) {
+            d->listed.insert(descriptor.name);
+        });
+        connect(list, &ListJob::statusReceived, this, [this](const MailBoxDescriptor &descriptor, const QList<QPair<QByteArray, qint64> > &status) {
+            d->statusReceived(descriptor.name, status);
+        });
+        connect(list, &KJob::result, this, [this](KJob *job) {
+            d->finish(job);
+        });
+        list->start();
+        return;
+    }
+
+    if (d->previous.isEmpty()) {
+        d->finished = true;
+        emitResult();
+        return;
+    }
+    QStringList mailBoxes = d->previous.keys();
+    std::sort(mailBoxes.begin(), mailBoxes.end());
+    StatusJob *status = new StatusJob(d->session);
+    status->setMailBoxes(mailBoxes);
+    status->setDataItems(d->statusItems());
+    connect(status, &StatusJob::statusReceived, this, [this](const QString &mailBox, const QList<QPair<QByteArray, qint64> > &status) {
+        d->statusReceived(mailBox, status);
+    });
+    connect(status, &KJob::result, this, [this, status](KJob *job) {
+        d->nonexistent = status->nonexistentMailBoxes();
+        d->finish(job);
+    });
+    status->start();
+}
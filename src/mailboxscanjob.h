@@ -0,0 +1,144 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_MAILBOXSCANJOB_H
+#define KIMAP2_MAILBOXSCANJOB_H
+
+#include "kimap2_export.h"
+
+#include <KJob>
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QPair>
+#include <QtCore/QStringList>
+
+namespace KIMAP2
+{
+
+class Session;
+class MailboxScanJobPrivate;
+
+/**
+ * What the STATUS of a mailbox looked like, to tell whether it changed since.
+ *
+ * Store it with the local copy of the mailbox and pass it to MailboxScanJob::setFingerprints().
+ */
+struct KIMAP2_EXPORT MailboxFingerprint {
+    MailboxFingerprint() : messages(0), uidNext(0), uidValidity(0), unseen(0), highestModSequence(0) { }
+
+    /**
+     * Takes the values from a status as reported by StatusJob or ListJob.
+     */
+    static MailboxFingerprint fromStatus(const QList<QPair<QByteArray, qint64> > &status);
+
+    /**
+     * Returns roughly how many messages changed from @p older to this fingerprint, the
+     * largest possible value if the mailbox was replaced, i.e. the UIDVALIDITY differs.
+     */
+    qint64 distance(const MailboxFingerprint &older) const;
+
+    bool operator==(const MailboxFingerprint &other) const;
+    bool operator!=(const MailboxFingerprint &other) const
+    {
+        return !(*this == other);
+    }
+
+    qint64 messages;
+    qint64 uidNext;
+    qint64 uidValidity;
+    qint64 unseen;
+    /**
+     * 0 if the server has no CONDSTORE (RFC 7162), then flag changes that keep the number
+     * of unseen messages go unnoticed.
+     */
+    quint64 highestModSequence;
+};
+
+/**
+ * Finds the mailboxes that changed since their fingerprints were taken, without selecting any.
+ *
+ * If the server has LIST-STATUS (RFC 5819), a single LIST returns the status of every
+ * mailbox of the account. Mailboxes that aren't in the fingerprints are then reported as
+ * changed, and those that are no longer listed as removed. Otherwise the STATUS of each
+ * mailbox in the fingerprints is requested, all commands pipelined, and a mailbox the server
+ * reports as [NONEXISTENT] is removed. Either way the scan takes about one round trip. A
+ * mailbox that is still there but got no status keeps its fingerprint.
+ *
+ * The capabilities are checked when the job starts, so the session should be logged in by then.
+ *
+ * Once the responses are in, the changed mailboxes are reported with mailBoxChanged(), those that
+ * changed the most first, and the job finishes. fingerprints() then has the fingerprints to pass
+ * to the next scan.
+ *
+ * @code
+ * KIMAP2::MailboxScanJob *scan = new KIMAP2::MailboxScanJob(session);
+ * scan->setFingerprints(store->fingerprints());
+ * connect(scan, &KIMAP2::MailboxScanJob::mailBoxChanged, syncer, &Syncer::syncMailBox);
+ * scan->start();
+ * @endcode
+ */
+class KIMAP2_EXPORT MailboxScanJob : public KJob
+{
+    Q_OBJECT
+
+public:
+    explicit MailboxScanJob(Session *session, QObject *parent = Q_NULLPTR);
+    ~MailboxScanJob();
+
+    /**
+     * The fingerprints of the mailboxes as of the last scan.
+     */
+    void setFingerprints(const QHash<QString, MailboxFingerprint> &fingerprints);
+
+    /**
+     * The fingerprints as of this scan once the job finished, those given otherwise.
+     */
+    QHash<QString, MailboxFingerprint> fingerprints() const;
+
+    /**
+     * The changed mailboxes in the order they were reported, known once the job finished.
+     */
+    QStringList changedMailBoxes() const;
+
+    /**
+     * The mailboxes that are gone, known once the job finished.
+     */
+    QStringList removedMailBoxes() const;
+
+    /**
+     * Whether the scan used LIST-STATUS, known once the job started.
+     */
+    bool usesListStatus() const;
+
+    void start() Q_DECL_OVERRIDE;
+
+Q_SIGNALS:
+    /**
+     * @p mailBox changed from @p previous to @p current. @p previous has a UIDVALIDITY of 0 for a new mailbox.
+     */
+    void mailBoxChanged(const QString &mailBox, const KIMAP2::MailboxFingerprint &current, const KIMAP2::MailboxFingerprint &previous);
+
+private:
+    Q_DISABLE_COPY(MailboxScanJob)
+    friend class MailboxScanJobPrivate;
+    MailboxScanJobPrivate *const d;
+};
+
+}
+
+#endif
@@ -0,0 +1,371 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "mailboxsyncjob.h"
+
+#include "kimap_debug.h"
+
+#include "imapbitmap.h"
+#include "job_p.h"
+#include "message_p.h"
+#include "session_p.h"
+
+namespace KIMAP2
+{
+class MailboxSyncJobPrivate : public JobPrivate
+{
+public:
+    MailboxSyncJobPrivate(Session *session, const QString &name)
+        : JobPrivate(session, name), batchSize(500), strategy(MailboxSyncJob::Full),
+          collecting(MailboxSyncJob::Full), reset(false), resetFetchSent(false) { }
+    ~MailboxSyncJobPrivate() { }
+
+    void addMessage(MailboxSyncJob *job, const MessageUpdate &update);
+    void flush(MailboxSyncJob *job);
+    void finish(MailboxSyncJob *job);
+    void restart(MailboxSyncJob *job);
+
+    QString mailBox;
+    MailboxSyncState previous;
+    int batchSize;
+    MailboxSyncJob::Strategy strategy;
+    // What the responses still to come are, a full fetch after a UIDVALIDITY change
+    MailboxSyncJob::Strategy collecting;
+    bool reset;
+    bool resetFetchSent;
+    QByteArray searchTag;
+
+    // The previous UIDs without open ends, ImapSet::contains() is too slow for every FETCH
+    ImapSet known;
+    ImapBitmap knownLookup;
+
+    MailboxSyncState state;
+    ImapSetBuilder newUids;
+    ImapSetBuilder seenUids;
+    ImapSet searched;
+    ImapSet vanished;
+    QVector<MailboxSyncJob::MessageState> newBatch;
+    QVector<MailboxSyncJob::MessageState> changedBatch;
+};
+}
+
+using namespace KIMAP2;
+
+void MailboxSyncJobPrivate::addMessage(MailboxSyncJob *job, const MessageUpdate &update)
+{
+    if (update.uid <= 0) {
+        return;
+    }
+    MailboxSyncJob::MessageState message;
+    message.uid = update.uid;
+    message.flags = update.flags;
+    message.modSeq = update.modSeq;
+
+    seenUids.add(update.uid);
+    if (knownLookup.contains(update.uid)) {
+        changedBatch << message;
+    } else {
+        newUids.add(update.uid);
+        newBatch << message;
+    }
+    if (newBatch.size() >= batchSize || changedBatch.size() >= batchSize) {
+        flush(job);
+    }
+}
+
+void MailboxSyncJobPrivate::flush(MailboxSyncJob *job)
+{
+    if (!newBatch.isEmpty()) {
+        emit job->newMessages(job, newBatch);
+        newBatch.clear();
+    }
+    if (!changedBatch.isEmpty()) {
+        emit job->changedMessages(job, changedBatch);
+        changedBatch.clear();
+    }
+}
+
+void MailboxSyncJobPrivate::finish(MailboxSyncJob *job)
+{
+    flush(job);
+
+    const ImapSet all = known.united(newUids.toSet());
+    switch (collecting) {
+    case MailboxSyncJob::Full:
+        state.uids = seenUids.toSet();
+        vanished = known.subtracted(state.uids);
+        break;
+    case MailboxSyncJob::CondStore:
+        //Without a search nothing was known, so nothing can be gone
+        if (!searchTag.isEmpty()) {
+            vanished = known.subtracted(searched);
+        }
+        state.uids = all.subtracted(vanished);
+        break;
+    case MailboxSyncJob::QResync:
+        vanished = vanished.intersected(all);
+        state.uids = all.subtracted(vanished);
+        break;
+    }
+    if (!vanished.isEmpty()) {
+        emit job->vanishedMessages(job, vanished);
+    }
+}
+
+void MailboxSyncJobPrivate::restart(MailboxSyncJob *job)
+{
+    //Everything known is gone, what the server reports now is new
+    reset = true;
+    if (!known.isEmpty()) {
+        emit job->vanishedMessages(job, known);
+    }
+    known = ImapSet();
+    knownLookup = ImapBitmap();
+    newUids.clear();
+    seenUids.clear();
+    searched = ImapSet();
+    vanished = ImapSet();
+    newBatch.clear();
+    changedBatch.clear();
+}
+
+MailboxSyncJob::MailboxSyncJob(Session *session)
+    : Job(*new MailboxSyncJobPrivate(session, "MailboxSync"))
+{
+}
+
+MailboxSyncJob::~MailboxSyncJob()
+{
+}
+
+void MailboxSyncJob::setMailBox(const QString &mailBox)
+{
+    Q_D(MailboxSyncJob);
+    d->mailBox = mailBox;
+}
+
+QString MailboxSyncJob::mailBox() const
+{
+    Q_D(const MailboxSyncJob);
+    return d->mailBox;
+}
+
+void MailboxSyncJob::setPreviousState(const MailboxSyncState &state)
+{
+    Q_D(MailboxSyncJob);
+    d->previous = state;
+}
+
+MailboxSyncState MailboxSyncJob::previousState() const
+{
+    Q_D(const MailboxSyncJob);
+    return d->previous;
+}
+
+void MailboxSyncJob::setBatchSize(int size)
+{
+    Q_D(MailboxSyncJob);
+    d->batchSize = qMax(1, size);
+}
+
+int MailboxSyncJob::batchSize() const
+{
+    Q_D(const MailboxSyncJob);
+    return d->batchSize;
+}
+
+MailboxSyncJob::Strategy MailboxSyncJob::strategy() const
+{
+    Q_D(const MailboxSyncJob);
+    return d->strategy;
+}
+
+bool MailboxSyncJob::uidValidityChanged() const
+{
+    Q_D(const MailboxSyncJob);
+    return d->reset;
+}
+
+MailboxSyncState MailboxSyncJob::state() const
+{
+    Q_D(const MailboxSyncJob);
+    return d->state;
+}
+
+void MailboxSyncJob::doStart()
+{
+    Q_D(MailboxSyncJob);
+
+    const QStringList capabilities = d->m_session->capabilities();
+    const bool condstore = capabilities.contains(QStringLiteral("CONDSTORE"), Qt::CaseInsensitive);
+    const bool hasPrevious = d->previous.uidValidity > 0 && d->previous.highestModSequence > 0;
+    if (hasPrevious && capabilities.contains(QStringLiteral("QRESYNC"), Qt::CaseInsensitive)) {
+        d->strategy = QResync;
+    } else if (hasPrevious && condstore) {
+        d->strategy = CondStore;
+    } else {
+        d->strategy = Full;
+    }
+    d->collecting = d->strategy;
+
+    if (d->previous.uidValidity > 0) {
+        d->known = ImapBitmap::fromImapSet(d->previous.uids, d->previous.nextUid - 1).toImapSet();
+        d->knownLookup = ImapBitmap::fromImapSet(d->known);
+    }
+
+    const QByteArray mailBox = '\"' + d->sessionInternal()->encodeMailBoxName(d->mailBox) + '\"';
+    const QByteArray changedSince = QByteArray::number(d->previous.highestModSequence);
+    switch (d->strategy) {
+    case QResync:
+        // The known UIDs are left out, the VANISHED response is filtered with them instead
+        if (!d->sessionInternal()->isExtensionEnabled("QRESYNC")) {
+            d->sendCommand("ENABLE", "QRESYNC");
+        }
+        d->sendCommand("SELECT", mailBox + " (QRESYNC (" + QByteArray::number(d->previous.uidValidity) + ' ' + changedSince + "))");
+        break;
+    case CondStore: {
+        d->sendCommand("SELECT", mailBox + " (CONDSTORE)");
+        const QVector<ImapSet::Range> ranges = d->known.ranges();
+        if (!ranges.isEmpty()) {
+            const QByteArray search = "UID 1:" + QByteArray::number(ranges.last().end ? ranges.last().end : ranges.last().begin);
+            if (capabilities.contains(QStringLiteral("ESEARCH"), Qt::CaseInsensitive)) {
+                d->sendCommand("UID SEARCH", "RETURN (ALL) " + search);
+            } else {
+                d->sendCommand("UID SEARCH", search);
+            }
+            d->searchTag = d->tags.last();
+        }
+        d->sendCommand("UID FETCH", "1:* (UID FLAGS) (CHANGEDSINCE " + changedSince + ')');
+        break;
+    }
+    case Full:
+        d->sendCommand("SELECT", condstore ? mailBox + " (CONDSTORE)" : mailBox);
+        d->sendCommand("UID FETCH", condstore ? "1:* (UID FLAGS MODSEQ)" : "1:* (UID FLAGS)");
+        break;
+    }
+}
+
+void MailboxSyncJob::handleResponse(const Message &response)
+{
+    Q_D(MailboxSyncJob);
+
+    const bool tagged = !response.content.isEmpty() && d->tags.contains(response.content.first().toString());
+    if (tagged && d->tags.size() == 1 && !error() && response.content.size() >= 2
+            && response.content[1].keyword() == ImapKeyword::Ok) {
+        if (d->reset && !d->resetFetchSent) {
+            //What the pipelined commands did was for the old UIDs, start over
+            d->resetFetchSent = true;
+            d->collecting = Full;
+            d->tags.clear();
+            d->sendCommand("UID FETCH", d->state.highestModSequence > 0 ? "1:* (UID FLAGS MODSEQ)" : "1:* (UID FLAGS)");
+            return;
+        }
+        d->finish(this);
+    }
+
+    if (handleErrorReplies(response) == Handled) {
+        return;
+    }
+    //Until the fetch after a UIDVALIDITY change, the messages reported are from before it
+    const bool stale = d->reset && !d->resetFetchSent;
+
+    ImapSet vanishedUids;
+    if (JobPrivate::parseVanished(response, &vanishedUids)) {
+        if (!stale && d->collecting == QResync) {
+            d->vanished = d->vanished.united(vanishedUids);
+        }
+        return;
+    }
+    JobPrivate::MessageUpdate update;
+    if (JobPrivate::parseMessageUpdate(response, &update)) {
+        if (!stale) {
+            d->addMessage(this, update);
+        }
+        return;
+    }
+    if (response.content.size() < 2) {
+        return;
+    }
+
+    const ImapKeyword code = response.content[1].keyword();
+    if (code == ImapKeyword::Ok) {
+        if (response.responseCode.isEmpty()) {
+            return;
+        }
+        const ImapKeyword responseCode = response.responseCode[0].keyword();
+        if (responseCode == ImapKeyword::NoModSeq) {
+            d->state.highestModSequence = 0;
+            return;
+        }
+        if (response.responseCode.size() < 2) {
+            return;
+        }
+        bool isInt;
+        const QByteArray value = response.responseCode[1].toString();
+        switch (responseCode) {
+        case ImapKeyword::HighestModSeq: {
+            const quint64 modSequence = value.toULongLong(&isInt);
+            if (isInt) {
+                d->state.highestModSequence = modSequence;
+            }
+            break;
+        }
+        case ImapKeyword::UidNext: {
+            const qint64 uidNext = value.toLongLong(&isInt);
+            if (isInt) {
+                d->state.nextUid = uidNext;
+            }
+            break;
+        }
+        case ImapKeyword::UidValidity: {
+            const qint64 uidValidity = value.toLongLong(&isInt);
+            if (!isInt) {
+                break;
+            }
+            d->state.uidValidity = uidValidity;
+            if (d->previous.uidValidity > 0 && uidValidity != d->previous.uidValidity && !d->reset) {
+                qCDebug(KIMAP2_LOG) << "UIDVALIDITY of" << d->mailBox << "changed, resyncing";
+                d->restart(this);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    } else if (stale || d->collecting != CondStore) {
+        return;
+    } else if (code == ImapKeyword::Search) {
+        for (int i = 2; i < response.content.size(); ++i) {
+            d->searched.add(response.content[i].toString().toLongLong());
+        }
+    } else if (code == ImapKeyword::ESearch) {
+        // * ESEARCH (TAG "A000002") UID ALL 1:20,22
+        for (int i = 2; i + 1 < response.content.size(); ++i) {
+            const Message::Part &part = response.content[i];
+            if (part.type() == Message::Part::List) {
+                const QList<QByteArray> correlator = part.toList();
+                if (correlator.size() == 2 && correlator[0].toUpper() == "TAG" && correlator[1] != d->searchTag) {
+                    return;
+                }
+            } else if (part.toString().toUpper() == "ALL") {
+                d->searched = ImapSet::fromImapSequenceSet(response.content[++i].toString());
+            }
+        }
+    }
+}
+
+#include "moc_mailboxsyncjob.cpp"
@@ -0,0 +1,149 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_MAILBOXSYNCJOB_H
+#define KIMAP2_MAILBOXSYNCJOB_H
+
+#include "kimap2_export.h"
+
+#include "imapset.h"
+#include "job.h"
+
+#include <QtCore/QVector>
+
+namespace KIMAP2
+{
+
+class Session;
+struct Message;
+class MailboxSyncJobPrivate;
+
+/**
+ * What a MailboxSyncJob learned about a mailbox, and what it needs for the next sync.
+ *
+ * Store it with the local copy of the mailbox and pass it to MailboxSyncJob::setPreviousState().
+ */
+struct KIMAP2_EXPORT MailboxSyncState {
+    MailboxSyncState() : uidValidity(0), nextUid(0), highestModSequence(0) { }
+
+    qint64 uidValidity;
+    qint64 nextUid;
+    /**
+     * 0 if the mailbox has no mod-sequences, then every sync is a full one.
+     */
+    quint64 highestModSequence;
+    /**
+     * The UIDs of all messages in the mailbox.
+     */
+    ImapSet uids;
+};
+
+/**
+ * Selects a mailbox and brings a local copy of it up to date.
+ *
+ * The job picks the cheapest way the server and the previous state allow:
+ * @li QResync: SELECT with QRESYNC (RFC 7162) reports new, changed and vanished messages at once
+ * @li CondStore: the flags changed since the last sync (RFC 7162), and a UID SEARCH for vanished messages
+ * @li Full: the UID and flags of every message, compared with the previous UIDs
+ *
+ * The commands are pipelined behind the SELECT. The results are reported in batches with
+ * newMessages(), changedMessages() and vanishedMessages(), and the state for the next
+ * sync is available with state() once the job is done. The headers or content of the new
+ * messages can then be fetched with a FetchJob.
+ *
+ * If the UIDVALIDITY changed, all previous UIDs are reported as vanished and every message
+ * as new.
+ */
+class KIMAP2_EXPORT MailboxSyncJob : public Job
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(MailboxSyncJob)
+
+public:
+    enum Strategy {
+        Full,
+        CondStore,
+        QResync
+    };
+
+    /**
+     * A message as reported by the sync, the modification sequence is 0 without CONDSTORE.
+     */
+    struct MessageState {
+        qint64 uid;
+        QList<QByteArray> flags;
+        quint64 modSeq;
+    };
+
+    explicit MailboxSyncJob(Session *session);
+    virtual ~MailboxSyncJob();
+
+    void setMailBox(const QString &mailBox);
+    QString mailBox() const;
+
+    /**
+     * The state the last sync of the mailbox ended with. Without one, the sync is a full one.
+     */
+    void setPreviousState(const MailboxSyncState &state);
+    MailboxSyncState previousState() const;
+
+    /**
+     * Reports at most @p size messages per newMessages() and changedMessages(), 500 by default.
+     */
+    void setBatchSize(int size);
+    int batchSize() const;
+
+    /**
+     * How the mailbox is synced, known once the job started.
+     */
+    Strategy strategy() const;
+
+    /**
+     * Whether the previous UIDs were dropped because the UIDVALIDITY changed.
+     */
+    bool uidValidityChanged() const;
+
+    /**
+     * The state to pass to the next sync, complete once the job finished successfully.
+     */
+    MailboxSyncState state() const;
+
+Q_SIGNALS:
+    /**
+     * Messages that are not in MailboxSyncState::uids of the previous state.
+     */
+    void newMessages(KIMAP2::MailboxSyncJob *job, const QVector<KIMAP2::MailboxSyncJob::MessageState> &messages);
+
+    /**
+     * Messages of the previous state whose flags may have changed. In a full sync these
+     * are all of them, so the flags have to be compared.
+     */
+    void changedMessages(KIMAP2::MailboxSyncJob *job, const QVector<KIMAP2::MailboxSyncJob::MessageState> &messages);
+
+    /**
+     * Messages of the previous state that are gone.
+     */
+    void vanishedMessages(KIMAP2::MailboxSyncJob *job, const KIMAP2::ImapSet &uids);
+
+protected:
+    void doStart() Q_DECL_OVERRIDE;
+    void handleResponse(const Message &response) Q_DECL_OVERRIDE;
+};
+
+}
+
+#endif
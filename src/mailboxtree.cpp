@@ -0,0 +1,243 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "mailboxtree.h"
+
+#include "kimap_debug.h"
+
+#include "session.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QPointer>
+
+static const int _kimap_mailBoxTreeNodeListId = qRegisterMetaType<QList<KIMAP2::MailBoxTree::Node> >();
+
+namespace KIMAP2
+{
+
+class MailBoxTreePrivate
+{
+public:
+    struct Pending {
+        QList<MailBoxTree::Node> children;
+        // False once the level was invalidated while it was listed
+        bool cache;
+        ListJob *job;
+    };
+
+    MailBoxTreePrivate(MailBoxTree *tree, Session *session)
+        : q(tree),
+          session(session),
+          option(ListJob::IncludeUnsubscribed)
+    {
+    }
+
+    // Whether @p name is @p mailBox or a mailbox below it
+    bool isWithin(const QString &name, const QString &mailBox) const
+    {
+        if (mailBox.isEmpty() || name == mailBox) {
+            return true;
+        }
+        const QChar separator = nodes.value(name).descriptor.separator;
+        return !separator.isNull() && name.size() > mailBox.size()
+               && name.startsWith(mailBox) && name.at(mailBox.size()) == separator;
+    }
+
+    QChar separator(const QString &mailBox) const
+    {
+        const QHash<QString, MailBoxTree::Node>::const_iterator it = nodes.constFind(mailBox);
+        if (it != nodes.constEnd()) {
+            return it->descriptor.separator;
+        }
+        //All mailboxes of a namespace share their separator, most accounts have just one
+        return nodes.isEmpty() ? QChar() : nodes.constBegin()->descriptor.separator;
+    }
+
+    void list(const QString &mailBox);
+    void finish(const QString &mailBox, ListJob *job);
+
+    MailBoxTree *const q;
+    QPointer<Session> session;
+    ListJob::Option option;
+    ListJob::ExtendedOptions extendedOptions;
+    // The children of every loaded level by the name of its mailbox, the top level under an empty name
+    QHash<QString, QList<MailBoxTree::Node> > levels;
+    // Every mailbox some level reported
+    QHash<QString, MailBoxTree::Node> nodes;
+    QHash<QString, Pending> pending;
+};
+
+}
+
+using namespace KIMAP2;
+
+bool MailBoxTree::Node::hasChildren() const
+{
+    return !flags.contains("\\hasnochildren") && !flags.contains("\\noinferiors");
+}
+
+bool MailBoxTree::Node::isSelectable() const
+{
+    return !flags.contains("\\noselect") && !flags.contains("\\nonexistent");
+}
+
+void MailBoxTreePrivate::list(const QString &mailBox)
+{
+    MailBoxDescriptor parent;
+    parent.name = mailBox;
+    parent.separator = separator(mailBox);
+
+    ListJob *job = new ListJob(session);
+    job->setOption(option);
+    job->setExtendedOptions(extendedOptions);
+    job->setChildrenOf(parent);
+    //Replaces a LIST that was invalidated, which is then no longer reported
+    pending.insert(mailBox, Pending{QList<MailBoxTree::Node>(), true, job});
+
+    QObject::connect(job, &ListJob::resultReceived, q, [this, mailBox, job](const MailBoxDescriptor &descriptor, const QList<QByteArray> &flags) {
+        const QHash<QString, Pending>::iterator level = pending.find(mailBox);
+        if (level == pending.end() || level->job != job) {
+            return;
+        }
+        MailBoxTree::Node node;
+        node.descriptor = descriptor;
+        node.flags = flags;
+        level->children << node;
+    });
+    QObject::connect(job, &KJob::result, q, [this, mailBox, job]() {
+        finish(mailBox, job);
+    });
+    job->start();
+}
+
+void MailBoxTreePrivate::finish(const QString &mailBox, ListJob *job)
+{
+    const QHash<QString, Pending>::iterator it = pending.find(mailBox);
+    if (it == pending.end() || it->job != job) {
+        return;
+    }
+    const Pending level = *it;
+    pending.erase(it);
+    if (job->error()) {
+        qCDebug(KIMAP2_LOG) << "Listing the children of" << mailBox << "failed:" << job->errorString();
+        emit q->requestFailed(mailBox, job->errorString());
+        return;
+    }
+    if (level.cache) {
+        levels.insert(mailBox, level.children);
+        for (const MailBoxTree::Node &node : level.children) {
+            nodes.insert(node.descriptor.name, node);
+        }
+    }
+    emit q->childrenReceived(mailBox, level.children);
+}
+
+MailBoxTree::MailBoxTree(Session *session, QObject *parent)
+    : QObject(parent), d(new MailBoxTreePrivate(this, session))
+{
+}
+
+MailBoxTree::~MailBoxTree()
+{
+    delete d;
+}
+
+void MailBoxTree::setOption(ListJob::Option option)
+{
+    d->option = option;
+    invalidate();
+}
+
+ListJob::Option MailBoxTree::option() const
+{
+    return d->option;
+}
+
+void MailBoxTree::setExtendedOptions(ListJob::ExtendedOptions options)
+{
+    d->extendedOptions = options;
+    invalidate();
+}
+
+ListJob::ExtendedOptions MailBoxTree::extendedOptions() const
+{
+    return d->extendedOptions;
+}
+
+void MailBoxTree::requestChildren(const QString &mailBox)
+{
+    const QHash<QString, QList<Node> >::const_iterator level = d->levels.constFind(mailBox);
+    if (level != d->levels.constEnd()) {
+        emit childrenReceived(mailBox, *level);
+        return;
+    }
+    //A LIST that was invalidated meanwhile may miss changes, so that one isn't waited for
+    const QHash<QString, MailBoxTreePrivate::Pending>::const_iterator listing = d->pending.constFind(mailBox);
+    if (listing != d->pending.constEnd() && listing->cache) {
+        return;
+    }
+    const QHash<QString, Node>::const_iterator known = d->nodes.constFind(mailBox);
+    if (known != d->nodes.constEnd() && !known->hasChildren()) {
+        d->levels.insert(mailBox, QList<Node>());
+        emit childrenReceived(mailBox, QList<Node>());
+        return;
+    }
+    if (!d->session) {
+        emit requestFailed(mailBox, QStringLiteral("The session is gone"));
+        return;
+    }
+    d->list(mailBox);
+}
+
+bool MailBoxTree::isLoaded(const QString &mailBox) const
+{
+    return d->levels.contains(mailBox);
+}
+
+QList<MailBoxTree::Node> MailBoxTree::children(const QString &mailBox) const
+{
+    return d->levels.value(mailBox);
+}
+
+MailBoxTree::Node MailBoxTree::node(const QString &mailBox) const
+{
+    return d->nodes.value(mailBox);
+}
+
+void MailBoxTree::invalidate(const QString &mailBox)
+{
+    for (QHash<QString, MailBoxTreePrivate::Pending>::iterator it = d->pending.begin(); it != d->pending.end(); ++it) {
+        if (d->isWithin(it.key(), mailBox)) {
+            it->cache = false;
+        }
+    }
+    for (QHash<QString, QList<Node> >::iterator it = d->levels.begin(); it != d->levels.end();) {
+        if (d->isWithin(it.key(), mailBox)) {
+            it = d->levels.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    //The mailbox itself stays known, as an entry of the level above
+    for (QHash<QString, Node>::iterator it = d->nodes.begin(); it != d->nodes.end();) {
+        if (it.key() != mailBox && d->isWithin(it.key(), mailBox)) {
+            it = d->nodes.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
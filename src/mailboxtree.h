@@ -0,0 +1,148 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_MAILBOXTREE_H
+#define KIMAP2_MAILBOXTREE_H
+
+#include "kimap2_export.h"
+
+#include "listjob.h"
+
+#include <QtCore/QObject>
+
+namespace KIMAP2
+{
+
+class Session;
+class MailBoxTreePrivate;
+
+/**
+ * Loads the mailbox hierarchy of a session one level at a time, as it is expanded.
+ *
+ * Instead of listing every mailbox of the account up front, which takes long for accounts
+ * with many thousands of shared mailboxes, requestChildren() lists only the level below a
+ * mailbox with ListJob::setChildrenOf(). The top level comes with a single small LIST, so
+ * it can be shown right away, and every other level only when it is asked for.
+ *
+ * The levels are cached, so each is listed once per tree. Keep one tree with each session
+ * and call invalidate() for the parts that changed, e.g. after creating or renaming a
+ * mailbox. Mailboxes the server reports without children, with \HasNoChildren or
+ * \Noinferiors, are answered from the cache without a LIST.
+ *
+ * @code
+ * KIMAP2::MailBoxTree *tree = new KIMAP2::MailBoxTree(session, view);
+ * connect(tree, &KIMAP2::MailBoxTree::childrenReceived, view, &FolderView::insertChildren);
+ * tree->requestChildren();
+ * @endcode
+ */
+class KIMAP2_EXPORT MailBoxTree : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * A mailbox as the LIST of its level reported it.
+     */
+    struct KIMAP2_EXPORT Node {
+        MailBoxDescriptor descriptor;
+        // In lower case, like those of ListJob::resultReceived()
+        QList<QByteArray> flags;
+
+        /**
+         * Returns false if the server said the mailbox has no children, true if it
+         * has some or the server didn't say.
+         */
+        bool hasChildren() const;
+
+        /**
+         * Returns false for mailboxes that only exist as a level of the hierarchy.
+         */
+        bool isSelectable() const;
+    };
+
+    explicit MailBoxTree(Session *session, QObject *parent = Q_NULLPTR);
+    ~MailBoxTree();
+
+    /**
+     * Sets which mailboxes are listed, ListJob::IncludeUnsubscribed by default.
+     * Clears the cache.
+     */
+    void setOption(ListJob::Option option);
+    ListJob::Option option() const;
+
+    /**
+     * Sets the LIST-EXTENDED options for every level, see ListJob::setExtendedOptions().
+     * Clears the cache.
+     */
+    void setExtendedOptions(ListJob::ExtendedOptions options);
+    ListJob::ExtendedOptions extendedOptions() const;
+
+    /**
+     * Has the children of @p mailBox reported with childrenReceived(), the top level for an
+     * empty name.
+     *
+     * Levels that are cached are reported right away, others once their LIST completed. A level
+     * that is being listed already isn't listed a second time, unless it was invalidated since,
+     * in which case only the new LIST is reported. @p mailBox should be one the tree reported, so
+     * its hierarchy separator is known.
+     */
+    void requestChildren(const QString &mailBox = QString());
+
+    /**
+     * Returns true if the children of @p mailBox are cached.
+     */
+    bool isLoaded(const QString &mailBox = QString()) const;
+
+    /**
+     * Returns the cached children of @p mailBox, nothing if they are not loaded.
+     */
+    QList<Node> children(const QString &mailBox = QString()) const;
+
+    /**
+     * Returns the cached node of @p mailBox, one with an empty name if it isn't known.
+     */
+    Node node(const QString &mailBox) const;
+
+    /**
+     * Drops the cached children of @p mailBox and all levels below, or the whole tree for an
+     * empty name. Levels that are being listed are still reported, but not cached, unless they
+     * are requested again.
+     */
+    void invalidate(const QString &mailBox = QString());
+
+Q_SIGNALS:
+    /**
+     * The children of @p mailBox, an empty name for the top level, in the order the server listed them.
+     */
+    void childrenReceived(const QString &mailBox, const QList<KIMAP2::MailBoxTree::Node> &children);
+
+    /**
+     * Listing the children of @p mailBox failed, the level stays unloaded.
+     */
+    void requestFailed(const QString &mailBox, const QString &errorString);
+
+private:
+    Q_DISABLE_COPY(MailBoxTree)
+    friend class MailBoxTreePrivate;
+    MailBoxTreePrivate *const d;
+};
+
+}
+
+Q_DECLARE_METATYPE(KIMAP2::MailBoxTree::Node)
+
+#endif
@@ -22,39 +22,271 @@
 
 #include <QtCore/QByteArray>
 #include <QtCore/QList>
+#include <QtCore/QPair>
 #include <QtCore/QMetaType>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QTemporaryFile>
+
+#include <utility>
+
+#include "imapkeyword_p.h"
 
 namespace KIMAP2
 {
 
+/**
+ * A literal the parser wrote to a temporary file instead of holding it in memory,
+ * see ImapStreamParser::setSpillThreshold().
+ *
+ * Once written the file is mapped, for as long as the object exists.
+ */
+class SpilledLiteral : public QTemporaryFile
+{
+public:
+    explicit SpilledLiteral(const QString &templateName)
+        : QTemporaryFile(templateName), m_data(Q_NULLPTR), m_size(0) { }
+
+    /**
+     * Maps the file once the literal was written completely. Returns false if that failed.
+     */
+    bool mapData()
+    {
+        m_size = pos();
+        if (!flush() || m_size == 0) {
+            return false;
+        }
+        m_data = map(0, m_size);
+        return m_data;
+    }
+
+    /**
+     * Returns the content, pointing into the mapping.
+     */
+    inline QByteArray data() const
+    {
+        return QByteArray::fromRawData(reinterpret_cast<const char *>(m_data), int(m_size));
+    }
+
+    inline bool contains(const QByteArray &bytes) const
+    {
+        const char *begin = reinterpret_cast<const char *>(m_data);
+        return m_data && bytes.constData() >= begin && bytes.constData() < begin + m_size;
+    }
+
+private:
+    uchar *m_data;
+    qint64 m_size;
+};
+
+/**
+ * A parsed response.
+ *
+ * The message passed to the response callback lives in the parser's arena, which is reset once
+ * the callback returns. Anything that is kept has to be promoted out of it by taking a copy of the
+ * part, list or byte array: copies are implicitly shared, and the parser doesn't reuse storage
+ * that is still referenced. Keeping a reference or pointer into the message is not safe.
+ */
 struct Message {
+    /**
+     * The structure of a list nested in a first level list, like a BODYSTRUCTURE or ENVELOPE.
+     *
+     * Every node is either a string or a list of nodes.
+     */
+    class Node
+    {
+    public:
+        Node()
+            : m_isList(false) { }
+        explicit Node(const QByteArray &string)
+            : m_isList(false), m_string(string) { }
+
+        static inline Node makeList()
+        {
+            Node node;
+            node.m_isList = true;
+            return node;
+        }
+
+        inline bool isList() const
+        {
+            return m_isList;
+        }
+        inline bool isNil() const
+        {
+            return !m_isList && m_string == "NIL";
+        }
+        inline const QByteArray &toString() const
+        {
+            return m_string;
+        }
+        inline const QList<Node> &children() const
+        {
+            return m_children;
+        }
+        inline int size() const
+        {
+            return m_children.size();
+        }
+
+        /**
+         * Returns the child at @p index, or an empty node if there is none.
+         */
+        inline Node at(int index) const
+        {
+            return m_children.value(index);
+        }
+
+        /**
+         * Returns the string of the child at @p index, or an empty string if it is NIL, a list or missing.
+         */
+        inline QByteArray stringAt(int index) const
+        {
+            const Node child = at(index);
+            if (child.isList() || child.isNil()) {
+                return QByteArray();
+            }
+            return child.m_string;
+        }
+
+        inline void append(const Node &child)
+        {
+            m_children << child;
+        }
+
+        /**
+         * Returns a copy of this node that no longer references the parser's receive buffers.
+         */
+        inline Node detached() const
+        {
+            Node result(QByteArray(m_string.constData(), m_string.size()));
+            result.m_isList = m_isList;
+            foreach (const Node &child, m_children) {
+                result.m_children << child.detached();
+            }
+            return result;
+        }
+
+    private:
+        bool m_isList;
+        QByteArray m_string;
+        QList<Node> m_children;
+    };
+
     class Part
     {
     public:
         enum Type { String = 0, List };
 
         explicit Part(const QByteArray &string)
-            : m_type(String), m_string(string) { }
-        explicit Part(const QList<QByteArray> &list)
-            : m_type(List), m_list(list) { }
+            : m_type(String), m_keyword(imapKeyword(string)), m_string(string) { }
+        Part(const QByteArray &string, ImapKeyword keyword)
+            : m_type(String), m_keyword(keyword), m_string(string) { }
+        explicit Part(const QList<QByteArray> &list, const QList<QPair<int, Node> > &sublists = QList<QPair<int, Node> >(),
+                      const QByteArray &keywords = QByteArray())
+            : m_type(List), m_keyword(ImapKeyword::None), m_list(list), m_sublists(sublists), m_keywords(keywords) { }
+        /**
+         * Takes over the list the parser built, without touching its reference count.
+         */
+        Part(QList<QByteArray> &&list, QList<QPair<int, Node> > &&sublists, QByteArray &&keywords)
+            : m_type(List), m_keyword(ImapKeyword::None), m_list(std::move(list)), m_sublists(std::move(sublists)),
+              m_keywords(std::move(keywords)) { }
 
         inline Type type() const
         {
             return m_type;
         }
-        inline QByteArray toString() const
+
+        /**
+         * The string and list are returned by reference, bind them to a const reference
+         * to read them without a copy.
+         */
+        inline const QByteArray &toString() const
         {
             return m_string;
         }
-        inline QList<QByteArray> toList() const
+        inline const QList<QByteArray> &toList() const
         {
             return m_list;
         }
 
+        /**
+         * Moves the string or list out of the part, which is left empty.
+         *
+         * For receivers that own the message, e.g. a detached copy, and keep the payload.
+         */
+        inline QByteArray takeString()
+        {
+            return std::move(m_string);
+        }
+        inline QList<QByteArray> takeList()
+        {
+            m_sublists.clear();
+            m_keywords.clear();
+            return std::move(m_list);
+        }
+
+        /**
+         * The keyword a string part is, if any.
+         */
+        inline ImapKeyword keyword() const
+        {
+            return m_keyword;
+        }
+
+        /**
+         * The keyword the list item at @p index is, if any.
+         */
+        inline ImapKeyword keywordAt(int index) const
+        {
+            if (index >= 0 && index < m_keywords.size()) {
+                return static_cast<ImapKeyword>(m_keywords.at(index));
+            }
+            return imapKeyword(m_list.value(index));
+        }
+
+        /**
+         * Returns the structure of the list item at @p index if it is a nested list.
+         *
+         * The item itself contains the nested list as sent by the server, the returned node
+         * allows to walk it without parsing it again. Returns an empty node otherwise.
+         */
+        inline Node sublist(int index) const
+        {
+            for (const auto &sublist : m_sublists) {
+                if (sublist.first == index) {
+                    return sublist.second;
+                }
+            }
+            return Node();
+        }
+
+        /**
+         * Returns a copy of this part that no longer references the parser's receive buffers.
+         */
+        inline Part detached() const
+        {
+            if (m_type == List) {
+                QList<QByteArray> list;
+                list.reserve(m_list.size());
+                foreach (const QByteArray &item, m_list) {
+                    list << QByteArray(item.constData(), item.size());
+                }
+                QList<QPair<int, Node> > sublists;
+                for (const auto &sublist : m_sublists) {
+                    sublists << qMakePair(sublist.first, sublist.second.detached());
+                }
+                return Part(list, sublists, m_keywords);
+            }
+            return Part(QByteArray(m_string.constData(), m_string.size()), m_keyword);
+        }
+
     private:
         Type m_type;
+        ImapKeyword m_keyword;
         QByteArray m_string;
         QList<QByteArray> m_list;
+        QList<QPair<int, Node> > m_sublists;
+        QByteArray m_keywords;
     };
 
     inline QByteArray toString() const
@@ -94,8 +326,71 @@ struct Message {
         return result;
     }
 
+    /**
+     * A borrowed message was produced by a parser in zero-copy mode.
+     *
+     * Its parts point directly into the receive buffers listed in @c slabs, which are kept alive
+     * for as long as the message (or a copy of it) exists. Byte arrays taken out of such a message
+     * must be passed through owned() if they are kept beyond the lifetime of the message.
+     * The same goes for the literals in @c spilledLiterals, in either mode.
+     */
+    inline bool isBorrowed() const
+    {
+        return !slabs.isEmpty() || !spilledLiterals.isEmpty();
+    }
+
+    /**
+     * Returns the spilled literal @p data points into, or null.
+     *
+     * Keeping it keeps @p data valid, without copying it out of the file.
+     */
+    inline QSharedPointer<SpilledLiteral> spilledLiteral(const QByteArray &data) const
+    {
+        for (const QSharedPointer<SpilledLiteral> &literal : spilledLiterals) {
+            if (literal->contains(data)) {
+                return literal;
+            }
+        }
+        return QSharedPointer<SpilledLiteral>();
+    }
+
+    /**
+     * Returns @p data in a form that is safe to keep after this message has been destroyed.
+     *
+     * This only copies for borrowed messages.
+     */
+    inline QByteArray owned(const QByteArray &data) const
+    {
+        if (isBorrowed()) {
+            return QByteArray(data.constData(), data.size());
+        }
+        return data;
+    }
+
+    /**
+     * Returns a deep copy of this message that doesn't reference any receive buffer.
+     */
+    inline Message detached() const
+    {
+        if (!isBorrowed()) {
+            return *this;
+        }
+        Message result;
+        result.content.reserve(content.size());
+        foreach (const Part &part, content) {
+            result.content << part.detached();
+        }
+        result.responseCode.reserve(responseCode.size());
+        foreach (const Part &part, responseCode) {
+            result.responseCode << part.detached();
+        }
+        return result;
+    }
+
     QList<Part> content;
     QList<Part> responseCode;
+    QList<QByteArray> slabs;
+    QList<QSharedPointer<SpilledLiteral> > spilledLiterals;
 };
 
 }
@@ -0,0 +1,520 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "messagecache.h"
+
+#include "kimap_debug.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QSaveFile>
+#include <QtCore/QtEndian>
+
+#include <algorithm>
+
+namespace KIMAP2
+{
+
+/*
+ * The file starts with a header:
+ *   "KIMAP2MC", quint32 version, quint32 unused, qint64 UIDVALIDITY
+ * followed by records, each with a header:
+ *   quint32 length of the data, quint8 type, 3 unused bytes, qint64 UID
+ * All numbers are little endian. The data of a Message record is
+ *   quint64 MODSEQ, qint64 size, qint64 INTERNALDATE, quint32 length, flags, quint32 length, header
+ * with the flags separated by spaces. A Flags record holds MODSEQ and flags the same way,
+ * a Removed record a sequence set and a UID of 0.
+ */
+static const char s_magic[] = "KIMAP2MC";
+static const quint32 s_version = 1;
+static const qint64 s_fileHeaderSize = 24;
+static const qint64 s_recordHeaderSize = 16;
+
+enum RecordType {
+    MessageRecord = 1,
+    FlagsRecord = 2,
+    RemovedRecord = 3
+};
+
+class MessageCachePrivate
+{
+public:
+    // Where the data of the last records of a message starts, flags is 0 without a Flags record
+    struct Location {
+        qint64 message;
+        qint64 flags;
+    };
+
+    MessageCachePrivate(const QString &fileName)
+        : file(fileName), map(Q_NULLPTR), mappedSize(0), uidValidity(0) { }
+
+    bool reset(qint64 uidValidity);
+    bool mapFile() const;
+    void unmapFile();
+    bool readIndex();
+    void removeFromIndex(const ImapSet &uids);
+    bool append(RecordType type, qint64 uid, const QByteArray &data);
+    const uchar *data(qint64 offset, qint64 length) const;
+    MessageCache::Entry read(qint64 uid, const Location &location) const;
+    void setError(const QString &message);
+
+    // Mutable as the mapping grows with the file on the next read
+    mutable QFile file;
+    mutable uchar *map;
+    mutable qint64 mappedSize;
+    qint64 uidValidity;
+    QHash<qint64, Location> index;
+    QString errorString;
+};
+
+}
+
+using namespace KIMAP2;
+
+template <typename T>
+static void appendNumber(QByteArray &data, T value)
+{
+    const T littleEndian = qToLittleEndian(value);
+    data.append(reinterpret_cast<const char *>(&littleEndian), sizeof(T));
+}
+
+template <typename T>
+static T readNumber(const uchar *data)
+{
+    return qFromLittleEndian<T>(data);
+}
+
+static void appendBytes(QByteArray &data, const QByteArray &bytes)
+{
+    appendNumber<quint32>(data, bytes.size());
+    data.append(bytes);
+}
+
+static QByteArray flagsData(quint64 modSeq, const MessageFlags &flags)
+{
+    QByteArray data;
+    appendNumber<quint64>(data, modSeq);
+    appendBytes(data, flags.isEmpty() ? QByteArray() : flags.join(' '));
+    return data;
+}
+
+static QByteArray fileHeader(qint64 uidValidity)
+{
+    QByteArray header(s_magic, 8);
+    appendNumber<quint32>(header, s_version);
+    appendNumber<quint32>(header, 0);
+    appendNumber<qint64>(header, uidValidity);
+    return header;
+}
+
+static QByteArray record(RecordType type, qint64 uid, const QByteArray &data)
+{
+    QByteArray bytes;
+    bytes.reserve(s_recordHeaderSize + data.size());
+    appendNumber<quint32>(bytes, data.size());
+    appendNumber<quint8>(bytes, type);
+    bytes.append(3, '\0');
+    appendNumber<qint64>(bytes, uid);
+    bytes.append(data);
+    return bytes;
+}
+
+static QByteArray messageData(const MessageCache::Entry &entry)
+{
+    QByteArray data;
+    data.reserve(32 + entry.header.size());
+    appendNumber<quint64>(data, entry.modSeq);
+    appendNumber<qint64>(data, entry.size);
+    appendNumber<qint64>(data, entry.internalDate);
+    appendBytes(data, entry.flags.isEmpty() ? QByteArray() : entry.flags.join(' '));
+    appendBytes(data, entry.header);
+    return data;
+}
+
+// Reads a length and the bytes after it at @p pos, advancing it. Returns false if they don't fit.
+static bool readBytes(const uchar *data, qint64 length, qint64 *pos, QByteArray *bytes)
+{
+    if (*pos + 4 > length) {
+        return false;
+    }
+    const quint32 size = readNumber<quint32>(data + *pos);
+    *pos += 4;
+    if (*pos + size > length) {
+        return false;
+    }
+    *bytes = QByteArray(reinterpret_cast<const char *>(data + *pos), size);
+    *pos += size;
+    return true;
+}
+
+MessageCache::Entry::Entry()
+    : uid(0), size(0), internalDate(0), modSeq(0)
+{
+}
+
+void MessageCachePrivate::setError(const QString &message)
+{
+    errorString = message;
+    qCWarning(KIMAP2_LOG) << file.fileName() << message;
+}
+
+bool MessageCachePrivate::reset(qint64 validity)
+{
+    unmapFile();
+    index.clear();
+    const QByteArray header = fileHeader(validity);
+    if (!file.resize(0) || !file.seek(0) || file.write(header) != header.size()) {
+        setError(file.errorString());
+        return false;
+    }
+    uidValidity = validity;
+    return true;
+}
+
+bool MessageCachePrivate::mapFile() const
+{
+    const qint64 size = file.size();
+    if (map && mappedSize == size) {
+        return true;
+    }
+    if (map) {
+        file.unmap(map);
+    }
+    map = file.map(0, size);
+    mappedSize = map ? size : 0;
+    return map;
+}
+
+void MessageCachePrivate::unmapFile()
+{
+    if (map) {
+        file.unmap(map);
+        map = Q_NULLPTR;
+        mappedSize = 0;
+    }
+}
+
+const uchar *MessageCachePrivate::data(qint64 offset, qint64 length) const
+{
+    if (offset + length > mappedSize && (!mapFile() || offset + length > mappedSize)) {
+        return Q_NULLPTR;
+    }
+    return map + offset;
+}
+
+void MessageCachePrivate::removeFromIndex(const ImapSet &uids)
+{
+    foreach (const ImapSet::Range &range, uids.ranges()) {
+        //An end of 0 is "n:*", everything from the beginning on
+        if (range.end && range.end - range.begin < index.size()) {
+            for (qint64 uid = range.begin; uid <= range.end; ++uid) {
+                index.remove(uid);
+            }
+        } else {
+            for (auto it = index.begin(); it != index.end();) {
+                if (it.key() >= range.begin && (!range.end || it.key() <= range.end)) {
+                    it = index.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+    }
+}
+
+bool MessageCachePrivate::readIndex()
+{
+    if (!mapFile()) {
+        setError(file.errorString());
+        return false;
+    }
+    const qint64 size = mappedSize;
+    qint64 pos = s_fileHeaderSize;
+    while (pos + s_recordHeaderSize <= size) {
+        const quint32 length = readNumber<quint32>(map + pos);
+        const quint8 type = map[pos + 4];
+        const qint64 uid = readNumber<qint64>(map + pos + 8);
+        const qint64 begin = pos + s_recordHeaderSize;
+        if (begin + length > size) {
+            break;
+        }
+        switch (type) {
+        case MessageRecord:
+            index.insert(uid, Location{begin, 0});
+            break;
+        case FlagsRecord: {
+            auto it = index.find(uid);
+            if (it != index.end()) {
+                it->flags = begin;
+            }
+            break;
+        }
+        case RemovedRecord:
+            removeFromIndex(ImapSet::fromImapSequenceSet(QByteArray(reinterpret_cast<const char *>(map + begin), length)));
+            break;
+        default:
+            break;
+        }
+        pos = begin + length;
+    }
+    if (pos < size) {
+        qCDebug(KIMAP2_LOG) << "Dropping an incomplete record at the end of" << file.fileName();
+        unmapFile();
+        if (!file.resize(pos)) {
+            setError(file.errorString());
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MessageCachePrivate::append(RecordType type, qint64 uid, const QByteArray &data)
+{
+    if (!file.isOpen()) {
+        errorString = QStringLiteral("The cache is not open");
+        return false;
+    }
+    const QByteArray bytes = record(type, uid, data);
+    const qint64 begin = file.size() + s_recordHeaderSize;
+    if (!file.seek(file.size()) || file.write(bytes) != bytes.size()) {
+        setError(file.errorString());
+        return false;
+    }
+    switch (type) {
+    case MessageRecord:
+        index.insert(uid, Location{begin, 0});
+        break;
+    case FlagsRecord:
+        index[uid].flags = begin;
+        break;
+    case RemovedRecord:
+        break;
+    }
+    return true;
+}
+
+MessageCache::Entry MessageCachePrivate::read(qint64 uid, const Location &location) const
+{
+    MessageCache::Entry entry;
+    const uchar *header = data(location.message - s_recordHeaderSize, s_recordHeaderSize);
+    if (!header) {
+        return entry;
+    }
+    const qint64 length = readNumber<quint32>(header);
+    const uchar *message = data(location.message, length);
+    qint64 pos = 24;
+    QByteArray flags;
+    if (!message || length < pos || !readBytes(message, length, &pos, &flags) || !readBytes(message, length, &pos, &entry.header)) {
+        qCWarning(KIMAP2_LOG) << "Corrupt record for" << uid << "in" << file.fileName();
+        entry.header.clear();
+        return entry;
+    }
+    entry.modSeq = readNumber<quint64>(message);
+    entry.size = readNumber<qint64>(message + 8);
+    entry.internalDate = readNumber<qint64>(message + 16);
+
+    if (location.flags) {
+        const uchar *update = data(location.flags - s_recordHeaderSize, s_recordHeaderSize);
+        const qint64 updateLength = update ? readNumber<quint32>(update) : 0;
+        const uchar *flagsUpdate = update ? data(location.flags, updateLength) : Q_NULLPTR;
+        pos = 8;
+        if (flagsUpdate && updateLength >= pos && readBytes(flagsUpdate, updateLength, &pos, &flags)) {
+            entry.modSeq = readNumber<quint64>(flagsUpdate);
+        }
+    }
+    if (!flags.isEmpty()) {
+        entry.flags = flags.split(' ');
+    }
+    entry.uid = uid;
+    return entry;
+}
+
+MessageCache::MessageCache(const QString &fileName)
+    : d(new MessageCachePrivate(fileName))
+{
+}
+
+MessageCache::~MessageCache()
+{
+    close();
+    delete d;
+}
+
+QString MessageCache::fileName() const
+{
+    return d->file.fileName();
+}
+
+bool MessageCache::open(qint64 uidValidity)
+{
+    close();
+    d->errorString.clear();
+    if (!d->file.open(QIODevice::ReadWrite | QIODevice::Unbuffered)) {
+        d->setError(d->file.errorString());
+        return false;
+    }
+
+    QByteArray header = d->file.read(s_fileHeaderSize);
+    if (header.size() < s_fileHeaderSize || !header.startsWith(QByteArray(s_magic, 8))
+            || readNumber<quint32>(reinterpret_cast<const uchar *>(header.constData()) + 8) != s_version
+            || readNumber<qint64>(reinterpret_cast<const uchar *>(header.constData()) + 16) != uidValidity) {
+        if (d->file.size() > 0) {
+            qCDebug(KIMAP2_LOG) << "Discarding the cache" << d->file.fileName();
+        }
+        if (!d->reset(uidValidity)) {
+            d->file.close();
+            return false;
+        }
+    }
+    d->uidValidity = uidValidity;
+    if (!d->readIndex()) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MessageCache::close()
+{
+    d->unmapFile();
+    d->file.close();
+    d->index.clear();
+    d->uidValidity = 0;
+}
+
+bool MessageCache::isOpen() const
+{
+    return d->file.isOpen();
+}
+
+QString MessageCache::errorString() const
+{
+    return d->errorString;
+}
+
+qint64 MessageCache::uidValidity() const
+{
+    return d->uidValidity;
+}
+
+bool MessageCache::insert(const Entry &entry)
+{
+    if (entry.uid <= 0) {
+        return false;
+    }
+    return d->append(MessageRecord, entry.uid, messageData(entry));
+}
+
+bool MessageCache::insert(const FetchJob::Result &result)
+{
+    Entry entry;
+    entry.uid = result.uid;
+    entry.size = result.size;
+    entry.internalDate = result.internalDate;
+    entry.modSeq = result.modSeq;
+    entry.flags = result.flags;
+    if (!result.rawHeader.isNull()) {
+        entry.header = result.rawHeader;
+    }
+#ifndef KIMAP2_NO_KMIME
+    else if (result.message) {
+        entry.header = result.message->head();
+    }
+#endif
+    return insert(entry);
+}
+
+bool MessageCache::updateFlags(qint64 uid, const MessageFlags &flags, quint64 modSeq)
+{
+    if (!d->index.contains(uid)) {
+        return true;
+    }
+    return d->append(FlagsRecord, uid, flagsData(modSeq, flags));
+}
+
+bool MessageCache::remove(const ImapSet &uids)
+{
+    if (uids.isEmpty() || d->index.isEmpty()) {
+        return true;
+    }
+    if (!d->append(RemovedRecord, 0, uids.toImapSequenceSet())) {
+        return false;
+    }
+    d->removeFromIndex(uids);
+    return true;
+}
+
+bool MessageCache::contains(qint64 uid) const
+{
+    return d->index.contains(uid);
+}
+
+MessageCache::Entry MessageCache::entry(qint64 uid) const
+{
+    const auto it = d->index.constFind(uid);
+    if (it == d->index.constEnd()) {
+        return Entry();
+    }
+    return d->read(uid, *it);
+}
+
+ImapSet MessageCache::uids() const
+{
+    QVector<ImapSet::Id> values;
+    values.reserve(d->index.size());
+    for (auto it = d->index.constBegin(); it != d->index.constEnd(); ++it) {
+        values << it.key();
+    }
+    std::sort(values.begin(), values.end());
+    ImapSetBuilder builder;
+    foreach (ImapSet::Id uid, values) {
+        builder.add(uid);
+    }
+    return builder.toSet();
+}
+
+int MessageCache::count() const
+{
+    return d->index.size();
+}
+
+bool MessageCache::compact()
+{
+    if (!isOpen()) {
+        d->errorString = QStringLiteral("The cache is not open");
+        return false;
+    }
+    const qint64 uidValidity = d->uidValidity;
+    QSaveFile output(d->file.fileName());
+    if (!output.open(QIODevice::WriteOnly)) {
+        d->setError(output.errorString());
+        return false;
+    }
+    output.write(fileHeader(uidValidity));
+    foreach (const ImapSet::Range &range, uids().ranges()) {
+        for (qint64 uid = range.begin; uid <= range.end; ++uid) {
+            output.write(record(MessageRecord, uid, messageData(entry(uid))));
+        }
+    }
+    close();
+    if (!output.commit()) {
+        d->setError(output.errorString());
+        open(uidValidity);
+        return false;
+    }
+    return open(uidValidity);
+}
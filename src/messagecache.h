@@ -0,0 +1,138 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_MESSAGECACHE_H
+#define KIMAP2_MESSAGECACHE_H
+
+#include "kimap2_export.h"
+
+#include "fetchjob.h"
+#include "imapset.h"
+
+namespace KIMAP2
+{
+
+class MessageCachePrivate;
+
+/**
+ * Keeps what was fetched about the messages of one mailbox in a file, so that it doesn't
+ * have to be fetched again on the next start.
+ *
+ * The file is only appended to and is read through a memory mapping, opening it only
+ * reads the small record headers to build the index. Flag changes and removals are
+ * appended as records of their own, compact() rewrites the file without the
+ * records they made obsolete.
+ *
+ * The file belongs to one UIDVALIDITY of the mailbox, opening it with another one
+ * empties it. Together with a MailboxSyncJob, whose changes are applied with
+ * updateFlags() and remove(), only the headers of the new messages have to be fetched.
+ *
+ * @code
+ * KIMAP2::MessageCache cache(path);
+ * cache.open(state.uidValidity);
+ * ...
+ * connect(fetchJob, &KIMAP2::FetchJob::resultReceived, [&cache](const KIMAP2::FetchJob::Result &result) {
+ *     cache.insert(result);
+ * });
+ * @endcode
+ */
+class KIMAP2_EXPORT MessageCache
+{
+public:
+    /**
+     * A cached message, uid is 0 for a message that isn't cached.
+     */
+    struct KIMAP2_EXPORT Entry {
+        Entry();
+
+        qint64 uid;
+        qint64 size;
+        /**
+         * The INTERNALDATE in seconds since the epoch (UTC), as in FetchJob::Result.
+         */
+        qint64 internalDate;
+        quint64 modSeq;
+        MessageFlags flags;
+        /**
+         * The header fields that were fetched, as the server sent them.
+         */
+        QByteArray header;
+    };
+
+    explicit MessageCache(const QString &fileName);
+    ~MessageCache();
+
+    QString fileName() const;
+
+    /**
+     * Opens the file, creating it if needed, and reads its index.
+     *
+     * If the file was written for another @p uidValidity, or isn't a cache file, it is emptied.
+     * A record cut off by a crash is dropped. Returns false if the file can't be used,
+     * see errorString().
+     */
+    bool open(qint64 uidValidity);
+    void close();
+    bool isOpen() const;
+    QString errorString() const;
+
+    qint64 uidValidity() const;
+
+    /**
+     * Adds a message or replaces what is cached about it. Returns false if writing failed.
+     */
+    bool insert(const Entry &entry);
+
+    /**
+     * Adds a fetched message, the header is taken from FetchJob::Result::rawHeader,
+     * or from the parsed message without raw results, which KIMAP2Core doesn't have.
+     */
+    bool insert(const FetchJob::Result &result);
+
+    /**
+     * Records new flags of a cached message, e.g. from MailboxSyncJob::changedMessages().
+     * Does nothing for messages that aren't cached.
+     */
+    bool updateFlags(qint64 uid, const MessageFlags &flags, quint64 modSeq);
+
+    /**
+     * Removes messages, e.g. from MailboxSyncJob::vanishedMessages().
+     */
+    bool remove(const ImapSet &uids);
+
+    bool contains(qint64 uid) const;
+    Entry entry(qint64 uid) const;
+
+    /**
+     * Returns the UIDs of all cached messages.
+     */
+    ImapSet uids() const;
+    int count() const;
+
+    /**
+     * Rewrites the file with only the current state of each message.
+     */
+    bool compact();
+
+private:
+    Q_DISABLE_COPY(MessageCache)
+    MessageCachePrivate *const d;
+};
+
+}
+
+#endif
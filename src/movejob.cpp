@@ -19,6 +19,7 @@
 
 #include "movejob.h"
 
+#include "bodycache.h"
 #include "job_p.h"
 #include "message_p.h"
 #include "session_p.h"
@@ -34,6 +35,9 @@ public:
     MoveJobPrivate(Session *session, const QString &name) 
         : JobPrivate(session, name)
         , uidBased(false)
+        , maximumSetLength(0)
+        , bodyCache(Q_NULLPTR)
+        , sourceUidValidity(-1)
     {}
 
     ~MoveJobPrivate()
@@ -42,7 +46,11 @@ public:
     QString mailBox;
     ImapSet set;
     bool uidBased;
-    ImapSet resultingUids;
+    int maximumSetLength;
+    CopyUidMap copyUids;
+    BodyCache *bodyCache;
+    QString sourceMailBox;
+    qint64 sourceUidValidity;
 };
 }
 
@@ -95,42 +103,81 @@ bool MoveJob::isUidBased() const
     return d->uidBased;
 }
 
+void MoveJob::setMaximumSetLength(int length)
+{
+    Q_D(MoveJob);
+    d->maximumSetLength = length;
+}
+
+int MoveJob::maximumSetLength() const
+{
+    Q_D(const MoveJob);
+    return d->maximumSetLength;
+}
+
 ImapSet MoveJob::resultingUids() const
 {
     Q_D(const MoveJob);
-    return d->resultingUids;
+    return d->copyUids.destination;
+}
+
+ImapSet MoveJob::sourceUids() const
+{
+    Q_D(const MoveJob);
+    return d->copyUids.source;
+}
+
+qint64 MoveJob::resultingUid(qint64 sourceUid) const
+{
+    Q_D(const MoveJob);
+    return d->copyUids.destinationOf(sourceUid);
+}
+
+qint64 MoveJob::uidValidity() const
+{
+    Q_D(const MoveJob);
+    return d->copyUids.uidValidity;
+}
+
+void MoveJob::setBodyCache(BodyCache *cache)
+{
+    Q_D(MoveJob);
+    d->bodyCache = cache;
 }
 
 void MoveJob::doStart()
 {
     Q_D(MoveJob);
+    d->sourceMailBox = d->m_session->selectedMailBox();
+    d->sourceUidValidity = d->sessionInternal()->selectedUidValidity;
 
     d->set.optimize();
-    QByteArray parameters = d->set.toImapSequenceSet() + ' ';
-    parameters += '\"' + KIMAP2::encodeImapFolderName(d->mailBox.toUtf8()) + '\"';
+    const QByteArray mailBox = '\"' + d->sessionInternal()->encodeMailBoxName(d->mailBox) + '\"';
 
     QByteArray command = "MOVE";
     if (d->uidBased) {
         command = "UID " + command;
     }
 
-    d->sendCommand(command, parameters);
+    const QList<ImapSet> chunks = d->uidBased ? d->set.split(d->maximumSetLength) : QList<ImapSet>() << d->set;
+    foreach (const ImapSet &chunk, chunks) {
+        d->sendCommand(command, chunk.toImapSequenceSet() + ' ' + mailBox);
+    }
 }
 
 void MoveJob::handleResponse(const Message &response)
 {
     Q_D(MoveJob);
 
-    for (QList<Message::Part>::ConstIterator it = response.responseCode.begin();
-            it != response.responseCode.end(); ++it) {
-        if (it->toString() == "COPYUID") {
-            it = it + 3;
-            if (it < response.responseCode.end()) {
-                d->resultingUids = ImapSet::fromImapSequenceSet(it->toString());
-            }
-            break;
+    if (d->bodyCache) {
+        CopyUidMap copied;
+        copied.parse(response);
+        if (!copied.source.isEmpty()) {
+            d->bodyCache->addCopies(d->sourceMailBox, d->sourceUidValidity, copied.source,
+                                    d->mailBox, copied.uidValidity, copied.destination);
         }
     }
+    d->copyUids.parse(response);
 
     handleErrorReplies(response);
 }
@@ -27,6 +27,7 @@
 
 namespace KIMAP2 {
 
+class BodyCache;
 class MoveJobPrivate;
 
 /**
@@ -73,7 +74,8 @@ public:
      * Sets the messages to be moved,
      *
      * If sequence numbers are given, isUidBased() should be false.  If UIDs
-     * are given, isUidBased() should be true.
+     * are given, isUidBased() should be true. ImapSet::savedSearchResult() moves the
+     * result a SearchJob saved on the server.
      *
      * @param set  the sequence numbers or UIDs of the messages to be moved
      */
@@ -105,6 +107,16 @@ public:
      */
     bool isUidBased() const;
 
+    /**
+     * Splits the sequence set so that each command carries at most @p length bytes of it.
+     *
+     * See CopyJob::setMaximumSetLength(). Only for UID based moves, since each move
+     * renumbers the messages after those it moved. The default is 0, which moves
+     * everything with a single command.
+     */
+    void setMaximumSetLength(int length);
+    int maximumSetLength() const;
+
     /**
      * The UIDs of the moved messages in the destination mailbox.
      *
@@ -113,6 +125,31 @@ public:
      */
     ImapSet resultingUids() const;
 
+    /**
+     * The UIDs the moved messages had in the source mailbox, in the order of resultingUids().
+     */
+    ImapSet sourceUids() const;
+
+    /**
+     * Returns the UID in the destination mailbox of the message that had the UID
+     * @p sourceUid, or 0 if the server didn't report it. See CopyJob::resultingUid().
+     */
+    qint64 resultingUid(qint64 sourceUid) const;
+
+    /**
+     * The UIDVALIDITY of the destination mailbox from the COPYUID response code, which
+     * resultingUids() are valid for. Zero if the server does not support the UIDPLUS extension.
+     */
+    qint64 uidValidity() const;
+
+    /**
+     * Records in @p cache which messages the copies are, from the COPYUID response code,
+     * so a FetchJob in the destination mailbox takes their content from the cache.
+     *
+     * The cache is not owned and has to stay valid until the job finished.
+     */
+    void setBodyCache(BodyCache *cache);
+
 protected:
     void doStart() Q_DECL_OVERRIDE;
     void handleResponse(const KIMAP2::Message &response) Q_DECL_OVERRIDE;
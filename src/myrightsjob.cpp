@@ -51,13 +51,23 @@ void MyRightsJob::doStart()
 {
     Q_D(MyRightsJob);
 
-    d->sendCommand("MYRIGHTS", '\"' + KIMAP2::encodeImapFolderName(d->mailBox.toUtf8()) + '\"');
+    if (d->sessionInternal()->cachedMyRights(d->mailBox, &d->myRights)) {
+        emitResult();
+        return;
+    }
+
+    d->sendCommand("MYRIGHTS", '\"' + d->sessionInternal()->encodeMailBoxName(d->mailBox) + '\"');
 }
 
 void MyRightsJob::handleResponse(const Message &response)
 {
     Q_D(MyRightsJob);
 
+    if (response.content.size() >= 2 && !d->tags.isEmpty() && response.content.first().toString() == d->tags.last()
+            && response.content[1].keyword() == ImapKeyword::Ok) {
+        d->sessionInternal()->rememberMyRights(d->mailBox, d->myRights);
+    }
+
     if (handleErrorReplies(response) == NotHandled) {
         if (response.content.size() == 4 &&
                 response.content[1].toString() == "MYRIGHTS") {
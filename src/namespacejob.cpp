@@ -27,32 +27,6 @@
 #include "rfccodecs.h"
 #include "session_p.h"
 
-static QList<QByteArray> parseParenthesizedList(const QByteArray &data)
-{
-    QList<QByteArray> result;
-    if (data.isEmpty()) {
-        return result;
-    }
-    if (data.at(0) != '(') {
-        return result;
-    }
-    bool parsingString = false;
-    int start = 0;
-    for (int pos = 1; pos < data.size(); pos++) {
-        //Match unescaped quotes
-        if (data.at(pos) == '\"' && data.at(pos - 1) != '\\') {
-            if (parsingString) {
-                parsingString = false;
-                result << data.mid(start, pos - start);
-            } else {
-                parsingString = true;
-                start = pos + 1;
-            }
-        }
-    }
-    return result;
-}
-
 namespace KIMAP2
 {
 class NamespaceJobPrivate : public JobPrivate
@@ -61,19 +35,23 @@ public:
     NamespaceJobPrivate(Session *session,  const QString &name) : JobPrivate(session, name) { }
     ~NamespaceJobPrivate() { }
 
-    QList<MailBoxDescriptor> processNamespaceList(const QList<QByteArray> &namespaceList)
+    QList<MailBoxDescriptor> processNamespaceList(const Message::Part &namespaceList)
     {
         QList<MailBoxDescriptor> result;
 
-        foreach (const QByteArray &namespaceItem, namespaceList) {
-            QList<QByteArray> parts = parseParenthesizedList(namespaceItem);
+        const QList<QByteArray> items = namespaceList.toList();
+        for (int i = 0; i < items.size(); i++) {
+            const Message::Node parts = namespaceList.sublist(i);
             if (parts.size() < 2) {
-                qWarning() << "Not enough parts in namespace item " << namespaceItem;
+                qWarning() << "Not enough parts in namespace item " << items[i];
                 continue;
             }
             MailBoxDescriptor descriptor;
-            descriptor.name = QString::fromUtf8(decodeImapFolderName(parts[0]));
-            descriptor.separator = QLatin1Char(parts[1][0]);
+            descriptor.name = sessionInternal()->decodeMailBoxName(parts.stringAt(0));
+            const QByteArray separator = parts.stringAt(1);
+            if (!separator.isEmpty()) {
+                descriptor.separator = QLatin1Char(separator[0]);
+            }
 
             result << descriptor;
         }
@@ -135,6 +113,13 @@ bool NamespaceJob::containsEmptyNamespace() const
 void NamespaceJob::doStart()
 {
     Q_D(NamespaceJob);
+    if (d->m_session->hasNamespaces()) {
+        d->personalNamespaces = d->m_session->personalNamespaces();
+        d->userNamespaces = d->m_session->userNamespaces();
+        d->sharedNamespaces = d->m_session->sharedNamespaces();
+        emitResult();
+        return;
+    }
     d->sendCommand("NAMESPACE", {});
 }
 
@@ -145,13 +130,15 @@ void NamespaceJob::handleResponse(const Message &response)
         if (response.content.size() >= 5 &&
                 response.content[1].toString() == "NAMESPACE") {
             // Personal namespaces
-            d->personalNamespaces = d->processNamespaceList(response.content[2].toList());
+            d->personalNamespaces = d->processNamespaceList(response.content[2]);
 
             // User namespaces
-            d->userNamespaces = d->processNamespaceList(response.content[3].toList());
+            d->userNamespaces = d->processNamespaceList(response.content[3]);
 
             // Shared namespaces
-            d->sharedNamespaces = d->processNamespaceList(response.content[4].toList());
+            d->sharedNamespaces = d->processNamespaceList(response.content[4]);
+
+            d->sessionInternal()->setNamespaces(d->personalNamespaces, d->userNamespaces, d->sharedNamespaces);
         }
     }
 }
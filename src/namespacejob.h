@@ -32,6 +32,12 @@ struct Message;
 struct MailBoxDescriptor;
 class NamespaceJobPrivate;
 
+/**
+ * Retrieves the namespaces of the server (RFC 2342).
+ *
+ * The session keeps them for the connection, so a NamespaceJob on a session that already
+ * knows them finishes right away without sending NAMESPACE, see Session::hasNamespaces().
+ */
 class KIMAP2_EXPORT NamespaceJob : public Job
 {
     Q_OBJECT
@@ -0,0 +1,335 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "notifyjob.h"
+
+#include "kimap_debug.h"
+
+#include "job_p.h"
+#include "message_p.h"
+#include "session_p.h"
+#include "rfccodecs.h"
+
+#include <QtCore/QPointer>
+#include <QtCore/QTimer>
+
+namespace KIMAP2
+{
+class NotifyJobPrivate : public JobPrivate
+{
+public:
+    NotifyJobPrivate(NotifyJob *job, Session *session, const QString &name)
+        : JobPrivate(session, name), q(job), idleSent(false), idling(false), stopRequested(false), polling(false),
+          originalSocketTimeout(-1), pollInterval(60) { }
+    ~NotifyJobPrivate() { }
+
+    void startPollTimer()
+    {
+        //The timer lives on the thread of the job, which is not necessarily ours
+        QMetaObject::invokeMethod(&pollTimer, "start", Q_ARG(int, pollInterval * 1000));
+    }
+
+    void poll()
+    {
+        QPointer<NotifyJob> guard(q);
+        sessionInternal()->callInSessionThread([this, guard]() {
+            if (guard && !stopRequested) {
+                sendCommand("NOOP", {});
+            }
+        });
+    }
+
+    static QByteArray eventNames(NotifyJob::Events events)
+    {
+        QByteArray names;
+        if (events & NotifyJob::MessageNew) {
+            names += "MessageNew ";
+        }
+        if (events & NotifyJob::MessageExpunge) {
+            names += "MessageExpunge ";
+        }
+        if (events & NotifyJob::FlagChange) {
+            names += "FlagChange ";
+        }
+        if (events & NotifyJob::MailBoxName) {
+            names += "MailboxName ";
+        }
+        if (events & NotifyJob::SubscriptionChange) {
+            names += "SubscriptionChange ";
+        }
+        names.chop(1);
+        return names.isEmpty() ? QByteArray("NONE") : '(' + names + ')';
+    }
+
+    QByteArray mailBoxNames(const QStringList &mailBoxes)
+    {
+        QByteArray names;
+        foreach (const QString &mailBox, mailBoxes) {
+            names += '\"' + sessionInternal()->encodeMailBoxName(mailBox) + "\" ";
+        }
+        names.chop(1);
+        return '(' + names + ')';
+    }
+
+    QString mailBoxName(const QByteArray &name)
+    {
+        return sessionInternal()->decodeMailBoxName(name);
+    }
+
+    struct Filter {
+        QByteArray kind;
+        QStringList mailBoxes;
+        NotifyJob::Events events;
+    };
+
+    NotifyJob *const q;
+    NotifyJob::Events selectedEvents;
+    //The filters after SELECTED, like "(SUBTREE ("INBOX") (MessageNew MessageExpunge))" once
+    //encoded, which happens on the session thread since it depends on what is enabled
+    QList<Filter> filters;
+    QByteArray notifyTag;
+    bool idleSent;
+    bool idling;
+    bool stopRequested;
+    // Without IDLE a NOOP every pollInterval seconds picks up the events
+    bool polling;
+    int originalSocketTimeout;
+    int pollInterval;
+    QTimer pollTimer;
+};
+}
+
+using namespace KIMAP2;
+
+NotifyJob::NotifyJob(Session *session)
+    : Job(*new NotifyJobPrivate(this, session, "Notify"))
+{
+    Q_D(NotifyJob);
+    d->pollTimer.setSingleShot(true);
+    connect(&d->pollTimer, &QTimer::timeout, this, [this]() {
+        Q_D(NotifyJob);
+        d->poll();
+    });
+    connect(this, &KJob::result, this, [this]() {
+        Q_D(NotifyJob);
+        d->pollTimer.stop();
+        if (d->idleSent) {
+            d->sessionInternal()->setSocketTimeout(d->originalSocketTimeout);
+        }
+    });
+}
+
+NotifyJob::~NotifyJob()
+{
+}
+
+void NotifyJob::setSelectedEvents(Events events)
+{
+    Q_D(NotifyJob);
+    d->selectedEvents = events;
+}
+
+NotifyJob::Events NotifyJob::selectedEvents() const
+{
+    Q_D(const NotifyJob);
+    return d->selectedEvents;
+}
+
+void NotifyJob::addSubtree(const QStringList &mailBoxes, Events events)
+{
+    Q_D(NotifyJob);
+    d->filters << NotifyJobPrivate::Filter{"SUBTREE", mailBoxes, events};
+}
+
+void NotifyJob::addMailBoxes(const QStringList &mailBoxes, Events events)
+{
+    Q_D(NotifyJob);
+    d->filters << NotifyJobPrivate::Filter{"MAILBOXES", mailBoxes, events};
+}
+
+void NotifyJob::setPollInterval(int seconds)
+{
+    Q_D(NotifyJob);
+    d->pollInterval = qMax(1, seconds);
+}
+
+int NotifyJob::pollInterval() const
+{
+    Q_D(const NotifyJob);
+    return d->pollInterval;
+}
+
+void NotifyJob::stop()
+{
+    Q_D(NotifyJob);
+    if (d->polling) {
+        d->pollTimer.stop();
+        QPointer<NotifyJob> guard(this);
+        d->sessionInternal()->callInSessionThread([d, guard]() {
+            if (!guard || d->stopRequested) {
+                return;
+            }
+            //Otherwise it finishes once NOTIFY or the NOOP completed
+            d->stopRequested = true;
+            if (d->tags.isEmpty()) {
+                guard->emitResult();
+            }
+        });
+        return;
+    }
+    if (!d->idling) {
+        //Finishes once NOTIFY completed
+        d->stopRequested = true;
+        return;
+    }
+    d->idling = false;
+    d->sessionInternal()->sendData("DONE");
+}
+
+void NotifyJob::doStart()
+{
+    Q_D(NotifyJob);
+
+    if (!d->m_session->capabilities().contains(QStringLiteral("NOTIFY"), Qt::CaseInsensitive)) {
+        qCWarning(KIMAP2_LOG) << "The server does not support NOTIFY";
+        setError(KJob::UserDefinedError);
+        setErrorText(QStringLiteral("The server does not support NOTIFY"));
+        emitResult();
+        return;
+    }
+    d->polling = !d->sessionInternal()->hasCapability("IDLE");
+
+    QByteArray parameters;
+    if (d->selectedEvents) {
+        parameters += " (SELECTED " + NotifyJobPrivate::eventNames(d->selectedEvents) + ')';
+    }
+    foreach (const NotifyJobPrivate::Filter &filter, d->filters) {
+        parameters += " (" + filter.kind + ' ' + d->mailBoxNames(filter.mailBoxes) + ' ' + NotifyJobPrivate::eventNames(filter.events) + ')';
+    }
+
+    d->sendCommand("NOTIFY", parameters.isEmpty() ? QByteArray("NONE") : "SET" + parameters);
+    d->notifyTag = d->tags.last();
+}
+
+void NotifyJob::handleResponse(const Message &response)
+{
+    Q_D(NotifyJob);
+
+    const bool tagged = !response.content.isEmpty() && d->tags.contains(response.content.first().toString());
+    const bool ok = tagged && response.content.size() >= 2 && response.content[1].keyword() == ImapKeyword::Ok;
+    if (ok && d->polling && !d->stopRequested) {
+        //NOTIFY or a NOOP completed, the job goes on with the next NOOP
+        d->notifyTag.clear();
+        d->tags.removeAll(response.content.first().toString());
+        d->startPollTimer();
+        return;
+    }
+    if (!d->notifyTag.isEmpty() && !response.content.isEmpty() && response.content.first().toString() == d->notifyTag) {
+        d->notifyTag.clear();
+        if (!d->stopRequested && ok) {
+            //Without IDLE the server would hold the events back until the next command
+            d->tags.removeAll(response.content.first().toString());
+            d->originalSocketTimeout = d->sessionInternal()->socketTimeout();
+            d->sessionInternal()->setSocketTimeout(-1);
+            d->idleSent = true;
+            d->sendCommand("IDLE", {});
+            return;
+        }
+    }
+
+    if (handleErrorReplies(response) == Handled) {
+        return;
+    }
+
+    ImapSet vanishedUids;
+    if (JobPrivate::parseVanished(response, &vanishedUids)) {
+        Q_EMIT selectedMessagesVanished(this, vanishedUids);
+        return;
+    }
+    if (response.content.size() < 2) {
+        return;
+    }
+    if (response.content[0].toString() == "+") {
+        d->idling = true;
+        if (d->stopRequested) {
+            stop();
+        }
+        return;
+    }
+
+    const ImapKeyword code = response.content[1].keyword();
+    if (code == ImapKeyword::Status && response.content.size() >= 4) {
+        // * STATUS "INBOX" (MESSAGES 12 UIDNEXT 4392)
+        QList<QPair<QByteArray, qint64> > status;
+        const QList<QByteArray> &items = response.content[3].toList();
+        for (int i = 0; i + 1 < items.size(); i += 2) {
+            status << qMakePair(response.owned(items[i]), items[i + 1].toLongLong());
+        }
+        Q_EMIT mailBoxStatusChanged(this, d->mailBoxName(response.content[2].toString()), status);
+        return;
+    }
+    if (code == ImapKeyword::List && response.content.size() >= 5) {
+        // * LIST () "/" "New" ("OLDNAME" ("Old"))
+        QList<QByteArray> flags;
+        foreach (const QByteArray &flag, response.content[2].toList()) {
+            flags << flag.toLower();
+        }
+        const QString mailBox = d->mailBoxName(response.content[4].toString());
+        if (response.content.size() >= 6 && response.content[5].type() == Message::Part::List) {
+            const QList<QByteArray> extended = response.content[5].toList();
+            for (int i = 0; i + 1 < extended.size(); i += 2) {
+                if (extended[i].toUpper() == "OLDNAME") {
+                    const QByteArray oldName = response.content[5].sublist(i + 1).stringAt(0);
+                    Q_EMIT mailBoxRenamed(this, d->mailBoxName(oldName), mailBox);
+                    return;
+                }
+            }
+        }
+        if (flags.contains("\\nonexistent")) {
+            Q_EMIT mailBoxDeleted(this, mailBox);
+        } else {
+            Q_EMIT mailBoxCreated(this, mailBox, flags);
+        }
+        return;
+    }
+    if (response.content.size() < 3) {
+        return;
+    }
+
+    const qint64 number = response.content[1].toString().toLongLong();
+    switch (response.content[2].keyword()) {
+    case ImapKeyword::Exists:
+        Q_EMIT selectedMessageCountChanged(this, number);
+        break;
+    case ImapKeyword::Expunge:
+        Q_EMIT selectedMessageExpunged(this, number);
+        break;
+    case ImapKeyword::Fetch:
+    case ImapKeyword::UidFetch: {
+        JobPrivate::MessageUpdate update;
+        if (JobPrivate::parseMessageUpdate(response, &update)) {
+            Q_EMIT selectedMessageFlagsChanged(this, update.sequenceNumber, update.uid, update.flags, update.modSeq);
+        }
+        break;
+    }
+    default:
+        qCDebug(KIMAP2_LOG) << "Unhandled response: " << response.toString().constData();
+        break;
+    }
+}
+
+#include "moc_notifyjob.cpp"
@@ -0,0 +1,168 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_NOTIFYJOB_H
+#define KIMAP2_NOTIFYJOB_H
+
+#include "kimap2_export.h"
+
+#include "imapset.h"
+#include "job.h"
+
+#include <QtCore/QPair>
+#include <QtCore/QStringList>
+
+namespace KIMAP2
+{
+
+class Session;
+struct Message;
+class NotifyJobPrivate;
+
+/**
+ * Watches several mailboxes for changes on one connection.
+ *
+ * The job tells the server which events to report with NOTIFY SET and then
+ * idles the connection until stop() is called, like IdleJob does. Instead of
+ * only reporting on the selected mailbox, the server reports the changes of
+ * all mailboxes given with addSubtree() and addMailBoxes(), so a single
+ * connection can replace one idling connection per mailbox.
+ *
+ * Changes to other mailboxes than the selected one are reported with STATUS
+ * responses, see mailBoxStatusChanged(), changes to the selected mailbox
+ * the same way IdleJob reports them.
+ *
+ * This job requires that the server supports NOTIFY
+ * (<a href="https://tools.ietf.org/html/rfc5465">RFC 5465</a>). If it doesn't
+ * support IDLE, the job sends a NOOP every pollInterval() seconds instead, which
+ * makes the server send the events it held back.
+ */
+class KIMAP2_EXPORT NotifyJob : public Job
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(NotifyJob)
+
+public:
+    enum Event {
+        NoEvent = 0,
+        MessageNew = 1,
+        MessageExpunge = 2,
+        FlagChange = 4,
+        MailBoxName = 8,
+        SubscriptionChange = 16
+    };
+    Q_DECLARE_FLAGS(Events, Event)
+
+    explicit NotifyJob(Session *session);
+    virtual ~NotifyJob();
+
+    /**
+     * Sets the events to report for the selected mailbox, whichever it is.
+     *
+     * Only MessageNew, MessageExpunge and FlagChange apply to it, and the
+     * first two have to be given together. Nothing is reported for the
+     * selected mailbox by default.
+     */
+    void setSelectedEvents(Events events);
+    Events selectedEvents() const;
+
+    /**
+     * Reports @p events for the mailboxes @p mailBoxes and all mailboxes below them.
+     *
+     * @param mailBoxes  the (unquoted) names of the mailboxes
+     * @param events  the events to report
+     */
+    void addSubtree(const QStringList &mailBoxes, Events events);
+
+    /**
+     * Reports @p events for the mailboxes @p mailBoxes only.
+     *
+     * @param mailBoxes  the (unquoted) names of the mailboxes
+     * @param events  the events to report
+     */
+    void addMailBoxes(const QStringList &mailBoxes, Events events);
+
+    /**
+     * Sets how many seconds pass between two NOOPs if the server doesn't support IDLE.
+     * The default is 60.
+     */
+    void setPollInterval(int seconds);
+    int pollInterval() const;
+
+public Q_SLOTS:
+    /**
+     * Stops watching. The events stay set on the connection, so they
+     * are reported again while a later IdleJob runs.
+     */
+    void stop();
+
+Q_SIGNALS:
+    /**
+     * The status of a mailbox other than the selected one changed, e.g. MESSAGES
+     * and UIDNEXT after MessageNew, in the same form as StatusJob::status().
+     */
+    void mailBoxStatusChanged(KIMAP2::NotifyJob *job, const QString &mailBox, const QList<QPair<QByteArray, qint64> > &status);
+
+    /**
+     * A mailbox was created, or became visible by a subscription change.
+     */
+    void mailBoxCreated(KIMAP2::NotifyJob *job, const QString &mailBox, const QList<QByteArray> &flags);
+
+    /**
+     * A mailbox was deleted.
+     */
+    void mailBoxDeleted(KIMAP2::NotifyJob *job, const QString &mailBox);
+
+    /**
+     * A mailbox was renamed from @p oldName to @p newName.
+     */
+    void mailBoxRenamed(KIMAP2::NotifyJob *job, const QString &oldName, const QString &newName);
+
+    /**
+     * The number of messages in the selected mailbox changed.
+     */
+    void selectedMessageCountChanged(KIMAP2::NotifyJob *job, qint64 messageCount);
+
+    /**
+     * The message with sequence number @p sequenceNumber was expunged from the selected mailbox.
+     */
+    void selectedMessageExpunged(KIMAP2::NotifyJob *job, qint64 sequenceNumber);
+
+    /**
+     * Messages were expunged from the selected mailbox, reported with VANISHED once QRESYNC is enabled.
+     */
+    void selectedMessagesVanished(KIMAP2::NotifyJob *job, const KIMAP2::ImapSet &uids);
+
+    /**
+     * The flags of a message in the selected mailbox changed.
+     *
+     * @param uid  the UID of the message, or 0 if the server did not send it
+     * @param modSeq  the new mod-sequence of the message, or 0 if the server did not send it
+     */
+    void selectedMessageFlagsChanged(KIMAP2::NotifyJob *job, qint64 sequenceNumber, qint64 uid,
+                                     const QList<QByteArray> &flags, quint64 modSeq);
+
+protected:
+    void doStart() Q_DECL_OVERRIDE;
+    void handleResponse(const Message &response) Q_DECL_OVERRIDE;
+};
+
+}
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(KIMAP2::NotifyJob::Events)
+
+#endif
@@ -0,0 +1,113 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "oauthtokenprovider.h"
+
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QWeakPointer>
+
+namespace KIMAP2
+{
+
+class OAuthTokenProviderPrivate
+{
+public:
+    explicit OAuthTokenProviderPrivate(const OAuthTokenProvider::Fetcher &fetcher)
+        : fetcher(fetcher), fetching(false)
+    {
+    }
+
+    static void tokenFetched(const QWeakPointer<OAuthTokenProviderPrivate> &weak, const QString &token)
+    {
+        const QSharedPointer<OAuthTokenProviderPrivate> d = weak.toStrongRef();
+        if (!d) {
+            return;
+        }
+        QList<OAuthTokenProvider::TokenCallback> waiting;
+        {
+            QMutexLocker locker(&d->mutex);
+            d->fetching = false;
+            d->token = token;
+            waiting.swap(d->waiting);
+        }
+        for (const OAuthTokenProvider::TokenCallback &callback : waiting) {
+            callback(token);
+        }
+    }
+
+    const OAuthTokenProvider::Fetcher fetcher;
+    mutable QMutex mutex;
+    QString token;
+    bool fetching;
+    QList<OAuthTokenProvider::TokenCallback> waiting;
+};
+
+}
+
+using namespace KIMAP2;
+
+OAuthTokenProvider::OAuthTokenProvider(const Fetcher &fetcher)
+    : d(new OAuthTokenProviderPrivate(fetcher))
+{
+}
+
+OAuthTokenProvider::~OAuthTokenProvider()
+{
+}
+
+void OAuthTokenProvider::requestToken(const TokenCallback &callback)
+{
+    QMutexLocker locker(&d->mutex);
+    if (!d->token.isEmpty()) {
+        const QString token = d->token;
+        locker.unlock();
+        callback(token);
+        return;
+    }
+    d->waiting << callback;
+    if (d->fetching) {
+        return;
+    }
+    d->fetching = true;
+    locker.unlock();
+
+    const QWeakPointer<OAuthTokenProviderPrivate> weak = d;
+    d->fetcher([weak](const QString &token) {
+        OAuthTokenProviderPrivate::tokenFetched(weak, token);
+    });
+}
+
+void OAuthTokenProvider::invalidate(const QString &token)
+{
+    QMutexLocker locker(&d->mutex);
+    if (d->token == token) {
+        d->token.clear();
+    }
+}
+
+void OAuthTokenProvider::setToken(const QString &token)
+{
+    QMutexLocker locker(&d->mutex);
+    d->token = token;
+}
+
+QString OAuthTokenProvider::token() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->token;
+}
@@ -0,0 +1,98 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_OAUTHTOKENPROVIDER_H
+#define KIMAP2_OAUTHTOKENPROVIDER_H
+
+#include "kimap2_export.h"
+
+#include <QtCore/QSharedPointer>
+#include <QtCore/QString>
+
+#include <functional>
+
+namespace KIMAP2
+{
+
+class OAuthTokenProviderPrivate;
+
+/**
+ * Hands out an OAuth access token to the logins of one account, see LoginJob::setTokenProvider().
+ *
+ * The provider keeps the last token until a server rejects it, so the sessions of a pool, and
+ * the logins repeated when a session reconnects, share one token instead of each fetching its
+ * own. Logins that ask for a token while it is being refreshed wait for that fetch.
+ *
+ * @code
+ * auto provider = QSharedPointer<KIMAP2::OAuthTokenProvider>::create([account](const KIMAP2::OAuthTokenProvider::TokenCallback &done) {
+ *     account->refreshAccessToken(done);
+ * });
+ * KIMAP2::SessionPool pool(host, 993, [provider](KIMAP2::Session *session) {
+ *     KIMAP2::LoginJob *login = new KIMAP2::LoginJob(session);
+ *     login->setUserName(userName);
+ *     login->setAuthenticationMode(KIMAP2::LoginJob::XOAuth2);
+ *     login->setTokenProvider(provider);
+ *     login->start();
+ * });
+ * @endcode
+ *
+ * The provider can be used from any thread.
+ */
+class KIMAP2_EXPORT OAuthTokenProvider
+{
+public:
+    /**
+     * Receives a token, an empty one if none could be fetched.
+     */
+    typedef std::function<void(const QString &token)> TokenCallback;
+
+    /**
+     * Fetches a new token and passes it to @p done, possibly later and from another thread.
+     * Not called again before the previous fetch finished.
+     */
+    typedef std::function<void(const TokenCallback &done)> Fetcher;
+
+    explicit OAuthTokenProvider(const Fetcher &fetcher);
+    ~OAuthTokenProvider();
+
+    /**
+     * Calls @p callback with the current token, right away if there is one and otherwise once
+     * it has been fetched, on the thread that delivered it.
+     */
+    void requestToken(const TokenCallback &callback);
+
+    /**
+     * Drops @p token, e.g. because the server rejected it, so the next request fetches a new
+     * one. Does nothing if the token has been replaced already.
+     */
+    void invalidate(const QString &token);
+
+    /**
+     * Sets the current token, e.g. one that was refreshed elsewhere.
+     */
+    void setToken(const QString &token);
+    QString token() const;
+
+private:
+    Q_DISABLE_COPY(OAuthTokenProvider)
+    //Shared with the fetches in flight, which may finish after the provider is gone
+    QSharedPointer<OAuthTokenProviderPrivate> d;
+};
+
+}
+
+#endif
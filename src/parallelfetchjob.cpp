@@ -0,0 +1,577 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "parallelfetchjob.h"
+
+#include "kimap_debug.h"
+
+#include "searchjob.h"
+#include "session.h"
+#include "sessionpool.h"
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMap>
+#include <QtCore/QPointer>
+#include <QtCore/QSet>
+#include <QtCore/QTimer>
+
+#include <limits>
+
+// Smaller chunks than this cost more in round trips than they gain in balance
+static const int s_minimumChunkSize = 10;
+
+namespace KIMAP2
+{
+
+class ParallelFetchJobPrivate
+{
+public:
+    struct Worker {
+        QPointer<Session> session;
+        QPointer<FetchJob> job;
+        // What the job fetches, and what it delivered so far
+        ImapSet chunk;
+        qint64 chunkCount = 0;
+        QSet<qint64> received;
+        // The lowest UID of the chunk that wasn't delivered, 0 if none is left
+        qint64 lowestOutstanding = 0;
+        QElapsedTimer timer;
+        // The upper half of the chunk was handed out again, its results are ignored
+        bool split = false;
+    };
+
+    ParallelFetchJobPrivate(ParallelFetchJob *job, SessionPool *pool)
+        : q(job),
+          pool(pool),
+          sessionCount(4),
+          chunkSize(500),
+          rebalanceInterval(2000),
+          ordered(false),
+          started(false),
+          finished(false),
+          processed(0),
+          rebalanceCount(0)
+    {
+    }
+
+    ~ParallelFetchJobPrivate()
+    {
+        qDeleteAll(workers);
+    }
+
+    void search();
+    void partition(const ImapSet &set);
+    void schedule();
+    void fetchChunk(Worker *worker);
+    void resultReceived(Worker *worker, const FetchJob::Result &result);
+    void chunkFinished(Worker *worker, FetchJob *job);
+    void removeWorker(Worker *worker);
+    void rebalance();
+    void deliverOrdered(bool all);
+    void finish(int error = 0, const QString &errorText = QString());
+    void abortAll();
+
+    static qint64 count(const ImapSet &set);
+    static qint64 nextInSet(const ImapSet &set, qint64 uid);
+    ImapSet outstanding(const Worker *worker) const;
+
+    ParallelFetchJob *const q;
+    QPointer<SessionPool> pool;
+    QString mailBox;
+    FetchJob::FetchScope scope;
+    ImapSet uids;
+    int sessionCount;
+    int chunkSize;
+    int rebalanceInterval;
+    bool ordered;
+
+    bool started;
+    bool finished;
+    QList<Worker *> workers;
+    // Not handed out yet
+    ImapSet remaining;
+    qint64 processed;
+    int rebalanceCount;
+    // Held back for ordered delivery
+    QMap<qint64, FetchJob::Result> pendingResults;
+    QTimer rebalanceTimer;
+};
+
+}
+
+using namespace KIMAP2;
+
+qint64 ParallelFetchJobPrivate::count(const ImapSet &set)
+{
+    qint64 count = 0;
+    foreach (const ImapSet::Range &range, set.ranges()) {
+        count += range.end - range.begin + 1;
+    }
+    return count;
+}
+
+/**
+ * Returns the lowest UID of the optimized @p set that is above @p uid, 0 if there is none.
+ */
+qint64 ParallelFetchJobPrivate::nextInSet(const ImapSet &set, qint64 uid)
+{
+    foreach (const ImapSet::Range &range, set.ranges()) {
+        if (uid < range.begin) {
+            return range.begin;
+        }
+        if (uid < range.end) {
+            return uid + 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Moves the first @p count UIDs out of the optimized @p set.
+ */
+static ImapSet takeFirst(ImapSet *set, qint64 count)
+{
+    ImapSet taken;
+    ImapSet rest;
+    foreach (const ImapSet::Range &range, set->ranges()) {
+        if (count <= 0) {
+            rest.add(ImapInterval(range.begin, range.end));
+        } else if (range.end - range.begin + 1 <= count) {
+            taken.add(ImapInterval(range.begin, range.end));
+            count -= range.end - range.begin + 1;
+        } else {
+            taken.add(ImapInterval(range.begin, range.begin + count - 1));
+            rest.add(ImapInterval(range.begin + count, range.end));
+            count = 0;
+        }
+    }
+    *set = rest;
+    return taken;
+}
+
+ImapSet ParallelFetchJobPrivate::outstanding(const Worker *worker) const
+{
+    QVector<ImapSet::Id> received;
+    received.reserve(worker->received.size());
+    foreach (qint64 uid, worker->received) {
+        received << uid;
+    }
+    ImapSet done;
+    done.add(received);
+    return worker->chunk.subtracted(done);
+}
+
+void ParallelFetchJobPrivate::search()
+{
+    Worker *worker = workers.first();
+    if (!pool) {
+        finish(KJob::UserDefinedError, QStringLiteral("The session pool was deleted"));
+        return;
+    }
+    Job *job = pool->submit(worker->session, mailBox, [this](Session *session) -> Job * {
+        SearchJob *search = new SearchJob(session);
+        search->setUidBased(true);
+        search->setReturnOptions(SearchJob::ReturnAll);
+        if (uids.isEmpty()) {
+            search->setTerm(Term(Term::All, QString()));
+        } else {
+            search->setTerm(Term(Term::Uid, uids));
+        }
+        return search;
+    }, true);
+    if (!job) {
+        finish(KJob::UserDefinedError, QStringLiteral("The session is no longer in the pool"));
+        return;
+    }
+    QObject::connect(job, &KJob::finished, q, [this, worker](KJob *job) {
+        if (finished) {
+            return;
+        }
+        if (job->error()) {
+            finish(job->error(), job->errorText());
+        } else if (!worker->session) {
+            finish(ConnectionLost, QStringLiteral("The session went away during the search"));
+        } else {
+            partition(static_cast<SearchJob *>(job)->resultSet());
+        }
+    });
+}
+
+void ParallelFetchJobPrivate::partition(const ImapSet &set)
+{
+    remaining = set.united(ImapSet());
+    q->setTotalAmount(KJob::Items, count(remaining));
+    if (remaining.isEmpty()) {
+        finish();
+        return;
+    }
+    schedule();
+}
+
+void ParallelFetchJobPrivate::schedule()
+{
+    if (finished) {
+        return;
+    }
+    //Workers whose session left the pool are removed on the way
+    const QList<Worker *> current = workers;
+    for (Worker *worker : current) {
+        if (finished || remaining.isEmpty()) {
+            break;
+        }
+        if (!worker->job) {
+            fetchChunk(worker);
+        }
+    }
+    if (finished) {
+        return;
+    }
+
+    bool idle = false;
+    bool busy = false;
+    for (const Worker *worker : workers) {
+        if (worker->job) {
+            busy = true;
+        } else {
+            idle = true;
+        }
+    }
+    if (!busy) {
+        deliverOrdered(true);
+        finish();
+    } else if (idle && remaining.isEmpty()) {
+        rebalance();
+    }
+}
+
+void ParallelFetchJobPrivate::fetchChunk(Worker *worker)
+{
+    if (!pool) {
+        finish(KJob::UserDefinedError, QStringLiteral("The session pool was deleted"));
+        return;
+    }
+    //Guided: the chunks shrink with what is left, so the sessions run out of work together
+    const qint64 left = count(remaining);
+    const qint64 size = qMin<qint64>(chunkSize, qMax<qint64>(s_minimumChunkSize, left / (2 * workers.size())));
+    worker->chunk = takeFirst(&remaining, size);
+    worker->chunkCount = count(worker->chunk);
+    worker->received.clear();
+    worker->lowestOutstanding = worker->chunk.ranges().first().begin;
+    worker->split = false;
+    worker->timer.start();
+
+    const ImapSet chunk = worker->chunk;
+    Job *job = pool->submit(worker->session, mailBox, [this, chunk](Session *session) -> Job * {
+        FetchJob *fetch = new FetchJob(session);
+        fetch->setUidBased(true);
+        fetch->setSequenceSet(chunk);
+        fetch->setScope(scope);
+        return fetch;
+    }, true);
+    FetchJob *fetch = static_cast<FetchJob *>(job);
+    if (!fetch) {
+        remaining = remaining.united(worker->chunk);
+        removeWorker(worker);
+        return;
+    }
+    worker->job = fetch;
+    QObject::connect(fetch, &FetchJob::resultReceived, q, [this, worker](const FetchJob::Result &result) {
+        resultReceived(worker, result);
+    });
+    //Also emitted if the job goes away with its session
+    QObject::connect(fetch, &KJob::finished, q, [this, worker, fetch]() {
+        chunkFinished(worker, fetch);
+    });
+}
+
+void ParallelFetchJobPrivate::resultReceived(Worker *worker, const FetchJob::Result &result)
+{
+    if (finished || worker->received.contains(result.uid) || !worker->chunk.contains(result.uid)) {
+        return;
+    }
+    worker->received.insert(result.uid);
+    while (worker->lowestOutstanding && worker->received.contains(worker->lowestOutstanding)) {
+        worker->lowestOutstanding = nextInSet(worker->chunk, worker->lowestOutstanding);
+    }
+    q->setProcessedAmount(KJob::Items, ++processed);
+
+    if (!ordered) {
+        emit q->resultReceived(result);
+        return;
+    }
+    pendingResults.insert(result.uid, result);
+    deliverOrdered(false);
+}
+
+void ParallelFetchJobPrivate::chunkFinished(Worker *worker, FetchJob *job)
+{
+    if (worker->job != job) {
+        return;
+    }
+    worker->job = Q_NULLPTR;
+    if (finished) {
+        return;
+    }
+
+    const int error = job->error();
+    if (error == ConnectionLost || error == CouldNotConnect || error == HostNotFound || !worker->session) {
+        qCDebug(KIMAP2_LOG) << "A session of the parallel fetch failed:" << job->errorString();
+        remaining = remaining.united(outstanding(worker));
+        if (workers.size() == 1) {
+            finish(error, job->errorText());
+            return;
+        }
+        removeWorker(worker);
+        worker = Q_NULLPTR;
+    } else if (error) {
+        finish(error, job->errorText());
+        return;
+    }
+    //UIDs that didn't come were expunged in the meantime
+    if (worker) {
+        worker->chunk = ImapSet();
+        worker->lowestOutstanding = 0;
+    }
+    if (ordered) {
+        deliverOrdered(false);
+    }
+    schedule();
+}
+
+void ParallelFetchJobPrivate::removeWorker(Worker *worker)
+{
+    workers.removeOne(worker);
+    delete worker;
+    if (workers.isEmpty()) {
+        finish(KJob::UserDefinedError, QStringLiteral("No session of the pool is left to fetch from"));
+    }
+}
+
+void ParallelFetchJobPrivate::rebalance()
+{
+    rebalanceTimer.stop();
+    if (rebalanceInterval <= 0 || finished) {
+        return;
+    }
+    Worker *lagging = Q_NULLPTR;
+    qint64 longest = 0;
+    for (Worker *worker : workers) {
+        const qint64 left = worker->chunkCount - worker->received.size();
+        //Splitting small rests again would only add round trips
+        if (!worker->job || worker->split || left < 2 * s_minimumChunkSize) {
+            continue;
+        }
+        const qint64 elapsed = worker->timer.elapsed();
+        // Without a result yet the rate is unknown, the time it already took has to do
+        const qint64 expected = worker->received.isEmpty() ? elapsed : left * elapsed / worker->received.size();
+        if (expected >= rebalanceInterval && expected > longest) {
+            lagging = worker;
+            longest = expected;
+        }
+    }
+    if (!lagging) {
+        rebalanceTimer.start(rebalanceInterval);
+        return;
+    }
+    //Aborting would drop the results that are already on their way, so the job keeps running
+    //and what it sends for the upper half of its rest is ignored
+    ImapSet moved = outstanding(lagging).united(ImapSet());
+    takeFirst(&moved, count(moved) / 2);
+    qCDebug(KIMAP2_LOG) << "Handing out" << count(moved) << "UIDs of a lagging session again";
+    lagging->split = true;
+    lagging->chunk = lagging->chunk.subtracted(moved);
+    lagging->chunkCount = count(lagging->chunk);
+    remaining = remaining.united(moved);
+    ++rebalanceCount;
+    schedule();
+}
+
+void ParallelFetchJobPrivate::deliverOrdered(bool all)
+{
+    qint64 frontier = std::numeric_limits<qint64>::max();
+    if (!all) {
+        if (!remaining.isEmpty()) {
+            frontier = remaining.ranges().first().begin;
+        }
+        for (const Worker *worker : workers) {
+            if (worker->lowestOutstanding) {
+                frontier = qMin(frontier, worker->lowestOutstanding);
+            }
+        }
+    }
+    while (!pendingResults.isEmpty() && pendingResults.firstKey() < frontier) {
+        const FetchJob::Result result = pendingResults.take(pendingResults.firstKey());
+        emit q->resultReceived(result);
+        if (finished) {
+            return;
+        }
+    }
+}
+
+void ParallelFetchJobPrivate::abortAll()
+{
+    for (Worker *worker : workers) {
+        if (worker->job) {
+            worker->job->abort();
+        }
+    }
+}
+
+void ParallelFetchJobPrivate::finish(int error, const QString &errorText)
+{
+    if (finished) {
+        return;
+    }
+    finished = true;
+    rebalanceTimer.stop();
+    abortAll();
+    if (error) {
+        q->setError(error);
+        q->setErrorText(errorText);
+    }
+    q->emitResult();
+}
+
+ParallelFetchJob::ParallelFetchJob(SessionPool *pool, QObject *parent)
+    : KJob(parent), d(new ParallelFetchJobPrivate(this, pool))
+{
+    d->rebalanceTimer.setSingleShot(true);
+    connect(&d->rebalanceTimer, &QTimer::timeout, this, [this]() {
+        d->rebalance();
+    });
+}
+
+ParallelFetchJob::~ParallelFetchJob()
+{
+    d->abortAll();
+    delete d;
+}
+
+void ParallelFetchJob::setMailBox(const QString &mailBox)
+{
+    d->mailBox = mailBox;
+}
+
+QString ParallelFetchJob::mailBox() const
+{
+    return d->mailBox;
+}
+
+void ParallelFetchJob::setScope(const FetchJob::FetchScope &scope)
+{
+    d->scope = scope;
+}
+
+FetchJob::FetchScope ParallelFetchJob::scope() const
+{
+    return d->scope;
+}
+
+void ParallelFetchJob::setUids(const ImapSet &uids)
+{
+    d->uids = uids;
+}
+
+ImapSet ParallelFetchJob::uids() const
+{
+    return d->uids;
+}
+
+void ParallelFetchJob::setSessionCount(int count)
+{
+    d->sessionCount = qMax(1, count);
+}
+
+int ParallelFetchJob::sessionCount() const
+{
+    return d->sessionCount;
+}
+
+void ParallelFetchJob::setChunkSize(int count)
+{
+    d->chunkSize = qMax(1, count);
+}
+
+int ParallelFetchJob::chunkSize() const
+{
+    return d->chunkSize;
+}
+
+void ParallelFetchJob::setRebalanceInterval(int msecs)
+{
+    d->rebalanceInterval = msecs;
+}
+
+int ParallelFetchJob::rebalanceInterval() const
+{
+    return d->rebalanceInterval;
+}
+
+void ParallelFetchJob::setOrdered(bool ordered)
+{
+    d->ordered = ordered;
+}
+
+bool ParallelFetchJob::isOrdered() const
+{
+    return d->ordered;
+}
+
+int ParallelFetchJob::rebalanceCount() const
+{
+    return d->rebalanceCount;
+}
+
+void ParallelFetchJob::start()
+{
+    Q_ASSERT(!d->started);
+    d->started = true;
+    if (!d->pool || d->mailBox.isEmpty()) {
+        qCWarning(KIMAP2_LOG) << "A parallel fetch needs a pool and a mailbox";
+        d->finish(KJob::UserDefinedError, QStringLiteral("No mailbox to fetch from"));
+        return;
+    }
+    foreach (Session *session, d->pool->sessionsFor(d->mailBox, d->sessionCount)) {
+        ParallelFetchJobPrivate::Worker *worker = new ParallelFetchJobPrivate::Worker;
+        worker->session = session;
+        d->workers << worker;
+    }
+    if (d->workers.isEmpty()) {
+        d->finish(KJob::UserDefinedError, QStringLiteral("The connection limit doesn't allow another session"));
+        return;
+    }
+    qCDebug(KIMAP2_LOG) << "Fetching" << d->mailBox << "over" << d->workers.size() << "sessions";
+
+    //Ranges without an open end can be handed out right away
+    bool bounded = !d->uids.isEmpty() && !d->uids.isSavedSearchResult();
+    foreach (const ImapSet::Range &range, d->uids.ranges()) {
+        bounded = bounded && range.end;
+    }
+    if (bounded) {
+        d->partition(d->uids);
+    } else {
+        d->search();
+    }
+}
+
+bool ParallelFetchJob::doKill()
+{
+    d->finished = true;
+    d->rebalanceTimer.stop();
+    d->abortAll();
+    return true;
+}
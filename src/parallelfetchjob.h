@@ -0,0 +1,139 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_PARALLELFETCHJOB_H
+#define KIMAP2_PARALLELFETCHJOB_H
+
+#include "kimap2_export.h"
+
+#include "fetchjob.h"
+#include "imapset.h"
+
+#include <KJob>
+
+namespace KIMAP2
+{
+
+class SessionPool;
+class ParallelFetchJobPrivate;
+
+/**
+ * Fetches the messages of one mailbox over several sessions of a SessionPool at once.
+ *
+ * A single connection is limited by its own throughput, e.g. by TLS running on one core or
+ * by the congestion window of one stream, so the initial download of a large mailbox goes
+ * faster over a few of them. The UIDs are handed out to the sessions in chunks, each of
+ * which is fetched by a UID based FetchJob with the mailbox EXAMINEd. A session that is done
+ * takes the next chunk, and the chunks get smaller towards the end so the sessions finish
+ * together.
+ *
+ * Once nothing is left to hand out, a session that lags behind the others, i.e. that would
+ * take longer than rebalanceInterval() for the rest of its chunk at its rate so far, keeps
+ * the lower half of what it didn't deliver yet, and the upper half is handed out again to the
+ * idle sessions. Its FetchJob isn't aborted, so results already on their way aren't lost, but
+ * the session stays busy until the server sent the whole chunk.
+ *
+ * The results are delivered unordered as they arrive, or in UID order with setOrdered().
+ * Progress is reported in KJob::Items. The job fails with the error of the first FetchJob
+ * that fails, unless it lost its connection while other sessions remain to take over.
+ *
+ * @code
+ * KIMAP2::ParallelFetchJob *job = new KIMAP2::ParallelFetchJob(pool);
+ * job->setMailBox(QStringLiteral("INBOX"));
+ * job->setScope(scope);
+ * connect(job, &KIMAP2::ParallelFetchJob::resultReceived, store, &Store::add);
+ * job->start();
+ * @endcode
+ */
+class KIMAP2_EXPORT ParallelFetchJob : public KJob
+{
+    Q_OBJECT
+
+public:
+    explicit ParallelFetchJob(SessionPool *pool, QObject *parent = Q_NULLPTR);
+    ~ParallelFetchJob();
+
+    void setMailBox(const QString &mailBox);
+    QString mailBox() const;
+
+    /**
+     * Sets what is fetched for every message. Bodies should be fetched with BODY.PEEK,
+     * see FetchJob::FetchScope, since the mailbox is only examined.
+     */
+    void setScope(const FetchJob::FetchScope &scope);
+    FetchJob::FetchScope scope() const;
+
+    /**
+     * Sets the UIDs to fetch, by default all messages.
+     *
+     * A set without open end, e.g. ImapSet(1, select->nextUid() - 1) from an earlier
+     * SelectJob, is partitioned as is. Otherwise a UID SEARCH, or an ESEARCH where the server
+     * supports it, finds the messages first, which balances the chunks if there are large
+     * gaps between the UIDs.
+     */
+    void setUids(const ImapSet &uids);
+    ImapSet uids() const;
+
+    /**
+     * Sets how many sessions the job uses at most. The pool may provide fewer.
+     * The default is 4.
+     */
+    void setSessionCount(int count);
+    int sessionCount() const;
+
+    /**
+     * Sets how many UIDs a chunk has at most. The default is 500.
+     */
+    void setChunkSize(int count);
+    int chunkSize() const;
+
+    /**
+     * Sets after how many milliseconds of expected remaining work a session counts as lagging
+     * once the others are idle, 0 to never rebalance. The default is 2000.
+     */
+    void setRebalanceInterval(int msecs);
+    int rebalanceInterval() const;
+
+    /**
+     * Delivers the results in ascending UID order. A result is then held back until those
+     * of all lower UIDs were delivered. Disabled by default.
+     */
+    void setOrdered(bool ordered);
+    bool isOrdered() const;
+
+    /**
+     * Returns how often the chunk of a lagging session was split up so far.
+     */
+    int rebalanceCount() const;
+
+    void start() Q_DECL_OVERRIDE;
+
+Q_SIGNALS:
+    void resultReceived(const KIMAP2::FetchJob::Result &result);
+
+protected:
+    bool doKill() Q_DECL_OVERRIDE;
+
+private:
+    Q_DISABLE_COPY(ParallelFetchJob)
+    friend class ParallelFetchJobPrivate;
+    ParallelFetchJobPrivate *const d;
+};
+
+}
+
+#endif
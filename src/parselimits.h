@@ -0,0 +1,46 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_PARSELIMITS_H
+#define KIMAP2_PARSELIMITS_H
+
+#include "kimap2_export.h"
+
+#include <QtCore/QtGlobal>
+
+namespace KIMAP2
+{
+
+/**
+ * Bounds what the response parser holds of a single response, see Session::setParseLimits().
+ *
+ * 0 means no limit, the default for all of them.
+ */
+struct KIMAP2_EXPORT ParseLimits {
+    ParseLimits();
+
+    // An atom, quoted string, literal size or nested list, in bytes
+    qint64 tokenSize;
+    // A response, without its literals
+    qint64 lineSize;
+    // The size a literal announces, including literals in nested lists
+    qint64 literalSize;
+};
+
+}
+
+#endif
@@ -0,0 +1,66 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_PARSERCOUNTERS_H
+#define KIMAP2_PARSERCOUNTERS_H
+
+#include "kimap2_export.h"
+
+#include <QtCore/QtGlobal>
+
+namespace KIMAP2
+{
+
+/**
+ * What the response parser did, for profiling, see SessionMetrics::parser.
+ *
+ * Only counted if the library was built with KIMAP2_PARSER_COUNTERS, the counters
+ * stay 0 otherwise and cost nothing.
+ */
+struct KIMAP2_EXPORT ParserCounters {
+    ParserCounters();
+
+    /**
+     * Returns true if the library was built with the counters.
+     */
+    static bool isEnabled();
+
+    // Reads shorter than this count as small reads
+    static const int smallReadSize = 512;
+
+    // The bytes the parser consumed in each of its states
+    qint64 initBytes;
+    qint64 quotedStringBytes;
+    qint64 literalStringBytes;
+    qint64 stringBytes;
+    qint64 whitespaceBytes;
+    qint64 angleBracketStringBytes;
+    qint64 crlfBytes;
+    // The bytes of nested lists, which are also passed on as a whole
+    qint64 sublistBytes;
+    // Times the buffer was trimmed, the times that copied an unfinished token, and the bytes copied
+    qint64 trims;
+    qint64 trimCopies;
+    qint64 trimCopiedBytes;
+    // Reads from the socket, and those that returned less than smallReadSize bytes
+    qint64 reads;
+    qint64 smallReads;
+};
+
+}
+
+#endif
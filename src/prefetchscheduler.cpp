@@ -0,0 +1,344 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "prefetchscheduler.h"
+
+#include "kimap_debug.h"
+
+#include "session.h"
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QPointer>
+#include <QtCore/QTimer>
+
+namespace KIMAP2
+{
+
+class PrefetchSchedulerPrivate
+{
+public:
+    struct Range {
+        QString mailBox;
+        ImapSet uids;
+        FetchJob::FetchScope scope;
+        int rank;
+    };
+
+    PrefetchSchedulerPrivate(PrefetchScheduler *scheduler, Session *session)
+        : q(scheduler),
+          session(session),
+          chunkSize(50),
+          byteBudget(0),
+          timeBudget(0),
+          running(false),
+          yielding(false),
+          runBytes(0),
+          chunkStartBytes(0)
+    {
+    }
+
+    void insert(const Range &range, bool first);
+    void scheduleNext();
+    void fetchNext();
+    void yield();
+    void chunkFinished(FetchJob *fetchJob);
+    void finishRun();
+    bool budgetExhausted() const;
+
+    qint64 receivedBytes() const
+    {
+        return session ? session->metrics().bytesReceived : 0;
+    }
+
+    PrefetchScheduler *const q;
+    QPointer<Session> session;
+    // Sorted by rank
+    QList<Range> ranges;
+    int chunkSize;
+    qint64 byteBudget;
+    int timeBudget;
+
+    bool running;
+    QElapsedTimer runTimer;
+    QTimer deadline;
+    QPointer<FetchJob> job;
+    // Aborted because another job was queued or the run ended
+    bool yielding;
+    // What job fetches, and what it delivered so far
+    Range chunk;
+    QVector<ImapSet::Id> received;
+    qint64 runBytes;
+    qint64 chunkStartBytes;
+};
+
+}
+
+using namespace KIMAP2;
+
+/**
+ * Moves the first @p count UIDs out of @p set. An interval without end is taken as a
+ * chunk of its own, since its size isn't known.
+ */
+static ImapSet takeFirst(ImapSet *set, int count)
+{
+    ImapSet taken;
+    ImapSet rest;
+    qint64 remaining = count;
+    foreach (const ImapSet::Range &range, set->ranges()) {
+        if (remaining <= 0) {
+            rest.add(ImapInterval(range.begin, range.end));
+        } else if (!range.end) {
+            if (taken.isEmpty()) {
+                taken.add(ImapInterval(range.begin));
+                remaining = 0;
+            } else {
+                rest.add(ImapInterval(range.begin));
+            }
+        } else if (range.end - range.begin + 1 <= remaining) {
+            taken.add(ImapInterval(range.begin, range.end));
+            remaining -= range.end - range.begin + 1;
+        } else {
+            taken.add(ImapInterval(range.begin, range.begin + remaining - 1));
+            rest.add(ImapInterval(range.begin + remaining, range.end));
+            remaining = 0;
+        }
+    }
+    *set = rest;
+    return taken;
+}
+
+void PrefetchSchedulerPrivate::insert(const Range &range, bool first)
+{
+    int i = 0;
+    while (i < ranges.size() && (ranges.at(i).rank < range.rank || (!first && ranges.at(i).rank == range.rank))) {
+        ++i;
+    }
+    ranges.insert(i, range);
+}
+
+void PrefetchSchedulerPrivate::scheduleNext()
+{
+    //Let jobs started in the meantime go first
+    QTimer::singleShot(0, q, [this]() {
+        fetchNext();
+    });
+}
+
+bool PrefetchSchedulerPrivate::budgetExhausted() const
+{
+    return (byteBudget > 0 && runBytes >= byteBudget) || (timeBudget > 0 && runTimer.elapsed() >= timeBudget);
+}
+
+void PrefetchSchedulerPrivate::fetchNext()
+{
+    if (!running || job || !session) {
+        return;
+    }
+    if (budgetExhausted()) {
+        finishRun();
+        return;
+    }
+    if (session->jobQueueSize() > 0) {
+        //Continued once the queue ran empty
+        return;
+    }
+
+    const QString selected = session->selectedMailBox();
+    int i = 0;
+    while (i < ranges.size() && ranges.at(i).mailBox != selected) {
+        ++i;
+    }
+    if (i == ranges.size()) {
+        finishRun();
+        return;
+    }
+
+    Range &range = ranges[i];
+    chunk.mailBox = range.mailBox;
+    chunk.scope = range.scope;
+    chunk.rank = range.rank;
+    chunk.uids = takeFirst(&range.uids, chunkSize);
+    if (range.uids.isEmpty()) {
+        ranges.removeAt(i);
+    }
+    received.clear();
+    yielding = false;
+    chunkStartBytes = receivedBytes();
+
+    job = new FetchJob(session);
+    job->setUidBased(true);
+    job->setSequenceSet(chunk.uids);
+    job->setScope(chunk.scope);
+    job->setPriority(Job::BackgroundPriority);
+    QObject::connect(job.data(), &FetchJob::resultReceived, q, [this](const FetchJob::Result &result) {
+        received << result.uid;
+        emit q->resultReceived(chunk.mailBox, result);
+    });
+    FetchJob *fetchJob = job.data();
+    QObject::connect(fetchJob, &KJob::result, q, [this, fetchJob]() {
+        chunkFinished(fetchJob);
+    });
+    job->start();
+}
+
+void PrefetchSchedulerPrivate::yield()
+{
+    if (job && !yielding) {
+        yielding = true;
+        job->abort();
+    }
+}
+
+void PrefetchSchedulerPrivate::chunkFinished(FetchJob *fetchJob)
+{
+    runBytes += receivedBytes() - chunkStartBytes;
+    if (fetchJob->error() == KJob::KilledJobError) {
+        //Fetched later, ahead of the rest of the range
+        Range rest = chunk;
+        ImapSet done;
+        done.add(received);
+        rest.uids = chunk.uids.subtracted(done);
+        if (!rest.uids.isEmpty()) {
+            insert(rest, true);
+        }
+    } else if (fetchJob->error()) {
+        qCWarning(KIMAP2_LOG) << "Prefetching" << chunk.uids.toImapSequenceSet() << "failed:" << fetchJob->errorString();
+    }
+    job = Q_NULLPTR;
+    if (running) {
+        scheduleNext();
+    }
+}
+
+void PrefetchSchedulerPrivate::finishRun()
+{
+    running = false;
+    deadline.stop();
+    yield();
+    emit q->runFinished();
+}
+
+PrefetchScheduler::PrefetchScheduler(Session *session, QObject *parent)
+    : QObject(parent), d(new PrefetchSchedulerPrivate(this, session))
+{
+    d->deadline.setSingleShot(true);
+    connect(&d->deadline, &QTimer::timeout, this, [this]() {
+        d->finishRun();
+    });
+    connect(session, &Session::jobQueueSizeChanged, this, [this](int queueSize) {
+        if (!d->running) {
+            return;
+        }
+        if (d->job && queueSize > 1) {
+            qCDebug(KIMAP2_LOG) << "Prefetching steps aside for another job";
+            d->yield();
+        } else if (!d->job && queueSize == 0) {
+            d->scheduleNext();
+        }
+    });
+}
+
+PrefetchScheduler::~PrefetchScheduler()
+{
+    stop();
+    delete d;
+}
+
+void PrefetchScheduler::addRange(const QString &mailBox, const ImapSet &uids, const FetchJob::FetchScope &scope, int rank)
+{
+    if (uids.isEmpty()) {
+        return;
+    }
+    PrefetchSchedulerPrivate::Range range;
+    range.mailBox = mailBox;
+    range.uids = uids;
+    range.scope = scope;
+    range.rank = rank;
+    d->insert(range, false);
+    if (d->running) {
+        d->scheduleNext();
+    }
+}
+
+void PrefetchScheduler::clear(const QString &mailBox)
+{
+    for (int i = d->ranges.size() - 1; i >= 0; --i) {
+        if (mailBox.isEmpty() || d->ranges.at(i).mailBox == mailBox) {
+            d->ranges.removeAt(i);
+        }
+    }
+}
+
+bool PrefetchScheduler::isEmpty() const
+{
+    return d->ranges.isEmpty() && !d->job;
+}
+
+void PrefetchScheduler::setChunkSize(int count)
+{
+    d->chunkSize = qMax(1, count);
+}
+
+int PrefetchScheduler::chunkSize() const
+{
+    return d->chunkSize;
+}
+
+void PrefetchScheduler::setByteBudget(qint64 bytes)
+{
+    d->byteBudget = bytes;
+}
+
+qint64 PrefetchScheduler::byteBudget() const
+{
+    return d->byteBudget;
+}
+
+void PrefetchScheduler::setTimeBudget(int msecs)
+{
+    d->timeBudget = msecs;
+}
+
+int PrefetchScheduler::timeBudget() const
+{
+    return d->timeBudget;
+}
+
+bool PrefetchScheduler::isRunning() const
+{
+    return d->running;
+}
+
+void PrefetchScheduler::start()
+{
+    d->running = true;
+    d->runBytes = 0;
+    d->runTimer.start();
+    if (d->timeBudget > 0) {
+        d->deadline.start(d->timeBudget);
+    }
+    d->scheduleNext();
+}
+
+void PrefetchScheduler::stop()
+{
+    d->running = false;
+    d->deadline.stop();
+    d->yield();
+}
+
+#include "moc_prefetchscheduler.cpp"
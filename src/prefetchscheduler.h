@@ -0,0 +1,124 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_PREFETCHSCHEDULER_H
+#define KIMAP2_PREFETCHSCHEDULER_H
+
+#include "kimap2_export.h"
+
+#include "fetchjob.h"
+#include "imapset.h"
+
+#include <QtCore/QObject>
+
+namespace KIMAP2
+{
+
+class Session;
+class PrefetchSchedulerPrivate;
+
+/**
+ * Fetches messages ahead of time while a session has nothing else to do.
+ *
+ * UID ranges are added with a rank, e.g. the headers of the visible messages with rank 0,
+ * those of the surrounding ones with rank 1 and the bodies of the unread ones with rank 2.
+ * Once start() was called and the job queue of the session is empty, the ranges are
+ * fetched in the order of their ranks by FetchJobs of at most chunkSize() UIDs with
+ * Job::BackgroundPriority.
+ *
+ * As soon as another job is queued, the running fetch is aborted and its remaining UIDs go
+ * back to their range, so the scheduler never delays an interactive job by more than the
+ * abort takes. Only ranges of the mailbox that is selected on the session are fetched,
+ * the scheduler doesn't select mailboxes on its own.
+ *
+ * A run started with start() ends with runFinished() when its byte or time budget is used
+ * up, or when no range of the selected mailbox is left.
+ */
+class KIMAP2_EXPORT PrefetchScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit PrefetchScheduler(Session *session, QObject *parent = Q_NULLPTR);
+    ~PrefetchScheduler();
+
+    /**
+     * Adds @p uids of @p mailBox to fetch with @p scope. Lower ranks are fetched first, ranges
+     * of the same rank in the order they were added, and the UIDs of a range in its order.
+     */
+    void addRange(const QString &mailBox, const ImapSet &uids, const FetchJob::FetchScope &scope, int rank = 0);
+
+    /**
+     * Drops the ranges of @p mailBox, or all of them for an empty mailbox.
+     */
+    void clear(const QString &mailBox = QString());
+
+    /**
+     * Returns true if no range is left to fetch.
+     */
+    bool isEmpty() const;
+
+    /**
+     * Sets how many UIDs each FetchJob fetches at most. The default is 50.
+     */
+    void setChunkSize(int count);
+    int chunkSize() const;
+
+    /**
+     * Ends a run once @p bytes were received for it. It is checked between the chunks, so a
+     * run takes at most one chunk more. The default of 0 doesn't limit it.
+     */
+    void setByteBudget(qint64 bytes);
+    qint64 byteBudget() const;
+
+    /**
+     * Ends a run @p msecs milliseconds after it started, aborting the fetch in flight.
+     * The default of 0 doesn't limit it.
+     */
+    void setTimeBudget(int msecs);
+    int timeBudget() const;
+
+    bool isRunning() const;
+
+public Q_SLOTS:
+    /**
+     * Starts a run with fresh budgets.
+     */
+    void start();
+
+    /**
+     * Ends the run, aborting the fetch in flight.
+     */
+    void stop();
+
+Q_SIGNALS:
+    void resultReceived(const QString &mailBox, const KIMAP2::FetchJob::Result &result);
+
+    /**
+     * Emitted when a run ended on its own, i.e. not by stop().
+     */
+    void runFinished();
+
+private:
+    Q_DISABLE_COPY(PrefetchScheduler)
+    friend class PrefetchSchedulerPrivate;
+    PrefetchSchedulerPrivate *const d;
+};
+
+}
+
+#endif
@@ -51,8 +51,10 @@ RenameJob::~RenameJob()
 void RenameJob::doStart()
 {
     Q_D(RenameJob);
-    d->sendCommand("RENAME", '\"' + KIMAP2::encodeImapFolderName(d->sourceMailBox.toUtf8()) +
-            "\" \"" + KIMAP2::encodeImapFolderName(d->destinationMailBox.toUtf8()) + '\"');
+    d->sessionInternal()->forgetMailBoxInfo(d->sourceMailBox);
+    d->sessionInternal()->forgetMailBoxInfo(d->destinationMailBox);
+    d->sendCommand("RENAME", '\"' + d->sessionInternal()->encodeMailBoxName(d->sourceMailBox) +
+            "\" \"" + d->sessionInternal()->encodeMailBoxName(d->destinationMailBox) + '\"');
 }
 
 void RenameJob::setSourceMailBox(const QString &mailBox)
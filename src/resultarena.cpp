@@ -0,0 +1,181 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "resultarena.h"
+
+#include <QtCore/QMutex>
+#include <QtCore/QVector>
+
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+
+// Keeps the copies aligned, memcpy is faster on aligned data
+static const int s_alignment = 16;
+
+namespace KIMAP2
+{
+
+class ResultArenaPrivate
+{
+public:
+    struct Block {
+        char *data;
+        int size;
+        int used;
+    };
+
+    ResultArenaPrivate(int blockSize)
+        : blockSize(blockSize),
+          current(0),
+          size(0)
+    {
+    }
+
+    ~ResultArenaPrivate()
+    {
+        for (const Block &block : blocks) {
+            std::free(block.data);
+        }
+    }
+
+    char *allocate(int bytes);
+
+    const int blockSize;
+    QVector<Block> blocks;
+    // The block copies go to, those before it are full
+    int current;
+    qint64 size;
+    mutable QMutex mutex;
+};
+
+}
+
+using namespace KIMAP2;
+
+char *ResultArenaPrivate::allocate(int bytes)
+{
+    const int needed = (bytes + s_alignment - 1) / s_alignment * s_alignment;
+    for (; current < blocks.size(); ++current) {
+        Block &block = blocks[current];
+        if (block.size - block.used >= needed) {
+            char *data = block.data + block.used;
+            block.used += needed;
+            return data;
+        }
+        //Don't give up on a block for a copy larger than blocks are anyway
+        if (needed > blockSize) {
+            break;
+        }
+    }
+
+    Block block;
+    block.size = qMax(needed, blockSize);
+    block.data = static_cast<char *>(std::malloc(block.size));
+    if (!block.data) {
+        return Q_NULLPTR;
+    }
+    block.used = needed;
+    blocks.insert(current, block);
+    if (needed > blockSize) {
+        //Keeps the current block open for the smaller copies
+        ++current;
+    }
+    return block.data;
+}
+
+ResultArena::ResultArena(int blockSize)
+    : d(new ResultArenaPrivate(qMax(blockSize, s_alignment)))
+{
+}
+
+ResultArena::~ResultArena()
+{
+    delete d;
+}
+
+int ResultArena::blockSize() const
+{
+    return d->blockSize;
+}
+
+QByteArray ResultArena::copy(const char *data, int size)
+{
+    if (size <= 0) {
+        return QByteArray("");
+    }
+    QMutexLocker locker(&d->mutex);
+    char *copy = size < INT_MAX - s_alignment ? d->allocate(size + 1) : Q_NULLPTR;
+    if (!copy) {
+        return QByteArray(data, size);
+    }
+    std::memcpy(copy, data, size);
+    copy[size] = '\0';
+    d->size += size;
+    return QByteArray::fromRawData(copy, size);
+}
+
+QByteArray ResultArena::copy(const QByteArray &data)
+{
+    if (data.isNull()) {
+        return QByteArray();
+    }
+    return copy(data.constData(), data.size());
+}
+
+bool ResultArena::contains(const char *data) const
+{
+    QMutexLocker locker(&d->mutex);
+    for (const ResultArenaPrivate::Block &block : d->blocks) {
+        if (data >= block.data && data < block.data + block.size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+qint64 ResultArena::size() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->size;
+}
+
+qint64 ResultArena::capacity() const
+{
+    QMutexLocker locker(&d->mutex);
+    qint64 capacity = 0;
+    for (const ResultArenaPrivate::Block &block : d->blocks) {
+        capacity += block.size;
+    }
+    return capacity;
+}
+
+void ResultArena::reset()
+{
+    QMutexLocker locker(&d->mutex);
+    for (int i = d->blocks.size() - 1; i >= 0; --i) {
+        ResultArenaPrivate::Block &block = d->blocks[i];
+        if (block.size > d->blockSize) {
+            std::free(block.data);
+            d->blocks.remove(i);
+        } else {
+            block.used = 0;
+        }
+    }
+    d->current = 0;
+    d->size = 0;
+}
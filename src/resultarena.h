@@ -0,0 +1,103 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_RESULTARENA_H
+#define KIMAP2_RESULTARENA_H
+
+#include "kimap2_export.h"
+
+#include <QtCore/QByteArray>
+
+namespace KIMAP2
+{
+
+class ResultArenaPrivate;
+
+/**
+ * Keeps the raw data of FetchJob results in large blocks that are released all at once,
+ * see FetchJob::setResultArena().
+ *
+ * Copying millions of message bodies into individually allocated byte arrays fragments the
+ * heap of a long running process. With an arena, the data of a batch of results goes into a
+ * few blocks one after the other, and reset() makes the blocks available for the next batch
+ * instead of returning them to the heap.
+ *
+ * The byte arrays copy() returns point into the arena, so they are only valid until reset()
+ * and have to be copied with QByteArray(data.constData(), data.size()) to be kept longer.
+ * The arena can be used from any thread.
+ *
+ * @code
+ * KIMAP2::ResultArena arena;
+ * for (const KIMAP2::ImapSet &batch : batches) {
+ *     KIMAP2::FetchJob *job = new KIMAP2::FetchJob(session);
+ *     job->setRawResults(true);
+ *     job->setResultArena(&arena);
+ *     ...
+ *     job->exec();
+ *     archive->write(results);
+ *     results.clear();
+ *     arena.reset();
+ * }
+ * @endcode
+ */
+class KIMAP2_EXPORT ResultArena
+{
+public:
+    /**
+     * Creates an arena that allocates blocks of @p blockSize bytes. Data larger than a block
+     * gets a block of its own, which reset() releases.
+     */
+    explicit ResultArena(int blockSize = 1024 * 1024);
+    ~ResultArena();
+
+    int blockSize() const;
+
+    /**
+     * Returns a copy of @p size bytes at @p data that lives in the arena. The copy is followed
+     * by a terminating '\0', like the data of any QByteArray.
+     */
+    QByteArray copy(const char *data, int size);
+    QByteArray copy(const QByteArray &data);
+
+    /**
+     * Returns true if @p data points into the arena.
+     */
+    bool contains(const char *data) const;
+
+    /**
+     * The bytes copied into the arena since the last reset().
+     */
+    qint64 size() const;
+
+    /**
+     * The bytes of all blocks the arena holds.
+     */
+    qint64 capacity() const;
+
+    /**
+     * Invalidates all copies, keeping the blocks of blockSize() for the next ones.
+     */
+    void reset();
+
+private:
+    Q_DISABLE_COPY(ResultArena)
+    ResultArenaPrivate *const d;
+};
+
+}
+
+#endif
@@ -37,11 +37,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <QtCore/QTextCodec>
 #include <QtCore/QBuffer>
 #include <QtCore/QByteArray>
 #include <QtCore/QLatin1Char>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
 #include <kcodecs.h>
 
 using namespace KIMAP2;
@@ -53,6 +56,25 @@ using namespace KIMAP2;
 static const unsigned char base64chars[] =
     "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+,";
 #define UNDEFINED 64
+/* the index of each character in base64chars, or UNDEFINED */
+static const unsigned char base64index[256] = {
+    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 62, 63, 64, 64, 64,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 64, 64, 64, 64, 64, 64,
+    64,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 64, 64, 64, 64, 64,
+    64, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 64, 64, 64, 64, 64,
+    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+    64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64
+};
 #define MAXLINE  76
 static const char especials[17] = "()<>@,;:\"/[]?.= ";
 
@@ -69,38 +91,39 @@ static const char especials[17] = "()<>@,;:\"/[]?.= ";
 //-----------------------------------------------------------------------------
 QByteArray KIMAP2::decodeImapFolderName(const QByteArray &inSrc)
 {
-    unsigned char c, i, bitcount;
+    unsigned char c, bitcount;
     unsigned long ucs4, utf16, bitbuf;
-    unsigned char base64[256], utf8[6];
-    unsigned int srcPtr = 0;
-    QByteArray dst;
-    QByteArray src = inSrc;
-    uint srcLen = inSrc.length();
 
-    /* initialize modified base64 decoding table */
-    memset(base64, UNDEFINED, sizeof(base64));
-    for (i = 0; i < sizeof(base64chars); ++i) {
-        base64[(int)base64chars[i]] = i;
+    /* everything but '&' is copied literally, so most names come back unchanged */
+    if (!inSrc.contains('&')) {
+        return inSrc;
     }
 
+    const unsigned char *src = reinterpret_cast<const unsigned char *>(inSrc.constData());
+    const unsigned char *const srcEnd = src + inSrc.size();
+    /* 16 bits take at least 8/3 base64 characters and at most 3 bytes of UTF-8 */
+    QByteArray dst;
+    dst.resize(inSrc.size() + inSrc.size() / 8 + 4);
+    char *dstPtr = dst.data();
+
     /* loop until end of string */
-    while (srcPtr < srcLen) {
-        c = src[srcPtr++];
+    while (src < srcEnd) {
+        c = *src++;
         /* deal with literal characters and &- */
-        if (c != '&' || src[srcPtr] == '-') {
+        if (c != '&' || (src < srcEnd && *src == '-')) {
             /* encode literally */
-            dst += c;
+            *dstPtr++ = c;
             /* skip over the '-' if this is an &- sequence */
             if (c == '&') {
-                srcPtr++;
+                src++;
             }
         } else {
             /* convert modified UTF-7 -> UTF-16 -> UCS-4 -> UTF-8 -> HEX */
             bitbuf = 0;
             bitcount = 0;
             ucs4 = 0;
-            while ((c = base64[(unsigned char)src[srcPtr]]) != UNDEFINED) {
-                ++srcPtr;
+            while (src < srcEnd && (c = base64index[*src]) != UNDEFINED) {
+                ++src;
                 bitbuf = (bitbuf << 6) | c;
                 bitcount += 6;
                 /* enough bits for a UTF-16 character? */
@@ -118,41 +141,37 @@ QByteArray KIMAP2::decodeImapFolderName(const QByteArray &inSrc)
                     }
                     /* convert UTF-16 range of UCS4 to UTF-8 */
                     if (ucs4 <= 0x7fUL) {
-                        utf8[0] = ucs4;
-                        i = 1;
+                        *dstPtr++ = ucs4;
                     } else if (ucs4 <= 0x7ffUL) {
-                        utf8[0] = 0xc0 | (ucs4 >> 6);
-                        utf8[1] = 0x80 | (ucs4 & 0x3f);
-                        i = 2;
+                        *dstPtr++ = 0xc0 | (ucs4 >> 6);
+                        *dstPtr++ = 0x80 | (ucs4 & 0x3f);
                     } else if (ucs4 <= 0xffffUL) {
-                        utf8[0] = 0xe0 | (ucs4 >> 12);
-                        utf8[1] = 0x80 | ((ucs4 >> 6) & 0x3f);
-                        utf8[2] = 0x80 | (ucs4 & 0x3f);
-                        i = 3;
+                        *dstPtr++ = 0xe0 | (ucs4 >> 12);
+                        *dstPtr++ = 0x80 | ((ucs4 >> 6) & 0x3f);
+                        *dstPtr++ = 0x80 | (ucs4 & 0x3f);
                     } else {
-                        utf8[0] = 0xf0 | (ucs4 >> 18);
-                        utf8[1] = 0x80 | ((ucs4 >> 12) & 0x3f);
-                        utf8[2] = 0x80 | ((ucs4 >> 6) & 0x3f);
-                        utf8[3] = 0x80 | (ucs4 & 0x3f);
-                        i = 4;
-                    }
-                    /* copy it */
-                    for (c = 0; c < i; ++c) {
-                        dst += utf8[c];
+                        *dstPtr++ = 0xf0 | (ucs4 >> 18);
+                        *dstPtr++ = 0x80 | ((ucs4 >> 12) & 0x3f);
+                        *dstPtr++ = 0x80 | ((ucs4 >> 6) & 0x3f);
+                        *dstPtr++ = 0x80 | (ucs4 & 0x3f);
                     }
                 }
             }
             /* skip over trailing '-' in modified UTF-7 encoding */
-            if (src[srcPtr] == '-') {
-                ++srcPtr;
+            if (src < srcEnd && *src == '-') {
+                ++src;
             }
         }
     }
+    dst.resize(dstPtr - dst.constData());
     return dst;
 }
 
 QString KIMAP2::decodeImapFolderName(const QString &inSrc)
 {
+    if (!inSrc.contains(QLatin1Char('&'))) {
+        return inSrc;
+    }
     return QString::fromUtf8(decodeImapFolderName(inSrc.toUtf8()).constData());
 }
 
@@ -189,8 +208,53 @@ QString KIMAP2::quoteIMAP(const QString &src)
 }
 
 //-----------------------------------------------------------------------------
+//@cond PRIVATE
+/* true if any byte of x is below n, for n up to 128 */
+#define HASLESS(x, n) (((x) - ~quint64(0) / 255 * (n)) & ~(x) & ~quint64(0) / 255 * 128)
+/* true if any byte of x is above n, for n up to 127 */
+#define HASMORE(x, n) ((((x) + ~quint64(0) / 255 * (127 - (n))) | (x)) & ~quint64(0) / 255 * 128)
+/* true if any byte of x is n */
+#define HASVALUE(x, n) HASLESS((x) ^ (~quint64(0) / 255 * (n)), 1)
+
+/* false if a character needs encoding or quoting, checking eight at a time */
+static bool encodesAsItself(const QByteArray &src)
+{
+    const char *ptr = src.constData();
+    const char *const end = ptr + src.size();
+    for (; end - ptr >= 8; ptr += 8) {
+        quint64 word;
+        memcpy(&word, ptr, sizeof(word));
+        if (HASLESS(word, ' ') || HASMORE(word, '~') ||
+                HASVALUE(word, '&') || HASVALUE(word, '"') || HASVALUE(word, '\\')) {
+            return false;
+        }
+    }
+    for (; ptr < end; ++ptr) {
+        const unsigned char c = *ptr;
+        if (c < ' ' || c > '~' || c == '&' || c == '"' || c == '\\') {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool encodesAsItself(const QString &src)
+{
+    for (const QChar c : src) {
+        const ushort u = c.unicode();
+        if (u < ' ' || u > '~' || u == '&' || u == '"' || u == '\\') {
+            return false;
+        }
+    }
+    return true;
+}
+//@endcond
+
 QString KIMAP2::encodeImapFolderName(const QString &inSrc)
 {
+    if (encodesAsItself(inSrc)) {
+        return inSrc;
+    }
     return QString::fromUtf8(encodeImapFolderName(inSrc.toUtf8()).constData());
 }
 
@@ -198,18 +262,24 @@ QByteArray KIMAP2::encodeImapFolderName(const QByteArray &inSrc)
 {
     unsigned int utf8pos, utf8total, c, utf7mode, bitstogo, utf16flag;
     unsigned int ucs4, bitbuf;
-    QByteArray src = inSrc;
+    if (encodesAsItself(inSrc)) {
+        return inSrc;
+    }
+
+    const unsigned char *src = reinterpret_cast<const unsigned char *>(inSrc.constData());
+    const unsigned char *const srcEnd = src + inSrc.size();
     QByteArray dst;
+    /* enough unless there are control characters, which take up to five */
+    dst.reserve(2 * inSrc.size() + 8);
 
-    int srcPtr = 0;
     utf7mode = 0;
     utf8total = 0;
     bitstogo = 0;
     utf8pos = 0;
     bitbuf = 0;
     ucs4 = 0;
-    while (srcPtr < src.length()) {
-        c = (unsigned char)src[srcPtr++];
+    while (src < srcEnd) {
+        c = *src++;
         /* normal character? */
         if (c >= ' ' && c <= '~') {
             /* switch out of UTF-7 mode */
@@ -221,6 +291,10 @@ QByteArray KIMAP2::encodeImapFolderName(const QByteArray &inSrc)
                 dst += '-';
                 utf7mode = 0;
             }
+            /* quote for IMAP, base64 never needs it */
+            if (c == '"' || c == '\\') {
+                dst += '\\';
+            }
             dst += c;
             /* encode '&' as '&-' */
             if (c == '&') {
@@ -287,60 +361,60 @@ QByteArray KIMAP2::encodeImapFolderName(const QByteArray &inSrc)
         }
         dst += '-';
     }
-    return quoteIMAP(dst);
+    return dst;
 }
 
 //-----------------------------------------------------------------------------
-QTextCodec *KIMAP2::codecForName(const QString &str)
+//@cond PRIVATE
+/* the codecs looked up so far, by the charset label as given */
+struct CodecCache {
+    QMutex mutex;
+    QHash<QByteArray, QTextCodec *> codecs;
+};
+Q_GLOBAL_STATIC(CodecCache, codecCache)
+
+static QTextCodec *cachedCodecForName(const QByteArray &name)
 {
-    if (str.isEmpty()) {
+    if (name.isEmpty()) {
         return Q_NULLPTR;
     }
-    return QTextCodec::codecForName(str.toLower().
-                                    replace(QStringLiteral("windows"), QStringLiteral("cp")).toLatin1());
-}
-
-//-----------------------------------------------------------------------------
-const QString KIMAP2::decodeRFC2047String(const QString &str)
-{
-    QString throw_away;
-
-    return decodeRFC2047String(str, throw_away);
-}
-
-//-----------------------------------------------------------------------------
-const QString KIMAP2::decodeRFC2047String(const QString &str,
-        QString &charset)
-{
-    QString throw_away;
-
-    return decodeRFC2047String(str, charset, throw_away);
+    CodecCache *cache = codecCache();
+    QMutexLocker locker(&cache->mutex);
+    const auto cached = cache->codecs.constFind(name);
+    if (cached != cache->codecs.constEnd()) {
+        return cached.value();
+    }
+    QTextCodec *codec = QTextCodec::codecForName(name.toLower().replace("windows", "cp"));
+    /* labels come from the messages, so don't let bogus ones grow it forever */
+    if (cache->codecs.size() < 256) {
+        cache->codecs.insert(name, codec);
+    }
+    return codec;
 }
 
-//-----------------------------------------------------------------------------
-const QString KIMAP2::decodeRFC2047String(const QString &str,
-        QString &charset,
-        QString &language)
+/* decodes the encoded words of str into the bytes of the last charset named */
+static QByteArray decodeRFC2047(const QByteArray &str, QByteArray &charset, QByteArray &language)
 {
-    //do we have a rfc string
-    if (!str.contains(QStringLiteral("=?"))) {
-        return str;
-    }
-
-    // FIXME get rid of the conversion?
-    QByteArray aStr = str.toLatin1();   // QString.length() means Unicode chars
     QByteArray result;
-    char *pos, *beg, *end, *mid = Q_NULLPTR;
+    result.reserve(str.size());
+    const char *pos, *beg, *end, *mid = Q_NULLPTR;
     QByteArray cstr;
-    char encoding = 0, ch;
+    char encoding = 0;
     bool valid;
     const int maxLen = 200;
     int i;
 
-//  result.truncate(aStr.length());
-    for (pos = aStr.data(); *pos; pos++) {
+    /* the data is zero terminated, which the parsing below relies on */
+    const char *const strEnd = str.constData() + str.size();
+    for (pos = str.constData(); pos < strEnd; pos++) {
         if (pos[0] != '=' || pos[1] != '?') {
-            result += *pos;
+            /* copy everything up to the next encoded word at once */
+            const char *next = pos + 1;
+            while (next < strEnd && (next[0] != '=' || next[1] != '?')) {
+                next++;
+            }
+            result.append(pos, next - pos);
+            pos = next - 1;
             continue;
         }
         beg = pos + 2;
@@ -356,25 +430,22 @@ const QString KIMAP2::decodeRFC2047String(const QString &str,
         if (*pos != '?' || i < 4 || i >= maxLen) {
             valid = false;
         } else {
-            charset = QLatin1String(QByteArray(beg, i - 1));    // -2 + 1 for the zero
-            int pt = charset.lastIndexOf(QLatin1Char('*'));
+            charset = QByteArray(beg, i - 2);
+            const int pt = charset.lastIndexOf('*');
             if (pt != -1) {
                 // save language for later usage
-                language = charset.right(charset.length() - pt - 1);
+                language = charset.mid(pt + 1);
 
                 // tie off language as defined in rfc2047
                 charset.truncate(pt);
             }
             // get encoding and check delimiting question marks
             encoding = toupper(pos[1]);
-            if (pos[2] != '?' ||
-                    (encoding != 'Q' && encoding != 'B' &&
-                     encoding != 'q' && encoding != 'b')) {
+            if ((encoding != 'Q' && encoding != 'B') || pos[2] != '?') {
                 valid = false;
             }
             pos += 3;
             i += 3;
-//  qCDebug(KIMAP2_LOG) << "Charset:" << charset << "- Language:" << language << "-'" << pos << "'";
         }
         if (valid) {
             mid = pos;
@@ -389,49 +460,76 @@ const QString KIMAP2::decodeRFC2047String(const QString &str,
             }
         }
         if (valid) {
-            ch = *pos;
-            *pos = '\0';
-            cstr = QByteArray(mid).left((int)(mid - pos - 1));
+            cstr = QByteArray(mid, pos - mid);
             if (encoding == 'Q') {
                 // decode quoted printable text
-                for (i = cstr.length() - 1; i >= 0; --i) {
-                    if (cstr[i] == '_') {
-                        cstr[i] = ' ';
-                    }
-                }
-//    qCDebug(KIMAP2_LOG) << "before QP '"
-//    << cstr << "'";
+                cstr.replace('_', ' ');
                 cstr = KCodecs::quotedPrintableDecode(cstr);
-//    qCDebug(KIMAP2_LOG) << "after QP '"
-//    << cstr << "'";
             } else {
                 // decode base64 text
                 cstr = QByteArray::fromBase64(cstr);
             }
-            *pos = ch;
-            int len = cstr.length();
-            for (i = 0; i < len; ++i) {
-                result += cstr[i];
-            }
+            result += cstr;
 
             pos = end - 1;
         } else {
-//    qCDebug(KIMAP2_LOG) << "invalid";
-            //result += "=?";
-            //pos = beg -1; // because pos gets increased shortly afterwards
             pos = beg - 2;
             result += *pos++;
             result += *pos;
         }
     }
-    if (!charset.isEmpty()) {
-        QTextCodec *aCodec = codecForName(QLatin1String(charset.toLatin1()));
-        if (aCodec) {
-//    qCDebug(KIMAP2_LOG) << "Codec is" << aCodec->name();
-            return aCodec->toUnicode(result);
-        }
+    return result;
+}
+//@endcond
+
+QTextCodec *KIMAP2::codecForName(const QString &str)
+{
+    return cachedCodecForName(str.toLatin1());
+}
+
+//-----------------------------------------------------------------------------
+const QString KIMAP2::decodeRFC2047String(const QString &str)
+{
+    QString throw_away;
+
+    return decodeRFC2047String(str, throw_away);
+}
+
+//-----------------------------------------------------------------------------
+const QString KIMAP2::decodeRFC2047String(const QString &str,
+        QString &charset)
+{
+    QString throw_away;
+
+    return decodeRFC2047String(str, charset, throw_away);
+}
+
+//-----------------------------------------------------------------------------
+const QString KIMAP2::decodeRFC2047String(const QString &str,
+        QString &charset,
+        QString &language)
+{
+    //do we have a rfc string
+    if (!str.contains(QLatin1String("=?"))) {
+        return str;
     }
-    return QLatin1String(result);
+
+    QByteArray charsetName;
+    QByteArray languageName;
+    const QByteArray result = decodeRFC2047(str.toLatin1(), charsetName, languageName);
+    if (charsetName.isNull()) {
+        charsetName = charset.toLatin1();
+    } else {
+        charset = QString::fromLatin1(charsetName);
+    }
+    if (!languageName.isNull()) {
+        language = QString::fromLatin1(languageName);
+    }
+    QTextCodec *aCodec = cachedCodecForName(charsetName);
+    if (aCodec) {
+        return aCodec->toUnicode(result);
+    }
+    return QString::fromLatin1(result);
 }
 
 //-----------------------------------------------------------------------------
@@ -655,3 +753,130 @@ const QString KIMAP2::decodeRFC2231String(const QString &str)
     }
     return st;
 }
+
+//@cond PRIVATE
+static bool readDigits(const char *&p, const char *end, int count, int *value)
+{
+    *value = 0;
+    for (int i = 0; i < count; ++i, ++p) {
+        if (p == end || *p < '0' || *p > '9') {
+            return false;
+        }
+        *value = *value * 10 + (*p - '0');
+    }
+    return true;
+}
+
+static int monthOf(const char *p)
+{
+    static const char months[] = "janfebmaraprmayjunjulaugsepoctnovdec";
+    const char name[3] = { char(p[0] | 0x20), char(p[1] | 0x20), char(p[2] | 0x20) };
+    for (int i = 0; i < 12; ++i) {
+        if (qstrncmp(name, months + 3 * i, 3) == 0) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+// Days since 1970-01-01 of a date in the proleptic Gregorian calendar
+static qint64 daysFromCivil(int year, int month, int day)
+{
+    year -= month <= 2;
+    const qint64 era = (year >= 0 ? year : year - 399) / 400;
+    const int yearOfEra = year - era * 400;
+    const int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    const int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
+}
+//@endcond
+
+//@cond PRIVATE
+/*
+ * Finds the next CRLF with memchr, which the C library vectorizes, so the runs between line
+ * endings are scanned many bytes at a time.
+ */
+static const char *findCrlf(const char *pos, const char *end)
+{
+    while (pos < end) {
+        const char *cr = static_cast<const char *>(memchr(pos, '\r', end - pos));
+        if (!cr || cr + 1 == end) {
+            return Q_NULLPTR;
+        }
+        if (cr[1] == '\n') {
+            return cr;
+        }
+        pos = cr + 1;
+    }
+    return Q_NULLPTR;
+}
+//@endcond
+
+QByteArray KIMAP2::crlfToLf(const QByteArray &src)
+{
+    const char *in = src.constData();
+    const char *const end = in + src.size();
+    const char *cr = findCrlf(in, end);
+    if (!cr) {
+        return src;
+    }
+
+    QByteArray result;
+    result.resize(src.size());
+    char *out = result.data();
+    while (cr) {
+        memcpy(out, in, cr - in);
+        out += cr - in;
+        //The LF starts the next run
+        in = cr + 1;
+        cr = findCrlf(in + 1, end);
+    }
+    memcpy(out, in, end - in);
+    out += end - in;
+    result.resize(out - result.constData());
+    return result;
+}
+
+qint64 KIMAP2::parseImapDateTime(const QByteArray &dateTime, bool *ok)
+{
+    if (ok) {
+        *ok = false;
+    }
+    const char *p = dateTime.constData();
+    const char *end = p + dateTime.size();
+    if (p != end && *p == ' ') {
+        ++p;
+    }
+    int day;
+    if (!readDigits(p, end, 1, &day)) {
+        return 0;
+    }
+    if (p != end && *p >= '0' && *p <= '9') {
+        day = day * 10 + (*p++ - '0');
+    }
+    // "-Mon-yyyy hh:mm:ss +zzzz"
+    if (end - p != 24 || p[0] != '-' || p[4] != '-' || p[9] != ' ' || p[12] != ':' || p[15] != ':' || p[18] != ' ' ||
+            (p[19] != '+' && p[19] != '-')) {
+        return 0;
+    }
+    const int month = monthOf(p + 1);
+    p += 5;
+    int year, hour, minute, second, zoneHours, zoneMinutes;
+    if (!readDigits(p, end, 4, &year) || !readDigits(++p, end, 2, &hour) || !readDigits(++p, end, 2, &minute) ||
+            !readDigits(++p, end, 2, &second)) {
+        return 0;
+    }
+    p += 1;
+    const int zoneSign = *p++ == '-' ? -1 : 1;
+    if (!readDigits(p, end, 2, &zoneHours) || !readDigits(p, end, 2, &zoneMinutes)) {
+        return 0;
+    }
+    if (month == 0 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60 || zoneMinutes > 59) {
+        return 0;
+    }
+    if (ok) {
+        *ok = true;
+    }
+    const qint64 local = daysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+    return local - zoneSign * (zoneHours * 3600 + zoneMinutes * 60);
+}
@@ -135,6 +135,22 @@ KIMAP2_EXPORT const QString encodeRFC2231String(const QString &str);
   @param str is the QString to decode.
 */
 KIMAP2_EXPORT const QString decodeRFC2231String(const QString &str);
+
+/**
+  Parses an IMAP date-time like "17-Jul-1996 02:44:25 -0700", e.g. from INTERNALDATE.
+  The day may be padded with a space or have a single digit.
+  @param dateTime is the date-time, without the surrounding quotes.
+  @param ok is set to whether @p dateTime was well-formed, if given.
+  @return the time in seconds since the epoch (UTC), or 0 if @p dateTime is malformed.
+*/
+KIMAP2_EXPORT qint64 parseImapDateTime(const QByteArray &dateTime, bool *ok = Q_NULLPTR);
+
+/**
+  Replaces the CRLF line endings of @p src with LF, as KMime expects them.
+  A lone CR is kept. Data without CRLF is returned as it is, without a copy.
+  @param src is the data, e.g. a message as the server sent it.
+*/
+KIMAP2_EXPORT QByteArray crlfToLf(const QByteArray &src);
 }
 
 #endif
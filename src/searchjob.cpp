@@ -23,28 +23,51 @@
 
 #include <QtCore/QDate>
 
+#include <algorithm>
+
 #include "job_p.h"
 #include "message_p.h"
 #include "session_p.h"
+#include "flagssnapshot.h"
 #include "imapset.h"
+#include "rfccodecs.h"
 
 namespace KIMAP2
 {
 
-class Term::Private
+class Term::Private : public QSharedData
 {
 public:
     Private(): isFuzzy(false), isNegated(false), isNull(false) {}
+
+    void updateSerialized()
+    {
+        if (isNegated) {
+            serialized = "NOT " + command;
+        } else if (isFuzzy) {
+            serialized = "FUZZY " + command;
+        } else {
+            serialized = command;
+        }
+    }
+
     QByteArray command;
+    // What serialize() returns, kept up to date so nested terms and searches only share it
+    QByteArray serialized;
     bool isFuzzy;
     bool isNegated;
     bool isNull;
 };
 
 Term::Term()
-    :  d(new Term::Private)
 {
-    d->isNull = true;
+    // Shared by all null terms, e.g. the one of every SearchJob
+    static const QSharedDataPointer<Term::Private> null([]() {
+        Term::Private *p = new Term::Private;
+        p->isNull = true;
+        return p;
+    }());
+    d = null;
 }
 
 Term::Term(Term::Relation relation, const QVector<Term> &subterms)
@@ -74,6 +97,7 @@ Term::Term(Term::Relation relation, const QVector<Term> &subterms)
     } else {
         d->isNull = true;
     }
+    d->updateSerialized();
 }
 
 Term::Term(Term::SearchKey key, const QString &value)
@@ -107,10 +131,18 @@ Term::Term(Term::SearchKey key, const QString &value)
     case To:
         d->command += "TO";
         break;
+    case GmailRaw:
+    case GmailLabel:
+        //Gmail queries and labels commonly contain quotes themselves
+        d->command += key == GmailRaw ? "X-GM-RAW" : "X-GM-LABELS";
+        d->command += " \"" + quoteIMAP(value.toUtf8()) + "\"";
+        d->updateSerialized();
+        return;
     }
     if (key != All) {
         d->command += " \"" + QByteArray(value.toUtf8().constData()) + "\"";
     }
+    d->updateSerialized();
 }
 
 Term::Term(const QString &header, const QString &value)
@@ -119,6 +151,7 @@ Term::Term(const QString &header, const QString &value)
     d->command += "HEADER";
     d->command += ' ' + QByteArray(header.toUtf8().constData());
     d->command += " \"" + QByteArray(value.toUtf8().constData()) + "\"";
+    d->updateSerialized();
 }
 
 Term::Term(Term::BooleanSearchKey key)
@@ -150,12 +183,14 @@ Term::Term(Term::BooleanSearchKey key)
         d->command = "SEEN";
         break;
     }
+    d->updateSerialized();
 }
 
-static QByteArray monthName(int month)
+static const char *monthName(int month)
 {
-    static const char* names[12] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
-    return (month >= 1 && month <= 12) ? QByteArray(names[month - 1]) : QByteArray();
+    //don't use QDate::shortMonthName(), it returns a localized month name
+    static const char *const names[12] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    return (month >= 1 && month <= 12) ? names[month - 1] : "";
 }
 
 Term::Term(Term::DateSearchKey key, const QDate &date)
@@ -183,9 +218,11 @@ Term::Term(Term::DateSearchKey key, const QDate &date)
     }
     d->command += " \"";
     d->command += QByteArray::number(date.day()) + '-';
-    d->command += monthName(date.month()) + '-';
+    d->command += monthName(date.month());
+    d->command += '-';
     d->command += QByteArray::number(date.year());
     d->command += '\"';
+    d->updateSerialized();
 }
 
 Term::Term(Term::NumberSearchKey key, int value)
@@ -200,6 +237,7 @@ Term::Term(Term::NumberSearchKey key, int value)
         break;
     }
     d->command += " " + QByteArray::number(value);
+    d->updateSerialized();
 }
 
 Term::Term(Term::SequenceSearchKey key, const ImapSet &set)
@@ -215,17 +253,36 @@ Term::Term(Term::SequenceSearchKey key, const ImapSet &set)
     auto optimizedSet = set;
     optimizedSet.optimize();
     d->command += " " + optimizedSet.toImapSequenceSet();
+    d->updateSerialized();
 }
 
-Term::Term(const Term &other)
+Term::Term(Term::GmailIdSearchKey key, qint64 id)
     :  d(new Term::Private)
 {
-    *d = *other.d;
+    switch (key) {
+    case GmailMessageId:
+        d->command = "X-GM-MSGID";
+        break;
+    case GmailThreadId:
+        d->command = "X-GM-THRID";
+        break;
+    }
+    d->command += " " + QByteArray::number(id);
+    d->updateSerialized();
+}
+
+Term::Term(const Term &other)
+    :  d(other.d)
+{
+}
+
+Term::~Term()
+{
 }
 
 Term &Term::operator=(const Term &other)
 {
-    *d = *other.d;
+    d = other.d;
     return *this;
 }
 
@@ -238,25 +295,24 @@ bool Term::operator==(const Term &other) const
 
 QByteArray Term::serialize() const
 {
-    QByteArray command;
-    if (d->isFuzzy) {
-        command = "FUZZY ";
-    }
-    if (d->isNegated) {
-        command = "NOT ";
-    }
-    return command + d->command;
+    return d->serialized;
 }
 
 Term &Term::setFuzzy(bool fuzzy)
 {
-    d->isFuzzy = fuzzy;
+    if (d.constData()->isFuzzy != fuzzy) {
+        d->isFuzzy = fuzzy;
+        d->updateSerialized();
+    }
     return *this;
 }
 
 Term &Term::setNegated(bool negated)
 {
-    d->isNegated = negated;
+    if (d.constData()->isNegated != negated) {
+        d->isNegated = negated;
+        d->updateSerialized();
+    }
     return *this;
 }
 
@@ -272,70 +328,179 @@ class SearchJobPrivate : public JobPrivate
 public:
     SearchJobPrivate(Session *session, const QString &name) : JobPrivate(session, name), logic(SearchJob::And)
     {
-        criteriaMap[SearchJob::All]  = "ALL";
-        criteriaMap[SearchJob::Answered] = "ANSWERED";
-        criteriaMap[SearchJob::BCC] = "BCC";
-        criteriaMap[SearchJob::Before] = "BEFORE";
-        criteriaMap[SearchJob::Body] = "BODY";
-        criteriaMap[SearchJob::CC] = "CC";
-        criteriaMap[SearchJob::Deleted] = "DELETED";
-        criteriaMap[SearchJob::Draft] = "DRAFT";
-        criteriaMap[SearchJob::Flagged] = "FLAGGED";
-        criteriaMap[SearchJob::From] = "FROM";
-        criteriaMap[SearchJob::Header] = "HEADER";
-        criteriaMap[SearchJob::Keyword] = "KEYWORD";
-        criteriaMap[SearchJob::Larger] = "LARGER";
-        criteriaMap[SearchJob::New] = "NEW";
-        criteriaMap[SearchJob::Old] = "OLD";
-        criteriaMap[SearchJob::On] = "ON";
-        criteriaMap[SearchJob::Recent] = "RECENT";
-        criteriaMap[SearchJob::Seen] = "SEEN";
-        criteriaMap[SearchJob::SentBefore] = "SENTBEFORE";
-        criteriaMap[SearchJob::SentOn] = "SENTON";
-        criteriaMap[SearchJob::SentSince] = "SENTSINCE";
-        criteriaMap[SearchJob::Since] = "SINCE";
-        criteriaMap[SearchJob::Smaller] = "SMALLER";
-        criteriaMap[SearchJob::Subject] = "SUBJECT";
-        criteriaMap[SearchJob::Text] = "TEXT";
-        criteriaMap[SearchJob::To] = "TO";
-        criteriaMap[SearchJob::Uid] = "UID";
-        criteriaMap[SearchJob::Unanswered] = "UNANSWERED";
-        criteriaMap[SearchJob::Undeleted] = "UNDELETED";
-        criteriaMap[SearchJob::Undraft] = "UNDRAFT";
-        criteriaMap[SearchJob::Unflagged] = "UNFLAGGED";
-        criteriaMap[SearchJob::Unkeyword] = "UNKEYWORD";
-        criteriaMap[SearchJob::Unseen] = "UNSEEN";
-
-        //don't use QDate::shortMonthName(), it returns a localized month name
-        months[1] = "Jan";
-        months[2] = "Feb";
-        months[3] = "Mar";
-        months[4] = "Apr";
-        months[5] = "May";
-        months[6] = "Jun";
-        months[7] = "Jul";
-        months[8] = "Aug";
-        months[9] = "Sep";
-        months[10] = "Oct";
-        months[11] = "Nov";
-        months[12] = "Dec";
-
         nextContent = 0;
         uidBased = false;
+        incremental = false;
+        chunkSize = 0;
+        esearch = false;
+        minimum = 0;
+        maximum = 0;
+        count = 0;
+        partialFirst = 0;
+        partialLast = 0;
+        partialSent = false;
+        hasSnapshot = false;
+        answeredLocally = false;
+        replay = [this]() {
+            runs = RunList();
+            chunk = RunList();
+            nextContent = 0;
+            esearch = false;
+            minimum = 0;
+            maximum = 0;
+            count = 0;
+            all = ImapSet();
+        };
     }
     ~SearchJobPrivate() { }
 
     QByteArray charset;
     QList<QByteArray> criterias;
-    QMap<SearchJob::SearchCriteria, QByteArray > criteriaMap;
-    QMap<int, QByteArray> months;
     SearchJob::SearchLogic logic;
     QList<QByteArray> contents;
-    QVector<qint64> results;
+    void addResult(qint64 value);
+    void flushChunk();
+    QVector<qint64> partialWindow(QVector<qint64> values) const;
+
+    struct Run {
+        qint64 begin;
+        qint64 end;
+    };
+    // Numbers in the order they were sent, with consecutive numbers merged
+    struct RunList {
+        RunList() : ascending(true), count(0) { }
+
+        void add(qint64 value);
+        ImapSet toSet() const;
+        QVector<qint64> toVector() const;
+
+        QVector<Run> runs;
+        // Whether the runs are increasing and disjoint, so they already form the set
+        bool ascending;
+        qint64 count;
+    };
+
+    // The results of the SEARCH responses
+    RunList runs;
+    bool incremental;
+    int chunkSize;
+    // The results not delivered yet in incremental mode
+    RunList chunk;
     uint nextContent;
     bool uidBased;
     Term term;
+    SearchJob::ReturnOptions returnOptions;
+    // Whether the results came with ESEARCH, then only the fields below are set
+    bool esearch;
+    qint64 minimum;
+    qint64 maximum;
+    qint64 count;
+    // Also the window of PARTIAL
+    ImapSet all;
+    qint64 partialFirst;
+    qint64 partialLast;
+    // Whether the server cuts the window, otherwise ALL is requested and it is cut locally
+    bool partialSent;
+    // See SearchJob::setFlagsSnapshot()
+    FlagsSnapshot snapshot;
+    bool hasSnapshot;
+    bool answeredLocally;
 };
+
+void SearchJobPrivate::RunList::add(qint64 value)
+{
+    ++count;
+    if (!runs.isEmpty()) {
+        Run &last = runs.last();
+        if (value == last.end + 1) {
+            last.end = value;
+            return;
+        }
+        ascending = ascending && value > last.end + 1;
+    }
+    const Run run = { value, value };
+    runs.append(run);
+}
+
+ImapSet SearchJobPrivate::RunList::toSet() const
+{
+    ImapSet set;
+    if (!ascending) {
+        set.add(toVector());
+        return set;
+    }
+    foreach (const Run &run, runs) {
+        set.add(ImapInterval(run.begin, run.end));
+    }
+    return set;
+}
+
+QVector<qint64> SearchJobPrivate::RunList::toVector() const
+{
+    QVector<qint64> values;
+    values.reserve(count);
+    foreach (const Run &run, runs) {
+        for (qint64 value = run.begin; value <= run.end; ++value) {
+            values.append(value);
+        }
+    }
+    return values;
+}
+
+void SearchJobPrivate::addResult(qint64 value)
+{
+    if (count == 0) {
+        minimum = value;
+        maximum = value;
+    } else {
+        minimum = qMin(minimum, value);
+        maximum = qMax(maximum, value);
+    }
+    ++count;
+    if (!incremental) {
+        runs.add(value);
+        return;
+    }
+    chunk.add(value);
+    if (chunk.count >= chunkSize) {
+        flushChunk();
+    }
+}
+
+/**
+ * Cuts the window of setPartial() out of @p values, for servers that returned all results.
+ */
+QVector<qint64> SearchJobPrivate::partialWindow(QVector<qint64> values) const
+{
+    if (!partialFirst) {
+        return values;
+    }
+    if (!runs.ascending) {
+        std::sort(values.begin(), values.end());
+    }
+    //Negative positions count from the end, -1 being the last
+    qint64 from = partialFirst > 0 ? partialFirst - 1 : values.size() + partialFirst;
+    qint64 to = partialLast > 0 ? partialLast - 1 : values.size() + partialLast;
+    if (from > to) {
+        qSwap(from, to);
+    }
+    from = qMax(qint64(0), from);
+    to = qMin(qint64(values.size()) - 1, to);
+    if (from > to) {
+        return QVector<qint64>();
+    }
+    return values.mid(from, to - from + 1);
+}
+
+void SearchJobPrivate::flushChunk()
+{
+    if (chunk.count == 0) {
+        return;
+    }
+    const ImapSet set = chunk.toSet();
+    chunk = RunList();
+    emit static_cast<SearchJob *>(q_ptr)->resultsReceived(set);
+}
 }
 
 using namespace KIMAP2;
@@ -355,14 +520,91 @@ void SearchJob::setTerm(const Term &term)
     d->term = term;
 }
 
+void SearchJob::setFlagsSnapshot(const FlagsSnapshot &snapshot)
+{
+    Q_D(SearchJob);
+    d->snapshot = snapshot;
+    d->hasSnapshot = true;
+}
+
+bool SearchJob::isAnsweredLocally() const
+{
+    Q_D(const SearchJob);
+    return d->answeredLocally;
+}
+
 void SearchJob::doStart()
 {
     Q_D(SearchJob);
 
     QByteArray searchKey;
 
+    if (!d->uidBased && d->sessionInternal()->isExtensionEnabled("UIDONLY")) {
+        qCWarning(KIMAP2_LOG) << "Searching for sequence numbers isn't possible with UIDONLY";
+        setError(KJob::UserDefinedError);
+        setErrorText(QStringLiteral("Sequence numbers are not available once UIDONLY is enabled"));
+        emitResult();
+        return;
+    }
+
+    const QStringList capabilities = d->m_session->capabilities();
+    const bool searchRes = d->sessionInternal()->hasCapability("SEARCHRES");
+    if ((d->returnOptions & ReturnSave) && !searchRes) {
+        qCWarning(KIMAP2_LOG) << "The server can't save search results";
+        setError(KJob::UserDefinedError);
+        setErrorText(QStringLiteral("The server doesn't support SEARCHRES"));
+        emitResult();
+        return;
+    }
+
+    if (d->hasSnapshot && d->uidBased && !(d->returnOptions & ReturnSave)) {
+        bool ok = false;
+        const ImapSet matches = d->snapshot.search(d->term, &ok);
+        if (ok) {
+            d->answeredLocally = true;
+            foreach (const ImapSet::Range &range, matches.ranges()) {
+                for (qint64 value = range.begin; value <= range.end; ++value) {
+                    d->addResult(value);
+                }
+            }
+            d->flushChunk();
+            emitResult();
+            return;
+        }
+    }
+
+    //RFC 5267 only knows positions from the start, RFC 9394 also from the end
+    const bool partial = d->partialFirst && (capabilities.contains(QStringLiteral("PARTIAL"), Qt::CaseInsensitive)
+                         || (d->partialFirst > 0 && d->partialLast > 0
+                             && capabilities.contains(QStringLiteral("CONTEXT=SEARCH"), Qt::CaseInsensitive)));
+    d->partialSent = partial;
+    d->esearch = partial || (d->returnOptions && (searchRes || d->sessionInternal()->hasCapability("ESEARCH")));
+    if (d->esearch) {
+        QList<QByteArray> options;
+        if (partial) {
+            options << "PARTIAL " + QByteArray::number(d->partialFirst) + ':' + QByteArray::number(d->partialLast);
+        }
+        if (d->returnOptions & ReturnMin) {
+            options << "MIN";
+        }
+        if (d->returnOptions & ReturnMax) {
+            options << "MAX";
+        }
+        if (d->returnOptions & ReturnCount) {
+            options << "COUNT";
+        }
+        //PARTIAL takes the place of ALL, without it the window is cut from ALL
+        if (((d->returnOptions & ReturnAll) || d->partialFirst) && !partial) {
+            options << "ALL";
+        }
+        if (d->returnOptions & ReturnSave) {
+            options << "SAVE";
+        }
+        searchKey = "RETURN (" + options.join(' ') + ") ";
+    }
+
     if (!d->charset.isEmpty()) {
-        searchKey = "CHARSET " + d->charset;
+        searchKey += "CHARSET " + d->charset;
     }
 
     if (!d->term.isNull()) {
@@ -421,7 +663,51 @@ void SearchJob::handleResponse(const Message &response)
             d->nextContent++;
         } else if (response.content.size() >= 2 && response.content[1].toString() == "SEARCH") {
             for (int i = 2; i < response.content.size(); i++) {
-                d->results.append(response.content[i].toString().toInt());
+                d->addResult(response.content[i].toString().toLongLong());
+            }
+            d->flushChunk();
+        } else if (response.content.size() >= 2 && response.content[1].keyword() == ImapKeyword::ESearch) {
+            // * ESEARCH (TAG "A000001") UID MIN 2 COUNT 3 ALL 2,10:11
+            for (int i = 2; i < response.content.size(); i++) {
+                const Message::Part &part = response.content[i];
+                if (part.type() == Message::Part::List) {
+                    const QList<QByteArray> correlator = part.toList();
+                    if (correlator.size() == 2 && correlator[0].toUpper() == "TAG" && !d->tags.contains(correlator[1])) {
+                        return;
+                    }
+                    continue;
+                }
+                const QByteArray name = part.toString().toUpper();
+                if (name == "UID" || i + 1 >= response.content.size()) {
+                    continue;
+                }
+                if (name == "PARTIAL") {
+                    // PARTIAL (1:100 4200:4270,4302), or NIL instead of the set if nothing is in the window
+                    const QList<QByteArray> window = response.content[++i].toList();
+                    if (window.size() == 2 && window[1].toUpper() != "NIL") {
+                        d->all = ImapSet::fromImapSequenceSet(window[1]);
+                    }
+                    continue;
+                }
+                const QByteArray value = response.content[++i].toString();
+                if (name == "MIN") {
+                    d->minimum = value.toLongLong();
+                } else if (name == "MAX") {
+                    d->maximum = value.toLongLong();
+                } else if (name == "COUNT") {
+                    d->count = value.toLongLong();
+                } else if (name == "ALL") {
+                    d->all = ImapSet::fromImapSequenceSet(value);
+                    if (!d->esearch) {
+                        //IMAP4rev2 answers every SEARCH with ESEARCH, the matches come as ranges
+                        foreach (const ImapSet::Range &range, d->all.ranges()) {
+                            for (qint64 match = range.begin; match <= range.end; ++match) {
+                                d->addResult(match);
+                            }
+                        }
+                        d->flushChunk();
+                    }
+                }
             }
         }
     }
@@ -454,5 +740,94 @@ bool SearchJob::isUidBased() const
 QVector<qint64> SearchJob::results() const
 {
     Q_D(const SearchJob);
-    return d->results;
+    return d->partialWindow(d->runs.toVector());
+}
+
+void SearchJob::setReturnOptions(ReturnOptions options)
+{
+    Q_D(SearchJob);
+    d->returnOptions = options;
+}
+
+SearchJob::ReturnOptions SearchJob::returnOptions() const
+{
+    Q_D(const SearchJob);
+    return d->returnOptions;
+}
+
+qint64 SearchJob::minimumResult() const
+{
+    Q_D(const SearchJob);
+    return d->minimum;
+}
+
+qint64 SearchJob::maximumResult() const
+{
+    Q_D(const SearchJob);
+    return d->maximum;
+}
+
+qint64 SearchJob::resultCount() const
+{
+    Q_D(const SearchJob);
+    return d->count;
+}
+
+ImapSet SearchJob::resultSet() const
+{
+    Q_D(const SearchJob);
+    if (d->esearch && (d->partialSent || !d->partialFirst)) {
+        return d->all;
+    }
+    if (d->esearch) {
+        QVector<qint64> all;
+        foreach (const ImapSet::Range &range, d->all.ranges()) {
+            for (qint64 value = range.begin; value <= range.end; ++value) {
+                all << value;
+            }
+        }
+        //The positions of the window are those in the sorted results
+        std::sort(all.begin(), all.end());
+        ImapSet set;
+        set.add(d->partialWindow(all));
+        return set;
+    }
+    if (d->partialFirst) {
+        ImapSet set;
+        set.add(d->partialWindow(d->runs.toVector()));
+        return set;
+    }
+    return d->runs.toSet();
+}
+
+void SearchJob::setPartial(qint64 first, qint64 last)
+{
+    Q_D(SearchJob);
+    d->partialFirst = first;
+    d->partialLast = last;
+}
+
+void SearchJob::setIncrementalDelivery(bool incremental, int chunkSize)
+{
+    Q_D(SearchJob);
+    d->incremental = incremental;
+    d->chunkSize = qMax(1, chunkSize);
+    if (!incremental) {
+        d->listObserver = ImapStreamParser::ListObserver();
+        return;
+    }
+    d->listObserver.string = [d](const Message &message, const QByteArray &string) {
+        // The numbers of "* SEARCH 1 2 3" are taken while the line arrives, instead of being kept in it
+        if (message.content.size() != 2 || message.content[1].keyword() != ImapKeyword::Search
+                || message.content[0].toString() != "*") {
+            return false;
+        }
+        bool ok;
+        const qint64 value = string.toLongLong(&ok);
+        if (!ok) {
+            return false;
+        }
+        d->addResult(value);
+        return true;
+    };
 }
@@ -24,7 +24,8 @@
 #include "kimap2_export.h"
 
 #include "job.h"
-#include <QSharedPointer>
+#include "imapset.h"
+#include <QSharedDataPointer>
 
 class QDate;
 
@@ -32,6 +33,7 @@ namespace KIMAP2
 {
 
 class ImapSet;
+class FlagsSnapshot;
 
 class Session;
 struct Message;
@@ -59,7 +61,13 @@ public:
         Subject,
         Text,
         To,
-        Keyword
+        Keyword,
+        /**
+         * A query in Gmail's own search syntax, such as "has:attachment in:anywhere".
+         * Only supported by Gmail, like the other X-GM keys.
+         */
+        GmailRaw,
+        GmailLabel
     };
 
     enum BooleanSearchKey {
@@ -89,15 +97,20 @@ public:
         Uid,
         SequenceNumber
     };
+    enum GmailIdSearchKey {
+        GmailMessageId,
+        GmailThreadId
+    };
 
     Term();
-    ~Term() = default; // silence clazy rule of three warning
+    ~Term();
     Term(Relation relation, const QVector<Term> &subterms);
     Term(SearchKey key, const QString &value);
     Term(BooleanSearchKey key);
     Term(DateSearchKey key, const QDate &date);
     Term(NumberSearchKey key, int value);
     Term(SequenceSearchKey key, const KIMAP2::ImapSet &);
+    Term(GmailIdSearchKey key, qint64 id);
     Term(const QString &header, const QString &value);
 
     Term(const Term &other);
@@ -114,7 +127,7 @@ public:
 
 private:
     class Private;
-    QSharedPointer<Private> d;
+    QSharedDataPointer<Private> d;
 };
 
 class KIMAP2_EXPORT SearchJob : public Job
@@ -167,9 +180,26 @@ public:
         Unseen
     };
 
+    /**
+     * The results to return instead of the list of matches, see setReturnOptions().
+     */
+    enum ReturnOption {
+        ReturnMin = 0x1,    /**< The lowest match, see minimumResult() */
+        ReturnMax = 0x2,    /**< The highest match, see maximumResult() */
+        ReturnCount = 0x4,  /**< The number of matches, see resultCount() */
+        ReturnAll = 0x8,    /**< All matches as a sequence set, see resultSet() */
+        ReturnSave = 0x10   /**< Keeps the matches on the server for ImapSet::savedSearchResult() (RFC 5182).
+                                 The server must have the SEARCHRES capability, otherwise the job fails. */
+    };
+    Q_DECLARE_FLAGS(ReturnOptions, ReturnOption)
+
     explicit SearchJob(Session *session);
     virtual ~SearchJob();
 
+    /**
+     * Sets whether the job searches for UIDs, or for sequence numbers, the default.
+     * Once UIDONLY (RFC 9586) is enabled, only searching for UIDs is possible.
+     */
     void setUidBased(bool uidBased);
     bool isUidBased() const;
 
@@ -183,6 +213,65 @@ public:
      */
     QVector<qint64> results() const;
 
+    /**
+     * Asks the server to only return the @p options instead of every match, with
+     * ESEARCH (RFC 4731), e.g. only ReturnCount if just the number is needed.
+     *
+     * Matches returned with ReturnAll come as a compact set, so results() stays empty
+     * and resultSet() has to be used. Without the ESEARCH capability the normal search
+     * is used, and the values below are computed while reading its results.
+     *
+     * With ReturnSave the matches can be used by the next commands as ImapSet::savedSearchResult(),
+     * e.g. for a StoreJob, without sending them to the client and back. If it is the only
+     * option the server returns nothing else.
+     *
+     * Default is no options, the normal search.
+     */
+    void setReturnOptions(ReturnOptions options);
+    ReturnOptions returnOptions() const;
+
+    /**
+     * The lowest and highest match, or 0 if nothing matched.
+     */
+    qint64 minimumResult() const;
+    qint64 maximumResult() const;
+    /**
+     * The number of matches.
+     */
+    qint64 resultCount() const;
+    /**
+     * All matches.
+     *
+     * The results of a normal search are kept as ranges of consecutive numbers while
+     * they are read, so this is cheaper than results() to pass on to e.g.
+     * FetchJob::setSequenceSet(), and needs no sorting if the server sent them in order.
+     */
+    ImapSet resultSet() const;
+
+    /**
+     * Only returns the matches from position @p first to @p last, counting from 1 in
+     * ascending order, e.g. 1 and 100 for the lowest ones, or -1 and -100 for the highest
+     * with RFC 9394 (PARTIAL).
+     *
+     * The window is requested with RETURN (PARTIAL ...) if the server has the PARTIAL or,
+     * for positive positions, the CONTEXT=SEARCH capability, and is available with
+     * resultSet(). Other servers return every match, and resultSet() and results() only
+     * contain the window. It can be combined with the other return options, except
+     * ReturnAll, and not with setIncrementalDelivery().
+     */
+    void setPartial(qint64 first, qint64 last);
+
+    /**
+     * Delivers the results of a normal search in chunks of @p chunkSize numbers with
+     * resultsReceived() while the SEARCH response is still arriving, instead of keeping them.
+     *
+     * The numbers are taken from the response as they are parsed, so the memory used stays
+     * bounded however many messages match, and e.g. fetching the first matches can be started
+     * before the rest arrived. results() and resultSet() stay empty, the count, minimum and
+     * maximum are still available.
+     */
+    void setIncrementalDelivery(bool incremental, int chunkSize = 1000);
+
     /**
      * Sets the search term.
      * @param term The search term.
@@ -190,6 +279,28 @@ public:
      */
     void setTerm(const Term &);
 
+    /**
+     * Answers UID searches from @p snapshot instead of the server, if the term only needs
+     * what the snapshot holds, see FlagsSnapshot::search(). Other searches, and those with
+     * ReturnSave, are sent to the server as usual.
+     *
+     * The snapshot has to be up to date with the mailbox, e.g. kept with MailboxSyncJob.
+     * The results are available as if the server sent them, the return options and
+     * setPartial() are applied locally.
+     */
+    void setFlagsSnapshot(const FlagsSnapshot &snapshot);
+
+    /**
+     * Returns true if the results came from the snapshot instead of the server.
+     */
+    bool isAnsweredLocally() const;
+
+Q_SIGNALS:
+    /**
+     * A chunk of results, see setIncrementalDelivery().
+     */
+    void resultsReceived(const KIMAP2::ImapSet &results);
+
 protected:
     void doStart() Q_DECL_OVERRIDE;
     void handleResponse(const Message &response) Q_DECL_OVERRIDE;
@@ -197,4 +308,6 @@ protected:
 
 }
 
+Q_DECLARE_OPERATORS_FOR_FLAGS(KIMAP2::SearchJob::ReturnOptions)
+
 #endif
@@ -24,7 +24,6 @@
 #include "job_p.h"
 #include "message_p.h"
 #include "session_p.h"
-#include "rfccodecs.h"
 
 namespace KIMAP2
 {
@@ -34,9 +33,13 @@ public:
     SelectJobPrivate(Session *session, const QString &name)
         : JobPrivate(session, name), readOnly(false), messageCount(-1), recentCount(-1),
           firstUnseenIndex(-1), uidValidity(-1), nextUid(-1), highestmodseq(0),
-          condstoreEnabled(false) { }
+          condstoreEnabled(false), qresyncUidValidity(0), qresyncModSequence(0) { }
     ~SelectJobPrivate() { }
 
+    SelectState toState() const;
+    void setState(const SelectState &state);
+    void reportFlagsChange(SelectJob *job, const Message &response);
+
     QString mailBox;
     bool readOnly;
 
@@ -48,12 +51,90 @@ public:
     qint64 uidValidity;
     qint64 nextUid;
     quint64 highestmodseq;
+    QByteArray mailBoxId;
     bool condstoreEnabled;
+    qint64 qresyncUidValidity;
+    quint64 qresyncModSequence;
+    ImapSet qresyncKnownUids;
+    ImapSet qresyncSequenceNumbers;
+    ImapSet qresyncSequenceUids;
 };
 }
 
 using namespace KIMAP2;
 
+SelectState SelectJobPrivate::toState() const
+{
+    SelectState state;
+    state.mailBox = mailBox;
+    state.readOnly = readOnly;
+    state.condstoreEnabled = condstoreEnabled;
+    state.flags = flags;
+    state.permanentFlags = permanentFlags;
+    state.messageCount = messageCount;
+    state.recentCount = recentCount;
+    state.firstUnseenIndex = firstUnseenIndex;
+    state.uidValidity = uidValidity;
+    state.nextUid = nextUid;
+    state.highestModSequence = highestmodseq;
+    state.mailBoxId = mailBoxId;
+    return state;
+}
+
+void SelectJobPrivate::setState(const SelectState &state)
+{
+    flags = state.flags;
+    permanentFlags = state.permanentFlags;
+    messageCount = state.messageCount;
+    recentCount = state.recentCount;
+    firstUnseenIndex = state.firstUnseenIndex;
+    uidValidity = state.uidValidity;
+    nextUid = state.nextUid;
+    highestmodseq = state.highestModSequence;
+    mailBoxId = state.mailBoxId;
+}
+
+void SelectJobPrivate::reportFlagsChange(SelectJob *job, const Message &response)
+{
+    // * 49 FETCH (UID 117 FLAGS (\Seen \Answered) MODSEQ (90060115194045001)),
+    // or * 117 UIDFETCH (FLAGS (\Seen \Answered) MODSEQ (90060115194045001)) with UIDONLY
+    if (response.content.size() < 4 || response.content[3].type() != Message::Part::List) {
+        return;
+    }
+    const Message::Part &items = response.content[3];
+    const QList<QByteArray> list = items.toList();
+    qint64 uid = 0;
+    if (response.content[2].keyword() == ImapKeyword::UidFetch) {
+        uid = response.content[1].toString().toLongLong();
+    }
+    QList<QByteArray> flags;
+    quint64 modSequence = 0;
+    for (int i = 0; i + 1 < list.size(); i += 2) {
+        const QByteArray &value = list.at(i + 1);
+        switch (items.keywordAt(i)) {
+        case ImapKeyword::Uid:
+            uid = value.toLongLong();
+            break;
+        case ImapKeyword::Flags:
+            if (value.startsWith('(') && value.endsWith(')')) {
+                const QByteArray inner = value.mid(1, value.size() - 2);
+                if (!inner.isEmpty()) {
+                    flags = inner.split(' ');
+                }
+            }
+            break;
+        case ImapKeyword::ModSeq:
+            modSequence = value.mid(1, value.size() - 2).toULongLong();
+            break;
+        default:
+            break;
+        }
+    }
+    if (uid > 0) {
+        emit job->messageFlagsChanged(uid, flags, modSequence);
+    }
+}
+
 SelectJob::SelectJob(Session *session)
     : Job(*new SelectJobPrivate(session, "Select"))
 {
@@ -135,6 +216,12 @@ quint64 SelectJob::highestModSequence() const
     return d->highestmodseq;
 }
 
+QByteArray SelectJob::mailBoxId() const
+{
+    Q_D(const SelectJob);
+    return d->mailBoxId;
+}
+
 void SelectJob::setCondstoreEnabled(bool enable)
 {
     Q_D(SelectJob);
@@ -147,21 +234,60 @@ bool SelectJob::condstoreEnabled() const
     return d->condstoreEnabled;
 }
 
+void SelectJob::setQResync(qint64 uidValidity, quint64 modSequence, const ImapSet &knownUids)
+{
+    Q_D(SelectJob);
+    d->qresyncUidValidity = uidValidity;
+    d->qresyncModSequence = modSequence;
+    d->qresyncKnownUids = knownUids;
+}
+
+void SelectJob::setQResyncSequenceMatch(const ImapSet &knownSequenceNumbers, const ImapSet &knownUids)
+{
+    Q_D(SelectJob);
+    d->qresyncSequenceNumbers = knownSequenceNumbers;
+    d->qresyncSequenceUids = knownUids;
+}
+
 void SelectJob::doStart()
 {
     Q_D(SelectJob);
 
+    const bool qresync = d->qresyncUidValidity > 0 && d->qresyncModSequence > 0;
+    const SelectState cached = qresync ? SelectState() : d->sessionInternal()->cachedSelect(d->mailBox, d->readOnly, d->condstoreEnabled);
+    if (cached.valid) {
+        qCDebug(KIMAP2_LOG) << "Already selected: " << d->mailBox;
+        d->setState(cached);
+        emitResult();
+        return;
+    }
+
     QByteArray command = "SELECT";
     if (d->readOnly) {
         command = "EXAMINE";
     }
 
-    QByteArray params = '\"' + KIMAP2::encodeImapFolderName(d->mailBox.toUtf8()) + '\"';
+    QByteArray params = '\"' + d->sessionInternal()->encodeMailBoxName(d->mailBox) + '\"';
 
-    if (d->condstoreEnabled) {
+    if (qresync) {
+        // SELECT "INBOX" (QRESYNC (67890007 20050715194045000 41:211 (1:20 41:60)))
+        params += " (QRESYNC (" + QByteArray::number(d->qresyncUidValidity) + ' ' + QByteArray::number(d->qresyncModSequence);
+        if (!d->qresyncKnownUids.isEmpty()) {
+            params += ' ' + d->qresyncKnownUids.toImapSequenceSet();
+        }
+        //Sequence numbers are meaningless with UIDONLY (RFC 9586)
+        if (!d->qresyncSequenceNumbers.isEmpty() && !d->qresyncSequenceUids.isEmpty()
+                && !d->sessionInternal()->isExtensionEnabled("UIDONLY")) {
+            params += " (" + d->qresyncSequenceNumbers.toImapSequenceSet() + ' ' + d->qresyncSequenceUids.toImapSequenceSet() + ')';
+        }
+        params += "))";
+    } else if (d->condstoreEnabled) {
         params += " (CONDSTORE)";
     }
 
+    if (qresync && !d->sessionInternal()->isExtensionEnabled("QRESYNC")) {
+        d->sendCommand("ENABLE", "QRESYNC");
+    }
     d->sendCommand(command, params);
 }
 
@@ -169,41 +295,67 @@ void SelectJob::handleResponse(const Message &response)
 {
     Q_D(SelectJob);
 
+    //Before the result, so that the jobs started from it already find it
+    if (response.content.size() >= 2 && !d->tags.isEmpty() && response.content.first().toString() == d->tags.last()
+            && response.content[1].keyword() == ImapKeyword::Ok) {
+        d->sessionInternal()->rememberSelect(d->toState());
+    }
+
     if (handleErrorReplies(response) == NotHandled) {
+        ImapSet vanishedUids;
+        if (JobPrivate::parseVanished(response, &vanishedUids)) {
+            emit vanished(vanishedUids);
+            return;
+        }
         if (response.content.size() >= 2) {
-            QByteArray code = response.content[1].toString();
+            const ImapKeyword code = response.content[1].keyword();
 
-            if (code == "OK") {
+            if (code == ImapKeyword::Ok) {
                 if (response.responseCode.size() < 2) {
                     return;
                 }
 
-                code = response.responseCode[0].toString();
-
-                if (code == "PERMANENTFLAGS") {
+                const ImapKeyword responseCode = response.responseCode[0].keyword();
+                switch (responseCode) {
+                case ImapKeyword::PermanentFlags:
                     d->permanentFlags = response.responseCode[1].toList();
-                } else if (code == "HIGHESTMODSEQ") {
+                    break;
+                case ImapKeyword::HighestModSeq: {
                     bool isInt;
                     quint64 value = response.responseCode[1].toString().toULongLong(&isInt);
                     if (!isInt) {
                         return;
                     }
                     d->highestmodseq = value;
-                } else {
+                    break;
+                }
+                case ImapKeyword::UidValidity:
+                case ImapKeyword::Unseen:
+                case ImapKeyword::UidNext: {
                     bool isInt;
                     qint64 value = response.responseCode[1].toString().toLongLong(&isInt);
                     if (!isInt) {
                         return;
                     }
-                    if (code == "UIDVALIDITY") {
+                    if (responseCode == ImapKeyword::UidValidity) {
                         d->uidValidity = value;
-                    } else if (code == "UNSEEN") {
-                        d->firstUnseenIndex = value;
-                    } else if (code == "UIDNEXT") {
+                    } else if (responseCode == ImapKeyword::Unseen) {
+                        if (!d->sessionInternal()->isExtensionEnabled("UIDONLY")) {
+                            d->firstUnseenIndex = value;
+                        }
+                    } else {
                         d->nextUid = value;
                     }
+                    break;
+                }
+                default:
+                    if (response.responseCode[0].toString() == "MAILBOXID") {
+                        const Message::Part &id = response.responseCode[1];
+                        d->mailBoxId = JobPrivate::parseObjectId(id.type() == Message::Part::List ? id.toList().value(0) : id.toString());
+                    }
+                    break;
                 }
-            } else if (code == "FLAGS") {
+            } else if (code == ImapKeyword::Flags) {
                 d->flags = response.content[2].toList();
             } else {
                 bool isInt;
@@ -212,11 +364,19 @@ void SelectJob::handleResponse(const Message &response)
                     return;
                 }
 
-                code = response.content[2].toString();
-                if (code == "EXISTS") {
+                switch (response.content[2].keyword()) {
+                case ImapKeyword::Exists:
                     d->messageCount = value;
-                } else if (code == "RECENT") {
+                    break;
+                case ImapKeyword::Fetch:
+                case ImapKeyword::UidFetch:
+                    d->reportFlagsChange(this, response);
+                    break;
+                case ImapKeyword::Recent:
                     d->recentCount = value;
+                    break;
+                default:
+                    break;
                 }
             }
         } else {
@@ -22,6 +22,7 @@
 
 #include "kimap2_export.h"
 
+#include "imapset.h"
 #include "job.h"
 
 namespace KIMAP2
@@ -53,6 +54,11 @@ public:
 
     int messageCount() const;
     int recentCount() const;
+    /**
+     * The sequence number of the first unseen message, -1 if the server didn't report it,
+     * which is always the case once UIDONLY (RFC 9586) is enabled, and with IMAP4rev2 (RFC 9051)
+     * servers. A SearchJob for unseen messages with ReturnMin finds it there.
+     */
     int firstUnseenIndex() const;
 
     qint64 uidValidity() const;
@@ -67,6 +73,14 @@ public:
      */
     quint64 highestModSequence() const;
 
+    /**
+     * @return The MAILBOXID of the mailbox (RFC 8474), or a null array if the
+     * server does not have OBJECTID capability.
+     *
+     * Unlike the name, it doesn't change when the mailbox is renamed.
+     */
+    QByteArray mailBoxId() const;
+
     /**
      * Whether to append CONDSTORE parameter to the SELECT command.
      *
@@ -85,6 +99,40 @@ public:
      */
     bool condstoreEnabled() const;
 
+    /**
+     * Resynchronizes the mailbox while selecting it, with QRESYNC (RFC 7162).
+     *
+     * Pass the UIDVALIDITY and the highest mod-sequence of the last synchronization, and
+     * optionally the UIDs that are known, to limit the report to them. The server then
+     * reports the messages that vanished since with vanished(), and the flags of those
+     * that changed with messageFlagsChanged(), so the cost of a resynchronization
+     * depends on the number of changes instead of the size of the mailbox.
+     *
+     * The server must have QRESYNC capability. QRESYNC is enabled on the session
+     * with ENABLE first if necessary. Nothing is resynchronized if @p uidValidity
+     * doesn't match anymore.
+     */
+    void setQResync(qint64 uidValidity, quint64 modSequence, const ImapSet &knownUids = ImapSet());
+
+    /**
+     * Helps the server to find the messages expunged since the last synchronization, by
+     * pairing the sequence numbers of some messages with their UIDs ("seq-match-data").
+     *
+     * Only used together with setQResync(), and not once UIDONLY (RFC 9586) is enabled.
+     */
+    void setQResyncSequenceMatch(const ImapSet &knownSequenceNumbers, const ImapSet &knownUids);
+
+Q_SIGNALS:
+    /**
+     * The messages with @p uids were expunged since the synchronization passed to setQResync().
+     */
+    void vanished(const KIMAP2::ImapSet &uids);
+
+    /**
+     * The flags of a message changed since the synchronization passed to setQResync().
+     */
+    void messageFlagsChanged(qint64 uid, const QList<QByteArray> &flags, quint64 modSequence);
+
 protected:
     void doStart() Q_DECL_OVERRIDE;
     void handleResponse(const Message &response) Q_DECL_OVERRIDE;
@@ -24,15 +24,35 @@
 #include "session.h"
 #include "session_p.h"
 
+#include <QCoreApplication>
 #include <QDebug>
+#include <QEvent>
+#include <QSemaphore>
+
+#include <algorithm>
+#include <iterator>
+#include <random>
+
+#ifdef Q_OS_UNIX
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
 
 #include "kimap_debug.h"
 
 #include "job.h"
+#include "job_p.h"
 #include "message_p.h"
 #include "sessionlogger_p.h"
+#include "deflatedevice_p.h"
+#include "hostconnector_p.h"
+#include "flagset_p.h"
 #include "rfccodecs.h"
 #include "imapstreamparser.h"
+#include "selectjob.h"
+#include "transport.h"
 
 Q_DECLARE_METATYPE(QSsl::SslProtocol)
 Q_DECLARE_METATYPE(QSslSocket::SslMode)
@@ -40,7 +60,353 @@ static const int _kimap_sslVersionId = qRegisterMetaType<QSsl::SslProtocol>();
 
 using namespace KIMAP2;
 
+namespace
+{
+
+/**
+ * Carries a call to the thread the session I/O lives on.
+ */
+class SessionCallEvent : public QEvent
+{
+public:
+    explicit SessionCallEvent(const std::function<void()> &call)
+        : QEvent(eventType()), call(call)
+    {
+    }
+
+    static QEvent::Type eventType()
+    {
+        static const QEvent::Type type = static_cast<QEvent::Type>(QEvent::registerEventType());
+        return type;
+    }
+
+    std::function<void()> call;
+};
+
+/**
+ * Runs the calls posted to it on the thread it lives on.
+ */
+class SessionCallReceiver : public QObject
+{
+public:
+    bool event(QEvent *event) Q_DECL_OVERRIDE
+    {
+        if (event->type() == SessionCallEvent::eventType()) {
+            static_cast<SessionCallEvent *>(event)->call();
+            return true;
+        }
+        return QObject::event(event);
+    }
+};
+
+/**
+ * The I/O threads shared by the sessions created with Session::SharedWorkerThread.
+ */
+class IoThreads
+{
+public:
+    IoThreads()
+        : count(qMax(1, QThread::idealThreadCount()))
+    {
+    }
+
+    ~IoThreads()
+    {
+        for (QThread *thread : threads) {
+            thread->quit();
+            thread->wait();
+            delete thread;
+        }
+    }
+
+    // Returns the thread with the fewest sessions, starting another one while there are less than count
+    QThread *acquire()
+    {
+        QMutexLocker locker(&mutex);
+        if (threads.size() < count) {
+            QThread *thread = new QThread;
+            thread->setObjectName(QStringLiteral("KIMAP2 I/O %1").arg(threads.size() + 1));
+            thread->start();
+            threads << thread;
+            sessions << 0;
+        }
+        int best = 0;
+        for (int i = 1; i < threads.size(); ++i) {
+            if (sessions.at(i) < sessions.at(best)) {
+                best = i;
+            }
+        }
+        sessions[best]++;
+        return threads.at(best);
+    }
+
+    void release(QThread *thread)
+    {
+        QMutexLocker locker(&mutex);
+        const int i = threads.indexOf(thread);
+        Q_ASSERT(i >= 0);
+        sessions[i]--;
+    }
+
+    QMutex mutex;
+    int count;
+    // Started threads, and how many sessions run on each of them
+    QList<QThread *> threads;
+    QList<int> sessions;
+};
+
+Q_GLOBAL_STATIC(IoThreads, ioThreads)
+
+/**
+ * The TLS session tickets of the servers we were connected to, see Session::setTlsSessionCacheEnabled().
+ */
+class TlsSessionCache
+{
+public:
+    TlsSessionCache()
+        : enabled(false)
+    {
+    }
+
+    static QString key(const QString &hostName, quint16 port)
+    {
+        return hostName + QLatin1Char(':') + QString::number(port);
+    }
+
+    QMutex mutex;
+    bool enabled;
+    // By key()
+    QHash<QString, QByteArray> tickets;
+};
+
+Q_GLOBAL_STATIC(TlsSessionCache, tlsSessionCache)
+
+/**
+ * The TLS configuration new sessions start with, see Session::setDefaultSslConfiguration().
+ */
+struct SslDefaults {
+    QMutex mutex;
+    QSslConfiguration configuration;
+};
+
+Q_GLOBAL_STATIC(SslDefaults, sslDefaults)
+
+/**
+ * Takes the place of the commands sent with Session::sendCommand() in the job queue.
+ *
+ * It is never deleted while the session exists, and doesn't emit a result either,
+ * the session is told directly when it is done.
+ */
+class CommandRunner : public Job
+{
+public:
+    explicit CommandRunner(Session *session)
+        : Job(*new JobPrivate(session, QStringLiteral("Command")))
+    {
+        setAutoDelete(false);
+    }
+
+private:
+    void doStart() Q_DECL_OVERRIDE
+    {
+        d_ptr->sessionInternal()->sendQueuedCommands();
+    }
+
+    void handleResponse(const Message &response) Q_DECL_OVERRIDE
+    {
+        d_ptr->sessionInternal()->queuedCommandResponse(response);
+    }
+
+    void connectionLost() Q_DECL_OVERRIDE
+    {
+        d_ptr->sessionInternal()->failQueuedCommands();
+    }
+};
+
+QByteArray joinParts(const QList<Message::Part> &parts)
+{
+    QByteArray result;
+    foreach (const Message::Part &part, parts) {
+        if (!result.isEmpty()) {
+            result += ' ';
+        }
+        if (part.type() == Message::Part::List) {
+            result += '(' + part.toList().join(' ') + ')';
+        } else {
+            result += part.toString();
+        }
+    }
+    return result;
+}
+
+// The parts of an untagged response for CommandResult
+QList<QByteArray> toParts(const Message &response)
+{
+    QList<QByteArray> parts;
+    foreach (const Message::Part &part, response.content) {
+        parts << joinParts(QList<Message::Part>() << part);
+    }
+    if (!response.responseCode.isEmpty()) {
+        parts.insert(qMin(2, parts.size()), '[' + joinParts(response.responseCode) + ']');
+    }
+    return parts;
+}
+
+}
+
+CapabilityCache::~CapabilityCache()
+{
+}
+
+SessionObserver::~SessionObserver()
+{
+}
+
+void SessionObserver::jobEnqueued(Job *)
+{
+}
+
+void SessionObserver::jobStarted(Job *)
+{
+}
+
+void SessionObserver::commandSent(const QByteArray &, const QByteArray &, qint64)
+{
+}
+
+void SessionObserver::firstResponseByte(const QByteArray &)
+{
+}
+
+void SessionObserver::commandCompleted(const QByteArray &, const QByteArray &, const QByteArray &)
+{
+}
+
+void SessionObserver::literalStarted(qint64)
+{
+}
+
+void SessionObserver::literalFinished(qint64)
+{
+}
+
+void SessionObserver::dataRead(qint64)
+{
+}
+
+void SessionObserver::dataWritten(qint64)
+{
+}
+
+bool CommandResult::isOk() const
+{
+    return status == "OK";
+}
+
+SessionMetrics::Command::Command()
+    : count(0),
+      failed(0),
+      totalLatency(0),
+      latencyHistogram(SessionMetrics::latencyBuckets().size() + 1, 0)
+{
+}
+
+ParseLimits::ParseLimits()
+    : tokenSize(0),
+      lineSize(0),
+      literalSize(0)
+{
+}
+
+ParserCounters::ParserCounters()
+    : initBytes(0),
+      quotedStringBytes(0),
+      literalStringBytes(0),
+      stringBytes(0),
+      whitespaceBytes(0),
+      angleBracketStringBytes(0),
+      crlfBytes(0),
+      sublistBytes(0),
+      trims(0),
+      trimCopies(0),
+      trimCopiedBytes(0),
+      reads(0),
+      smallReads(0)
+{
+}
+
+bool ParserCounters::isEnabled()
+{
+#ifdef KIMAP2_PARSER_COUNTERS
+    return true;
+#else
+    return false;
+#endif
+}
+
+SessionMetrics::SessionMetrics()
+    : bytesSent(0),
+      bytesReceived(0),
+      literalBytesReceived(0),
+      parseTime(0),
+      jobsStarted(0),
+      queueWaitTime(0),
+      tlsHandshakes(0),
+      tlsSessionCacheHits(0)
+{
+}
+
+SessionMemoryUsage::SessionMemoryUsage()
+    : parserBufferCapacity(0),
+      socketReadBuffer(0),
+      literalBytes(0),
+      largestLiteral(0),
+      writeQueueBytes(0),
+      queuedJobs(0),
+      inFlightPayloadBytes(0)
+{
+}
+
+ReconnectPolicy::ReconnectPolicy()
+    : maximumAttempts(0),
+      initialDelay(1000),
+      maximumDelay(60000)
+{
+}
+
+SocketOptions::SocketOptions()
+    : lowDelay(false),
+      sendBufferSize(0),
+      receiveBufferSize(0),
+      keepAlive(true),
+      keepAliveIdle(0),
+      keepAliveInterval(0),
+      keepAliveCount(0)
+{
+}
+
+QVector<int> SessionMetrics::latencyBuckets()
+{
+    return QVector<int>() << 5 << 10 << 25 << 50 << 100 << 250 << 500 << 1000 << 2500 << 5000 << 10000 << 30000;
+}
+
 Session::Session(const QString &hostName, quint16 port, QObject *parent)
+    : Session(hostName, port, OwnerThread, parent)
+{
+}
+
+Session::Session(const QString &hostName, quint16 port, ThreadingMode threadingMode, QObject *parent)
+    : Session(hostName, port, threadingMode, QSharedPointer<Transport>(), parent)
+{
+}
+
+Session::Session(const QSharedPointer<Transport> &transport, ThreadingMode threadingMode, QObject *parent)
+    : Session(transport->hostName(), 0, threadingMode, transport, parent)
+{
+}
+
+Session::Session(const QString &hostName, quint16 port, ThreadingMode threadingMode, const QSharedPointer<Transport> &transport,
+                 QObject *parent)
     : QObject(parent), d(new SessionPrivate(this))
 {
     if (!qEnvironmentVariableIsEmpty("KIMAP2_LOGFILE")) {
@@ -55,11 +421,18 @@ Session::Session(const QString &hostName, quint16 port, QObject *parent)
         d->trackTime = true;
         qCInfo(KIMAP2_LOG) << "Tracking timings.";
     }
+    if (d->logger || d->dumpTraffic) {
+        //Log the data as it is read instead of reassembling every response
+        d->stream->setTrafficObserver([this](const char *data, int size) {
+            d->trafficReceived(data, size);
+        });
+    }
 
     d->state = Disconnected;
     d->jobRunning = false;
     d->hostName = hostName;
     d->port = port;
+    d->transport = transport;
 
     connect(d->socket.data(), &QIODevice::readyRead, d, &SessionPrivate::readMessage);
 
@@ -74,6 +447,15 @@ Session::Session(const QString &hostName, quint16 port, QObject *parent)
             d, &SessionPrivate::socketActivity);
     connect(d->socket.data(), &QSslSocket::encryptedBytesWritten,
             d, &SessionPrivate::socketActivity);
+    connect(d->socket.data(), &QIODevice::bytesWritten,
+            d, &SessionPrivate::continueWriting);
+    connect(d->socket.data(), &QSslSocket::encryptedBytesWritten,
+            d, &SessionPrivate::continueWriting);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
+    //With TLS 1.3 the tickets only arrive after the handshake
+    connect(d->socket.data(), &QSslSocket::newSessionTicketReceived,
+            d, &SessionPrivate::storeTlsSessionTicket);
+#endif
     connect(d->socket.data(), &QIODevice::readyRead,
             d, &SessionPrivate::socketActivity);
     connect(d->socket.data(), &QAbstractSocket::stateChanged, [this](QAbstractSocket::SocketState state) {
@@ -89,21 +471,31 @@ Session::Session(const QString &hostName, quint16 port, QObject *parent)
         }
     });
 
-    d->socketTimer.setSingleShot(true);
     connect(&d->socketTimer, &QTimer::timeout,
-            d, &SessionPrivate::onSocketTimeout);
+            d, &SessionPrivate::checkSocketTimeout);
+    connect(&d->reconnectTimer, &QTimer::timeout,
+            d, &SessionPrivate::reconnect);
+    connect(&d->bandwidthTimer, &QTimer::timeout,
+            d, &SessionPrivate::bandwidthAvailable);
+    //Stays on our thread, so the metrics arrive where they are asked for
+    connect(&d->metricsTimer, &QTimer::timeout, this, [this]() {
+        emit metricsUpdated(metrics());
+    });
 
-    d->socketProgressTimer.setSingleShot(false);
-    connect(&d->socketProgressTimer, &QTimer::timeout,
-            d, &SessionPrivate::onSocketProgressTimeout);
+    if (threadingMode != OwnerThread) {
+        d->startWorkerThread(threadingMode);
+    }
 
-    d->startSocketTimer();
     qCDebug(KIMAP2_LOG) << "Connecting to: " << hostName << port;
-    d->socket->connectToHost(hostName, port);
+    d->callInSessionThread([this]() {
+        d->startSocketTimer();
+        d->connectToServer();
+    });
 }
 
 Session::~Session()
 {
+    d->stopWorkerThread();
     //Make sure all jobs know we're done
     d->clearJobQueue();
     delete d;
@@ -121,32 +513,122 @@ quint16 Session::port() const
 
 Session::State Session::state() const
 {
+    QMutexLocker locker(&d->publicMutex);
     return d->state;
 }
 
 bool Session::isConnected() const
 {
+    QMutexLocker locker(&d->publicMutex);
     return (d->state == Authenticated || d->state == Selected);
 }
 
 QString Session::userName() const
 {
+    QMutexLocker locker(&d->publicMutex);
     return d->userName;
 }
 
 QByteArray Session::serverGreeting() const
 {
+    QMutexLocker locker(&d->publicMutex);
     return d->greeting;
 }
 
+void Session::submit(const JobFactory &factory)
+{
+    d->callInOwnerThread([this, factory]() {
+        if (Job *job = factory(this)) {
+            job->start();
+        }
+    });
+}
+
+void Session::addJobs(const QList<Job *> &jobs)
+{
+    if (!jobs.isEmpty()) {
+        d->addJobs(jobs);
+    }
+}
+
+void Session::sendCommand(const QByteArray &command, const QByteArray &arguments, const CommandCallback &callback)
+{
+    d->callInSessionThread([this, command, arguments, callback]() {
+        d->queueCommand(command, arguments, callback);
+    });
+}
+
+void Session::setIoThreadCount(int count)
+{
+    Q_ASSERT(count > 0);
+    QMutexLocker locker(&ioThreads->mutex);
+    ioThreads->count = count;
+}
+
+int Session::ioThreadCount()
+{
+    QMutexLocker locker(&ioThreads->mutex);
+    return ioThreads->count;
+}
+
+void Session::setTlsSessionCacheEnabled(bool enabled)
+{
+    QMutexLocker locker(&tlsSessionCache->mutex);
+    tlsSessionCache->enabled = enabled;
+    if (!enabled) {
+        tlsSessionCache->tickets.clear();
+    }
+}
+
+bool Session::isTlsSessionCacheEnabled()
+{
+    QMutexLocker locker(&tlsSessionCache->mutex);
+    return tlsSessionCache->enabled;
+}
+
+void Session::setDefaultSslConfiguration(const QSslConfiguration &configuration)
+{
+    QMutexLocker locker(&sslDefaults->mutex);
+    sslDefaults->configuration = configuration;
+}
+
+QSslConfiguration Session::defaultSslConfiguration()
+{
+    QMutexLocker locker(&sslDefaults->mutex);
+    return sslDefaults->configuration;
+}
+
+void Session::setConnectionRacingEnabled(bool enabled)
+{
+    HostConnector::setEnabled(enabled);
+}
+
+bool Session::isConnectionRacingEnabled()
+{
+    return HostConnector::isEnabled();
+}
+
+void Session::setHostLookupCacheTimeout(int seconds)
+{
+    HostConnector::setCacheTimeout(seconds);
+}
+
+int Session::hostLookupCacheTimeout()
+{
+    return HostConnector::cacheTimeout();
+}
+
 int Session::jobQueueSize() const
 {
-    return d->queue.size() + (d->jobRunning ? 1 : 0);
+    if (d->workerThread) {
+        return d->publicJobQueueSize.load();
+    }
+    return d->jobQueueSize();
 }
 
 void Session::close()
 {
-    d->closeSocket();
+    QMetaObject::invokeMethod(d, "closeForGood");
 }
 
 void Session::ignoreErrors(const QList<QSslError> &errors)
@@ -164,214 +646,1839 @@ int Session::timeout() const
     return d->socketTimeout() / 1000;
 }
 
-QString Session::selectedMailBox() const
+void Session::setReceiveBufferLimits(int minimum, int maximum)
 {
-    return QString::fromUtf8(d->currentMailBox);
+    d->callInSessionThread([this, minimum, maximum]() {
+        d->stream->setBufferSizeLimits(minimum, maximum);
+    });
 }
 
-
-SessionPrivate::SessionPrivate(Session *session)
-    : QObject(session),
-      q(session),
-      state(Session::Disconnected),
-      hostLookupInProgress(false),
-      logger(Q_NULLPTR),
-      currentJob(Q_NULLPTR),
-      tagCount(0),
-      socketTimerInterval(30000),   // By default timeouts on 30s
-      socketProgressInterval(3000),   // mention we're still alive every 3s
-      socket(new QSslSocket),
-      stream(new ImapStreamParser(socket.data())),
-      accumulatedWaitTime(0),
-      accumulatedProcessingTime(0),
-      trackTime(false),
-      dumpTraffic(false)
+void Session::setReleaseIdleReceiveBuffers(bool release)
 {
-    //For windows this needs to be set before connecting according to the docs
-    socket->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
-    stream->onResponseReceived([this](const Message &message) {
-        responseReceived(message);
+    d->callInSessionThread([this, release]() {
+        d->stream->setReleaseIdleBuffers(release);
     });
 }
 
-SessionPrivate::~SessionPrivate()
+void Session::setReadBufferSize(qint64 size)
 {
+    {
+        QMutexLocker locker(&d->publicMutex);
+        d->readBufferSize = size;
+    }
+    d->callInSessionThread([this, size]() {
+        d->socket->setReadBufferSize(size);
+    });
 }
 
-void SessionPrivate::handleSslErrors(const QList<QSslError> &errors)
+qint64 Session::readBufferSize() const
 {
-    emit q->sslErrors(errors);
+    QMutexLocker locker(&d->publicMutex);
+    return d->readBufferSize;
 }
 
-void SessionPrivate::addJob(Job *job)
+void Session::setBandwidthLimiter(BandwidthLimiter *limiter)
 {
-    queue.append(job);
-    emit q->jobQueueSizeChanged(q->jobQueueSize());
+    d->callInSessionThread([this, limiter]() {
+        d->bandwidthLimiter = limiter;
+        if (!limiter) {
+            d->stream->setReadLimit(-1);
+            //Whatever waited for it can go on
+            if (d->bandwidthTimer.isActive()) {
+                d->bandwidthTimer.start(0);
+            }
+        }
+    });
+}
 
-    QObject::connect(job, &KJob::result, this, &SessionPrivate::jobDone);
-    QObject::connect(job, &QObject::destroyed, this, &SessionPrivate::jobDestroyed);
-    startNext();
+BandwidthLimiter *Session::bandwidthLimiter() const
+{
+    return d->bandwidthLimiter;
 }
 
-void SessionPrivate::startNext()
+void Session::setSocketOptions(const SocketOptions &options)
 {
-    QMetaObject::invokeMethod(this, "doStartNext");
+    d->callInSessionThread([this, options]() {
+        d->socketOptions = options;
+        d->applySocketOptions();
+    });
 }
 
-void SessionPrivate::doStartNext()
+SocketOptions Session::socketOptions() const
 {
-    //Wait until we are ready to process
-    if (queue.isEmpty()
-        || jobRunning
-        || socket->state() == QSslSocket::ConnectingState
-        || socket->state() == QSslSocket::HostLookupState) {
-        return;
-    }
+    return d->socketOptions;
+}
 
-    currentJob = queue.dequeue();
+SessionMetrics Session::metrics() const
+{
+    QMutexLocker locker(&d->publicMutex);
+    return d->metrics;
+}
 
-    //Since we aren't connecting we may never get back. Cancel the job
-    if (socket->state() == QSslSocket::UnconnectedState) {
-        qCDebug(KIMAP2_LOG) << "Cancelling job due to lack of connection: " << currentJob->metaObject()->className();
-        currentJob->connectionLost();
-        return;
-    }
+void Session::setLiteralSpillThreshold(qint64 size, const QString &directory)
+{
+    d->callInSessionThread([this, size, directory]() {
+        d->stream->setSpillThreshold(size, directory);
+    });
+}
 
-    if (trackTime) {
-        time.start();
-    }
-    restartSocketTimer();
-    jobRunning = true;
-    currentJob->doStart();
+qint64 Session::literalSpillThreshold() const
+{
+    return d->stream->spillThreshold();
 }
 
-void SessionPrivate::jobDone(KJob *job)
+SessionMemoryUsage Session::memoryUsage() const
 {
-    Q_UNUSED(job);
-    Q_ASSERT(job == currentJob);
-    qCDebug(KIMAP2_LOG) << "Job done: " << job->metaObject()->className();
+    QMutexLocker locker(&d->publicMutex);
+    return d->memoryUsage;
+}
 
-    stopSocketTimer();
+void Session::setMaximumLiteralSize(qint64 size)
+{
+    d->callInSessionThread([this, size]() {
+        d->maximumLiteralSize = size;
+    });
+}
 
-    jobRunning = false;
-    currentJob = Q_NULLPTR;
-    emit q->jobQueueSizeChanged(q->jobQueueSize());
-    startNext();
+qint64 Session::maximumLiteralSize() const
+{
+    return d->maximumLiteralSize;
 }
 
-void SessionPrivate::jobDestroyed(QObject *job)
+void Session::setMaximumResponseBytes(qint64 bytes)
 {
-    queue.removeAll(static_cast<KIMAP2::Job *>(job));
-    if (currentJob == job) {
-        currentJob = Q_NULLPTR;
-    }
+    d->callInSessionThread([this, bytes]() {
+        d->maximumResponseBytes = bytes;
+    });
 }
 
-void SessionPrivate::responseReceived(const Message &response)
+qint64 Session::maximumResponseBytes() const
+{
+    return d->maximumResponseBytes;
+}
+
+void Session::setParseLimits(const ParseLimits &limits)
+{
+    {
+        QMutexLocker locker(&d->publicMutex);
+        d->parseLimits = limits;
+    }
+    d->callInSessionThread([this, limits]() {
+        d->stream->setLimits(limits, [this](const Message &partial, const QString &reason) {
+            d->limitedResponseReceived(partial, reason);
+        });
+    });
+}
+
+ParseLimits Session::parseLimits() const
+{
+    QMutexLocker locker(&d->publicMutex);
+    return d->parseLimits;
+}
+
+void Session::setMaximumQueuedJobs(int count)
+{
+    d->callInSessionThread([this, count]() {
+        d->maximumQueuedJobs = count;
+    });
+}
+
+int Session::maximumQueuedJobs() const
+{
+    return d->maximumQueuedJobs;
+}
+
+void Session::setMetricsInterval(int msecs)
+{
+    if (msecs > 0) {
+        d->metricsTimer.start(msecs);
+    } else {
+        d->metricsTimer.stop();
+    }
+}
+
+int Session::metricsInterval() const
+{
+    return d->metricsTimer.isActive() ? d->metricsTimer.interval() : 0;
+}
+
+qint64 Session::receiveBufferCopiedBytes() const
+{
+    return d->stream->trimmedBytes();
+}
+
+void Session::setPipeliningEnabled(bool enabled)
+{
+    d->callInSessionThread([this, enabled]() {
+        d->pipelining = enabled;
+    });
+}
+
+bool Session::isPipeliningEnabled() const
+{
+    return d->pipelining;
+}
+
+void Session::setSelectCacheEnabled(bool enabled)
+{
+    d->callInSessionThread([this, enabled]() {
+        d->selectCacheEnabled = enabled;
+        if (!enabled) {
+            d->selectState = SelectState();
+        }
+    });
+}
+
+bool Session::isSelectCacheEnabled() const
+{
+    return d->selectCacheEnabled;
+}
+
+void Session::setUidMapEnabled(bool enabled)
+{
+    d->callInSessionThread([this, enabled]() {
+        d->sequenceMapEnabled = enabled;
+        if (!enabled) {
+            d->clearSequenceMap();
+        }
+    });
+}
+
+bool Session::isUidMapEnabled() const
+{
+    return d->sequenceMapEnabled;
+}
+
+qint64 Session::uidForSequenceNumber(qint64 sequenceNumber) const
+{
+    QMutexLocker locker(&d->publicMutex);
+    if (sequenceNumber < 1 || sequenceNumber > d->sequenceMap.uids.size()) {
+        return 0;
+    }
+    return d->sequenceMap.uids.at(sequenceNumber - 1);
+}
+
+bool Session::isUidMapComplete() const
+{
+    QMutexLocker locker(&d->publicMutex);
+    return d->sequenceMapEnabled && d->sequenceMap.counted && !d->sequenceMap.unknown && d->state == Selected;
+}
+
+void Session::setJobCoalescingEnabled(bool enabled)
+{
+    d->callInSessionThread([this, enabled]() {
+        d->jobCoalescing = enabled;
+    });
+}
+
+bool Session::isJobCoalescingEnabled() const
+{
+    return d->jobCoalescing;
+}
+
+void Session::setMailBoxNameCacheEnabled(bool enabled)
+{
+    d->callInSessionThread([this, enabled]() {
+        d->mailBoxNameCacheEnabled = enabled;
+        if (!enabled) {
+            d->decodedMailBoxNames.clear();
+            d->encodedMailBoxNames.clear();
+        }
+    });
+}
+
+bool Session::isMailBoxNameCacheEnabled() const
+{
+    return d->mailBoxNameCacheEnabled;
+}
+
+void Session::setMailBoxInfoCacheTimeout(int seconds)
+{
+    d->callInSessionThread([this, seconds]() {
+        d->mailBoxInfoCacheTimeout = qMax(0, seconds);
+        if (!d->mailBoxInfoCacheTimeout) {
+            d->clearMailBoxInfo();
+        }
+    });
+}
+
+int Session::mailBoxInfoCacheTimeout() const
+{
+    return d->mailBoxInfoCacheTimeout;
+}
+
+void Session::setReconnectPolicy(const ReconnectPolicy &policy)
+{
+    d->callInSessionThread([this, policy]() {
+        d->reconnectPolicy = policy;
+    });
+}
+
+ReconnectPolicy Session::reconnectPolicy() const
+{
+    return d->reconnectPolicy;
+}
+
+void Session::setParseErrorRecoveryEnabled(bool enabled)
+{
+    d->callInSessionThread([this, enabled]() {
+        if (enabled) {
+            d->stream->setErrorRecoveryEnabled(true, [this](const Message &partial, const QString &reason) {
+                d->malformedResponseReceived(partial, reason);
+            });
+        } else {
+            d->stream->setErrorRecoveryEnabled(false);
+        }
+    });
+}
+
+bool Session::isParseErrorRecoveryEnabled() const
+{
+    return d->stream->isErrorRecoveryEnabled();
+}
+
+QStringList Session::capabilities() const
+{
+    QMutexLocker locker(&d->publicMutex);
+    return d->publicCapabilities;
+}
+
+bool Session::hasCapability(const QString &capability) const
+{
+    QMutexLocker locker(&d->publicMutex);
+    return d->hasCapability(capability.toUpper().toLatin1());
+}
+
+bool Session::hasNamespaces() const
+{
+    QMutexLocker locker(&d->publicMutex);
+    return d->namespacesKnown;
+}
+
+QList<MailBoxDescriptor> Session::personalNamespaces() const
+{
+    QMutexLocker locker(&d->publicMutex);
+    return d->personalNamespaces;
+}
+
+QList<MailBoxDescriptor> Session::userNamespaces() const
+{
+    QMutexLocker locker(&d->publicMutex);
+    return d->userNamespaces;
+}
+
+QList<MailBoxDescriptor> Session::sharedNamespaces() const
+{
+    QMutexLocker locker(&d->publicMutex);
+    return d->sharedNamespaces;
+}
+
+void Session::setCapabilityCache(CapabilityCache *cache)
+{
+    d->capabilityCache.store(cache);
+}
+
+CapabilityCache *Session::capabilityCache() const
+{
+    return d->capabilityCache.load();
+}
+
+void Session::setObserver(SessionObserver *observer)
+{
+    d->observer.store(observer);
+    //The parser only reports literals while somebody listens
+    d->callInSessionThread([this, observer]() {
+        ImapStreamParser::LiteralObserver literalObserver;
+        if (observer) {
+            literalObserver.started = [this](qint64 size) {
+                if (SessionObserver *current = d->observer.load()) {
+                    current->literalStarted(size);
+                }
+            };
+            literalObserver.finished = [this](qint64 size) {
+                if (SessionObserver *current = d->observer.load()) {
+                    current->literalFinished(size);
+                }
+            };
+        }
+        d->stream->setLiteralObserver(literalObserver);
+    });
+}
+
+SessionObserver *Session::observer() const
+{
+    return d->observer.load();
+}
+
+QString Session::selectedMailBox() const
+{
+    QMutexLocker locker(&d->publicMutex);
+    return QString::fromUtf8(d->currentMailBox);
+}
+
+
+SessionPrivate::SessionPrivate(Session *session)
+    : QObject(session),
+      q(session),
+      state(Session::Disconnected),
+      hostLookupInProgress(false),
+      logger(Q_NULLPTR),
+      currentJob(Q_NULLPTR),
+      followUpOf(Q_NULLPTR),
+      commandRunner(new CommandRunner(session)),
+      commandRunnerQueued(false),
+      pipelining(false),
+      selectCacheEnabled(false),
+      selectedUidValidity(-1),
+      sequenceMapEnabled(false),
+      jobCoalescing(false),
+      mailBoxNameCacheEnabled(false),
+      mailBoxInfoCacheTimeout(0),
+      capabilitiesAnnounced(false),
+      tagCount(0),
+      socketTimerInterval(30000),   // By default timeouts on 30s
+      socketProgressInterval(3000),   // mention we're still alive every 3s
+      socketDeadlineArmed(false),
+      lastSocketActivity(0),
+      lastProgressReport(0),
+      socket(new QSslSocket),
+      stream(new ImapStreamParser(socket.data())),
+      readingPausedBy(Q_NULLPTR),
+      writeScheduled(false),
+      accumulatedWaitTime(0),
+      accumulatedProcessingTime(0),
+      trackTime(false),
+      dumpTraffic(false),
+      workerThread(Q_NULLPTR),
+      ownsWorkerThread(false),
+      ownerCalls(new SessionCallReceiver),
+      flagTable(new FlagTable),
+      readBufferSize(0),
+      namespacesKnown(false),
+      maximumLiteralSize(0),
+      maximumResponseBytes(0),
+      maximumQueuedJobs(0),
+      currentJobReceivedFrom(0),
+      reconnecting(false),
+      reconnectAttempts(0),
+      bandwidthLimiter(Q_NULLPTR)
+{
+    reconnectTimer.setSingleShot(true);
+    bandwidthTimer.setSingleShot(true);
+    //A child, so that it moves to the worker thread with us
+    hostConnector = new HostConnector(this);
+    connect(hostConnector, &HostConnector::finished, this, &SessionPrivate::connectToAddress);
+    {
+        //Shared, so the sessions don't each build their own
+        QMutexLocker locker(&sslDefaults->mutex);
+        if (!sslDefaults->configuration.isNull()) {
+            socket->setSslConfiguration(sslDefaults->configuration);
+        }
+    }
+    //For windows the keepalive needs to be set before connecting according to the docs
+    applySocketOptions();
+    commandTimer.start();
+    writeBuffer.reserve(16 * 1024);
+    stream->setZeroCopyEnabled(true);
+    stream->onResponseReceived([this](const Message &message) {
+        responseReceived(message);
+    });
+    stream->setLiteralSinkProvider([this](const Message &message, const QByteArray &name, qint64 size) {
+        if (currentJob && maximumLiteralSize && size > maximumLiteralSize) {
+            exceedLimit(currentJob, QStringLiteral("a literal of %1 bytes").arg(size));
+        } else if (currentJob && maximumResponseBytes
+                   && stream->bytesRead() - currentJobReceivedFrom + size > maximumResponseBytes) {
+            exceedLimit(currentJob, QStringLiteral("a response of more than %1 bytes").arg(maximumResponseBytes));
+        }
+        if (currentJob && currentJob->d_ptr->limitExceeded) {
+            //Dropped as it arrives
+            return ImapStreamParser::LiteralSink([](const char *, int) {});
+        }
+        if (currentJob && currentJob->d_ptr->literalSinkProvider) {
+            return currentJob->d_ptr->literalSinkProvider(message, name, size);
+        }
+        return ImapStreamParser::LiteralSink();
+    });
+}
+
+SessionPrivate::~SessionPrivate()
+{
+}
+
+void SessionPrivate::handleSslErrors(const QList<QSslError> &errors)
+{
+    if (workerThread) {
+        //Session::ignoreErrors() only has an effect before we return, so wait for the receivers
+        QMetaObject::invokeMethod(q, "sslErrors", Qt::BlockingQueuedConnection, Q_ARG(QList<QSslError>, errors));
+        return;
+    }
+    emit q->sslErrors(errors);
+}
+
+void SessionPrivate::addJob(Job *job)
+{
+    addJobs(QList<Job *>() << job);
+}
+
+void SessionPrivate::addJobs(const QList<Job *> &jobs)
+{
+    callInSessionThread([this, jobs]() {
+        const qint64 now = commandTimer.elapsed();
+        for (Job *job : jobs) {
+            if (maximumQueuedJobs && queue.size() >= maximumQueuedJobs) {
+                qCWarning(KIMAP2_LOG) << "Too many queued jobs, failing: " << job->metaObject()->className();
+                job->setError(LimitExceeded);
+                job->setErrorText(QStringLiteral("%1 failed, more than %2 jobs are queued.").arg(job->d_ptr->m_name).arg(maximumQueuedJobs));
+                job->emitResult();
+                continue;
+            }
+            job->d_ptr->queuedAt = now;
+            job->d_ptr->queuedMailBox = currentMailBox;
+            enqueue(job);
+            if (SessionObserver *o = observer.load()) {
+                o->jobEnqueued(job);
+            }
+            QObject::connect(job, &KJob::result, this, &SessionPrivate::jobDone);
+            QObject::connect(job, &QObject::destroyed, this, &SessionPrivate::jobDestroyed);
+        }
+        emitJobQueueSizeChanged();
+        startNext();
+    });
+}
+
+void SessionPrivate::enqueue(Job *job)
+{
+    //Don't starve lower priorities if higher ones keep coming
+    static const int maximumOvertaken = 8;
+
+    const Job::Priority priority = job->d_ptr->priority;
+    auto position = queue.end();
+    while (position != queue.begin()) {
+        const JobPrivate *queued = (*std::prev(position))->d_ptr;
+        if (queued->priority >= priority || queued->overtaken >= maximumOvertaken) {
+            break;
+        }
+        --position;
+    }
+    for (auto it = position; it != queue.end(); ++it) {
+        (*it)->d_ptr->overtaken++;
+    }
+    queue.insert(position, job);
+}
+
+bool SessionPrivate::stepAside(Job *job)
+{
+    if (job != currentJob || !pipelinedJobs.isEmpty() || queue.isEmpty()
+            || queue.head()->d_ptr->priority <= job->d_ptr->priority) {
+        return false;
+    }
+    qCDebug(KIMAP2_LOG) << "Stepping aside for a job of higher priority: " << job->metaObject()->className();
+
+    //Continue ahead of everything with a lower priority
+    auto position = queue.begin();
+    while (position != queue.end() && (*position)->d_ptr->priority >= job->d_ptr->priority) {
+        ++position;
+    }
+    queue.insert(position, job);
+    job->d_ptr->suspended = true;
+    job->d_ptr->suspendedMailBox = currentMailBox;
+    currentJob = Q_NULLPTR;
+    jobRunning = false;
+    stream->setListObserver(ImapStreamParser::ListObserver());
+    startNext();
+    return true;
+}
+
+void SessionPrivate::queueCommand(const QByteArray &command, const QByteArray &arguments, const Session::CommandCallback &callback)
+{
+    QueuedCommand queued;
+    queued.command = command;
+    queued.arguments = arguments;
+    queued.callback = callback;
+    queuedCommands.enqueue(queued);
+    if (!commandRunnerQueued) {
+        commandRunnerQueued = true;
+        commandRunner->d_ptr->queuedAt = commandTimer.elapsed();
+        enqueue(commandRunner);
+        emitJobQueueSizeChanged();
+        startNext();
+    }
+}
+
+void SessionPrivate::sendQueuedCommands()
+{
+    //What is sent from now on waits for the next turn, so that other jobs aren't held up
+    commandRunnerQueued = false;
+    while (!queuedCommands.isEmpty()) {
+        QueuedCommand queued = queuedCommands.dequeue();
+        queued.tag = sendCommand(queued.command, queued.arguments, commandRunner);
+        sentCommands << queued;
+    }
+}
+
+void SessionPrivate::queuedCommandResponse(const Message &response)
+{
+    const QByteArray tag = response.content.first().toString();
+    if (tag == "*") {
+        if (!sentCommands.isEmpty()) {
+            sentCommands.first().result.untaggedResponses << toParts(response);
+        }
+        return;
+    }
+    for (int i = 0; i < sentCommands.size(); ++i) {
+        if (sentCommands.at(i).tag != tag) {
+            continue;
+        }
+        QueuedCommand completed = sentCommands.takeAt(i);
+        if (response.content.size() >= 2) {
+            completed.result.status = response.content[1].toString();
+            QList<Message::Part> text = response.content.mid(2);
+            completed.result.text = joinParts(text);
+            if (!response.responseCode.isEmpty()) {
+                completed.result.text.prepend('[' + joinParts(response.responseCode) + "] ");
+            }
+        }
+        if (completed.callback) {
+            completed.callback(completed.result);
+        }
+        break;
+    }
+    if (sentCommands.isEmpty() && currentJob == commandRunner) {
+        jobDone(commandRunner);
+    }
+}
+
+void SessionPrivate::failQueuedCommands()
+{
+    //Nothing will complete anymore, including what waits for the next turn
+    QList<QueuedCommand> failed = sentCommands;
+    failed += queuedCommands;
+    sentCommands.clear();
+    queuedCommands.clear();
+    if (commandRunnerQueued) {
+        commandRunnerQueued = false;
+        queue.remove(commandRunner);
+    }
+    foreach (const QueuedCommand &command, failed) {
+        if (command.callback) {
+            command.callback(command.result);
+        }
+    }
+    if (currentJob == commandRunner || pipelinedJobs.contains(commandRunner)) {
+        jobDone(commandRunner);
+    }
+}
+
+bool SessionPrivate::cancelQueuedJob(Job *job)
+{
+    if (!queue.remove(job)) {
+        return false;
+    }
+    QObject::disconnect(job, Q_NULLPTR, this, Q_NULLPTR);
+    forgetJob(job);
+    emitJobQueueSizeChanged();
+    return true;
+}
+
+bool SessionPrivate::isOnlyJob(Job *job) const
+{
+    return currentJob == job && pipelinedJobs.isEmpty() && queue.isEmpty();
+}
+
+qint64 SessionPrivate::literalBytesPending() const
+{
+    return stream->literalBytesPending();
+}
+
+void SessionPrivate::startFollowUp(Job *job)
+{
+    if (job != currentJob || !pipelinedJobs.isEmpty()) {
+        return;
+    }
+    followUpOf = job;
+    //Directly, so that both commands go out with the same write
+    doStartNext();
+}
+
+void SessionPrivate::startNext()
+{
+    QMetaObject::invokeMethod(this, "doStartNext");
+}
+
+void SessionPrivate::doStartNext()
+{
+    //Wait until we are ready to process
+    if (queue.isEmpty()
+        || (jobRunning && !canPipelineNext())
+        || socket->state() == QSslSocket::ConnectingState
+        || socket->state() == QSslSocket::HostLookupState
+        //The socket only connects once an address won the race
+        || hostConnector->isRunning()
+        || reconnectTimer.isActive()
+        || (reconnecting && !reconnectLogin)) {
+        return;
+    }
+
+    Job *job = queue.dequeue();
+    {
+        QMutexLocker locker(&publicMutex);
+        metrics.jobsStarted++;
+        metrics.queueWaitTime += commandTimer.elapsed() - job->d_ptr->queuedAt;
+    }
+
+    //Since we aren't connecting we may never get back. Cancel the job
+    if (socket->state() == QSslSocket::UnconnectedState) {
+        qCDebug(KIMAP2_LOG) << "Cancelling job due to lack of connection: " << job->metaObject()->className();
+        if (jobRunning) {
+            pipelinedJobs << job;
+        } else {
+            currentJob = job;
+        }
+        job->connectionLost();
+        return;
+    }
+
+    if (jobCoalescing && job->d_ptr->coalesce && !job->d_ptr->suspended) {
+        int coalesced = 0;
+        //Jobs queued while another mailbox was selected meant that one
+        while (!queue.isEmpty() && !queue.head()->d_ptr->suspended
+                && queue.head()->d_ptr->queuedMailBox == job->d_ptr->queuedMailBox && job->d_ptr->coalesce(queue.head())) {
+            queue.dequeue()->d_ptr->coalescedInto = job;
+            ++coalesced;
+        }
+        if (coalesced) {
+            qCDebug(KIMAP2_LOG) << "Coalesced" << coalesced << "jobs into: " << job->metaObject()->className();
+            emitJobQueueSizeChanged();
+        }
+    }
+
+    if (jobRunning) {
+        //Send the command right away, the server answers it after the running ones
+        qCDebug(KIMAP2_LOG) << "Pipelining job: " << job->metaObject()->className();
+        pipelinedJobs << job;
+        if (SessionObserver *o = observer.load()) {
+            o->jobStarted(job);
+        }
+        job->doStart();
+        startNext();
+        return;
+    }
+
+    if (job->d_ptr->suspended && !job->d_ptr->suspendedMailBox.isEmpty()
+            && job->d_ptr->suspendedMailBox != currentMailBox) {
+        //One of the jobs that went first selected another mailbox
+        queue.prepend(job);
+        SelectJob *select = new SelectJob(q);
+        select->setMailBox(QString::fromUtf8(job->d_ptr->suspendedMailBox));
+        select->d_ptr->queuedAt = commandTimer.elapsed();
+        //Without its mailbox the job can't continue, and selecting again would fail the same way
+        QPointer<Job> suspended(job);
+        QObject::connect(select, &KJob::result, this, [this, suspended, select]() {
+            if (!select->error() || !suspended || !queue.contains(suspended.data())) {
+                return;
+            }
+            queue.remove(suspended.data());
+            QObject::disconnect(suspended.data(), Q_NULLPTR, this, Q_NULLPTR);
+            forgetJob(suspended.data());
+            suspended->setError(select->error());
+            suspended->setErrorText(QStringLiteral("%1 failed, its mailbox can't be selected again: %2")
+                                    .arg(suspended->d_ptr->m_name, select->errorText()));
+            emitJobQueueSizeChanged();
+            suspended->emitResult();
+        });
+        QObject::connect(select, &KJob::result, this, &SessionPrivate::jobDone);
+        QObject::connect(select, &QObject::destroyed, this, &SessionPrivate::jobDestroyed);
+        job = select;
+    }
+
+    currentJob = job;
+    currentJobReceivedFrom = stream->bytesRead();
+    if (trackTime) {
+        time.start();
+    }
+    restartSocketTimer();
+    jobRunning = true;
+    stream->setListObserver(currentJob->d_ptr->listObserver);
+    if (SessionObserver *o = observer.load()) {
+        o->jobStarted(currentJob);
+    }
+    if (currentJob->d_ptr->suspended) {
+        currentJob->d_ptr->suspended = false;
+        currentJob->d_ptr->resume();
+    } else {
+        currentJob->doStart();
+    }
+    if (pipelining) {
+        startNext();
+    }
+}
+
+bool SessionPrivate::canPipelineNext() const
+{
+    //Limit how far we get ahead of the server
+    static const int maximumPipelineDepth = 32;
+    if (currentJob && currentJob == followUpOf && pipelinedJobs.isEmpty()) {
+        return true;
+    }
+    return pipelining
+           && currentJob
+           && currentJob->d_ptr->pipelineSafe
+           && queue.head()->d_ptr->pipelineSafe
+           && pipelinedJobs.size() < maximumPipelineDepth;
+}
+
+void SessionPrivate::jobDone(KJob *job)
+{
+    qCDebug(KIMAP2_LOG) << "Job done: " << job->metaObject()->className();
+
+    if (static_cast<Job *>(job)->d_ptr->coalescedInto) {
+        //It never ran on its own
+        forgetJob(static_cast<Job *>(job));
+        return;
+    }
+
+    if (job != currentJob) {
+        Q_ASSERT(pipelinedJobs.contains(static_cast<Job *>(job)));
+        forgetJob(static_cast<Job *>(job));
+        pipelinedJobs.removeAll(static_cast<Job *>(job));
+        emitJobQueueSizeChanged();
+        startNext();
+        return;
+    }
+
+    stopSocketTimer();
+
+    forgetJob(static_cast<Job *>(job));
+    jobRunning = false;
+    currentJob = Q_NULLPTR;
+    stream->setListObserver(ImapStreamParser::ListObserver());
+    if (!pipelinedJobs.isEmpty()) {
+        //The next pipelined job is already running, it only takes over the untagged responses
+        currentJob = pipelinedJobs.takeFirst();
+        currentJobReceivedFrom = stream->bytesRead();
+        jobRunning = true;
+        restartSocketTimer();
+    }
+    emitJobQueueSizeChanged();
+    startNext();
+}
+
+void SessionPrivate::jobDestroyed(QObject *job)
+{
+    queue.remove(static_cast<KIMAP2::Job *>(job));
+    pipelinedJobs.removeAll(static_cast<KIMAP2::Job *>(job));
+    forgetJob(static_cast<KIMAP2::Job *>(job));
+    if (currentJob == job) {
+        currentJob = Q_NULLPTR;
+        stream->setListObserver(ImapStreamParser::ListObserver());
+        if (!pipelinedJobs.isEmpty()) {
+            currentJob = pipelinedJobs.takeFirst();
+        }
+    }
+}
+
+void SessionPrivate::trafficReceived(const char *data, int size)
 {
     if (dumpTraffic) {
-        qCInfo(KIMAP2_LOG) << "S: " << QString::fromLatin1(response.toString());
+        qCInfo(KIMAP2_LOG) << "S: " << QString::fromLatin1(data, size).trimmed();
+    }
+    if (logger && (logger->isCapture() || q->isConnected())) {
+        logger->dataReceived(data, size);
+    }
+}
+
+void SessionPrivate::responseReceived(const Message &response)
+{
+    QByteArray tag;
+    ImapKeyword code = ImapKeyword::None;
+
+    if (response.content.size() >= 1) {
+        tag = response.content[0].toString();
+    }
+
+    if (response.content.size() >= 2) {
+        code = response.content[1].keyword();
+    }
+
+    updateCapabilities(response);
+    if (code == ImapKeyword::Enabled && tag == "*") {
+        updateEnabledExtensions(response);
+    }
+    if (tag == "*" && response.responseCode.size() >= 2
+            && response.responseCode.first().keyword() == ImapKeyword::UidValidity) {
+        selectedUidValidity = response.responseCode[1].toString().toLongLong();
+    }
+    if (selectState.valid && tag == "*") {
+        updateSelectState(response);
+    }
+    //UIDONLY (RFC 9586) leaves nothing to map
+    if (sequenceMapEnabled && tag == "*" && !isExtensionEnabled("UIDONLY")) {
+        updateSequenceMap(response);
+    }
+
+    PendingCommand command;
+    if (tag != "*" && tag != "+") {
+        command = pendingCommands.take(tag);
+        if (command.isValid()) {
+            recordCompletion(command, code == ImapKeyword::Ok);
+            if (SessionObserver *o = observer.load()) {
+                o->commandCompleted(tag, command.command, response.content.size() >= 2 ? response.content[1].toString() : QByteArray());
+            }
+            if (trackTime) {
+                qCDebug(KIMAP2_LOG) << "Command" << tag << "completed after" << commandTimer.elapsed() - command.sentAt << "ms";
+            }
+        }
+    }
+
+    // BYE may arrive as part of a LOGOUT sequence or before the server closes the connection after an error.
+    // In any case we should wait until the server closes the connection, so we don't have to do anything.
+    if (code == ImapKeyword::Bye) {
+        Message simplified = response;
+        if (simplified.content.size() >= 2) {
+            simplified.content.removeFirst(); // Strip the tag
+            simplified.content.removeFirst(); // Strip the code
+        }
+        qCDebug(KIMAP2_LOG) << "Received BYE: " << simplified.toString();
+        return;
+    }
+
+    switch (state) {
+    case Session::Disconnected:
+        stopSocketTimer();
+        if (code == ImapKeyword::Ok) {
+            Message simplified = response;
+            simplified.content.removeFirst(); // Strip the tag
+            simplified.content.removeFirst(); // Strip the code
+            setGreeting(simplified.toString().trimmed()); // Save the server greeting
+            setState(Session::NotAuthenticated);
+        } else if (code == ImapKeyword::Preauth) {
+            Message simplified = response;
+            simplified.content.removeFirst(); // Strip the tag
+            simplified.content.removeFirst(); // Strip the code
+            setGreeting(simplified.toString().trimmed()); // Save the server greeting
+            setState(Session::Authenticated);
+        } else {
+            //We have been rejected
+            closeSocket();
+        }
+        return;
+    case Session::NotAuthenticated:
+        if (code == ImapKeyword::Ok && command.transition == PendingCommand::Authenticate) {
+            //Servers announce other capabilities once authenticated, those from before are stale
+            if (!capabilitiesAnnounced) {
+                setCapabilities(QStringList());
+            }
+            setState(Session::Authenticated);
+        }
+        break;
+    case Session::Authenticated:
+        if (code == ImapKeyword::Ok && command.transition == PendingCommand::Select) {
+            setState(Session::Selected);
+            setCurrentMailBox(command.mailBox);
+        }
+        break;
+    case Session::Selected:
+        if ((code == ImapKeyword::Ok && command.transition == PendingCommand::Close) ||
+                (code != ImapKeyword::Ok && command.transition == PendingCommand::Select)) {
+            setState(Session::Authenticated);
+            setCurrentMailBox(QByteArray());
+        } else if (code == ImapKeyword::Ok && command.transition == PendingCommand::Select) {
+            setCurrentMailBox(command.mailBox);
+        }
+        break;
+    }
+
+    // Tagged responses go to the job that sent the command, untagged ones to whoever is interested
+    Job *job = command.job;
+    if (!job) {
+        job = tag == "*" ? untaggedResponseHandler(response) : currentJob;
+    }
+    if (job && job == currentJob && maximumResponseBytes && tag == "*"
+            && stream->bytesRead() - currentJobReceivedFrom > maximumResponseBytes) {
+        exceedLimit(job, QStringLiteral("a response of more than %1 bytes").arg(maximumResponseBytes));
+    }
+    if (job && job->d_ptr->limitExceeded && tag != "+") {
+        restartSocketTimer();
+        if (command.job == job && std::none_of(pendingCommands.constBegin(), pendingCommands.constEnd(), [job](const PendingCommand &pending) {
+                return pending.job == job;
+            })) {
+            //The last of its commands completed
+            job->d_ptr->tags.clear();
+            job->emitResult();
+        }
+        return;
+    }
+    if (job) {
+        restartSocketTimer();
+        if (response.isBorrowed() && !job->d_ptr->handlesBorrowedResponses) {
+            job->handleResponse(response.detached());
+        } else {
+            job->handleResponse(response);
+        }
+    } else if (tag != "*" || !reportUnsolicited(response)) {
+        //Formatting the response is expensive, so only when somebody reads it
+        qCDebug(KIMAP2_LOG) << "A message was received from the server with no job to handle it:"
+                            << response.toString()
+                            << '(' + response.toString().toHex() + ')';
+    }
+}
+
+bool SessionPrivate::reportUnsolicited(const Message &response)
+{
+    ImapSet vanished;
+    bool earlier = false;
+    if (JobPrivate::parseVanished(response, &vanished, &earlier)) {
+        if (!earlier) {
+            emit q->selectedMessagesVanished(vanished);
+        }
+        return true;
+    }
+    if (response.content.size() < 3) {
+        return false;
+    }
+    switch (response.content[2].keyword()) {
+    case ImapKeyword::Exists:
+        emit q->selectedMessageCountChanged(response.content[1].toString().toLongLong());
+        return true;
+    case ImapKeyword::Expunge:
+        //The sequence map was updated already
+        emit q->selectedMessageExpunged(response.content[1].toString().toLongLong(), sequenceMap.expungedUid);
+        return true;
+    case ImapKeyword::Fetch:
+    case ImapKeyword::UidFetch: {
+        JobPrivate::MessageUpdate update;
+        if (!JobPrivate::parseMessageUpdate(response, &update)) {
+            return false;
+        }
+        if (!update.uid && update.sequenceNumber) {
+            update.uid = q->uidForSequenceNumber(update.sequenceNumber);
+        }
+        emit q->selectedMessageFlagsChanged(update.sequenceNumber, update.uid, update.flags, update.modSeq);
+        return true;
+    }
+    case ImapKeyword::Recent:
+        //Nothing to do about it without a job
+        return true;
+    default:
+        return false;
+    }
+}
+
+void SessionPrivate::malformedResponseReceived(const Message &partial, const QString &reason)
+{
+    qCWarning(KIMAP2_LOG) << "Dropped a malformed response:" << reason;
+    qCDebug(KIMAP2_LOG) << "Parsed so far: " << partial.toString();
+    const QByteArray tag = partial.content.isEmpty() ? QByteArray() : partial.content[0].toString();
+    const PendingCommand command = (tag != "*" && tag != "+") ? pendingCommands.value(tag) : PendingCommand();
+    Job *job = command.job ? command.job : untaggedResponseHandler(partial);
+    if (job) {
+        emit job->warning(job, QStringLiteral("Dropped a malformed response from the server (%1): %2")
+                          .arg(reason, QString::fromUtf8(partial.toString())));
+    }
+    completeDroppedResponse(partial, tag, command);
+}
+
+void SessionPrivate::limitedResponseReceived(const Message &partial, const QString &reason)
+{
+    const QByteArray tag = partial.content.isEmpty() ? QByteArray() : partial.content[0].toString();
+    const PendingCommand command = (tag != "*" && tag != "+") ? pendingCommands.value(tag) : PendingCommand();
+    Job *job = command.job ? command.job : untaggedResponseHandler(partial);
+    if (job && job != commandRunner) {
+        exceedLimit(job, reason);
+    } else {
+        qCWarning(KIMAP2_LOG) << "Dropped a response:" << reason << "exceeds the parse limits";
+    }
+    completeDroppedResponse(partial, tag, command);
+}
+
+void SessionPrivate::completeDroppedResponse(const Message &partial, const QByteArray &tag, const PendingCommand &command)
+{
+    if (!command.isValid() || partial.content.size() < 2) {
+        return;
     }
-    if (logger && q->isConnected()) {
-        logger->dataReceived(response.toString());
+    const ImapKeyword code = partial.content[1].keyword();
+    if (code == ImapKeyword::Ok || code == ImapKeyword::No || code == ImapKeyword::Bad) {
+        //The command completes without the text that couldn't be parsed
+        Message completion;
+        const QByteArray &status = partial.content[1].toString();
+        completion.content << Message::Part(QByteArray(tag.constData(), tag.size()))
+                           << Message::Part(QByteArray(status.constData(), status.size()), code);
+        responseReceived(completion);
     }
+}
 
-    QByteArray tag;
-    QByteArray code;
+Job *SessionPrivate::untaggedResponseHandler(const Message &response) const
+{
+    if (pipelinedJobs.isEmpty()) {
+        return currentJob;
+    }
+    if (currentJob && currentJob->d_ptr->isInterestedIn && currentJob->d_ptr->isInterestedIn(response)) {
+        return currentJob;
+    }
+    for (Job *job : pipelinedJobs) {
+        if (job->d_ptr->isInterestedIn && job->d_ptr->isInterestedIn(response)) {
+            return job;
+        }
+    }
+    return currentJob;
+}
 
-    if (response.content.size() >= 1) {
-        tag = response.content[0].toString();
+void SessionPrivate::forgetJob(Job *job)
+{
+    if (followUpOf == job) {
+        followUpOf = Q_NULLPTR;
+    }
+    if (readingPausedBy == job) {
+        //Nobody waits for the consumer anymore
+        readingPausedBy = Q_NULLPTR;
+        stream->setPaused(false);
+        QMetaObject::invokeMethod(this, "readMessage", Qt::QueuedConnection);
+    }
+    //Late completions still change the state, but go to the current job
+    for (auto it = pendingCommands.begin(); it != pendingCommands.end();) {
+        if (it->job != job) {
+            ++it;
+        } else if (it->transition == PendingCommand::NoTransition) {
+            it = pendingCommands.erase(it);
+        } else {
+            it->job = Q_NULLPTR;
+            ++it;
+        }
     }
+}
 
-    if (response.content.size() >= 2) {
-        code = response.content[1].toString();
+void SessionPrivate::setState(Session::State s)
+{
+    if (s != Session::Selected) {
+        selectState = SelectState();
+        selectedUidValidity = -1;
+        clearSequenceMap();
+    }
+    if (s != state) {
+        Session::State oldState = state;
+        {
+            QMutexLocker locker(&publicMutex);
+            state = s;
+        }
+        emit q->stateChanged(state, oldState);
     }
+}
 
-    // BYE may arrive as part of a LOGOUT sequence or before the server closes the connection after an error.
-    // In any case we should wait until the server closes the connection, so we don't have to do anything.
-    if (code == "BYE") {
-        Message simplified = response;
-        if (simplified.content.size() >= 2) {
-            simplified.content.removeFirst(); // Strip the tag
-            simplified.content.removeFirst(); // Strip the code
+void SessionPrivate::setGreeting(const QByteArray &newGreeting)
+{
+    QMutexLocker locker(&publicMutex);
+    greeting = newGreeting;
+}
+
+void SessionPrivate::setCurrentMailBox(const QByteArray &mailBox)
+{
+    if (mailBox != currentMailBox) {
+        selectState = SelectState();
+    }
+    QMutexLocker locker(&publicMutex);
+    currentMailBox = mailBox;
+}
+
+void SessionPrivate::rememberSelect(const SelectState &select)
+{
+    if (selectCacheEnabled && state == Session::Selected) {
+        selectState = select;
+        selectState.valid = true;
+    }
+}
+
+//@cond PRIVATE
+template<typename T>
+static bool lookupCachedInfo(const QHash<QString, SessionPrivate::CachedInfo<T> > &cache, const QString &mailBox,
+                             qint64 now, int timeout, T *value)
+{
+    const auto cached = cache.constFind(mailBox);
+    if (!timeout || cached == cache.constEnd() || now - cached->storedAt >= timeout * 1000LL) {
+        return false;
+    }
+    *value = cached->value;
+    return true;
+}
+//@endcond
+
+void SessionPrivate::rememberMyRights(const QString &mailBox, Acl::Rights rights)
+{
+    if (mailBoxInfoCacheTimeout) {
+        cachedMyRightsByMailBox.insert(mailBox, {rights, commandTimer.elapsed()});
+    }
+}
+
+bool SessionPrivate::cachedMyRights(const QString &mailBox, Acl::Rights *rights) const
+{
+    return lookupCachedInfo(cachedMyRightsByMailBox, mailBox, commandTimer.elapsed(), mailBoxInfoCacheTimeout, rights);
+}
+
+void SessionPrivate::rememberAcl(const QString &mailBox, const QMap<QByteArray, Acl::Rights> &rights)
+{
+    if (mailBoxInfoCacheTimeout) {
+        cachedAclsByMailBox.insert(mailBox, {rights, commandTimer.elapsed()});
+    }
+}
+
+bool SessionPrivate::cachedAcl(const QString &mailBox, QMap<QByteArray, Acl::Rights> *rights) const
+{
+    return lookupCachedInfo(cachedAclsByMailBox, mailBox, commandTimer.elapsed(), mailBoxInfoCacheTimeout, rights);
+}
+
+void SessionPrivate::rememberQuotaRoot(const QString &mailBox, const QuotaRootState &quotaRoot)
+{
+    if (mailBoxInfoCacheTimeout) {
+        cachedQuotaRootsByMailBox.insert(mailBox, {quotaRoot, commandTimer.elapsed()});
+    }
+}
+
+bool SessionPrivate::cachedQuotaRoot(const QString &mailBox, QuotaRootState *quotaRoot) const
+{
+    return lookupCachedInfo(cachedQuotaRootsByMailBox, mailBox, commandTimer.elapsed(), mailBoxInfoCacheTimeout, quotaRoot);
+}
+
+void SessionPrivate::forgetMailBoxInfo(const QString &mailBox)
+{
+    cachedMyRightsByMailBox.remove(mailBox);
+    cachedAclsByMailBox.remove(mailBox);
+    cachedQuotaRootsByMailBox.remove(mailBox);
+}
+
+void SessionPrivate::forgetQuotaRoot(const QByteArray &root)
+{
+    for (auto it = cachedQuotaRootsByMailBox.begin(); it != cachedQuotaRootsByMailBox.end();) {
+        if (it->value.roots.contains(root)) {
+            it = cachedQuotaRootsByMailBox.erase(it);
+        } else {
+            ++it;
         }
-        qCDebug(KIMAP2_LOG) << "Received BYE: " << simplified.toString();
+    }
+}
+
+void SessionPrivate::clearMailBoxInfo()
+{
+    cachedMyRightsByMailBox.clear();
+    cachedAclsByMailBox.clear();
+    cachedQuotaRootsByMailBox.clear();
+}
+
+SelectState SessionPrivate::cachedSelect(const QString &mailBox, bool readOnly, bool condstoreEnabled) const
+{
+    if (!selectState.valid || state != Session::Selected || selectState.mailBox != mailBox
+            || selectState.readOnly != readOnly || selectState.condstoreEnabled != condstoreEnabled) {
+        return SelectState();
+    }
+    return selectState;
+}
+
+void SessionPrivate::updateSelectState(const Message &response)
+{
+    if (response.content.size() < 3) {
+        return;
+    }
+    const ImapKeyword code = response.content[1].keyword();
+    if (code == ImapKeyword::Ok) {
+        if (response.responseCode.size() < 2) {
+            return;
+        }
+        const QByteArray value = response.responseCode[1].toString();
+        switch (response.responseCode[0].keyword()) {
+        case ImapKeyword::PermanentFlags:
+            selectState.permanentFlags = response.responseCode[1].toList();
+            break;
+        case ImapKeyword::HighestModSeq:
+            selectState.highestModSequence = qMax(selectState.highestModSequence, value.toULongLong());
+            break;
+        case ImapKeyword::UidNext:
+            selectState.nextUid = value.toLongLong();
+            break;
+        case ImapKeyword::UidValidity:
+            if (value.toLongLong() != selectState.uidValidity) {
+                selectState = SelectState();
+            }
+            break;
+        default:
+            break;
+        }
+        return;
+    }
+    if (code == ImapKeyword::Flags) {
+        selectState.flags = response.content[2].toList();
+        return;
+    }
+    if (code == ImapKeyword::Vanished) {
+        selectState = SelectState();
         return;
     }
 
-    switch (state) {
-    case Session::Disconnected:
-        stopSocketTimer();
-        if (code == "OK") {
-            Message simplified = response;
-            simplified.content.removeFirst(); // Strip the tag
-            simplified.content.removeFirst(); // Strip the code
-            greeting = simplified.toString().trimmed(); // Save the server greeting
-            setState(Session::NotAuthenticated);
-        } else if (code == "PREAUTH") {
-            Message simplified = response;
-            simplified.content.removeFirst(); // Strip the tag
-            simplified.content.removeFirst(); // Strip the code
-            greeting = simplified.toString().trimmed(); // Save the server greeting
-            setState(Session::Authenticated);
+    bool isInt;
+    const int number = response.content[1].toString().toInt(&isInt);
+    if (!isInt) {
+        return;
+    }
+    switch (response.content[2].keyword()) {
+    case ImapKeyword::Exists:
+        if (number > selectState.messageCount) {
+            //We don't know the UIDs of the new messages
+            selectState = SelectState();
         } else {
-            //We have been rejected
-            closeSocket();
+            selectState.messageCount = number;
+        }
+        break;
+    case ImapKeyword::Recent:
+        selectState.recentCount = number;
+        break;
+    case ImapKeyword::Expunge:
+        selectState.messageCount--;
+        break;
+    case ImapKeyword::Fetch:
+    case ImapKeyword::UidFetch:
+        if (response.content[2].keyword() == ImapKeyword::UidFetch) {
+            // * 117 UIDFETCH (FLAGS ...), with UIDONLY (RFC 9586)
+            selectState.nextUid = qMax(selectState.nextUid, response.content[1].toString().toLongLong() + 1);
+        }
+        if (response.content.size() >= 4 && response.content[3].type() == Message::Part::List) {
+            const Message::Part &items = response.content[3];
+            const QList<QByteArray> list = items.toList();
+            for (int i = 0; i + 1 < list.size(); i += 2) {
+                const ImapKeyword item = items.keywordAt(i);
+                if (item == ImapKeyword::Uid) {
+                    selectState.nextUid = qMax(selectState.nextUid, list.at(i + 1).toLongLong() + 1);
+                } else if (item == ImapKeyword::ModSeq) {
+                    // MODSEQ (12345)
+                    const QByteArray value = list.at(i + 1).mid(1, list.at(i + 1).size() - 2);
+                    selectState.highestModSequence = qMax(selectState.highestModSequence, value.toULongLong());
+                }
+            }
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static bool isUidSearchAll(const QByteArray &command, const QByteArray &args)
+{
+    if (command != "UID SEARCH") {
+        return false;
+    }
+    // ALL, or RETURN (... ALL ...) ALL
+    QByteArray criteria = args;
+    if (args.startsWith("RETURN (")) {
+        const int end = args.indexOf(')');
+        if (end < 0 || !args.mid(8, end - 8).split(' ').contains("ALL")) {
+            return false;
+        }
+        criteria = args.mid(end + 1).trimmed();
+    }
+    return criteria == "ALL";
+}
+
+void SessionPrivate::clearSequenceMap()
+{
+    QMutexLocker locker(&publicMutex);
+    sequenceMap = SequenceMap();
+}
+
+void SessionPrivate::seedSequenceMap(QVector<quint32> uids)
+{
+    //SEARCH doesn't promise any order, but the sequence numbers follow the UIDs
+    std::sort(uids.begin(), uids.end());
+    QMutexLocker locker(&publicMutex);
+    sequenceMap.uids = uids;
+    sequenceMap.counted = true;
+    sequenceMap.unknown = 0;
+}
+
+void SessionPrivate::updateSequenceMap(const Message &response)
+{
+    if (response.content.size() < 2) {
+        return;
+    }
+    const ImapKeyword code = response.content[1].keyword();
+    if (code == ImapKeyword::Search) {
+        //SEARCH has no correlator, so the search that lists all UIDs has to be the only one
+        int searches = 0;
+        bool seeds = false;
+        for (const PendingCommand &pending : pendingCommands) {
+            if (pending.command.endsWith("SEARCH")) {
+                searches++;
+                seeds = pending.listsAllUids;
+            }
+        }
+        if (searches == 1 && seeds) {
+            QVector<quint32> uids;
+            uids.reserve(response.content.size() - 2);
+            for (int i = 2; i < response.content.size(); i++) {
+                uids << response.content[i].toString().toUInt();
+            }
+            seedSequenceMap(uids);
         }
         return;
-    case Session::NotAuthenticated:
-        if (code == "OK" && tag == authTag) {
-            setState(Session::Authenticated);
+    }
+    if (code == ImapKeyword::ESearch) {
+        // * ESEARCH (TAG "A000001") UID ALL 2,10:11, without ALL if nothing matched
+        if (response.content.size() < 3 || response.content[2].type() != Message::Part::List) {
+            return;
+        }
+        const QList<QByteArray> correlator = response.content[2].toList();
+        if (correlator.size() != 2 || correlator[0].toUpper() != "TAG"
+                || !pendingCommands.value(correlator[1]).listsAllUids) {
+            return;
+        }
+        int exists;
+        {
+            QMutexLocker locker(&publicMutex);
+            if (!sequenceMap.counted) {
+                //No EXISTS since the map was reset, there is nothing to bound the ranges with
+                return;
+            }
+            //Every EXISTS resized the map, so it has an entry for each message
+            exists = sequenceMap.uids.size();
+        }
+        QVector<quint32> uids;
+        for (int i = 3; i + 1 < response.content.size(); i++) {
+            if (response.content[i].toString().toUpper() != "ALL") {
+                continue;
+            }
+            const ImapSet all = ImapSet::fromImapSequenceSet(response.content[i + 1].toString());
+            for (const ImapInterval &interval : all.intervals()) {
+                //A range up to * lists no UIDs, the server is broken
+                if (!interval.hasDefinedEnd()) {
+                    qCWarning(KIMAP2_LOG) << "Not seeding the UID map from an open range in" << response.toString();
+                    return;
+                }
+                //No more UIDs than there are messages, however large the ranges are
+                for (qint64 uid = interval.begin(); uid <= interval.end() && uids.size() < exists; uid++) {
+                    uids << quint32(uid);
+                }
+            }
+        }
+        seedSequenceMap(uids);
+        return;
+    }
+    if (code == ImapKeyword::Vanished) {
+        // * VANISHED 41,43:116, not the EARLIER ones that were gone before the SELECT
+        if (response.content.size() < 3 || response.content[2].type() == Message::Part::List) {
+            return;
+        }
+        QMutexLocker locker(&publicMutex);
+        if (sequenceMap.unknown) {
+            //Some of the messages we don't know may be gone as well
+            sequenceMap = SequenceMap();
+            return;
+        }
+        const ImapSet vanished = ImapSet::fromImapSequenceSet(response.content.last().toString());
+        QVector<quint32> &uids = sequenceMap.uids;
+        uids.erase(std::remove_if(uids.begin(), uids.end(), [&vanished](quint32 uid) {
+            return vanished.contains(uid);
+        }), uids.end());
+        return;
+    }
+    if (response.content.size() < 3) {
+        return;
+    }
+
+    bool isInt;
+    const int number = response.content[1].toString().toInt(&isInt);
+    if (!isInt || number < 0 || (number == 0 && response.content[2].keyword() != ImapKeyword::Exists)) {
+        return;
+    }
+    QMutexLocker locker(&publicMutex);
+    QVector<quint32> &uids = sequenceMap.uids;
+    switch (response.content[2].keyword()) {
+    case ImapKeyword::Exists:
+        if (number > uids.size()) {
+            sequenceMap.unknown += number - uids.size();
+            uids.resize(number);
         }
+        sequenceMap.counted = true;
         break;
-    case Session::Authenticated:
-        if (code == "OK" && tag == selectTag) {
-            setState(Session::Selected);
-            currentMailBox = upcomingMailBox;
+    case ImapKeyword::Expunge:
+        sequenceMap.expungedUid = 0;
+        if (number <= uids.size()) {
+            sequenceMap.expungedUid = uids.at(number - 1);
+            if (!sequenceMap.expungedUid) {
+                sequenceMap.unknown--;
+            }
+            uids.remove(number - 1);
         }
         break;
-    case Session::Selected:
-        if ((code == "OK" && tag == closeTag) ||
-                (code != "OK" && tag == selectTag)) {
-            setState(Session::Authenticated);
-            currentMailBox = QByteArray();
-        } else if (code == "OK" && tag == selectTag) {
-            currentMailBox = upcomingMailBox;
+    case ImapKeyword::Fetch:
+        if (response.content.size() >= 4 && response.content[3].type() == Message::Part::List) {
+            const Message::Part &items = response.content[3];
+            const QList<QByteArray> list = items.toList();
+            for (int i = 0; i + 1 < list.size(); i += 2) {
+                if (items.keywordAt(i) != ImapKeyword::Uid) {
+                    continue;
+                }
+                if (number > uids.size()) {
+                    //Before the EXISTS that announces it, or the map was dropped
+                    sequenceMap.unknown += number - uids.size();
+                    uids.resize(number);
+                }
+                quint32 &uid = uids[number - 1];
+                if (!uid) {
+                    sequenceMap.unknown--;
+                }
+                uid = list.at(i + 1).toUInt();
+                break;
+            }
         }
         break;
+    default:
+        break;
+    }
+}
+
+void SessionPrivate::updateCapabilities(const Message &response)
+{
+    // Either "* CAPABILITY ..." or a [CAPABILITY ...] response code, e.g. in the greeting
+    QList<Message::Part>::const_iterator it;
+    QList<Message::Part>::const_iterator end;
+    if (response.content.size() >= 2 && response.content[1].keyword() == ImapKeyword::Capability) {
+        it = response.content.constBegin() + 2;
+        end = response.content.constEnd();
+    } else if (!response.responseCode.isEmpty() && response.responseCode.first().keyword() == ImapKeyword::Capability) {
+        it = response.responseCode.constBegin() + 1;
+        end = response.responseCode.constEnd();
+    } else {
+        return;
+    }
+
+    //Every announcement is the complete list
+    QStringList announced;
+    for (; it != end; ++it) {
+        announced << QString::fromLatin1(it->toString().toUpper());
+    }
+    capabilitiesAnnounced = true;
+    setCapabilities(announced);
+}
+
+void SessionPrivate::setCapabilities(const QStringList &list)
+{
+    {
+        QMutexLocker locker(&publicMutex);
+        //Session::hasCapability() reads them from other threads
+        capabilities.clear();
+        foreach (const QString &capability, list) {
+            capabilities.insert(capability.toLatin1());
+        }
+        if (publicCapabilities == list) {
+            return;
+        }
+        publicCapabilities = list;
+    }
+    emit q->capabilitiesChanged(list);
+}
+
+void SessionPrivate::setNamespaces(const QList<MailBoxDescriptor> &personal, const QList<MailBoxDescriptor> &user, const QList<MailBoxDescriptor> &shared)
+{
+    QMutexLocker locker(&publicMutex);
+    namespacesKnown = true;
+    personalNamespaces = personal;
+    userNamespaces = user;
+    sharedNamespaces = shared;
+}
+
+void SessionPrivate::clearNamespaces()
+{
+    QMutexLocker locker(&publicMutex);
+    namespacesKnown = false;
+    personalNamespaces.clear();
+    userNamespaces.clear();
+    sharedNamespaces.clear();
+}
+
+bool SessionPrivate::canSendNonSynchronizingLiteral(qint64 size) const
+{
+    if (capabilities.contains("LITERAL+")) {
+        return true;
+    }
+    //RFC 7888: LITERAL- only covers literals of up to 4096 bytes
+    return capabilities.contains("LITERAL-") && size <= 4096;
+}
+
+qint64 SessionPrivate::appendLimit(const QString &mailBox) const
+{
+    const auto reported = appendLimits.constFind(mailBox);
+    if (reported != appendLimits.constEnd()) {
+        return *reported;
+    }
+    //A plain APPENDLIMIT only says that the limits differ per mailbox
+    foreach (const QByteArray &capability, capabilities) {
+        if (capability.startsWith("APPENDLIMIT=")) {
+            bool ok;
+            const qint64 limit = capability.mid(12).toLongLong(&ok);
+            return ok ? limit : -1;
+        }
+    }
+    return -1;
+}
+
+void SessionPrivate::rememberAppendLimit(const QString &mailBox, qint64 limit)
+{
+    appendLimits.insert(mailBox, limit);
+}
+
+bool SessionPrivate::isExtensionEnabled(const QByteArray &extension) const
+{
+    return enabledExtensions.contains(extension);
+}
+
+bool SessionPrivate::isImap4Rev2() const
+{
+    //A server offering both follows IMAP4rev1 until IMAP4rev2 is enabled
+    return isExtensionEnabled("IMAP4REV2")
+           || (capabilities.contains("IMAP4REV2") && !capabilities.contains("IMAP4REV1"));
+}
+
+bool SessionPrivate::hasCapability(const QByteArray &capability) const
+{
+    //The extensions RFC 9051 made part of the base protocol
+    static const QSet<QByteArray> rev2 = {
+        "NAMESPACE", "UNSELECT", "UIDPLUS", "ESEARCH", "SEARCHRES", "ENABLE", "IDLE", "SASL-IR",
+        "LIST-EXTENDED", "LIST-STATUS", "MOVE", "LITERAL-", "BINARY", "SPECIAL-USE"
+    };
+    return capabilities.contains(capability) || (rev2.contains(capability) && isImap4Rev2());
+}
+
+bool SessionPrivate::hasUtf8MailBoxNames() const
+{
+    return isExtensionEnabled("UTF8=ACCEPT") || isImap4Rev2();
+}
+
+/*
+ * Undoes the escapes of quoteIMAP(), giving the name as the server sends it.
+ */
+static QByteArray unquoted(const QByteArray &quoted)
+{
+    if (!quoted.contains('\\')) {
+        return quoted;
+    }
+    QByteArray result;
+    result.reserve(quoted.size());
+    for (int i = 0; i < quoted.size(); ++i) {
+        if (quoted.at(i) == '\\' && i + 1 < quoted.size()) {
+            ++i;
+        }
+        result += quoted.at(i);
+    }
+    return result;
+}
+
+QString SessionPrivate::decodeMailBoxName(const QByteArray &name)
+{
+    if (!name.contains('&') || hasUtf8MailBoxNames()) {
+        return QString::fromUtf8(name);
+    }
+    if (!mailBoxNameCacheEnabled) {
+        return QString::fromUtf8(KIMAP2::decodeImapFolderName(name));
+    }
+    const auto cached = decodedMailBoxNames.constFind(name);
+    if (cached != decodedMailBoxNames.constEnd()) {
+        return cached.value();
+    }
+    //The name may point into the read buffer
+    const QByteArray encoded(name.constData(), name.size());
+    const QString decoded = QString::fromUtf8(KIMAP2::decodeImapFolderName(encoded));
+    cacheMailBoxName(encoded, KIMAP2::quoteIMAP(encoded), decoded);
+    return decoded;
+}
+
+QByteArray SessionPrivate::encodeMailBoxName(const QString &name)
+{
+    if (hasUtf8MailBoxNames()) {
+        //Quoted strings may hold UTF-8 as they are (RFC 6855, RFC 9051)
+        return KIMAP2::quoteIMAP(name.toUtf8());
+    }
+    if (!mailBoxNameCacheEnabled) {
+        return KIMAP2::encodeImapFolderName(name.toUtf8());
+    }
+    const auto cached = encodedMailBoxNames.constFind(name);
+    if (cached != encodedMailBoxNames.constEnd()) {
+        return cached.value();
+    }
+    const QByteArray quoted = KIMAP2::encodeImapFolderName(name.toUtf8());
+    if (quoted.contains('&')) {
+        cacheMailBoxName(unquoted(quoted), quoted, name);
+    }
+    return quoted;
+}
+
+void SessionPrivate::cacheMailBoxName(const QByteArray &encoded, const QByteArray &quoted, const QString &decoded)
+{
+    //Plenty for the folder lists of most accounts, and starting over is cheap
+    if (decodedMailBoxNames.size() >= 4096) {
+        decodedMailBoxNames.clear();
+        encodedMailBoxNames.clear();
+    }
+    decodedMailBoxNames.insert(encoded, decoded);
+    encodedMailBoxNames.insert(decoded, quoted);
+}
+
+void SessionPrivate::updateEnabledExtensions(const KIMAP2::Message &response)
+{
+    QMutexLocker locker(&publicMutex);
+    for (int i = 2; i < response.content.size(); ++i) {
+        enabledExtensions.insert(response.content[i].toString().toUpper());
+    }
+}
+
+void SessionPrivate::recordCompletion(const PendingCommand &command, bool ok)
+{
+    static const QVector<int> buckets = SessionMetrics::latencyBuckets();
+
+    const qint64 latency = commandTimer.elapsed() - command.sentAt;
+    QMutexLocker locker(&publicMutex);
+    SessionMetrics::Command &stats = metrics.commands[command.command];
+    stats.count++;
+    if (!ok) {
+        stats.failed++;
+    }
+    stats.totalLatency += latency;
+    const int bucket = std::lower_bound(buckets.constBegin(), buckets.constEnd(), latency) - buckets.constBegin();
+    stats.latencyHistogram[bucket]++;
+}
+
+void SessionPrivate::updateMemoryUsage()
+{
+    qint64 writeQueueBytes = socket->bytesToWrite() + socket->encryptedBytesToWrite();
+    for (const OutgoingData &outgoing : dataQueue) {
+        //Streamed data is only read from the device a chunk at a time
+        writeQueueBytes += outgoing.data.size();
+    }
+    memoryUsage.parserBufferCapacity = stream->bufferCapacity();
+    memoryUsage.socketReadBuffer = socket->bytesAvailable();
+    memoryUsage.literalBytes = stream->literalBytesBuffered();
+    memoryUsage.largestLiteral = stream->largestLiteral();
+    memoryUsage.writeQueueBytes = writeQueueBytes;
+    memoryUsage.queuedJobs = queue.size();
+    memoryUsage.inFlightPayloadBytes = currentJob ? stream->bytesRead() - currentJobReceivedFrom : 0;
+}
+
+void SessionPrivate::exceedLimit(Job *job, const QString &what)
+{
+    //The command runner stays with the session, its commands are small anyway
+    if (job->d_ptr->limitExceeded || job == commandRunner) {
+        return;
     }
+    qCWarning(KIMAP2_LOG) << "Memory limit exceeded by" << job->metaObject()->className() << ":" << what;
+    job->d_ptr->limitExceeded = true;
+    job->setError(LimitExceeded);
+    job->setErrorText(QStringLiteral("%1 failed, %2 exceeds the limit of the session.").arg(job->d_ptr->m_name, what));
+    if (readingPausedBy == job) {
+        //Nobody consumes its responses anymore
+        resumeReading(job);
+    }
+}
 
-    if (tag == authTag) {
-        authTag.clear();
+int SessionPrivate::jobQueueSize() const
+{
+    return queue.size() + pipelinedJobs.size() + (jobRunning ? 1 : 0);
+}
+
+void SessionPrivate::emitJobQueueSizeChanged()
+{
+    const int size = jobQueueSize();
+    publicJobQueueSize.store(size);
+    {
+        QMutexLocker locker(&publicMutex);
+        updateMemoryUsage();
     }
-    if (tag == selectTag) {
-        selectTag.clear();
+    emit q->jobQueueSizeChanged(size);
+}
+
+void SessionPrivate::callInSessionThread(const std::function<void()> &call)
+{
+    if (QThread::currentThread() == thread()) {
+        call();
+    } else {
+        QCoreApplication::postEvent(this, new SessionCallEvent(call));
     }
-    if (tag == closeTag) {
-        closeTag.clear();
+}
+
+bool SessionPrivate::event(QEvent *event)
+{
+    if (event->type() == SessionCallEvent::eventType()) {
+        static_cast<SessionCallEvent *>(event)->call();
+        return true;
     }
+    return QObject::event(event);
+}
 
-    // If a job is running forward it the response
-    if (currentJob) {
-        restartSocketTimer();
-        currentJob->handleResponse(response);
+void SessionPrivate::startWorkerThread(Session::ThreadingMode mode)
+{
+    qRegisterMetaType<QList<QSslError> >("QList<QSslError>");
+    qRegisterMetaType<KIMAP2::Session::State>("KIMAP2::Session::State");
+    qRegisterMetaType<QList<QByteArray> >("QList<QByteArray>");
+    qRegisterMetaType<KIMAP2::ImapSet>();
+
+    //Borrowed tokens would reach the owner thread through queued signals while the buffer is reused
+    stream->setZeroCopyEnabled(false);
+
+    if (mode == Session::SharedWorkerThread) {
+        workerThread = ioThreads->acquire();
     } else {
-        qCWarning(KIMAP2_LOG) << "A message was received from the server with no job to handle it:"
-                             << response.toString()
-                             << '(' + response.toString().toHex() + ')';
+        workerThread = new QThread;
+        workerThread->setObjectName(QStringLiteral("KIMAP2 session ") + hostName);
+        ownsWorkerThread = true;
+    }
+    //Objects with a parent can't be moved, the session deletes us explicitly anyway
+    setParent(Q_NULLPTR);
+    moveToThread(workerThread);
+    socket->moveToThread(workerThread);
+    socketTimer.moveToThread(workerThread);
+    reconnectTimer.moveToThread(workerThread);
+    bandwidthTimer.moveToThread(workerThread);
+    if (ownsWorkerThread) {
+        workerThread->start();
     }
 }
 
-void SessionPrivate::setState(Session::State s)
+void SessionPrivate::stopWorkerThread()
 {
-    if (s != state) {
-        Session::State oldState = state;
-        state = s;
-        emit q->stateChanged(state, oldState);
+    if (!workerThread) {
+        return;
+    }
+    //Objects can only be pushed away from the thread they live in
+    QThread *ownerThread = q->thread();
+    QSemaphore moved;
+    callInSessionThread([this, ownerThread, &moved]() {
+        stopSocketTimer();
+        socketTimer.stop();
+        socketTimer.moveToThread(ownerThread);
+        reconnectTimer.stop();
+        reconnectTimer.moveToThread(ownerThread);
+        bandwidthTimer.stop();
+        bandwidthTimer.moveToThread(ownerThread);
+        socket->moveToThread(ownerThread);
+        moveToThread(ownerThread);
+        moved.release();
+    });
+    moved.acquire();
+
+    if (ownsWorkerThread) {
+        workerThread->quit();
+        workerThread->wait();
+        delete workerThread;
+        ownsWorkerThread = false;
+    } else {
+        ioThreads->release(workerThread);
     }
+    workerThread = Q_NULLPTR;
 }
 
-QByteArray SessionPrivate::sendCommand(const QByteArray &command, const QByteArray &args)
+void SessionPrivate::callInOwnerThread(const std::function<void()> &call)
+{
+    if (QThread::currentThread() == ownerCalls->thread()) {
+        call();
+    } else {
+        QCoreApplication::postEvent(ownerCalls.data(), new SessionCallEvent(call));
+    }
+}
+
+QByteArray SessionPrivate::sendCommand(const QByteArray &command, const QByteArray &args, Job *job)
 {
     QByteArray tag = 'A' + QByteArray::number(++tagCount).rightJustified(6, '0');
 
@@ -381,41 +2488,114 @@ QByteArray SessionPrivate::sendCommand(const QByteArray &command, const QByteArr
     }
 
     sendData(payload);
+    if (SessionObserver *o = observer.load()) {
+        o->commandSent(tag, command, payload.size() + 2);
+        tagsAwaitingResponse << tag;
+    }
 
+    PendingCommand pending;
+    pending.job = job;
+    pending.command = command;
+    pending.sentAt = commandTimer.elapsed();
     if (command == "LOGIN" || command == "AUTHENTICATE") {
-        authTag = tag;
+        pending.transition = PendingCommand::Authenticate;
+        capabilitiesAnnounced = false;
     } else if (command == "SELECT" || command == "EXAMINE") {
-        selectTag = tag;
-        upcomingMailBox = args;
-        upcomingMailBox.remove(0, 1);
-        upcomingMailBox = upcomingMailBox.left(upcomingMailBox.indexOf('\"'));
-        upcomingMailBox = KIMAP2::decodeImapFolderName(upcomingMailBox);
+        pending.transition = PendingCommand::Select;
+        pending.mailBox = args;
+        pending.mailBox.remove(0, 1);
+        pending.mailBox = pending.mailBox.left(pending.mailBox.indexOf('\"'));
+        if (!hasUtf8MailBoxNames()) {
+            pending.mailBox = KIMAP2::decodeImapFolderName(pending.mailBox);
+        }
     } else if (command == "CLOSE") {
-        closeTag = tag;
+        pending.transition = PendingCommand::Close;
+    }
+    if (pending.transition == PendingCommand::Select || pending.transition == PendingCommand::Close) {
+        //The responses that follow describe another mailbox, or none
+        selectState = SelectState();
+        selectedUidValidity = -1;
+        clearSequenceMap();
     }
+    pending.listsAllUids = sequenceMapEnabled && isUidSearchAll(command, args);
+    pendingCommands.insert(tag, pending);
     return tag;
 }
 
-void SessionPrivate::sendData(const QByteArray &data)
+void SessionPrivate::sendData(const QByteArray &data, bool endLine)
 {
+    if (QThread::currentThread() != thread()) {
+        callInSessionThread([this, data, endLine]() {
+            sendData(data, endLine);
+        });
+        return;
+    }
+
     restartSocketTimer();
+    {
+        QMutexLocker locker(&publicMutex);
+        metrics.bytesSent += data.size() + (endLine ? 2 : 0);
+    }
 
     if (dumpTraffic) {
         qCInfo(KIMAP2_LOG) << "C: " << data;
     }
-    if (logger && q->isConnected()) {
+    if (logger && (logger->isCapture() || q->isConnected())) {
         logger->dataSent(data);
     }
 
-    dataQueue.enqueue(data + "\r\n");
-    QMetaObject::invokeMethod(this, "writeDataQueue");
+    //Everything sent until we get back to the event loop goes out in one write
+    OutgoingData outgoing;
+    outgoing.data = data;
+    outgoing.endLine = endLine;
+    dataQueue.enqueue(outgoing);
+    if (!writeScheduled) {
+        writeScheduled = true;
+        QMetaObject::invokeMethod(this, "writeDataQueue", Qt::QueuedConnection);
+    }
+}
+
+void SessionPrivate::sendDevice(QIODevice *device, qint64 size, const std::function<void(qint64 written)> &progress, bool endLine)
+{
+    if (QThread::currentThread() != thread()) {
+        callInSessionThread([this, device, size, progress, endLine]() {
+            sendDevice(device, size, progress, endLine);
+        });
+        return;
+    }
+
+    restartSocketTimer();
+    {
+        QMutexLocker locker(&publicMutex);
+        metrics.bytesSent += size + (endLine ? 2 : 0);
+    }
+
+    if (dumpTraffic) {
+        qCInfo(KIMAP2_LOG) << "C: " << size << "bytes from a device";
+    }
+
+    OutgoingData outgoing;
+    outgoing.streamed = true;
+    outgoing.device = device;
+    outgoing.size = size;
+    outgoing.progress = progress;
+    outgoing.endLine = endLine;
+    dataQueue.enqueue(outgoing);
+    if (device && device->isSequential()) {
+        //Nothing to read yet is no error for pipes and sockets
+        connect(device, &QIODevice::readyRead, this, &SessionPrivate::continueWriting, Qt::UniqueConnection);
+    }
+    if (!writeScheduled) {
+        writeScheduled = true;
+        QMetaObject::invokeMethod(this, "writeDataQueue", Qt::QueuedConnection);
+    }
 }
 
 void SessionPrivate::socketConnected()
 {
     qCInfo(KIMAP2_LOG) << "Socket connected.";
     //Detect if the connection is no longer available
-    socket->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+    applySocketOptions();
     startNext();
 }
 
@@ -423,14 +2603,36 @@ void SessionPrivate::socketDisconnected()
 {
     qCInfo(KIMAP2_LOG) << "Socket disconnected.";
     stopSocketTimer();
+    //Nothing that is still pending will complete
+    pendingCommands.clear();
+    tagsAwaitingResponse.clear();
+    dataQueue.clear();
+    setCapabilities(QStringList());
+    {
+        QMutexLocker locker(&publicMutex);
+        enabledExtensions.clear();
+    }
+    appendLimits.clear();
+    //Another connection may well log in as someone else
+    clearNamespaces();
+    clearMailBoxInfo();
+    readingPausedBy = Q_NULLPTR;
+    stream->setPaused(false);
+    if (compression) {
+        qCDebug(KIMAP2_LOG) << "Received" << compression->compressedBytesRead() << "compressed bytes for"
+                            << compression->decompressedBytesRead() << "bytes of data";
+        stream->switchDevice(socket.data());
+        compression.reset();
+    }
 
-    if (logger && q->isConnected()) {
+    if (logger && (logger->isCapture() || q->isConnected())) {
         logger->disconnectionOccured();
     }
 
+    const bool reconnect = canReconnect(q->isConnected());
     if (state != Session::Disconnected) {
         setState(Session::Disconnected);
-    } else {
+    } else if (!reconnect) {
         //If we timeout during host lookup we don't receive an explicit host lookup error
         if (hostLookupInProgress) {
             socketError(QAbstractSocket::HostNotFoundError);
@@ -439,13 +2641,19 @@ void SessionPrivate::socketDisconnected()
         emit q->connectionFailed();
     }
 
+    if (reconnect) {
+        prepareReconnect();
+        return;
+    }
+    dropReconnectJobs();
+    reconnecting = false;
     clearJobQueue();
 }
 
 void SessionPrivate::socketActivity()
 {
     //This slot can be called after the job has already finished, in that case we don't want to restart the timer
-    if (currentJob) {
+    if (currentJob && !readingPausedBy) {
         restartSocketTimer();
     }
 }
@@ -454,13 +2662,20 @@ void SessionPrivate::socketError(QAbstractSocket::SocketError error)
 {
     qCDebug(KIMAP2_LOG) << "Socket error: " << error;
     stopSocketTimer();
+    if (state == Session::Disconnected && HostConnector::isEnabled()) {
+        //The address that was found may not work anymore
+        HostConnector::forget(hostName);
+    }
 
+    for (Job *job : pipelinedJobs) {
+        job->setSocketError(error);
+    }
     if (currentJob) {
         qCWarning(KIMAP2_LOG) << "Socket error:" << error;
         currentJob->setSocketError(error);
-    } else if (!queue.isEmpty()) {
+    } else if (!queue.isEmpty() && !reconnectLogin) {
         qCWarning(KIMAP2_LOG) << "Socket error:" << error;
-        currentJob = queue.takeFirst();
+        currentJob = queue.dequeue();
         currentJob->setSocketError(error);
     }
 
@@ -469,23 +2684,206 @@ void SessionPrivate::socketError(QAbstractSocket::SocketError error)
 
 void SessionPrivate::clearJobQueue()
 {
+    const QList<Job *> pipelined = pipelinedJobs; // copy because jobDone removes them
+    for (Job *job : pipelined) {
+        job->connectionLost();
+    }
     if (!currentJob && !queue.isEmpty()) {
-        currentJob = queue.takeFirst();
+        currentJob = queue.dequeue();
     }
     if (currentJob) {
         currentJob->connectionLost();
     }
 
-    QQueue<Job *> queueCopy = queue; // copy because jobDestroyed calls removeAll
+    if (queue.contains(commandRunner)) {
+        failQueuedCommands();
+    }
+    QList<Job *> queueCopy = queue.toList(); // copy because jobDestroyed calls remove
+    queueCopy.removeAll(commandRunner); // it stays with the session
     qDeleteAll(queueCopy);
     queue.clear();
-    emit q->jobQueueSizeChanged(0);
+    if (commandRunnerQueued) {
+        //Sent from one of the failed callbacks
+        queue.enqueue(commandRunner);
+    }
+    emitJobQueueSizeChanged();
+}
+
+bool SessionPrivate::canReconnect(bool wasLoggedIn) const
+{
+    return reconnectLogin && reconnectPolicy.maximumAttempts > 0
+           && (wasLoggedIn || reconnecting)
+           && reconnectAttempts < reconnectPolicy.maximumAttempts;
+}
+
+void SessionPrivate::prepareReconnect()
+{
+    //Unless the select of the previous attempt didn't get its answer yet
+    if (reconnectMailBox.isEmpty()) {
+        reconnectMailBox = currentMailBox;
+    }
+    //Since the new connection has nothing selected
+    setCurrentMailBox(QByteArray());
+    reconnecting = true;
+
+    //Jobs that can't be sent again fail as usual, the others go first once we're back
+    QList<Job *> running;
+    if (currentJob) {
+        running << currentJob;
+    }
+    running += pipelinedJobs;
+    pipelinedJobs.clear();
+    currentJob = Q_NULLPTR;
+    jobRunning = false;
+    followUpOf = Q_NULLPTR;
+    stream->setListObserver(ImapStreamParser::ListObserver());
+    QList<Job *> replayed;
+    foreach (Job *job, running) {
+        if (job->d_ptr->replay && job != commandRunner && !reconnectJobs.contains(job)) {
+            replayed << job;
+        } else {
+            //So that jobDone() takes it
+            pipelinedJobs << job;
+            job->connectionLost();
+        }
+    }
+    dropReconnectJobs();
+    for (int i = replayed.size() - 1; i >= 0; --i) {
+        Job *job = replayed.at(i);
+        forgetJob(job);
+        job->d_ptr->tags.clear();
+        job->d_ptr->limitExceeded = false;
+        job->d_ptr->replay();
+        queue.prepend(job);
+    }
+    if (!replayed.isEmpty()) {
+        qCDebug(KIMAP2_LOG) << "Sending" << replayed.size() << "jobs again after reconnecting";
+    }
+    emitJobQueueSizeChanged();
+
+    //Sessions that lost their connections together don't come back all at once
+    static thread_local std::minstd_rand random(std::random_device {}());
+    const qint64 delay = qMin(qint64(reconnectPolicy.initialDelay) << qMin(reconnectAttempts, 20),
+                              qint64(reconnectPolicy.maximumDelay));
+    const int jittered = std::uniform_int_distribution<int>(int(delay / 2), int(delay))(random);
+    qCInfo(KIMAP2_LOG) << "Reconnecting in" << jittered << "ms, attempt" << reconnectAttempts + 1;
+    reconnectTimer.start(jittered);
+}
+
+void SessionPrivate::dropReconnectJobs()
+{
+    foreach (const QPointer<Job> &job, reconnectJobs) {
+        if (job && queue.remove(job)) {
+            QObject::disconnect(job, Q_NULLPTR, this, Q_NULLPTR);
+            job->deleteLater();
+        }
+    }
+    reconnectJobs.clear();
+}
+
+void SessionPrivate::prependJob(Job *job)
+{
+    job->d_ptr->queuedAt = commandTimer.elapsed();
+    queue.prepend(job);
+    QObject::connect(job, &KJob::result, this, &SessionPrivate::jobDone);
+    QObject::connect(job, &QObject::destroyed, this, &SessionPrivate::jobDestroyed);
+}
+
+void SessionPrivate::reconnect()
+{
+    if (!reconnectLogin) {
+        //Logged out in the meantime
+        reconnecting = false;
+        clearJobQueue();
+        return;
+    }
+    reconnectAttempts++;
+    stream->reset();
+
+    //Log in and select again ahead of everything that waits
+    if (!reconnectMailBox.isEmpty()) {
+        SelectJob *select = new SelectJob(q);
+        select->setMailBox(decodeMailBoxName(reconnectMailBox));
+        QObject::connect(select, &KJob::result, this, [this]() {
+            if (socket->state() == QAbstractSocket::ConnectedState) {
+                //Answered, even if the mailbox is gone
+                reconnectMailBox.clear();
+            }
+        });
+        prependJob(select);
+        reconnectJobs << select;
+    }
+    Job *login = reconnectLogin(q);
+    QObject::connect(login, &KJob::result, this, [this](KJob *job) {
+        if (job->error() && socket->state() == QAbstractSocket::ConnectedState) {
+            qCWarning(KIMAP2_LOG) << "Logging in again failed: " << job->errorText();
+            //Retrying doesn't change the answer. Nothing starts anymore until the queue is cleared
+            forgetLogin();
+            QMetaObject::invokeMethod(this, "closeSocket", Qt::QueuedConnection);
+        }
+    });
+    prependJob(login);
+    reconnectJobs << login;
+    emitJobQueueSizeChanged();
+
+    qCDebug(KIMAP2_LOG) << "Reconnecting to: " << hostName << port;
+    startSocketTimer();
+    applySocketOptions();
+    connectToServer();
+}
+
+void SessionPrivate::rememberLogin(const Session::JobFactory &login)
+{
+    reconnectLogin = login;
+    //Back for good
+    reconnecting = false;
+    reconnectAttempts = 0;
+}
+
+void SessionPrivate::forgetLogin()
+{
+    reconnectLogin = Session::JobFactory();
+}
+
+void SessionPrivate::startCompression()
+{
+    Q_ASSERT(!compression);
+    qCDebug(KIMAP2_LOG) << "Starting compression";
+    //Whatever the parser already read belongs to the compressed stream
+    compression.reset(new DeflateDevice(socket.data(), stream->switchDevice(Q_NULLPTR)));
+    stream->switchDevice(compression.data());
+}
+
+bool SessionPrivate::isCompressionActive() const
+{
+    return !compression.isNull();
 }
 
 void SessionPrivate::startSsl(QSsl::SslProtocol protocol)
 {
     socket->setProtocol(protocol);
-    connect(socket.data(), &QSslSocket::encrypted, this, &SessionPrivate::sslConnected);
+    //What the server announced in plain text can't be trusted anymore
+    setCapabilities(QStringList());
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+    offeredTlsSessionTicket.clear();
+    {
+        QMutexLocker locker(&tlsSessionCache->mutex);
+        if (tlsSessionCache->enabled) {
+            QSslConfiguration configuration = socket->sslConfiguration();
+            //Otherwise the socket doesn't hand out the ticket once it is connected
+            configuration.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+            const QByteArray ticket = tlsSessionCache->tickets.value(TlsSessionCache::key(hostName, port));
+            if (!ticket.isEmpty()) {
+                qCDebug(KIMAP2_LOG) << "Offering a cached TLS session";
+                configuration.setSessionTicket(ticket);
+                offeredTlsSessionTicket = ticket;
+            }
+            socket->setSslConfiguration(configuration);
+        }
+    }
+#endif
+    //Once per socket, which encrypts again after reconnecting
+    connect(socket.data(), &QSslSocket::encrypted, this, &SessionPrivate::sslConnected, Qt::UniqueConnection);
     if (socket->state() == QAbstractSocket::ConnectedState) {
         qCDebug(KIMAP2_LOG) << "Starting client encryption";
         Q_ASSERT(socket->mode() == QSslSocket::UnencryptedMode);
@@ -498,12 +2896,43 @@ void SessionPrivate::startSsl(QSsl::SslProtocol protocol)
 void SessionPrivate::sslConnected()
 {
     qCDebug(KIMAP2_LOG) << "ssl is connected";
+    {
+        QMutexLocker locker(&publicMutex);
+        metrics.tlsHandshakes++;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+        //Qt doesn't tell whether the server resumed the session, but a full handshake comes with a new one
+        if (!offeredTlsSessionTicket.isEmpty() && socket->sslConfiguration().sessionTicket() == offeredTlsSessionTicket) {
+            metrics.tlsSessionCacheHits++;
+        }
+#endif
+    }
+    offeredTlsSessionTicket.clear();
+    storeTlsSessionTicket();
+    applySocketOptions();
     emit encryptionNegotiationResult(true);
 }
 
+void SessionPrivate::storeTlsSessionTicket()
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+    const QByteArray ticket = socket->sslConfiguration().sessionTicket();
+    QMutexLocker locker(&tlsSessionCache->mutex);
+    if (tlsSessionCache->enabled && !ticket.isEmpty()) {
+        tlsSessionCache->tickets.insert(TlsSessionCache::key(hostName, port), ticket);
+    }
+#endif
+}
+
 void SessionPrivate::setSocketTimeout(int ms)
 {
-    bool timerActive = socketTimer.isActive();
+    if (QThread::currentThread() != thread()) {
+        callInSessionThread([this, ms]() {
+            setSocketTimeout(ms);
+        });
+        return;
+    }
+
+    bool timerActive = socketDeadlineArmed;
 
     if (timerActive) {
         stopSocketTimer();
@@ -526,36 +2955,65 @@ void SessionPrivate::startSocketTimer()
     if (socketTimerInterval < 0) {
         return;
     }
-    Q_ASSERT(!socketTimer.isActive());
-
-    socketTimer.start(socketTimerInterval);
-    socketProgressTimer.start(socketProgressInterval);
+    socketDeadlineArmed = true;
+    lastSocketActivity = commandTimer.elapsed();
+    lastProgressReport = lastSocketActivity;
+
+    //A coarse check is good enough for a timeout, and cheaper than restarting a timer on every response
+    const int checkInterval = qBound(1, socketTimerInterval / 20, 1000);
+    if (!socketTimer.isActive() || socketTimer.interval() != checkInterval) {
+        socketTimer.start(checkInterval);
+    }
 }
 
 void SessionPrivate::stopSocketTimer()
 {
-    socketTimer.stop();
-    socketProgressTimer.stop();
+    //The check timer stops on its next timeout
+    socketDeadlineArmed = false;
 }
 
 void SessionPrivate::restartSocketTimer()
 {
-    stopSocketTimer();
-    startSocketTimer();
+    if (!socketDeadlineArmed) {
+        startSocketTimer();
+        return;
+    }
+    lastSocketActivity = commandTimer.elapsed();
+}
+
+void SessionPrivate::checkSocketTimeout()
+{
+    if (!socketDeadlineArmed) {
+        socketTimer.stop();
+        return;
+    }
+    const qint64 now = commandTimer.elapsed();
+    const qint64 idle = now - lastSocketActivity;
+    if (idle >= socketTimerInterval) {
+        socketDeadlineArmed = false;
+        socketTimer.stop();
+        onSocketTimeout();
+    } else if (idle >= socketProgressInterval && now - lastProgressReport >= socketProgressInterval) {
+        lastProgressReport = now;
+        onSocketProgressTimeout();
+    }
 }
 
 void SessionPrivate::onSocketTimeout()
 {
     qCWarning(KIMAP2_LOG) << "Aborting on socket timeout. " << socketTimerInterval;
     if (!currentJob && !queue.isEmpty()) {
-        currentJob = queue.takeFirst();
+        currentJob = queue.dequeue();
     }
     if (currentJob) {
         qCWarning(KIMAP2_LOG) << "Current job: " << currentJob->metaObject()->className();
         currentJob->setErrorMessage("Aborting on socket timeout. Interval " + QString::number(socketTimerInterval) + " ms");
     }
+    if (hostConnector->isRunning()) {
+        socketError(QAbstractSocket::SocketTimeoutError);
+        return;
+    }
     socket->abort();
-    socketProgressTimer.stop();
 }
 
 QString SessionPrivate::getStateName() const 
@@ -588,8 +3046,108 @@ void SessionPrivate::onSocketProgressTimeout()
 
 void SessionPrivate::writeDataQueue()
 {
+    //Larger payloads are written from the caller's buffer instead of being copied
+    static const int directWriteSize = 16 * 1024;
+
+    //Every write is flushed on its own when compressing, which is why they are gathered here
+    QIODevice *device = compression ? static_cast<QIODevice *>(compression.data()) : socket.data();
+    writeScheduled = false;
+    writeBuffer.resize(0);
     while (!dataQueue.isEmpty()) {
-        socket->write(dataQueue.dequeue());
+        if (bandwidthLimiter && bandwidthLimiter->delay(BandwidthLimiter::Upload, bandwidthBudget())) {
+            //What was gathered so far is still written
+            waitForBandwidth(BandwidthLimiter::Upload);
+            break;
+        }
+        if (dataQueue.head().streamed) {
+            if (!writeBuffer.isEmpty()) {
+                write(device, writeBuffer);
+                writeBuffer.resize(0);
+            }
+            if (!writeStream(device, dataQueue.head())) {
+                //The rest waits behind it, see continueWriting()
+                return;
+            }
+            if (dataQueue.dequeue().endLine) {
+                writeBuffer.append("\r\n", 2);
+            }
+            continue;
+        }
+        const OutgoingData outgoing = dataQueue.dequeue();
+        const QByteArray &data = outgoing.data;
+        if (data.size() >= directWriteSize) {
+            if (!writeBuffer.isEmpty()) {
+                write(device, writeBuffer);
+                writeBuffer.resize(0);
+            }
+            write(device, data);
+        } else {
+            writeBuffer.append(data);
+        }
+        if (outgoing.endLine) {
+            writeBuffer.append("\r\n", 2);
+        }
+    }
+    if (!writeBuffer.isEmpty()) {
+        write(device, writeBuffer);
+    }
+    QMutexLocker locker(&publicMutex);
+    updateMemoryUsage();
+}
+
+void SessionPrivate::write(QIODevice *device, const QByteArray &data)
+{
+    device->write(data);
+    if (bandwidthLimiter) {
+        bandwidthLimiter->consume(BandwidthLimiter::Upload, bandwidthBudget(), data.size());
+    }
+    if (SessionObserver *o = observer.load()) {
+        o->dataWritten(data.size());
+    }
+}
+
+bool SessionPrivate::writeStream(QIODevice *device, OutgoingData &outgoing)
+{
+    //Read ahead no further than this while the socket still has to write the previous chunks
+    static const qint64 chunkSize = 64 * 1024;
+
+    while (outgoing.written < outgoing.size) {
+        if (socket->bytesToWrite() + socket->encryptedBytesToWrite() >= 2 * chunkSize) {
+            return false;
+        }
+        if (bandwidthLimiter && bandwidthLimiter->delay(BandwidthLimiter::Upload, bandwidthBudget())) {
+            waitForBandwidth(BandwidthLimiter::Upload);
+            return false;
+        }
+        QByteArray chunk;
+        if (outgoing.device) {
+            chunk = outgoing.device->read(qMin(chunkSize, outgoing.size - outgoing.written));
+        }
+        if (chunk.isEmpty()) {
+            if (outgoing.device && outgoing.device->isSequential() && outgoing.device->isOpen()) {
+                //Continues with readyRead
+                return false;
+            }
+            qCWarning(KIMAP2_LOG) << "The device ended" << outgoing.size - outgoing.written << "bytes early, closing connection.";
+            socket->close();
+            return false;
+        }
+        write(device, chunk);
+        outgoing.written += chunk.size();
+        if (logger && (logger->isCapture() || q->isConnected())) {
+            logger->dataSent(chunk);
+        }
+        if (outgoing.progress) {
+            outgoing.progress(outgoing.written);
+        }
+    }
+    return true;
+}
+
+void SessionPrivate::continueWriting()
+{
+    if (!writeScheduled && !dataQueue.isEmpty() && dataQueue.head().streamed) {
+        writeDataQueue();
     }
 }
 
@@ -599,11 +3157,72 @@ void SessionPrivate::readMessage()
         accumulatedWaitTime += time.elapsed();
         time.start();
     }
-    stream->parseStream();
+    SessionObserver *o = observer.load();
+    const qint64 bytesReadBefore = o ? stream->bytesRead() : 0;
+    if (o && !tagsAwaitingResponse.isEmpty() && socket->bytesAvailable()) {
+        for (const QByteArray &tag : tagsAwaitingResponse) {
+            o->firstResponseByte(tag);
+        }
+        tagsAwaitingResponse.clear();
+    }
+    QElapsedTimer parseTimer;
+    parseTimer.start();
+    if (bandwidthLimiter) {
+        //One buffer worth at a time, so sessions sharing the limiter aren't starved while this one parses.
+        //Buffered data is still parsed when nothing may be read
+        BandwidthLimiter *const limiter = bandwidthLimiter;
+        const BandwidthLimiter::Budget budget = bandwidthBudget();
+        while (true) {
+            const qint64 granted = limiter->acquire(BandwidthLimiter::Download, budget, stream->bufferSize());
+            const qint64 bytesReadUnshaped = stream->bytesRead();
+            stream->setReadLimit(granted);
+            stream->parseStream();
+            const qint64 read = stream->bytesRead() - bytesReadUnshaped;
+            //Give back what wasn't used
+            limiter->consume(BandwidthLimiter::Download, budget, read - granted);
+            //The handlers may have replaced the limiter
+            if (!granted || read < granted || stream->error() || bandwidthLimiter != limiter) {
+                break;
+            }
+        }
+        //Nothing is read that wasn't acquired
+        stream->setReadLimit(bandwidthLimiter ? 0 : -1);
+        if (bandwidthLimiter && socket->bytesAvailable() && !stream->isPaused()) {
+            waitForBandwidth(BandwidthLimiter::Download);
+        }
+    } else {
+        stream->parseStream();
+    }
+    //The handlers may have removed it
+    if (o && (o = observer.load())) {
+        o->dataRead(stream->bytesRead() - bytesReadBefore);
+    }
+    if (currentJob && currentJob->d_ptr->parsePassFinished) {
+        currentJob->d_ptr->parsePassFinished();
+    }
+    const QList<Job *> pipelined = pipelinedJobs; // copy because the hooks may finish jobs
+    for (Job *job : pipelined) {
+        if (job->d_ptr->parsePassFinished) {
+            job->d_ptr->parsePassFinished();
+        }
+    }
+    {
+        QMutexLocker locker(&publicMutex);
+        metrics.parseTime += parseTimer.nsecsElapsed() / 1000;
+        metrics.bytesReceived = stream->bytesRead();
+        metrics.literalBytesReceived = stream->literalBytesRead();
+#ifdef KIMAP2_PARSER_COUNTERS
+        metrics.parser = stream->counters();
+#endif
+        updateMemoryUsage();
+    }
     if (stream->error()) {
         qCWarning(KIMAP2_LOG) << "Error while parsing, closing connection.";
         qCDebug(KIMAP2_LOG) << "Current buffer: " << stream->currentBuffer();
         socket->close();
+    } else if (compression && compression->error()) {
+        qCWarning(KIMAP2_LOG) << "Error while decompressing, closing connection.";
+        socket->close();
     }
     if (trackTime) {
         accumulatedProcessingTime += time.elapsed();
@@ -612,11 +3231,194 @@ void SessionPrivate::readMessage()
     }
 }
 
+static void setTcpOption(qintptr descriptor, int option, int value)
+{
+#ifdef Q_OS_UNIX
+    if (::setsockopt(int(descriptor), IPPROTO_TCP, option, &value, sizeof(value)) != 0) {
+        qCWarning(KIMAP2_LOG) << "Failed to set TCP option" << option << "to" << value;
+    }
+#else
+    Q_UNUSED(descriptor);
+    Q_UNUSED(option);
+    Q_UNUSED(value);
+#endif
+}
+
+void SessionPrivate::applySocketOptions()
+{
+    socket->setSocketOption(QAbstractSocket::KeepAliveOption, socketOptions.keepAlive ? 1 : 0);
+    socket->setSocketOption(QAbstractSocket::LowDelayOption, socketOptions.lowDelay ? 1 : 0);
+    if (socketOptions.sendBufferSize > 0) {
+        socket->setSocketOption(QAbstractSocket::SendBufferSizeSocketOption, socketOptions.sendBufferSize);
+    }
+    if (socketOptions.receiveBufferSize > 0) {
+        socket->setSocketOption(QAbstractSocket::ReceiveBufferSizeSocketOption, socketOptions.receiveBufferSize);
+    }
+    //Qt has no options for the keepalive timing, they need the descriptor of a connected socket
+    const qintptr descriptor = socket->socketDescriptor();
+    if (!socketOptions.keepAlive || descriptor == -1 || transport) {
+        return;
+    }
+    if (socketOptions.keepAliveIdle > 0) {
+#if defined(TCP_KEEPIDLE)
+        setTcpOption(descriptor, TCP_KEEPIDLE, socketOptions.keepAliveIdle);
+#elif defined(TCP_KEEPALIVE)
+        setTcpOption(descriptor, TCP_KEEPALIVE, socketOptions.keepAliveIdle);
+#endif
+    }
+#if defined(TCP_KEEPINTVL)
+    if (socketOptions.keepAliveInterval > 0) {
+        setTcpOption(descriptor, TCP_KEEPINTVL, socketOptions.keepAliveInterval);
+    }
+#endif
+#if defined(TCP_KEEPCNT)
+    if (socketOptions.keepAliveCount > 0) {
+        setTcpOption(descriptor, TCP_KEEPCNT, socketOptions.keepAliveCount);
+    }
+#endif
+}
+
+BandwidthLimiter::Budget SessionPrivate::bandwidthBudget() const
+{
+    if (currentJob && currentJob->d_ptr->priority == Job::BackgroundPriority) {
+        return BandwidthLimiter::Background;
+    }
+    return BandwidthLimiter::Interactive;
+}
+
+void SessionPrivate::waitForBandwidth(BandwidthLimiter::Direction direction)
+{
+    const int delay = qMax(1, bandwidthLimiter->delay(direction, bandwidthBudget()));
+    if (!bandwidthTimer.isActive() || bandwidthTimer.remainingTime() > delay) {
+        bandwidthTimer.start(delay);
+    }
+}
+
+void SessionPrivate::bandwidthAvailable()
+{
+    if (!dataQueue.isEmpty() && !writeScheduled) {
+        writeDataQueue();
+    }
+    if (socket->bytesAvailable()) {
+        readMessage();
+    }
+}
+
+void SessionPrivate::pauseReading(Job *job)
+{
+    //Once it is done the job doesn't get another response
+    if (readingPausedBy || (job != currentJob && !pipelinedJobs.contains(job))) {
+        return;
+    }
+    qCDebug(KIMAP2_LOG) << "Pausing reading for " << job->metaObject()->className();
+    readingPausedBy = job;
+    stream->setPaused(true);
+    //The server can't make progress while we don't read
+    stopSocketTimer();
+}
+
+void SessionPrivate::resumeReading(Job *job)
+{
+    if (readingPausedBy != job) {
+        return;
+    }
+    readingPausedBy = Q_NULLPTR;
+    stream->setPaused(false);
+    if (currentJob) {
+        restartSocketTimer();
+    }
+    //The data that arrived in the meantime won't emit readyRead again
+    QMetaObject::invokeMethod(this, "readMessage", Qt::QueuedConnection);
+}
+
 void SessionPrivate::closeSocket()
 {
     qCDebug(KIMAP2_LOG) << "Closing socket.";
+    if (hostConnector->isRunning()) {
+        //The socket doesn't connect yet, so it wouldn't tell
+        hostConnector->abort();
+        hostLookupInProgress = false;
+        socketDisconnected();
+        return;
+    }
     socket->close();
 }
 
+void SessionPrivate::connectToServer()
+{
+    if (transport) {
+        connectThroughTransport();
+        return;
+    }
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+    if (HostConnector::isEnabled() && QHostAddress(hostName).isNull()) {
+        hostLookupInProgress = true;
+        hostConnector->start(hostName, port);
+        return;
+    }
+#endif
+    socket->connectToHost(hostName, port);
+}
+
+void SessionPrivate::connectThroughTransport()
+{
+    QString errorString;
+    const qintptr descriptor = transport->open(&errorString);
+    if (descriptor == -1) {
+        qCWarning(KIMAP2_LOG) << "Failed to open the transport:" << errorString;
+        //Fails later, like a TCP connection would
+        QMetaObject::invokeMethod(this, "transportFailed", Qt::QueuedConnection);
+        return;
+    }
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+    socket->setPeerVerifyName(hostName);
+#endif
+    if (!socket->setSocketDescriptor(descriptor)) {
+        qCWarning(KIMAP2_LOG) << "Failed to adopt the transport's socket:" << socket->errorString();
+#ifdef Q_OS_UNIX
+        ::close(int(descriptor));
+#endif
+        QMetaObject::invokeMethod(this, "transportFailed", Qt::QueuedConnection);
+        return;
+    }
+    //An adopted socket is connected already and doesn't tell
+    QMetaObject::invokeMethod(this, "socketConnected", Qt::QueuedConnection);
+}
+
+void SessionPrivate::transportFailed()
+{
+    socketError(QAbstractSocket::ConnectionRefusedError);
+    //The socket never connected, so it doesn't report the disconnect
+    socketDisconnected();
+}
+
+void SessionPrivate::connectToAddress(const QHostAddress &address)
+{
+    if (address.isNull()) {
+        //Reports the error as usual
+        socket->connectToHost(hostName, port);
+        return;
+    }
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+    //Verifies the certificate against the host name, not the address
+    socket->setPeerVerifyName(hostName);
+#endif
+    socket->connectToHost(address, port);
+}
+
+void SessionPrivate::closeForGood()
+{
+    forgetLogin();
+    if (reconnectTimer.isActive()) {
+        //The socket is closed already
+        reconnectTimer.stop();
+        reconnecting = false;
+        dropReconnectJobs();
+        clearJobQueue();
+        return;
+    }
+    closeSocket();
+}
+
 #include "moc_session.cpp"
 #include "moc_session_p.cpp"
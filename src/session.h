@@ -22,29 +22,332 @@
 #define KIMAP2_SESSION_H
 
 #include "kimap2_export.h"
+#include "imapset.h"
+#include "parselimits.h"
+#include "parsercounters.h"
 
+#include <QtCore/QHash>
+#include <QtCore/QMetaType>
 #include <QtCore/QObject>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
 #include <QtNetwork/QSsl>
 #include <QtNetwork/QSslSocket>
 
+#include <functional>
+
 namespace KIMAP2
 {
 
+class BandwidthLimiter;
+class Job;
+struct MailBoxDescriptor;
 class SessionPrivate;
 class JobPrivate;
+class Transport;
 struct Message;
 
+/**
+ * Statistics about what a session sent and received, see Session::metrics().
+ *
+ * All values add up from the start of the session.
+ */
+struct KIMAP2_EXPORT SessionMetrics {
+    /**
+     * The statistics of one kind of command, e.g. "UID FETCH".
+     */
+    struct KIMAP2_EXPORT Command {
+        Command();
+
+        // Commands that completed, successfully or not
+        qint64 count;
+        // Commands that completed with NO or BAD
+        qint64 failed;
+        // Milliseconds from sending the commands to their tagged completion
+        qint64 totalLatency;
+        // Completed commands by latency, see latencyBuckets()
+        QVector<qint64> latencyHistogram;
+    };
+
+    SessionMetrics();
+
+    /**
+     * The upper bounds of the latency histogram buckets in milliseconds.
+     *
+     * The histograms have one more bucket which counts everything slower.
+     */
+    static QVector<int> latencyBuckets();
+
+    QHash<QByteArray, Command> commands;
+    // Bytes as the protocol sees them, i.e. before compression
+    qint64 bytesSent;
+    qint64 bytesReceived;
+    qint64 literalBytesReceived;
+    // Microseconds spent parsing and handling responses
+    qint64 parseTime;
+    // Jobs that were started, and the milliseconds they spent in the queue before
+    qint64 jobsStarted;
+    qint64 queueWaitTime;
+    // Completed TLS handshakes, and how many of them resumed the session of a ticket from the TLS
+    // session cache. A resumption in which the server renewed the ticket isn't told apart from a
+    // full handshake
+    qint64 tlsHandshakes;
+    qint64 tlsSessionCacheHits;
+    // Only counted in builds with KIMAP2_PARSER_COUNTERS
+    ParserCounters parser;
+};
+
+/**
+ * What a session holds in memory, see Session::memoryUsage().
+ *
+ * Unlike SessionMetrics these are current values, except for largestLiteral. Results the
+ * consumers of the jobs keep aren't included.
+ */
+struct KIMAP2_EXPORT SessionMemoryUsage {
+    SessionMemoryUsage();
+
+    // Allocated for the receive buffers of the parser
+    qint64 parserBufferCapacity;
+    // Read by the socket, but not by the parser yet
+    qint64 socketReadBuffer;
+    // The literal being received, as far as it is held in memory
+    qint64 literalBytes;
+    // The largest literal announced since the start of the session
+    qint64 largestLiteral;
+    // Waiting to be written, in the session and in the socket
+    qint64 writeQueueBytes;
+    // Jobs waiting to run
+    int queuedJobs;
+    // Received since the job that receives the responses now started
+    qint64 inFlightPayloadBytes;
+};
+
+/**
+ * The outcome of a command sent with Session::sendCommand().
+ */
+struct KIMAP2_EXPORT CommandResult {
+    bool isOk() const;
+
+    // OK, NO or BAD, or empty if the connection was lost before the command completed
+    QByteArray status;
+    // The rest of the tagged completion, with the response code in brackets
+    QByteArray text;
+    /**
+     * The untagged responses received while the command was the oldest one running,
+     * each split into its parts, e.g. "*", "STATUS", "INBOX", "(MESSAGES 3)".
+     */
+    QList<QList<QByteArray> > untaggedResponses;
+};
+
+/**
+ * How a session reconnects once it lost its connection, see Session::setReconnectPolicy().
+ */
+struct KIMAP2_EXPORT ReconnectPolicy {
+    ReconnectPolicy();
+
+    // How often the session tries in a row before it gives up, 0 disables reconnecting
+    int maximumAttempts;
+    // Milliseconds before the first attempt, doubled for every further one up to maximumDelay
+    int initialDelay;
+    int maximumDelay;
+};
+
+/**
+ * Options of the TCP socket of a session, see Session::setSocketOptions().
+ *
+ * Sizes and times of 0 keep what the system uses by default.
+ */
+struct KIMAP2_EXPORT SocketOptions {
+    SocketOptions();
+
+    // TCP_NODELAY, so that small commands go out without waiting for more data. Off by default
+    bool lowDelay;
+    // The kernel buffers in bytes, large buffers help on links with a high bandwidth-delay product
+    int sendBufferSize;
+    int receiveBufferSize;
+    // Notices connections that are gone without the peer telling us. On by default
+    bool keepAlive;
+    // Seconds of idleness before the first probe, between probes, and how many unanswered
+    // probes drop the connection. Only where the platform supports setting them
+    int keepAliveIdle;
+    int keepAliveInterval;
+    int keepAliveCount;
+};
+
+/**
+ * Remembers the capabilities of servers across connections, see Session::setCapabilityCache().
+ */
+class KIMAP2_EXPORT CapabilityCache
+{
+public:
+    virtual ~CapabilityCache();
+
+    /**
+     * Returns the capabilities stored for the server, or an empty list if there are none.
+     */
+    virtual QStringList capabilities(const QString &hostName, quint16 port) = 0;
+
+    /**
+     * Stores the capabilities the server announced before authentication.
+     */
+    virtual void setCapabilities(const QString &hostName, quint16 port, const QStringList &capabilities) = 0;
+};
+
+/**
+ * Receives the events of a session as they happen, for tracing, see Session::setObserver().
+ *
+ * Everything is called on the I/O thread of the session, so an observer should only take a
+ * timestamp and hand the event over instead of blocking. The default implementations do nothing.
+ */
+class KIMAP2_EXPORT SessionObserver
+{
+public:
+    virtual ~SessionObserver();
+
+    /**
+     * @p job was added to the queue.
+     */
+    virtual void jobEnqueued(Job *job);
+
+    /**
+     * @p job left the queue and runs, including jobs that continue after stepping aside.
+     */
+    virtual void jobStarted(Job *job);
+
+    /**
+     * The command line of @p command, e.g. "UID FETCH", was queued for writing with @p tag.
+     * @p bytes doesn't include literals sent after the line.
+     */
+    virtual void commandSent(const QByteArray &tag, const QByteArray &command, qint64 bytes);
+
+    /**
+     * The first data arrived after @p tag was sent, whichever response it belongs to.
+     */
+    virtual void firstResponseByte(const QByteArray &tag);
+
+    /**
+     * The tagged completion of @p command arrived, @p status is OK, NO or BAD.
+     */
+    virtual void commandCompleted(const QByteArray &tag, const QByteArray &command, const QByteArray &status);
+
+    /**
+     * A literal of @p size bytes starts, and was read completely.
+     */
+    virtual void literalStarted(qint64 size);
+    virtual void literalFinished(qint64 size);
+
+    /**
+     * @p bytes were read or written. Like SessionMetrics, bytes count as the protocol sees them,
+     * i.e. before compression.
+     */
+    virtual void dataRead(qint64 bytes);
+    virtual void dataWritten(qint64 bytes);
+};
+
 class KIMAP2_EXPORT Session : public QObject
 {
     Q_OBJECT
     Q_ENUMS(State)
+    Q_PROPERTY(QStringList capabilities READ capabilities NOTIFY capabilitiesChanged)
 
     friend class JobPrivate;
 
 public:
     enum State { Disconnected = 0, NotAuthenticated, Authenticated, Selected };
 
+    /**
+     * Where the socket I/O and the parsing of responses happen.
+     */
+    enum ThreadingMode {
+        OwnerThread = 0, ///< On the thread the session was created on
+        WorkerThread,    ///< On a thread of its own, started and stopped with the session
+        SharedWorkerThread ///< On one of a fixed set of threads shared by all sessions, see setIoThreadCount()
+    };
+
+    /**
+     * Creates a job on the session. The session starts it.
+     */
+    typedef std::function<Job *(Session *session)> JobFactory;
+
+    /**
+     * Receives the result of a command sent with sendCommand().
+     */
+    typedef std::function<void(const CommandResult &result)> CommandCallback;
+
     Session(const QString &hostName, quint16 port, QObject *parent = Q_NULLPTR);
+
+    /**
+     * Creates a session that does its I/O according to @p threadingMode.
+     *
+     * With WorkerThread, jobs are still created, started and deleted on the thread
+     * of the session, but they handle the responses on the worker thread, so their
+     * signals reach receivers on other threads as queued connections. sslErrors()
+     * is the exception: it is delivered blocking, so that ignoreErrors() keeps working.
+     * Jobs must not be deleted while they are running.
+     */
+    Session(const QString &hostName, quint16 port, ThreadingMode threadingMode, QObject *parent = Q_NULLPTR);
+
+    /**
+     * Creates a session that connects through @p transport instead of TCP, e.g. to a server
+     * on a Unix domain socket or one running in the same process.
+     *
+     * hostName() is the one of the transport and port() is 0. The transport also opens the
+     * connections when the session reconnects, and can be shared with other sessions.
+     */
+    explicit Session(const QSharedPointer<Transport> &transport, ThreadingMode threadingMode = OwnerThread, QObject *parent = Q_NULLPTR);
+
+    /**
+     * Sets how many threads the sessions created with SharedWorkerThread are spread over.
+     *
+     * New sessions go to the thread with the fewest sessions. The default is one thread
+     * per core. Threads that already run are kept until the application exits.
+     */
+    static void setIoThreadCount(int count);
+    static int ioThreadCount();
+
+    /**
+     * Enables a process wide cache of TLS session tickets, keyed by host and port.
+     *
+     * When a session encrypts the connection to a server that a session was connected to before,
+     * it offers the ticket of that connection so that the server can resume the TLS session with
+     * an abbreviated handshake, e.g. when many sessions reconnect at once. Disabling the cache
+     * clears it. Disabled by default. Requires Qt 5.4.
+     */
+    static void setTlsSessionCacheEnabled(bool enabled);
+    static bool isTlsSessionCacheEnabled();
+
+    /**
+     * Sets the TLS configuration that sessions created afterwards start with, e.g. with the CA
+     * certificates of a bundle that was parsed once with QSslCertificate::fromPath(), instead of
+     * every session setting up its own.
+     *
+     * The configuration is implicitly shared, so all sessions refer to the same copy of it.
+     * A null configuration, the default, leaves the sockets with
+     * QSslConfiguration::defaultConfiguration().
+     */
+    static void setDefaultSslConfiguration(const QSslConfiguration &configuration);
+    static QSslConfiguration defaultSslConfiguration();
+
+    /**
+     * Races the addresses of hosts that have several (Happy Eyeballs, RFC 8305), so that a broken
+     * IPv6 or IPv4 network doesn't hold up connecting. Disabled by default. Requires Qt 5.4.
+     *
+     * Alternating between IPv6 and IPv4, another address is tried every 250 ms until one accepts
+     * the connection, and the session connects to it. The addresses are looked up once for all
+     * sessions and kept for hostLookupCacheTimeout(), with the address that won first, so that
+     * the following sessions and reconnects connect to it right away. Disabling it clears the cache.
+     */
+    static void setConnectionRacingEnabled(bool enabled);
+    static bool isConnectionRacingEnabled();
+
+    /**
+     * Sets how long the addresses of a host are kept for connection racing. The default is 300
+     * seconds, since the lookup doesn't tell how long the DNS records are valid. 0 looks the
+     * host up for every connection.
+     */
+    static void setHostLookupCacheTimeout(int seconds);
+    static int hostLookupCacheTimeout();
     ~Session();
 
     QString hostName() const;
@@ -68,6 +371,8 @@ public:
 
     /**
      * Set the session timeout. The default is 30 seconds.
+     *
+     * The timeout is checked with a granularity of a twentieth of it, but at least once a second.
      * @param timeout The socket timeout in seconds, negative values disable the timeout.
      */
     void setTimeout(int timeout);
@@ -77,13 +382,314 @@ public:
      */
     int timeout() const;
 
+    /**
+     * Sets the limits for the receive buffer, in bytes.
+     *
+     * The buffer grows while data arrives faster than it is parsed, and shrinks back once
+     * the connection is calm. The default range is 16000 bytes to 1 MiB.
+     */
+    void setReceiveBufferLimits(int minimum, int maximum);
+
+    /**
+     * Frees the receive buffers whenever the session has parsed everything it received.
+     *
+     * For processes that hold many connections, most of which are idle at any time, e.g. in
+     * IDLE. Each burst of data then allocates the buffer anew. Disabled by default.
+     */
+    void setReleaseIdleReceiveBuffers(bool release);
+
+    /**
+     * Limits how many bytes the socket reads ahead of the parser. The default of 0 means no limit.
+     *
+     * Once the limit is reached, TCP flow control throttles the server until the parser catches
+     * up. Together with FetchJob::setResultWindow() this bounds the memory used for a consumer
+     * that is slower than the network.
+     */
+    void setReadBufferSize(qint64 size);
+    qint64 readBufferSize() const;
+
+    /**
+     * Sets the options of the socket, which are applied when connecting, once connected,
+     * and again after the TLS handshake.
+     *
+     * Set them right after constructing the session, the receive buffer size only affects the
+     * TCP window if it is set before the connection is established.
+     */
+    void setSocketOptions(const SocketOptions &options);
+    SocketOptions socketOptions() const;
+
+    /**
+     * Shapes the traffic of the session with @p limiter, which can be shared with other sessions.
+     * Null, the default, doesn't limit it. The limiter isn't owned and has to outlive the session.
+     *
+     * The session stops reading while the budget is used up, so a read buffer size (see
+     * setReadBufferSize()) is needed to slow down the server instead of only the parser. Written
+     * data counts before compression.
+     */
+    void setBandwidthLimiter(BandwidthLimiter *limiter);
+    BandwidthLimiter *bandwidthLimiter() const;
+
+    /**
+     * Returns how many bytes the parser had to copy to move unfinished tokens between its buffers.
+     */
+    qint64 receiveBufferCopiedBytes() const;
+
+    /**
+     * Enables command pipelining.
+     *
+     * Jobs that support it (e.g. StatusJob) are then started while the previous ones
+     * are still waiting for the server, instead of waiting a full round trip each.
+     * Pipelining is disabled by default.
+     */
+    void setPipeliningEnabled(bool enabled);
+    bool isPipeliningEnabled() const;
+
+    /**
+     * Lets a SelectJob for the mailbox that is already selected finish without asking the server.
+     *
+     * The job needs the same read-only and CONDSTORE options as the SELECT that is remembered. It
+     * then reports the state from that SELECT, as updated by the untagged responses received since:
+     * EXISTS, EXPUNGE, RECENT, FLAGS, the UIDs and MODSEQ values of FETCH responses and response
+     * codes. The first unseen index stays the one reported by the server. New messages, a changed
+     * UIDVALIDITY or VANISHED responses make the next SELECT go out again. Disabled by default.
+     */
+    void setSelectCacheEnabled(bool enabled);
+    bool isSelectCacheEnabled() const;
+
+    /**
+     * Keeps the UIDs of the messages in the selected mailbox by sequence number, so that
+     * responses with sequence numbers, e.g. the EXPUNGE and FETCH responses caused by other
+     * clients, can be resolved to UIDs without asking the server. Enable it before selecting.
+     *
+     * The map starts with the message count of a SELECT, without knowing the UIDs. A UID SEARCH
+     * ALL, e.g. a uid based SearchJob for Term::All, also with ReturnAll, fills it in at once,
+     * as do the UIDs in FETCH responses one by one. EXISTS, EXPUNGE and VANISHED keep it current.
+     * The map takes 4 bytes per message. Disabled by default.
+     */
+    void setUidMapEnabled(bool enabled);
+    bool isUidMapEnabled() const;
+
+    /**
+     * Returns the UID of the message with @p sequenceNumber in the selected mailbox,
+     * or 0 if the UID map doesn't know it. See setUidMapEnabled().
+     */
+    qint64 uidForSequenceNumber(qint64 sequenceNumber) const;
+
+    /**
+     * Returns true if the UID map knows the UIDs of all messages in the selected mailbox.
+     */
+    bool isUidMapComplete() const;
+
+    /**
+     * Lets a job that starts take over the jobs queued right behind it that do the same
+     * to other messages, so that they share its commands.
+     *
+     * Currently StoreJobs with the same mode, flags and labels merge their sets, if the same
+     * mailbox was selected when they were queued. The jobs that were taken over finish with
+     * the result of the one that ran. Disabled by default.
+     */
+    void setJobCoalescingEnabled(bool enabled);
+    bool isJobCoalescingEnabled() const;
+
+    /**
+     * Remembers the mailbox names converted from and to modified UTF-7.
+     *
+     * ListJob then decodes each name with non-ASCII characters only once, and SelectJob and
+     * StatusJob reuse the encoding of the names that were listed. Names in plain ASCII need no
+     * conversion and aren't cached. The cache is bounded and dropped when disabled. Disabled by
+     * default.
+     */
+    void setMailBoxNameCacheEnabled(bool enabled);
+    bool isMailBoxNameCacheEnabled() const;
+
+    /**
+     * Lets MyRightsJob, GetAclJob and GetQuotaRootJob answer from what was reported for the
+     * same mailbox in the last @p seconds, instead of asking the server again.
+     *
+     * SetAclJob, DeleteAclJob, DeleteJob and RenameJob drop what is known about their mailbox,
+     * and SetQuotaJob drops the quotas of the mailboxes under its root. Changes made by other
+     * clients show only once the entries expire. A timeout of 0, the default, disables the cache.
+     */
+    void setMailBoxInfoCacheTimeout(int seconds);
+    int mailBoxInfoCacheTimeout() const;
+
+    /**
+     * Reconnects when the connection is lost after a LoginJob succeeded, instead of failing the
+     * queued jobs. Disabled by default.
+     *
+     * The session connects again, logs in like the last successful LoginJob did, including its
+     * encryption, and selects the mailbox that was selected, before the queued jobs continue.
+     * Of the jobs that were running, FetchJob, SearchJob, StatusJob and ListJob are sent again,
+     * so they can report results again that they reported before; the others fail with
+     * ConnectionLost. The delay before each attempt is taken randomly from the upper half of
+     * the delay of the policy, so that sessions which lost their connections at the same time
+     * don't come back at once. If the login fails, or no attempt succeeds, the queue is cleared
+     * as without reconnecting. close() and LogoutJob end the session for good.
+     */
+    void setReconnectPolicy(const ReconnectPolicy &policy);
+    ReconnectPolicy reconnectPolicy() const;
+
+    /**
+     * Drops responses that can't be parsed instead of closing the connection. Disabled by default.
+     *
+     * Parsing continues with the next line. The job the response was meant for is told with
+     * KJob::warning(), and a tagged completion that was malformed after its status still
+     * completes the command.
+     */
+    void setParseErrorRecoveryEnabled(bool enabled);
+    bool isParseErrorRecoveryEnabled() const;
+
     /**
      * Returns the currently selected mailbox.
      */
     QString selectedMailBox() const;
 
+    /**
+     * Returns the capabilities the server announced last on this connection.
+     *
+     * They are taken from CAPABILITY responses and from the [CAPABILITY] response codes the
+     * servers send e.g. in the greeting and when the authentication completed. The capabilities
+     * announced before STARTTLS are dropped once the connection is encrypted.
+     */
+    QStringList capabilities() const;
+
+    /**
+     * Returns true if the server announced @p capability, or if it is one of the extensions
+     * IMAP4rev2 made part of the protocol, e.g. LIST-STATUS, and the connection follows IMAP4rev2.
+     */
+    bool hasCapability(const QString &capability) const;
+
+    /**
+     * Sets a cache for the capabilities of servers, which the session doesn't own.
+     *
+     * LoginJob then skips the CAPABILITY command if it finds the capabilities of the server in
+     * the cache, and stores the ones it retrieved otherwise. The cache is used on the I/O thread
+     * of the session, so it has to be thread-safe when shared by sessions on worker threads.
+     */
+    void setCapabilityCache(CapabilityCache *cache);
+    CapabilityCache *capabilityCache() const;
+
+    /**
+     * Returns true once a NamespaceJob retrieved the namespaces of the server on this connection.
+     *
+     * Later NamespaceJobs then finish with them right away, and a ListJob can query them with
+     * ListJob::setQueriesSessionNamespaces(). They are dropped with the connection.
+     */
+    bool hasNamespaces() const;
+
+    /**
+     * The namespaces the last NamespaceJob retrieved, see NamespaceJob::personalNamespaces().
+     */
+    QList<MailBoxDescriptor> personalNamespaces() const;
+    QList<MailBoxDescriptor> userNamespaces() const;
+    QList<MailBoxDescriptor> sharedNamespaces() const;
+
+    /**
+     * Sets an observer for the events of this session, which the session doesn't own.
+     *
+     * Pass null to remove it. Without an observer tracing costs nothing but a pointer check.
+     */
+    void setObserver(SessionObserver *observer);
+    SessionObserver *observer() const;
+
     int jobQueueSize() const;
 
+    /**
+     * Creates a job with @p factory and starts it. Can be called from any thread.
+     *
+     * The factory runs on the thread of the session, so that the job belongs to it. To receive
+     * the results on another thread, connect to the job from the factory with a receiver
+     * living on that thread.
+     */
+    void submit(const JobFactory &factory);
+
+    /**
+     * Starts all of @p jobs, in this order, like calling start() on each of them.
+     *
+     * Meant for queueing many jobs at once, e.g. after being offline: the queue is
+     * only updated once, so jobQueueSizeChanged() is emitted once. Can be called from
+     * any thread.
+     */
+    void addJobs(const QList<Job *> &jobs);
+
+    /**
+     * Sends @p command with @p arguments through the job queue, without the overhead of a Job.
+     *
+     * Meant for small commands that are sent in large numbers, e.g. STORE, NOOP or STATUS.
+     * The commands take one place in the queue: those sent until it is their turn go out
+     * together, and the ones sent in the meantime wait for the next turn. @p callback is
+     * called on the session thread once the command completed, or the connection was lost.
+     * The arguments are sent as they are, so they can't contain literals. Can be called
+     * from any thread.
+     */
+    void sendCommand(const QByteArray &command, const QByteArray &arguments, const CommandCallback &callback);
+
+    /**
+     * Returns the statistics collected so far. Can be called from any thread.
+     */
+    SessionMetrics metrics() const;
+
+    /**
+     * Returns what the session holds in memory. Can be called from any thread.
+     *
+     * The values are taken whenever the session read or wrote data, and when jobs are queued.
+     */
+    SessionMemoryUsage memoryUsage() const;
+
+    /**
+     * Fails jobs that would make the session hold more memory than these limits, with the
+     * LimitExceeded error. 0, the default, means no limit.
+     *
+     * A job that receives a literal larger than @p size, or more than @p bytes responses in
+     * total, stops receiving its responses: literals are dropped as they arrive and the job fails
+     * once the server completed its commands, so the connection stays usable. Only literals on
+     * the first level of a response are limited, e.g. not those in a BODYSTRUCTURE.
+     */
+    void setMaximumLiteralSize(qint64 size);
+    qint64 maximumLiteralSize() const;
+    void setMaximumResponseBytes(qint64 bytes);
+    qint64 maximumResponseBytes() const;
+
+    /**
+     * Bounds the tokens, lines and literals the parser accepts, so that a misbehaving server
+     * can't make it buffer without end.
+     *
+     * A response that goes over a limit is skipped up to its end without holding on to it, and
+     * the job it was meant for fails with LimitExceeded once the server completed its commands,
+     * so the connection stays usable. A completion that goes over a limit still completes its
+     * command. Unlike setMaximumLiteralSize() the limits are checked before anything is
+     * allocated, and also apply to the commands of the session itself.
+     */
+    void setParseLimits(const ParseLimits &limits);
+    ParseLimits parseLimits() const;
+
+    /**
+     * Fails jobs right away that are started while @p count jobs wait in the queue.
+     * 0, the default, means no limit.
+     */
+    void setMaximumQueuedJobs(int count);
+    int maximumQueuedJobs() const;
+
+    /**
+     * Writes literals of at least @p size bytes to a temporary file in @p directory as they
+     * arrive, instead of holding them in memory. 0, the default, disables it.
+     *
+     * Meant for unexpectedly large messages, so that they don't count against the memory of the
+     * process while they are received. The file is mapped once the literal is complete and the
+     * jobs read it like any other response. Jobs keep what they take out of it in memory, except
+     * for FetchJob with FetchJob::setMappedResultsEnabled(). Literals a job streams to a sink,
+     * e.g. with FetchJob::setPartSink(), aren't affected. The system temporary directory is used
+     * if @p directory is empty.
+     */
+    void setLiteralSpillThreshold(qint64 size, const QString &directory = QString());
+    qint64 literalSpillThreshold() const;
+
+    /**
+     * Emits metricsUpdated() every @p msecs milliseconds. 0, the default, disables it.
+     */
+    void setMetricsInterval(int msecs);
+    int metricsInterval() const;
+
     void close();
 
     /**
@@ -126,11 +732,56 @@ Q_SIGNALS:
     */
     void stateChanged(KIMAP2::Session::State newState, KIMAP2::Session::State oldState);
 
+    /**
+     * Emitted periodically with the current metrics, see setMetricsInterval().
+     */
+    void metricsUpdated(const KIMAP2::SessionMetrics &metrics);
+
+    /**
+     * Emitted when the server announced other capabilities, or they were dropped with the connection.
+     */
+    void capabilitiesChanged(const QStringList &capabilities);
+
+    /**
+     * Emitted for an EXISTS the server sent while no job was running, e.g. between two jobs.
+     *
+     * The selected* signals report the updates about the selected mailbox that no job was there
+     * to receive. The updates that arrive while a job runs go to the job, e.g. to IdleJob.
+     */
+    void selectedMessageCountChanged(qint64 messageCount);
+
+    /**
+     * Emitted for an EXPUNGE the server sent while no job was running.
+     *
+     * @param uid the UID of the message if the UID map knew it (see setUidMapEnabled()), or 0
+     */
+    void selectedMessageExpunged(qint64 sequenceNumber, qint64 uid);
+
+    /**
+     * Emitted for the VANISHED responses the server sent while no job was running.
+     */
+    void selectedMessagesVanished(const KIMAP2::ImapSet &uids);
+
+    /**
+     * Emitted for a FETCH response about the flags of a message the server sent while
+     * no job was running.
+     *
+     * @param sequenceNumber the sequence number, 0 once UIDONLY is enabled
+     * @param uid the UID of the message, or 0 if neither the server sent it nor the UID map knew it
+     * @param modSeq the mod-sequence of the message, or 0 if the server didn't send it
+     */
+    void selectedMessageFlagsChanged(qint64 sequenceNumber, qint64 uid, const QList<QByteArray> &flags, quint64 modSeq);
+
 private:
+    Session(const QString &hostName, quint16 port, ThreadingMode threadingMode, const QSharedPointer<Transport> &transport,
+            QObject *parent);
+
     friend class SessionPrivate;
     SessionPrivate *const d;
 };
 
 }
 
+Q_DECLARE_METATYPE(KIMAP2::SessionMetrics)
+
 #endif
@@ -22,15 +22,32 @@
 #define KIMAP2_SESSION_P_H
 
 #include "session.h"
+#include "acl.h"
+#include "bandwidthlimiter.h"
+#include "listjob.h"
 
 #include <QtNetwork/QSslSocket>
 
+#include <QtCore/QAtomicInt>
+#include <QtCore/QAtomicPointer>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QMap>
+#include <QtCore/QMutex>
 #include <QtCore/QObject>
+#include <QtCore/QPair>
+#include <QtCore/QPointer>
 #include <QtCore/QQueue>
+#include <QtCore/QSet>
+#include <QtCore/QSharedPointer>
 #include <QtCore/QString>
+#include <QtCore/QThread>
 #include <QtCore/QTimer>
 #include <QtCore/QTime>
 
+#include <functional>
+#include <list>
+
 class KJob;
 
 namespace KIMAP2
@@ -40,6 +57,152 @@ class Job;
 struct Message;
 class SessionLogger;
 class ImapStreamParser;
+class DeflateDevice;
+class HostConnector;
+class Transport;
+class FlagTable;
+
+/**
+ * The jobs waiting to run, which can leave from anywhere in constant time.
+ *
+ * Only the pointers are used for the bookkeeping, so a job can still be removed while it is destroyed.
+ */
+class JobQueue
+{
+public:
+    typedef std::list<Job *>::iterator iterator;
+    typedef std::list<Job *>::const_iterator const_iterator;
+
+    inline bool isEmpty() const
+    {
+        return m_jobs.empty();
+    }
+    inline int size() const
+    {
+        return int(m_jobs.size());
+    }
+    inline bool contains(Job *job) const
+    {
+        return m_positions.contains(job);
+    }
+    inline Job *head() const
+    {
+        return m_jobs.front();
+    }
+    inline Job *dequeue()
+    {
+        Job *job = m_jobs.front();
+        remove(job);
+        return job;
+    }
+    inline void enqueue(Job *job)
+    {
+        insert(m_jobs.end(), job);
+    }
+    inline void prepend(Job *job)
+    {
+        insert(m_jobs.begin(), job);
+    }
+    inline void insert(iterator before, Job *job)
+    {
+        Q_ASSERT(!contains(job));
+        m_positions.insert(job, m_jobs.insert(before, job));
+    }
+    inline bool remove(Job *job)
+    {
+        const auto position = m_positions.find(job);
+        if (position == m_positions.end()) {
+            return false;
+        }
+        m_jobs.erase(position.value());
+        m_positions.erase(position);
+        return true;
+    }
+    inline void clear()
+    {
+        m_jobs.clear();
+        m_positions.clear();
+    }
+    inline QList<Job *> toList() const
+    {
+        QList<Job *> jobs;
+        jobs.reserve(size());
+        for (Job *job : m_jobs) {
+            jobs << job;
+        }
+        return jobs;
+    }
+
+    inline iterator begin()
+    {
+        return m_jobs.begin();
+    }
+    inline iterator end()
+    {
+        return m_jobs.end();
+    }
+    inline const_iterator begin() const
+    {
+        return m_jobs.begin();
+    }
+    inline const_iterator end() const
+    {
+        return m_jobs.end();
+    }
+
+private:
+    std::list<Job *> m_jobs;
+    QHash<Job *, iterator> m_positions;
+};
+
+/**
+ * What a SELECT reported about the selected mailbox, kept up to date by the untagged
+ * responses that followed it. See Session::setSelectCacheEnabled().
+ */
+struct SelectState {
+    SelectState()
+        : valid(false), readOnly(false), condstoreEnabled(false), messageCount(-1), recentCount(-1),
+          firstUnseenIndex(-1), uidValidity(-1), nextUid(-1), highestModSequence(0) { }
+
+    bool valid;
+    QString mailBox;
+    bool readOnly;
+    bool condstoreEnabled;
+    QList<QByteArray> flags;
+    QList<QByteArray> permanentFlags;
+    int messageCount;
+    int recentCount;
+    int firstUnseenIndex;
+    qint64 uidValidity;
+    qint64 nextUid;
+    quint64 highestModSequence;
+    QByteArray mailBoxId;
+};
+
+/**
+ * The UIDs of the messages in the selected mailbox by sequence number, 0 where a UID isn't
+ * known. See Session::setUidMapEnabled().
+ */
+struct SequenceMap {
+    SequenceMap() : counted(false), unknown(0), expungedUid(0) { }
+
+    QVector<quint32> uids;
+    // Whether uids has an entry for every message, from an EXISTS or a search since the map was reset
+    bool counted;
+    // How many of uids are 0
+    int unknown;
+    // The UID of the message the last EXPUNGE removed, 0 if it wasn't known
+    qint64 expungedUid;
+};
+
+/**
+ * What GETQUOTAROOT reported for a mailbox: its quota roots, and the usage and limit of each
+ * resource by root.
+ */
+struct QuotaRootState {
+    QList<QByteArray> roots;
+    QMap<QByteArray, QMap<QByteArray, QPair<qint64, qint64> > > quotas;
+};
 
 class KIMAP2_EXPORT SessionPrivate : public QObject
 {
@@ -52,19 +215,188 @@ public:
     virtual ~SessionPrivate();
 
     void addJob(Job *job);
-    QByteArray sendCommand(const QByteArray &command, const QByteArray &args = QByteArray());
+    void addJobs(const QList<Job *> &jobs);
+
+    /**
+     * Lets the queued jobs of higher priority run before @p job continues.
+     *
+     * Only possible for the running job, between two of its commands. Returns true if the job was
+     * queued again, in which case JobPrivate::resume is called once it is its turn, after selecting
+     * its mailbox again if necessary.
+     */
+    bool stepAside(Job *job);
+
+    /**
+     * The commands sent with Session::sendCommand(). A job that stays with the session takes
+     * their place in the queue and hands its work back to these.
+     */
+    void queueCommand(const QByteArray &command, const QByteArray &arguments, const Session::CommandCallback &callback);
+    void sendQueuedCommands();
+    void queuedCommandResponse(const KIMAP2::Message &response);
+    void failQueuedCommands();
+
+    /**
+     * Remembers the outcome of a successful SELECT, if the select cache is enabled.
+     */
+    void rememberSelect(const SelectState &select);
+
+    /**
+     * Returns the remembered state if @p mailBox is selected with the same options, or an invalid one.
+     */
+    SelectState cachedSelect(const QString &mailBox, bool readOnly, bool condstoreEnabled) const;
+
+    /**
+     * The results of MyRightsJob, GetAclJob and GetQuotaRootJob, if the mailbox info cache is
+     * enabled, see Session::setMailBoxInfoCacheTimeout(). The lookups return false for what
+     * isn't known or has expired.
+     */
+    void rememberMyRights(const QString &mailBox, Acl::Rights rights);
+    bool cachedMyRights(const QString &mailBox, Acl::Rights *rights) const;
+    void rememberAcl(const QString &mailBox, const QMap<QByteArray, Acl::Rights> &rights);
+    bool cachedAcl(const QString &mailBox, QMap<QByteArray, Acl::Rights> *rights) const;
+    void rememberQuotaRoot(const QString &mailBox, const QuotaRootState &quotaRoot);
+    bool cachedQuotaRoot(const QString &mailBox, QuotaRootState *quotaRoot) const;
+
+    /**
+     * Drops the cached rights and quota of @p mailBox, for a job that changes them.
+     */
+    void forgetMailBoxInfo(const QString &mailBox);
+
+    /**
+     * Drops the cached quotas of all mailboxes under @p root.
+     */
+    void forgetQuotaRoot(const QByteArray &root);
+
+    /**
+     * Starts the next queued job right away, while @p job still waits for its completion.
+     *
+     * Only one job follows up, independent of whether pipelining is enabled.
+     */
+    void startFollowUp(Job *job);
+    QByteArray sendCommand(const QByteArray &command, const QByteArray &args = QByteArray(), Job *job = Q_NULLPTR);
     void startSsl(QSsl::SslProtocol version);
-    void sendData(const QByteArray &data);
+    /**
+     * Writes @p data after the data sent so far, followed by CRLF unless @p endLine is false,
+     * e.g. for a literal that more arguments follow on the same line.
+     */
+    void sendData(const QByteArray &data, bool endLine = true);
+
+    /**
+     * Writes @p size bytes read from @p device, followed by CRLF unless @p endLine is false,
+     * after the data sent so far.
+     *
+     * The device is read a chunk at a time whenever the socket wrote most of the previous ones,
+     * so its content is never held in memory as a whole. @p progress is called with the number
+     * of bytes written so far. The device has to be read from the session thread. If it has fewer
+     * bytes than announced, the connection is closed, since the server waits for all of them.
+     */
+    void sendDevice(QIODevice *device, qint64 size, const std::function<void(qint64 written)> &progress, bool endLine = true);
 
     void setSocketTimeout(int ms);
     int socketTimeout() const;
 
+    /**
+     * Returns true if the server accepts a literal of @p size without a continuation request,
+     * as announced with LITERAL+ or LITERAL- (RFC 7888).
+     */
+    bool canSendNonSynchronizingLiteral(qint64 size) const;
+
+    /**
+     * Returns the largest message the server accepts with APPEND to @p mailBox (RFC 7889),
+     * or -1 if it has no known limit. A limit reported for the mailbox with STATUS, see
+     * rememberAppendLimit(), takes precedence over the one in the capabilities.
+     */
+    qint64 appendLimit(const QString &mailBox) const;
+    void rememberAppendLimit(const QString &mailBox, qint64 limit);
+
+    /**
+     * Whether @p extension was turned on with ENABLE (RFC 5161) on this connection.
+     */
+    bool isExtensionEnabled(const QByteArray &extension) const;
+
+    /**
+     * Whether the connection follows IMAP4rev2 (RFC 9051): the server announced only IMAP4rev2,
+     * or IMAP4rev2 was turned on with ENABLE. Mailbox names are UTF-8 then, there is no RECENT,
+     * and SEARCH is answered with ESEARCH.
+     */
+    bool isImap4Rev2() const;
+
+    /**
+     * Whether the server announced @p capability, given in upper case, or it is part of IMAP4rev2
+     * and the connection follows it, e.g. ESEARCH, LIST-EXTENDED or LIST-STATUS.
+     */
+    bool hasCapability(const QByteArray &capability) const;
+
+    /**
+     * Converts mailbox names between modified UTF-7 and Unicode, like decodeImapFolderName()
+     * and encodeImapFolderName(). Names that need converting are remembered if the name cache
+     * is enabled, see Session::setMailBoxNameCacheEnabled(). Once UTF8=ACCEPT or IMAP4rev2 is
+     * enabled, names are plain UTF-8 in both directions. Only call on the session thread.
+     */
+    QString decodeMailBoxName(const QByteArray &name);
+    QByteArray encodeMailBoxName(const QString &name);
+    bool hasUtf8MailBoxNames() const;
+
+    /**
+     * Compresses all traffic from now on (RFC 4978).
+     *
+     * Call while handling the tagged OK of COMPRESS DEFLATE, since the server compresses
+     * everything that follows it.
+     */
+    void startCompression();
+    bool isCompressionActive() const;
+
+    /**
+     * Takes @p job out of the queue if it didn't run yet, so that it can finish on its own right away.
+     */
+    bool cancelQueuedJob(Job *job);
+
+    /**
+     * Returns true if nothing but @p job runs or waits on the session.
+     */
+    bool isOnlyJob(Job *job) const;
+
+    /**
+     * Returns how much of the literal being received is still to come.
+     */
+    qint64 literalBytesPending() const;
+
+    /**
+     * Stops reading from the socket at the end of the current response, for a consumer of @p job
+     * that can't keep up. Reading continues with resumeReading(), or once the job is done.
+     */
+    void pauseReading(Job *job);
+    void resumeReading(Job *job);
+
+    /**
+     * Fails @p job because @p what went over a limit of the session, see Session::setMaximumLiteralSize().
+     *
+     * The job receives no more responses, it finishes once the server completed its commands.
+     */
+    void exceedLimit(Job *job, const QString &what);
+
+    /**
+     * Remembers how to log in again after reconnecting, for a LoginJob that succeeded, see
+     * Session::setReconnectPolicy(). forgetLogin() ends the session for good, e.g. for LOGOUT.
+     */
+    void rememberLogin(const Session::JobFactory &login);
+    void forgetLogin();
+
+    /**
+     * Runs @p call on the thread the session I/O lives on.
+     *
+     * The call is made directly when already on that thread, and queued otherwise.
+     */
+    void callInSessionThread(const std::function<void()> &call);
+
+protected:
+    bool event(QEvent *event) Q_DECL_OVERRIDE;
+
 Q_SIGNALS:
     void encryptionNegotiationResult(bool);
 
 private Q_SLOTS:
-    void onSocketTimeout();
-    void onSocketProgressTimeout();
+    void checkSocketTimeout();
 
     void doStartNext();
     void jobDone(KJob *);
@@ -77,19 +409,71 @@ private Q_SLOTS:
     void handleSslErrors(const QList<QSslError> &errors);
 
     void closeSocket();
+    void closeForGood();
+    void reconnect();
     void readMessage();
     void writeDataQueue();
+    void continueWriting();
     void sslConnected();
+    void storeTlsSessionTicket();
+    void bandwidthAvailable();
+    void connectToAddress(const QHostAddress &address);
+    void transportFailed();
 
 private:
     void responseReceived(const KIMAP2::Message &);
+    void malformedResponseReceived(const KIMAP2::Message &partial, const QString &reason);
+    // A response the parser dropped for going over its limits, see Session::setParseLimits()
+    void limitedResponseReceived(const KIMAP2::Message &partial, const QString &reason);
+    Job *untaggedResponseHandler(const KIMAP2::Message &) const;
+    // Emits the signals for updates no job was there for, returns false for other responses
+    bool reportUnsolicited(const KIMAP2::Message &response);
+    void forgetJob(Job *job);
+    bool canPipelineNext() const;
+    void trafficReceived(const char *data, int size);
+    void enqueue(Job *job);
     void startNext();
     void clearJobQueue();
+    bool canReconnect(bool wasLoggedIn) const;
+    void prepareReconnect();
+    void dropReconnectJobs();
+    void prependJob(Job *job);
+    void applySocketOptions();
+    void connectToServer();
+    void connectThroughTransport();
+    BandwidthLimiter::Budget bandwidthBudget() const;
+    void waitForBandwidth(BandwidthLimiter::Direction direction);
     void setState(Session::State state);
-
+    void setGreeting(const QByteArray &greeting);
+    void updateCapabilities(const KIMAP2::Message &response);
+    void updateEnabledExtensions(const KIMAP2::Message &response);
+    void setCapabilities(const QStringList &list);
+    void setNamespaces(const QList<MailBoxDescriptor> &personal, const QList<MailBoxDescriptor> &user, const QList<MailBoxDescriptor> &shared);
+    void clearNamespaces();
+    void setCurrentMailBox(const QByteArray &mailBox);
+    void updateSelectState(const KIMAP2::Message &response);
+    void updateSequenceMap(const KIMAP2::Message &response);
+    void seedSequenceMap(QVector<quint32> uids);
+    void clearSequenceMap();
+    int jobQueueSize() const;
+    void emitJobQueueSizeChanged();
+    // Only call with publicMutex held
+    void updateMemoryUsage();
+
+    void startWorkerThread(Session::ThreadingMode mode);
+    void stopWorkerThread();
+    void callInOwnerThread(const std::function<void()> &call);
+
+    /**
+     * Arms, disarms or postpones the socket timeout.
+     *
+     * Only the time of the last activity is updated, a coarse timer checks it against the deadline.
+     */
     void startSocketTimer();
     void stopSocketTimer();
     void restartSocketTimer();
+    void onSocketTimeout();
+    void onSocketProgressTimeout();
     QString getStateName() const;
 
     Session *const q;
@@ -102,36 +486,206 @@ private:
 
     bool jobRunning;
     Job *currentJob;
-    QQueue<Job *> queue;
-
-    QByteArray authTag;
-    QByteArray selectTag;
-    QByteArray closeTag;
+    JobQueue queue;
+    // Jobs started while currentJob is still running
+    QList<Job *> pipelinedJobs;
+    // The job that lets the next one start, see startFollowUp()
+    Job *followUpOf;
+
+    struct QueuedCommand {
+        QByteArray tag;
+        QByteArray command;
+        QByteArray arguments;
+        Session::CommandCallback callback;
+        CommandResult result;
+    };
+    // Waiting for the next turn of commandRunner
+    QQueue<QueuedCommand> queuedCommands;
+    // Sent, in the order they were sent
+    QList<QueuedCommand> sentCommands;
+    Job *commandRunner;
+    bool commandRunnerQueued;
+    bool pipelining;
+    bool selectCacheEnabled;
+    SelectState selectState;
+    // The UIDVALIDITY of the mailbox that is selected, or being selected, -1 if unknown
+    qint64 selectedUidValidity;
+    bool sequenceMapEnabled;
+    // Guarded by publicMutex, only written on the session thread
+    SequenceMap sequenceMap;
+    bool jobCoalescing;
+    bool mailBoxNameCacheEnabled;
+    // In seconds, 0 while the mailbox info cache is disabled
+    int mailBoxInfoCacheTimeout;
+    template<typename T>
+    struct CachedInfo {
+        T value;
+        // In commandTimer time
+        qint64 storedAt;
+    };
+    QHash<QString, CachedInfo<Acl::Rights> > cachedMyRightsByMailBox;
+    QHash<QString, CachedInfo<QMap<QByteArray, Acl::Rights> > > cachedAclsByMailBox;
+    QHash<QString, CachedInfo<QuotaRootState> > cachedQuotaRootsByMailBox;
+    void clearMailBoxInfo();
+    // Only names that differ from their encoding, in both directions. The encoded names are
+    // looked up as the server sends them, and kept quoted as encodeMailBoxName() returns them.
+    QHash<QByteArray, QString> decodedMailBoxNames;
+    QHash<QString, QByteArray> encodedMailBoxNames;
+    void cacheMailBoxName(const QByteArray &encoded, const QByteArray &quoted, const QString &decoded);
+
+    /**
+     * A command that was sent and whose tagged completion is still pending.
+     */
+    struct PendingCommand {
+        enum Transition { NoTransition, Authenticate, Select, Close };
+
+        PendingCommand() : job(Q_NULLPTR), transition(NoTransition), sentAt(0), listsAllUids(false) { }
+
+        bool isValid() const
+        {
+            return !command.isEmpty();
+        }
+
+        // The job that receives the completion, or null if it is no longer running
+        Job *job;
+        // The state change on completion
+        Transition transition;
+        // The mailbox being selected
+        QByteArray mailBox;
+        // The command name, e.g. "UID FETCH"
+        QByteArray command;
+        qint64 sentAt;
+        // A UID SEARCH ALL, whose results seed the sequence map
+        bool listsAllUids;
+    };
+    QHash<QByteArray, PendingCommand> pendingCommands;
+    QElapsedTimer commandTimer;
+    void recordCompletion(const PendingCommand &command, bool ok);
+    // Completes the command of a dropped completion without the text that couldn't be kept
+    void completeDroppedResponse(const KIMAP2::Message &partial, const QByteArray &tag, const PendingCommand &command);
 
     QString userName;
     QByteArray greeting;
+    // The capabilities the server announced last
+    QSet<QByteArray> capabilities;
+    // Whether they were announced since the last LOGIN or AUTHENTICATE was sent
+    bool capabilitiesAnnounced;
+    // Reported with STATUS, -1 where the server has no limit for the mailbox
+    QHash<QString, qint64> appendLimits;
+    // Turned on with ENABLE on this connection
+    QSet<QByteArray> enabledExtensions;
+    // The same in the announced order, guarded by publicMutex
+    QStringList publicCapabilities;
+    QAtomicPointer<CapabilityCache> capabilityCache;
+    QAtomicPointer<SessionObserver> observer;
+    // Sent since the last data arrived, only tracked for the observer
+    QList<QByteArray> tagsAwaitingResponse;
     QByteArray currentMailBox;
-    QByteArray upcomingMailBox;
     quint16 tagCount;
 
     int socketTimerInterval;
+    // Checks the deadline periodically while it is armed
     QTimer socketTimer;
     int socketProgressInterval;
-    QTimer socketProgressTimer;
+    bool socketDeadlineArmed;
+    // In commandTimer time
+    qint64 lastSocketActivity;
+    qint64 lastProgressReport;
 
     QString hostName;
     quint16 port;
 
+    // Opens the connections instead of TCP, if set. Declared before the socket, so that the
+    // connection is closed before the transport goes away
+    QSharedPointer<Transport> transport;
     QScopedPointer<QSslSocket> socket;
+    // The ticket from the TLS session cache that the current handshake offers
+    QByteArray offeredTlsSessionTicket;
+    // Finds the address to connect to, see Session::setConnectionRacingEnabled()
+    HostConnector *hostConnector;
     QScopedPointer<ImapStreamParser> stream;
-
-    QQueue<QByteArray> dataQueue;
+    // Between the socket and the parser once COMPRESS is active
+    QScopedPointer<DeflateDevice> compression;
+    // The job whose consumer we wait for while reading is paused
+    Job *readingPausedBy;
+
+    /**
+     * Data waiting to be written, either as it is or streamed from a device, see sendDevice().
+     */
+    struct OutgoingData {
+        OutgoingData() : endLine(true), streamed(false), size(0), written(0) {}
+
+        QByteArray data;
+        bool endLine;
+        bool streamed;
+        QPointer<QIODevice> device;
+        qint64 size;
+        qint64 written;
+        std::function<void(qint64 written)> progress;
+    };
+    /**
+     * Writes as much of @p outgoing to @p device as the socket takes.
+     * Returns true once it was written completely.
+     */
+    bool writeStream(QIODevice *device, OutgoingData &outgoing);
+    void write(QIODevice *device, const QByteArray &data);
+
+    QQueue<OutgoingData> dataQueue;
+    QByteArray writeBuffer;
+    bool writeScheduled;
 
     QTime time;
     qint64 accumulatedWaitTime;
     qint64 accumulatedProcessingTime;
     bool trackTime;
     bool dumpTraffic;
+
+    // Only set if the I/O doesn't happen on the owner thread
+    QThread *workerThread;
+    bool ownsWorkerThread;
+    // Stays on the owner thread to run calls posted from elsewhere
+    QScopedPointer<QObject> ownerCalls;
+    // Shared by the flags of all fetched messages, kept across reconnects
+    QSharedPointer<FlagTable> flagTable;
+    // Guards the state that is read from the owner thread
+    mutable QMutex publicMutex;
+    QAtomicInt publicJobQueueSize;
+    // Also guarded by publicMutex
+    SessionMetrics metrics;
+    SessionMemoryUsage memoryUsage;
+    // What the parser and the socket of the session thread were given last
+    ParseLimits parseLimits;
+    qint64 readBufferSize;
+    // From the last NamespaceJob on this connection, also guarded by publicMutex
+    bool namespacesKnown;
+    QList<MailBoxDescriptor> personalNamespaces;
+    QList<MailBoxDescriptor> userNamespaces;
+    QList<MailBoxDescriptor> sharedNamespaces;
+    // 0 for no limit
+    qint64 maximumLiteralSize;
+    qint64 maximumResponseBytes;
+    int maximumQueuedJobs;
+    // The bytes read when currentJob started receiving the responses
+    qint64 currentJobReceivedFrom;
+    QTimer metricsTimer;
+
+    SocketOptions socketOptions;
+    ReconnectPolicy reconnectPolicy;
+    // Creates a LoginJob like the last one that succeeded, unset before and after LOGOUT
+    Session::JobFactory reconnectLogin;
+    // From losing the connection until the login succeeded again
+    bool reconnecting;
+    int reconnectAttempts;
+    QTimer reconnectTimer;
+    // Selected when the connection was lost
+    QByteArray reconnectMailBox;
+    // The login and select queued for the current attempt
+    QList<QPointer<Job> > reconnectJobs;
+
+    // Not owned, see Session::setBandwidthLimiter()
+    BandwidthLimiter *bandwidthLimiter;
+    // Continues reading and writing once the limiter allows it again
+    QTimer bandwidthTimer;
 };
 
 }
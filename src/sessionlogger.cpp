@@ -22,19 +22,153 @@
 
 #include "kimap_debug.h"
 
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QMutex>
+#include <QtCore/QtEndian>
+#include <QtCore/QThread>
+#include <QtCore/QWaitCondition>
+
+#include <cctype>
+#include <cstring>
+
 #ifdef WIN32
 #include <process.h>
 #else
 #include <unistd.h> //for getpid()
 #endif
 
+namespace KIMAP2
+{
+
+/**
+ * Formats and writes the queued traffic on a background thread.
+ */
+class SessionLoggerPrivate : public QThread
+{
+public:
+    enum RecordType {
+        Sent = 'C',
+        Received = 'S',
+        Disconnected = 'X',
+        Dropped = 'D'
+    };
+
+    SessionLoggerPrivate();
+
+    void enqueue(char type, const char *data, int size);
+    void stop();
+
+    inline bool isCapture() const
+    {
+        return m_capture;
+    }
+
+protected:
+    void run() Q_DECL_OVERRIDE;
+
+private:
+    void appendRecord(char type, const char *data, int size);
+    void writeRecords(const QByteArray &records);
+    void writeCaptureRecord(char type, qint64 timestamp, const char *data, int size);
+    void writeSent(const QByteArray &data);
+    void writeReceived(const char *data, int size);
+    void finishLine();
+    void flushOutput();
+
+    QFile m_file;
+    qint64 m_maximumSize;
+    bool m_redact;
+    bool m_capture;
+    QElapsedTimer m_clock;
+
+    // Shared with the session
+    QMutex m_mutex;
+    QWaitCondition m_condition;
+    QByteArray m_pending;
+    qint64 m_droppedBytes;
+    bool m_stopping;
+    QAtomicInt m_full;
+
+    // Only used by the writer thread
+    QByteArray m_output;
+    qint64 m_written;
+    bool m_atLineStart;
+    QByteArray m_lineTail;
+    qint64 m_literalRemaining;
+};
+
+}
+
 using namespace KIMAP2;
 
-SessionLogger::SessionLogger()
-    : m_id(0)
+// Wake the writer once this much is queued, otherwise write at least every FlushInterval ms
+static const int FlushThreshold = 64 * 1024;
+static const int FlushInterval = 1000;
+// Data beyond this is dropped if the writer can't keep up
+static const int MaximumPending = 8 * 1024 * 1024;
+// Bytes of a line kept to detect literals
+static const int LineTailSize = 32;
+// See SessionLogger
+static const char CaptureHeader[] = "KIMAP2 capture 1\n";
+static const int CaptureRecordHeaderSize = 1 + 8 + 4;
+
+/**
+ * Returns the size of the literal announced at the end of @p line, or 0.
+ */
+static qint64 literalSize(const QByteArray &line)
+{
+    if (!line.endsWith('}')) {
+        return 0;
+    }
+    const int start = line.lastIndexOf('{');
+    if (start < 0) {
+        return 0;
+    }
+    bool ok;
+    const qint64 size = line.mid(start + 1, line.size() - start - 2).toLongLong(&ok);
+    return ok ? size : 0;
+}
+
+/**
+ * Leaves out credentials and anything sent outside of a command.
+ */
+static QByteArray redacted(const QByteArray &line)
+{
+    //Commands start with a tag, everything else is continuation data such as literals or authentication responses
+    int tagEnd = 1;
+    while (tagEnd < line.size() && isdigit(line.at(tagEnd))) {
+        ++tagEnd;
+    }
+    if (!line.startsWith('A') || tagEnd == 1 || tagEnd == line.size() || line.at(tagEnd) != ' ') {
+        if (line == "DONE") {
+            return line;
+        }
+        return '<' + QByteArray::number(line.size()) + " bytes redacted>";
+    }
+    const int commandEnd = line.indexOf(' ', tagEnd + 1);
+    if (commandEnd > 0) {
+        const QByteArray command = line.mid(tagEnd + 1, commandEnd - tagEnd - 1).toUpper();
+        if (command == "LOGIN" || command == "AUTHENTICATE") {
+            return line.left(commandEnd) + " <redacted>";
+        }
+    }
+    return line;
+}
+
+SessionLoggerPrivate::SessionLoggerPrivate()
+    : m_maximumSize(100 * 1024 * 1024),
+      m_redact(qEnvironmentVariableIsSet("KIMAP2_LOGFILE_REDACT")),
+      m_capture(qEnvironmentVariableIsSet("KIMAP2_LOGFILE_CAPTURE")),
+      m_droppedBytes(0),
+      m_stopping(false),
+      m_full(0),
+      m_written(0),
+      m_atLineStart(true),
+      m_literalRemaining(0)
 {
     static qint64 nextId = 0;
-    m_id = ++nextId;
+    const qint64 id = ++nextId;
 
     m_file.setFileName(QLatin1String(qgetenv("KIMAP2_LOGFILE"))
                        + QLatin1Char('.')
@@ -43,30 +177,265 @@ SessionLogger::SessionLogger()
 #else
                        + QString::number(getpid())
 #endif
-                       + QLatin1Char('.') + QString::number(m_id));
+                       + QLatin1Char('.') + QString::number(id));
     if (!m_file.open(QFile::WriteOnly)) {
         qCDebug(KIMAP2_LOG) << " m_file can be open in write only";
+        m_full.store(1);
+    }
+
+    if (!qEnvironmentVariableIsEmpty("KIMAP2_LOGFILE_MAXSIZE")) {
+        m_maximumSize = qgetenv("KIMAP2_LOGFILE_MAXSIZE").toLongLong();
     }
+    if (m_capture) {
+        m_output = CaptureHeader;
+    }
+    m_clock.start();
+}
+
+void SessionLoggerPrivate::enqueue(char type, const char *data, int size)
+{
+    if (m_full.load()) {
+        return;
+    }
+    QMutexLocker locker(&m_mutex);
+    //Rather lose some of the log than grow without bounds
+    if (m_pending.size() + size > MaximumPending) {
+        m_droppedBytes += size;
+        return;
+    }
+    if (m_droppedBytes) {
+        appendRecord(Dropped, reinterpret_cast<const char *>(&m_droppedBytes), sizeof(m_droppedBytes));
+        m_droppedBytes = 0;
+    }
+    appendRecord(type, data, size);
+    if (m_pending.size() >= FlushThreshold) {
+        m_condition.wakeOne();
+    }
+}
+
+void SessionLoggerPrivate::appendRecord(char type, const char *data, int size)
+{
+    const qint64 timestamp = m_clock.nsecsElapsed() / 1000;
+    m_pending.append(type);
+    m_pending.append(reinterpret_cast<const char *>(&timestamp), sizeof(timestamp));
+    m_pending.append(reinterpret_cast<const char *>(&size), sizeof(size));
+    m_pending.append(data, size);
+}
+
+void SessionLoggerPrivate::stop()
+{
+    QMutexLocker locker(&m_mutex);
+    m_stopping = true;
+    m_condition.wakeOne();
+}
+
+void SessionLoggerPrivate::run()
+{
+    QByteArray records;
+    while (true) {
+        {
+            QMutexLocker locker(&m_mutex);
+            while (!m_stopping && m_pending.size() < FlushThreshold) {
+                if (!m_condition.wait(&m_mutex, FlushInterval) && !m_pending.isEmpty()) {
+                    break;
+                }
+            }
+            if (m_pending.isEmpty()) {
+                //Only happens once we're stopping
+                break;
+            }
+            records.swap(m_pending);
+        }
+        writeRecords(records);
+        records.clear();
+    }
+}
+
+void SessionLoggerPrivate::writeRecords(const QByteArray &records)
+{
+    if (m_full.load()) {
+        return;
+    }
+    int pos = 0;
+    while (pos < records.size()) {
+        const char type = records.at(pos);
+        qint64 timestamp;
+        memcpy(&timestamp, records.constData() + pos + 1, sizeof(timestamp));
+        int size;
+        memcpy(&size, records.constData() + pos + 1 + sizeof(timestamp), sizeof(size));
+        const char *data = records.constData() + pos + 1 + sizeof(timestamp) + sizeof(size);
+        pos += 1 + sizeof(timestamp) + sizeof(size) + size;
+
+        if (m_capture) {
+            writeCaptureRecord(type, timestamp, data, size);
+            continue;
+        }
+
+        switch (type) {
+        case Sent:
+            writeSent(QByteArray::fromRawData(data, size));
+            break;
+        case Received:
+            writeReceived(data, size);
+            break;
+        case Disconnected:
+            finishLine();
+            m_output += "X\n";
+            m_lineTail.clear();
+            m_literalRemaining = 0;
+            break;
+        case Dropped: {
+            qint64 dropped;
+            memcpy(&dropped, data, sizeof(dropped));
+            finishLine();
+            m_output += "! " + QByteArray::number(dropped) + " bytes dropped\n";
+            //We lost track of where we are in the stream
+            m_lineTail.clear();
+            m_literalRemaining = 0;
+            break;
+        }
+        default:
+            Q_ASSERT(false);
+            break;
+        }
+    }
+    flushOutput();
+}
+
+void SessionLoggerPrivate::writeCaptureRecord(char type, qint64 timestamp, const char *data, int size)
+{
+    if (m_full.load()) {
+        return;
+    }
+    QByteArray converted;
+    if (type == Sent && m_redact) {
+        converted = redacted(QByteArray::fromRawData(data, size).trimmed()) + "\r\n";
+    } else if (type == Dropped) {
+        qint64 dropped;
+        memcpy(&dropped, data, sizeof(dropped));
+        converted.resize(sizeof(dropped));
+        qToBigEndian<quint64>(dropped, reinterpret_cast<uchar *>(converted.data()));
+    }
+    if (!converted.isNull()) {
+        data = converted.constData();
+        size = converted.size();
+    }
+    //Stop at a record boundary, so that the capture stays readable
+    if (m_maximumSize > 0 && m_written + m_output.size() + CaptureRecordHeaderSize + size > m_maximumSize) {
+        m_full.store(1);
+        return;
+    }
+    char header[CaptureRecordHeaderSize];
+    header[0] = type;
+    qToBigEndian<quint64>(timestamp, reinterpret_cast<uchar *>(header + 1));
+    qToBigEndian<quint32>(size, reinterpret_cast<uchar *>(header + 9));
+    m_output.append(header, sizeof(header));
+    m_output.append(data, size);
+}
+
+void SessionLoggerPrivate::writeSent(const QByteArray &data)
+{
+    finishLine();
+    m_output += "C: " + (m_redact ? redacted(data.trimmed()) : data.trimmed()) + '\n';
+}
+
+void SessionLoggerPrivate::writeReceived(const char *data, int size)
+{
+    int pos = 0;
+    while (pos < size) {
+        if (m_literalRemaining > 0) {
+            const int amount = qMin<qint64>(m_literalRemaining, size - pos);
+            if (!m_redact) {
+                m_output.append(data + pos, amount);
+            }
+            m_literalRemaining -= amount;
+            pos += amount;
+            continue;
+        }
+
+        if (m_atLineStart) {
+            m_output += "S: ";
+            m_atLineStart = false;
+        }
+        const char *newline = static_cast<const char *>(memchr(data + pos, '\n', size - pos));
+        const int end = newline ? newline - data : size;
+        for (; pos < end; ++pos) {
+            if (data[pos] != '\r') {
+                m_output += data[pos];
+                m_lineTail += data[pos];
+            }
+        }
+        if (m_lineTail.size() > LineTailSize) {
+            m_lineTail.remove(0, m_lineTail.size() - LineTailSize);
+        }
+        if (!newline) {
+            break;
+        }
+        ++pos;
+
+        //A literal continues the line
+        m_literalRemaining = literalSize(m_lineTail);
+        m_lineTail.clear();
+        if (m_literalRemaining > 0 && m_redact) {
+            m_output += " <" + QByteArray::number(m_literalRemaining) + " bytes redacted>";
+        } else if (m_literalRemaining > 0) {
+            m_output += '\n';
+        } else {
+            m_output += '\n';
+            m_atLineStart = true;
+        }
+    }
+}
+
+void SessionLoggerPrivate::finishLine()
+{
+    if (!m_atLineStart) {
+        m_output += '\n';
+        m_atLineStart = true;
+    }
+}
+
+void SessionLoggerPrivate::flushOutput()
+{
+    if (m_maximumSize > 0 && m_written + m_output.size() > m_maximumSize) {
+        m_output.truncate(qMax<qint64>(0, m_maximumSize - m_written));
+        m_output += "\n! Log size limit reached\n";
+        m_full.store(1);
+    }
+    m_written += m_output.size();
+    m_file.write(m_output);
+    m_file.flush();
+    m_output.clear();
+}
+
+SessionLogger::SessionLogger()
+    : d(new SessionLoggerPrivate)
+{
+    d->start(QThread::LowPriority);
 }
 
 SessionLogger::~SessionLogger()
 {
-    m_file.close();
+    d->stop();
+    d->wait();
 }
 
 void SessionLogger::dataSent(const QByteArray &data)
 {
-    m_file.write("C: " + data.trimmed() + '\n');
-    m_file.flush();
+    d->enqueue(SessionLoggerPrivate::Sent, data.constData(), data.size());
 }
 
-void SessionLogger::dataReceived(const QByteArray &data)
+void SessionLogger::dataReceived(const char *data, int size)
 {
-    m_file.write("S: " + data.trimmed() + '\n');
-    m_file.flush();
+    d->enqueue(SessionLoggerPrivate::Received, data, size);
+}
+
+bool SessionLogger::isCapture() const
+{
+    return d->isCapture();
 }
 
 void SessionLogger::disconnectionOccured()
 {
-    m_file.write("X\n");
+    d->enqueue(SessionLoggerPrivate::Disconnected, Q_NULLPTR, 0);
 }
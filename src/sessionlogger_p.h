@@ -21,14 +21,31 @@
 #ifndef KIMAP2_SESSIONLOGGER_P_H
 #define KIMAP2_SESSIONLOGGER_P_H
 
-#include <QtCore/QObject>
-#include <QtCore/QFile>
+#include <QtCore/QByteArray>
+#include <QtCore/QScopedPointer>
 
 namespace KIMAP2
 {
 
 class SessionLoggerPrivate;
 
+/**
+ * Logs the traffic of a session to the file named by KIMAP2_LOGFILE.
+ *
+ * The data is only copied into a buffer on the calling thread,
+ * formatting and writing happens on a background thread.
+ *
+ * KIMAP2_LOGFILE_MAXSIZE limits the size of the file in bytes (100 MiB by default, 0 disables the limit),
+ * and if KIMAP2_LOGFILE_REDACT is set credentials, literals and data sent outside of commands are left out.
+ *
+ * If KIMAP2_LOGFILE_CAPTURE is set the file is a capture that can be replayed instead of a readable
+ * log, with the exact bytes and when they were sent or received. It starts with the line
+ * "KIMAP2 capture 1", followed by records of a type ('C' sent, 'S' received, 'X' disconnected,
+ * 'D' data dropped), the microseconds since the logger was created as a big endian 64 bit
+ * integer, the size of the data as a big endian 32 bit integer and the data (for 'D' the number of
+ * bytes as a big endian 64 bit integer). A capture starts with the connection instead of the
+ * login, and KIMAP2_LOGFILE_REDACT only affects what is sent in it, so that the responses still parse.
+ */
 class SessionLogger
 {
 public:
@@ -36,13 +53,17 @@ public:
     ~SessionLogger();
 
     void dataSent(const QByteArray &data);
-    void dataReceived(const QByteArray &data);
+    void dataReceived(const char *data, int size);
     void disconnectionOccured();
 
+    /**
+     * Returns true if the traffic is captured for a replay, which includes the login.
+     */
+    bool isCapture() const;
+
 private:
     Q_DISABLE_COPY(SessionLogger)
-    qint64 m_id;
-    QFile m_file;
+    QScopedPointer<SessionLoggerPrivate> d;
 };
 
 }
@@ -0,0 +1,366 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#include "sessionpool.h"
+
+#include "kimap_debug.h"
+
+#include "job.h"
+#include "keepalivescheduler.h"
+#include "selectjob.h"
+#include "session.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QPointer>
+#include <QtCore/QSharedPointer>
+
+#include <algorithm>
+
+namespace KIMAP2
+{
+
+struct ServerConnections {
+    int limit = 0;
+    // Connected sessions, and those that didn't connect or fail yet
+    int count = 0;
+    int opening = 0;
+};
+
+typedef QHash<QString, ServerConnections> ServerConnectionMap;
+Q_GLOBAL_STATIC(ServerConnectionMap, serverConnections)
+
+enum ConnectionState {
+    Opening,
+    Connected,
+    Closed
+};
+
+// Moves a session of @p hostName that is in @p state to @p next, a closed one stays closed
+static void updateConnection(const QString &hostName, ConnectionState *state, ConnectionState next)
+{
+    if (*state == next || *state == Closed || serverConnections.isDestroyed()) {
+        return;
+    }
+    ServerConnections &connections = (*serverConnections)[hostName];
+    if (*state == Opening) {
+        connections.opening--;
+    } else {
+        connections.count--;
+    }
+    if (next == Opening) {
+        connections.opening++;
+    } else if (next == Connected) {
+        connections.count++;
+    }
+    *state = next;
+}
+
+class SessionPoolPrivate
+{
+public:
+    struct Entry {
+        Session *session;
+        // The mailbox that is selected once the queued jobs ran
+        QString mailBox;
+        // Whether the pool opened it with EXAMINE
+        bool readOnly;
+    };
+
+    SessionPoolPrivate(SessionPool *pool)
+        : q(pool),
+          port(0),
+          maximumSessions(4)
+    {
+    }
+
+    Entry *entry(Session *session);
+    Entry *sessionFor(const QString &mailBox);
+    bool canCreateSession() const;
+    Entry *createSession();
+    void removeSession(Session *session);
+
+    SessionPool *const q;
+    QString hostName;
+    quint16 port;
+    SessionPool::SessionSetup setup;
+    int maximumSessions;
+    QList<Entry> entries;
+    QPointer<KeepAliveScheduler> keepAlive;
+};
+
+}
+
+using namespace KIMAP2;
+
+SessionPoolPrivate::Entry *SessionPoolPrivate::entry(Session *session)
+{
+    for (Entry &entry : entries) {
+        if (entry.session == session) {
+            return &entry;
+        }
+    }
+    return Q_NULLPTR;
+}
+
+SessionPoolPrivate::Entry *SessionPoolPrivate::sessionFor(const QString &mailBox)
+{
+    Entry *preferred = Q_NULLPTR;
+    Entry *leastBusy = Q_NULLPTR;
+    for (Entry &entry : entries) {
+        const int queueSize = entry.session->jobQueueSize();
+        if (!mailBox.isEmpty() && entry.mailBox == mailBox && !entry.readOnly
+                && (!preferred || queueSize < preferred->session->jobQueueSize())) {
+            preferred = &entry;
+        }
+        if (!leastBusy || queueSize < leastBusy->session->jobQueueSize()) {
+            leastBusy = &entry;
+        }
+    }
+
+    //Selecting again is more expensive than waiting for the session that has the mailbox
+    if (preferred) {
+        return preferred;
+    }
+    if (leastBusy && leastBusy->session->jobQueueSize() == 0) {
+        return leastBusy;
+    }
+    if (canCreateSession()) {
+        return createSession();
+    }
+    return leastBusy;
+}
+
+bool SessionPoolPrivate::canCreateSession() const
+{
+    if (entries.size() >= maximumSessions) {
+        return false;
+    }
+    const ServerConnections connections = serverConnections->value(hostName);
+    return connections.limit <= 0 || connections.count + connections.opening < connections.limit;
+}
+
+SessionPoolPrivate::Entry *SessionPoolPrivate::createSession()
+{
+    Session *session = new Session(hostName, port, q);
+    entries << Entry{session, QString(), false};
+
+    //Counted from connecting until the connection is gone, not for as long as the object lives
+    const QString host = hostName;
+    const QSharedPointer<ConnectionState> state(new ConnectionState(Opening));
+    (*serverConnections)[host].opening++;
+    QObject::connect(session, &QObject::destroyed, [host, state]() {
+        updateConnection(host, state.data(), Closed);
+    });
+    QObject::connect(session, &Session::stateChanged, q, [this, session, host, state](Session::State newState) {
+        updateConnection(host, state.data(), newState == Session::Disconnected ? Closed : Connected);
+        if (newState == Session::Disconnected) {
+            qCDebug(KIMAP2_LOG) << "Session disconnected, removing it from the pool";
+            removeSession(session);
+        }
+    });
+    QObject::connect(session, &Session::connectionFailed, q, [this, session, host, state]() {
+        updateConnection(host, state.data(), Closed);
+        removeSession(session);
+    });
+    QObject::connect(session, &Session::jobQueueSizeChanged, q, [this, session](int queueSize) {
+        //Whatever ran, this is what is selected now
+        if (queueSize == 0) {
+            Entry *e = entry(session);
+            if (e && e->mailBox != session->selectedMailBox()) {
+                e->mailBox = session->selectedMailBox();
+                e->readOnly = false;
+            }
+        }
+    });
+
+    if (keepAlive) {
+        keepAlive->addSession(session);
+    }
+    if (setup) {
+        setup(session);
+    }
+    return &entries.last();
+}
+
+void SessionPoolPrivate::removeSession(Session *session)
+{
+    for (int i = 0; i < entries.size(); ++i) {
+        if (entries.at(i).session == session) {
+            entries.removeAt(i);
+            if (keepAlive) {
+                keepAlive->removeSession(session);
+            }
+            session->deleteLater();
+            return;
+        }
+    }
+}
+
+SessionPool::SessionPool(const QString &hostName, quint16 port, const SessionSetup &setup, QObject *parent)
+    : QObject(parent), d(new SessionPoolPrivate(this))
+{
+    d->hostName = hostName;
+    d->port = port;
+    d->setup = setup;
+}
+
+SessionPool::~SessionPool()
+{
+    //Don't react to the sessions going away anymore
+    const QList<Session *> sessions = this->sessions();
+    d->entries.clear();
+    qDeleteAll(sessions);
+    delete d;
+}
+
+void SessionPool::setMaximumSessions(int maximum)
+{
+    Q_ASSERT(maximum > 0);
+    d->maximumSessions = maximum;
+}
+
+int SessionPool::maximumSessions() const
+{
+    return d->maximumSessions;
+}
+
+void SessionPool::setConnectionLimit(const QString &hostName, int limit)
+{
+    (*serverConnections)[hostName].limit = limit;
+}
+
+int SessionPool::connectionLimit(const QString &hostName)
+{
+    return serverConnections->value(hostName).limit;
+}
+
+Job *SessionPool::submit(const QString &mailBox, const JobFactory &factory)
+{
+    SessionPoolPrivate::Entry *entry = d->sessionFor(mailBox);
+    if (!entry) {
+        qCWarning(KIMAP2_LOG) << "The connection limit for" << d->hostName << "doesn't allow another session";
+        return Q_NULLPTR;
+    }
+    Session *session = entry->session;
+
+    if (!mailBox.isEmpty() && (entry->mailBox != mailBox || entry->readOnly)) {
+        SelectJob *select = new SelectJob(session);
+        select->setMailBox(mailBox);
+        select->start();
+        entry->mailBox = mailBox;
+        entry->readOnly = false;
+    }
+
+    Job *job = factory(session);
+    job->start();
+    return job;
+}
+
+Job *SessionPool::submit(Session *session, const QString &mailBox, const JobFactory &factory, bool readOnly)
+{
+    SessionPoolPrivate::Entry *entry = d->entry(session);
+    if (!entry) {
+        qCWarning(KIMAP2_LOG) << "The session isn't in the pool";
+        return Q_NULLPTR;
+    }
+
+    //A selected mailbox serves read-only jobs as well
+    if (!mailBox.isEmpty() && (entry->mailBox != mailBox || (entry->readOnly && !readOnly))) {
+        SelectJob *select = new SelectJob(session);
+        select->setMailBox(mailBox);
+        select->setOpenReadOnly(readOnly);
+        select->start();
+        entry->mailBox = mailBox;
+        entry->readOnly = readOnly;
+    }
+
+    Job *job = factory(session);
+    job->start();
+    return job;
+}
+
+QList<Session *> SessionPool::sessionsFor(const QString &mailBox, int count)
+{
+    QList<SessionPoolPrivate::Entry *> candidates;
+    for (SessionPoolPrivate::Entry &entry : d->entries) {
+        candidates << &entry;
+    }
+    std::stable_sort(candidates.begin(), candidates.end(), [&mailBox](const SessionPoolPrivate::Entry *left, const SessionPoolPrivate::Entry *right) {
+        const bool leftHasIt = !mailBox.isEmpty() && left->mailBox == mailBox;
+        const bool rightHasIt = !mailBox.isEmpty() && right->mailBox == mailBox;
+        if (leftHasIt != rightHasIt) {
+            return leftHasIt;
+        }
+        return left->session->jobQueueSize() < right->session->jobQueueSize();
+    });
+
+    QList<Session *> sessions;
+    for (const SessionPoolPrivate::Entry *entry : candidates) {
+        if (sessions.size() >= count) {
+            break;
+        }
+        sessions << entry->session;
+    }
+    while (sessions.size() < count && d->canCreateSession()) {
+        sessions << d->createSession()->session;
+    }
+    return sessions;
+}
+
+Session *SessionPool::openSession()
+{
+    if (!d->canCreateSession()) {
+        return Q_NULLPTR;
+    }
+    return d->createSession()->session;
+}
+
+void SessionPool::setKeepAliveScheduler(KeepAliveScheduler *scheduler)
+{
+    if (d->keepAlive) {
+        for (const SessionPoolPrivate::Entry &entry : d->entries) {
+            d->keepAlive->removeSession(entry.session);
+        }
+        d->keepAlive->disconnect(this);
+    }
+    d->keepAlive = scheduler;
+    if (!scheduler) {
+        return;
+    }
+    for (const SessionPoolPrivate::Entry &entry : d->entries) {
+        scheduler->addSession(entry.session);
+    }
+    connect(scheduler, &KeepAliveScheduler::sessionUnresponsive, this, [this](Session *session) {
+        qCDebug(KIMAP2_LOG) << "Session is unresponsive, removing it from the pool";
+        d->removeSession(session);
+    });
+}
+
+KeepAliveScheduler *SessionPool::keepAliveScheduler() const
+{
+    return d->keepAlive;
+}
+
+QList<Session *> SessionPool::sessions() const
+{
+    QList<Session *> sessions;
+    for (const SessionPoolPrivate::Entry &entry : d->entries) {
+        sessions << entry.session;
+    }
+    return sessions;
+}
@@ -0,0 +1,135 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_SESSIONPOOL_H
+#define KIMAP2_SESSIONPOOL_H
+
+#include "kimap2_export.h"
+
+#include <QtCore/QObject>
+
+#include <functional>
+
+namespace KIMAP2
+{
+
+class Job;
+class KeepAliveScheduler;
+class Session;
+class SessionPoolPrivate;
+
+/**
+ * Distributes the jobs of one account over several sessions.
+ *
+ * Jobs are submitted together with the mailbox they operate on and go to a session that
+ * already has this mailbox selected, if there is one. Otherwise an idle session, or a new
+ * one if the limits allow it, selects the mailbox first. Sessions that lose their connection
+ * are dropped from the pool and replaced on demand.
+ */
+class KIMAP2_EXPORT SessionPool : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * Prepares a new session, e.g. by starting a LoginJob on it.
+     *
+     * Jobs started here run before any job the pool submits to the session.
+     */
+    typedef std::function<void(Session *session)> SessionSetup;
+
+    /**
+     * Creates a job on the given session. The pool starts it.
+     */
+    typedef std::function<Job *(Session *session)> JobFactory;
+
+    SessionPool(const QString &hostName, quint16 port, const SessionSetup &setup, QObject *parent = Q_NULLPTR);
+    ~SessionPool();
+
+    /**
+     * Sets how many sessions the pool opens at most. The default is 4.
+     */
+    void setMaximumSessions(int maximum);
+    int maximumSessions() const;
+
+    /**
+     * Limits the number of connections all pools together open to @p hostName.
+     *
+     * A session counts while it connects and while it is connected, one that lost its
+     * connection no longer does. A limit of 0, the default, only applies the maximum of each pool.
+     */
+    static void setConnectionLimit(const QString &hostName, int limit);
+    static int connectionLimit(const QString &hostName);
+
+    /**
+     * Creates a job for @p mailBox on a suitable session and starts it.
+     *
+     * If the session doesn't have @p mailBox selected by the time the job runs, a SelectJob
+     * is queued before it. An empty mailbox runs the job on the least busy session as is.
+     *
+     * Returns null without calling @p factory if the pool has no session and the connection limit
+     * of the server doesn't allow opening one.
+     */
+    Job *submit(const QString &mailBox, const JobFactory &factory);
+
+    /**
+     * Creates a job for @p mailBox on @p session, which must be one of sessions(), and starts it.
+     *
+     * If the session doesn't have @p mailBox open, a SelectJob is queued before the job, which
+     * opens it with EXAMINE if @p readOnly is true. A session that examined a mailbox isn't
+     * used by submit() for that mailbox until it selected it again.
+     *
+     * Returns null without calling @p factory if @p session isn't in the pool.
+     */
+    Job *submit(Session *session, const QString &mailBox, const JobFactory &factory, bool readOnly = false);
+
+    /**
+     * Returns up to @p count different sessions to spread work on @p mailBox over, e.g. for
+     * a ParallelFetchJob. Sessions that have @p mailBox open come first, then the least busy
+     * ones, and new sessions are opened as long as the limits allow it.
+     *
+     * The list is empty if the pool has no session and can't open one.
+     */
+    QList<Session *> sessionsFor(const QString &mailBox, int count);
+
+    /**
+     * Opens another session if the maximum and the connection limit of the server allow it,
+     * returns null otherwise.
+     */
+    Session *openSession();
+
+    /**
+     * Keeps the sessions of the pool alive with @p scheduler, which can be shared with other
+     * pools. Sessions that don't answer its NOOP are dropped from the pool, like those that
+     * lose their connection. The scheduler isn't owned, null (the default) doesn't use one.
+     */
+    void setKeepAliveScheduler(KeepAliveScheduler *scheduler);
+    KeepAliveScheduler *keepAliveScheduler() const;
+
+    /**
+     * Returns the sessions currently in the pool.
+     */
+    QList<Session *> sessions() const;
+
+private:
+    friend class SessionPoolPrivate;
+    SessionPoolPrivate *const d;
+};
+
+}
+
+#endif
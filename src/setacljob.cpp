@@ -54,7 +54,8 @@ void SetAclJob::doStart()
     } else if (d->modifier == Remove) {
         r.prepend('-');
     }
-    d->sendCommand("SETACL", '\"' + KIMAP2::encodeImapFolderName(d->mailBox.toUtf8()) + "\" \"" + d->id + "\" \"" + r + '\"');
+    d->sessionInternal()->forgetMailBoxInfo(d->mailBox);
+    d->sendCommand("SETACL", '\"' + d->sessionInternal()->encodeMailBoxName(d->mailBox) + "\" \"" + d->id + "\" \"" + r + '\"');
 }
 
 void SetAclJob::setRights(AclModifier modifier, Acl::Rights rights)
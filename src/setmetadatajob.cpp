@@ -57,7 +57,7 @@ void SetMetaDataJob::doStart()
 {
     Q_D(SetMetaDataJob);
     QByteArray parameters;
-    parameters = '\"' + KIMAP2::encodeImapFolderName(d->mailBox.toUtf8()) + "\" ";
+    parameters = '\"' + d->sessionInternal()->encodeMailBoxName(d->mailBox) + "\" ";
     d->entriesIt = d->entries.constBegin();
 
     QByteArray command = "SETMETADATA";
@@ -65,6 +65,7 @@ void SetQuotaJob::doStart()
 
     qCDebug(KIMAP2_LOG) << "SETQUOTA " << '\"' + d->root + "\" " + s;
     //XXX: [alexmerry, 2010-07-24]: should d->root be quoted properly?
+    d->sessionInternal()->forgetQuotaRoot(d->root);
     d->sendCommand("SETQUOTA", '\"' + d->root + "\" " + s);
 }
 
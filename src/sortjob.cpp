@@ -0,0 +1,226 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "sortjob.h"
+
+#include "kimap_debug.h"
+
+#include "job_p.h"
+#include "message_p.h"
+#include "session_p.h"
+
+namespace KIMAP2
+{
+class SortJobPrivate : public JobPrivate
+{
+public:
+    SortJobPrivate(Session *session, const QString &name)
+        : JobPrivate(session, name), uidBased(false), charset("UTF-8"), first(0), last(0), count(0), esort(false) { }
+    ~SortJobPrivate() { }
+
+    bool uidBased;
+    QByteArray charset;
+    QList<QByteArray> sortKeys;
+    Term term;
+    qint64 first;
+    qint64 last;
+    QVector<qint64> results;
+    qint64 count;
+    bool esort;
+};
+}
+
+using namespace KIMAP2;
+
+SortJob::SortJob(Session *session)
+    : Job(*new SortJobPrivate(session, "Sort"))
+{
+}
+
+SortJob::~SortJob()
+{
+}
+
+void SortJob::setUidBased(bool uidBased)
+{
+    Q_D(SortJob);
+    d->uidBased = uidBased;
+}
+
+bool SortJob::isUidBased() const
+{
+    Q_D(const SortJob);
+    return d->uidBased;
+}
+
+void SortJob::setCharset(const QByteArray &charset)
+{
+    Q_D(SortJob);
+    d->charset = charset;
+}
+
+QByteArray SortJob::charset() const
+{
+    Q_D(const SortJob);
+    return d->charset;
+}
+
+void SortJob::addSortKey(SortKey key, bool reverse)
+{
+    Q_D(SortJob);
+    static const char *const names[] = {"ARRIVAL", "CC", "DATE", "FROM", "SIZE", "SUBJECT", "TO"};
+    const QByteArray name = names[key];
+    d->sortKeys << (reverse ? "REVERSE " + name : name);
+}
+
+void SortJob::setTerm(const Term &term)
+{
+    Q_D(SortJob);
+    d->term = term;
+}
+
+void SortJob::setPartial(qint64 first, qint64 last)
+{
+    Q_D(SortJob);
+    d->first = first;
+    d->last = last;
+}
+
+QVector<qint64> SortJob::results() const
+{
+    Q_D(const SortJob);
+    if (d->esort || d->first <= 0 || d->last < d->first) {
+        return d->results;
+    }
+    //The server sent all of them
+    return d->results.mid(d->first - 1, d->last - d->first + 1);
+}
+
+ImapSet SortJob::resultSet() const
+{
+    const QVector<qint64> values = results();
+    ImapSet set;
+    for (int i = 0; i < values.size();) {
+        int end = i + 1;
+        while (end < values.size() && values.at(end) == values.at(end - 1) + 1) {
+            ++end;
+        }
+        set.add(ImapInterval(values.at(i), values.at(end - 1)));
+        i = end;
+    }
+    return set;
+}
+
+qint64 SortJob::resultCount() const
+{
+    Q_D(const SortJob);
+    return d->esort ? d->count : d->results.size();
+}
+
+void SortJob::doStart()
+{
+    Q_D(SortJob);
+
+    const QStringList capabilities = d->m_session->capabilities();
+    if (!capabilities.contains(QStringLiteral("SORT"), Qt::CaseInsensitive)) {
+        qCWarning(KIMAP2_LOG) << "Sorting on the server requires SORT";
+        setError(KJob::UserDefinedError);
+        setErrorText(QStringLiteral("The server does not support SORT"));
+        emitResult();
+        return;
+    }
+    if (d->sortKeys.isEmpty()) {
+        qCWarning(KIMAP2_LOG) << "No sort keys given";
+        setError(KJob::UserDefinedError);
+        setErrorText(QStringLiteral("No sort keys given"));
+        emitResult();
+        return;
+    }
+
+    d->results.clear();
+    d->count = 0;
+    d->esort = d->first > 0 && d->last >= d->first
+               && capabilities.contains(QStringLiteral("CONTEXT=SORT"), Qt::CaseInsensitive);
+
+    QByteArray arguments;
+    if (d->esort) {
+        arguments = "RETURN (PARTIAL " + QByteArray::number(d->first) + ':' + QByteArray::number(d->last) + " COUNT) ";
+    }
+    arguments += '(' + d->sortKeys.join(' ') + ") " + d->charset + ' ';
+    if (d->term.isNull()) {
+        arguments += "ALL";
+    } else {
+        const QByteArray term = d->term.serialize();
+        if (term.startsWith('(')) {
+            arguments += term.mid(1, term.size() - 2);
+        } else {
+            arguments += term;
+        }
+    }
+
+    d->sendCommand(d->uidBased ? "UID SORT" : "SORT", arguments);
+}
+
+void SortJob::handleResponse(const Message &response)
+{
+    Q_D(SortJob);
+
+    if (handleErrorReplies(response) == NotHandled) {
+        if (response.content.size() >= 2 && response.content[1].toString() == "SORT") {
+            d->results.reserve(d->results.size() + response.content.size() - 2);
+            for (int i = 2; i < response.content.size(); i++) {
+                d->results << response.content[i].toString().toLongLong();
+            }
+        } else if (response.content.size() >= 2 && response.content[1].keyword() == ImapKeyword::ESearch) {
+            // * ESEARCH (TAG "A000001") UID PARTIAL (1:50 23,1:5,94) COUNT 300000
+            for (int i = 2; i < response.content.size(); i++) {
+                const Message::Part &part = response.content[i];
+                if (part.type() == Message::Part::List) {
+                    const QList<QByteArray> correlator = part.toList();
+                    if (correlator.size() == 2 && correlator[0].toUpper() == "TAG" && !d->tags.contains(correlator[1])) {
+                        return;
+                    }
+                    continue;
+                }
+                const QByteArray name = part.toString().toUpper();
+                if (name == "UID" || i + 1 >= response.content.size()) {
+                    continue;
+                }
+                const Message::Part &value = response.content[++i];
+                if (name == "COUNT") {
+                    d->count = value.toString().toLongLong();
+                } else if (name == "PARTIAL" && value.type() == Message::Part::List && value.toList().size() == 2) {
+                    //NIL if the window is beyond the matches
+                    const QByteArray set = value.toList().at(1);
+                    if (set.toUpper() == "NIL") {
+                        continue;
+                    }
+                    foreach (const ImapSet::Range &range, ImapSet::fromImapSequenceSet(set).ranges()) {
+                        //In sort order, so "7:5" runs backwards
+                        const qint64 end = range.end ? range.end : range.begin;
+                        const qint64 step = end < range.begin ? -1 : 1;
+                        for (qint64 id = range.begin; id != end + step; id += step) {
+                            d->results << id;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+#include "moc_sortjob.cpp"
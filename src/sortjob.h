@@ -0,0 +1,119 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_SORTJOB_H
+#define KIMAP2_SORTJOB_H
+
+#include "kimap2_export.h"
+
+#include "job.h"
+#include "imapset.h"
+#include "searchjob.h"
+
+#include <QtCore/QVector>
+
+namespace KIMAP2
+{
+
+class Session;
+struct Message;
+class SortJobPrivate;
+
+/**
+ * Sorts the messages of the selected mailbox on the server (RFC 5256).
+ *
+ * This spares fetching the headers of every message to sort them on the client.
+ * With setPartial() only a window of the sorted list is returned, e.g. the
+ * messages of one screen, if the server supports CONTEXT=SORT (RFC 5267).
+ *
+ * This job can only be run in the selected state, and requires the SORT capability.
+ */
+class KIMAP2_EXPORT SortJob : public Job
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(SortJob)
+
+    friend class SessionPrivate;
+
+public:
+    enum SortKey {
+        Arrival,
+        Cc,
+        Date,
+        From,
+        Size,
+        Subject,
+        To
+    };
+
+    explicit SortJob(Session *session);
+    virtual ~SortJob();
+
+    void setUidBased(bool uidBased);
+    bool isUidBased() const;
+
+    /**
+     * The charset of the strings in the search term, "UTF-8" by default.
+     */
+    void setCharset(const QByteArray &charset);
+    QByteArray charset() const;
+
+    /**
+     * Adds a key to sort by, after the ones added before, optionally in reverse order.
+     * At least one key is required.
+     */
+    void addSortKey(SortKey key, bool reverse = false);
+
+    /**
+     * Only the messages matching @p term are sorted, all messages by default.
+     */
+    void setTerm(const Term &term);
+
+    /**
+     * Only returns the messages from position @p first to @p last of the sorted list,
+     * counting from 1, e.g. 1 and 50 for the first screen.
+     *
+     * resultCount() is still the number of all matches. Without CONTEXT=SORT the
+     * whole list is received and cut to the window on the client.
+     */
+    void setPartial(qint64 first, qint64 last);
+
+    /**
+     * The sorted sequence numbers or UIDs, depending on isUidBased().
+     */
+    QVector<qint64> results() const;
+
+    /**
+     * The same as results(), with each ascending run of consecutive numbers as one interval.
+     *
+     * The intervals are in sort order, so the set can be passed to e.g. FetchJob::setSequenceSet().
+     */
+    ImapSet resultSet() const;
+
+    /**
+     * The number of messages that matched, also those outside of the window of setPartial().
+     */
+    qint64 resultCount() const;
+
+protected:
+    void doStart() Q_DECL_OVERRIDE;
+    void handleResponse(const Message &response) Q_DECL_OVERRIDE;
+};
+
+}
+
+#endif
@@ -21,7 +21,6 @@
 #include "job_p.h"
 #include "message_p.h"
 #include "session_p.h"
-#include "rfccodecs.h"
 #include "kimap_debug.h"
 
 namespace KIMAP2
@@ -33,15 +32,48 @@ public:
     explicit StatusJobPrivate(Session *session, const QString &name)
         : JobPrivate(session, name)
     {
+        replay = [this]() {
+            statuses.clear();
+            mailBoxId.clear();
+            nonexistent.clear();
+        };
     }
 
     ~StatusJobPrivate()
     {
     }
 
-    QString mailBox;
+    /**
+     * Returns the mailbox a STATUS response names, or a null string if it is none of ours.
+     */
+    QString mailBoxOf(const QByteArray &name) const
+    {
+        //INBOX is case-insensitive
+        return encodedNames.value(name.toUpper() == "INBOX" ? QByteArray("INBOX") : name);
+    }
+
+    /**
+     * Returns the value of @p item in the status of @p mailBox, or -1 if it wasn't reported.
+     */
+    qint64 value(const QString &mailBox, const QByteArray &item) const
+    {
+        const QList<QPair<QByteArray, qint64>> status = statuses.value(mailBox);
+        for (int i = status.size() - 1; i >= 0; --i) {
+            if (status.at(i).first == item) {
+                return status.at(i).second;
+            }
+        }
+        return -1;
+    }
+
+    QStringList mailBoxes;
+    QHash<QByteArray, QString> encodedNames;
     QList<QByteArray> dataItems;
-    QList<QPair<QByteArray, qint64>> status;
+    QHash<QString, QList<QPair<QByteArray, qint64>>> statuses;
+    QByteArray mailBoxId;
+    // The mailbox each STATUS was sent for, by tag
+    QHash<QByteArray, QString> tagMailBoxes;
+    QStringList nonexistent;
 };
 
 }
@@ -51,6 +83,15 @@ using namespace KIMAP2;
 StatusJob::StatusJob(Session *session)
     : Job(*new StatusJobPrivate(session, "Status"))
 {
+    Q_D(StatusJob);
+    //STATUS doesn't touch the session state and its response names the mailbox
+    d->pipelineSafe = true;
+    d->isInterestedIn = [d](const Message &response) {
+        if (response.content.size() < 3 || response.content[1].keyword() != ImapKeyword::Status) {
+            return false;
+        }
+        return !d->mailBoxOf(response.content[2].toString()).isNull();
+    };
 }
 
 StatusJob::~StatusJob()
@@ -59,14 +100,25 @@ StatusJob::~StatusJob()
 
 void StatusJob::setMailBox(const QString &mailBox)
 {
-    Q_D(StatusJob);
-    d->mailBox = mailBox;
+    setMailBoxes(QStringList() << mailBox);
 }
 
 QString StatusJob::mailBox() const
 {
     Q_D(const StatusJob);
-    return d->mailBox;
+    return d->mailBoxes.value(0);
+}
+
+void StatusJob::setMailBoxes(const QStringList &mailBoxes)
+{
+    Q_D(StatusJob);
+    d->mailBoxes = mailBoxes;
+}
+
+QStringList StatusJob::mailBoxes() const
+{
+    Q_D(const StatusJob);
+    return d->mailBoxes;
 }
 
 void StatusJob::setDataItems(const QList<QByteArray> &dataItems)
@@ -82,34 +134,111 @@ QList<QByteArray> StatusJob::dataItems() const
 }
 
 QList<QPair<QByteArray, qint64>> StatusJob::status() const
+{
+    return status(mailBox());
+}
+
+QList<QPair<QByteArray, qint64>> StatusJob::status(const QString &mailBox) const
 {
     Q_D(const StatusJob);
-    return d->status;
+    return d->statuses.value(mailBox);
+}
+
+qint64 StatusJob::size() const
+{
+    return size(mailBox());
+}
+
+qint64 StatusJob::size(const QString &mailBox) const
+{
+    Q_D(const StatusJob);
+    return d->value(mailBox, "SIZE");
+}
+
+qint64 StatusJob::appendLimit() const
+{
+    return appendLimit(mailBox());
+}
+
+qint64 StatusJob::appendLimit(const QString &mailBox) const
+{
+    Q_D(const StatusJob);
+    return d->value(mailBox, "APPENDLIMIT");
+}
+
+QByteArray StatusJob::mailBoxId() const
+{
+    Q_D(const StatusJob);
+    return d->mailBoxId;
+}
+
+QStringList StatusJob::nonexistentMailBoxes() const
+{
+    Q_D(const StatusJob);
+    return d->nonexistent;
 }
 
 void StatusJob::doStart()
 {
     Q_D(StatusJob);
 
-    const QByteArray params = '\"' + KIMAP2::encodeImapFolderName(d->mailBox.toUtf8()) + "\" ("
-                            + d->dataItems.join(' ') + ')';
-
-    d->sendCommand("STATUS", params);
+    const QByteArray items = " (" + d->dataItems.join(' ') + ')';
+    d->encodedNames.clear();
+    d->tagMailBoxes.clear();
+    foreach (const QString &mailBox, d->mailBoxes) {
+        const QByteArray name = d->sessionInternal()->encodeMailBoxName(mailBox);
+        d->encodedNames.insert(name.toUpper() == "INBOX" ? QByteArray("INBOX") : name, mailBox);
+        d->sendCommand("STATUS", '\"' + name + '\"' + items);
+        d->tagMailBoxes.insert(d->tags.last(), mailBox);
+    }
 }
 
 void StatusJob::handleResponse(const Message &response)
 {
     Q_D(StatusJob);
 
+    if (response.content.size() >= 2 && response.content[1].toString() == "NO"
+            && d->tags.contains(response.content.first().toString())) {
+        for (const Message::Part &code : response.responseCode) {
+            if (code.toString() == "NONEXISTENT") {
+                d->nonexistent << d->tagMailBoxes.value(response.content.first().toString());
+                break;
+            }
+        }
+    }
+
     if (handleErrorReplies(response) == NotHandled) {
         if (response.content.size() >= 3) {
             const QByteArray code = response.content[1].toString();
             if (code == "STATUS") {
 
-                const QList<QByteArray> resp = response.content[3].toList();
-                for (int i = 0; i < resp.size(); i += 2) {
-                    d->status << (qMakePair(resp[i], resp[i + 1].toLongLong()));
+                QString mailBox = d->mailBoxOf(response.content[2].toString());
+                if (mailBox.isNull() && d->mailBoxes.size() == 1) {
+                    //Not pipelined, so it can only be ours, whatever spelling the server used
+                    mailBox = d->mailBoxes.first();
+                }
+                QList<QPair<QByteArray, qint64>> status;
+                const QList<QByteArray> &resp = response.content[3].toList();
+                for (int i = 0; i + 1 < resp.size(); i += 2) {
+                    if (resp[i] == "MAILBOXID") {
+                        if (mailBox == this->mailBox()) {
+                            d->mailBoxId = JobPrivate::parseObjectId(resp[i + 1]);
+                        }
+                        continue;
+                    }
+                    if (resp[i] == "APPENDLIMIT") {
+                        //NIL if the mailbox has no limit
+                        const qint64 limit = resp[i + 1] == "NIL" ? -1 : resp[i + 1].toLongLong();
+                        if (!mailBox.isNull()) {
+                            d->sessionInternal()->rememberAppendLimit(mailBox, limit);
+                        }
+                        status << qMakePair(QByteArray("APPENDLIMIT"), limit);
+                        continue;
+                    }
+                    status << (qMakePair(response.owned(resp[i]), resp[i + 1].toLongLong()));
                 }
+                d->statuses[mailBox] += status;
+                Q_EMIT statusReceived(mailBox, status);
 
             } else if (code == "OK") {
                 return;
@@ -24,6 +24,7 @@
 
 #include "job.h"
 #include <QList>
+#include <QStringList>
 
 namespace KIMAP2
 {
@@ -44,11 +45,68 @@ public:
     void setMailBox(const QString &mailBox);
     QString mailBox() const;
 
+    /**
+     * Requests the status of several mailboxes at once.
+     *
+     * The STATUS commands are sent back-to-back, so all of them take about one
+     * round trip. Each status is reported with statusReceived() as it arrives.
+     * If a mailbox fails, e.g. because it no longer exists, the job fails after
+     * the others have been reported.
+     *
+     * This replaces the mailbox set with setMailBox(), which is the first of
+     * @p mailBoxes afterwards.
+     */
+    void setMailBoxes(const QStringList &mailBoxes);
+    QStringList mailBoxes() const;
+
     void setDataItems(const QList<QByteArray> &dataItems);
     QList<QByteArray> dataItems() const;
 
+    /**
+     * The status of mailBox().
+     */
     QList<QPair<QByteArray, qint64>> status() const;
 
+    /**
+     * The status of @p mailBox, one of mailBoxes().
+     */
+    QList<QPair<QByteArray, qint64>> status(const QString &mailBox) const;
+
+    /**
+     * The total size in bytes of the messages in mailBox(), or in @p mailBox, if "SIZE" (RFC 8438)
+     * was in the data items. Returns -1 if the server didn't report it.
+     *
+     * This spares summing up the RFC822.SIZE of every message, but the server has to
+     * announce STATUS=SIZE.
+     */
+    qint64 size() const;
+    qint64 size(const QString &mailBox) const;
+
+    /**
+     * The largest message that can be appended to mailBox(), or to @p mailBox, if "APPENDLIMIT"
+     * (RFC 7889) was in the data items. Returns -1 if the mailbox has no limit or it wasn't
+     * reported. AppendJob checks against the reported limit by itself.
+     */
+    qint64 appendLimit() const;
+    qint64 appendLimit(const QString &mailBox) const;
+
+    /**
+     * The MAILBOXID (RFC 8474) if "MAILBOXID" was in the data items, it is not part of status().
+     */
+    QByteArray mailBoxId() const;
+
+    /**
+     * The mailboxes whose STATUS failed with [NONEXISTENT] (RFC 5530), the server says they
+     * are gone rather than e.g. not accessible right now.
+     */
+    QStringList nonexistentMailBoxes() const;
+
+Q_SIGNALS:
+    /**
+     * The status of @p mailBox arrived. The MAILBOXID is not part of @p status.
+     */
+    void statusReceived(const QString &mailBox, const QList<QPair<QByteArray, qint64>> &status);
+
 protected:
     void doStart() Q_DECL_OVERRIDE;
     void handleResponse(const Message &response) Q_DECL_OVERRIDE;
@@ -25,12 +25,14 @@
 #include "message_p.h"
 #include "session_p.h"
 
+#include <QtCore/QPointer>
+
 namespace KIMAP2
 {
 class StoreJobPrivate : public JobPrivate
 {
 public:
-    StoreJobPrivate(Session *session, const QString &name) : JobPrivate(session, name) { }
+    StoreJobPrivate(Session *session, const QString &name) : JobPrivate(session, name), maximumSetLength(0), unchangedSince(0) { }
     ~StoreJobPrivate() { }
 
     QByteArray addFlags(const QByteArray &param, const MessageFlags &flags)
@@ -62,11 +64,17 @@ public:
 
     ImapSet set;
     bool uidBased;
+    int maximumSetLength;
     StoreJob::StoreMode mode;
     MessageFlags flags;
     MessageFlags gmLabels;
 
     QMap<int, MessageFlags> resultingFlags;
+    quint64 unchangedSince;
+    ImapSet modifiedSet;
+    QMap<int, quint64> resultingModSeqs;
+    // The queued jobs this one does the work of, see Session::setJobCoalescingEnabled()
+    QList<QPointer<StoreJob> > coalesced;
 };
 }
 
@@ -78,10 +86,57 @@ StoreJob::StoreJob(Session *session)
     Q_D(StoreJob);
     d->uidBased = false;
     d->mode = SetFlags;
+    d->coalesce = [this](Job *queued) {
+        Q_D(StoreJob);
+        StoreJob *other = qobject_cast<StoreJob *>(queued);
+        if (!other || d->set.isEmpty() || d->set.isSavedSearchResult()) {
+            return false;
+        }
+        const StoreJobPrivate *const otherD = other->d_func();
+        if (otherD->uidBased != d->uidBased || otherD->mode != d->mode || otherD->flags != d->flags
+                || otherD->gmLabels != d->gmLabels || otherD->unchangedSince != d->unchangedSince || otherD->set.isEmpty() || otherD->set.isSavedSearchResult()) {
+            return false;
+        }
+        d->coalesced << other;
+        return true;
+    };
+    connect(this, &KJob::result, this, [this]() {
+        Q_D(StoreJob);
+        foreach (const QPointer<StoreJob> &job, d->coalesced) {
+            if (!job) {
+                continue;
+            }
+            StoreJobPrivate *const jobD = job->d_func();
+            for (auto it = d->resultingFlags.constBegin(); it != d->resultingFlags.constEnd(); ++it) {
+                if (jobD->set.contains(it.key())) {
+                    jobD->resultingFlags.insert(it.key(), it.value());
+                }
+            }
+            for (auto it = d->resultingModSeqs.constBegin(); it != d->resultingModSeqs.constEnd(); ++it) {
+                if (jobD->set.contains(it.key())) {
+                    jobD->resultingModSeqs.insert(it.key(), it.value());
+                }
+            }
+            jobD->modifiedSet = d->modifiedSet.intersected(jobD->set);
+            job->setError(error());
+            job->setErrorText(errorText());
+            job->emitResult();
+        }
+        d->coalesced.clear();
+    });
 }
 
 StoreJob::~StoreJob()
 {
+    Q_D(StoreJob);
+    //Destroyed before it finished, the others can't wait for it
+    foreach (const QPointer<StoreJob> &job, d->coalesced) {
+        if (job) {
+            job->setError(KJob::KilledJobError);
+            job->setErrorText(QStringLiteral("The job doing the store was destroyed"));
+            job->emitResult();
+        }
+    }
 }
 
 void StoreJob::setSequenceSet(const ImapSet &set)
@@ -108,12 +163,30 @@ bool StoreJob::isUidBased() const
     return d->uidBased;
 }
 
+void StoreJob::setMaximumSetLength(int length)
+{
+    Q_D(StoreJob);
+    d->maximumSetLength = length;
+}
+
+int StoreJob::maximumSetLength() const
+{
+    Q_D(const StoreJob);
+    return d->maximumSetLength;
+}
+
 void StoreJob::setFlags(const MessageFlags &flags)
 {
     Q_D(StoreJob);
     d->flags = flags;
 }
 
+void StoreJob::setFlags(const FlagSet &flags)
+{
+    Q_D(StoreJob);
+    d->flags = flags.toMessageFlags();
+}
+
 MessageFlags StoreJob::flags() const
 {
     Q_D(const StoreJob);
@@ -150,6 +223,39 @@ QMap<int, MessageFlags> StoreJob::resultingFlags() const
     return d->resultingFlags;
 }
 
+void StoreJob::setUnchangedSince(quint64 modSeq)
+{
+    Q_D(StoreJob);
+    d->unchangedSince = modSeq;
+}
+
+quint64 StoreJob::unchangedSince() const
+{
+    Q_D(const StoreJob);
+    return d->unchangedSince;
+}
+
+ImapSet StoreJob::modifiedSet() const
+{
+    Q_D(const StoreJob);
+    return d->modifiedSet;
+}
+
+QMap<int, quint64> StoreJob::resultingModSeqs() const
+{
+    Q_D(const StoreJob);
+    return d->resultingModSeqs;
+}
+
+static void addRanges(ImapSetBuilder &builder, const ImapSet &set)
+{
+    foreach (const ImapSet::Range &range, set.ranges()) {
+        if (range.begin) {
+            builder.add(range.begin, range.end);
+        }
+    }
+}
+
 void StoreJob::doStart()
 {
     Q_D(StoreJob);
@@ -162,8 +268,30 @@ void StoreJob::doStart()
         return;
     }
 
+    if (!d->uidBased && d->sessionInternal()->isExtensionEnabled("UIDONLY")) {
+        qCWarning(KIMAP2_LOG) << "Storing by sequence number isn't possible with UIDONLY";
+        setError(KJob::UserDefinedError);
+        setErrorText(QStringLiteral("Sequence numbers are not available once UIDONLY is enabled"));
+        emitResult();
+        return;
+    }
+
     d->set.optimize();
-    QByteArray parameters = d->set.toImapSequenceSet() + ' ';
+    ImapSet set = d->set;
+    if (!d->coalesced.isEmpty()) {
+        ImapSetBuilder builder;
+        addRanges(builder, d->set);
+        foreach (const QPointer<StoreJob> &job, d->coalesced) {
+            if (job) {
+                addRanges(builder, job->d_func()->set);
+            }
+        }
+        set = builder.toSet();
+    }
+    QByteArray parameters;
+    if (d->unchangedSince > 0) {
+        parameters += "(UNCHANGEDSINCE " + QByteArray::number(d->unchangedSince) + ") ";
+    }
 
     if (!d->flags.isEmpty() || d->mode == SetFlags) {
         parameters += d->addFlags("FLAGS", d->flags);
@@ -182,24 +310,43 @@ void StoreJob::doStart()
         command = "UID " + command;
     }
 
-    d->sendCommand(command, parameters);
+    const QList<ImapSet> chunks = d->uidBased ? set.split(d->maximumSetLength) : QList<ImapSet>() << set;
+    foreach (const ImapSet &chunk, chunks) {
+        d->sendCommand(command, chunk.toImapSequenceSet() + ' ' + parameters);
+    }
 }
 
 void StoreJob::handleResponse(const Message &response)
 {
     Q_D(StoreJob);
 
+    // [MODIFIED 7,9], with the completion of each chunk
+    for (int i = 0; i + 1 < response.responseCode.size(); ++i) {
+        if (response.responseCode.at(i).toString() == "MODIFIED") {
+            const ImapSet modified = ImapSet::fromImapSequenceSet(response.responseCode.at(i + 1).toString());
+            foreach (const ImapSet::Range &range, modified.ranges()) {
+                d->modifiedSet.add(ImapInterval(range.begin, range.end));
+            }
+            break;
+        }
+    }
+
     if (handleErrorReplies(response) == NotHandled) {
-        if (response.content.size() == 4 &&
-                response.content[2].toString() == "FETCH" &&
+        const ImapKeyword code = response.content.size() == 4 ? response.content[2].keyword() : ImapKeyword::None;
+        if ((code == ImapKeyword::Fetch || code == ImapKeyword::UidFetch) &&
                 response.content[3].type() == Message::Part::List) {
 
             int id = response.content[1].toString().toInt();
             qint64 uid = 0;
             bool uidFound = false;
+            if (code == ImapKeyword::UidFetch) {
+                //UIDONLY (RFC 9586) sends the UID in place of the sequence number
+                uid = response.content[1].toString().toLongLong(&uidFound);
+            }
             QList<QByteArray> resultingFlags;
+            quint64 modSeq = 0;
 
-            QList<QByteArray> content = response.content[3].toList();
+            const QList<QByteArray> &content = response.content[3].toList();
 
             for (QList<QByteArray>::ConstIterator it = content.constBegin();
                     it != content.constEnd(); ++it) {
@@ -217,13 +364,22 @@ void StoreJob::handleResponse(const Message &response)
                     }
                 } else if (str == "UID") {
                     uid = it->toLongLong(&uidFound);
+                } else if (str == "MODSEQ") {
+                    // MODSEQ (12121231000)
+                    QByteArray value = *it;
+                    if (value.startsWith('(') && value.endsWith(')')) {
+                        value = value.mid(1, value.size() - 2);
+                    }
+                    modSeq = value.trimmed().toULongLong();
                 }
             }
 
-            if (!d->uidBased) {
-                d->resultingFlags[id] = resultingFlags;
-            } else if (uidFound) {
-                d->resultingFlags[uid] = resultingFlags;
+            const int key = d->uidBased ? int(uid) : id;
+            if (!d->uidBased || uidFound) {
+                d->resultingFlags[key] = resultingFlags;
+                if (modSeq > 0) {
+                    d->resultingModSeqs[key] = modSeq;
+                }
             } else {
                 qCWarning(KIMAP2_LOG) << "We asked for UID but the server didn't give it back, resultingFlags not stored.";
             }
@@ -22,6 +22,7 @@
 
 #include "kimap2_export.h"
 
+#include "flagset.h"
 #include "job.h"
 #include "imapset.h"
 
@@ -57,7 +58,21 @@ public:
     void setUidBased(bool uidBased);
     bool isUidBased() const;
 
+    /**
+     * Splits the sequence set so that each command carries at most @p length bytes of it.
+     *
+     * The STORE commands are sent back-to-back without waiting for each other, as with
+     * FetchJob::setMaximumSetLength(), and the job fails if one of them fails.
+     * Only for UID based stores. The default is 0, which stores everything with a single command.
+     */
+    void setMaximumSetLength(int length);
+    int maximumSetLength() const;
+
     void setFlags(const MessageFlags &flags);
+    /**
+     * Stores the flags of @p flags, e.g. from FetchJob::Result::flagSet.
+     */
+    void setFlags(const FlagSet &flags);
     MessageFlags flags() const;
 
     void setGMLabels(const MessageFlags &gmLabels);
@@ -68,6 +83,28 @@ public:
 
     QMap<int, MessageFlags> resultingFlags() const;
 
+    /**
+     * Only stores to messages whose MODSEQ is at most @p modSeq (RFC 7162 UNCHANGEDSINCE).
+     *
+     * Messages changed since are left alone and listed in modifiedSet(), so concurrent
+     * changes aren't overwritten. Needs CONDSTORE, the default of 0 stores unconditionally.
+     */
+    void setUnchangedSince(quint64 modSeq);
+    quint64 unchangedSince() const;
+
+    /**
+     * The messages the store wasn't applied to because they changed since unchangedSince(),
+     * as reported with the MODIFIED response code. UIDs or sequence numbers, as isUidBased().
+     */
+    ImapSet modifiedSet() const;
+
+    /**
+     * The new MODSEQ of the stored messages, by the same keys as resultingFlags().
+     *
+     * Only filled if the server reports it, which it does with CONDSTORE enabled.
+     */
+    QMap<int, quint64> resultingModSeqs() const;
+
 protected:
     void doStart() Q_DECL_OVERRIDE;
     void handleResponse(const Message &response) Q_DECL_OVERRIDE;
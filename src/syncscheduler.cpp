@@ -0,0 +1,440 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "syncscheduler.h"
+
+#include "kimap_debug.h"
+
+#include "bandwidthlimiter.h"
+#include "job.h"
+#include "session.h"
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QPointer>
+#include <QtCore/QSet>
+#include <QtCore/QTimer>
+
+#include <algorithm>
+
+namespace KIMAP2
+{
+
+class SyncSchedulerPrivate
+{
+public:
+    struct Task {
+        QPointer<SessionPool> pool;
+        QString mailBox;
+        QDateTime lastSync;
+        SessionPool::JobFactory factory;
+    };
+
+    struct Running {
+        QPointer<SessionPool> pool;
+        QString mailBox;
+        Session *session;
+    };
+
+    SyncSchedulerPrivate(SyncScheduler *scheduler)
+        : q(scheduler),
+          maximumConnections(0),
+          handshakeRate(0),
+          bandwidthLimit(0),
+          scheduled(false),
+          active(false)
+    {
+        clock.start();
+        retryTimer.setSingleShot(true);
+    }
+
+    static bool staler(const Task &left, const Task &right)
+    {
+        //Never synced is the stalest of all
+        if (left.lastSync.isValid() != right.lastSync.isValid()) {
+            return !left.lastSync.isValid();
+        }
+        return left.lastSync < right.lastSync;
+    }
+
+    void enqueue(const Task &task)
+    {
+        tasks.insert(std::upper_bound(tasks.begin(), tasks.end(), task, staler), task);
+    }
+
+    bool isBusy(Session *session) const
+    {
+        for (const Running &running : runningTasks) {
+            if (running.session == session) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool isIdle(Session *session) const
+    {
+        return session->state() != Session::Disconnected && session->jobQueueSize() == 0
+               && !isBusy(session) && !closing.contains(session);
+    }
+
+    Session *idleSession(SessionPool *pool, const QString &mailBox) const
+    {
+        Session *idle = Q_NULLPTR;
+        for (Session *session : pool->sessions()) {
+            if (!isIdle(session)) {
+                continue;
+            }
+            if (!mailBox.isEmpty() && session->selectedMailBox() == mailBox) {
+                return session;
+            }
+            if (!idle) {
+                idle = session;
+            }
+        }
+        return idle;
+    }
+
+    int connectionCount() const
+    {
+        int count = 0;
+        for (const QPointer<SessionPool> &pool : pools) {
+            if (pool) {
+                count += pool->sessions().size();
+            }
+        }
+        return count;
+    }
+
+    // Milliseconds until another handshake is allowed, 0 if it is now
+    int handshakeDelay()
+    {
+        if (handshakeRate <= 0) {
+            return 0;
+        }
+        const qint64 now = clock.elapsed();
+        while (!handshakes.isEmpty() && handshakes.first() <= now - 1000) {
+            handshakes.removeFirst();
+        }
+        if (handshakes.size() < handshakeRate) {
+            return 0;
+        }
+        return int(handshakes.first() + 1000 - now);
+    }
+
+    bool hasPendingTask(SessionPool *pool) const
+    {
+        for (const Task &task : tasks) {
+            if (task.pool == pool) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void closeUnusedSession(SessionPool *forPool);
+    Session *openSession(SessionPool *pool);
+    void watch(Session *session);
+    void start(const Task &task, Session *session);
+    void finish(Job *job, bool emitFinished);
+    void scheduleLater();
+    void run();
+
+    SyncScheduler *const q;
+    int maximumConnections;
+    int handshakeRate;
+    qint64 bandwidthLimit;
+    BandwidthLimiter limiter;
+    // Ordered by staleness
+    QList<Task> tasks;
+    QHash<Job *, Running> runningTasks;
+    QList<QPointer<SessionPool> > pools;
+    // When a task last ran on the session
+    QHash<Session *, qint64> lastUsed;
+    QSet<Session *> closing;
+    QList<qint64> handshakes;
+    QElapsedTimer clock;
+    QTimer retryTimer;
+    bool scheduled;
+    // Whether a task ran since idle() was last emitted
+    bool active;
+};
+
+}
+
+using namespace KIMAP2;
+
+void SyncSchedulerPrivate::closeUnusedSession(SessionPool *forPool)
+{
+    //One at a time, it takes a moment until the pool drops a closed session
+    if (!closing.isEmpty()) {
+        return;
+    }
+    Session *oldest = Q_NULLPTR;
+    for (const QPointer<SessionPool> &pool : pools) {
+        if (!pool || pool == forPool || hasPendingTask(pool)) {
+            continue;
+        }
+        for (Session *session : pool->sessions()) {
+            if (isIdle(session) && (!oldest || lastUsed.value(session) < lastUsed.value(oldest))) {
+                oldest = session;
+            }
+        }
+    }
+    if (oldest) {
+        qCDebug(KIMAP2_LOG) << "Closing an idle session to make room for another account";
+        closing.insert(oldest);
+        oldest->close();
+    }
+}
+
+Session *SyncSchedulerPrivate::openSession(SessionPool *pool)
+{
+    Session *session = pool->openSession();
+    if (session) {
+        handshakes << clock.elapsed();
+        watch(session);
+    }
+    return session;
+}
+
+void SyncSchedulerPrivate::watch(Session *session)
+{
+    if (lastUsed.contains(session)) {
+        return;
+    }
+    lastUsed.insert(session, clock.elapsed());
+    QObject::connect(session, &QObject::destroyed, q, [this, session]() {
+        lastUsed.remove(session);
+        closing.remove(session);
+        //A connection is free now
+        scheduleLater();
+    });
+    //The pool drops sessions that lost their connection
+    QObject::connect(session, &Session::stateChanged, q, [this](Session::State newState) {
+        if (newState == Session::Disconnected) {
+            scheduleLater();
+        }
+    });
+}
+
+void SyncSchedulerPrivate::start(const Task &task, Session *session)
+{
+    watch(session);
+    session->setBandwidthLimiter(&limiter);
+    Job *job = task.pool->submit(session, task.mailBox, task.factory);
+    if (!job) {
+        return;
+    }
+    lastUsed.insert(session, clock.elapsed());
+    runningTasks.insert(job, Running{task.pool, task.mailBox, session});
+    active = true;
+
+    QObject::connect(job, &KJob::result, q, [this, job]() {
+        finish(job, true);
+    });
+    //Jobs don't emit their result if the pool deletes their session
+    QObject::connect(job, &QObject::destroyed, q, [this, job]() {
+        finish(job, false);
+    });
+    emit q->taskStarted(task.pool, task.mailBox, job);
+}
+
+void SyncSchedulerPrivate::finish(Job *job, bool emitFinished)
+{
+    if (!runningTasks.contains(job)) {
+        return;
+    }
+    const Running running = runningTasks.take(job);
+    if (lastUsed.contains(running.session)) {
+        lastUsed.insert(running.session, clock.elapsed());
+    }
+    if (emitFinished) {
+        emit q->taskFinished(running.pool, running.mailBox, job);
+    }
+    //The queue of the session only empties after the result
+    scheduleLater();
+}
+
+void SyncSchedulerPrivate::scheduleLater()
+{
+    if (scheduled) {
+        return;
+    }
+    scheduled = true;
+    QTimer::singleShot(0, q, [this]() {
+        run();
+    });
+}
+
+void SyncSchedulerPrivate::run()
+{
+    scheduled = false;
+    retryTimer.stop();
+
+    int i = 0;
+    int retryDelay = 0;
+    while (i < tasks.size()) {
+        const Task task = tasks.at(i);
+        if (!task.pool) {
+            tasks.removeAt(i);
+            continue;
+        }
+
+        Session *session = idleSession(task.pool, task.mailBox);
+        if (!session) {
+            if (maximumConnections > 0 && connectionCount() >= maximumConnections) {
+                closeUnusedSession(task.pool);
+                ++i;
+                continue;
+            }
+            const int delay = handshakeDelay();
+            if (delay > 0) {
+                retryDelay = retryDelay > 0 ? qMin(retryDelay, delay) : delay;
+                ++i;
+                continue;
+            }
+            session = openSession(task.pool);
+        }
+        if (!session) {
+            //The pool is at its limits, its running tasks make room again
+            ++i;
+            continue;
+        }
+
+        tasks.removeAt(i);
+        start(task, session);
+    }
+
+    if (retryDelay > 0) {
+        retryTimer.start(retryDelay);
+    }
+    if (active && tasks.isEmpty() && runningTasks.isEmpty()) {
+        active = false;
+        emit q->idle();
+    }
+}
+
+SyncScheduler::SyncScheduler(QObject *parent)
+    : QObject(parent), d(new SyncSchedulerPrivate(this))
+{
+    connect(&d->retryTimer, &QTimer::timeout, this, [this]() {
+        d->run();
+    });
+}
+
+SyncScheduler::~SyncScheduler()
+{
+    //The limiter goes away with us
+    for (const QPointer<SessionPool> &pool : d->pools) {
+        if (!pool) {
+            continue;
+        }
+        for (Session *session : pool->sessions()) {
+            if (session->bandwidthLimiter() == &d->limiter) {
+                session->setBandwidthLimiter(Q_NULLPTR);
+            }
+        }
+    }
+    delete d;
+}
+
+void SyncScheduler::setMaximumConnections(int maximum)
+{
+    d->maximumConnections = maximum;
+    d->scheduleLater();
+}
+
+int SyncScheduler::maximumConnections() const
+{
+    return d->maximumConnections;
+}
+
+void SyncScheduler::setHandshakeRate(int perSecond)
+{
+    d->handshakeRate = perSecond;
+    d->scheduleLater();
+}
+
+int SyncScheduler::handshakeRate() const
+{
+    return d->handshakeRate;
+}
+
+void SyncScheduler::setBandwidthLimit(qint64 bytesPerSecond)
+{
+    d->bandwidthLimit = bytesPerSecond;
+    d->limiter.setRate(BandwidthLimiter::Download, BandwidthLimiter::Background, bytesPerSecond);
+    d->limiter.setRate(BandwidthLimiter::Upload, BandwidthLimiter::Background, bytesPerSecond);
+}
+
+qint64 SyncScheduler::bandwidthLimit() const
+{
+    return d->bandwidthLimit;
+}
+
+BandwidthLimiter *SyncScheduler::bandwidthLimiter() const
+{
+    return &d->limiter;
+}
+
+void SyncScheduler::schedule(SessionPool *pool, const QString &mailBox, const QDateTime &lastSync, const SessionPool::JobFactory &factory)
+{
+    Q_ASSERT(pool);
+    if (!d->pools.contains(pool)) {
+        d->pools << pool;
+    }
+
+    SyncSchedulerPrivate::Task task{pool, mailBox, lastSync, factory};
+    for (int i = 0; i < d->tasks.size(); ++i) {
+        const SyncSchedulerPrivate::Task &pending = d->tasks.at(i);
+        if (pending.pool == pool && pending.mailBox == mailBox) {
+            if (SyncSchedulerPrivate::staler(pending, task)) {
+                task.lastSync = pending.lastSync;
+            }
+            d->tasks.removeAt(i);
+            break;
+        }
+    }
+    d->enqueue(task);
+    d->scheduleLater();
+}
+
+void SyncScheduler::cancel(SessionPool *pool, const QString &mailBox)
+{
+    for (int i = d->tasks.size() - 1; i >= 0; --i) {
+        const SyncSchedulerPrivate::Task &task = d->tasks.at(i);
+        if (task.pool == pool && (mailBox.isEmpty() || task.mailBox == mailBox)) {
+            d->tasks.removeAt(i);
+        }
+    }
+}
+
+int SyncScheduler::pendingTasks() const
+{
+    return d->tasks.size();
+}
+
+int SyncScheduler::runningTasks() const
+{
+    return d->runningTasks.size();
+}
+
+int SyncScheduler::connectionCount() const
+{
+    return d->connectionCount();
+}
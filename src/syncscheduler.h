@@ -0,0 +1,147 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_SYNCSCHEDULER_H
+#define KIMAP2_SYNCSCHEDULER_H
+
+#include "kimap2_export.h"
+
+#include "sessionpool.h"
+
+#include <QtCore/QDateTime>
+#include <QtCore/QObject>
+
+namespace KIMAP2
+{
+
+class BandwidthLimiter;
+class Job;
+class SyncSchedulerPrivate;
+
+/**
+ * Runs the sync tasks of many accounts within global limits.
+ *
+ * Each account has its own SessionPool. Tasks are scheduled with the pool of their account,
+ * the mailbox they sync and when it was last synced, and run in the order of their staleness,
+ * the ones that were never synced first. A task runs on an idle session of its pool, preferably
+ * one that has the mailbox selected already, and only if the pool has none, a new session is
+ * opened, as long as
+ * @li all pools together stay within maximumConnections(),
+ * @li no more than handshakeRate() sessions were opened during the last second, and
+ * @li the pool and the connection limit of its server allow it, see SessionPool::setConnectionLimit().
+ *
+ * A task that can't run yet doesn't hold up those behind it, so a busy account doesn't starve the
+ * quiet ones. When the connection limit is reached, the idle session that went unused the longest
+ * is closed for a task of another account.
+ *
+ * Every session a task runs on shares bandwidthLimiter(), which limits the background traffic,
+ * so the jobs of the tasks should have Job::BackgroundPriority.
+ *
+ * @code
+ * KIMAP2::SyncScheduler scheduler;
+ * scheduler.setMaximumConnections(200);
+ * scheduler.setHandshakeRate(20);
+ * for (Account *account : accounts) {
+ *     scheduler.schedule(account->pool(), QStringLiteral("INBOX"), account->lastSync(), [account](KIMAP2::Session *session) {
+ *         return account->createSyncJob(session);
+ *     });
+ * }
+ * @endcode
+ */
+class KIMAP2_EXPORT SyncScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit SyncScheduler(QObject *parent = Q_NULLPTR);
+    ~SyncScheduler();
+
+    /**
+     * Sets how many sessions the pools of the scheduled tasks have open at most together.
+     * The default of 0 doesn't limit them.
+     */
+    void setMaximumConnections(int maximum);
+    int maximumConnections() const;
+
+    /**
+     * Sets how many sessions, and with them TLS handshakes, are opened per second at most.
+     * The default of 0 doesn't limit them.
+     */
+    void setHandshakeRate(int perSecond);
+    int handshakeRate() const;
+
+    /**
+     * Limits the background traffic of all sessions a task ran on to @p bytesPerSecond in each
+     * direction. The default of 0 doesn't limit it.
+     */
+    void setBandwidthLimit(qint64 bytesPerSecond);
+    qint64 bandwidthLimit() const;
+
+    /**
+     * The limiter shared by the sessions, e.g. to set different rates for uploads and downloads.
+     */
+    BandwidthLimiter *bandwidthLimiter() const;
+
+    /**
+     * Schedules a task for @p mailBox of the account of @p pool, which was last synced at
+     * @p lastSync, an invalid time for never. The pool isn't owned, the tasks of a pool that's
+     * deleted are dropped.
+     *
+     * Once a session is available, @p factory creates the job on it, which is started by the
+     * pool after selecting @p mailBox if needed.
+     *
+     * If a task for @p mailBox of @p pool is pending already, it is replaced and keeps the older
+     * of both times.
+     */
+    void schedule(SessionPool *pool, const QString &mailBox, const QDateTime &lastSync, const SessionPool::JobFactory &factory);
+
+    /**
+     * Drops the pending tasks for @p mailBox of @p pool, or all of its tasks for an empty mailbox.
+     * Running tasks aren't affected.
+     */
+    void cancel(SessionPool *pool, const QString &mailBox = QString());
+
+    int pendingTasks() const;
+    int runningTasks() const;
+
+    /**
+     * Returns how many sessions the pools of the scheduled tasks have open.
+     */
+    int connectionCount() const;
+
+Q_SIGNALS:
+    void taskStarted(KIMAP2::SessionPool *pool, const QString &mailBox, KIMAP2::Job *job);
+
+    /**
+     * Emitted when the job of a task finished, see KJob::error() for whether it succeeded.
+     */
+    void taskFinished(KIMAP2::SessionPool *pool, const QString &mailBox, KIMAP2::Job *job);
+
+    /**
+     * Emitted when the last running task finished and none is pending.
+     */
+    void idle();
+
+private:
+    Q_DISABLE_COPY(SyncScheduler)
+    friend class SyncSchedulerPrivate;
+    SyncSchedulerPrivate *const d;
+};
+
+}
+
+#endif
@@ -0,0 +1,182 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "threadjob.h"
+
+#include "kimap_debug.h"
+
+#include "job_p.h"
+#include "message_p.h"
+#include "session_p.h"
+
+namespace KIMAP2
+{
+class ThreadJobPrivate : public JobPrivate
+{
+public:
+    ThreadJobPrivate(Session *session, const QString &name)
+        : JobPrivate(session, name), uidBased(false), charset("UTF-8"), algorithm(ThreadJob::References) { }
+    ~ThreadJobPrivate() { }
+
+    /**
+     * Reads the members of a thread like "3 6 (4 23)(44 7 96)", where 6 replies to 3
+     * and both 4 and 44 reply to 6.
+     */
+    static ThreadNode parseThread(const QList<Message::Node> &members)
+    {
+        QVector<qint64> chain;
+        int i = 0;
+        for (; i < members.size() && !members.at(i).isList(); ++i) {
+            chain << members.at(i).toString().toLongLong();
+        }
+        //Branches start with nested lists, without a parent if there is no number before them
+        ThreadNode node = {chain.isEmpty() ? 0 : chain.takeLast(), QVector<ThreadNode>()};
+        for (; i < members.size(); ++i) {
+            if (members.at(i).isList()) {
+                node.children << parseThread(members.at(i).children());
+            }
+        }
+        //The single replies before the branches, without recursing for each
+        while (!chain.isEmpty()) {
+            const ThreadNode parent = {chain.takeLast(), QVector<ThreadNode>() << node};
+            node = parent;
+        }
+        return node;
+    }
+
+    bool uidBased;
+    QByteArray charset;
+    ThreadJob::Algorithm algorithm;
+    Term term;
+    QVector<ThreadNode> threads;
+};
+}
+
+using namespace KIMAP2;
+
+ThreadJob::ThreadJob(Session *session)
+    : Job(*new ThreadJobPrivate(session, "Thread"))
+{
+}
+
+ThreadJob::~ThreadJob()
+{
+}
+
+void ThreadJob::setUidBased(bool uidBased)
+{
+    Q_D(ThreadJob);
+    d->uidBased = uidBased;
+}
+
+bool ThreadJob::isUidBased() const
+{
+    Q_D(const ThreadJob);
+    return d->uidBased;
+}
+
+void ThreadJob::setCharset(const QByteArray &charset)
+{
+    Q_D(ThreadJob);
+    d->charset = charset;
+}
+
+QByteArray ThreadJob::charset() const
+{
+    Q_D(const ThreadJob);
+    return d->charset;
+}
+
+void ThreadJob::setAlgorithm(Algorithm algorithm)
+{
+    Q_D(ThreadJob);
+    d->algorithm = algorithm;
+}
+
+ThreadJob::Algorithm ThreadJob::algorithm() const
+{
+    Q_D(const ThreadJob);
+    return d->algorithm;
+}
+
+void ThreadJob::setTerm(const Term &term)
+{
+    Q_D(ThreadJob);
+    d->term = term;
+}
+
+QVector<ThreadNode> ThreadJob::threads() const
+{
+    Q_D(const ThreadJob);
+    return d->threads;
+}
+
+void ThreadJob::doStart()
+{
+    Q_D(ThreadJob);
+
+    const QByteArray algorithm = d->algorithm == OrderedSubject ? "ORDEREDSUBJECT" : "REFERENCES";
+    if (!d->m_session->capabilities().contains(QStringLiteral("THREAD=") + QString::fromLatin1(algorithm), Qt::CaseInsensitive)) {
+        qCWarning(KIMAP2_LOG) << "The server can't thread with" << algorithm;
+        setError(KJob::UserDefinedError);
+        setErrorText(QStringLiteral("The server does not support THREAD=%1").arg(QString::fromLatin1(algorithm)));
+        emitResult();
+        return;
+    }
+
+    d->threads.clear();
+    QByteArray arguments = algorithm + ' ' + d->charset + ' ';
+    if (d->term.isNull()) {
+        arguments += "ALL";
+    } else {
+        const QByteArray term = d->term.serialize();
+        if (term.startsWith('(')) {
+            arguments += term.mid(1, term.size() - 2);
+        } else {
+            arguments += term;
+        }
+    }
+
+    d->sendCommand(d->uidBased ? "UID THREAD" : "THREAD", arguments);
+}
+
+void ThreadJob::handleResponse(const Message &response)
+{
+    Q_D(ThreadJob);
+
+    if (handleErrorReplies(response) == NotHandled) {
+        // * THREAD (2)(3 6 (4 23)(44 7 96))
+        if (response.content.size() >= 2 && response.content[1].toString() == "THREAD") {
+            for (int i = 2; i < response.content.size(); i++) {
+                const Message::Part &part = response.content[i];
+                if (part.type() != Message::Part::List) {
+                    continue;
+                }
+                const QList<QByteArray> items = part.toList();
+                QList<Message::Node> members;
+                members.reserve(items.size());
+                for (int j = 0; j < items.size(); ++j) {
+                    const Message::Node sublist = part.sublist(j);
+                    members << (sublist.isList() ? sublist : Message::Node(items.at(j)));
+                }
+                d->threads << ThreadJobPrivate::parseThread(members);
+            }
+        }
+    }
+}
+
+#include "moc_threadjob.cpp"
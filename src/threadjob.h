@@ -0,0 +1,100 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_THREADJOB_H
+#define KIMAP2_THREADJOB_H
+
+#include "kimap2_export.h"
+
+#include "job.h"
+#include "searchjob.h"
+
+#include <QtCore/QVector>
+
+namespace KIMAP2
+{
+
+class Session;
+struct Message;
+class ThreadJobPrivate;
+
+/**
+ * A message and the replies to it, see ThreadJob::threads().
+ */
+struct KIMAP2_EXPORT ThreadNode {
+    /**
+     * The sequence number or UID, or 0 if the message the replies refer to is not in the mailbox.
+     */
+    qint64 id;
+    QVector<ThreadNode> children;
+};
+
+/**
+ * Groups the messages of the selected mailbox into threads on the server (RFC 5256).
+ *
+ * This job can only be run in the selected state, and requires the THREAD capability
+ * for the algorithm, e.g. THREAD=REFERENCES.
+ */
+class KIMAP2_EXPORT ThreadJob : public Job
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(ThreadJob)
+
+    friend class SessionPrivate;
+
+public:
+    enum Algorithm {
+        OrderedSubject, /**< Threads by subject only, sorted by date */
+        References      /**< Threads by In-Reply-To and References headers */
+    };
+
+    explicit ThreadJob(Session *session);
+    virtual ~ThreadJob();
+
+    void setUidBased(bool uidBased);
+    bool isUidBased() const;
+
+    /**
+     * The charset of the strings in the search term, "UTF-8" by default.
+     */
+    void setCharset(const QByteArray &charset);
+    QByteArray charset() const;
+
+    /**
+     * Default is References.
+     */
+    void setAlgorithm(Algorithm algorithm);
+    Algorithm algorithm() const;
+
+    /**
+     * Only the messages matching @p term are threaded, all messages by default.
+     */
+    void setTerm(const Term &term);
+
+    /**
+     * The threads in the order the server sent them, each as the tree of its replies.
+     */
+    QVector<ThreadNode> threads() const;
+
+protected:
+    void doStart() Q_DECL_OVERRIDE;
+    void handleResponse(const Message &response) Q_DECL_OVERRIDE;
+};
+
+}
+
+#endif
@@ -0,0 +1,823 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "transport.h"
+
+#include "kimap_debug.h"
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QFile>
+#include <QtCore/QMutex>
+#include <QtCore/QRunnable>
+#include <QtCore/QSet>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
+#include <QtCore/QVector>
+
+#ifdef Q_OS_UNIX
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#ifdef Q_OS_LINUX
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+using namespace KIMAP2;
+
+#ifdef Q_OS_UNIX
+static QString systemError()
+{
+    return QString::fromLocal8Bit(strerror(errno));
+}
+
+/*
+ * Keeps the descriptors out of processes that other code starts.
+ */
+static void setCloseOnExec(int descriptor)
+{
+    ::fcntl(descriptor, F_SETFD, ::fcntl(descriptor, F_GETFD) | FD_CLOEXEC);
+}
+
+static bool openSocketPair(int descriptors[2], QString *errorString)
+{
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, descriptors) != 0) {
+        *errorString = systemError();
+        return false;
+    }
+    setCloseOnExec(descriptors[0]);
+    setCloseOnExec(descriptors[1]);
+    return true;
+}
+#endif
+
+#ifndef Q_OS_LINUX
+static qintptr unsupported(QString *errorString)
+{
+    *errorString = QStringLiteral("Transport not supported on this platform.");
+    return -1;
+}
+#endif
+
+Transport::~Transport()
+{
+}
+
+namespace KIMAP2
+{
+
+class UnixSocketTransportPrivate
+{
+public:
+    QString path;
+};
+
+class SocketPairTransportPrivate
+{
+public:
+    SocketPairTransport::PeerHandler peerHandler;
+    QString hostName;
+};
+
+class ProcessTransportPrivate
+{
+public:
+    void reapChildren(bool all);
+
+    QString program;
+    QStringList arguments;
+    QMutex mutex;
+    QVector<qint64> children;
+};
+
+#ifdef Q_OS_LINUX
+/*
+ * A TCP connection and the end of the socket pair of its session. Each direction keeps the
+ * data that was read from one side and isn't written to the other yet.
+ */
+struct EpollConnection {
+    struct Channel {
+        Channel() : buffer(Q_NULLPTR), offset(0), size(0), eof(false) { }
+
+        char *buffer;
+        int offset;
+        int size;
+        // The other side is shut down for writing, nothing more comes
+        bool eof;
+    };
+
+    EpollConnection() : local(-1), remote(-1), connecting(false), nextAddress(0) { }
+
+    int local;
+    int remote;
+    bool connecting;
+    // The addresses of the host as sockaddrs, tried one after another
+    QVector<QByteArray> addresses;
+    int nextAddress;
+    Channel upstream;
+    Channel downstream;
+};
+
+/*
+ * The thread that relays the connections of an EpollTransport.
+ */
+class EpollReactor : public QThread
+{
+public:
+    EpollReactor();
+    ~EpollReactor();
+
+    bool init(QString *errorString);
+    // Takes over @p connection, the thread starts relaying it
+    void add(EpollConnection *connection);
+    void stop();
+    int connectionCount() const;
+
+protected:
+    void run() Q_DECL_OVERRIDE;
+
+private:
+    enum Progress {
+        Waiting, // Until a side is ready again
+        Busy,    // Stopped to give the other connections a turn
+        Failed
+    };
+
+    void wakeUp();
+    bool watch(EpollConnection *connection, int descriptor);
+    char *takeBuffer();
+    void returnBuffer(char *&buffer);
+    Progress relay(int from, int to, EpollConnection::Channel *channel);
+    void pump(EpollConnection *connection);
+    void finishConnect(EpollConnection *connection);
+    void close(EpollConnection *connection);
+
+    int m_epoll;
+    int m_wakeUp;
+    QAtomicInt m_stopping;
+    mutable QMutex m_mutex;
+    // Every connection that isn't closed, and those not watched yet
+    QSet<EpollConnection *> m_connections;
+    QVector<EpollConnection *> m_pending;
+    // Only used by the thread
+    QVector<char *> m_freeBuffers;
+    QVector<EpollConnection *> m_busy;
+    QVector<EpollConnection *> m_closed;
+};
+#endif
+
+class EpollTransportPrivate
+{
+public:
+#ifdef Q_OS_LINUX
+    EpollReactor *startReactor(QString *errorString);
+
+    EpollReactor *reactor;
+    // Resolves the host names, getaddrinfo() can't be made to not block
+    QThreadPool resolver;
+#endif
+    QString hostName;
+    quint16 port;
+    mutable QMutex mutex;
+};
+
+}
+
+UnixSocketTransport::UnixSocketTransport(const QString &path)
+    : d(new UnixSocketTransportPrivate)
+{
+    d->path = path;
+}
+
+UnixSocketTransport::~UnixSocketTransport()
+{
+    delete d;
+}
+
+QString UnixSocketTransport::hostName() const
+{
+    return QStringLiteral("localhost");
+}
+
+qintptr UnixSocketTransport::open(QString *errorString)
+{
+#ifdef Q_OS_UNIX
+    const QByteArray path = QFile::encodeName(d->path);
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= int(sizeof(address.sun_path))) {
+        *errorString = QStringLiteral("Socket path too long: %1").arg(d->path);
+        return -1;
+    }
+    memcpy(address.sun_path, path.constData(), path.size());
+
+    const int descriptor = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (descriptor == -1) {
+        *errorString = systemError();
+        return -1;
+    }
+    setCloseOnExec(descriptor);
+    //Local sockets accept right away, or fail right away
+    if (::connect(descriptor, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+        *errorString = systemError();
+        ::close(descriptor);
+        return -1;
+    }
+    return descriptor;
+#else
+    return unsupported(errorString);
+#endif
+}
+
+SocketPairTransport::SocketPairTransport(const PeerHandler &peerHandler, const QString &hostName)
+    : d(new SocketPairTransportPrivate)
+{
+    d->peerHandler = peerHandler;
+    d->hostName = hostName;
+}
+
+SocketPairTransport::~SocketPairTransport()
+{
+    delete d;
+}
+
+QString SocketPairTransport::hostName() const
+{
+    return d->hostName;
+}
+
+qintptr SocketPairTransport::open(QString *errorString)
+{
+#ifdef Q_OS_UNIX
+    int descriptors[2];
+    if (!openSocketPair(descriptors, errorString)) {
+        return -1;
+    }
+    d->peerHandler(descriptors[1]);
+    return descriptors[0];
+#else
+    return unsupported(errorString);
+#endif
+}
+
+void ProcessTransportPrivate::reapChildren(bool all)
+{
+#ifdef Q_OS_UNIX
+    QMutexLocker locker(&mutex);
+    //A process that ignores the end of its input doesn't get to block us
+    static const int exitWaits = 50;
+    for (int wait = 0;; ++wait) {
+        for (int i = children.size() - 1; i >= 0; --i) {
+            const pid_t pid = pid_t(children.at(i));
+            if (::waitpid(pid, Q_NULLPTR, WNOHANG) != 0) {
+                children.remove(i);
+            } else if (all && wait == exitWaits) {
+                qCWarning(KIMAP2_LOG) << "Killing a server process that didn't exit:" << pid;
+                ::kill(pid, SIGKILL);
+                ::waitpid(pid, Q_NULLPTR, 0);
+                children.remove(i);
+            }
+        }
+        if (!all || children.isEmpty()) {
+            break;
+        }
+        ::usleep(10 * 1000);
+    }
+#else
+    Q_UNUSED(all);
+#endif
+}
+
+ProcessTransport::ProcessTransport(const QString &program, const QStringList &arguments)
+    : d(new ProcessTransportPrivate)
+{
+    d->program = program;
+    d->arguments = arguments;
+}
+
+ProcessTransport::~ProcessTransport()
+{
+    //The sessions are gone, so the processes got end of file already
+    d->reapChildren(true);
+    delete d;
+}
+
+QString ProcessTransport::hostName() const
+{
+    return QStringLiteral("localhost");
+}
+
+qintptr ProcessTransport::open(QString *errorString)
+{
+#ifdef Q_OS_UNIX
+    d->reapChildren(false);
+
+    //Everything the child needs is prepared before the fork, it may only exec then
+    QList<QByteArray> arguments;
+    arguments << QFile::encodeName(d->program);
+    foreach (const QString &argument, d->arguments) {
+        arguments << argument.toLocal8Bit();
+    }
+    QVector<char *> argv;
+    for (QByteArray &argument : arguments) {
+        argv << argument.data();
+    }
+    argv << Q_NULLPTR;
+
+    int descriptors[2];
+    if (!openSocketPair(descriptors, errorString)) {
+        return -1;
+    }
+    const pid_t pid = ::fork();
+    if (pid == -1) {
+        *errorString = systemError();
+        ::close(descriptors[0]);
+        ::close(descriptors[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        //dup2 clears close-on-exec on the copies
+        ::dup2(descriptors[1], STDIN_FILENO);
+        ::dup2(descriptors[1], STDOUT_FILENO);
+        ::execvp(argv.at(0), argv.data());
+        ::_exit(127);
+    }
+    ::close(descriptors[1]);
+    {
+        QMutexLocker locker(&d->mutex);
+        d->children << qint64(pid);
+    }
+    qCDebug(KIMAP2_LOG) << "Started" << d->program << "as" << pid;
+    return descriptors[0];
+#else
+    return unsupported(errorString);
+#endif
+}
+
+#ifdef Q_OS_LINUX
+// The pieces the data is relayed in, and how many of them each direction gets per turn
+static const int relayBufferSize = 16 * 1024;
+static const int relayTurns = 8;
+// How many buffers are kept for reuse, the rest is released once the data went through
+static const int maximumFreeBuffers = 64;
+
+/*
+ * Starts connecting @p connection to the next of its addresses that accepts a socket.
+ */
+static bool connectNext(EpollConnection *connection, QString *errorString)
+{
+    while (connection->nextAddress < connection->addresses.size()) {
+        const QByteArray &address = connection->addresses.at(connection->nextAddress++);
+        const sockaddr *socketAddress = reinterpret_cast<const sockaddr *>(address.constData());
+        const int descriptor = ::socket(socketAddress->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+        if (descriptor == -1) {
+            *errorString = systemError();
+            continue;
+        }
+        //The relay writes whatever the session wrote, Nagle would only hold it back
+        const int enabled = 1;
+        ::setsockopt(descriptor, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled));
+        ::setsockopt(descriptor, SOL_SOCKET, SO_KEEPALIVE, &enabled, sizeof(enabled));
+        if (::connect(descriptor, socketAddress, socklen_t(address.size())) == 0 || errno == EINPROGRESS) {
+            connection->remote = descriptor;
+            connection->connecting = true;
+            return true;
+        }
+        *errorString = systemError();
+        ::close(descriptor);
+    }
+    return false;
+}
+
+EpollReactor::EpollReactor()
+    : m_epoll(-1),
+      m_wakeUp(-1)
+{
+    setObjectName(QStringLiteral("KIMAP2 epoll transport"));
+}
+
+EpollReactor::~EpollReactor()
+{
+    qDeleteAll(m_connections);
+    for (char *buffer : m_freeBuffers) {
+        delete[] buffer;
+    }
+    if (m_wakeUp != -1) {
+        ::close(m_wakeUp);
+    }
+    if (m_epoll != -1) {
+        ::close(m_epoll);
+    }
+}
+
+bool EpollReactor::init(QString *errorString)
+{
+    m_epoll = ::epoll_create1(EPOLL_CLOEXEC);
+    m_wakeUp = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_epoll == -1 || m_wakeUp == -1) {
+        *errorString = systemError();
+        return false;
+    }
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = Q_NULLPTR;
+    if (::epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeUp, &event) != 0) {
+        *errorString = systemError();
+        return false;
+    }
+    return true;
+}
+
+void EpollReactor::add(EpollConnection *connection)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_connections.insert(connection);
+        m_pending << connection;
+    }
+    //Only the thread touches the connections it watches
+    wakeUp();
+}
+
+void EpollReactor::stop()
+{
+    m_stopping.store(1);
+    wakeUp();
+    wait();
+}
+
+int EpollReactor::connectionCount() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_connections.size();
+}
+
+void EpollReactor::wakeUp()
+{
+    const quint64 one = 1;
+    const ssize_t written = ::write(m_wakeUp, &one, sizeof(one));
+    Q_UNUSED(written);
+}
+
+bool EpollReactor::watch(EpollConnection *connection, int descriptor)
+{
+    //Edge triggered, so every side is read and written until it would block
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = connection;
+    if (::epoll_ctl(m_epoll, EPOLL_CTL_ADD, descriptor, &event) != 0) {
+        qCWarning(KIMAP2_LOG) << "Can't watch a relayed connection:" << systemError();
+        return false;
+    }
+    return true;
+}
+
+char *EpollReactor::takeBuffer()
+{
+    if (!m_freeBuffers.isEmpty()) {
+        return m_freeBuffers.takeLast();
+    }
+    return new char[relayBufferSize];
+}
+
+void EpollReactor::returnBuffer(char *&buffer)
+{
+    if (!buffer) {
+        return;
+    }
+    if (m_freeBuffers.size() < maximumFreeBuffers) {
+        m_freeBuffers << buffer;
+    } else {
+        delete[] buffer;
+    }
+    buffer = Q_NULLPTR;
+}
+
+EpollReactor::Progress EpollReactor::relay(int from, int to, EpollConnection::Channel *channel)
+{
+    int turns = 0;
+    forever {
+        if (channel->offset < channel->size) {
+            const ssize_t written = ::send(to, channel->buffer + channel->offset, channel->size - channel->offset, MSG_NOSIGNAL);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return errno == EAGAIN || errno == EWOULDBLOCK ? Waiting : Failed;
+            }
+            channel->offset += int(written);
+            continue;
+        }
+        //Idle directions hold no buffer
+        returnBuffer(channel->buffer);
+        channel->offset = 0;
+        channel->size = 0;
+        if (channel->eof) {
+            return Waiting;
+        }
+        if (++turns > relayTurns) {
+            return Busy;
+        }
+
+        char *buffer = takeBuffer();
+        const ssize_t received = ::recv(from, buffer, relayBufferSize, 0);
+        if (received > 0) {
+            channel->buffer = buffer;
+            channel->size = int(received);
+            continue;
+        }
+        returnBuffer(buffer);
+        if (received == 0) {
+            channel->eof = true;
+            ::shutdown(to, SHUT_WR);
+            return Waiting;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        return errno == EAGAIN || errno == EWOULDBLOCK ? Waiting : Failed;
+    }
+}
+
+void EpollReactor::pump(EpollConnection *connection)
+{
+    const Progress upstream = relay(connection->local, connection->remote, &connection->upstream);
+    const Progress downstream = upstream == Failed ? Failed : relay(connection->remote, connection->local, &connection->downstream);
+    if (upstream == Failed || downstream == Failed) {
+        close(connection);
+        return;
+    }
+    if (connection->upstream.eof && connection->downstream.eof
+            && !connection->upstream.buffer && !connection->downstream.buffer) {
+        close(connection);
+        return;
+    }
+    if ((upstream == Busy || downstream == Busy) && !m_busy.contains(connection)) {
+        m_busy << connection;
+    }
+}
+
+void EpollReactor::finishConnect(EpollConnection *connection)
+{
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (::getsockopt(connection->remote, SOL_SOCKET, SO_ERROR, &error, &length) != 0) {
+        error = errno;
+    }
+    if (!error) {
+        //The event may be one of the session's side
+        sockaddr_storage peer;
+        socklen_t peerLength = sizeof(peer);
+        if (::getpeername(connection->remote, reinterpret_cast<sockaddr *>(&peer), &peerLength) == 0) {
+            connection->connecting = false;
+        }
+        return;
+    }
+
+    qCDebug(KIMAP2_LOG) << "Connecting failed:" << QString::fromLocal8Bit(strerror(error));
+    ::close(connection->remote);
+    connection->remote = -1;
+    QString errorString;
+    if (!connectNext(connection, &errorString) || !watch(connection, connection->remote)) {
+        //The session sees the connection closed before the greeting
+        close(connection);
+    }
+}
+
+void EpollReactor::close(EpollConnection *connection)
+{
+    ::close(connection->local);
+    connection->local = -1;
+    if (connection->remote != -1) {
+        ::close(connection->remote);
+        connection->remote = -1;
+    }
+    returnBuffer(connection->upstream.buffer);
+    returnBuffer(connection->downstream.buffer);
+    m_busy.removeAll(connection);
+    {
+        QMutexLocker locker(&m_mutex);
+        m_connections.remove(connection);
+    }
+    //Deleted once the events that are still about it were handled
+    m_closed << connection;
+}
+
+void EpollReactor::run()
+{
+    epoll_event events[64];
+    while (!m_stopping.load()) {
+        const int count = ::epoll_wait(m_epoll, events, 64, m_busy.isEmpty() ? -1 : 0);
+        if (count < 0 && errno != EINTR) {
+            qCWarning(KIMAP2_LOG) << "Waiting for the relayed connections failed:" << systemError();
+            break;
+        }
+        for (int i = 0; i < count; ++i) {
+            EpollConnection *connection = static_cast<EpollConnection *>(events[i].data.ptr);
+            if (!connection) {
+                quint64 value;
+                const ssize_t received = ::read(m_wakeUp, &value, sizeof(value));
+                Q_UNUSED(received);
+                QVector<EpollConnection *> pending;
+                {
+                    QMutexLocker locker(&m_mutex);
+                    pending.swap(m_pending);
+                }
+                for (EpollConnection *added : pending) {
+                    if (!watch(added, added->local) || !watch(added, added->remote)) {
+                        close(added);
+                    }
+                }
+                continue;
+            }
+            if (connection->local == -1) {
+                //Closed while handling an earlier event
+                continue;
+            }
+            if (connection->connecting) {
+                finishConnect(connection);
+                if (connection->connecting || connection->local == -1) {
+                    continue;
+                }
+            }
+            pump(connection);
+        }
+
+        const QVector<EpollConnection *> busy = m_busy;
+        m_busy.clear();
+        for (EpollConnection *connection : busy) {
+            if (connection->local != -1) {
+                pump(connection);
+            }
+        }
+        qDeleteAll(m_closed);
+        m_closed.clear();
+    }
+
+    QList<EpollConnection *> remaining;
+    {
+        QMutexLocker locker(&m_mutex);
+        remaining = m_connections.toList();
+        m_pending.clear();
+    }
+    for (EpollConnection *connection : remaining) {
+        close(connection);
+    }
+    qDeleteAll(m_closed);
+    m_closed.clear();
+}
+
+/*
+ * Resolves the host of a connection and starts connecting it, off the thread of the session.
+ */
+class EpollResolution : public QRunnable
+{
+public:
+    EpollResolution(EpollReactor *reactor, EpollConnection *connection, const QString &hostName, quint16 port)
+        : m_reactor(reactor), m_connection(connection), m_hostName(hostName), m_port(port)
+    {
+    }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_ADDRCONFIG;
+        addrinfo *addresses = Q_NULLPTR;
+        const int error = ::getaddrinfo(m_hostName.toUtf8().constData(), QByteArray::number(m_port).constData(), &hints, &addresses);
+        if (error != 0) {
+            fail(QString::fromLocal8Bit(gai_strerror(error)));
+            return;
+        }
+        for (const addrinfo *address = addresses; address; address = address->ai_next) {
+            m_connection->addresses << QByteArray(reinterpret_cast<const char *>(address->ai_addr), int(address->ai_addrlen));
+        }
+        ::freeaddrinfo(addresses);
+
+        QString errorString;
+        if (!connectNext(m_connection, &errorString)) {
+            fail(errorString);
+            return;
+        }
+        m_reactor->add(m_connection);
+    }
+
+private:
+    void fail(const QString &errorString)
+    {
+        //The session sees the connection closed before the greeting
+        qCDebug(KIMAP2_LOG) << "Can't connect to" << m_hostName << errorString;
+        ::close(m_connection->local);
+        delete m_connection;
+    }
+
+    EpollReactor *m_reactor;
+    EpollConnection *m_connection;
+    QString m_hostName;
+    quint16 m_port;
+};
+
+EpollReactor *EpollTransportPrivate::startReactor(QString *errorString)
+{
+    QMutexLocker locker(&mutex);
+    if (!reactor) {
+        EpollReactor *started = new EpollReactor;
+        if (!started->init(errorString)) {
+            delete started;
+            return Q_NULLPTR;
+        }
+        started->start();
+        reactor = started;
+    }
+    return reactor;
+}
+#endif
+
+EpollTransport::EpollTransport(const QString &hostName, quint16 port)
+    : d(new EpollTransportPrivate)
+{
+#ifdef Q_OS_LINUX
+    d->reactor = Q_NULLPTR;
+#endif
+    d->hostName = hostName;
+    d->port = port;
+}
+
+EpollTransport::~EpollTransport()
+{
+#ifdef Q_OS_LINUX
+    //The sessions are gone, whatever they left is closed
+    d->resolver.waitForDone();
+    if (d->reactor) {
+        d->reactor->stop();
+        delete d->reactor;
+    }
+#endif
+    delete d;
+}
+
+QString EpollTransport::hostName() const
+{
+    return d->hostName;
+}
+
+qintptr EpollTransport::open(QString *errorString)
+{
+#ifdef Q_OS_LINUX
+    EpollReactor *reactor = d->startReactor(errorString);
+    if (!reactor) {
+        return -1;
+    }
+
+    int descriptors[2];
+    if (!openSocketPair(descriptors, errorString)) {
+        return -1;
+    }
+    ::fcntl(descriptors[1], F_SETFL, ::fcntl(descriptors[1], F_GETFL) | O_NONBLOCK);
+    EpollConnection *connection = new EpollConnection;
+    connection->local = descriptors[1];
+    d->resolver.start(new EpollResolution(reactor, connection, d->hostName, d->port));
+    return descriptors[0];
+#else
+    return unsupported(errorString);
+#endif
+}
+
+int EpollTransport::connectionCount() const
+{
+#ifdef Q_OS_LINUX
+    QMutexLocker locker(&d->mutex);
+    return d->reactor ? d->reactor->connectionCount() : 0;
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,164 @@
+/*
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef KIMAP2_TRANSPORT_H
+#define KIMAP2_TRANSPORT_H
+
+#include "kimap2_export.h"
+
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+#include <functional>
+
+namespace KIMAP2
+{
+
+/**
+ * Opens the connections of a session that doesn't talk to its server over TCP, see
+ * Session::Session(const QSharedPointer<Transport> &, ThreadingMode, QObject *).
+ *
+ * A transport hands out connected stream sockets, which the session reads and writes like a
+ * TCP connection, including STARTTLS or TLS. One transport can serve many sessions.
+ * The transports that come with the library need a Unix system, elsewhere they fail to open.
+ */
+class KIMAP2_EXPORT Transport
+{
+public:
+    virtual ~Transport();
+
+    /**
+     * The name the session reports as its host name, and verifies a certificate against.
+     */
+    virtual QString hostName() const = 0;
+
+    /**
+     * Opens a connection and returns the descriptor of a connected stream socket, which the
+     * session takes over, or -1 with @p errorString set.
+     *
+     * Called on the thread of the session, for the first connection and for every reconnect.
+     */
+    virtual qintptr open(QString *errorString) = 0;
+};
+
+class UnixSocketTransportPrivate;
+
+/**
+ * Connects to a server listening on a Unix domain socket, e.g. a Dovecot on the same host.
+ */
+class KIMAP2_EXPORT UnixSocketTransport : public Transport
+{
+public:
+    explicit UnixSocketTransport(const QString &path);
+    ~UnixSocketTransport();
+
+    QString hostName() const Q_DECL_OVERRIDE;
+    qintptr open(QString *errorString) Q_DECL_OVERRIDE;
+
+private:
+    Q_DISABLE_COPY(UnixSocketTransport)
+    UnixSocketTransportPrivate *const d;
+};
+
+class SocketPairTransportPrivate;
+
+/**
+ * Connects to a peer in the same process through a socket pair, e.g. a server in a benchmark
+ * or test, which leaves out the TCP stack and the network.
+ */
+class KIMAP2_EXPORT SocketPairTransport : public Transport
+{
+public:
+    /**
+     * Receives the other end of each new connection, which it then owns.
+     */
+    typedef std::function<void(qintptr descriptor)> PeerHandler;
+
+    explicit SocketPairTransport(const PeerHandler &peerHandler, const QString &hostName = QStringLiteral("localhost"));
+    ~SocketPairTransport();
+
+    QString hostName() const Q_DECL_OVERRIDE;
+    qintptr open(QString *errorString) Q_DECL_OVERRIDE;
+
+private:
+    Q_DISABLE_COPY(SocketPairTransport)
+    SocketPairTransportPrivate *const d;
+};
+
+class ProcessTransportPrivate;
+
+/**
+ * Runs a server process for each connection and talks to it over its standard input and
+ * output, e.g. "dovecot --exec-mail imap", which greets with PREAUTH.
+ *
+ * The process gets end of file on its input when the session closes the connection, and
+ * is expected to exit then. Processes still running when the transport is destroyed are
+ * killed after half a second.
+ */
+class KIMAP2_EXPORT ProcessTransport : public Transport
+{
+public:
+    ProcessTransport(const QString &program, const QStringList &arguments = QStringList());
+    ~ProcessTransport();
+
+    QString hostName() const Q_DECL_OVERRIDE;
+    qintptr open(QString *errorString) Q_DECL_OVERRIDE;
+
+private:
+    Q_DISABLE_COPY(ProcessTransport)
+    ProcessTransportPrivate *const d;
+};
+
+class EpollTransportPrivate;
+
+/**
+ * Connects to a server over TCP, with the TCP connections of all its sessions served by one
+ * thread that waits with epoll. Linux only.
+ *
+ * Each session gets one end of a socket pair, which the thread relays to the TCP connection
+ * and back. The thread holds a buffer only while data is on its way, taken from a pool. This
+ * is not faster than a direct connection: the relay copies the data once more, hands it to
+ * another thread, and takes three descriptors per session. The session still reads through
+ * its own socket, and STARTTLS and TLS are done by the session as with any transport, with
+ * the certificate verified against @p hostName.
+ *
+ * open() hands the session its end right away, @p hostName is resolved on a thread of the
+ * transport and its addresses are tried one after another. A host that can't be resolved or
+ * reached shows as a connection that was closed before the greeting.
+ */
+class KIMAP2_EXPORT EpollTransport : public Transport
+{
+public:
+    EpollTransport(const QString &hostName, quint16 port);
+    ~EpollTransport();
+
+    QString hostName() const Q_DECL_OVERRIDE;
+    qintptr open(QString *errorString) Q_DECL_OVERRIDE;
+
+    /**
+     * Returns the number of connections that are relayed at the moment.
+     */
+    int connectionCount() const;
+
+private:
+    Q_DISABLE_COPY(EpollTransport)
+    EpollTransportPrivate *const d;
+};
+
+}
+
+#endif
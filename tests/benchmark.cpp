@@ -17,17 +17,95 @@
 
 #include <qtest.h>
 
+#include "kimap2test/allocationcounter.h"
 #include "kimap2test/fakeserver.h"
+#include "kimap2test/trafficcapture.h"
 #include "kimap2/session.h"
 #include "kimap2/fetchjob.h"
+#include "kimap2/listjob.h"
+#include "kimap2/searchjob.h"
+#include "kimap2/imapset.h"
+#include "kimap2/rfccodecs.h"
 #include "imapstreamparser.h"
 
 #include <QtTest>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <functional>
 
 Q_DECLARE_METATYPE(KIMAP2::FetchJob::FetchScope)
 
 using namespace KIMAP2;
 
+/**
+ * The result of one benchmark, @p operations runs of the same operation.
+ *
+ * allocations is -1 where allocations can't be counted.
+ */
+struct Measurement {
+    QString name;
+    qint64 operations;
+    qint64 bytes;
+    qint64 nsecs;
+    qint64 allocations;
+
+    double nsPerOperation() const
+    {
+        return double(nsecs) / operations;
+    }
+
+    double bytesPerOperation() const
+    {
+        return double(bytes) / operations;
+    }
+
+    double allocationsPerOperation() const
+    {
+        return allocations < 0 ? -1 : double(allocations) / operations;
+    }
+
+    double megabytesPerSecond() const
+    {
+        return nsecs > 0 ? (bytes / 1024.0 / 1024.0) / (nsecs / 1e9) : 0;
+    }
+};
+
+static QByteArray headerFetchResponse(int count)
+{
+    QByteArray data;
+    for (int i = 1; i <= count; i++) {
+        data += QString("* %1 FETCH (UID %2 FLAGS (\\Seen) BODY[HEADER.FIELDS (TO FROM MESSAGE-ID REFERENCES IN-REPLY-TO SUBJECT DATE)] {154}\r\nFrom: Joe Smith <smith@example.com>\r\nDate: Wed, 2 Mar 2011 11:33:24 +0700\r\nMessage-ID: <1234@example.com>\r\nSubject: hello\r\nTo: Jane <jane@example.com>\r\n\r\n BODY[1.1.1] {28}\r\nHi Jane, nice to meet you!\r\n BODY[1.1.1.MIME] {48}\r\nContent-Type: text/plain; charset=ISO-8859-1\r\n\r\n)\r\n").arg(i).arg(i).toLatin1();
+    }
+    return data;
+}
+
+static QByteArray bodyFetchResponse(int count, int bodySize)
+{
+    QByteArray line("Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor.\r\n");
+    QByteArray body;
+    while (body.size() + line.size() <= bodySize) {
+        body += line;
+    }
+    QByteArray data;
+    for (int i = 1; i <= count; i++) {
+        data += "* " + QByteArray::number(i) + " FETCH (UID " + QByteArray::number(i) + " RFC822.SIZE " + QByteArray::number(body.size())
+                + " BODY[] {" + QByteArray::number(body.size()) + "}\r\n" + body + ")\r\n";
+    }
+    return data;
+}
+
+static QByteArray bodyStructureFetchResponse(int count)
+{
+    QByteArray data;
+    for (int i = 1; i <= count; i++) {
+        data += "* " + QByteArray::number(i) + " FETCH (UID " + QByteArray::number(i) + " BODYSTRUCTURE ((((\"TEXT\" \"PLAIN\" (\"CHARSET\" \"ISO-8859-1\") NIL NIL \"7BIT\" 72 4 NIL NIL NIL)(\"TEXT\" \"HTML\" (\"CHARSET\" \"ISO-8859-1\") NIL NIL \"QUOTED-PRINTABLE\" 281 5 NIL NIL NIL) \"ALTERNATIVE\" (\"BOUNDARY\" \"0001\") NIL NIL)(\"IMAGE\" \"GIF\" (\"NAME\" \"B56.gif\") \"<B56@goomoji.gmail>\" NIL \"BASE64\" 528 NIL NIL NIL) \"RELATED\" (\"BOUNDARY\" \"0002\") NIL NIL)(\"IMAGE\" \"JPEG\" (\"NAME\" \"photo.jpg\") NIL NIL \"BASE64\" 53338 NIL (\"ATTACHMENT\" (\"FILENAME\" \"photo.jpg\")) NIL) \"MIXED\" (\"BOUNDARY\" \"0003\") NIL NIL))\r\n";
+    }
+    return data;
+}
+
 class Benchmark: public QObject
 {
     Q_OBJECT
@@ -41,6 +119,162 @@ private:
     QMap<qint64, KIMAP2::MessagePtr> m_messages;
     QMap<qint64, KIMAP2::MessageAttributes> m_attrs;
 
+    QVector<Measurement> m_measurements;
+
+    /**
+     * Runs @p operation @p operations times and records the time and allocations it took.
+     *
+     * @p bytes is the amount of input handled by one run.
+     */
+    Measurement measure(const QString &name, qint64 operations, qint64 bytes, const std::function<void()> &operation)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        AllocationCounter counter;
+        for (qint64 i = 0; i < operations; ++i) {
+            operation();
+        }
+        counter.stop();
+        const qint64 nsecs = timer.nsecsElapsed();
+        const qint64 allocations = AllocationCounter::isSupported() ? counter.allocations() : -1;
+        return record({name, operations, bytes * operations, nsecs, allocations});
+    }
+
+    Measurement record(const Measurement &measurement)
+    {
+        qWarning().nospace() << qPrintable(measurement.name) << ": "
+                             << measurement.nsPerOperation() << " ns/op, "
+                             << measurement.bytesPerOperation() << " bytes/op, "
+                             << measurement.allocationsPerOperation() << " allocs/op, "
+                             << measurement.megabytesPerSecond() << " MB/s";
+        m_measurements << measurement;
+        return measurement;
+    }
+
+    /**
+     * Prints what the parser did for @p name, in builds with KIMAP2_PARSER_COUNTERS.
+     */
+    static void printCounters(const QString &name, const KIMAP2::ParserCounters &counters)
+    {
+        if (!KIMAP2::ParserCounters::isEnabled()) {
+            return;
+        }
+        qWarning().nospace() << qPrintable(name) << " parser bytes: "
+                             << counters.initBytes << " init, "
+                             << counters.quotedStringBytes << " quoted, "
+                             << counters.literalStringBytes << " literal, "
+                             << counters.stringBytes << " string, "
+                             << counters.whitespaceBytes << " whitespace, "
+                             << counters.angleBracketStringBytes << " bracket, "
+                             << counters.crlfBytes << " crlf, "
+                             << counters.sublistBytes << " in sublists";
+        qWarning().nospace() << qPrintable(name) << " parser buffer: "
+                             << counters.trims << " trims, "
+                             << counters.trimCopies << " copying " << counters.trimCopiedBytes << " bytes, "
+                             << counters.reads << " reads, "
+                             << counters.smallReads << " below " << KIMAP2::ParserCounters::smallReadSize << " bytes";
+    }
+
+    void measureParser(const QString &name, const QByteArray &input, int expectedResponses)
+    {
+        QByteArray data = input;
+        int resultCount = 0;
+        KIMAP2::ParserCounters counters;
+        measure(name, 1, data.size(), [&]() {
+            QBuffer buffer(&data);
+            buffer.open(QIODevice::ReadOnly);
+            KIMAP2::ImapStreamParser parser(&buffer);
+            parser.onResponseReceived([&resultCount](const KIMAP2::Message &) {
+                resultCount++;
+            });
+            while (parser.availableDataSize()) {
+                parser.parseStream();
+            }
+            counters = parser.counters();
+        });
+        printCounters(name, counters);
+        QCOMPARE(resultCount, expectedResponses);
+    }
+
+    static qint64 scenarioSize(const QList<QByteArray> &scenario)
+    {
+        qint64 size = 0;
+        foreach (const QByteArray &line, scenario) {
+            if (line.startsWith("S: ")) {
+                size += line.size() - 3 + 2;
+            }
+        }
+        return size;
+    }
+
+    static QJsonObject toJson(const Measurement &measurement)
+    {
+        QJsonObject object;
+        object.insert(QStringLiteral("name"), measurement.name);
+        object.insert(QStringLiteral("operations"), double(measurement.operations));
+        object.insert(QStringLiteral("nsPerOperation"), measurement.nsPerOperation());
+        object.insert(QStringLiteral("bytesPerOperation"), measurement.bytesPerOperation());
+        object.insert(QStringLiteral("allocationsPerOperation"), measurement.allocationsPerOperation());
+        object.insert(QStringLiteral("megabytesPerSecond"), measurement.megabytesPerSecond());
+        return object;
+    }
+
+    void writeResults(const QString &fileName)
+    {
+        QJsonArray results;
+        foreach (const Measurement &measurement, m_measurements) {
+            results.append(toJson(measurement));
+        }
+        QFile file(fileName);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qWarning() << "Failed to write the benchmark results to" << fileName;
+            return;
+        }
+        file.write(QJsonDocument(results).toJson());
+    }
+
+    /**
+     * Compares the results against the ones saved in @p fileName, returns false if one got slower
+     * by more than @p tolerance percent or needs more allocations.
+     */
+    bool compareToBaseline(const QString &fileName, double tolerance)
+    {
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly)) {
+            qWarning() << "Failed to read the benchmark baseline" << fileName;
+            return false;
+        }
+        QHash<QString, QJsonObject> baseline;
+        foreach (const QJsonValue &value, QJsonDocument::fromJson(file.readAll()).array()) {
+            const QJsonObject object = value.toObject();
+            baseline.insert(object.value(QStringLiteral("name")).toString(), object);
+        }
+
+        bool ok = true;
+        foreach (const Measurement &measurement, m_measurements) {
+            if (!baseline.contains(measurement.name)) {
+                qWarning() << qPrintable(measurement.name) << "is not in the baseline";
+                continue;
+            }
+            const QJsonObject base = baseline.value(measurement.name);
+            const double baseNs = base.value(QStringLiteral("nsPerOperation")).toDouble();
+            const double baseAllocations = base.value(QStringLiteral("allocationsPerOperation")).toDouble();
+            const double change = baseNs > 0 ? (measurement.nsPerOperation() - baseNs) * 100 / baseNs : 0;
+            qWarning().nospace() << qPrintable(measurement.name) << ": "
+                                 << change << "% time, "
+                                 << baseAllocations << " -> " << measurement.allocationsPerOperation() << " allocs/op";
+            if (change > tolerance) {
+                qWarning() << qPrintable(measurement.name) << "got slower than the baseline";
+                ok = false;
+            }
+            if (baseAllocations >= 0 && measurement.allocationsPerOperation() > baseAllocations) {
+                qWarning() << qPrintable(measurement.name) << "allocates more than the baseline";
+                ok = false;
+            }
+        }
+        return ok;
+    }
+
 public Q_SLOTS:
     void onResultReceived(const FetchJob::Result &result)
     {
@@ -66,52 +300,61 @@ public Q_SLOTS:
 
 private Q_SLOTS:
 
+    /**
+     * Writes the results to KIMAP2_BENCHMARK_OUTPUT and compares them against KIMAP2_BENCHMARK_BASELINE,
+     * both JSON files in the same format.
+     *
+     * KIMAP2_BENCHMARK_TOLERANCE is the slowdown in percent accepted against the baseline, 10 by default.
+     */
+    void cleanupTestCase()
+    {
+        if (!qEnvironmentVariableIsEmpty("KIMAP2_BENCHMARK_OUTPUT")) {
+            writeResults(QFile::decodeName(qgetenv("KIMAP2_BENCHMARK_OUTPUT")));
+        }
+        if (!qEnvironmentVariableIsEmpty("KIMAP2_BENCHMARK_BASELINE")) {
+            bool ok = false;
+            double tolerance = qgetenv("KIMAP2_BENCHMARK_TOLERANCE").toDouble(&ok);
+            if (!ok) {
+                tolerance = 10;
+            }
+            QVERIFY(compareToBaseline(QFile::decodeName(qgetenv("KIMAP2_BENCHMARK_BASELINE")), tolerance));
+        }
+    }
+
     void testFetchParseOnly()
     {
-        int count = 5000;
-        int parsedBytes = 0;
-        QByteArray data;
-        for (int i = 1; i <= count; i++) {
-            data += QString("* %1 FETCH (UID %2 FLAGS (\\Seen) BODY[HEADER.FIELDS (TO FROM MESSAGE-ID REFERENCES IN-REPLY-TO SUBJECT DATE)] {154}\r\nFrom: Joe Smith <smith@example.com>\r\nDate: Wed, 2 Mar 2011 11:33:24 +0700\r\nMessage-ID: <1234@example.com>\r\nSubject: hello\r\nTo: Jane <jane@example.com>\r\n\r\n BODY[1.1.1] {28}\r\nHi Jane, nice to meet you!\r\n BODY[1.1.1.MIME] {48}\r\nContent-Type: text/plain; charset=ISO-8859-1\r\n\r\n)\r\n").arg(i).arg(i).toLatin1();
-        };
+        const int count = 5000;
+        QByteArray data = headerFetchResponse(count);
         data += "A000001 OK fetch done\r\n";
-        parsedBytes = data.size();
-
-        QBuffer buffer(&data);
-        buffer.open(QIODevice::ReadOnly);
-        KIMAP2::ImapStreamParser parser(&buffer);
-        int resultCount = 0;
-        parser.onResponseReceived([&resultCount](const KIMAP2::Message &) {
-            resultCount++;
-        });
-
-
-        QTime time;
-        time.start();
+        measureParser(QStringLiteral("parser/headers"), data, count + 1);
+    }
 
-        while (parser.availableDataSize()) {
-            parser.parseStream();
-        }
+    void testParseBodyLiterals()
+    {
+        const int count = 500;
+        QByteArray data = bodyFetchResponse(count, 64 * 1024);
+        data += "A000001 OK fetch done\r\n";
+        measureParser(QStringLiteral("parser/body-literals"), data, count + 1);
+    }
 
-        qWarning() << "Reading " << count << " messages took: " << time.elapsed() << " ms.";
-        qWarning() << parsedBytes << " bytes expected to be parsed";
-        qWarning() << "Received " << resultCount << " results";
+    void testParseBodyStructures()
+    {
+        const int count = 5000;
+        QByteArray data = bodyStructureFetchResponse(count);
+        data += "A000001 OK fetch done\r\n";
+        measureParser(QStringLiteral("parser/bodystructures"), data, count + 1);
     }
 
     void testFetchParts()
     {
         int count = 5000;
-        int parsedBytes = 0;
         QList<QByteArray> scenario;
         scenario << FakeServer::preauth();
-        parsedBytes += scenario.last().size();
         scenario << "C: A000001 FETCH 1:* (BODY.PEEK[HEADER.FIELDS (TO FROM MESSAGE-ID REFERENCES IN-REPLY-TO SUBJECT DATE)] BODY.PEEK[1.1.1.MIME] BODY.PEEK[1.1.1] FLAGS UID)";
         for (int i = 1; i <= count; i++) {
             scenario << QString("S: * %1 FETCH (UID %2 FLAGS (\\Seen) BODY[HEADER.FIELDS (TO FROM MESSAGE-ID REFERENCES IN-REPLY-TO SUBJECT DATE)] {154}\r\nFrom: Joe Smith <smith@example.com>\r\nDate: Wed, 2 Mar 2011 11:33:24 +0700\r\nMessage-ID: <1234@example.com>\r\nSubject: hello\r\nTo: Jane <jane@example.com>\r\n\r\n BODY[1.1.1] {28}\r\nHi Jane, nice to meet you!\r\n BODY[1.1.1.MIME] {48}\r\nContent-Type: text/plain; charset=ISO-8859-1\r\n\r\n)\r\n").arg(i).arg(i).toLatin1();
-            parsedBytes += scenario.last().size();
         };
         scenario << "S: A000001 OK fetch done";
-        parsedBytes += scenario.last().size();
 
         KIMAP2::FetchJob::FetchScope scope;
         scope.mode = KIMAP2::FetchJob::FetchScope::HeaderAndContent;
@@ -131,13 +374,11 @@ private Q_SLOTS:
 
         connect(job, &FetchJob::resultReceived, this, &Benchmark::onResultReceived);
 
-        QTime time;
-        time.start();
-
-        bool result = job->exec();
-
-        qWarning() << "Reading " << count << " messages took: " << time.elapsed() << " ms.";
-        qWarning() << parsedBytes << " bytes expected to be parsed";
+        bool result = false;
+        measure(QStringLiteral("fetchjob/parts"), 1, scenarioSize(scenario), [&]() {
+            result = job->exec();
+        });
+        printCounters(QStringLiteral("fetchjob/parts"), session.metrics().parser);
 
         QVERIFY(result);
         QVERIFY(m_signals.count() > 0);
@@ -163,17 +404,13 @@ private Q_SLOTS:
     void testFetchFlags()
     {
         int count = 5000;
-        int parsedBytes = 0;
         QList<QByteArray> scenario;
         scenario << FakeServer::preauth();
-        parsedBytes += scenario.last().size();
         scenario << "C: A000001 FETCH 1:* (FLAGS UID)";
         for (int i = 1; i <= count; i++) {
             scenario << QString("S: * %1 FETCH ( FLAGS (\\Seen) UID %2 )\r\n").arg(i).arg(i).toLatin1();
-            parsedBytes += scenario.last().size();
         };
         scenario << "S: A000001 OK fetch done";
-        parsedBytes += scenario.last().size();
 
         KIMAP2::FetchJob::FetchScope scope;
         scope.mode = KIMAP2::FetchJob::FetchScope::Flags;
@@ -191,13 +428,11 @@ private Q_SLOTS:
 
         connect(job, &FetchJob::resultReceived, this, &Benchmark::onResultReceived);
 
-        QTime time;
-        time.start();
-
-        bool result = job->exec();
-
-        qWarning() << "Reading " << count << " messages took: " << time.elapsed() << " ms.";
-        qWarning() << parsedBytes << " bytes expected to be parsed";
+        bool result = false;
+        measure(QStringLiteral("fetchjob/flags"), 1, scenarioSize(scenario), [&]() {
+            result = job->exec();
+        });
+        printCounters(QStringLiteral("fetchjob/flags"), session.metrics().parser);
 
         QVERIFY(result);
         QVERIFY(m_signals.count() > 0);
@@ -205,8 +440,6 @@ private Q_SLOTS:
         QCOMPARE(m_messages.count(), count);
         QCOMPARE(m_attrs.count(), 0);
 
-        // Check that we received the message header
-
         fakeServer.quit();
 
         m_signals.clear();
@@ -217,6 +450,179 @@ private Q_SLOTS:
         m_attrs.clear();
     }
 
+    void testSearchResults()
+    {
+        const int count = 100000;
+        QByteArray results("S: * SEARCH");
+        for (int i = 1; i <= count; i++) {
+            // Leave gaps so that the result doesn't collapse into a single interval
+            results += ' ' + QByteArray::number(i * 2);
+        }
+        QList<QByteArray> scenario;
+        scenario << FakeServer::preauth()
+                 << "C: A000001 UID SEARCH ALL"
+                 << results
+                 << "S: A000001 OK search done";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::SearchJob *job = new KIMAP2::SearchJob(&session);
+        job->setUidBased(true);
+        job->setTerm(KIMAP2::Term(KIMAP2::Term::All));
+
+        bool result = false;
+        measure(QStringLiteral("searchjob/results"), 1, scenarioSize(scenario), [&]() {
+            result = job->exec();
+        });
+        printCounters(QStringLiteral("searchjob/results"), session.metrics().parser);
+
+        QVERIFY(result);
+        QCOMPARE(job->results().count(), count);
+
+        fakeServer.quit();
+    }
+
+    void testListFolders()
+    {
+        const int count = 20000;
+        QList<QByteArray> scenario;
+        scenario << FakeServer::preauth()
+                 << "C: A000001 LIST \"\" *";
+        for (int i = 0; i < count; i++) {
+            scenario << "S: * LIST ( \\HasNoChildren ) / INBOX/Folder" + QByteArray::number(i / 100) + "/Sub" + QByteArray::number(i);
+        }
+        scenario << "S: A000001 OK LIST completed";
+
+        FakeServer fakeServer;
+        fakeServer.setScenario(scenario);
+        fakeServer.startAndWait();
+
+        KIMAP2::Session session(QStringLiteral("127.0.0.1"), 5989);
+
+        KIMAP2::ListJob *job = new KIMAP2::ListJob(&session);
+        job->setOption(KIMAP2::ListJob::IncludeUnsubscribed);
+        int received = 0;
+        connect(job, &KIMAP2::ListJob::resultReceived, [&received](const KIMAP2::MailBoxDescriptor &, const QList<QByteArray> &) {
+            received++;
+        });
+
+        bool result = false;
+        measure(QStringLiteral("listjob/folders"), 1, scenarioSize(scenario), [&]() {
+            result = job->exec();
+        });
+        printCounters(QStringLiteral("listjob/folders"), session.metrics().parser);
+
+        QVERIFY(result);
+        QCOMPARE(received, count);
+
+        fakeServer.quit();
+    }
+
+    void testImapSet()
+    {
+        const qint64 count = 1000000;
+        ImapSet set;
+        measure(QStringLiteral("imapset/build"), 1, 0, [&]() {
+            set = ImapSet();
+            for (qint64 uid = 1; uid <= count; uid++) {
+                // Every third uid is missing, which leaves roughly 333k intervals
+                if (uid % 3) {
+                    set.add(uid);
+                }
+            }
+        });
+
+        ImapSet built;
+        measure(QStringLiteral("imapset/builder"), 1, 0, [&]() {
+            ImapSetBuilder builder;
+            for (qint64 uid = 1; uid <= count; uid++) {
+                if (uid % 3) {
+                    builder.add(uid);
+                }
+            }
+            built = builder.toSet();
+        });
+
+        measure(QStringLiteral("imapset/optimize"), 1, 0, [&]() {
+            set.optimize();
+        });
+        QCOMPARE(set.intervals().count(), int(count / 3) + 1);
+
+        QByteArray sequence;
+        measure(QStringLiteral("imapset/serialize"), 1, 0, [&]() {
+            sequence = set.toImapSequenceSet();
+        });
+
+        ImapSet parsed;
+        measure(QStringLiteral("imapset/parse"), 1, sequence.size(), [&]() {
+            parsed = ImapSet::fromImapSequenceSet(sequence);
+        });
+        QCOMPARE(parsed, set);
+        QCOMPARE(built, set);
+    }
+
+    void testFolderNameCodecs()
+    {
+        const QByteArray name("INBOX/Entw\xc3\xbcrfe/Gr\xc3\xb6\xc3\x9f" "ere \xc3\x84nderungen/\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e");
+        const QByteArray encoded = KIMAP2::encodeImapFolderName(name);
+        QByteArray result;
+        measure(QStringLiteral("rfccodecs/encodeImapFolderName"), 100000, name.size(), [&]() {
+            result = KIMAP2::encodeImapFolderName(name);
+        });
+        QCOMPARE(result, encoded);
+        measure(QStringLiteral("rfccodecs/decodeImapFolderName"), 100000, encoded.size(), [&]() {
+            result = KIMAP2::decodeImapFolderName(encoded);
+        });
+        QCOMPARE(result, name);
+    }
+
+    void testDecodeRFC2047()
+    {
+        const QString subject = QStringLiteral("Re: =?utf-8?Q?Gr=C3=BC=C3=9Fe?= =?utf-8?B?YXVzIELDpHJsaW4=?=");
+        QString result;
+        measure(QStringLiteral("rfccodecs/decodeRFC2047String"), 100000, subject.size(), [&]() {
+            result = KIMAP2::decodeRFC2047String(subject);
+        });
+        QCOMPARE(result, QString::fromUtf8("Re: Grüße aus Bärlin"));
+    }
+
+    /**
+     * Parses the responses of a capture taken with KIMAP2_LOGFILE_CAPTURE, named by KIMAP2_BENCHMARK_CAPTURE.
+     */
+    void testParseCapture()
+    {
+        if (qEnvironmentVariableIsEmpty("KIMAP2_BENCHMARK_CAPTURE")) {
+            QSKIP("KIMAP2_BENCHMARK_CAPTURE is not set");
+        }
+        TrafficCapture capture;
+        QVERIFY(capture.load(QFile::decodeName(qgetenv("KIMAP2_BENCHMARK_CAPTURE"))));
+        if (capture.isIncomplete()) {
+            qWarning() << "The capture is incomplete, the parser may get out of sync";
+        }
+        QByteArray data = capture.receivedData();
+
+        int resultCount = 0;
+        KIMAP2::ParserCounters counters;
+        measure(QStringLiteral("parser/capture"), 1, data.size(), [&]() {
+            QBuffer buffer(&data);
+            buffer.open(QIODevice::ReadOnly);
+            KIMAP2::ImapStreamParser parser(&buffer);
+            parser.onResponseReceived([&resultCount](const KIMAP2::Message &) {
+                resultCount++;
+            });
+            while (parser.availableDataSize()) {
+                parser.parseStream();
+            }
+            counters = parser.counters();
+        });
+        printCounters(QStringLiteral("parser/capture"), counters);
+        qWarning() << "Received " << resultCount << " responses";
+    }
+
 };
 
 QTEST_GUILESS_MAIN(Benchmark)
@@ -0,0 +1,607 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+/*
+ * Runs standard workloads against a live server and reports their latencies and throughput.
+ *
+ * imapbench imap.example.com:993 user password --folders 20 --messages 5000 --json results.json
+ *
+ * The store workload changes the flags of messages, it adds a keyword and removes it again,
+ * so it only runs when it is asked for with --workloads.
+ */
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QScopedPointer>
+
+#include "session.h"
+#include "fetchjob.h"
+#include "imapset.h"
+#include "listjob.h"
+#include "loginjob.h"
+#include "logoutjob.h"
+#include "searchjob.h"
+#include "selectjob.h"
+#include "statusjob.h"
+#include "storejob.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+using namespace KIMAP2;
+
+/**
+ * The result of one workload: the latencies of its operations, if they were timed one by one,
+ * and the bytes and items it received in @p msecs.
+ */
+struct Measurement {
+    Measurement() : items(0), bytes(0), msecs(0) { }
+
+    QString name;
+    QVector<double> latencies;
+    qint64 items;
+    qint64 bytes;
+    qint64 msecs;
+
+    double percentile(double p) const
+    {
+        if (latencies.isEmpty()) {
+            return 0;
+        }
+        QVector<double> sorted = latencies;
+        std::sort(sorted.begin(), sorted.end());
+        //Nearest rank
+        const int rank = qBound(1, int(std::ceil(p / 100.0 * sorted.size())), sorted.size());
+        return sorted.at(rank - 1);
+    }
+
+    double itemsPerSecond() const
+    {
+        return msecs > 0 ? items / (msecs / 1000.0) : 0;
+    }
+
+    double megabytesPerSecond() const
+    {
+        return msecs > 0 ? (bytes / 1024.0 / 1024.0) / (msecs / 1000.0) : 0;
+    }
+};
+
+struct Options {
+    QString server;
+    quint16 port;
+    QString user;
+    QString password;
+    bool tls;
+    int connections;
+    int folders;
+    QString mailBox;
+    int messages;
+    int bodies;
+    int store;
+    int chunkSize;
+    int pipelineDepth;
+};
+
+class Bench
+{
+public:
+    explicit Bench(const Options &options) : m_options(options) { }
+
+    Session *login(QString *error)
+    {
+        QScopedPointer<Session> session(new Session(m_options.server, m_options.port));
+        Session *s = session.data();
+        QObject::connect(s, &Session::sslErrors, [s](const QList<QSslError> &errors) {
+            qWarning() << "Ignoring SSL errors:" << errors;
+            s->ignoreErrors(errors);
+        });
+
+        LoginJob *login = new LoginJob(s);
+        login->setEncryptionMode(m_options.tls ? QSsl::AnyProtocol : QSsl::UnknownProtocol, false);
+        login->setAuthenticationMode(LoginJob::Plain);
+        login->setUserName(m_options.user);
+        login->setPassword(m_options.password);
+        if (!login->exec()) {
+            *error = login->errorString();
+            return Q_NULLPTR;
+        }
+        return session.take();
+    }
+
+    static void logout(Session *session)
+    {
+        LogoutJob *logout = new LogoutJob(session);
+        logout->exec();
+    }
+
+    bool runConnect()
+    {
+        Measurement m;
+        m.name = QStringLiteral("connect+login");
+        qint64 handshakes = 0;
+        QElapsedTimer total;
+        total.start();
+        for (int i = 0; i < m_options.connections; ++i) {
+            QElapsedTimer timer;
+            timer.start();
+            QString error;
+            QScopedPointer<Session> session(login(&error));
+            if (!session) {
+                qWarning() << "Login failed:" << error;
+                return false;
+            }
+            m.latencies << timer.elapsed();
+            m.items++;
+            m.bytes += session->metrics().bytesReceived;
+            handshakes += session->metrics().tlsHandshakes;
+            logout(session.data());
+        }
+        m.msecs = total.elapsed();
+        record(m);
+        qInfo().nospace() << "  " << handshakes << " TLS handshakes";
+        return true;
+    }
+
+    bool runSelect(Session *session)
+    {
+        const QStringList mailBoxes = selectableMailBoxes(session);
+        if (mailBoxes.isEmpty()) {
+            return false;
+        }
+        Measurement m;
+        m.name = QStringLiteral("select");
+        runMeasured(session, &m, [&]() {
+            for (const QString &mailBox : mailBoxes) {
+                QElapsedTimer timer;
+                timer.start();
+                if (!select(session, mailBox, true)) {
+                    return false;
+                }
+                m.latencies << timer.elapsed();
+                m.items++;
+            }
+            return true;
+        });
+        record(m);
+        return true;
+    }
+
+    bool runFetch(Session *session, const QString &name, FetchJob::FetchScope::Mode mode, int count, int pipelinedChunks)
+    {
+        if (!select(session, m_options.mailBox, true)) {
+            return false;
+        }
+        const ImapSet uids = lastUids(session, count);
+        if (uids.isEmpty()) {
+            qWarning() << m_options.mailBox << "has no messages to fetch";
+            return false;
+        }
+
+        Measurement m;
+        m.name = name;
+        const bool ok = runMeasured(session, &m, [&]() {
+            FetchJob *fetch = new FetchJob(session);
+            FetchJob::FetchScope scope;
+            scope.mode = mode;
+            fetch->setScope(scope);
+            fetch->setUidBased(true);
+            fetch->setSequenceSet(uids);
+            fetch->setRawResults(true);
+            fetch->setChunkSize(m_options.chunkSize);
+            fetch->setPipelinedChunks(pipelinedChunks);
+            //Time each chunk from the previous one, pipelined chunks overlap
+            QElapsedTimer chunkTimer;
+            chunkTimer.start();
+            QObject::connect(fetch, &FetchJob::resultReceived, [&m](const FetchJob::Result &) {
+                m.items++;
+            });
+            QObject::connect(fetch, &FetchJob::chunkCompleted, [&m, &chunkTimer](const ImapSet &) {
+                m.latencies << chunkTimer.restart();
+            });
+            return fetch->exec();
+        });
+        record(m);
+        return ok;
+    }
+
+    bool runStore(Session *session)
+    {
+        if (!select(session, m_options.mailBox, false)) {
+            return false;
+        }
+        const ImapSet uids = lastUids(session, m_options.store);
+        if (uids.isEmpty()) {
+            qWarning() << m_options.mailBox << "has no messages to store flags on";
+            return false;
+        }
+        qint64 count = 0;
+        for (const ImapInterval &interval : uids.intervals()) {
+            count += interval.size();
+        }
+        const MessageFlags keyword = MessageFlags() << QByteArrayLiteral("$KIMAP2Bench");
+
+        //One job per message, each waits for the previous one
+        Measurement serial;
+        serial.name = QStringLiteral("store serial");
+        bool ok = runMeasured(session, &serial, [&]() {
+            for (const ImapInterval &interval : uids.intervals()) {
+                for (qint64 uid = interval.begin(); uid <= interval.end(); ++uid) {
+                    QElapsedTimer timer;
+                    timer.start();
+                    StoreJob *store = new StoreJob(session);
+                    store->setUidBased(true);
+                    store->setSequenceSet(ImapSet(uid));
+                    store->setMode(StoreJob::AppendFlags);
+                    store->setFlags(keyword);
+                    if (!store->exec()) {
+                        return false;
+                    }
+                    serial.latencies << timer.elapsed();
+                    serial.items++;
+                }
+            }
+            return true;
+        });
+        record(serial);
+
+        //The same number of commands, sent without waiting for each other
+        Measurement pipelined;
+        pipelined.name = QStringLiteral("store pipelined");
+        ok = runMeasured(session, &pipelined, [&]() {
+            int pending = 0;
+            bool failed = false;
+            QEventLoop loop;
+            for (const ImapInterval &interval : uids.intervals()) {
+                for (qint64 uid = interval.begin(); uid <= interval.end(); ++uid) {
+                    pending++;
+                    QElapsedTimer timer;
+                    timer.start();
+                    session->sendCommand("UID STORE", QByteArray::number(uid) + " -FLAGS.SILENT ($KIMAP2Bench)",
+                    [&, timer](const CommandResult &result) {
+                        pipelined.latencies << timer.elapsed();
+                        pipelined.items++;
+                        failed = failed || !result.isOk();
+                        if (--pending == 0) {
+                            loop.quit();
+                        }
+                    });
+                }
+            }
+            loop.exec();
+            return !failed;
+        }) && ok;
+        record(pipelined);
+
+        //All messages with a single command
+        Measurement batched;
+        batched.name = QStringLiteral("store batched");
+        ok = runMeasured(session, &batched, [&]() {
+            for (StoreJob::StoreMode mode : {StoreJob::AppendFlags, StoreJob::RemoveFlags}) {
+                QElapsedTimer timer;
+                timer.start();
+                StoreJob *store = new StoreJob(session);
+                store->setUidBased(true);
+                store->setSequenceSet(uids);
+                store->setMode(mode);
+                store->setFlags(keyword);
+                if (!store->exec()) {
+                    return false;
+                }
+                batched.latencies << timer.elapsed();
+                batched.items += count;
+            }
+            return true;
+        }) && ok;
+        record(batched);
+        return ok;
+    }
+
+    bool runPipeline(Session *session)
+    {
+        const QStringList mailBoxes = selectableMailBoxes(session);
+        if (mailBoxes.isEmpty()) {
+            return false;
+        }
+        const QList<QByteArray> items = QList<QByteArray>() << "MESSAGES" << "UIDNEXT" << "UIDVALIDITY" << "UNSEEN";
+
+        Measurement serial;
+        serial.name = QStringLiteral("status serial");
+        session->setPipeliningEnabled(false);
+        bool ok = runMeasured(session, &serial, [&]() {
+            for (const QString &mailBox : mailBoxes) {
+                QElapsedTimer timer;
+                timer.start();
+                StatusJob *status = new StatusJob(session);
+                status->setMailBox(mailBox);
+                status->setDataItems(items);
+                if (!status->exec()) {
+                    return false;
+                }
+                serial.latencies << timer.elapsed();
+                serial.items++;
+            }
+            return true;
+        });
+        record(serial);
+
+        Measurement pipelined;
+        pipelined.name = QStringLiteral("status pipelined");
+        session->setPipeliningEnabled(true);
+        ok = runMeasured(session, &pipelined, [&]() {
+            QElapsedTimer timer;
+            timer.start();
+            StatusJob *status = new StatusJob(session);
+            status->setMailBoxes(mailBoxes);
+            status->setDataItems(items);
+            QObject::connect(status, &StatusJob::statusReceived, [&](const QString &, const QList<QPair<QByteArray, qint64> > &) {
+                pipelined.latencies << timer.elapsed();
+                pipelined.items++;
+            });
+            return status->exec();
+        }) && ok;
+        session->setPipeliningEnabled(false);
+        record(pipelined);
+
+        ok = runFetch(session, QStringLiteral("headers serial chunks"), FetchJob::FetchScope::Headers, m_options.messages, 1) && ok;
+        ok = runFetch(session, QStringLiteral("headers pipelined chunks"), FetchJob::FetchScope::Headers, m_options.messages, m_options.pipelineDepth) && ok;
+        return ok;
+    }
+
+    void printCommands(Session *session) const
+    {
+        const SessionMetrics metrics = session->metrics();
+        const QVector<int> buckets = SessionMetrics::latencyBuckets();
+        qInfo() << "Commands:";
+        QList<QByteArray> names = metrics.commands.keys();
+        std::sort(names.begin(), names.end());
+        for (const QByteArray &name : names) {
+            const SessionMetrics::Command command = metrics.commands.value(name);
+            qInfo().nospace().noquote() << "  " << name << ": " << command.count << " completed, " << command.failed << " failed, "
+                                        << "mean " << (command.count > 0 ? double(command.totalLatency) / command.count : 0) << " ms, "
+                                        << "p50 " << histogramPercentile(command, buckets, 50) << ", "
+                                        << "p90 " << histogramPercentile(command, buckets, 90) << ", "
+                                        << "p99 " << histogramPercentile(command, buckets, 99);
+        }
+        qInfo().nospace() << "  " << metrics.bytesSent << " bytes sent, " << metrics.bytesReceived << " bytes received, "
+                          << metrics.parseTime / 1000 << " ms parsing";
+    }
+
+    bool writeResults(const QString &fileName) const
+    {
+        QJsonArray results;
+        for (const Measurement &m : m_measurements) {
+            QJsonObject object;
+            object.insert(QStringLiteral("name"), m.name);
+            object.insert(QStringLiteral("items"), double(m.items));
+            object.insert(QStringLiteral("bytes"), double(m.bytes));
+            object.insert(QStringLiteral("msecs"), double(m.msecs));
+            object.insert(QStringLiteral("p50"), m.percentile(50));
+            object.insert(QStringLiteral("p90"), m.percentile(90));
+            object.insert(QStringLiteral("p99"), m.percentile(99));
+            object.insert(QStringLiteral("itemsPerSecond"), m.itemsPerSecond());
+            object.insert(QStringLiteral("megabytesPerSecond"), m.megabytesPerSecond());
+            results.append(object);
+        }
+        QFile file(fileName);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qWarning() << "Failed to write the results to" << fileName;
+            return false;
+        }
+        file.write(QJsonDocument(results).toJson());
+        return true;
+    }
+
+private:
+    // Runs @p operation and takes its time and the bytes it received from the session metrics
+    static bool runMeasured(Session *session, Measurement *m, const std::function<bool()> &operation)
+    {
+        const qint64 bytesBefore = session->metrics().bytesReceived;
+        QElapsedTimer timer;
+        timer.start();
+        const bool ok = operation();
+        m->msecs = timer.elapsed();
+        m->bytes = session->metrics().bytesReceived - bytesBefore;
+        if (!ok) {
+            qWarning() << m->name << "failed";
+        }
+        return ok;
+    }
+
+    // The upper bound of the histogram bucket the @p p th percentile falls into
+    static QString histogramPercentile(const SessionMetrics::Command &command, const QVector<int> &buckets, double p)
+    {
+        qint64 total = 0;
+        for (qint64 count : command.latencyHistogram) {
+            total += count;
+        }
+        if (total == 0) {
+            return QStringLiteral("-");
+        }
+        const qint64 rank = qMax<qint64>(1, qint64(std::ceil(p / 100.0 * total)));
+        qint64 seen = 0;
+        for (int i = 0; i < command.latencyHistogram.size(); ++i) {
+            seen += command.latencyHistogram.at(i);
+            if (seen >= rank) {
+                return i < buckets.size() ? QStringLiteral("<=%1 ms").arg(buckets.at(i)) : QStringLiteral(">%1 ms").arg(buckets.last());
+            }
+        }
+        return QStringLiteral("-");
+    }
+
+    void record(const Measurement &m)
+    {
+        m_measurements << m;
+        qInfo().nospace().noquote() << m.name << ": " << m.items << " in " << m.msecs << " ms, "
+                                    << m.itemsPerSecond() << "/s, " << m.megabytesPerSecond() << " MB/s"
+                                    << (m.latencies.isEmpty() ? QString() : QStringLiteral(", p50 %1 ms, p90 %2 ms, p99 %3 ms")
+                                        .arg(m.percentile(50)).arg(m.percentile(90)).arg(m.percentile(99)));
+    }
+
+    QStringList selectableMailBoxes(Session *session)
+    {
+        if (!m_mailBoxes.isEmpty()) {
+            return m_mailBoxes;
+        }
+        ListJob *list = new ListJob(session);
+        list->setOption(ListJob::IncludeUnsubscribed);
+        QObject::connect(list, &ListJob::resultReceived, [this](const MailBoxDescriptor &descriptor, const QList<QByteArray> &flags) {
+            for (const QByteArray &flag : flags) {
+                if (flag.toLower() == "\\noselect" || flag.toLower() == "\\nonexistent") {
+                    return;
+                }
+            }
+            if (m_mailBoxes.size() < m_options.folders) {
+                m_mailBoxes << descriptor.name;
+            }
+        });
+        if (!list->exec()) {
+            qWarning() << "Listing the mailboxes failed:" << list->errorString();
+        }
+        return m_mailBoxes;
+    }
+
+    static bool select(Session *session, const QString &mailBox, bool readOnly)
+    {
+        SelectJob *select = new SelectJob(session);
+        select->setMailBox(mailBox);
+        select->setOpenReadOnly(readOnly);
+        if (!select->exec()) {
+            qWarning() << "Selecting" << mailBox << "failed:" << select->errorString();
+            return false;
+        }
+        return true;
+    }
+
+    // The UIDs of the newest @p count messages of the selected mailbox
+    static ImapSet lastUids(Session *session, int count)
+    {
+        SearchJob *search = new SearchJob(session);
+        search->setUidBased(true);
+        search->setTerm(Term(Term::All, QString()));
+        if (!search->exec()) {
+            qWarning() << "Searching the messages failed:" << search->errorString();
+            return ImapSet();
+        }
+        QVector<qint64> uids = search->results();
+        std::sort(uids.begin(), uids.end());
+        if (uids.size() > count) {
+            uids.remove(0, uids.size() - count);
+        }
+        ImapSet set;
+        set.add(uids);
+        return set;
+    }
+
+    const Options m_options;
+    QStringList m_mailBoxes;
+    QVector<Measurement> m_measurements;
+};
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("imapbench"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Runs standard workloads against an IMAP server and reports latencies and throughput"));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("server"), QStringLiteral("The server, as host or host:port."));
+    parser.addPositionalArgument(QStringLiteral("user"), QStringLiteral("The user to log in as."));
+    parser.addPositionalArgument(QStringLiteral("password"), QStringLiteral("The password of the user."));
+    const QCommandLineOption workloadsOption(QStringLiteral("workloads"), QStringLiteral("The workloads to run: connect, select, headers, bodies, store, pipeline."),
+                                             QStringLiteral("list"), QStringLiteral("connect,select,headers,bodies,pipeline"));
+    const QCommandLineOption noTlsOption(QStringLiteral("no-tls"), QStringLiteral("Connect without TLS."));
+    const QCommandLineOption connectionsOption(QStringLiteral("connections"), QStringLiteral("The logins of the connect workload."), QStringLiteral("count"), QStringLiteral("10"));
+    const QCommandLineOption foldersOption(QStringLiteral("folders"), QStringLiteral("The mailboxes to select and to request the status of."), QStringLiteral("count"), QStringLiteral("10"));
+    const QCommandLineOption mailBoxOption(QStringLiteral("mailbox"), QStringLiteral("The mailbox to fetch from and to store flags in."), QStringLiteral("name"), QStringLiteral("INBOX"));
+    const QCommandLineOption messagesOption(QStringLiteral("messages"), QStringLiteral("The messages to fetch the headers of."), QStringLiteral("count"), QStringLiteral("1000"));
+    const QCommandLineOption bodiesOption(QStringLiteral("bodies"), QStringLiteral("The messages to download completely."), QStringLiteral("count"), QStringLiteral("100"));
+    const QCommandLineOption storeOption(QStringLiteral("store"), QStringLiteral("The messages to store a keyword on."), QStringLiteral("count"), QStringLiteral("100"));
+    const QCommandLineOption chunkSizeOption(QStringLiteral("chunk-size"), QStringLiteral("The messages fetched with one command."), QStringLiteral("count"), QStringLiteral("100"));
+    const QCommandLineOption depthOption(QStringLiteral("pipeline-depth"), QStringLiteral("The fetch commands in flight when pipelined."), QStringLiteral("count"), QStringLiteral("4"));
+    const QCommandLineOption jsonOption(QStringLiteral("json"), QStringLiteral("Also write the results to a JSON file."), QStringLiteral("file"));
+    parser.addOptions({workloadsOption, noTlsOption, connectionsOption, foldersOption, mailBoxOption, messagesOption,
+                       bodiesOption, storeOption, chunkSizeOption, depthOption, jsonOption});
+    parser.process(app);
+
+    const QStringList arguments = parser.positionalArguments();
+    if (arguments.size() != 3) {
+        parser.showHelp(1);
+    }
+
+    Options options;
+    options.server = arguments.at(0);
+    options.tls = !parser.isSet(noTlsOption);
+    options.port = options.tls ? 993 : 143;
+    if (options.server.count(QLatin1Char(':')) == 1) {
+        options.port = options.server.section(QLatin1Char(':'), 1).toUShort();
+        options.server = options.server.section(QLatin1Char(':'), 0, 0);
+    }
+    options.user = arguments.at(1);
+    options.password = arguments.at(2);
+    options.connections = parser.value(connectionsOption).toInt();
+    options.folders = parser.value(foldersOption).toInt();
+    options.mailBox = parser.value(mailBoxOption);
+    options.messages = parser.value(messagesOption).toInt();
+    options.bodies = parser.value(bodiesOption).toInt();
+    options.store = parser.value(storeOption).toInt();
+    options.chunkSize = parser.value(chunkSizeOption).toInt();
+    options.pipelineDepth = parser.value(depthOption).toInt();
+    const QStringList workloads = parser.value(workloadsOption).split(QLatin1Char(','), QString::SkipEmptyParts);
+
+    Bench bench(options);
+    bool ok = true;
+    if (workloads.contains(QStringLiteral("connect"))) {
+        ok = bench.runConnect() && ok;
+    }
+
+    QString error;
+    QScopedPointer<Session> session(bench.login(&error));
+    if (!session) {
+        qCritical() << "Login failed:" << error;
+        return 1;
+    }
+    if (workloads.contains(QStringLiteral("select"))) {
+        ok = bench.runSelect(session.data()) && ok;
+    }
+    if (workloads.contains(QStringLiteral("headers"))) {
+        ok = bench.runFetch(session.data(), QStringLiteral("headers"), FetchJob::FetchScope::Headers, options.messages, options.pipelineDepth) && ok;
+    }
+    if (workloads.contains(QStringLiteral("bodies"))) {
+        ok = bench.runFetch(session.data(), QStringLiteral("bodies"), FetchJob::FetchScope::Content, options.bodies, options.pipelineDepth) && ok;
+    }
+    if (workloads.contains(QStringLiteral("store"))) {
+        ok = bench.runStore(session.data()) && ok;
+    }
+    if (workloads.contains(QStringLiteral("pipeline"))) {
+        ok = bench.runPipeline(session.data()) && ok;
+    }
+    bench.printCommands(session.data());
+    Bench::logout(session.data());
+
+    if (parser.isSet(jsonOption)) {
+        ok = bench.writeResults(parser.value(jsonOption)) && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,83 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+/*
+ * Runs a LoadServer until it is interrupted, printing its counters every second.
+ *
+ * imaploadserver --messages 100000 --latency 20 --threads 4
+ */
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QTimer>
+
+#include "kimap2test/loadserver.h"
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("imaploadserver"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("An IMAP server for load tests, serving generated mailboxes"));
+    parser.addHelpOption();
+    const QCommandLineOption portOption(QStringLiteral("port"), QStringLiteral("The port to listen on."), QStringLiteral("port"), QStringLiteral("1143"));
+    const QCommandLineOption threadsOption(QStringLiteral("threads"), QStringLiteral("The threads serving the connections."), QStringLiteral("count"), QStringLiteral("1"));
+    const QCommandLineOption mailboxesOption(QStringLiteral("mailboxes"), QStringLiteral("The number of mailboxes."), QStringLiteral("count"), QStringLiteral("1"));
+    const QCommandLineOption messagesOption(QStringLiteral("messages"), QStringLiteral("The messages in every mailbox."), QStringLiteral("count"), QStringLiteral("1000"));
+    const QCommandLineOption bodySizeOption(QStringLiteral("body-size"), QStringLiteral("The size of a message body in bytes."), QStringLiteral("bytes"), QStringLiteral("2048"));
+    const QCommandLineOption multipartOption(QStringLiteral("multipart"), QStringLiteral("Generate multipart messages with an attachment."));
+    const QCommandLineOption newMessagesOption(QStringLiteral("new-message-interval"), QStringLiteral("Add a message to INBOX every interval, 0 for never."), QStringLiteral("ms"), QStringLiteral("0"));
+    const QCommandLineOption latencyOption(QStringLiteral("latency"), QStringLiteral("Hold back every response."), QStringLiteral("ms"), QStringLiteral("0"));
+    const QCommandLineOption bandwidthOption(QStringLiteral("bandwidth"), QStringLiteral("Limit what is sent to each client, 0 for no limit."), QStringLiteral("bytes/s"), QStringLiteral("0"));
+    parser.addOptions({portOption, threadsOption, mailboxesOption, messagesOption, bodySizeOption, multipartOption,
+                       newMessagesOption, latencyOption, bandwidthOption});
+    parser.process(app);
+
+    LoadServer::Options options;
+    options.port = parser.value(portOption).toUShort();
+    options.threads = parser.value(threadsOption).toInt();
+    options.mailboxes = parser.value(mailboxesOption).toInt();
+    options.messages = parser.value(messagesOption).toInt();
+    options.bodySize = parser.value(bodySizeOption).toInt();
+    options.shape = parser.isSet(multipartOption) ? LoadServer::Options::Multipart : LoadServer::Options::Plain;
+    options.newMessageInterval = parser.value(newMessagesOption).toInt();
+    options.latency = parser.value(latencyOption).toInt();
+    options.bandwidth = parser.value(bandwidthOption).toLongLong();
+
+    LoadServer server(options);
+    if (!server.startAndWait()) {
+        return 1;
+    }
+    qInfo() << "Listening on port" << server.port();
+
+    qint64 lastCommands = 0;
+    qint64 lastBytes = 0;
+    QTimer timer;
+    QObject::connect(&timer, &QTimer::timeout, [&]() {
+        const qint64 commands = server.commandCount();
+        const qint64 bytes = server.bytesSent();
+        qInfo().nospace() << server.connectionCount() << " connections, "
+                          << commands - lastCommands << " commands/s, "
+                          << (bytes - lastBytes) / 1024.0 / 1024.0 << " MB/s";
+        lastCommands = commands;
+        lastBytes = bytes;
+    });
+    timer.start(1000);
+
+    return app.exec();
+}